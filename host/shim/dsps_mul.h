@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// esp-dsp's element-wise multiply, portable version
+static inline esp_err_t dsps_mul_s16(const int16_t *input1,
+                                     const int16_t *input2, int16_t *output,
+                                     int len, int step1, int step2,
+                                     int step_out, int shift) {
+  for (int i = 0; i < len; i++) {
+    int32_t v = (int32_t)input1[i * step1] * input2[i * step2];
+    output[i * step_out] = (int16_t)(v >> shift);
+  }
+  return ESP_OK;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Host allocations all count as internal RAM in the per-subsystem usage
+static inline bool esp_ptr_external_ram(const void *p) {
+  (void)p;
+  return false;
+}
+
+static inline bool esp_ptr_internal(const void *p) {
+  (void)p;
+  return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+// FreeRTOS on the simulated scheduler (sim_rtos.c): every task is a thread,
+// but only one runs at a time, picked by priority, and time only moves
+// when all of them are blocked
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint32_t StackType_t;
+
+#define pdTRUE         1
+#define pdFALSE        0
+#define pdPASS         pdTRUE
+#define pdFAIL         pdFALSE
+#define errQUEUE_FULL  0
+#define errQUEUE_EMPTY 0
+#define portMAX_DELAY  ((TickType_t)0xffffffffUL)
+
+#define configTICK_RATE_HZ       CONFIG_FREERTOS_HZ
+#define configMAX_TASK_NAME_LEN  16
+#define configMAX_PRIORITIES     25
+#define portTICK_PERIOD_MS       ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)                                                      \
+  ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000U))
+#define pdTICKS_TO_MS(ticks)                                                   \
+  ((TickType_t)(((uint64_t)(ticks) * 1000U) / configTICK_RATE_HZ))
+
+#define tskIDLE_PRIORITY 0
+#define tskNO_AFFINITY   0x7fffffff
+
+// One task runs at a time, so critical sections have nothing to exclude
+typedef struct {
+  int owner;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux)      ((void)(mux))
+#define portEXIT_CRITICAL(mux)       ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux)  ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux)   ((void)(mux))
+#define taskENTER_CRITICAL(mux)      portENTER_CRITICAL(mux)
+#define taskEXIT_CRITICAL(mux)       portEXIT_CRITICAL(mux)
+#define portYIELD_FROM_ISR(x)        ((void)(x))
+
+static inline BaseType_t xPortInIsrContext(void) {
+  return pdFALSE;
+}
+
+static inline BaseType_t xPortGetCoreID(void) {
+  return 0;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "freertos/task.h"
+
+// Stacks come from the host heap either way; caps only matter on target
+static inline BaseType_t xTaskCreatePinnedToCoreWithCaps(
+    TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+    UBaseType_t priority, TaskHandle_t *out_handle, BaseType_t core,
+    uint32_t caps) {
+  (void)caps;
+  return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority,
+                                 out_handle, core);
+}
+
+static inline void vTaskDeleteWithCaps(TaskHandle_t task) {
+  vTaskDelete(task);
+}
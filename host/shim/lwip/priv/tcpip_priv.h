@@ -0,0 +1,12 @@
+#pragma once
+
+#include "lwip/udp.h"
+
+// There is no tcpip thread: the call runs on the caller's task
+struct tcpip_api_call_data {
+  int unused;
+};
+
+typedef err_t (*tcpip_api_call_fn)(struct tcpip_api_call_data *call);
+
+err_t tcpip_api_call(tcpip_api_call_fn fn, struct tcpip_api_call_data *call);
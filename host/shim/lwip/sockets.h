@@ -0,0 +1,12 @@
+#pragma once
+
+// The host socket API; the calls go to the virtual network (sim_net.c)
+// through the linker's --wrap
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
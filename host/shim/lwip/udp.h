@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "lwip/pbuf.h"
+
+// Just enough of the raw UDP API for ptp_clock.c; datagrams for a bound
+// port are handed to its callback by sim_net_deliver()
+
+typedef uint8_t u8_t;
+typedef uint16_t u16_t;
+typedef uint32_t u32_t;
+typedef int8_t err_t;
+
+#define ERR_OK   0
+#define ERR_MEM  -1
+#define ERR_BUF  -2
+#define ERR_USE  -8
+#define ERR_ARG  -16
+
+typedef struct {
+  uint32_t addr; // Network byte order
+} ip4_addr_t;
+
+typedef struct {
+  ip4_addr_t u_addr_ip4;
+  uint8_t type;
+} ip_addr_t;
+
+#define IPADDR_TYPE_V4 0
+
+extern const ip_addr_t sim_ip_addr_any;
+#define IP4_ADDR_ANY  (&sim_ip_addr_any)
+#define IP4_ADDR_ANY4 (&sim_ip_addr_any.u_addr_ip4)
+
+#define ip_2_ip4(ipaddr)        (&((ipaddr)->u_addr_ip4))
+#define ip4_addr_get_u32(ip4)   ((ip4)->addr)
+#define ip_set_option(pcb, opt) ((void)(pcb), (void)(opt))
+#define SOF_REUSEADDR           0x04
+
+int ip4addr_aton(const char *cp, ip4_addr_t *addr);
+
+struct udp_pcb;
+typedef void (*udp_recv_fn)(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+                            const ip_addr_t *addr, u16_t port);
+
+struct udp_pcb *udp_new_ip_type(u8_t type);
+err_t udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port);
+void udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg);
+void udp_remove(struct udp_pcb *pcb);
@@ -0,0 +1,57 @@
+#pragma once
+
+// Host build of the audio pipeline: the Kconfig defaults of the modules it
+// compiles, for a PSRAM board streaming through the resampler backend.
+// CMake may add -DCONFIG_IDF_TARGET_ESP32S3=1 (SIM_TARGET_S3).
+
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+
+#define CONFIG_AUDIO_COMPRESSED_BUFFER 1
+#if CONFIG_IDF_TARGET_ESP32S3
+#define CONFIG_AUDIO_COMPRESSED_BUFFER_KB 4096
+#else
+#define CONFIG_AUDIO_COMPRESSED_BUFFER_KB 1536
+#endif
+#define CONFIG_AUDIO_ADAPTIVE_DEPTH 1
+#define CONFIG_AUDIO_FAST_START 1
+#define CONFIG_AUDIO_FAST_START_FRAMES 8
+#define CONFIG_AUDIO_DECODE_QUEUE_PACKETS 16
+#define CONFIG_AUDIO_WARM_GRACE_S 15
+#define CONFIG_AUDIO_DRIFT_RESAMPLE 1
+#define CONFIG_AUDIO_OUTPUT_DMA_BUFFERS 8
+
+// The simulator provides the trace hooks itself (sim_trace.c)
+#define CONFIG_AUDIO_TRACE 1
+
+#define CONFIG_MEM_INTERNAL_RESERVE_KB 96
+#define CONFIG_MEM_PSRAM_RESERVE_KB 256
+
+#define CONFIG_NET_REALTIME_DSCP 48
+
+// Recommended task layout (task_placement.c)
+#define CONFIG_TASK_LAYOUT_RECOMMENDED 1
+#define CONFIG_TASK_AUDIO_RECV_CORE 0
+#define CONFIG_TASK_AUDIO_RECV_PRIORITY 8
+#define CONFIG_TASK_AUDIO_RECV_STACK 4096
+#define CONFIG_TASK_AUDIO_CTRL_CORE 0
+#define CONFIG_TASK_AUDIO_CTRL_PRIORITY 7
+#define CONFIG_TASK_AUDIO_CTRL_STACK 8192
+#define CONFIG_TASK_AUDIO_DECODE_CORE 1
+#define CONFIG_TASK_AUDIO_DECODE_PRIORITY 6
+#define CONFIG_TASK_AUDIO_DECODE_STACK 12288
+#define CONFIG_TASK_AUDIO_PLAY_CORE 1
+#define CONFIG_TASK_AUDIO_PLAY_PRIORITY 7
+#define CONFIG_TASK_AUDIO_PLAY_STACK 4096
+#define CONFIG_TASK_AUDIO_BUFFERED_CORE 1
+#define CONFIG_TASK_AUDIO_BUFFERED_PRIORITY 5
+#define CONFIG_TASK_AUDIO_BUFFERED_STACK 4096
+#define CONFIG_TASK_EVENT_PORT_CORE 0
+#define CONFIG_TASK_EVENT_PORT_PRIORITY 5
+#define CONFIG_TASK_EVENT_PORT_STACK 3072
+#define CONFIG_TASK_PTP_CORE 0
+#define CONFIG_TASK_PTP_PRIORITY 4
+#define CONFIG_TASK_PTP_STACK 4096
+#define CONFIG_TASK_NTP_CORE 0
+#define CONFIG_TASK_NTP_PRIORITY 5
+#define CONFIG_TASK_NTP_STACK 3072
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Simulation core shared by the shims and the harness.
+ *
+ * Time is virtual: it only advances when every task is blocked, straight to
+ * the earliest wake-up, so a run is reproducible for a given seed and as
+ * fast as the CPU allows. Tasks run one at a time by FreeRTOS priority.
+ */
+
+/* ---------- scheduler (sim_rtos.c) ---------- */
+
+/** Simulated microseconds since boot (what esp_timer_get_time() returns). */
+int64_t sim_now_us(void);
+
+/**
+ * Run main_fn as the first task and schedule until sim_stop() is called or
+ * nothing is left to run before end_us.
+ */
+void sim_run(void (*main_fn)(void *arg), void *arg, int64_t end_us);
+
+/** Stop the scheduler once the calling task blocks. */
+void sim_stop(void);
+
+/** Block the calling task until the given time. */
+void sim_sleep_until(int64_t when_us);
+
+/** Tasks blocked on something, in wake-up order. */
+typedef struct sim_waitq {
+  struct sim_task *head;
+} sim_waitq_t;
+
+/**
+ * Block the calling task on q for at most timeout_us (negative: forever).
+ * @return false on timeout
+ */
+bool sim_wait(sim_waitq_t *q, int64_t timeout_us);
+
+/** Make the first (or every) waiter ready; may switch to it. */
+void sim_wake_one(sim_waitq_t *q);
+void sim_wake_all(sim_waitq_t *q);
+
+/** Context switches so far, for the report. */
+uint64_t sim_switches(void);
+
+/* ---------- network (sim_net.c) ---------- */
+
+/**
+ * Hand a datagram to whatever is bound to dst_port: a raw UDP PCB gets its
+ * callback run at once, a socket queues it. Addresses in host byte order.
+ * @return false if nothing is bound there
+ */
+bool sim_net_deliver(uint16_t dst_port, uint32_t src_ip, uint16_t src_port,
+                     const uint8_t *data, size_t len);
+
+/** Something the receiver sent, seen by the harness (host byte order). */
+typedef void (*sim_net_tx_fn)(uint16_t src_port, uint32_t dst_ip,
+                              uint16_t dst_port, const uint8_t *data,
+                              size_t len);
+
+void sim_net_set_tx_hook(sim_net_tx_fn fn);
+
+/** Datagrams dropped on full socket queues (the lwIP mailbox). */
+uint32_t sim_net_overflows(void);
+
+/* ---------- trace (sim_trace.c) ---------- */
+
+/** Called when the receiver takes a frame for playout. */
+typedef void (*sim_dequeue_fn)(uint32_t rtp_timestamp);
+
+void sim_trace_set_dequeue_hook(sim_dequeue_fn fn);
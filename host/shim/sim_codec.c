@@ -0,0 +1,144 @@
+// Stand-ins for audio_decoder.c and audio_crypto.c: the simulator measures
+// timing, not audio, so payloads pass through in the clear and every frame
+// decodes to silence of the stream's frame size (L16 is unpacked as is)
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_crypto.h"
+#include "audio_decoder.h"
+
+#define DEFAULT_FRAME_SIZE 352
+
+typedef enum {
+  SIM_DECODER_NONE,
+  SIM_DECODER_PCM,
+  SIM_DECODER_ALAC,
+  SIM_DECODER_AAC,
+} sim_decoder_kind_t;
+
+struct audio_decoder {
+  audio_format_t format;
+  sim_decoder_kind_t kind;
+};
+
+// The same codec names the real decoder tells apart; like it, AAC-ELD is
+// refused
+static sim_decoder_kind_t kind_of(const char *codec) {
+  if (strcmp(codec, "AppleLossless") == 0 || strcmp(codec, "ALAC") == 0) {
+    return SIM_DECODER_ALAC;
+  }
+  if (strstr(codec, "ELD") || strstr(codec, "eld")) {
+    return SIM_DECODER_NONE;
+  }
+  if (strstr(codec, "AAC") || strstr(codec, "aac") ||
+      strstr(codec, "mpeg4-generic")) {
+    return SIM_DECODER_AAC;
+  }
+  return SIM_DECODER_PCM;
+}
+
+audio_decoder_t *audio_decoder_create(const audio_decoder_config_t *config) {
+  if (!config) {
+    return NULL;
+  }
+  audio_decoder_t *decoder = calloc(1, sizeof(*decoder));
+  if (!decoder) {
+    return NULL;
+  }
+  decoder->format = config->format;
+  decoder->kind = kind_of(config->format.codec);
+  return decoder;
+}
+
+void audio_decoder_destroy(audio_decoder_t *decoder) {
+  free(decoder);
+}
+
+bool audio_decoder_matches(const audio_decoder_t *decoder,
+                           const audio_format_t *format) {
+  return decoder && format &&
+         memcmp(&decoder->format, format, sizeof(*format)) == 0;
+}
+
+int audio_decoder_decode(audio_decoder_t *decoder, const uint8_t *input,
+                         size_t input_len, int16_t *output,
+                         size_t output_capacity_samples,
+                         audio_decode_info_t *info) {
+  if (!decoder || !input || !output || output_capacity_samples == 0 ||
+      decoder->kind == SIM_DECODER_NONE) {
+    return -1;
+  }
+  int channels = decoder->format.channels > 0 ? decoder->format.channels : 2;
+
+  size_t samples;
+  if (decoder->kind == SIM_DECODER_PCM) {
+    samples = input_len / (channels * sizeof(int16_t));
+  } else {
+    samples = decoder->format.frame_size > 0 ? decoder->format.frame_size
+                                             : DEFAULT_FRAME_SIZE;
+  }
+  if (samples > output_capacity_samples) {
+    samples = output_capacity_samples;
+  }
+  if (decoder->kind == SIM_DECODER_PCM) {
+    for (size_t i = 0; i < samples * channels; i++) {
+      output[i] = (int16_t)((input[2 * i] << 8) | input[2 * i + 1]);
+    }
+  } else {
+    memset(output, 0, samples * channels * sizeof(int16_t));
+  }
+
+  if (info) {
+    info->channels = channels;
+  }
+  return samples > 0 ? (int)samples : -1;
+}
+
+bool audio_decoder_is_aac(const audio_decoder_t *decoder) {
+  return decoder && decoder->kind == SIM_DECODER_AAC;
+}
+
+bool audio_decoder_is_alac(const audio_decoder_t *decoder) {
+  return decoder && decoder->kind == SIM_DECODER_ALAC;
+}
+
+void audio_crypto_prepare(audio_encrypt_t *encrypt) {
+  if (encrypt) {
+    encrypt->aes_ready = true;
+  }
+}
+
+void audio_crypto_release(audio_encrypt_t *encrypt) {
+  if (encrypt) {
+    encrypt->aes_ready = false;
+  }
+}
+
+int audio_crypto_decrypt_rtp(audio_encrypt_t *encrypt, const uint8_t *input,
+                             size_t input_len, uint8_t *output,
+                             size_t output_capacity,
+                             const uint8_t *full_packet,
+                             size_t full_packet_len) {
+  (void)encrypt;
+  (void)full_packet;
+  (void)full_packet_len;
+  if (input_len > output_capacity) {
+    return -1;
+  }
+  if (output != input) {
+    memmove(output, input, input_len);
+  }
+  return (int)input_len;
+}
+
+int audio_crypto_decrypt_buffered(const audio_encrypt_t *encrypt,
+                                  const uint8_t *packet, size_t packet_len,
+                                  uint8_t *output, size_t output_capacity) {
+  (void)encrypt;
+  if (packet_len < 12 || packet_len - 12 > output_capacity) {
+    return -1;
+  }
+  memmove(output, packet + 12, packet_len - 12);
+  return (int)(packet_len - 12);
+}
@@ -0,0 +1,434 @@
+#include "sim.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/igmp.h"
+#include "lwip/priv/tcpip_priv.h"
+#include "lwip/sockets.h"
+#include "lwip/udp.h"
+
+// Virtual descriptors live above anything the host hands out, and are
+// never reused, so a task still blocked on a closed one only sees EBADF
+#define FD_BASE        64
+#define FD_LIMIT       FD_SETSIZE
+#define RX_DEPTH       32   // CONFIG_LWIP_UDP_RECVMBOX_SIZE
+#define DGRAM_MAX      2048
+#define EPHEMERAL_BASE 49152
+
+typedef struct {
+  uint32_t src_ip;
+  uint16_t src_port;
+  uint16_t len;
+  uint8_t data[DGRAM_MAX];
+} dgram_t;
+
+typedef struct {
+  int type;
+  bool open;
+  uint16_t port; // 0 until bound
+  bool nonblocking;
+  int64_t rcvtimeo_us; // 0 blocks forever
+  dgram_t *rx;
+  unsigned rx_head;
+  unsigned rx_count;
+  sim_waitq_t readers;
+} vsock_t;
+
+struct udp_pcb {
+  bool used;
+  uint16_t port;
+  udp_recv_fn recv;
+  void *recv_arg;
+};
+
+static vsock_t socks[FD_LIMIT - FD_BASE];
+static int next_fd = FD_BASE;
+static uint16_t next_ephemeral = EPHEMERAL_BASE;
+static sim_waitq_t select_q;
+static struct udp_pcb pcbs[4];
+static sim_net_tx_fn tx_hook;
+static uint32_t overflows;
+
+const ip_addr_t sim_ip_addr_any;
+
+// The real calls, for descriptors that are not ours (stdio, files)
+int __real_close(int fd);
+int __real_fcntl(int fd, int cmd, ...);
+
+static vsock_t *vsock(int fd) {
+  if (fd < FD_BASE || fd >= next_fd) {
+    return NULL;
+  }
+  return &socks[fd - FD_BASE];
+}
+
+static vsock_t *open_vsock(int fd) {
+  vsock_t *s = vsock(fd);
+  if (!s || !s->open) {
+    errno = EBADF;
+    return NULL;
+  }
+  return s;
+}
+
+static bool port_in_use(uint16_t port) {
+  for (int fd = FD_BASE; fd < next_fd; fd++) {
+    vsock_t *s = vsock(fd);
+    if (s->open && s->port == port) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void sim_net_set_tx_hook(sim_net_tx_fn fn) {
+  tx_hook = fn;
+}
+
+uint32_t sim_net_overflows(void) {
+  return overflows;
+}
+
+bool sim_net_deliver(uint16_t dst_port, uint32_t src_ip, uint16_t src_port,
+                     const uint8_t *data, size_t len) {
+  if (len > DGRAM_MAX) {
+    return false;
+  }
+
+  for (size_t i = 0; i < sizeof(pcbs) / sizeof(pcbs[0]); i++) {
+    struct udp_pcb *pcb = &pcbs[i];
+    if (pcb->used && pcb->port == dst_port && pcb->recv) {
+      struct pbuf *p = malloc(sizeof(*p) + len);
+      if (!p) {
+        return false;
+      }
+      p->next = NULL;
+      p->payload = p + 1;
+      p->tot_len = p->len = (uint16_t)len;
+      memcpy(p->payload, data, len);
+      ip_addr_t addr = {.u_addr_ip4 = {.addr = htonl(src_ip)}};
+      pcb->recv(pcb->recv_arg, pcb, p, &addr, src_port); // Frees p
+      return true;
+    }
+  }
+
+  for (int fd = FD_BASE; fd < next_fd; fd++) {
+    vsock_t *s = vsock(fd);
+    if (!s->open || s->type != SOCK_DGRAM || s->port != dst_port) {
+      continue;
+    }
+    if (s->rx_count == RX_DEPTH) {
+      overflows++; // Mailbox full: lwIP drops it too
+      return true;
+    }
+    dgram_t *d = &s->rx[(s->rx_head + s->rx_count) % RX_DEPTH];
+    d->src_ip = src_ip;
+    d->src_port = src_port;
+    d->len = (uint16_t)len;
+    memcpy(d->data, data, len);
+    s->rx_count++;
+    sim_wake_all(&select_q);
+    sim_wake_one(&s->readers);
+    return true;
+  }
+  return false;
+}
+
+/* ---------- BSD sockets (linked with --wrap) ---------- */
+
+int __wrap_socket(int domain, int type, int protocol) {
+  (void)domain;
+  (void)protocol;
+  if (next_fd >= FD_LIMIT) {
+    errno = EMFILE;
+    return -1;
+  }
+  vsock_t *s = &socks[next_fd - FD_BASE];
+  memset(s, 0, sizeof(*s));
+  s->type = type;
+  if (type == SOCK_DGRAM) {
+    s->rx = calloc(RX_DEPTH, sizeof(dgram_t));
+    if (!s->rx) {
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+  s->open = true;
+  return next_fd++;
+}
+
+int __wrap_bind(int fd, const struct sockaddr *addr, socklen_t len) {
+  vsock_t *s = open_vsock(fd);
+  if (!s) {
+    return -1;
+  }
+  if (!addr || len < sizeof(struct sockaddr_in)) {
+    errno = EINVAL;
+    return -1;
+  }
+  uint16_t port = ntohs(((const struct sockaddr_in *)addr)->sin_port);
+  if (port == 0) {
+    while (port_in_use(next_ephemeral)) {
+      next_ephemeral++;
+    }
+    port = next_ephemeral++;
+  } else if (port_in_use(port)) {
+    errno = EADDRINUSE;
+    return -1;
+  }
+  s->port = port;
+  return 0;
+}
+
+int __wrap_getsockname(int fd, struct sockaddr *addr, socklen_t *len) {
+  vsock_t *s = open_vsock(fd);
+  if (!s) {
+    return -1;
+  }
+  struct sockaddr_in in = {.sin_family = AF_INET, .sin_port = htons(s->port)};
+  size_t n = *len < sizeof(in) ? *len : sizeof(in);
+  memcpy(addr, &in, n);
+  *len = sizeof(in);
+  return 0;
+}
+
+int __wrap_setsockopt(int fd, int level, int name, const void *value,
+                      socklen_t len) {
+  vsock_t *s = open_vsock(fd);
+  if (!s) {
+    return -1;
+  }
+  if (level == SOL_SOCKET && name == SO_RCVTIMEO &&
+      len >= sizeof(struct timeval)) {
+    const struct timeval *tv = value;
+    s->rcvtimeo_us = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+  }
+  return 0; // Buffer sizes, TOS and reuse have nothing to configure
+}
+
+int __wrap_listen(int fd, int backlog) {
+  (void)backlog;
+  return open_vsock(fd) ? 0 : -1;
+}
+
+int __wrap_fcntl(int fd, int cmd, ...) {
+  va_list args;
+  va_start(args, cmd);
+  long arg = va_arg(args, long);
+  va_end(args);
+
+  vsock_t *s = vsock(fd);
+  if (!s) {
+    return __real_fcntl(fd, cmd, arg);
+  }
+  if (!s->open) {
+    errno = EBADF;
+    return -1;
+  }
+  if (cmd == F_GETFL) {
+    return s->nonblocking ? O_NONBLOCK : 0;
+  }
+  if (cmd == F_SETFL) {
+    s->nonblocking = (arg & O_NONBLOCK) != 0;
+  }
+  return 0;
+}
+
+// Wait for a datagram; false with errno set on timeout or close
+static bool wait_readable(vsock_t *s, bool nonblocking) {
+  int64_t deadline = s->rcvtimeo_us ? sim_now_us() + s->rcvtimeo_us : -1;
+  while (s->open && s->rx_count == 0) {
+    int64_t left = deadline < 0 ? -1 : deadline - sim_now_us();
+    if (nonblocking || (deadline >= 0 && left <= 0) ||
+        !sim_wait(&s->readers, left)) {
+      errno = EAGAIN;
+      return false;
+    }
+  }
+  if (!s->open) {
+    errno = EBADF;
+    return false;
+  }
+  return true;
+}
+
+ssize_t __wrap_recvfrom(int fd, void *buf, size_t len, int flags,
+                        struct sockaddr *addr, socklen_t *addr_len) {
+  vsock_t *s = open_vsock(fd);
+  if (!s) {
+    return -1;
+  }
+  if (s->type != SOCK_DGRAM) {
+    errno = ENOTCONN;
+    return -1;
+  }
+  if (!wait_readable(s, s->nonblocking || (flags & MSG_DONTWAIT))) {
+    return -1;
+  }
+
+  dgram_t *d = &s->rx[s->rx_head];
+  size_t n = d->len < len ? d->len : len;
+  memcpy(buf, d->data, n);
+  if (addr && addr_len) {
+    struct sockaddr_in in = {.sin_family = AF_INET,
+                             .sin_port = htons(d->src_port),
+                             .sin_addr.s_addr = htonl(d->src_ip)};
+    size_t a = *addr_len < sizeof(in) ? *addr_len : sizeof(in);
+    memcpy(addr, &in, a);
+    *addr_len = sizeof(in);
+  }
+  s->rx_head = (s->rx_head + 1) % RX_DEPTH;
+  s->rx_count--;
+  return (ssize_t)n;
+}
+
+ssize_t __wrap_recv(int fd, void *buf, size_t len, int flags) {
+  return __wrap_recvfrom(fd, buf, len, flags, NULL, NULL);
+}
+
+// No TCP peer ever connects: buffered streams are not replayed
+int __wrap_accept(int fd, struct sockaddr *addr, socklen_t *addr_len) {
+  (void)addr;
+  (void)addr_len;
+  vsock_t *s = open_vsock(fd);
+  if (!s) {
+    return -1;
+  }
+  wait_readable(s, s->nonblocking);
+  return -1;
+}
+
+ssize_t __wrap_sendto(int fd, const void *buf, size_t len, int flags,
+                      const struct sockaddr *addr, socklen_t addr_len) {
+  (void)flags;
+  vsock_t *s = open_vsock(fd);
+  if (!s) {
+    return -1;
+  }
+  if (!addr || addr_len < sizeof(struct sockaddr_in)) {
+    errno = EDESTADDRREQ;
+    return -1;
+  }
+  const struct sockaddr_in *to = (const struct sockaddr_in *)addr;
+  if (tx_hook) {
+    tx_hook(s->port, ntohl(to->sin_addr.s_addr), ntohs(to->sin_port), buf,
+            len);
+  }
+  return (ssize_t)len;
+}
+
+int __wrap_select(int nfds, fd_set *readfds, fd_set *writefds,
+                  fd_set *exceptfds, struct timeval *timeout) {
+  (void)writefds;
+  (void)exceptfds;
+  int64_t deadline =
+      timeout ? sim_now_us() + (int64_t)timeout->tv_sec * 1000000 +
+                    timeout->tv_usec
+              : -1;
+  for (;;) {
+    fd_set ready;
+    FD_ZERO(&ready);
+    int count = 0;
+    for (int fd = FD_BASE; fd < nfds && readfds; fd++) {
+      vsock_t *s = vsock(fd);
+      if (s && FD_ISSET(fd, readfds) && (!s->open || s->rx_count > 0)) {
+        FD_SET(fd, &ready);
+        count++;
+      }
+    }
+    if (count > 0 || (deadline >= 0 && sim_now_us() >= deadline)) {
+      if (readfds) {
+        *readfds = ready;
+      }
+      return count;
+    }
+    sim_wait(&select_q, deadline < 0 ? -1 : deadline - sim_now_us());
+  }
+}
+
+int __wrap_close(int fd) {
+  vsock_t *s = vsock(fd);
+  if (!s) {
+    return __real_close(fd);
+  }
+  if (!s->open) {
+    errno = EBADF;
+    return -1;
+  }
+  s->open = false;
+  sim_wake_all(&s->readers);
+  sim_wake_all(&select_q);
+  return 0;
+}
+
+/* ---------- lwIP raw API (ptp_clock.c) ---------- */
+
+int ip4addr_aton(const char *cp, ip4_addr_t *addr) {
+  struct in_addr in;
+  if (!inet_aton(cp, &in)) {
+    return 0;
+  }
+  addr->addr = in.s_addr;
+  return 1;
+}
+
+struct udp_pcb *udp_new_ip_type(u8_t type) {
+  (void)type;
+  for (size_t i = 0; i < sizeof(pcbs) / sizeof(pcbs[0]); i++) {
+    if (!pcbs[i].used) {
+      memset(&pcbs[i], 0, sizeof(pcbs[i]));
+      pcbs[i].used = true;
+      return &pcbs[i];
+    }
+  }
+  return NULL;
+}
+
+err_t udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port) {
+  (void)ipaddr;
+  pcb->port = port;
+  return ERR_OK;
+}
+
+void udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg) {
+  pcb->recv = recv;
+  pcb->recv_arg = recv_arg;
+}
+
+void udp_remove(struct udp_pcb *pcb) {
+  pcb->used = false;
+}
+
+u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len,
+                        u16_t offset) {
+  if (offset >= p->len) {
+    return 0;
+  }
+  u16_t n = p->len - offset < len ? p->len - offset : len;
+  memcpy(dataptr, (const uint8_t *)p->payload + offset, n);
+  return n;
+}
+
+uint8_t pbuf_free(struct pbuf *p) {
+  free(p);
+  return 1;
+}
+
+err_t igmp_joingroup(const ip4_addr_t *ifaddr, const ip4_addr_t *groupaddr) {
+  (void)ifaddr;
+  (void)groupaddr;
+  return ERR_OK;
+}
+
+err_t igmp_leavegroup(const ip4_addr_t *ifaddr, const ip4_addr_t *groupaddr) {
+  (void)ifaddr;
+  (void)groupaddr;
+  return ERR_OK;
+}
+
+err_t tcpip_api_call(tcpip_api_call_fn fn, struct tcpip_api_call_data *call) {
+  return fn(call);
+}
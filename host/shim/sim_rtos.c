@@ -0,0 +1,654 @@
+#include "sim.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#define BOOT_US         500000 // esp_timer already runs when app_main starts
+#define TICK_US         (1000000 / configTICK_RATE_HZ)
+#define TASK_STACK      (1024 * 1024) // Host frames, not the target's
+#define TIMER_PRIORITY  22 // The esp_timer task
+#define NO_WAKE         INT64_MAX
+
+typedef enum {
+  TASK_READY,
+  TASK_BLOCKED,
+  TASK_DONE,
+} task_state_t;
+
+struct sim_task {
+  pthread_t thread;
+  pthread_cond_t turn; // Signalled when the task is given the baton
+  char name[configMAX_TASK_NAME_LEN];
+  TaskFunction_t fn;
+  void *arg;
+  UBaseType_t priority;
+  uint32_t stack_depth;
+  task_state_t state;
+  uint64_t ready_seq; // FIFO order among ready tasks of one priority
+  int64_t wake_us;    // Timeout while blocked, NO_WAKE for none
+  bool timed_out;
+  sim_waitq_t *waitq;
+  struct sim_task *wait_next;
+  uint32_t notify;
+  sim_waitq_t notify_q;
+  struct sim_task *next; // All tasks, in creation order
+};
+
+// The baton: whoever holds big and is `running` executes, everyone else
+// waits on their condition. NULL means the scheduler (main thread) has it.
+static pthread_mutex_t big = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sched_turn = PTHREAD_COND_INITIALIZER;
+static struct sim_task *running;
+static struct sim_task *tasks;
+static struct sim_task *tasks_tail;
+static int64_t now_us = BOOT_US;
+static uint64_t ready_seq;
+static uint64_t switches;
+static bool stopping;
+
+int64_t sim_now_us(void) {
+  return now_us;
+}
+
+uint64_t sim_switches(void) {
+  return switches;
+}
+
+void sim_stop(void) {
+  stopping = true;
+}
+
+/* ---------- scheduling ---------- */
+
+// Hand the baton back to the scheduler and wait to be picked again
+static void switch_out(struct sim_task *self) {
+  running = NULL;
+  pthread_cond_signal(&sched_turn);
+  while (running != self) {
+    pthread_cond_wait(&self->turn, &big);
+  }
+}
+
+static void run_task(struct sim_task *t) {
+  running = t;
+  switches++;
+  pthread_cond_signal(&t->turn);
+  while (running != NULL) {
+    pthread_cond_wait(&sched_turn, &big);
+  }
+}
+
+static void waitq_remove(struct sim_task *t) {
+  if (!t->waitq) {
+    return;
+  }
+  struct sim_task **link = &t->waitq->head;
+  while (*link && *link != t) {
+    link = &(*link)->wait_next;
+  }
+  if (*link) {
+    *link = t->wait_next;
+  }
+  t->waitq = NULL;
+  t->wait_next = NULL;
+}
+
+// Highest priority first, FIFO within one, as xEventList orders waiters
+static void waitq_insert(sim_waitq_t *q, struct sim_task *t) {
+  struct sim_task **link = &q->head;
+  while (*link && (*link)->priority >= t->priority) {
+    link = &(*link)->wait_next;
+  }
+  t->wait_next = *link;
+  *link = t;
+  t->waitq = q;
+}
+
+static void make_ready(struct sim_task *t) {
+  waitq_remove(t);
+  t->state = TASK_READY;
+  t->wake_us = NO_WAKE;
+  t->ready_seq = ++ready_seq;
+}
+
+// Waking a higher priority task preempts the caller, which stays at the
+// head of its own priority
+static void preempt_for(struct sim_task *t) {
+  struct sim_task *self = running;
+  if (self && t->priority > self->priority) {
+    self->state = TASK_READY;
+    switch_out(self);
+  }
+}
+
+static struct sim_task *pick_ready(void) {
+  struct sim_task *best = NULL;
+  for (struct sim_task *t = tasks; t; t = t->next) {
+    if (t->state != TASK_READY) {
+      continue;
+    }
+    if (!best || t->priority > best->priority ||
+        (t->priority == best->priority && t->ready_seq < best->ready_seq)) {
+      best = t;
+    }
+  }
+  return best;
+}
+
+static int64_t earliest_wake(void) {
+  int64_t next = NO_WAKE;
+  for (struct sim_task *t = tasks; t; t = t->next) {
+    if (t->state == TASK_BLOCKED && t->wake_us < next) {
+      next = t->wake_us;
+    }
+  }
+  return next;
+}
+
+static void expire_timeouts(void) {
+  for (struct sim_task *t = tasks; t; t = t->next) {
+    if (t->state == TASK_BLOCKED && t->wake_us <= now_us) {
+      make_ready(t);
+      t->timed_out = true;
+    }
+  }
+}
+
+bool sim_wait(sim_waitq_t *q, int64_t timeout_us) {
+  struct sim_task *self = running;
+  if (timeout_us == 0 || !self) {
+    return false;
+  }
+  self->state = TASK_BLOCKED;
+  self->timed_out = false;
+  self->wake_us = timeout_us < 0 ? NO_WAKE : now_us + timeout_us;
+  if (q) {
+    waitq_insert(q, self);
+  }
+  switch_out(self);
+  return !self->timed_out;
+}
+
+void sim_wake_one(sim_waitq_t *q) {
+  struct sim_task *t = q->head;
+  if (t) {
+    make_ready(t);
+    preempt_for(t);
+  }
+}
+
+void sim_wake_all(sim_waitq_t *q) {
+  struct sim_task *top = NULL;
+  while (q->head) {
+    struct sim_task *t = q->head;
+    make_ready(t);
+    if (!top || t->priority > top->priority) {
+      top = t;
+    }
+  }
+  if (top) {
+    preempt_for(top);
+  }
+}
+
+void sim_sleep_until(int64_t when_us) {
+  if (when_us > now_us) {
+    sim_wait(NULL, when_us - now_us);
+  }
+}
+
+// FreeRTOS timeouts expire on a tick interrupt
+static int64_t tick_deadline(TickType_t ticks) {
+  if (ticks == portMAX_DELAY) {
+    return NO_WAKE;
+  }
+  return (now_us / TICK_US + ticks) * TICK_US;
+}
+
+static bool wait_until(sim_waitq_t *q, int64_t deadline) {
+  if (deadline == NO_WAKE) {
+    return sim_wait(q, -1);
+  }
+  if (deadline <= now_us) {
+    return false;
+  }
+  return sim_wait(q, deadline - now_us);
+}
+
+/* ---------- tasks ---------- */
+
+static void task_exit(struct sim_task *self) {
+  self->state = TASK_DONE;
+  running = NULL;
+  pthread_cond_signal(&sched_turn);
+  pthread_mutex_unlock(&big);
+  pthread_exit(NULL);
+}
+
+static void *task_thread(void *arg) {
+  struct sim_task *t = arg;
+  pthread_mutex_lock(&big);
+  while (running != t) {
+    pthread_cond_wait(&t->turn, &big);
+  }
+  t->fn(t->arg);
+  task_exit(t); // FreeRTOS asserts here; treat it as vTaskDelete(NULL)
+  return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                   uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority,
+                                   TaskHandle_t *out_handle, BaseType_t core) {
+  (void)core;
+  struct sim_task *t = calloc(1, sizeof(*t));
+  if (!t) {
+    return pdFAIL;
+  }
+  snprintf(t->name, sizeof(t->name), "%s", name ? name : "");
+  t->fn = fn;
+  t->arg = arg;
+  t->priority = priority;
+  t->stack_depth = stack_depth;
+  pthread_cond_init(&t->turn, NULL);
+  make_ready(t);
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, TASK_STACK);
+  int err = pthread_create(&t->thread, &attr, task_thread, t);
+  pthread_attr_destroy(&attr);
+  if (err != 0) {
+    free(t);
+    return pdFAIL;
+  }
+  pthread_detach(t->thread);
+
+  if (tasks_tail) {
+    tasks_tail->next = t;
+  } else {
+    tasks = t;
+  }
+  tasks_tail = t;
+  if (out_handle) {
+    *out_handle = t;
+  }
+  preempt_for(t);
+  return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name,
+                       uint32_t stack_depth, void *arg, UBaseType_t priority,
+                       TaskHandle_t *out_handle) {
+  return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority,
+                                 out_handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  if (!task || task == running) {
+    task_exit(running);
+  }
+  // The thread stays parked; the handle remains valid memory
+  waitq_remove(task);
+  task->state = TASK_DONE;
+}
+
+void vTaskDelay(TickType_t ticks) {
+  if (ticks == 0) {
+    taskYIELD();
+    return;
+  }
+  wait_until(NULL, tick_deadline(ticks));
+}
+
+void taskYIELD(void) {
+  struct sim_task *self = running;
+  self->ready_seq = ++ready_seq; // Behind the others of its priority
+  switch_out(self);
+}
+
+TickType_t xTaskGetTickCount(void) {
+  return (TickType_t)(now_us / TICK_US);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+  return running;
+}
+
+const char *pcTaskGetName(TaskHandle_t task) {
+  task = task ? task : running;
+  return task ? task->name : "";
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+  task = task ? task : running;
+  return task->priority;
+}
+
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority) {
+  task = task ? task : running;
+  task->priority = priority;
+  if (running && task != running && task->state == TASK_READY) {
+    preempt_for(task);
+  }
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+  task = task ? task : running;
+  return task->stack_depth; // Not tracked on the host
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks) {
+  struct sim_task *self = running;
+  int64_t deadline = tick_deadline(ticks);
+  while (self->notify == 0 && ticks != 0) {
+    if (!wait_until(&self->notify_q, deadline)) {
+      break;
+    }
+  }
+  uint32_t value = self->notify;
+  if (value) {
+    self->notify = clear_on_exit ? 0 : value - 1;
+  }
+  return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  task->notify++;
+  sim_wake_all(&task->notify_q);
+  return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+  if (woken) {
+    *woken = pdFALSE;
+  }
+  xTaskNotifyGive(task);
+}
+
+/* ---------- queues and semaphores ---------- */
+
+struct sim_queue {
+  uint8_t *items;
+  size_t item_size;
+  UBaseType_t length;
+  UBaseType_t count;
+  UBaseType_t head;
+  sim_waitq_t senders;
+  sim_waitq_t receivers;
+};
+
+static QueueHandle_t queue_create(UBaseType_t length, UBaseType_t item_size,
+                                  UBaseType_t count) {
+  struct sim_queue *q = calloc(1, sizeof(*q));
+  if (!q) {
+    return NULL;
+  }
+  if (item_size) {
+    q->items = calloc(length, item_size);
+    if (!q->items) {
+      free(q);
+      return NULL;
+    }
+  }
+  q->item_size = item_size;
+  q->length = length;
+  q->count = count;
+  return q;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  return queue_create(length, item_size, 0);
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+  if (queue) {
+    free(queue->items);
+    free(queue);
+  }
+}
+
+static BaseType_t queue_send(QueueHandle_t q, const void *item,
+                             TickType_t ticks, bool front) {
+  int64_t deadline = tick_deadline(ticks);
+  while (q->count == q->length) {
+    if (ticks == 0 || !wait_until(&q->senders, deadline)) {
+      return errQUEUE_FULL;
+    }
+  }
+  if (q->item_size && item) {
+    UBaseType_t index;
+    if (front) {
+      q->head = (q->head + q->length - 1) % q->length;
+      index = q->head;
+    } else {
+      index = (q->head + q->count) % q->length;
+    }
+    memcpy(q->items + (size_t)index * q->item_size, item, q->item_size);
+  }
+  q->count++;
+  sim_wake_one(&q->receivers);
+  return pdPASS;
+}
+
+static BaseType_t queue_receive(QueueHandle_t q, void *item, TickType_t ticks,
+                                bool peek) {
+  int64_t deadline = tick_deadline(ticks);
+  while (q->count == 0) {
+    if (ticks == 0 || !wait_until(&q->receivers, deadline)) {
+      return errQUEUE_EMPTY;
+    }
+  }
+  if (q->item_size && item) {
+    memcpy(item, q->items + (size_t)q->head * q->item_size, q->item_size);
+  }
+  if (peek) {
+    return pdPASS;
+  }
+  q->head = (q->head + 1) % q->length;
+  q->count--;
+  sim_wake_one(&q->senders);
+  return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item,
+                      TickType_t ticks) {
+  return queue_send(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item,
+                             TickType_t ticks) {
+  return queue_send(queue, item, ticks, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+  return queue_receive(queue, item, ticks, false);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks) {
+  return queue_receive(queue, item, ticks, true);
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+  queue->count = 0;
+  queue->head = 0;
+  sim_wake_all(&queue->senders);
+  return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  return queue->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+  return queue->length - queue->count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+  return queue_create(1, 0, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+  return queue_create(1, 0, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max,
+                                           UBaseType_t initial) {
+  return queue_create(max, 0, initial);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+  return queue_receive(sem, NULL, ticks, false);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  return queue_send(sem, NULL, 0, false);
+}
+
+/* ---------- esp_timer ---------- */
+
+struct esp_timer {
+  esp_timer_cb_t callback;
+  void *arg;
+  int64_t deadline_us;
+  uint64_t period_us;
+  bool active;
+  struct esp_timer *next;
+};
+
+static struct esp_timer *timers;
+static sim_waitq_t timer_q;
+
+int64_t esp_timer_get_time(void) {
+  return now_us;
+}
+
+static struct esp_timer *next_due(void) {
+  struct esp_timer *best = NULL;
+  for (struct esp_timer *t = timers; t; t = t->next) {
+    if (t->active && (!best || t->deadline_us < best->deadline_us)) {
+      best = t;
+    }
+  }
+  return best;
+}
+
+static void timer_task(void *arg) {
+  (void)arg;
+  for (;;) {
+    struct esp_timer *t = next_due();
+    if (!t) {
+      sim_wait(&timer_q, -1);
+      continue;
+    }
+    if (t->deadline_us > now_us) {
+      sim_wait(&timer_q, t->deadline_us - now_us);
+      continue;
+    }
+    if (t->period_us) {
+      t->deadline_us += (int64_t)t->period_us;
+    } else {
+      t->active = false;
+    }
+    t->callback(t->arg); // May delete or restart t
+  }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args,
+                           esp_timer_handle_t *out_handle) {
+  if (!args || !args->callback || !out_handle) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  struct esp_timer *t = calloc(1, sizeof(*t));
+  if (!t) {
+    return ESP_ERR_NO_MEM;
+  }
+  t->callback = args->callback;
+  t->arg = args->arg;
+  t->next = timers;
+  timers = t;
+  *out_handle = t;
+  return ESP_OK;
+}
+
+static esp_err_t timer_start(esp_timer_handle_t timer, uint64_t timeout_us,
+                             uint64_t period_us) {
+  if (!timer) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (timer->active) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  timer->deadline_us = now_us + (int64_t)timeout_us;
+  timer->period_us = period_us;
+  timer->active = true;
+  sim_wake_all(&timer_q);
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+  return timer_start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer,
+                                   uint64_t period_us) {
+  return timer_start(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  if (!timer || !timer->active) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  timer->active = false;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+  if (!timer) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  struct esp_timer **link = &timers;
+  while (*link && *link != timer) {
+    link = &(*link)->next;
+  }
+  if (*link) {
+    *link = timer->next;
+  }
+  free(timer);
+  return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+  return timer && timer->active;
+}
+
+/* ---------- entry ---------- */
+
+void sim_run(void (*main_fn)(void *arg), void *arg, int64_t end_us) {
+  pthread_mutex_lock(&big);
+  xTaskCreate(timer_task, "esp_timer", 4096, NULL, TIMER_PRIORITY, NULL);
+  xTaskCreate(main_fn, "main", 8192, arg, 1, NULL);
+
+  while (!stopping) {
+    struct sim_task *t = pick_ready();
+    if (t) {
+      run_task(t);
+      continue;
+    }
+    int64_t next = earliest_wake();
+    if (next == NO_WAKE || next > end_us) {
+      break;
+    }
+    now_us = next > now_us ? next : now_us;
+    expire_timeouts();
+  }
+  pthread_mutex_unlock(&big);
+}
@@ -0,0 +1,126 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sim.h"
+
+/* ---------- log ---------- */
+
+esp_log_level_t sim_log_level = CONFIG_LOG_DEFAULT_LEVEL;
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format,
+                   ...) {
+  (void)tag;
+  if (level > sim_log_level) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+}
+
+void sim_log(esp_log_level_t level, const char *tag, const char *format, ...) {
+  static const char letters[] = "NEWIDV";
+  fprintf(stderr, "%c (%lld) %s: ", letters[level],
+          (long long)(sim_now_us() / 1000), tag);
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+  switch (code) {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_FAIL:
+    return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:
+    return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:
+    return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:
+    return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_INVALID_SIZE:
+    return "ESP_ERR_INVALID_SIZE";
+  case ESP_ERR_NOT_FOUND:
+    return "ESP_ERR_NOT_FOUND";
+  case ESP_ERR_NOT_SUPPORTED:
+    return "ESP_ERR_NOT_SUPPORTED";
+  case ESP_ERR_TIMEOUT:
+    return "ESP_ERR_TIMEOUT";
+  default:
+    return "ERROR";
+  }
+}
+
+/* ---------- heap ---------- */
+
+// What a WROVER module has left when AirPlay starts
+static size_t internal_free = 160 * 1024;
+static size_t psram_free = 4 * 1024 * 1024;
+
+void sim_heap_set_free(size_t internal_bytes, size_t psram_bytes) {
+  internal_free = internal_bytes;
+  psram_free = psram_bytes;
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps) {
+  if ((caps & MALLOC_CAP_SPIRAM) && psram_free == 0) {
+    return NULL;
+  }
+  return malloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+  if ((caps & MALLOC_CAP_SPIRAM) && psram_free == 0) {
+    return NULL;
+  }
+  return calloc(n, size);
+}
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps) {
+  (void)caps;
+  return realloc(ptr, size);
+}
+
+void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps) {
+  (void)caps;
+  void *ptr = NULL;
+  if (alignment < sizeof(void *)) {
+    alignment = sizeof(void *);
+  }
+  return posix_memalign(&ptr, alignment, size) == 0 ? ptr : NULL;
+}
+
+void heap_caps_free(void *ptr) {
+  free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+  if (caps & MALLOC_CAP_SPIRAM) {
+    return psram_free;
+  }
+  if (caps & (MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA | MALLOC_CAP_EXEC)) {
+    return internal_free;
+  }
+  return internal_free + psram_free;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+  return heap_caps_get_free_size(caps);
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+  return heap_caps_get_free_size(caps);
+}
+
+// Linker symbols mem_iram_text_bytes() reads on the target
+int _iram_text_start;
+extern int _iram_text_end __attribute__((alias("_iram_text_start")));
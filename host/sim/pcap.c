@@ -0,0 +1,139 @@
+#include "pcap.h"
+
+#include <string.h>
+
+#define MAGIC_US    0xa1b2c3d4
+#define MAGIC_NS    0xa1b23c4d
+#define MAGIC_NG    0x0a0d0d0a
+#define LINK_ETHER  1
+#define LINK_RAW    101
+#define LINK_SLL    113
+#define LINK_IPV4   228
+#define ETHER_IPV4  0x0800
+#define ETHER_VLAN  0x8100
+#define IP_UDP      17
+
+static uint32_t swap32(uint32_t v) {
+  return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+
+static uint16_t be16(const uint8_t *p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t be32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | p[3];
+}
+
+bool pcap_open(pcap_reader_t *reader, const char *path) {
+  memset(reader, 0, sizeof(*reader));
+  reader->file = fopen(path, "rb");
+  if (!reader->file) {
+    fprintf(stderr, "%s: cannot open\n", path);
+    return false;
+  }
+
+  uint32_t header[6];
+  if (fread(header, sizeof(header), 1, reader->file) != 1) {
+    fprintf(stderr, "%s: not a capture file\n", path);
+    pcap_close(reader);
+    return false;
+  }
+  uint32_t magic = header[0];
+  if (magic == swap32(MAGIC_US) || magic == swap32(MAGIC_NS)) {
+    reader->swapped = true;
+    magic = swap32(magic);
+  }
+  if (magic != MAGIC_US && magic != MAGIC_NS) {
+    fprintf(stderr, "%s: %s\n", path,
+            magic == MAGIC_NG ? "pcapng, convert it with editcap -F pcap"
+                              : "not a pcap file");
+    pcap_close(reader);
+    return false;
+  }
+  reader->nanosecond = magic == MAGIC_NS;
+  reader->linktype = reader->swapped ? swap32(header[5]) : header[5];
+  reader->linktype &= 0x0fffffff; // FCS bits
+  if (reader->linktype != LINK_ETHER && reader->linktype != LINK_RAW &&
+      reader->linktype != LINK_SLL && reader->linktype != LINK_IPV4) {
+    fprintf(stderr, "%s: unsupported link type %u\n", path,
+            (unsigned)reader->linktype);
+    pcap_close(reader);
+    return false;
+  }
+  return true;
+}
+
+// Offset of the IPv4 header in a frame, or -1
+static long ip_offset(const pcap_reader_t *reader, const uint8_t *frame,
+                      size_t len) {
+  if (reader->linktype == LINK_RAW || reader->linktype == LINK_IPV4) {
+    return 0;
+  }
+  long offset = reader->linktype == LINK_SLL ? 14 : 12;
+  if ((size_t)offset + 2 > len) {
+    return -1;
+  }
+  uint16_t type = be16(frame + offset);
+  if (type == ETHER_VLAN) {
+    offset += 4;
+    if ((size_t)offset + 2 > len) {
+      return -1;
+    }
+    type = be16(frame + offset);
+  }
+  return type == ETHER_IPV4 ? offset + 2 : -1;
+}
+
+bool pcap_next_udp(pcap_reader_t *reader, pcap_udp_t *udp) {
+  for (;;) {
+    uint32_t rec[4];
+    if (fread(rec, sizeof(rec), 1, reader->file) != 1) {
+      return false;
+    }
+    for (int i = 0; reader->swapped && i < 4; i++) {
+      rec[i] = swap32(rec[i]);
+    }
+    uint32_t caplen = rec[2];
+    if (caplen > sizeof(reader->record) ||
+        fread(reader->record, caplen, 1, reader->file) != 1) {
+      return false;
+    }
+
+    const uint8_t *frame = reader->record;
+    long ip = ip_offset(reader, frame, caplen);
+    if (ip < 0 || (size_t)ip + 20 > caplen || (frame[ip] >> 4) != 4) {
+      continue;
+    }
+    size_t ihl = (size_t)(frame[ip] & 0x0f) * 4;
+    uint16_t total = be16(frame + ip + 2);
+    uint16_t fragment = be16(frame + ip + 6);
+    if (frame[ip + 9] != IP_UDP || (fragment & 0x3fff) != 0 ||
+        (size_t)ip + total > caplen || total < ihl + 8) {
+      continue; // Not UDP, a fragment, or cut short by the snap length
+    }
+
+    const uint8_t *u = frame + ip + ihl;
+    size_t udp_len = be16(u + 4);
+    if (udp_len < 8 || udp_len > total - ihl) {
+      continue;
+    }
+    udp->time_us = (int64_t)rec[0] * 1000000 +
+                   (reader->nanosecond ? rec[1] / 1000 : rec[1]);
+    udp->src_ip = be32(frame + ip + 12);
+    udp->dst_ip = be32(frame + ip + 16);
+    udp->src_port = be16(u);
+    udp->dst_port = be16(u + 2);
+    udp->payload = u + 8;
+    udp->len = udp_len - 8;
+    return true;
+  }
+}
+
+void pcap_close(pcap_reader_t *reader) {
+  if (reader->file) {
+    fclose(reader->file);
+    reader->file = NULL;
+  }
+}
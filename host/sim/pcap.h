@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Classic libpcap capture reader, UDP over IPv4 only (Ethernet, raw IP and
+ * Linux cooked captures). pcapng files need `editcap -F pcap` first.
+ */
+
+typedef struct {
+  FILE *file;
+  bool swapped;
+  bool nanosecond;
+  uint32_t linktype;
+  uint8_t record[65536];
+} pcap_reader_t;
+
+typedef struct {
+  int64_t time_us; // Capture time
+  uint32_t src_ip; // Host byte order
+  uint32_t dst_ip;
+  uint16_t src_port;
+  uint16_t dst_port;
+  const uint8_t *payload; // Valid until the next read
+  size_t len;
+} pcap_udp_t;
+
+/** @return false (with a message on stderr) if the file is unusable */
+bool pcap_open(pcap_reader_t *reader, const char *path);
+
+/**
+ * Next UDP datagram, skipping everything else.
+ * @return false at the end of the file
+ */
+bool pcap_next_udp(pcap_reader_t *reader, pcap_udp_t *udp);
+
+void pcap_close(pcap_reader_t *reader);
@@ -0,0 +1,797 @@
+#include "sender.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "pcap.h"
+#include "sim.h"
+
+#define SENDER_IP           0xC0A80102 // 192.168.1.2
+#define SENDER_DATA_PORT    6010
+#define SENDER_CONTROL_PORT 6011
+#define SENDER_TIMING_PORT  6012
+#define PTP_EVENT_PORT      319
+#define PTP_GENERAL_PORT    320
+#define PTP_CLOCK_ID        0x1c36f0fffe0a0b0cULL
+#define FEEDER_PRIORITY     18 // The lwIP tcpip task
+#define DGRAM_MAX           1500
+#define HISTORY             2048 // Data packets kept for retransmission
+#define ANCHOR_PERIOD_US    1000000
+#define PTP_SYNC_PERIOD_US  125000
+#define PTP_ANNOUNCE_US     1000000
+#define FOLLOW_UP_GAP_US    30
+#define REFERENCE_MAX       65536
+#define NO_EVENT            INT64_MAX
+
+// RTP payload types (second byte without the marker bit)
+#define PT_DATA       0x60
+#define PT_SYNC       0x54
+#define PT_TIMING_REQ 0x52
+#define PT_TIMING_RSP 0x53
+#define PT_NACK       0x55
+#define PT_RETRANSMIT 0x56
+#define PT_ANCHOR     0x57
+
+typedef struct {
+  int64_t time_us;
+  uint64_t order; // Ties go in sending order
+  uint16_t src_port;
+  uint16_t dst_port;
+  uint16_t len;
+  uint8_t data[DGRAM_MAX];
+} event_t;
+
+typedef struct {
+  bool valid;
+  uint16_t seq;
+  uint16_t len;
+  uint8_t data[DGRAM_MAX];
+} history_t;
+
+// The true sender clock: S = s0 + (L - l0) * rate, ns against our us
+typedef struct {
+  int64_t l0_us;
+  int64_t s0_ns;
+  double rate;
+} truth_t;
+
+static sender_config_t cfg;
+static sender_clock_t clock_kind;
+static truth_t truth;
+static sender_stats_t stats;
+static uint64_t rng_state;
+
+static event_t **heap;
+static size_t heap_len;
+static size_t heap_cap;
+static uint64_t event_order;
+static sim_waitq_t feeder_q;
+static history_t *history;
+
+static struct {
+  bool valid;
+  uint32_t rtp;
+  int64_t network_ns;
+} anchor;
+
+// Generated stream
+static struct {
+  uint16_t seq;
+  uint32_t rtp0;
+  uint64_t packets;
+  int64_t start_s_ns; // Sender time of the first packet
+  int64_t next_data_us;
+  int64_t next_anchor_us;
+  int64_t next_ptp_us;
+  int64_t next_announce_us;
+  uint16_t ptp_seq;
+  uint16_t announce_seq;
+  bool first_sync;
+} gen;
+
+// Capture replay
+static struct {
+  pcap_reader_t reader;
+  bool have_next;
+  pcap_udp_t next;
+  int64_t t0_us; // Capture time of the first packet replayed
+  int64_t end_us;
+  uint32_t receiver_ip;
+  int64_t start_us;
+} cap;
+
+/* ---------- helpers ---------- */
+
+static uint64_t rng_next(void) {
+  // xorshift64*
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static double rng_unit(void) {
+  return (double)(rng_next() >> 11) / (double)(1ULL << 53);
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)(v >> 8);
+  p[1] = (uint8_t)v;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  put16(p, (uint16_t)(v >> 16));
+  put16(p + 2, (uint16_t)v);
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+  put32(p, (uint32_t)(v >> 32));
+  put32(p + 4, (uint32_t)v);
+}
+
+static uint16_t get16(const uint8_t *p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(const uint8_t *p) {
+  return ((uint32_t)get16(p) << 16) | get16(p + 2);
+}
+
+static uint64_t get64(const uint8_t *p) {
+  return ((uint64_t)get32(p) << 32) | get32(p + 4);
+}
+
+static int64_t sender_ns_at(double local_us) {
+  return truth.s0_ns +
+         (int64_t)llround((local_us - (double)truth.l0_us) * 1000.0 *
+                          truth.rate);
+}
+
+static double local_us_at(int64_t sender_ns) {
+  return (double)truth.l0_us +
+         (double)(sender_ns - truth.s0_ns) / (1000.0 * truth.rate);
+}
+
+// The receiver's reading of an NTP timestamp (ntp_clock.c)
+static int64_t ntp_to_ns(uint64_t ntp) {
+  return (int64_t)(ntp >> 32) * 1000000000LL +
+         (int64_t)(((ntp & 0xffffffffULL) * 1000000000ULL) >> 32);
+}
+
+static uint64_t ns_to_ntp(int64_t ns) {
+  uint64_t secs = (uint64_t)(ns / 1000000000LL);
+  uint64_t frac = ((uint64_t)(ns % 1000000000LL) << 32) / 1000000000ULL;
+  return (secs << 32) | frac;
+}
+
+static bool is_rtp(const uint8_t *p, size_t len) {
+  return len >= 4 && (p[0] & 0xc0) == 0x80;
+}
+
+/* ---------- network ---------- */
+
+static void heap_push(event_t *e) {
+  if (heap_len == heap_cap) {
+    heap_cap = heap_cap ? heap_cap * 2 : 256;
+    heap = realloc(heap, heap_cap * sizeof(*heap));
+    if (!heap) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+  size_t i = heap_len++;
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    event_t *p = heap[parent];
+    if (p->time_us < e->time_us ||
+        (p->time_us == e->time_us && p->order < e->order)) {
+      break;
+    }
+    heap[i] = p;
+    i = parent;
+  }
+  heap[i] = e;
+}
+
+static event_t *heap_pop(void) {
+  event_t *top = heap[0];
+  event_t *last = heap[--heap_len];
+  size_t i = 0;
+  for (;;) {
+    size_t child = 2 * i + 1;
+    if (child >= heap_len) {
+      break;
+    }
+    if (child + 1 < heap_len &&
+        (heap[child + 1]->time_us < heap[child]->time_us ||
+         (heap[child + 1]->time_us == heap[child]->time_us &&
+          heap[child + 1]->order < heap[child]->order))) {
+      child++;
+    }
+    if (last->time_us < heap[child]->time_us ||
+        (last->time_us == heap[child]->time_us &&
+         last->order < heap[child]->order)) {
+      break;
+    }
+    heap[i] = heap[child];
+    i = child;
+  }
+  if (heap_len > 0) {
+    heap[i] = last;
+  }
+  return top;
+}
+
+// Put a datagram on the simulated network; returns when it arrives
+static int64_t transmit(int64_t sent_us, uint16_t src_port, uint16_t dst_port,
+                        const uint8_t *data, size_t len) {
+  stats.sent++;
+  if (len > DGRAM_MAX || rng_unit() < cfg.loss) {
+    stats.lost++;
+    return -1;
+  }
+  event_t *e = malloc(sizeof(*e));
+  if (!e) {
+    stats.lost++;
+    return -1;
+  }
+  int64_t jitter =
+      cfg.jitter_us > 0 ? (int64_t)(rng_next() % (uint64_t)(cfg.jitter_us + 1))
+                        : 0;
+  e->time_us = sent_us + cfg.delay_us + jitter;
+  e->order = event_order++;
+  e->src_port = src_port;
+  e->dst_port = dst_port;
+  e->len = (uint16_t)len;
+  memcpy(e->data, data, len);
+  heap_push(e);
+  return e->time_us;
+}
+
+// What the receiver's control task will make of it, to time frames by
+static void track_anchor(const uint8_t *p, size_t len) {
+  uint8_t type = p[1] & 0x7f;
+  if (type == PT_SYNC && len >= 20) {
+    anchor.rtp = get32(p + 16);
+    anchor.network_ns = ntp_to_ns(get64(p + 8));
+  } else if (type == PT_ANCHOR && len >= 28) {
+    anchor.rtp = get32(p + 4) - 11035;
+    anchor.network_ns = (int64_t)get64(p + 8);
+  } else {
+    return;
+  }
+  anchor.valid = true;
+  stats.anchors++;
+}
+
+static void deliver(const event_t *e) {
+  if (e->dst_port == cfg.control_port && is_rtp(e->data, e->len)) {
+    track_anchor(e->data, e->len);
+  }
+  sim_net_deliver(e->dst_port, SENDER_IP, e->src_port, e->data, e->len);
+}
+
+static void remember(const uint8_t *p, size_t len) {
+  if (len > DGRAM_MAX || len < 4) {
+    return;
+  }
+  uint16_t seq = get16(p + 2);
+  history_t *h = &history[seq % HISTORY];
+  h->valid = true;
+  h->seq = seq;
+  h->len = (uint16_t)len;
+  memcpy(h->data, p, len);
+}
+
+/* ---------- generated stream ---------- */
+
+static void gen_data(int64_t now_us) {
+  uint8_t p[DGRAM_MAX];
+  size_t payload = cfg.payload_bytes;
+  if (payload == 0) {
+    payload = (size_t)cfg.frame_size * cfg.channels * 2; // L16
+  }
+  size_t len = 12 + payload;
+  if (len > sizeof(p)) {
+    len = sizeof(p);
+  }
+  memset(p, 0, len);
+  p[0] = 0x80;
+  p[1] = PT_DATA | (gen.packets == 0 ? 0x80 : 0);
+  put16(p + 2, gen.seq);
+  put32(p + 4, gen.rtp0 + (uint32_t)(gen.packets * cfg.frame_size));
+  put32(p + 8, 0x5a5a5a5a); // SSRC
+  remember(p, len);
+  transmit(now_us, SENDER_DATA_PORT, cfg.data_port, p, len);
+
+  gen.seq++;
+  gen.packets++;
+  int64_t s = gen.start_s_ns +
+              (int64_t)((double)gen.packets * cfg.frame_size * 1e9 /
+                        cfg.sample_rate);
+  gen.next_data_us = (int64_t)ceil(local_us_at(s));
+}
+
+// The frame due at the DAC at sender time s
+static uint32_t rtp_due_at(int64_t s_ns) {
+  double samples = (double)(s_ns - gen.start_s_ns - cfg.latency_us * 1000) *
+                   cfg.sample_rate / 1e9;
+  return gen.rtp0 + (uint32_t)(int64_t)floor(samples);
+}
+
+static void gen_anchor(int64_t now_us) {
+  uint8_t p[28] = {0};
+  int64_t s = sender_ns_at((double)now_us);
+  uint32_t rtp = rtp_due_at(s);
+  size_t len;
+  if (clock_kind == SENDER_CLOCK_NTP) {
+    p[0] = gen.first_sync ? 0x90 : 0x80;
+    p[1] = 0x80 | PT_SYNC;
+    put16(p + 2, 7);
+    put32(p + 4,
+          rtp - (uint32_t)(cfg.latency_us * cfg.sample_rate / 1000000));
+    put64(p + 8, ns_to_ntp(s));
+    put32(p + 16, rtp);
+    len = 20;
+  } else {
+    p[0] = gen.first_sync ? 0x90 : 0x80;
+    p[1] = 0x80 | PT_ANCHOR;
+    put16(p + 2, 7);
+    put32(p + 4, rtp + 11035);
+    put64(p + 8, (uint64_t)s);
+    put32(p + 16, rtp);
+    put64(p + 20, PTP_CLOCK_ID);
+    len = 28;
+  }
+  gen.first_sync = false;
+  transmit(now_us, SENDER_CONTROL_PORT, cfg.control_port, p, len);
+  gen.next_anchor_us = now_us + ANCHOR_PERIOD_US;
+}
+
+static void ptp_header(uint8_t *p, uint8_t type, uint16_t len, uint16_t seq,
+                       uint16_t flags, uint8_t control, int8_t interval) {
+  memset(p, 0, len);
+  p[0] = type;
+  p[1] = 0x02; // PTPv2
+  put16(p + 2, len);
+  put16(p + 6, flags);
+  put64(p + 20, PTP_CLOCK_ID);
+  put16(p + 28, 1); // Port number
+  put16(p + 30, seq);
+  p[32] = control;
+  p[33] = (uint8_t)interval;
+}
+
+static void put_ptp_time(uint8_t *p, int64_t ns) {
+  uint64_t secs = (uint64_t)(ns / 1000000000LL);
+  put16(p, (uint16_t)(secs >> 32));
+  put32(p + 2, (uint32_t)secs);
+  put32(p + 6, (uint32_t)(ns % 1000000000LL));
+}
+
+// Two-step Sync: the Follow_Up carries when the Sync left
+static void gen_ptp_sync(int64_t now_us) {
+  uint8_t p[44];
+  ptp_header(p, 0x0, sizeof(p), gen.ptp_seq, 0x0200, 0, -3);
+  transmit(now_us, PTP_EVENT_PORT, PTP_EVENT_PORT, p, sizeof(p));
+
+  ptp_header(p, 0x8, sizeof(p), gen.ptp_seq, 0, 2, -3);
+  put_ptp_time(p + 34, sender_ns_at((double)now_us));
+  transmit(now_us + FOLLOW_UP_GAP_US, PTP_GENERAL_PORT, PTP_GENERAL_PORT, p,
+           sizeof(p));
+  gen.ptp_seq++;
+  gen.next_ptp_us = now_us + PTP_SYNC_PERIOD_US;
+}
+
+static void gen_announce(int64_t now_us) {
+  uint8_t p[64];
+  ptp_header(p, 0xB, sizeof(p), gen.announce_seq++, 0, 5, 0);
+  p[47] = 248; // priority1
+  p[48] = 248; // clockClass
+  p[49] = 0xfe;
+  put16(p + 50, 0xffff);
+  p[52] = 248; // priority2
+  put64(p + 53, PTP_CLOCK_ID);
+  p[63] = 0xa0; // Internal oscillator
+  transmit(now_us, PTP_GENERAL_PORT, PTP_GENERAL_PORT, p, sizeof(p));
+  gen.next_announce_us = now_us + PTP_ANNOUNCE_US;
+}
+
+static int64_t gen_next_us(void) {
+  int64_t next = gen.next_data_us < gen.next_anchor_us ? gen.next_data_us
+                                                       : gen.next_anchor_us;
+  if (clock_kind == SENDER_CLOCK_PTP) {
+    if (gen.next_ptp_us < next) {
+      next = gen.next_ptp_us;
+    }
+    if (gen.next_announce_us < next) {
+      next = gen.next_announce_us;
+    }
+  }
+  return next;
+}
+
+static void gen_until(int64_t now_us) {
+  for (;;) {
+    int64_t next = gen_next_us();
+    if (next > now_us) {
+      return;
+    }
+    if (clock_kind == SENDER_CLOCK_PTP && next == gen.next_announce_us) {
+      gen_announce(next);
+    } else if (clock_kind == SENDER_CLOCK_PTP && next == gen.next_ptp_us) {
+      gen_ptp_sync(next);
+    } else if (next == gen.next_anchor_us) {
+      gen_anchor(next);
+    } else {
+      gen_data(next);
+    }
+  }
+}
+
+static void gen_init(int64_t start_us) {
+  int64_t s0 = clock_kind == SENDER_CLOCK_NTP
+                   ? 3900000000LL * 1000000000LL  // NTP era, 2023
+                   : 1700000000LL * 1000000000LL; // PTP (TAI-like)
+  truth.l0_us = start_us;
+  truth.s0_ns = s0;
+  truth.rate = 1.0 + cfg.skew_ppm * 1e-6;
+
+  gen.seq = (uint16_t)rng_next();
+  gen.rtp0 = (uint32_t)rng_next();
+  gen.first_sync = true;
+  // The clock runs before the stream starts, as it does on a real sender
+  gen.next_announce_us = start_us;
+  gen.next_ptp_us = start_us + 10000;
+  gen.next_anchor_us = start_us + 2000000;
+  gen.next_data_us = start_us + 2000000;
+  gen.start_s_ns = sender_ns_at((double)gen.next_data_us);
+}
+
+/* ---------- capture replay ---------- */
+
+typedef enum {
+  CAP_SKIP,
+  CAP_DATA,
+  CAP_CONTROL,
+  CAP_PTP_EVENT,
+  CAP_PTP_GENERAL,
+} cap_kind_t;
+
+static cap_kind_t classify(const pcap_udp_t *u, uint32_t receiver_ip) {
+  if (u->src_ip == receiver_ip || u->len < 4) {
+    return CAP_SKIP;
+  }
+  if (u->dst_port == PTP_EVENT_PORT || u->dst_port == PTP_GENERAL_PORT) {
+    return u->dst_port == PTP_EVENT_PORT ? CAP_PTP_EVENT : CAP_PTP_GENERAL;
+  }
+  if (u->dst_ip != receiver_ip || !is_rtp(u->payload, u->len)) {
+    return CAP_SKIP;
+  }
+  uint8_t type = u->payload[1] & 0x7f;
+  if (type == PT_DATA && u->len > 12) {
+    return CAP_DATA;
+  }
+  // Timing and retransmissions are answered by us, not replayed
+  return type == PT_SYNC || type == PT_ANCHOR ? CAP_CONTROL : CAP_SKIP;
+}
+
+static int64_t cap_local_us(int64_t capture_us) {
+  return cap.start_us +
+         (int64_t)llround((double)(capture_us - cap.t0_us) /
+                          (1.0 + cfg.skew_ppm * 1e-6));
+}
+
+// Least squares over (local, sender) pairs: the capture's own clock error
+// and the sender's drift against it both end up in the fit
+typedef struct {
+  size_t n;
+  int64_t l0, s0; // First pair, to keep the sums small
+  double sl, ss, sll, sls;
+} fit_t;
+
+static void fit_add(fit_t *f, int64_t local_us, int64_t sender_ns) {
+  if (f->n == 0) {
+    f->l0 = local_us;
+    f->s0 = sender_ns;
+  }
+  double l = (double)(local_us - f->l0);
+  double s = (double)(sender_ns - f->s0);
+  f->n++;
+  f->sl += l;
+  f->ss += s;
+  f->sll += l * l;
+  f->sls += l * s;
+}
+
+static bool fit_solve(const fit_t *f, truth_t *t) {
+  if (f->n < 2) {
+    return false;
+  }
+  double n = (double)f->n;
+  double var = f->sll - f->sl * f->sl / n;
+  if (var <= 0) {
+    return false;
+  }
+  double slope = (f->sls - f->sl * f->ss / n) / var; // ns per us
+  double mean_l = f->sl / n;
+  double mean_s = f->ss / n;
+  // Anchor the line at a whole microsecond near the middle of the capture
+  int64_t l0 = f->l0 + (int64_t)llround(mean_l);
+  double dl = (double)(l0 - f->l0) - mean_l;
+  t->l0_us = l0;
+  t->s0_ns = f->s0 + (int64_t)llround(mean_s + slope * dl);
+  t->rate = slope / 1000.0;
+  return true;
+}
+
+static bool cap_scan(const char *path, int64_t start_us) {
+  pcap_reader_t *r = &cap.reader;
+  if (!pcap_open(r, path)) {
+    return false;
+  }
+
+  // The receiver is where the audio went
+  pcap_udp_t u;
+  bool found = false;
+  bool saw_ptp = false;
+  while (pcap_next_udp(r, &u)) {
+    if (!found && is_rtp(u.payload, u.len) &&
+        (u.payload[1] & 0x7f) == PT_DATA && u.len > 12) {
+      cap.receiver_ip = u.dst_ip;
+      found = true;
+    }
+    saw_ptp |= u.dst_port == PTP_EVENT_PORT;
+  }
+  pcap_close(r);
+  if (!found) {
+    fprintf(stderr, "%s: no RTP audio (payload type 96) found\n", path);
+    return false;
+  }
+  if (!cfg.clock_set) {
+    clock_kind = saw_ptp ? SENDER_CLOCK_PTP : SENDER_CLOCK_NTP;
+  }
+
+  // Second pass: replay window and the sender clock references
+  static int64_t sync_t[65536]; // Capture time of each Sync, by sequence
+  fit_t fit = {0};
+  bool have_t0 = false;
+  pcap_open(r, path);
+  while (pcap_next_udp(r, &u)) {
+    cap_kind_t kind = classify(&u, cap.receiver_ip);
+    if (kind == CAP_SKIP) {
+      continue;
+    }
+    if (!have_t0) {
+      cap.t0_us = u.time_us;
+      cap.start_us = start_us;
+      have_t0 = true;
+    }
+    cap.end_us = cap_local_us(u.time_us);
+    const uint8_t *p = u.payload;
+    if (fit.n >= REFERENCE_MAX) {
+      continue;
+    }
+    if (clock_kind == SENDER_CLOCK_PTP && u.len >= 44) {
+      uint8_t type = p[0] & 0x0f;
+      uint16_t seq = get16(p + 30);
+      if (kind == CAP_PTP_EVENT && type == 0x0) {
+        sync_t[seq] = u.time_us;
+      } else if (kind == CAP_PTP_GENERAL && type == 0x8 && sync_t[seq]) {
+        uint64_t secs = ((uint64_t)get16(p + 34) << 32) | get32(p + 36);
+        int64_t ns = (int64_t)(secs * 1000000000ULL + get32(p + 40));
+        fit_add(&fit, cap_local_us(sync_t[seq]), ns);
+        sync_t[seq] = 0;
+      }
+    } else if (clock_kind == SENDER_CLOCK_NTP && kind == CAP_CONTROL &&
+               (p[1] & 0x7f) == PT_SYNC && u.len >= 20) {
+      fit_add(&fit, cap_local_us(u.time_us), ntp_to_ns(get64(p + 8)));
+    }
+  }
+  pcap_close(r);
+
+  if (!fit_solve(&fit, &truth)) {
+    fprintf(stderr, "%s: no %s clock references to replay against\n", path,
+            clock_kind == SENDER_CLOCK_PTP ? "PTP Follow_Up" : "NTP sync");
+    return false;
+  }
+  return pcap_open(r, path);
+}
+
+static void cap_read_next(void) {
+  cap.have_next = false;
+  while (pcap_next_udp(&cap.reader, &cap.next)) {
+    if (classify(&cap.next, cap.receiver_ip) != CAP_SKIP) {
+      cap.have_next = true;
+      return;
+    }
+  }
+}
+
+static int64_t cap_next_us(void) {
+  return cap.have_next ? cap_local_us(cap.next.time_us) : NO_EVENT;
+}
+
+static void cap_until(int64_t now_us) {
+  while (cap.have_next && cap_local_us(cap.next.time_us) <= now_us) {
+    const pcap_udp_t *u = &cap.next;
+    int64_t at = cap_local_us(u->time_us);
+    switch (classify(u, cap.receiver_ip)) {
+    case CAP_DATA:
+      remember(u->payload, u->len);
+      transmit(at, SENDER_DATA_PORT, cfg.data_port, u->payload, u->len);
+      break;
+    case CAP_CONTROL:
+      transmit(at, SENDER_CONTROL_PORT, cfg.control_port, u->payload, u->len);
+      break;
+    case CAP_PTP_EVENT:
+    case CAP_PTP_GENERAL:
+      transmit(at, u->dst_port, u->dst_port, u->payload, u->len);
+      break;
+    default:
+      break;
+    }
+    cap_read_next();
+  }
+}
+
+/* ---------- replies to the receiver ---------- */
+
+static void answer_nack(const uint8_t *p, size_t len) {
+  if (len < 8) {
+    return;
+  }
+  uint16_t first = get16(p + 4);
+  uint16_t count = get16(p + 6);
+  stats.nack_requests++;
+  stats.nack_packets += count;
+  for (uint16_t i = 0; i < count; i++) {
+    uint16_t seq = (uint16_t)(first + i);
+    const history_t *h = &history[seq % HISTORY];
+    if (!h->valid || h->seq != seq || h->len + 4 > DGRAM_MAX) {
+      continue;
+    }
+    uint8_t r[DGRAM_MAX];
+    r[0] = 0x80;
+    r[1] = 0x80 | PT_RETRANSMIT;
+    put16(r + 2, seq);
+    memcpy(r + 4, h->data, h->len);
+    transmit(sim_now_us(), SENDER_CONTROL_PORT, cfg.control_port, r,
+             (size_t)h->len + 4);
+    stats.retransmitted++;
+  }
+}
+
+// Stamped with the true sender clock when the request gets there
+static void answer_timing(uint16_t reply_port, const uint8_t *p, size_t len) {
+  if (len < 32) {
+    return;
+  }
+  stats.sent++;
+  if (rng_unit() < cfg.loss) {
+    stats.lost++;
+    return;
+  }
+  int64_t jitter =
+      cfg.jitter_us > 0 ? (int64_t)(rng_next() % (uint64_t)(cfg.jitter_us + 1))
+                        : 0;
+  int64_t arrival = sim_now_us() + cfg.delay_us + jitter;
+  uint64_t stamp = ns_to_ntp(sender_ns_at((double)arrival));
+
+  uint8_t r[32] = {0};
+  r[0] = 0x80;
+  r[1] = 0x80 | PT_TIMING_RSP;
+  memcpy(r + 2, p + 2, 2);
+  memcpy(r + 8, p + 8, 8); // The receiver's origin, echoed
+  put64(r + 16, stamp);
+  put64(r + 24, stamp);
+  transmit(arrival, SENDER_TIMING_PORT, reply_port, r, sizeof(r));
+  stats.timing_replies++;
+}
+
+static void on_receiver_tx(uint16_t src_port, uint32_t dst_ip,
+                           uint16_t dst_port, const uint8_t *data,
+                           size_t len) {
+  (void)dst_ip;
+  if (!is_rtp(data, len)) {
+    return;
+  }
+  uint8_t type = data[1] & 0x7f;
+  if (dst_port == SENDER_CONTROL_PORT && type == PT_NACK) {
+    answer_nack(data, len);
+  } else if (dst_port == SENDER_TIMING_PORT && type == PT_TIMING_REQ) {
+    answer_timing(src_port, data, len);
+  }
+  sim_wake_one(&feeder_q); // New datagrams on the way
+}
+
+/* ---------- feeder ---------- */
+
+// Plays the part of the network and the sender
+static void feeder_task(void *arg) {
+  (void)arg;
+  for (;;) {
+    int64_t now = sim_now_us();
+    if (cfg.pcap_path) {
+      cap_until(now);
+    } else {
+      gen_until(now);
+    }
+    while (heap_len > 0 && heap[0]->time_us <= now) {
+      event_t *e = heap_pop();
+      deliver(e);
+      free(e);
+    }
+
+    int64_t next = cfg.pcap_path ? cap_next_us() : gen_next_us();
+    if (heap_len > 0 && heap[0]->time_us < next) {
+      next = heap[0]->time_us;
+    }
+    sim_wait(&feeder_q, next == NO_EVENT ? -1 : next - now);
+  }
+}
+
+/* ---------- interface ---------- */
+
+bool sender_init(const sender_config_t *config, int64_t start_us) {
+  cfg = *config;
+  rng_state = cfg.seed ? cfg.seed : 0x9e3779b97f4a7c15ULL;
+  clock_kind = cfg.clock;
+  history = calloc(HISTORY, sizeof(*history));
+  if (!history) {
+    return false;
+  }
+  if (cfg.pcap_path) {
+    if (!cap_scan(cfg.pcap_path, start_us)) {
+      return false;
+    }
+    cap_read_next();
+    return true;
+  }
+  gen_init(start_us);
+  return true;
+}
+
+sender_clock_t sender_clock(void) {
+  return clock_kind;
+}
+
+int64_t sender_end_us(void) {
+  return cfg.pcap_path ? cap.end_us : 0;
+}
+
+void sender_start(void) {
+  sim_net_set_tx_hook(on_receiver_tx);
+  xTaskCreate(feeder_task, "sim_net", 8192, NULL, FEEDER_PRIORITY, NULL);
+}
+
+uint32_t sender_ip(void) {
+  return SENDER_IP;
+}
+
+uint16_t sender_control_port(void) {
+  return SENDER_CONTROL_PORT;
+}
+
+uint16_t sender_timing_port(void) {
+  return SENDER_TIMING_PORT;
+}
+
+bool sender_play_time_us(uint32_t rtp_timestamp, double *local_us) {
+  if (!anchor.valid) {
+    return false;
+  }
+  int32_t delta = (int32_t)(rtp_timestamp - anchor.rtp);
+  int64_t due_ns =
+      anchor.network_ns + (int64_t)delta * 1000000000LL / cfg.sample_rate;
+  *local_us = local_us_at(due_ns);
+  return true;
+}
+
+void sender_get_stats(sender_stats_t *out) {
+  *out = stats;
+}
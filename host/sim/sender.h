@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The sender side of the simulation: the clock the receiver is to follow,
+ * the packets it sends (from a capture or generated), the network between
+ * the two, and the replies a real sender gives to NTP timing requests and
+ * retransmission requests.
+ */
+
+typedef enum {
+  SENDER_CLOCK_PTP = 0, // AirPlay 2: PTP Sync/Follow_Up, 0xD7 anchors
+  SENDER_CLOCK_NTP,     // AirPlay 1: timing requests, 0x54 sync packets
+} sender_clock_t;
+
+typedef struct {
+  const char *pcap_path; // NULL generates a stream
+  bool clock_set;        // Otherwise taken from the capture
+  sender_clock_t clock;
+  int sample_rate;
+  int frame_size;
+  int channels;
+  size_t payload_bytes; // Generated RTP payload, 0 for L16 frames
+  int64_t latency_us;   // Generated: playout delay behind the sender
+  double loss;          // Probability, each datagram and direction
+  int64_t delay_us;     // One-way network delay
+  int64_t jitter_us;    // Uniform extra delay, reorders when > spacing
+  double skew_ppm;      // Sender clock rate against ours
+  uint64_t seed;
+  uint16_t data_port; // Receiver ports
+  uint16_t control_port;
+} sender_config_t;
+
+typedef struct {
+  uint32_t sent;
+  uint32_t lost;
+  uint32_t nack_requests;
+  uint32_t nack_packets;   // Sequence numbers asked for
+  uint32_t retransmitted;  // Of those, answered
+  uint32_t timing_replies; // NTP
+  uint32_t anchors;
+} sender_stats_t;
+
+/** Scan the capture, if any; start_us is when the stream begins. */
+bool sender_init(const sender_config_t *config, int64_t start_us);
+
+sender_clock_t sender_clock(void);
+
+/** Last packet time of a capture, or 0 for a generated stream. */
+int64_t sender_end_us(void);
+
+/** Start sending (a task) and answering the receiver. */
+void sender_start(void);
+
+uint32_t sender_ip(void);
+uint16_t sender_control_port(void);
+uint16_t sender_timing_port(void);
+
+/**
+ * When the frame should reach the DAC, in our clock, from the last anchor
+ * delivered and the true sender clock.
+ * @return false before the first anchor
+ */
+bool sender_play_time_us(uint32_t rtp_timestamp, double *local_us);
+
+void sender_get_stats(sender_stats_t *stats);
@@ -0,0 +1,525 @@
+// Host-side run of the AirPlay audio pipeline: the receiver, jitter buffer,
+// timing and clock modules from main/ play a capture (or a generated
+// stream) through a simulated network into a model of the I2S DAC, and the
+// sync error of every frame is measured against the true sender clock.
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_output.h"
+#include "audio_receiver.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "mem_budget.h"
+#include "ntp_clock.h"
+#include "ptp_clock.h"
+#include "sender.h"
+#include "sim.h"
+
+#define START_US          1000000 // Stream begins 1 s after boot
+#define DATA_PORT         6000
+#define CONTROL_PORT      6001
+#define FRAME_SAMPLES     352 // audio_output.c reads this much (+1)
+#define DAC_FRAMES        AUDIO_OUTPUT_DMA_FRAMES
+#define LOW_WATER_FRAMES  512
+#define OUTPUT_WAIT_MS    20
+#define PLAYBACK_PRIORITY 7
+#define POLL_US           100000
+
+typedef struct {
+  sender_config_t sender;
+  const char *codec;
+  double duration_s;
+  double settle_s;
+  bool psram;
+  const char *frames_path;
+} options_t;
+
+static options_t opt;
+
+// The DAC: output samples drain at exactly our rate, the resampler's ppm
+// decides how many a frame becomes
+static struct {
+  double empty_us; // When the FIFO runs dry at the current fill
+  bool last_audio;
+  uint32_t underruns;
+  uint32_t gaps;
+  uint64_t frames;
+  uint64_t silence_frames;
+} dac;
+
+// Sync error of played frames, in us (positive: late)
+static struct {
+  double *errors;
+  size_t count;
+  size_t cap;
+  size_t unsynced; // Played before any anchor arrived
+  bool pending;
+  uint32_t pending_rtp;
+  // The piece played last, measured once the next one shows where it ended
+  bool prev_valid;
+  uint32_t prev_rtp; // Header timestamp, before any late trim
+  size_t prev_samples;
+  double prev_heard_us;
+  FILE *frames_out;
+} sync_err;
+
+static struct {
+  bool locked;
+  double lock_s; // From clock start, which is before the stream starts
+  audio_stats_t stats;
+  ptp_stats_t ptp;
+  bool done;
+} result;
+
+/* ---------- playback ---------- */
+
+static void on_dequeued(uint32_t rtp_timestamp) {
+  sync_err.pending = true;
+  sync_err.pending_rtp = rtp_timestamp;
+}
+
+static double dac_fill_frames(void) {
+  double left = dac.empty_us - (double)sim_now_us();
+  return left > 0 ? left * audio_receiver_get_sample_rate() / 1e6 : 0;
+}
+
+// Blocks until the FIFO has room, like i2s_channel_write(); returns when
+// the first sample will be heard
+static double dac_write(size_t samples, bool audio) {
+  int rate = audio_receiver_get_sample_rate();
+  double out = audio ? samples * (1.0 + audio_receiver_get_drift_ppm() * 1e-6)
+                     : (double)samples;
+  double room_at = dac.empty_us - (DAC_FRAMES - out) * 1e6 / rate;
+  if (room_at > (double)sim_now_us()) {
+    sim_sleep_until((int64_t)ceil(room_at));
+  }
+
+  double now = (double)sim_now_us();
+  if (dac.empty_us < now) {
+    if (dac.last_audio && audio) {
+      dac.underruns++; // The ring ran dry in the middle of audio
+    }
+    dac.empty_us = now;
+  }
+  double start = dac.empty_us;
+  dac.empty_us += out * 1e6 / rate;
+  dac.last_audio = audio;
+  return start;
+}
+
+static void record_sync(double heard_us, uint32_t rtp) {
+  double due_us;
+  if (!sender_play_time_us(rtp, &due_us)) {
+    sync_err.unsynced++;
+    return;
+  }
+  double error = heard_us - due_us;
+  if (sync_err.frames_out) {
+    fprintf(sync_err.frames_out, "%.3f,%u,%.1f,%d\n", heard_us / 1000.0, rtp,
+            error, (int)audio_receiver_get_drift_ppm());
+  }
+  if (heard_us < START_US + opt.settle_s * 1e6) {
+    return;
+  }
+  if (sync_err.count == sync_err.cap) {
+    sync_err.cap = sync_err.cap ? sync_err.cap * 2 : 4096;
+    sync_err.errors =
+        realloc(sync_err.errors, sync_err.cap * sizeof(*sync_err.errors));
+    if (!sync_err.errors) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+  sync_err.errors[sync_err.count++] = error;
+}
+
+// The trace hook sees a frame's timestamp before late samples are trimmed
+// off its front; a piece that ends where the next one starts played its
+// last `samples`. Frames split into chunks, so their length is not known
+// up front.
+static void played(double heard_us, size_t samples, uint32_t rtp) {
+  if (sync_err.prev_valid) {
+    uint32_t length = rtp - sync_err.prev_rtp;
+    uint32_t start = sync_err.prev_rtp;
+    if (length >= sync_err.prev_samples &&
+        length <= (uint32_t)opt.sender.frame_size &&
+        sync_err.prev_samples < FRAME_SAMPLES + 1) {
+      start = rtp - (uint32_t)sync_err.prev_samples;
+    }
+    record_sync(sync_err.prev_heard_us, start);
+  }
+  sync_err.prev_valid = true;
+  sync_err.prev_rtp = rtp;
+  sync_err.prev_samples = samples;
+  sync_err.prev_heard_us = heard_us;
+}
+
+// audio_output.c's loop without I2S, EQ and gain
+static void playback_task(void *arg) {
+  (void)arg;
+  bool streaming = false;
+  for (;;) {
+    int16_t *pcm = NULL;
+    sync_err.pending = false;
+    // What audio_output.c measures from its DMA queue
+    double left_us = dac.empty_us - (double)sim_now_us();
+    audio_receiver_set_output_delay_us(left_us > 0 ? (uint32_t)left_us : 0);
+    size_t samples = audio_receiver_borrow(&pcm, FRAME_SAMPLES + 1);
+    if (samples > 0) {
+      bool is_silence = !pcm; // Early frame held back
+      bool dequeued = sync_err.pending;
+      uint32_t rtp = sync_err.pending_rtp;
+      double heard = dac_write(samples, true);
+      if (is_silence) {
+        dac.silence_frames += samples;
+      } else {
+        dac.frames += samples;
+        if (dequeued) {
+          played(heard, samples, rtp);
+        }
+      }
+      audio_receiver_release();
+      streaming = true;
+      continue;
+    }
+
+    if (streaming && dac_fill_frames() >= LOW_WATER_FRAMES) {
+      audio_receiver_wait_data(pdMS_TO_TICKS(OUTPUT_WAIT_MS));
+      continue;
+    }
+    if (streaming && !audio_receiver_wait_data(0)) {
+      dac.gaps++;
+    }
+    streaming = false;
+    dac_write(FRAME_SAMPLES, false);
+  }
+}
+
+/* ---------- scenario ---------- */
+
+static bool clock_locked(void) {
+  return sender_clock() == SENDER_CLOCK_PTP ? ptp_clock_is_locked()
+                                            : ntp_clock_is_locked();
+}
+
+static void fill_format(audio_format_t *format) {
+  memset(format, 0, sizeof(*format));
+  snprintf(format->codec, sizeof(format->codec), "%s", opt.codec);
+  format->sample_rate = opt.sender.sample_rate;
+  format->channels = opt.sender.channels;
+  format->bits_per_sample = 16;
+  format->frame_size = opt.sender.frame_size;
+  format->max_samples_per_frame = (uint32_t)opt.sender.frame_size;
+  format->sample_size = 16;
+  format->num_channels = (uint8_t)opt.sender.channels;
+  format->sample_rate_config = (uint32_t)opt.sender.sample_rate;
+}
+
+// What the RTSP handlers do for SETUP and RECORD, then wait it out
+static void scenario_task(void *arg) {
+  (void)arg;
+  mem_budget_init();
+  int64_t clock_start_us = sim_now_us();
+  if (sender_clock() == SENDER_CLOCK_PTP) {
+    ptp_clock_init();
+  } else {
+    ntp_clock_start_client(htonl(sender_ip()), sender_timing_port());
+  }
+
+  audio_format_t format;
+  fill_format(&format);
+  audio_receiver_init();
+  audio_receiver_set_format(&format);
+  audio_receiver_set_client_control(htonl(sender_ip()),
+                                    sender_control_port());
+  if (audio_receiver_start(DATA_PORT, CONTROL_PORT) != ESP_OK) {
+    fprintf(stderr, "audio_receiver_start failed\n");
+    exit(1);
+  }
+  audio_receiver_set_playing(true);
+
+  sim_trace_set_dequeue_hook(on_dequeued);
+  xTaskCreate(playback_task, "audio_play", 4096, NULL, PLAYBACK_PRIORITY,
+              NULL);
+  sender_start();
+
+  int64_t end_us = START_US + (int64_t)(opt.duration_s * 1e6);
+  while (sim_now_us() < end_us) {
+    sim_sleep_until(sim_now_us() + POLL_US);
+    if (!result.locked && clock_locked()) {
+      result.locked = true;
+      result.lock_s = (sim_now_us() - clock_start_us) / 1e6;
+    }
+  }
+
+  audio_receiver_get_stats(&result.stats);
+  if (sender_clock() == SENDER_CLOCK_PTP) {
+    ptp_clock_get_stats(&result.ptp);
+  }
+  result.done = true;
+  sim_stop();
+  sim_wait(NULL, -1);
+}
+
+/* ---------- report ---------- */
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void report(void) {
+  sender_stats_t tx;
+  sender_get_stats(&tx);
+  const audio_stats_t *rx = &result.stats;
+
+  printf("clock       %s, ",
+         sender_clock() == SENDER_CLOCK_PTP ? "PTP" : "NTP");
+  if (result.locked) {
+    printf("locked after %.1f s\n", result.lock_s);
+  } else {
+    printf("never locked\n");
+  }
+  printf("network     %u sent, %u lost, %u overflowed the socket queue\n",
+         tx.sent, tx.lost, sim_net_overflows());
+  printf("nack        %u requests for %u packets, %u resent, %u received\n",
+         tx.nack_requests, tx.nack_packets, tx.retransmitted,
+         rx->retransmits_received);
+  printf("receiver    %u received, %u decoded, %u dropped, %u late, "
+         "%u early\n",
+         rx->packets_received, rx->packets_decoded, rx->packets_dropped,
+         rx->late_frames, rx->early_frames);
+  printf("buffer      %u underruns, %u overruns, depth %u frames "
+         "(target %u), queue peak %u, queue drops %u\n",
+         rx->buffer_underruns, rx->buffer_overruns, rx->pcm_depth_frames,
+         rx->target_depth_frames, rx->decode_queue_peak,
+         rx->decode_queue_drops);
+  printf("jitter      p50 %u us, p95 %u us, p99 %u us, reorder %u\n",
+         rx->jitter_p50_us, rx->jitter_p95_us, rx->jitter_p99_us,
+         rx->reorder_depth);
+  printf("output      %.2f s audio, %.2f s early silence, %u DAC underruns, "
+         "%u gaps, drift %d ppm\n",
+         (double)dac.frames / opt.sender.sample_rate,
+         (double)dac.silence_frames / opt.sender.sample_rate, dac.underruns,
+         dac.gaps, (int)rx->drift_ppm);
+
+  if (sync_err.count == 0) {
+    printf("sync error  no anchored frames after %.1f s (%zu unanchored)\n",
+           opt.settle_s, sync_err.unsynced);
+    return;
+  }
+  double *e = sync_err.errors;
+  size_t n = sync_err.count;
+  double sum = 0;
+  double abs_sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += e[i];
+    abs_sum += fabs(e[i]);
+  }
+  qsort(e, n, sizeof(*e), compare_double);
+  printf("sync error  %zu frames after %.1f s: min %.0f, avg %.0f, "
+         "p50 %.0f, p99 %.0f, max %.0f us (mean |e| %.0f us)\n",
+         n, opt.settle_s, e[0], sum / n, e[n / 2], e[(size_t)(n * 0.99)],
+         e[n - 1], abs_sum / n);
+  printf("sim         %.1f s simulated, %llu task switches\n",
+         (sim_now_us() - START_US) / 1e6,
+         (unsigned long long)sim_switches());
+}
+
+/* ---------- options ---------- */
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [options] [capture.pcap]\n"
+          "\n"
+          "Without a capture, a stream is generated.\n"
+          "  --clock ptp|ntp     Clock of the generated stream (default ptp),\n"
+          "                      or override what the capture shows\n"
+          "  --codec NAME        Format codec (default AppleLossless; L16 for\n"
+          "                      raw PCM, AAC)\n"
+          "  --rate HZ           Sample rate (default 44100)\n"
+          "  --frame SAMPLES     Samples per packet (default 352)\n"
+          "  --latency-ms MS     Generated: sender lead (default 300)\n"
+          "  --duration S        Simulated time (default 30, or the capture)\n"
+          "  --settle S          Ignore sync errors before this (default 5)\n"
+          "  --loss P            Datagram loss probability (default 0)\n"
+          "  --delay-ms MS       One-way delay (default 1)\n"
+          "  --jitter-ms MS      Uniform extra delay (default 0)\n"
+          "  --skew-ppm PPM      Sender clock rate error (default 0)\n"
+          "  --seed N            Random seed (default 1)\n"
+          "  --no-psram          Profile of a board without PSRAM\n"
+          "  --frames FILE       Write time_ms,rtp,error_us,ppm per frame\n"
+          "  --verbose, -v       Receiver logs at debug level (-q: errors)\n",
+          argv0);
+}
+
+static bool parse_options(int argc, char **argv) {
+  enum {
+    OPT_CLOCK = 256,
+    OPT_CODEC,
+    OPT_RATE,
+    OPT_FRAME,
+    OPT_LATENCY,
+    OPT_DURATION,
+    OPT_SETTLE,
+    OPT_LOSS,
+    OPT_DELAY,
+    OPT_JITTER,
+    OPT_SKEW,
+    OPT_SEED,
+    OPT_NO_PSRAM,
+    OPT_FRAMES,
+  };
+  static const struct option longopts[] = {
+      {"clock", required_argument, NULL, OPT_CLOCK},
+      {"codec", required_argument, NULL, OPT_CODEC},
+      {"rate", required_argument, NULL, OPT_RATE},
+      {"frame", required_argument, NULL, OPT_FRAME},
+      {"latency-ms", required_argument, NULL, OPT_LATENCY},
+      {"duration", required_argument, NULL, OPT_DURATION},
+      {"settle", required_argument, NULL, OPT_SETTLE},
+      {"loss", required_argument, NULL, OPT_LOSS},
+      {"delay-ms", required_argument, NULL, OPT_DELAY},
+      {"jitter-ms", required_argument, NULL, OPT_JITTER},
+      {"skew-ppm", required_argument, NULL, OPT_SKEW},
+      {"seed", required_argument, NULL, OPT_SEED},
+      {"no-psram", no_argument, NULL, OPT_NO_PSRAM},
+      {"frames", required_argument, NULL, OPT_FRAMES},
+      {"verbose", no_argument, NULL, 'v'},
+      {"quiet", no_argument, NULL, 'q'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+
+  sender_config_t *s = &opt.sender;
+  s->sample_rate = 44100;
+  s->frame_size = 352;
+  s->channels = 2;
+  s->latency_us = 300000;
+  s->delay_us = 1000;
+  s->seed = 1;
+  s->data_port = DATA_PORT;
+  s->control_port = CONTROL_PORT;
+  opt.codec = "AppleLossless";
+  opt.duration_s = 0;
+  opt.settle_s = 5;
+  opt.psram = true;
+
+  int c;
+  while ((c = getopt_long(argc, argv, "vqh", longopts, NULL)) != -1) {
+    switch (c) {
+    case OPT_CLOCK:
+      s->clock_set = true;
+      if (strcmp(optarg, "ptp") == 0) {
+        s->clock = SENDER_CLOCK_PTP;
+      } else if (strcmp(optarg, "ntp") == 0) {
+        s->clock = SENDER_CLOCK_NTP;
+      } else {
+        return false;
+      }
+      break;
+    case OPT_CODEC:
+      opt.codec = optarg;
+      break;
+    case OPT_RATE:
+      s->sample_rate = atoi(optarg);
+      break;
+    case OPT_FRAME:
+      s->frame_size = atoi(optarg);
+      break;
+    case OPT_LATENCY:
+      s->latency_us = (int64_t)(atof(optarg) * 1000);
+      break;
+    case OPT_DURATION:
+      opt.duration_s = atof(optarg);
+      break;
+    case OPT_SETTLE:
+      opt.settle_s = atof(optarg);
+      break;
+    case OPT_LOSS:
+      s->loss = atof(optarg);
+      break;
+    case OPT_DELAY:
+      s->delay_us = (int64_t)(atof(optarg) * 1000);
+      break;
+    case OPT_JITTER:
+      s->jitter_us = (int64_t)(atof(optarg) * 1000);
+      break;
+    case OPT_SKEW:
+      s->skew_ppm = atof(optarg);
+      break;
+    case OPT_SEED:
+      s->seed = strtoull(optarg, NULL, 0);
+      break;
+    case OPT_NO_PSRAM:
+      opt.psram = false;
+      break;
+    case OPT_FRAMES:
+      opt.frames_path = optarg;
+      break;
+    case 'v':
+      sim_log_level = ESP_LOG_DEBUG;
+      break;
+    case 'q':
+      sim_log_level = ESP_LOG_ERROR;
+      break;
+    default:
+      return false;
+    }
+  }
+  if (optind + 1 == argc) {
+    s->pcap_path = argv[optind];
+  } else if (optind != argc) {
+    return false;
+  }
+  if (s->sample_rate <= 0 || s->frame_size <= 0 || s->loss < 0 ||
+      s->loss > 1) {
+    return false;
+  }
+  s->payload_bytes = strcmp(opt.codec, "L16") == 0 ? 0 : 256;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (!parse_options(argc, argv)) {
+    usage(argv[0]);
+    return 2;
+  }
+  if (!opt.psram) {
+    sim_heap_set_free(160 * 1024, 0);
+  }
+  if (opt.frames_path) {
+    sync_err.frames_out = fopen(opt.frames_path, "w");
+    if (!sync_err.frames_out) {
+      fprintf(stderr, "%s: cannot create\n", opt.frames_path);
+      return 1;
+    }
+    fprintf(sync_err.frames_out, "time_ms,rtp,error_us,drift_ppm\n");
+  }
+  if (!sender_init(&opt.sender, START_US)) {
+    return 1;
+  }
+  if (opt.duration_s <= 0) {
+    int64_t end = sender_end_us();
+    opt.duration_s = end > START_US ? (end - START_US) / 1e6 + 1 : 30;
+  }
+
+  sim_run(scenario_task, NULL, INT64_MAX);
+  if (!result.done) {
+    fprintf(stderr, "simulation stalled at %.3f s\n", sim_now_us() / 1e6);
+    return 1;
+  }
+  if (sync_err.frames_out) {
+    fclose(sync_err.frames_out);
+  }
+  report();
+  return 0;
+}
@@ -0,0 +1,484 @@
+#include "alac_decoder.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#define ELEMENT_SCE 0 // Single channel
+#define ELEMENT_CPE 1 // Channel pair
+#define ELEMENT_LFE 3 // Coded like a single channel
+#define ELEMENT_DSE 4 // Data stream, skipped
+#define ELEMENT_FIL 6 // Fill, skipped
+#define ELEMENT_END 7
+
+#define BIT_DEPTH       16
+#define MAX_PREFIX      9  // Unary prefix length that announces an escape
+#define RUN_ESCAPE_BITS 16 // Zero runs escape to a 16-bit count
+#define HISTORY_SHIFT   9  // The Rice history is Q9
+#define HISTORY_CLAMP   0xFFFF
+#define MAX_RICE_LIMIT  22 // Prefix, stop bit and remainder fit one peek
+#define FIRST_ORDER     31 // Predictor order that means plain integration
+#define MAX_ORDER       32
+
+static const char *TAG = "alac_dec";
+
+struct alac_decoder {
+  uint32_t frame_length;
+  int channels;
+  uint32_t pb; // Rice history multiplier
+  uint32_t mb; // Initial history
+  uint32_t kb; // Rice parameter limit
+  int32_t *mix[2]; // Per channel: residuals in, samples out
+};
+
+typedef struct {
+  const uint8_t *data;
+  size_t len;
+  size_t bit;
+} bit_reader_t;
+
+typedef struct {
+  uint32_t mode;
+  uint32_t denshift;
+  uint32_t pb_factor;
+  uint32_t order;
+  int16_t coefs[MAX_ORDER];
+} channel_params_t;
+
+/* ---------- bitstream ---------- */
+
+// The next 32 bits, MSB first; zeros past the end of the input
+static inline uint32_t peek32(const bit_reader_t *br) {
+  size_t byte = br->bit >> 3;
+  uint32_t shift = br->bit & 7;
+  uint8_t b[5] = {0};
+  if (byte + sizeof(b) <= br->len) {
+    memcpy(b, br->data + byte, sizeof(b));
+  } else if (byte < br->len) {
+    memcpy(b, br->data + byte, br->len - byte);
+  }
+  uint32_t word = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) |
+                  ((uint32_t)b[2] << 8) | b[3];
+  return shift ? (word << shift) | (b[4] >> (8 - shift)) : word;
+}
+
+// 1 to 32 bits
+static inline uint32_t read_bits(bit_reader_t *br, int count) {
+  uint32_t value = peek32(br) >> (32 - count);
+  br->bit += count;
+  return value;
+}
+
+static inline bool overran(const bit_reader_t *br) {
+  return br->bit > br->len * 8;
+}
+
+static inline uint32_t leading_zeros(uint32_t x) {
+  return x ? (uint32_t)__builtin_clz(x) : 32;
+}
+
+/**
+ * One adaptive Golomb value: a unary quotient, then a k-bit remainder that
+ * is sent in k - 1 bits when it is 0; or, after MAX_PREFIX ones, the value
+ * itself in escape_bits. Either way it is all within one 32-bit peek.
+ */
+static inline uint32_t read_golomb(bit_reader_t *br, uint32_t m, uint32_t k,
+                                   int escape_bits) {
+  uint32_t word = peek32(br);
+  uint32_t prefix = leading_zeros(~word);
+  if (prefix >= MAX_PREFIX) {
+    br->bit += MAX_PREFIX + escape_bits;
+    return (word << MAX_PREFIX) >> (32 - escape_bits);
+  }
+
+  uint32_t value = prefix * m;
+  br->bit += prefix + 1;
+  if (k > 1) {
+    uint32_t rem = (word << (prefix + 1)) >> (32 - k);
+    if (rem >= 2) {
+      value += rem - 1;
+      br->bit += k;
+    } else {
+      br->bit += k - 1;
+    }
+  }
+  return value;
+}
+
+/* ---------- residuals and prediction ---------- */
+
+static bool read_residuals(const alac_decoder_t *decoder, bit_reader_t *br,
+                           uint32_t pb_factor, int32_t *out, uint32_t count,
+                           int chan_bits) {
+  const uint32_t pb = decoder->pb * pb_factor / 4;
+  const uint32_t wb = (1u << decoder->kb) - 1;
+  uint32_t mb = decoder->mb;
+  uint32_t zmode = 0;
+  uint32_t c = 0;
+
+  while (c < count) {
+    uint32_t k = 31 - leading_zeros((mb >> HISTORY_SHIFT) + 3);
+    if (k > decoder->kb) {
+      k = decoder->kb;
+    }
+    uint32_t n = read_golomb(br, (1u << k) - 1, k, chan_bits);
+    uint32_t coded = n + zmode;
+    // Even codes are positive, odd ones negative
+    out[c++] = (coded & 1) ? -(int32_t)((coded + 1) >> 1)
+                           : (int32_t)(coded >> 1);
+
+    mb = pb * coded + mb - ((pb * mb) >> HISTORY_SHIFT);
+    if (n > HISTORY_CLAMP) {
+      mb = HISTORY_CLAMP;
+    }
+    zmode = 0;
+    // Quiet: a run of zeros follows, and the value after it is sent one less
+    if ((mb << 2) < (1u << HISTORY_SHIFT) && c < count) {
+      zmode = 1;
+      uint32_t kz = leading_zeros(mb) - 24 + ((mb + 16) >> 6);
+      uint32_t run =
+          read_golomb(br, ((1u << kz) - 1) & wb, kz, RUN_ESCAPE_BITS);
+      if (run > count - c) {
+        return false;
+      }
+      memset(out + c, 0, run * sizeof(out[0]));
+      c += run;
+      if (run >= 0xFFFF) {
+        zmode = 0;
+      }
+      mb = 0;
+    }
+  }
+  // Past the end every read was zeros; the values are garbage
+  return !overran(br);
+}
+
+static inline int32_t sign_extend(int32_t x, uint32_t shift) {
+  return (int32_t)((uint32_t)x << shift) >> shift;
+}
+
+static inline int32_t sign_of(int32_t x) {
+  return (x > 0) - (x < 0);
+}
+
+/**
+ * Undo the adaptive FIR in place: buf holds residuals in and samples out.
+ * After every sample the coefficients take a sign-sign step, exactly as in
+ * the encoder, so they are the caller's private copy. The products wrap
+ * like the reference's 32-bit arithmetic.
+ */
+static inline __attribute__((always_inline)) void
+unpredict_order(int32_t *buf, uint32_t count, int16_t *coefs, const int order,
+                uint32_t shift, uint32_t denshift) {
+  const int32_t denhalf = denshift ? 1 << (denshift - 1) : 0;
+  const uint32_t lim = (uint32_t)order + 1;
+  uint32_t warm = lim < count ? lim : count;
+
+  for (uint32_t j = 1; j < warm; j++) {
+    buf[j] = sign_extend(buf[j] + buf[j - 1], shift);
+  }
+  for (uint32_t j = lim; j < count; j++) {
+    const int32_t *hist = buf + j - 1;
+    int32_t top = buf[j - lim];
+    uint32_t sum = 0;
+    for (int k = 0; k < order; k++) {
+      sum += (uint32_t)coefs[k] * (uint32_t)(hist[-k] - top);
+    }
+
+    int32_t del = buf[j];
+    buf[j] = sign_extend(
+        del + top + ((int32_t)(sum + (uint32_t)denhalf) >> denshift), shift);
+
+    int32_t del0 = del;
+    if (del > 0) {
+      for (int k = order - 1; k >= 0; k--) {
+        int32_t dd = top - hist[-k];
+        int32_t sgn = sign_of(dd);
+        coefs[k] -= sgn;
+        del0 -= (order - k) * ((sgn * dd) >> denshift);
+        if (del0 <= 0) {
+          break;
+        }
+      }
+    } else if (del < 0) {
+      for (int k = order - 1; k >= 0; k--) {
+        int32_t dd = top - hist[-k];
+        int32_t sgn = sign_of(dd);
+        coefs[k] += sgn;
+        del0 -= (order - k) * ((-sgn * dd) >> denshift);
+        if (del0 >= 0) {
+          break;
+        }
+      }
+    }
+  }
+}
+
+static void unpredict(int32_t *buf, uint32_t count, int16_t *coefs,
+                      uint32_t order, int chan_bits, uint32_t denshift) {
+  const uint32_t shift = 32 - (uint32_t)chan_bits;
+  if (order == 0 || count == 0) {
+    return; // The residuals are the samples
+  }
+  if (order == FIRST_ORDER) {
+    for (uint32_t j = 1; j < count; j++) {
+      buf[j] = sign_extend(buf[j] + buf[j - 1], shift);
+    }
+    return;
+  }
+  // The orders encoders actually use get copies with the taps unrolled, so
+  // history and coefficients stay in registers
+  switch (order) {
+  case 4:
+    unpredict_order(buf, count, coefs, 4, shift, denshift);
+    break;
+  case 8:
+    unpredict_order(buf, count, coefs, 8, shift, denshift);
+    break;
+  default:
+    unpredict_order(buf, count, coefs, (int)order, shift, denshift);
+    break;
+  }
+}
+
+/* ---------- elements ---------- */
+
+static void read_params(bit_reader_t *br, channel_params_t *params) {
+  uint32_t byte = read_bits(br, 8);
+  params->mode = byte >> 4;
+  params->denshift = byte & 0xF;
+  byte = read_bits(br, 8);
+  params->pb_factor = byte >> 5;
+  params->order = byte & 0x1F;
+  for (uint32_t i = 0; i < params->order; i++) {
+    params->coefs[i] = (int16_t)read_bits(br, 16);
+  }
+}
+
+/**
+ * One SCE or CPE into decoder->mix.
+ * @return Samples per channel, -1 if malformed or unsupported
+ */
+static int decode_element(alac_decoder_t *decoder, bit_reader_t *br,
+                          int channels, int *mix_bits, int *mix_res) {
+  br->bit += 4; // Element instance
+  if (read_bits(br, 12) != 0) {
+    return -1;
+  }
+  uint32_t header = read_bits(br, 4);
+  bool partial = header & 0x8;
+  uint32_t bytes_shifted = (header >> 1) & 0x3;
+  bool escaped = header & 0x1;
+  if (bytes_shifted != 0) {
+    return -1; // Only used for 24- and 32-bit audio
+  }
+
+  uint32_t count = decoder->frame_length;
+  if (partial) {
+    count = read_bits(br, 32);
+  }
+  if (count == 0 || count > decoder->frame_length) {
+    return -1;
+  }
+
+  *mix_bits = 0;
+  *mix_res = 0;
+  if (escaped) {
+    // Stored verbatim, channels interleaved
+    for (uint32_t i = 0; i < count; i++) {
+      for (int ch = 0; ch < channels; ch++) {
+        decoder->mix[ch][i] = (int16_t)read_bits(br, BIT_DEPTH);
+      }
+    }
+    return overran(br) ? -1 : (int)count;
+  }
+
+  *mix_bits = (int)read_bits(br, 8);
+  *mix_res = (int8_t)read_bits(br, 8);
+  if (*mix_bits >= 32) {
+    return -1;
+  }
+  channel_params_t params[2];
+  for (int ch = 0; ch < channels; ch++) {
+    read_params(br, &params[ch]);
+  }
+  // The pair's side channel is one bit wider than the samples
+  int chan_bits = BIT_DEPTH + channels - 1;
+  for (int ch = 0; ch < channels; ch++) {
+    channel_params_t *p = &params[ch];
+    int32_t *buf = decoder->mix[ch];
+    if (!read_residuals(decoder, br, p->pb_factor, buf, count, chan_bits)) {
+      return -1;
+    }
+    if (p->mode != 0) {
+      unpredict(buf, count, NULL, FIRST_ORDER, chan_bits, 0);
+    }
+    unpredict(buf, count, p->coefs, p->order, chan_bits, p->denshift);
+  }
+  return (int)count;
+}
+
+// Left and right from mid and side, packed as one little-endian stereo word
+static inline uint32_t unmix_pair(int32_t u, int32_t v, int mix_bits,
+                                  int mix_res) {
+  int32_t l = u;
+  int32_t r = v;
+  if (mix_res != 0) {
+    l = u + v - ((mix_res * v) >> mix_bits);
+    r = l - v;
+  }
+  return (uint32_t)(uint16_t)l | ((uint32_t)(uint16_t)r << 16);
+}
+
+static void write_output(const alac_decoder_t *decoder, int16_t *output,
+                         uint32_t count, int mix_bits, int mix_res) {
+  const int32_t *u = decoder->mix[0];
+  if (decoder->channels == 1) {
+    for (uint32_t j = 0; j < count; j++) {
+      output[j] = (int16_t)u[j];
+    }
+    return;
+  }
+
+  const int32_t *v = decoder->mix[1];
+  if (((uintptr_t)output & 3) == 0) {
+    // Pool slots and the decode buffer are word aligned: one store a sample
+    uint32_t *dst = (uint32_t *)output;
+    for (uint32_t j = 0; j < count; j++) {
+      dst[j] = unmix_pair(u[j], v[j], mix_bits, mix_res);
+    }
+    return;
+  }
+  for (uint32_t j = 0; j < count; j++) {
+    uint32_t pair = unmix_pair(u[j], v[j], mix_bits, mix_res);
+    memcpy(output + 2 * j, &pair, sizeof(pair));
+  }
+}
+
+/* ---------- public ---------- */
+
+alac_decoder_t *alac_decoder_create(const audio_format_t *format) {
+  if (!format) {
+    return NULL;
+  }
+
+  // Same defaults as build_alac_magic_cookie()
+  uint32_t frame_length =
+      format->max_samples_per_frame
+          ? format->max_samples_per_frame
+          : (format->frame_size > 0 ? (uint32_t)format->frame_size : 352);
+  int bit_depth = format->sample_size
+                      ? format->sample_size
+                      : (format->bits_per_sample ? format->bits_per_sample
+                                                 : BIT_DEPTH);
+  int channels = format->num_channels
+                     ? format->num_channels
+                     : (format->channels ? format->channels : 2);
+  uint32_t kb = format->rice_limit ? format->rice_limit : 14;
+  if (bit_depth != BIT_DEPTH || channels < 1 || channels > 2 ||
+      frame_length > ALAC_DECODER_MAX_FRAME || kb > MAX_RICE_LIMIT) {
+    ESP_LOGE(TAG, "Unsupported ALAC stream: %d-bit, %d ch, %" PRIu32
+             " samples per frame, rice limit %" PRIu32,
+             bit_depth, channels, frame_length, kb);
+    return NULL;
+  }
+
+  // The buffers are touched for every sample: keep them out of PSRAM
+  size_t buffer_bytes = frame_length * sizeof(int32_t);
+  alac_decoder_t *decoder =
+      heap_caps_calloc(1, sizeof(*decoder) + (size_t)channels * buffer_bytes,
+                       MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  if (!decoder) {
+    ESP_LOGE(TAG, "No memory for %" PRIu32 "-sample frames", frame_length);
+    return NULL;
+  }
+  decoder->frame_length = frame_length;
+  decoder->channels = channels;
+  decoder->pb = format->rice_history_mult ? format->rice_history_mult : 40;
+  decoder->mb =
+      format->rice_initial_history ? format->rice_initial_history : 10;
+  decoder->kb = kb;
+  for (int ch = 0; ch < channels; ch++) {
+    decoder->mix[ch] = (int32_t *)(decoder + 1) + (size_t)ch * frame_length;
+  }
+
+  ESP_LOGI(TAG, "In-tree ALAC decoder: %d ch, %" PRIu32 " samples per frame",
+           channels, frame_length);
+  return decoder;
+}
+
+void alac_decoder_destroy(alac_decoder_t *decoder) {
+  heap_caps_free(decoder);
+}
+
+int alac_decoder_decode(alac_decoder_t *decoder, const uint8_t *input,
+                        size_t input_len, int16_t *output,
+                        size_t output_capacity_samples) {
+  if (!decoder || !input || !output) {
+    return -1;
+  }
+
+  bit_reader_t br = {.data = input, .len = input_len};
+  int samples = -1;
+  int mix_bits = 0;
+  int mix_res = 0;
+
+  // Every element takes at least its 3-bit tag, so this ends at the input
+  while (!overran(&br)) {
+    uint32_t tag = read_bits(&br, 3);
+    switch (tag) {
+    case ELEMENT_SCE:
+    case ELEMENT_LFE:
+    case ELEMENT_CPE: {
+      int channels = tag == ELEMENT_CPE ? 2 : 1;
+      // One audio element per frame, in the configured layout
+      if (samples >= 0 || channels != decoder->channels) {
+        return -1;
+      }
+      samples = decode_element(decoder, &br, channels, &mix_bits, &mix_res);
+      if (samples < 0) {
+        return -1;
+      }
+      break;
+    }
+    case ELEMENT_DSE: {
+      br.bit += 4; // Element instance
+      bool align = read_bits(&br, 1);
+      uint32_t bytes = read_bits(&br, 8);
+      if (bytes == 255) {
+        bytes += read_bits(&br, 8);
+      }
+      if (align) {
+        br.bit = (br.bit + 7) & ~(size_t)7;
+      }
+      br.bit += (size_t)bytes * 8;
+      break;
+    }
+    case ELEMENT_FIL: {
+      uint32_t bytes = read_bits(&br, 4);
+      if (bytes == 15) {
+        bytes += read_bits(&br, 8) - 1;
+      }
+      br.bit += (size_t)bytes * 8;
+      break;
+    }
+    case ELEMENT_END:
+      if (samples < 0 || overran(&br) ||
+          (size_t)samples > output_capacity_samples) {
+        return -1;
+      }
+      write_output(decoder, output, (uint32_t)samples, mix_bits, mix_res);
+      return samples;
+    default:
+      return -1; // Coupling and program config elements are not ALAC
+    }
+  }
+  return -1;
+}
+
+int alac_decoder_channels(const alac_decoder_t *decoder) {
+  return decoder ? decoder->channels : 0;
+}
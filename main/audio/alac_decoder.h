@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "audio_receiver.h"
+
+/**
+ * In-tree ALAC decoder (CONFIG_AUDIO_ALAC_INTREE).
+ *
+ * Covers what AirPlay senders produce: 16-bit mono (SCE) and stereo (CPE)
+ * frames, compressed or escaped, whole or partial, with fill and data
+ * elements skipped. Everything is fixed point. Residuals are decoded and
+ * predicted in place in two per-channel buffers from internal RAM, and the
+ * unmix writes interleaved PCM straight into the caller's buffer (the
+ * reserved pool slot on the zero-copy path), one 32-bit store per stereo
+ * sample.
+ */
+
+#define ALAC_DECODER_MAX_FRAME 4096 // ALAC's default frame length
+
+typedef struct alac_decoder alac_decoder_t;
+
+/**
+ * Set up from the SDP/ANNOUNCE parameters, with the same defaults as the
+ * magic cookie. NULL for bit depths other than 16, more than two channels
+ * or frames over ALAC_DECODER_MAX_FRAME.
+ */
+alac_decoder_t *alac_decoder_create(const audio_format_t *format);
+void alac_decoder_destroy(alac_decoder_t *decoder);
+
+/**
+ * Decode one frame into interleaved PCM. The input is read strictly within
+ * input_len; a frame that runs past it is rejected.
+ * @param output_capacity_samples Samples per channel output can hold
+ * @return Samples per channel, or -1 on a malformed or unsupported frame
+ */
+int alac_decoder_decode(alac_decoder_t *decoder, const uint8_t *input,
+                        size_t input_len, int16_t *output,
+                        size_t output_capacity_samples);
+
+/** Channels of the decoded PCM (1 or 2). */
+int alac_decoder_channels(const alac_decoder_t *decoder);
@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_arena.h"
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "mem_budget.h"
+
+static const char *TAG = "audio_arena";
+
+/* ---------- helpers ---------- */
+
+/* Offset of the oldest payload still held. Caller holds the lock. */
+static inline size_t read_pos(const audio_arena_t *a) {
+  return a->entries[a->entry_head].offset;
+}
+
+/* Find a contiguous region of len bytes at or after write_pos, wrapping to
+   the start if the tail is too short. Caller holds the lock.
+   Returns the offset, or (size_t)-1 if there is no room. */
+static size_t find_space(const audio_arena_t *a, size_t len) {
+  if (a->entry_count == 0) {
+    return len <= a->size ? 0 : (size_t)-1;
+  }
+
+  size_t rd = read_pos(a);
+  if (a->write_pos >= rd) {
+    /* Free space is [write_pos, size) + [0, rd) */
+    if (a->write_pos + len <= a->size) {
+      return a->write_pos;
+    }
+    if (len < rd) {
+      return 0;
+    }
+    return (size_t)-1;
+  }
+
+  /* Free space is [write_pos, rd); keep one byte so full != empty */
+  if (a->write_pos + len < rd) {
+    return a->write_pos;
+  }
+  return (size_t)-1;
+}
+
+/* ---------- init / deinit ---------- */
+
+esp_err_t audio_arena_init(audio_arena_t *arena, size_t size,
+                           int entry_capacity) {
+  if (!arena || size == 0 || entry_capacity <= 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  memset(arena, 0, sizeof(*arena));
+
+  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  arena->lock = lock;
+
+  arena->data = (uint8_t *)mem_alloc_prefer_psram(MEM_TAG_AUDIO, size);
+  if (!arena->data) {
+    ESP_LOGE(TAG, "Failed to allocate %zu byte arena", size);
+    return ESP_ERR_NO_MEM;
+  }
+  arena->size = size;
+
+  arena->entries = (audio_arena_entry_t *)mem_alloc_prefer_psram(
+      MEM_TAG_AUDIO, (size_t)entry_capacity * sizeof(audio_arena_entry_t));
+  if (!arena->entries) {
+    ESP_LOGE(TAG, "Failed to allocate arena index");
+    audio_arena_deinit(arena);
+    return ESP_ERR_NO_MEM;
+  }
+  arena->entry_capacity = entry_capacity;
+
+  ESP_LOGI(TAG, "Compressed arena created: %zu bytes, %d packets", size,
+           entry_capacity);
+  return ESP_OK;
+}
+
+void audio_arena_deinit(audio_arena_t *arena) {
+  if (!arena) {
+    return;
+  }
+
+  mem_free(MEM_TAG_AUDIO, arena->data, arena->size);
+  arena->data = NULL;
+  mem_free(MEM_TAG_AUDIO, arena->entries,
+           (size_t)arena->entry_capacity * sizeof(audio_arena_entry_t));
+  arena->entries = NULL;
+  arena->size = 0;
+  arena->entry_capacity = 0;
+  arena->entry_count = 0;
+}
+
+/* ---------- flush ---------- */
+
+void audio_arena_flush(audio_arena_t *arena) {
+  if (!arena || !arena->data) {
+    return;
+  }
+
+  portENTER_CRITICAL(&arena->lock);
+  arena->entry_head = 0;
+  arena->entry_count = 0;
+  arena->write_pos = 0;
+  arena->used_bytes = 0;
+  arena->generation++;
+  arena->resets++;
+  portEXIT_CRITICAL(&arena->lock);
+}
+
+/* Entries per critical section, so a long discard never holds the lock
+   for more than a few microseconds */
+#define DISCARD_BATCH 32
+
+int audio_arena_discard(audio_arena_t *arena, uint32_t from, uint32_t until) {
+  if (!arena || !arena->data) {
+    return 0;
+  }
+
+  int removed = 0;
+  bool more = true;
+  while (more) {
+    portENTER_CRITICAL(&arena->lock);
+    int batch = 0;
+    while (arena->entry_count > 0 && batch < DISCARD_BATCH) {
+      audio_arena_entry_t *e = &arena->entries[arena->entry_head];
+      if (e->rtp_timestamp - from >= until - from) {
+        break;
+      }
+      arena->entry_head = (arena->entry_head + 1) % arena->entry_capacity;
+      arena->entry_count--;
+      arena->used_bytes -= e->len;
+      batch++;
+    }
+    if (batch > 0) {
+      arena->generation++; // The head a pop may be copying is gone
+    }
+    more = batch == DISCARD_BATCH;
+    portEXIT_CRITICAL(&arena->lock);
+    removed += batch;
+  }
+  return removed;
+}
+
+/* ---------- producer ---------- */
+
+uint8_t *audio_arena_reserve(audio_arena_t *arena, size_t max_len,
+                             audio_arena_reservation_t *res) {
+  if (!arena || !arena->data || !res || max_len == 0 ||
+      max_len > UINT16_MAX) {
+    return NULL;
+  }
+
+  portENTER_CRITICAL(&arena->lock);
+  if (arena->entry_count >= arena->entry_capacity) {
+    portEXIT_CRITICAL(&arena->lock);
+    return NULL;
+  }
+  size_t offset = find_space(arena, max_len);
+  if (offset == (size_t)-1) {
+    portEXIT_CRITICAL(&arena->lock);
+    return NULL;
+  }
+  /* Entry is not visible until commit; the caller keeps where it goes, so
+     a flush in between cannot move it */
+  res->offset = (uint32_t)offset;
+  res->resets = arena->resets;
+  portEXIT_CRITICAL(&arena->lock);
+
+  return arena->data + offset;
+}
+
+bool audio_arena_commit(audio_arena_t *arena,
+                        const audio_arena_reservation_t *res,
+                        uint32_t rtp_timestamp, size_t len) {
+  if (!arena || !arena->data || !res || len == 0) {
+    return false;
+  }
+
+  portENTER_CRITICAL(&arena->lock);
+  /* A flush reset write_pos and the FIFO after the reserve; the payload
+     belongs to the old stream position, so leave it out */
+  bool valid = arena->resets == res->resets &&
+               arena->entry_count < arena->entry_capacity;
+  if (valid) {
+    int tail = (arena->entry_head + arena->entry_count) % arena->entry_capacity;
+    audio_arena_entry_t *e = &arena->entries[tail];
+    e->rtp_timestamp = rtp_timestamp;
+    e->offset = res->offset;
+    e->len = (uint16_t)len;
+    arena->entry_count++;
+    arena->write_pos = res->offset + len;
+    arena->used_bytes += len;
+  }
+  portEXIT_CRITICAL(&arena->lock);
+  return valid;
+}
+
+/* ---------- consumer ---------- */
+
+bool audio_arena_pop(audio_arena_t *arena, uint8_t *out, size_t capacity,
+                     size_t *len, uint32_t *rtp_timestamp) {
+  if (!arena || !arena->data || !out || !len || !rtp_timestamp) {
+    return false;
+  }
+
+  portENTER_CRITICAL(&arena->lock);
+  if (arena->entry_count == 0) {
+    portEXIT_CRITICAL(&arena->lock);
+    return false;
+  }
+  audio_arena_entry_t e = arena->entries[arena->entry_head];
+  uint32_t generation = arena->generation;
+  portEXIT_CRITICAL(&arena->lock);
+
+  /* Copy outside the lock; the producer cannot reuse this region until the
+     entry is removed below, and a flush is detected via generation. */
+  size_t n = e.len <= capacity ? e.len : 0;
+  if (n > 0) {
+    memcpy(out, arena->data + e.offset, n);
+  }
+
+  portENTER_CRITICAL(&arena->lock);
+  bool valid = arena->generation == generation && arena->entry_count > 0;
+  if (valid) {
+    arena->entry_head = (arena->entry_head + 1) % arena->entry_capacity;
+    arena->entry_count--;
+    arena->used_bytes -= e.len;
+  }
+  portEXIT_CRITICAL(&arena->lock);
+
+  if (!valid || n == 0) {
+    if (valid) {
+      ESP_LOGW(TAG, "Dropping %u byte packet (decoder buffer %zu)", e.len,
+               capacity);
+    }
+    return false;
+  }
+
+  *len = n;
+  *rtp_timestamp = e.rtp_timestamp;
+  return true;
+}
+
+int audio_arena_get_packet_count(audio_arena_t *arena) {
+  if (!arena) {
+    return 0;
+  }
+
+  int count;
+  portENTER_CRITICAL(&arena->lock);
+  count = arena->entry_count;
+  portEXIT_CRITICAL(&arena->lock);
+  return count;
+}
+
+size_t audio_arena_get_used_bytes(audio_arena_t *arena) {
+  if (!arena) {
+    return 0;
+  }
+
+  size_t used;
+  portENTER_CRITICAL(&arena->lock);
+  used = arena->used_bytes;
+  portEXIT_CRITICAL(&arena->lock);
+  return used;
+}
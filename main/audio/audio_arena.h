@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+/**
+ * Variable-size PSRAM arena for compressed audio packets.
+ *
+ * Buffered (type 103) streams arrive in order over TCP, so packets are kept
+ * as a FIFO of encoded payloads and decoded just ahead of playout. ALAC/AAC
+ * payloads are several times smaller than PCM, which lets the same memory
+ * hold minutes of audio instead of seconds.
+ *
+ * Single producer (buffered TCP task), single consumer (playback task).
+ */
+
+typedef struct {
+  uint32_t rtp_timestamp;
+  uint32_t offset; // Byte offset of payload in data[]
+  uint16_t len;
+} audio_arena_entry_t;
+
+typedef struct {
+  uint8_t *data;                // Byte ring in PSRAM
+  size_t size;                  // Size of data[]
+  size_t write_pos;             // Next write offset
+  audio_arena_entry_t *entries; // FIFO of packet descriptors
+  int entry_capacity;           // Max packets
+  int entry_head;               // Oldest entry
+  int entry_count;              // Packets currently held
+  size_t used_bytes;            // Payload bytes held (excludes wrap padding)
+  uint32_t generation;          // Bumped by flush, invalidates in-flight pops
+  uint32_t resets;              // Bumped by flush only, invalidates reserves
+  portMUX_TYPE lock;            // Spinlock for cursors
+} audio_arena_t;
+
+/** Where a reserved payload goes; handed back to commit unchanged. */
+typedef struct {
+  uint32_t offset; // Byte offset of the reserved region in data[]
+  uint32_t resets; // Arena flush count at reserve time
+} audio_arena_reservation_t;
+
+esp_err_t audio_arena_init(audio_arena_t *arena, size_t size,
+                           int entry_capacity);
+void audio_arena_deinit(audio_arena_t *arena);
+void audio_arena_flush(audio_arena_t *arena);
+
+/**
+ * Remove the oldest packets while their timestamps fall in [from, until),
+ * for a partial flush. Packets behind the first one outside the range are
+ * kept.
+ * @return Number of packets removed
+ */
+int audio_arena_discard(audio_arena_t *arena, uint32_t from, uint32_t until);
+
+/**
+ * Reserve contiguous space for a payload of up to max_len bytes.
+ * @param res Output: reservation to pass to audio_arena_commit()
+ * @return Write pointer, or NULL if the arena is full
+ */
+uint8_t *audio_arena_reserve(audio_arena_t *arena, size_t max_len,
+                             audio_arena_reservation_t *res);
+
+/**
+ * Append the reserved payload (len <= max_len passed to reserve). Dropped if
+ * the arena was flushed since the reservation was made.
+ * @return true if the packet was appended
+ */
+bool audio_arena_commit(audio_arena_t *arena,
+                        const audio_arena_reservation_t *res,
+                        uint32_t rtp_timestamp, size_t len);
+
+/**
+ * Copy the oldest packet out and remove it.
+ * @param out Destination buffer (internal RAM, for the decoder)
+ * @param capacity Size of out
+ * @param len Output: payload length
+ * @param rtp_timestamp Output: packet timestamp
+ * @return true if a packet was returned
+ */
+bool audio_arena_pop(audio_arena_t *arena, uint8_t *out, size_t capacity,
+                     size_t *len, uint32_t *rtp_timestamp);
+
+int audio_arena_get_packet_count(audio_arena_t *arena);
+size_t audio_arena_get_used_bytes(audio_arena_t *arena);
@@ -0,0 +1,121 @@
+#include "audio_bench.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define BUCKETS           128 // Four per octave cover the 32-bit range
+#define REPORT_PERIOD_US  ((int64_t)CONFIG_AUDIO_BENCH_REPORT_S * 1000000LL)
+#define REPORT_CHECK_MASK 0x3F // Look at the clock every 64 records
+
+typedef struct {
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+  uint32_t hist[BUCKETS];
+} bench_stage_t;
+
+static const char *TAG = "bench";
+
+static const char *const stage_names[AUDIO_BENCH_COUNT] = {
+    "decrypt", "decode_alac", "decode_aac", "decode_pcm", "queue",
+    "borrow",  "gain",
+};
+
+static bench_stage_t stages[AUDIO_BENCH_COUNT];
+static uint32_t records;
+static int64_t window_start_us;
+
+static uint32_t bucket_of(uint32_t cycles) {
+  if (cycles < 4) {
+    return cycles;
+  }
+  uint32_t octave = 31 - (uint32_t)__builtin_clz(cycles);
+  return 4 * (octave - 1) + ((cycles >> (octave - 2)) & 3);
+}
+
+static uint32_t bucket_upper(uint32_t bucket) {
+  if (bucket < 4) {
+    return bucket;
+  }
+  uint32_t shift = bucket / 4 - 1;
+  uint64_t upper = ((uint64_t)(5 + bucket % 4) << shift) - 1;
+  return upper > UINT32_MAX ? UINT32_MAX : (uint32_t)upper;
+}
+
+const char *audio_bench_name(audio_bench_id_t id) {
+  return id < AUDIO_BENCH_COUNT ? stage_names[id] : "unknown";
+}
+
+bool audio_bench_get(audio_bench_id_t id, audio_bench_result_t *result) {
+  if (id >= AUDIO_BENCH_COUNT || !result) {
+    return false;
+  }
+
+  const bench_stage_t *stage = &stages[id];
+  memset(result, 0, sizeof(*result));
+  if (stage->count == 0) {
+    return false;
+  }
+
+  result->count = stage->count;
+  result->min = stage->min;
+  result->max = stage->max;
+  result->avg = (uint32_t)(stage->sum / stage->count);
+
+  uint64_t needed = ((uint64_t)stage->count * 99 + 99) / 100;
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < BUCKETS; i++) {
+    seen += stage->hist[i];
+    if (seen >= needed) {
+      uint32_t upper = bucket_upper(i);
+      result->p99 = upper < stage->max ? upper : stage->max;
+      break;
+    }
+  }
+  return true;
+}
+
+void audio_bench_report(void) {
+  for (int id = 0; id < AUDIO_BENCH_COUNT; id++) {
+    audio_bench_result_t r;
+    if (!audio_bench_get((audio_bench_id_t)id, &r)) {
+      continue;
+    }
+    ESP_LOGI(TAG,
+             "bench v1 %s n=%" PRIu32 " min=%" PRIu32 " avg=%" PRIu32
+             " p99=%" PRIu32 " max=%" PRIu32,
+             stage_names[id], r.count, r.min, r.avg, r.p99, r.max);
+  }
+  memset(stages, 0, sizeof(stages));
+  window_start_us = esp_timer_get_time();
+}
+
+void audio_bench_record(audio_bench_id_t id, uint32_t cycles) {
+  if (id >= AUDIO_BENCH_COUNT) {
+    return;
+  }
+
+  bench_stage_t *stage = &stages[id];
+  if (stage->count == 0 || cycles < stage->min) {
+    stage->min = cycles;
+  }
+  if (cycles > stage->max) {
+    stage->max = cycles;
+  }
+  stage->count++;
+  stage->sum += cycles;
+  stage->hist[bucket_of(cycles)]++;
+
+  if ((++records & REPORT_CHECK_MASK) == 0) {
+    int64_t now = esp_timer_get_time();
+    if (window_start_us == 0) {
+      window_start_us = now;
+    } else if (now - window_start_us >= REPORT_PERIOD_US) {
+      audio_bench_report();
+    }
+  }
+}
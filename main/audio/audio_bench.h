@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#if CONFIG_AUDIO_BENCH
+#include "esp_cpu.h"
+#endif
+
+/**
+ * Cycle-count profiling of the per-frame hot paths.
+ *
+ * Each stage is timed with the CPU cycle counter on the frames of the live
+ * stream and folded into a log-scale histogram (four buckets per octave),
+ * from which min/avg/p99/max are read. Every CONFIG_AUDIO_BENCH_REPORT_S
+ * seconds one line per stage is logged in a fixed format, e.g.
+ *
+ *   bench v1 decode_alac n=1250 min=41210 avg=45877 p99=57343 max=61002
+ *
+ * and the counters restart, so releases can be compared by grepping logs.
+ * Without CONFIG_AUDIO_BENCH the hooks compile to nothing.
+ */
+
+typedef enum {
+  AUDIO_BENCH_DECRYPT = 0,
+  AUDIO_BENCH_DECODE_ALAC,
+  AUDIO_BENCH_DECODE_AAC,
+  AUDIO_BENCH_DECODE_PCM,
+  AUDIO_BENCH_QUEUE,
+  AUDIO_BENCH_BORROW, // Playback: take the next frame from the buffer
+  AUDIO_BENCH_GAIN,   // Playback: volume (and widening) of one frame
+  AUDIO_BENCH_COUNT,
+} audio_bench_id_t;
+
+typedef struct {
+  uint32_t count;
+  uint32_t min; // Cycles
+  uint32_t avg;
+  uint32_t p99; // Upper edge of the p99 histogram bucket
+  uint32_t max;
+} audio_bench_result_t;
+
+#if CONFIG_AUDIO_BENCH
+
+/** Account one timed call (any task; stats only, no locking). */
+void audio_bench_record(audio_bench_id_t id, uint32_t cycles);
+
+/**
+ * Summary of the current reporting window.
+ * @return false if the stage has not run in it
+ */
+bool audio_bench_get(audio_bench_id_t id, audio_bench_result_t *result);
+
+/** Stable stage name used in the report ("decrypt", "decode_alac", ...). */
+const char *audio_bench_name(audio_bench_id_t id);
+
+/** Log the report lines now and start a new window. */
+void audio_bench_report(void);
+
+static inline uint32_t audio_bench_start(void) {
+  return esp_cpu_get_cycle_count();
+}
+
+static inline void audio_bench_stop(audio_bench_id_t id, uint32_t start) {
+  audio_bench_record(id, esp_cpu_get_cycle_count() - start);
+}
+
+#else
+
+static inline uint32_t audio_bench_start(void) {
+  return 0;
+}
+
+static inline void audio_bench_stop(audio_bench_id_t id, uint32_t start) {
+  (void)id;
+  (void)start;
+}
+
+#endif
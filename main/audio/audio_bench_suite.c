@@ -0,0 +1,732 @@
+#include "audio_bench_suite.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_buffer.h"
+#include "audio_crypto.h"
+#include "audio_decoder.h"
+#include "audio_gain.h"
+#include "audio_receiver.h"
+#include "audio_resampler.h"
+#include "encoder/impl/esp_aac_enc.h"
+#include "esp_audio_enc.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sodium.h"
+#include "task_placement.h"
+#if CONFIG_AUDIO_EQ
+#include "audio_eq.h"
+#endif
+#if CONFIG_AUDIO_ALAC_INTREE
+#include "alac_magic_cookie.h"
+#include "decoder/impl/esp_alac_dec.h"
+#include "esp_audio_dec.h"
+#endif
+
+#define ITERATIONS     200
+#define SAMPLE_RATE    44100
+#define ALAC_FRAME     352
+#define ALAC_FRAMES    4
+#define ALAC_MAX_BYTES (ALAC_FRAME * 4 + 64) // Escapes can exceed raw PCM
+#define AAC_FRAME      1024
+#define AAC_FRAMES     4
+#define AAC_MAX_BYTES  1536
+#define AAC_BITRATE    256000
+#define PAYLOAD_BYTES  1024 // Crypto: a typical AAC packet
+#define RTP_HEADER     12
+#define BUFFER_SLOTS   64
+#define COPY_BYTES     (16 * 1024)
+#define COPY_PSRAM     (128 * 1024)
+#define COPY_ROUNDS    8
+#define RESAMPLE_PPM   100
+
+#define SUITE_STACK 12288
+
+// Encoder parameters, the ones the decoder's magic cookie defaults to
+#define ALAC_ORDER      8
+#define ALAC_DENSHIFT   9
+#define ALAC_PB         40
+#define ALAC_MB         10
+#define ALAC_KB         14
+#define ALAC_MIX_BITS   2
+#define ALAC_MIX_RES    2
+#define ALAC_CHAN_BITS  17 // 16-bit stereo pair plus the side channel bit
+#define ALAC_MAX_PREFIX 9
+
+static const char *TAG = "bench_suite";
+
+static const char *const stage_names[AUDIO_BENCH_SUITE_COUNT] = {
+    "decode_alac",    "decode_aac",    "decrypt_aes", "decrypt_chacha",
+    "buffer_insert",  "buffer_take",   "gain",        "gain_wide",
+    "resample",       "eq",            "decode_alac_vendor",
+};
+
+// Scratch for one run, from internal RAM like the pipeline's own buffers
+typedef struct {
+  int16_t pcm[ALAC_FRAMES][ALAC_FRAME * 2];
+  uint8_t alac[ALAC_FRAMES][ALAC_MAX_BYTES];
+  size_t alac_len[ALAC_FRAMES];
+  uint8_t aac[AAC_FRAMES][AAC_MAX_BYTES];
+  size_t aac_len[AAC_FRAMES];
+  int16_t out[AAC_FRAME * 2];
+  int32_t wide[ALAC_FRAME * 2];
+  int32_t mid[ALAC_FRAME]; // Encoder channels and residuals
+  int32_t side[ALAC_FRAME];
+  int32_t residual[ALAC_FRAME];
+  uint8_t packet[RTP_HEADER + PAYLOAD_BYTES + 16 + 8];
+  uint8_t plain[PAYLOAD_BYTES + 16];
+  uint32_t cycles[ITERATIONS];
+} scratch_t;
+
+typedef struct {
+  audio_bench_suite_result_t *result;
+  scratch_t *scratch;
+  esp_err_t err;
+  SemaphoreHandle_t done;
+} suite_run_t;
+
+static bool busy;
+
+const char *audio_bench_suite_name(audio_bench_suite_id_t id) {
+  return id < AUDIO_BENCH_SUITE_COUNT ? stage_names[id] : "unknown";
+}
+
+/* ---------- test content ---------- */
+
+// Two tones per channel over low-level noise: busy enough that the
+// codecs do real work, and the same on every board
+static void fill_signal(int16_t *pcm, size_t samples, uint32_t offset,
+                        uint32_t *seed) {
+  const float w = 2.0f * (float)M_PI / SAMPLE_RATE;
+  for (size_t i = 0; i < samples; i++) {
+    float t = (float)(offset + i);
+    *seed = *seed * 1664525u + 1013904223u;
+    int32_t noise = (int32_t)(*seed >> 24) - 128;
+    float l = 9000.0f * sinf(w * 440.0f * t) + 4000.0f * sinf(w * 3100.0f * t);
+    float r = 8000.0f * sinf(w * 660.0f * t) + 3000.0f * sinf(w * 5300.0f * t);
+    pcm[2 * i] = (int16_t)(l + (float)noise);
+    pcm[2 * i + 1] = (int16_t)(r + (float)noise);
+  }
+}
+
+/* ---------- ALAC encoder ---------- */
+
+// A minimal encoder for the frames the decoder is timed on: one compressed
+// stereo element with fixed mid/side mixing and the decoder's own adaptive
+// predictor started from a first-order filter. It writes exactly what the
+// reference decoder reads, which the bit-exact check confirms.
+
+typedef struct {
+  uint8_t *buf;
+  size_t cap;
+  size_t bit;
+} bits_t;
+
+static void put_bits(bits_t *b, uint32_t value, int n) {
+  for (int i = n - 1; i >= 0; i--) {
+    size_t byte = b->bit >> 3;
+    if (byte >= b->cap) {
+      return;
+    }
+    uint8_t mask = (uint8_t)(0x80 >> (b->bit & 7));
+    if ((value >> i) & 1) {
+      b->buf[byte] |= mask;
+    } else {
+      b->buf[byte] &= (uint8_t)~mask;
+    }
+    b->bit++;
+  }
+}
+
+static int lead(uint32_t x) {
+  return x ? __builtin_clz(x) : 32;
+}
+
+static int32_t sign_extend(int32_t x, int bits) {
+  int shift = 32 - bits;
+  return (int32_t)((uint32_t)x << shift) >> shift;
+}
+
+static int sign_of(int32_t x) {
+  return (x > 0) - (x < 0);
+}
+
+// Adaptive Golomb code: unary quotient, then the remainder in k bits (k - 1
+// when it is 0), or an escape with the value in raw bits
+static void put_rice(bits_t *b, uint32_t n, uint32_t m, int k,
+                     int escape_bits) {
+  uint32_t q = n / m;
+  uint32_t r = n % m;
+  if (q >= ALAC_MAX_PREFIX) {
+    put_bits(b, (1u << ALAC_MAX_PREFIX) - 1, ALAC_MAX_PREFIX);
+    put_bits(b, n, escape_bits);
+    return;
+  }
+  put_bits(b, ((1u << q) - 1) << 1, (int)q + 1);
+  if (k == 1) {
+    return;
+  }
+  if (r == 0) {
+    put_bits(b, 0, k - 1);
+  } else {
+    put_bits(b, r + 1, k);
+  }
+}
+
+static void put_residuals(bits_t *b, const int32_t *res, size_t count) {
+  uint32_t mb = ALAC_MB;
+  uint32_t wb = (1u << ALAC_KB) - 1;
+  uint32_t zmode = 0;
+  size_t c = 0;
+  while (c < count) {
+    int k = 31 - lead((mb >> 9) + 3);
+    if (k > ALAC_KB) {
+      k = ALAC_KB;
+    }
+    uint32_t m = (1u << k) - 1;
+    int32_t del = res[c];
+    uint32_t coded = del >= 0 ? (uint32_t)del * 2 : (uint32_t)(-del) * 2 - 1;
+    uint32_t n = coded - zmode;
+    put_rice(b, n, m, k, ALAC_CHAN_BITS);
+    c++;
+
+    mb = ALAC_PB * (n + zmode) + mb - ((ALAC_PB * mb) >> 9);
+    if (n > 0xFFFF) {
+      mb = 0xFFFF;
+    }
+    zmode = 0;
+    if ((mb << 2) < 512 && c < count) {
+      // Quiet: a run of zeros, then the next value is coded one less
+      zmode = 1;
+      uint32_t run = 0;
+      while (c + run < count && res[c + run] == 0 && run < 0xFFFF) {
+        run++;
+      }
+      int kz = lead(mb) - 24 + (int)((mb + 16) >> 6);
+      uint32_t mz = ((1u << kz) - 1) & wb;
+      put_rice(b, run, mz, kz, 16);
+      c += run;
+      if (run >= 0xFFFF) {
+        zmode = 0;
+      }
+      mb = 0;
+    }
+  }
+}
+
+// Residuals of the decoder's adaptive predictor, which has to run in
+// lockstep, coefficient updates included
+static void predict(const int32_t *in, int32_t *res, size_t count,
+                    const int16_t *start_coefs) {
+  int16_t coefs[ALAC_ORDER];
+  memcpy(coefs, start_coefs, sizeof(coefs));
+  const int order = ALAC_ORDER;
+  const int32_t denhalf = 1 << (ALAC_DENSHIFT - 1);
+
+  res[0] = in[0];
+  for (int j = 1; j <= order; j++) {
+    res[j] = sign_extend(in[j] - in[j - 1], ALAC_CHAN_BITS);
+  }
+  for (size_t j = order + 1; j < count; j++) {
+    const int32_t *pout = in + j - 1;
+    int32_t top = in[j - order - 1];
+    int32_t sum = 0;
+    for (int k = 0; k < order; k++) {
+      sum += coefs[k] * (pout[-k] - top);
+    }
+    int32_t del = sign_extend(
+        in[j] - (top + ((sum + denhalf) >> ALAC_DENSHIFT)), ALAC_CHAN_BITS);
+    res[j] = del;
+
+    int32_t del0 = del;
+    int sg = sign_of(del);
+    if (sg > 0) {
+      for (int k = order - 1; k >= 0; k--) {
+        int32_t dd = top - pout[-k];
+        int sgn = sign_of(dd);
+        coefs[k] -= sgn;
+        del0 -= (order - k) * ((sgn * dd) >> ALAC_DENSHIFT);
+        if (del0 <= 0) {
+          break;
+        }
+      }
+    } else if (sg < 0) {
+      for (int k = order - 1; k >= 0; k--) {
+        int32_t dd = top - pout[-k];
+        int sgn = sign_of(dd);
+        coefs[k] += sgn;
+        del0 -= (order - k) * ((-sgn * dd) >> ALAC_DENSHIFT);
+        if (del0 >= 0) {
+          break;
+        }
+      }
+    }
+  }
+}
+
+static const int16_t start_coefs[ALAC_ORDER] = {512, 0, 0, 0, 0, 0, 0, 0};
+
+static size_t alac_encode(scratch_t *s, const int16_t *pcm, uint8_t *out,
+                          size_t cap) {
+  const int m2 = (1 << ALAC_MIX_BITS) - ALAC_MIX_RES;
+  for (int j = 0; j < ALAC_FRAME; j++) {
+    int32_t l = pcm[2 * j];
+    int32_t r = pcm[2 * j + 1];
+    s->mid[j] = (ALAC_MIX_RES * l + m2 * r) >> ALAC_MIX_BITS;
+    s->side[j] = l - r;
+  }
+
+  memset(out, 0, cap);
+  bits_t b = {.buf = out, .cap = cap};
+  put_bits(&b, 1, 3);  // Channel pair element
+  put_bits(&b, 0, 4);  // Element instance
+  put_bits(&b, 0, 12); // Unused
+  put_bits(&b, 0, 4);  // Whole frame, no shift, compressed
+  put_bits(&b, ALAC_MIX_BITS, 8);
+  put_bits(&b, ALAC_MIX_RES, 8);
+  for (int ch = 0; ch < 2; ch++) {
+    put_bits(&b, ALAC_DENSHIFT, 8);         // Prediction mode 0
+    put_bits(&b, (4 << 5) | ALAC_ORDER, 8); // pbFactor 4
+    for (int k = 0; k < ALAC_ORDER; k++) {
+      put_bits(&b, (uint16_t)start_coefs[k], 16);
+    }
+  }
+  predict(s->mid, s->residual, ALAC_FRAME, start_coefs);
+  put_residuals(&b, s->residual, ALAC_FRAME);
+  predict(s->side, s->residual, ALAC_FRAME, start_coefs);
+  put_residuals(&b, s->residual, ALAC_FRAME);
+  put_bits(&b, 7, 3); // End element
+  if (b.bit >> 3 >= cap) {
+    return 0;
+  }
+  return (b.bit + 7) >> 3;
+}
+
+static bool prepare_aac(scratch_t *s, uint32_t *seed) {
+  esp_aac_enc_config_t cfg = ESP_AAC_ENC_CONFIG_DEFAULT();
+  cfg.sample_rate = SAMPLE_RATE;
+  cfg.channel = 2;
+  cfg.bits_per_sample = 16;
+  cfg.bitrate = AAC_BITRATE;
+  cfg.adts_used = false; // Raw access units, as AirPlay sends them
+
+  void *encoder = NULL;
+  if (esp_aac_enc_open(&cfg, sizeof(cfg), &encoder) != ESP_AUDIO_ERR_OK) {
+    return false;
+  }
+  int in_size = 0;
+  int out_size = 0;
+  esp_aac_enc_get_frame_size(encoder, &in_size, &out_size);
+  bool ok = in_size == (int)sizeof(s->out);
+  for (int i = 0; ok && i < AAC_FRAMES; i++) {
+    fill_signal(s->out, AAC_FRAME, (uint32_t)i * AAC_FRAME, seed);
+    esp_audio_enc_in_frame_t in = {.buffer = (uint8_t *)s->out,
+                                   .len = (uint32_t)in_size};
+    esp_audio_enc_out_frame_t out = {.buffer = s->aac[i],
+                                     .len = AAC_MAX_BYTES};
+    ok = esp_aac_enc_process(encoder, &in, &out) == ESP_AUDIO_ERR_OK &&
+         out.encoded_bytes > 0;
+    s->aac_len[i] = out.encoded_bytes;
+  }
+  esp_aac_enc_close(encoder);
+  return ok;
+}
+
+/* ---------- stages ---------- */
+
+static int compare_cycles(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void summarize(uint32_t *cycles, uint32_t count,
+                      audio_bench_result_t *result) {
+  memset(result, 0, sizeof(*result));
+  if (count == 0) {
+    return;
+  }
+  qsort(cycles, count, sizeof(cycles[0]), compare_cycles);
+  uint64_t sum = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    sum += cycles[i];
+  }
+  result->count = count;
+  result->min = cycles[0];
+  result->max = cycles[count - 1];
+  result->avg = (uint32_t)(sum / count);
+  result->p99 = cycles[(count * 99 + 99) / 100 - 1];
+}
+
+#if CONFIG_AUDIO_ALAC_INTREE
+// The pipeline decodes with the in-tree decoder; time the library on the
+// same frames so one run compares the two
+static void bench_alac_vendor(scratch_t *s, const audio_format_t *format,
+                              audio_bench_suite_result_t *result) {
+  uint8_t cookie[ALAC_MAGIC_COOKIE_SIZE];
+  build_alac_magic_cookie(cookie, format);
+  esp_alac_dec_cfg_t cfg = {.codec_spec_info = cookie,
+                            .spec_info_len = ALAC_MAGIC_COOKIE_SIZE};
+  void *handle = NULL;
+  if (esp_alac_dec_open(&cfg, sizeof(cfg), &handle) != ESP_AUDIO_ERR_OK) {
+    ESP_LOGW(TAG, "ALAC library unavailable, skipping it");
+    return;
+  }
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    int f = i % ALAC_FRAMES;
+    esp_audio_dec_in_raw_t raw = {.buffer = s->alac[f],
+                                  .len = (uint32_t)s->alac_len[f]};
+    esp_audio_dec_out_frame_t frame = {.buffer = (uint8_t *)s->out,
+                                       .len = sizeof(s->out)};
+    esp_audio_dec_info_t info = {0};
+    uint32_t start = esp_cpu_get_cycle_count();
+    esp_audio_err_t err = esp_alac_dec_decode(handle, &raw, &frame, &info);
+    s->cycles[i] = esp_cpu_get_cycle_count() - start;
+    if (err != ESP_AUDIO_ERR_OK || frame.decoded_size != sizeof(s->pcm[f]) ||
+        memcmp(s->out, s->pcm[f], sizeof(s->pcm[f])) != 0) {
+      result->alac_bitexact = false;
+    }
+  }
+  esp_alac_dec_close(handle);
+  summarize(s->cycles, ITERATIONS,
+            &result->stages[AUDIO_BENCH_SUITE_DECODE_ALAC_VENDOR]);
+}
+#endif
+
+static void bench_decode(scratch_t *s, audio_bench_suite_result_t *result) {
+  audio_decoder_config_t config = {
+      .format = {.codec = "AppleLossless",
+                 .sample_rate = SAMPLE_RATE,
+                 .channels = 2,
+                 .bits_per_sample = 16,
+                 .frame_size = ALAC_FRAME,
+                 .max_samples_per_frame = ALAC_FRAME,
+                 .sample_size = 16,
+                 .rice_history_mult = ALAC_PB,
+                 .rice_initial_history = ALAC_MB,
+                 .rice_limit = ALAC_KB,
+                 .num_channels = 2,
+                 .max_run = 255,
+                 .sample_rate_config = SAMPLE_RATE}};
+  audio_decoder_t *decoder = audio_decoder_create(&config);
+  if (decoder && audio_decoder_is_alac(decoder)) {
+    result->alac_bitexact = true;
+    for (int i = 0; i < ITERATIONS; i++) {
+      int f = i % ALAC_FRAMES;
+      uint32_t start = esp_cpu_get_cycle_count();
+      int samples =
+          audio_decoder_decode(decoder, s->alac[f], s->alac_len[f], s->out,
+                               AAC_FRAME, NULL);
+      s->cycles[i] = esp_cpu_get_cycle_count() - start;
+      if (samples != ALAC_FRAME ||
+          memcmp(s->out, s->pcm[f], sizeof(s->pcm[f])) != 0) {
+        result->alac_bitexact = false;
+      }
+    }
+    summarize(s->cycles, ITERATIONS,
+              &result->stages[AUDIO_BENCH_SUITE_DECODE_ALAC]);
+#if CONFIG_AUDIO_ALAC_INTREE
+    bench_alac_vendor(s, &config.format, result);
+#endif
+  }
+  audio_decoder_destroy(decoder);
+
+  if (s->aac_len[0] == 0) {
+    return;
+  }
+  audio_decoder_config_t aac = {.format = {.codec = "AAC",
+                                           .sample_rate = SAMPLE_RATE,
+                                           .channels = 2,
+                                           .bits_per_sample = 16,
+                                           .frame_size = AAC_FRAME}};
+  decoder = audio_decoder_create(&aac);
+  if (decoder && audio_decoder_is_aac(decoder)) {
+    for (int i = 0; i < ITERATIONS; i++) {
+      int f = i % AAC_FRAMES;
+      uint32_t start = esp_cpu_get_cycle_count();
+      audio_decoder_decode(decoder, s->aac[f], s->aac_len[f], s->out,
+                           AAC_FRAME, NULL);
+      s->cycles[i] = esp_cpu_get_cycle_count() - start;
+    }
+    summarize(s->cycles, ITERATIONS,
+              &result->stages[AUDIO_BENCH_SUITE_DECODE_AAC]);
+  }
+  audio_decoder_destroy(decoder);
+}
+
+static void bench_crypto(scratch_t *s, audio_bench_suite_result_t *result) {
+  audio_encrypt_t encrypt = {.type = AUDIO_ENCRYPT_AES_CBC, .key_len = 16};
+  for (int i = 0; i < 16; i++) {
+    encrypt.key[i] = (uint8_t)(0x10 + i);
+    encrypt.iv[i] = (uint8_t)(0xA0 + i);
+  }
+  memcpy(s->packet + RTP_HEADER, s->alac[0], PAYLOAD_BYTES);
+  audio_crypto_prepare(&encrypt);
+  for (int i = 0; i < ITERATIONS; i++) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    audio_crypto_decrypt_rtp(&encrypt, s->packet + RTP_HEADER, PAYLOAD_BYTES,
+                             s->plain, sizeof(s->plain), s->packet,
+                             RTP_HEADER + PAYLOAD_BYTES);
+    s->cycles[i] = esp_cpu_get_cycle_count() - start;
+  }
+  audio_crypto_release(&encrypt);
+  summarize(s->cycles, ITERATIONS,
+            &result->stages[AUDIO_BENCH_SUITE_DECRYPT_AES]);
+
+  // A sealed AirPlay 2 packet: AAD from the header, nonce in the last bytes
+  audio_encrypt_t chacha = {.type = AUDIO_ENCRYPT_CHACHA20_POLY1305,
+                            .key_len = 32};
+  for (int i = 0; i < 32; i++) {
+    chacha.key[i] = (uint8_t)(0x40 + i);
+  }
+  memset(s->packet, 0x5A, RTP_HEADER);
+  uint8_t *nonce = s->packet + sizeof(s->packet) - 8;
+  for (int i = 0; i < 8; i++) {
+    nonce[i] = (uint8_t)i;
+  }
+  uint8_t full_nonce[12] = {0};
+  memcpy(full_nonce + 4, nonce, 8);
+  unsigned long long sealed = 0;
+  crypto_aead_chacha20poly1305_ietf_encrypt(
+      s->packet + RTP_HEADER, &sealed, s->alac[1], PAYLOAD_BYTES,
+      s->packet + 4, 8, NULL, full_nonce, chacha.key);
+  for (int i = 0; i < ITERATIONS; i++) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    audio_crypto_decrypt_rtp(&chacha, s->packet + RTP_HEADER,
+                             sizeof(s->packet) - RTP_HEADER, s->plain,
+                             sizeof(s->plain), s->packet, sizeof(s->packet));
+    s->cycles[i] = esp_cpu_get_cycle_count() - start;
+  }
+  summarize(s->cycles, ITERATIONS,
+            &result->stages[AUDIO_BENCH_SUITE_DECRYPT_CHACHA]);
+}
+
+// A private ring of the pipeline's slot size, filled to the last slot and
+// drained again, so insert and take run at full depth
+static void bench_buffer(scratch_t *s, audio_bench_suite_result_t *result) {
+  audio_buffer_t *buffer = calloc(1, sizeof(*buffer));
+  if (!buffer) {
+    return;
+  }
+  if (audio_buffer_init_slots(buffer, BUFFER_SLOTS) != ESP_OK) {
+    free(buffer);
+    return;
+  }
+  audio_buffer_set_frame_samples(buffer, ALAC_FRAME);
+  audio_buffer_service(buffer);
+
+  audio_stats_t stats = {0};
+  uint32_t frames = 0;
+  while (frames < ITERATIONS) {
+    const int16_t *pcm = s->pcm[frames % ALAC_FRAMES];
+    uint32_t start = esp_cpu_get_cycle_count();
+    bool queued = audio_buffer_queue_decoded(
+        buffer, &stats, frames * ALAC_FRAME, pcm, ALAC_FRAME, 2);
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+    if (!queued || stats.buffer_overruns > 0) {
+      break;
+    }
+    s->cycles[frames++] = cycles;
+  }
+  summarize(s->cycles, frames,
+            &result->stages[AUDIO_BENCH_SUITE_BUFFER_INSERT]);
+
+  uint32_t taken = 0;
+  while (taken < frames) {
+    void *item = NULL;
+    size_t size = 0;
+    uint32_t start = esp_cpu_get_cycle_count();
+    bool ok = audio_buffer_take(buffer, &item, &size, 0);
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+    if (!ok) {
+      break;
+    }
+    audio_buffer_return(buffer, item);
+    s->cycles[taken++] = cycles;
+  }
+  summarize(s->cycles, taken, &result->stages[AUDIO_BENCH_SUITE_BUFFER_TAKE]);
+
+  audio_buffer_deinit(buffer);
+  free(buffer);
+}
+
+static void bench_dsp(scratch_t *s, audio_bench_suite_result_t *result) {
+  audio_gain_t gain;
+  audio_gain_init(&gain, AUDIO_GAIN_UNITY / 2);
+  for (int i = 0; i < ITERATIONS; i++) {
+    memcpy(s->out, s->pcm[i % ALAC_FRAMES], sizeof(s->pcm[0]));
+    uint32_t start = esp_cpu_get_cycle_count();
+    audio_gain_apply(&gain, s->out, ALAC_FRAME, AUDIO_GAIN_UNITY / 2);
+    s->cycles[i] = esp_cpu_get_cycle_count() - start;
+  }
+  summarize(s->cycles, ITERATIONS, &result->stages[AUDIO_BENCH_SUITE_GAIN]);
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    audio_gain_apply_wide(&gain, s->pcm[i % ALAC_FRAMES], s->wide, ALAC_FRAME,
+                          AUDIO_GAIN_UNITY / 2);
+    s->cycles[i] = esp_cpu_get_cycle_count() - start;
+  }
+  summarize(s->cycles, ITERATIONS,
+            &result->stages[AUDIO_BENCH_SUITE_GAIN_WIDE]);
+
+  audio_resampler_t resampler;
+  audio_resampler_init(&resampler);
+  audio_resampler_set_ppm(&resampler, RESAMPLE_PPM);
+  for (int i = 0; i < ITERATIONS; i++) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    audio_resampler_process(&resampler, s->pcm[i % ALAC_FRAMES], ALAC_FRAME,
+                            s->out, AAC_FRAME);
+    s->cycles[i] = esp_cpu_get_cycle_count() - start;
+  }
+  summarize(s->cycles, ITERATIONS,
+            &result->stages[AUDIO_BENCH_SUITE_RESAMPLE]);
+
+#if CONFIG_AUDIO_EQ
+  audio_eq_config_t eq;
+  audio_eq_get_config(&eq);
+  if (eq.enabled) {
+    for (int i = 0; i < ITERATIONS; i++) {
+      memcpy(s->out, s->pcm[i % ALAC_FRAMES], sizeof(s->pcm[0]));
+      uint32_t start = esp_cpu_get_cycle_count();
+      audio_eq_process(s->out, ALAC_FRAME, SAMPLE_RATE);
+      s->cycles[i] = esp_cpu_get_cycle_count() - start;
+    }
+    audio_eq_reset(); // Start the next stream from clean filter state
+    summarize(s->cycles, ITERATIONS, &result->stages[AUDIO_BENCH_SUITE_EQ]);
+  }
+#endif
+}
+
+// Bytes per microsecond is MB/s
+static uint32_t copy_rate(uint8_t *dst, const uint8_t *src, size_t len) {
+  memcpy(dst, src, len); // Warm the cache and TLB
+  int64_t start = esp_timer_get_time();
+  for (int i = 0; i < COPY_ROUNDS; i++) {
+    memcpy(dst, src, len);
+  }
+  int64_t elapsed = esp_timer_get_time() - start;
+  return elapsed > 0 ? (uint32_t)((int64_t)len * COPY_ROUNDS / elapsed) : 0;
+}
+
+static void bench_memcpy(audio_bench_suite_result_t *result) {
+  uint8_t *src = heap_caps_malloc(COPY_BYTES, MALLOC_CAP_INTERNAL);
+  uint8_t *dst = heap_caps_malloc(COPY_BYTES, MALLOC_CAP_INTERNAL);
+  if (src && dst) {
+    memset(src, 0xA5, COPY_BYTES);
+    result->memcpy_internal_mbps = copy_rate(dst, src, COPY_BYTES);
+  }
+  heap_caps_free(src);
+  heap_caps_free(dst);
+
+  src = heap_caps_malloc(COPY_PSRAM, MALLOC_CAP_SPIRAM);
+  dst = heap_caps_malloc(COPY_PSRAM, MALLOC_CAP_SPIRAM);
+  if (src && dst) {
+    memset(src, 0xA5, COPY_PSRAM);
+    result->memcpy_psram_mbps = copy_rate(dst, src, COPY_PSRAM);
+  }
+  heap_caps_free(src);
+  heap_caps_free(dst);
+}
+
+/* ---------- run ---------- */
+
+static void suite_task(void *arg) {
+  suite_run_t *run = arg;
+  scratch_t *s = run->scratch;
+  audio_bench_suite_result_t *result = run->result;
+
+  uint32_t seed = 1;
+  run->err = ESP_OK;
+  for (int i = 0; i < ALAC_FRAMES; i++) {
+    fill_signal(s->pcm[i], ALAC_FRAME, (uint32_t)i * ALAC_FRAME, &seed);
+    s->alac_len[i] = alac_encode(s, s->pcm[i], s->alac[i], ALAC_MAX_BYTES);
+    if (s->alac_len[i] == 0) {
+      run->err = ESP_FAIL;
+    }
+  }
+  if (!prepare_aac(s, &seed)) {
+    ESP_LOGW(TAG, "AAC encoder unavailable, skipping AAC decode");
+    memset(s->aac_len, 0, sizeof(s->aac_len));
+  }
+
+  if (run->err == ESP_OK) {
+    int64_t start = esp_timer_get_time();
+    bench_decode(s, result);
+    bench_crypto(s, result);
+    bench_buffer(s, result);
+    bench_dsp(s, result);
+    bench_memcpy(result);
+    result->duration_ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+  }
+
+  xSemaphoreGive(run->done);
+  vTaskDelete(NULL);
+}
+
+esp_err_t audio_bench_suite_run(audio_bench_suite_result_t *result) {
+  if (!result) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (busy || audio_receiver_is_streaming()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  memset(result, 0, sizeof(*result));
+  result->cpu_mhz = esp_rom_get_cpu_ticks_per_us();
+
+  suite_run_t run = {.result = result};
+  run.scratch = heap_caps_calloc(1, sizeof(scratch_t), MALLOC_CAP_INTERNAL);
+  run.done = xSemaphoreCreateBinary();
+  if (!run.scratch || !run.done) {
+    heap_caps_free(run.scratch);
+    if (run.done) {
+      vSemaphoreDelete(run.done);
+    }
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Same core and priority as the realtime decode task
+  const task_placement_t *decode = task_placement_get(TASK_AUDIO_DECODE);
+  busy = true;
+  if (xTaskCreatePinnedToCore(suite_task, "bench_suite", SUITE_STACK, &run,
+                              decode->priority, NULL,
+                              decode->core) != pdPASS) {
+    run.err = ESP_ERR_NO_MEM;
+  } else {
+    xSemaphoreTake(run.done, portMAX_DELAY);
+  }
+  busy = false;
+  heap_caps_free(run.scratch);
+  vSemaphoreDelete(run.done);
+  if (run.err != ESP_OK) {
+    return run.err;
+  }
+
+  for (int id = 0; id < AUDIO_BENCH_SUITE_COUNT; id++) {
+    const audio_bench_result_t *r = &result->stages[id];
+    if (r->count == 0) {
+      continue;
+    }
+    ESP_LOGI(TAG,
+             "bench v1 %s n=%" PRIu32 " min=%" PRIu32 " avg=%" PRIu32
+             " p99=%" PRIu32 " max=%" PRIu32,
+             stage_names[id], r->count, r->min, r->avg, r->p99, r->max);
+  }
+  ESP_LOGI(TAG,
+           "bench v1 memcpy internal=%" PRIu32 " MB/s psram=%" PRIu32
+           " MB/s alac_bitexact=%d cpu=%" PRIu32 " MHz (%" PRIu32 " ms)",
+           result->memcpy_internal_mbps, result->memcpy_psram_mbps,
+           result->alac_bitexact, result->cpu_mhz, result->duration_ms);
+  return ESP_OK;
+}
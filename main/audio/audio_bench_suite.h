@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "audio_bench.h"
+#include "esp_err.h"
+
+/**
+ * On-demand micro-benchmarks of the audio pipeline on the running board.
+ *
+ * Unlike CONFIG_AUDIO_BENCH, which profiles the frames of a live stream,
+ * the suite feeds every stage the same synthetic content (a fixed mix of
+ * tones and noise), so results from different boards and firmware builds
+ * can be compared directly. It runs on the decode core at the decoder's
+ * priority and refuses to start while a stream is playing.
+ */
+
+typedef enum {
+  AUDIO_BENCH_SUITE_DECODE_ALAC = 0, // Cycles per 352-sample frame
+  AUDIO_BENCH_SUITE_DECODE_AAC,      // Per 1024-sample frame
+  AUDIO_BENCH_SUITE_DECRYPT_AES,     // Per 1024-byte payload
+  AUDIO_BENCH_SUITE_DECRYPT_CHACHA,
+  AUDIO_BENCH_SUITE_BUFFER_INSERT, // Per frame, filling a full ring
+  AUDIO_BENCH_SUITE_BUFFER_TAKE,   // Per frame, draining it
+  AUDIO_BENCH_SUITE_GAIN,          // Per 352-sample frame
+  AUDIO_BENCH_SUITE_GAIN_WIDE,
+  AUDIO_BENCH_SUITE_RESAMPLE,
+  AUDIO_BENCH_SUITE_EQ, // Only with CONFIG_AUDIO_EQ and the EQ enabled
+  AUDIO_BENCH_SUITE_DECODE_ALAC_VENDOR, // With CONFIG_AUDIO_ALAC_INTREE
+  AUDIO_BENCH_SUITE_COUNT,
+} audio_bench_suite_id_t;
+
+typedef struct {
+  audio_bench_result_t stages[AUDIO_BENCH_SUITE_COUNT]; // count 0: skipped
+  uint32_t memcpy_internal_mbps; // MB/s, internal RAM to internal RAM
+  uint32_t memcpy_psram_mbps;    // MB/s, PSRAM to PSRAM, 0 without PSRAM
+  bool alac_bitexact;            // Every ALAC decoder matched the source
+  uint32_t cpu_mhz;
+  uint32_t duration_ms;
+} audio_bench_suite_result_t;
+
+/**
+ * Run the whole suite (about a second) and log it in "bench v1" lines.
+ * Blocks the caller until done.
+ * @return ESP_ERR_INVALID_STATE while a stream is playing, ESP_ERR_NO_MEM
+ *         if the scratch buffers could not be allocated
+ */
+esp_err_t audio_bench_suite_run(audio_bench_suite_result_t *result);
+
+/** Stable stage name ("decode_alac", "buffer_insert", ...). */
+const char *audio_bench_suite_name(audio_bench_suite_id_t id);
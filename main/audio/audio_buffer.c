@@ -1,3 +1,4 @@
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -5,100 +6,734 @@
 
 #include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "mem_budget.h"
+#include "rt_log.h"
+#if CONFIG_AUDIO_SRAM_PREFETCH
+#include "esp_attr.h"
+#include "esp_cache.h"
+#endif
 
 static const char *TAG = "audio_buf";
 
+/* How long a flush waits for the playback task to drop queued frames */
+#define FLUSH_ACK_TIMEOUT_MS 20
+
+/* Slot size classes in samples per channel, smallest first: short ring
+   positions of odd packet sizes, ELD 480 (2 x 240), AAC-LC 1024, ALAC
+   4096 and ELD 512 (4 x 256) and the 352-sample default */
+static const uint16_t slot_classes[] = {128, 240, 256, AAC_FRAMES_PER_PACKET};
+#define SLOT_CLASS_COUNT (sizeof(slot_classes) / sizeof(slot_classes[0]))
+
 /* ---------- helpers for the slot pool ---------- */
 
 static inline uint8_t *slot_ptr(audio_buffer_t *b, uint16_t slot) {
   return b->pool + (size_t)slot * b->slot_size;
 }
 
-static inline uint32_t slot_timestamp(audio_buffer_t *b, uint16_t slot) {
-  return ((audio_frame_header_t *)slot_ptr(b, slot))->rtp_timestamp;
+static inline uint16_t slot_of(audio_buffer_t *b, void *item) {
+  return (uint16_t)(((uint8_t *)item - b->pool) / b->slot_size);
+}
+
+#if CONFIG_AUDIO_HIMEM_POOL
+static inline bool bank_slot(audio_buffer_t *b, uint16_t slot) {
+  return slot >= b->direct_slots;
+}
+
+static inline audio_frame_header_t *slot_hdr(audio_buffer_t *b,
+                                             uint16_t slot) {
+  if (bank_slot(b, slot)) {
+    return &b->bank_hdr[slot - b->direct_slots];
+  }
+  return (audio_frame_header_t *)slot_ptr(b, slot);
+}
+#else
+static inline bool bank_slot(audio_buffer_t *b, uint16_t slot) {
+  (void)b;
+  (void)slot;
+  return false;
+}
+
+static inline audio_frame_header_t *slot_hdr(audio_buffer_t *b,
+                                             uint16_t slot) {
+  return (audio_frame_header_t *)slot_ptr(b, slot);
+}
+#endif
+
+static inline uint8_t slot_epoch(audio_buffer_t *b, uint16_t slot) {
+  return slot_hdr(b, slot)->reserved;
 }
 
-/* RTP timestamp comparison that handles 32-bit wraparound.
-   Returns negative if a < b, 0 if equal, positive if a > b. */
-static inline int32_t ts_cmp(uint32_t a, uint32_t b) {
-  return (int32_t)(a - b);
+static size_t slot_size_for(uint32_t samples, uint32_t channels) {
+  size_t size = sizeof(audio_frame_header_t) +
+                (size_t)samples * channels * AUDIO_BYTES_PER_SAMPLE;
+#if CONFIG_AUDIO_SRAM_PREFETCH
+  size = (size + AUDIO_PREFETCH_ALIGN - 1) / AUDIO_PREFETCH_ALIGN *
+         AUDIO_PREFETCH_ALIGN;
+#endif
+  return size;
 }
 
-/* Binary search: find the index in sorted[] where a frame with `timestamp`
-   should be inserted to keep ascending order. */
-static int sorted_insert_pos(audio_buffer_t *b, uint32_t timestamp) {
-  int lo = 0, hi = b->count;
-  while (lo < hi) {
-    int mid = lo + (hi - lo) / 2;
-    if (ts_cmp(slot_timestamp(b, b->sorted[mid]), timestamp) < 0) {
-      lo = mid + 1;
-    } else {
-      hi = mid;
+static uint32_t slot_class_for(uint32_t chunk_samples) {
+  for (size_t i = 0; i < SLOT_CLASS_COUNT; i++) {
+    if (chunk_samples <= slot_classes[i]) {
+      return slot_classes[i];
     }
   }
-  return lo;
+  return AAC_FRAMES_PER_PACKET;
 }
 
-/* ---------- queue_chunk (insert) ---------- */
+static inline uint32_t free_queue_next(audio_buffer_t *b, uint32_t i) {
+  return (i + 1) % (uint32_t)(b->capacity + 1);
+}
 
-static bool audio_buffer_queue_chunk(audio_buffer_t *buffer,
-                                     audio_stats_t *stats, uint32_t timestamp,
-                                     const int16_t *pcm_data, size_t samples,
-                                     int channels) {
-  if (samples == 0) {
+/* Consumer side of the free queue */
+static void free_slot(audio_buffer_t *b, uint16_t slot) {
+  uint32_t tail = atomic_load_explicit(&b->free_tail, memory_order_relaxed);
+  b->free_queue[tail] = slot;
+  atomic_store_explicit(&b->free_tail, free_queue_next(b, tail),
+                        memory_order_release);
+}
+
+static inline void wake_consumer(audio_buffer_t *b);
+
+/* Producer side of the free queue. Returns false if the pool is exhausted
+   or being re-sliced; in the latter case the spare is given up, since the
+   consumer rebuilds the free queue. */
+static bool reserve_slot(audio_buffer_t *b, uint16_t *slot) {
+  uint32_t seq = atomic_load(&b->slab_seq);
+  if (seq != atomic_load_explicit(&b->slab_done, memory_order_acquire)) {
+    b->spare_slot = -1;
+    if (atomic_exchange(&b->slab_parked, seq) != seq) {
+      wake_consumer(b);
+    }
+    return false;
+  }
+  if (b->spare_slot >= 0) {
+    *slot = (uint16_t)b->spare_slot;
+    b->spare_slot = -1;
+    return true;
+  }
+  uint32_t head = atomic_load_explicit(&b->free_head, memory_order_relaxed);
+  if (head == atomic_load_explicit(&b->free_tail, memory_order_acquire)) {
     return false;
   }
+  *slot = b->free_queue[head];
+  atomic_store_explicit(&b->free_head, free_queue_next(b, head),
+                        memory_order_release);
+  return true;
+}
+
+/* The producer cannot push to the free queue, so it keeps at most one
+   unused slot (it only ever has one reservation outstanding) */
+static inline void release_spare(audio_buffer_t *b, uint16_t slot) {
+  b->spare_slot = slot;
+}
 
-  portENTER_CRITICAL(&buffer->lock);
+/* ---------- helpers for the timestamp ring ---------- */
 
-  /* Overflow protection: drain oldest frames if at capacity */
-  while (buffer->count >= buffer->capacity && buffer->count > 0) {
-    uint16_t victim = buffer->sorted[0];
-    memmove(&buffer->sorted[0], &buffer->sorted[1],
-            (buffer->count - 1) * sizeof(uint16_t));
-    buffer->count--;
-    buffer->free_stack[buffer->free_top++] = victim;
-    /* Take one token from the semaphore to keep it in sync */
-    xSemaphoreTakeFromISR(buffer->data_ready, NULL);
+/* Smallest equal split of a packet into chunks of at most
+   AAC_FRAMES_PER_PACKET samples, so that consecutive chunks land on
+   consecutive ring positions (1024 -> 4 x 256, 352 -> 1 x 352). */
+static uint32_t chunk_samples_for(uint32_t frame_samples) {
+  if (frame_samples == 0) {
+    return AAC_FRAMES_PER_PACKET;
   }
+  for (uint32_t n = 1; n <= frame_samples; n++) {
+    if (frame_samples % n == 0 && frame_samples / n <= AAC_FRAMES_PER_PACKET) {
+      return frame_samples / n;
+    }
+  }
+  return AAC_FRAMES_PER_PACKET;
+}
 
-  if (buffer->free_top == 0) {
-    portEXIT_CRITICAL(&buffer->lock);
-    if (stats) {
-      stats->buffer_underruns++;
+static inline _Atomic uint32_t *ring_entry(audio_buffer_t *b,
+                                           uint32_t position) {
+  return &b->ring[position % (uint32_t)b->capacity];
+}
+
+/* Consumer: move head past one position and claim whatever it holds.
+   head is published before the entry is cleared, so a producer racing to
+   fill the same position either loses the exchange to us or sees head
+   beyond it and takes its frame back. */
+static uint32_t ring_pass(audio_buffer_t *b, uint32_t head) {
+  atomic_store(&b->head, head + 1);
+  uint32_t slot = atomic_exchange(ring_entry(b, head), AUDIO_BUFFER_EMPTY_SLOT);
+  if (slot != AUDIO_BUFFER_EMPTY_SLOT) {
+    atomic_fetch_sub(&b->count, 1);
+  }
+  return slot;
+}
+
+static inline void wake_consumer(audio_buffer_t *b) {
+  TaskHandle_t waiter = atomic_load(&b->waiter);
+  if (waiter) {
+    xTaskNotifyGive(waiter);
+  }
+}
+
+/* ---------- himem slots (ESP32 with 8 MB PSRAM) ---------- */
+
+#if CONFIG_AUDIO_HIMEM_POOL
+
+/* Bring the block holding a himem slot into one side's window. Each task
+   only maps its own range and both walk the ring in order, so a remap
+   happens about once per bank_slots_per_block frames. */
+static uint8_t *bank_map(audio_buffer_t *b, int side, uint16_t slot) {
+  audio_bank_window_t *w = &b->bank_window[side];
+  int index = slot - b->direct_slots;
+  int block = index / b->bank_slots_per_block;
+
+  if (block != w->block) {
+    if (w->ptr) {
+      esp_himem_unmap(w->range, w->ptr, ESP_HIMEM_BLKSZ);
+      w->ptr = NULL;
+      w->block = -1;
+    }
+    void *ptr;
+    esp_err_t err =
+        esp_himem_map(b->bank_mem, w->range, (size_t)block * ESP_HIMEM_BLKSZ,
+                      0, ESP_HIMEM_BLKSZ, 0, &ptr);
+    if (err != ESP_OK) {
+      RT_LOGE(TAG, "himem block %d map failed: %s", block,
+              esp_err_to_name(err));
+      return NULL;
+    }
+    w->ptr = (uint8_t *)ptr;
+    w->block = block;
+  }
+  return w->ptr + (size_t)(index % b->bank_slots_per_block) * b->slot_size;
+}
+
+/* Producer: PCM into a himem slot; the header goes to bank_hdr on commit */
+static bool bank_write(audio_buffer_t *b, uint16_t slot, const void *pcm,
+                       size_t bytes) {
+  uint8_t *ptr = bank_map(b, AUDIO_BANK_PRODUCER, slot);
+  if (!ptr) {
+    return false;
+  }
+  memcpy(ptr + sizeof(audio_frame_header_t), pcm, bytes);
+  return true;
+}
+
+/* Producer: himem slots cannot stay mapped while the decoder fills them,
+   so in-place decoding goes to a staging slot copied in on commit */
+static uint8_t *bank_stage(audio_buffer_t *b, uint16_t slot) {
+  if (!bank_slot(b, slot)) {
+    return slot_ptr(b, slot);
+  }
+  b->bank_staged_slot = slot;
+  return b->bank_staging;
+}
+
+static uint16_t item_slot(audio_buffer_t *b, void *item) {
+  if ((uint8_t *)item == b->bank_staging) {
+    return b->bank_staged_slot;
+  }
+  return slot_of(b, item);
+}
+
+/* Consumer: copy a claimed himem frame to a lend buffer and give the slot
+   straight back to the pool; the copy is released by return */
+static uint8_t *bank_claim(audio_buffer_t *b, uint16_t slot) {
+  int i = 0;
+  while (i < AUDIO_BANK_LEND && b->bank_lent[i]) {
+    i++;
+  }
+  uint8_t *src =
+      i < AUDIO_BANK_LEND ? bank_map(b, AUDIO_BANK_CONSUMER, slot) : NULL;
+  if (!src) {
+    free_slot(b, slot);
+    return NULL;
+  }
+
+  audio_frame_header_t *hdr = slot_hdr(b, slot);
+  memcpy(b->bank_lend[i], hdr, sizeof(*hdr));
+  memcpy(b->bank_lend[i] + sizeof(*hdr), src + sizeof(*hdr),
+         (size_t)hdr->samples_per_channel * hdr->channels * sizeof(int16_t));
+  b->bank_lent[i] = true;
+  free_slot(b, slot);
+  return b->bank_lend[i];
+}
+
+static bool bank_return(audio_buffer_t *b, void *item) {
+  for (int i = 0; i < AUDIO_BANK_LEND; i++) {
+    if (b->bank_lend[i] && (uint8_t *)item == b->bank_lend[i]) {
+      b->bank_lent[i] = false;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Himem slots of a size class; slots never straddle a block, so one
+   mapping always covers a whole frame */
+static int bank_slots_for(audio_buffer_t *b, size_t slot_size) {
+  return (int)(b->bank_blocks * (ESP_HIMEM_BLKSZ / slot_size));
+}
+
+static size_t bank_hdr_count(audio_buffer_t *b) {
+  return (size_t)bank_slots_for(
+      b, slot_size_for(slot_classes[0], AUDIO_MIN_SLOT_CHANNELS));
+}
+
+static void bank_deinit(audio_buffer_t *b) {
+  for (int i = 0; i < AUDIO_BANK_SIDES; i++) {
+    audio_bank_window_t *w = &b->bank_window[i];
+    if (w->ptr) {
+      esp_himem_unmap(w->range, w->ptr, ESP_HIMEM_BLKSZ);
+    }
+    if (w->range) {
+      esp_himem_free_map_range(w->range);
+    }
+    *w = (audio_bank_window_t){.block = -1};
+  }
+  if (b->bank_mem) {
+    esp_himem_free(b->bank_mem);
+    b->bank_mem = NULL;
+  }
+  mem_free(MEM_TAG_AUDIO, b->bank_hdr,
+           bank_hdr_count(b) * sizeof(audio_frame_header_t));
+  b->bank_hdr = NULL;
+  mem_free(MEM_TAG_AUDIO, b->bank_staging, AUDIO_SLOT_SIZE);
+  b->bank_staging = NULL;
+  for (int i = 0; i < AUDIO_BANK_LEND; i++) {
+    mem_free(MEM_TAG_AUDIO, b->bank_lend[i], AUDIO_SLOT_SIZE);
+    b->bank_lend[i] = NULL;
+    b->bank_lent[i] = false;
+  }
+  b->bank_blocks = 0;
+  b->bank_slots = 0;
+}
+
+/* Add himem blocks behind the directly mapped pool, enough for the S3
+   depth in slots of the largest class. Without himem (4 MB modules) or on
+   any failure the pool stays as is. */
+static void bank_init(audio_buffer_t *b, int direct_slots) {
+  for (int i = 0; i < AUDIO_BANK_SIDES; i++) {
+    b->bank_window[i].block = -1;
+  }
+
+  int room = MAX_HIMEM_RING_FRAMES - direct_slots;
+  size_t free_blocks = esp_himem_get_free_size() / ESP_HIMEM_BLKSZ;
+  if (room <= 0 || free_blocks == 0) {
+    return;
+  }
+
+  size_t per_block = ESP_HIMEM_BLKSZ / AUDIO_SLOT_SIZE;
+  size_t blocks = ((size_t)room + per_block - 1) / per_block;
+  if (blocks > free_blocks) {
+    blocks = free_blocks;
+  }
+  b->bank_blocks = blocks;
+
+  esp_err_t err = esp_himem_alloc(blocks * ESP_HIMEM_BLKSZ, &b->bank_mem);
+  for (int i = 0; i < AUDIO_BANK_SIDES && err == ESP_OK; i++) {
+    err = esp_himem_alloc_map_range(ESP_HIMEM_BLKSZ,
+                                    &b->bank_window[i].range);
+  }
+  b->bank_hdr = (audio_frame_header_t *)mem_alloc_prefer_psram(
+      MEM_TAG_AUDIO, bank_hdr_count(b) * sizeof(audio_frame_header_t));
+  b->bank_staging =
+      (uint8_t *)mem_alloc(MEM_TAG_AUDIO, AUDIO_SLOT_SIZE, MALLOC_CAP_8BIT);
+  bool lend_ok = true;
+  for (int i = 0; i < AUDIO_BANK_LEND; i++) {
+    /* Read by the output path, so internal RAM like the prefetch copies */
+    b->bank_lend[i] = (uint8_t *)mem_alloc(
+        MEM_TAG_AUDIO, AUDIO_SLOT_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    lend_ok = lend_ok && b->bank_lend[i];
+  }
+  if (err != ESP_OK || !b->bank_hdr || !b->bank_staging || !lend_ok) {
+    ESP_LOGW(TAG, "himem slots unavailable (%s), %d slot buffer",
+             err != ESP_OK ? esp_err_to_name(err) : "no memory",
+             direct_slots);
+    bank_deinit(b);
+    return;
+  }
+
+  ESP_LOGI(TAG, "himem: %zu KB beyond the mapped PSRAM",
+           blocks * ESP_HIMEM_BLKSZ / 1024);
+}
+
+#else
+
+static inline bool bank_write(audio_buffer_t *b, uint16_t slot,
+                              const void *pcm, size_t bytes) {
+  (void)b;
+  (void)slot;
+  (void)pcm;
+  (void)bytes;
+  return false;
+}
+
+static inline uint8_t *bank_stage(audio_buffer_t *b, uint16_t slot) {
+  return slot_ptr(b, slot);
+}
+
+static inline uint16_t item_slot(audio_buffer_t *b, void *item) {
+  return slot_of(b, item);
+}
+
+static inline uint8_t *bank_claim(audio_buffer_t *b, uint16_t slot) {
+  (void)b;
+  (void)slot;
+  return NULL;
+}
+
+static inline bool bank_return(audio_buffer_t *b, void *item) {
+  (void)b;
+  (void)item;
+  return false;
+}
+
+#endif
+
+/* ---------- SRAM prefetch window (consumer) ---------- */
+
+#if CONFIG_AUDIO_SRAM_PREFETCH
+
+static bool IRAM_ATTR prefetch_done(async_memcpy_handle_t dma,
+                                    async_memcpy_event_t *event, void *arg) {
+  (void)dma;
+  (void)event;
+  ((audio_prefetch_t *)arg)->state = AUDIO_PREFETCH_READY;
+  return false;
+}
+
+/* Start copies for the frames right behind head. Entries are keyed by ring
+   position and slot, so a copy never outlives the frame it was made for. */
+static void prefetch_ahead(audio_buffer_t *b) {
+  if (!b->prefetch_dma) {
+    return;
+  }
+
+  uint32_t head = atomic_load_explicit(&b->head, memory_order_relaxed);
+  uint32_t tail = atomic_load(&b->tail);
+  uint8_t epoch = (uint8_t)atomic_load(&b->epoch);
+
+  for (uint32_t i = 0; i < CONFIG_AUDIO_PREFETCH_FRAMES; i++) {
+    uint32_t position = head + i;
+    if ((int32_t)(tail - position) <= 0) {
+      break;
+    }
+    audio_prefetch_t *p =
+        &b->prefetch[position % CONFIG_AUDIO_PREFETCH_FRAMES];
+    if (p->state == AUDIO_PREFETCH_READY &&
+        (int32_t)(p->position - head) < 0) {
+      p->state = AUDIO_PREFETCH_FREE; // Its frame was passed or purged
+    }
+    if (p->state != AUDIO_PREFETCH_FREE) {
+      continue;
+    }
+
+    uint32_t slot = atomic_load(ring_entry(b, position));
+    if (slot == AUDIO_BUFFER_EMPTY_SLOT || bank_slot(b, (uint16_t)slot) ||
+        slot_epoch(b, (uint16_t)slot) != epoch) {
+      continue;
+    }
+
+    uint8_t *src = slot_ptr(b, (uint16_t)slot);
+    p->position = position;
+    p->slot = (uint16_t)slot;
+    p->state = AUDIO_PREFETCH_BUSY;
+    /* The producer wrote the slot through the cache */
+    esp_cache_msync(src, b->slot_size, ESP_CACHE_MSYNC_FLAG_DIR_C2M);
+    if (esp_async_memcpy(b->prefetch_dma, p->data, src, b->slot_size,
+                         prefetch_done, p) != ESP_OK) {
+      p->state = AUDIO_PREFETCH_FREE;
+      break;
     }
+  }
+}
+
+/* Swap a claimed slot for its SRAM copy when one is ready. The PSRAM slot
+   goes straight back to the pool; the copy is released by return. */
+static uint8_t *prefetch_claim(audio_buffer_t *b, uint32_t position,
+                               uint16_t slot) {
+  if (!b->prefetch_dma) {
+    return slot_ptr(b, slot);
+  }
+
+  audio_prefetch_t *p = &b->prefetch[position % CONFIG_AUDIO_PREFETCH_FRAMES];
+  if (p->state != AUDIO_PREFETCH_READY || p->position != position ||
+      p->slot != slot) {
+    return slot_ptr(b, slot);
+  }
+
+  p->state = AUDIO_PREFETCH_LENT;
+  free_slot(b, slot);
+  return p->data;
+}
+
+static bool prefetch_return(audio_buffer_t *b, void *item) {
+  uint8_t *ptr = (uint8_t *)item;
+  size_t area = (size_t)CONFIG_AUDIO_PREFETCH_FRAMES * AUDIO_SLOT_SIZE;
+  if (!b->prefetch_area || ptr < b->prefetch_area ||
+      ptr >= b->prefetch_area + area) {
     return false;
   }
 
-  /* Pop a free slot */
-  uint16_t slot = buffer->free_stack[--buffer->free_top];
+  b->prefetch[(ptr - b->prefetch_area) / AUDIO_SLOT_SIZE].state =
+      AUDIO_PREFETCH_FREE;
+  return true;
+}
+
+static bool prefetch_busy(audio_buffer_t *b) {
+  for (int i = 0; i < CONFIG_AUDIO_PREFETCH_FRAMES; i++) {
+    if (b->prefetch[i].state == AUDIO_PREFETCH_BUSY) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void prefetch_init(audio_buffer_t *b) {
+  b->prefetch_area = (uint8_t *)mem_aligned_alloc(
+      MEM_TAG_AUDIO, AUDIO_PREFETCH_ALIGN,
+      (size_t)CONFIG_AUDIO_PREFETCH_FRAMES * AUDIO_SLOT_SIZE,
+      MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+  async_memcpy_config_t config = ASYNC_MEMCPY_DEFAULT_CONFIG();
+  config.backlog = CONFIG_AUDIO_PREFETCH_FRAMES;
+  if (!b->prefetch_area ||
+      esp_async_memcpy_install(&config, &b->prefetch_dma) != ESP_OK) {
+    ESP_LOGW(TAG, "SRAM prefetch unavailable, reading frames from PSRAM");
+    mem_free(MEM_TAG_AUDIO, b->prefetch_area,
+             (size_t)CONFIG_AUDIO_PREFETCH_FRAMES * AUDIO_SLOT_SIZE);
+    b->prefetch_area = NULL;
+    b->prefetch_dma = NULL;
+    return;
+  }
+  for (int i = 0; i < CONFIG_AUDIO_PREFETCH_FRAMES; i++) {
+    b->prefetch[i].data = b->prefetch_area + (size_t)i * AUDIO_SLOT_SIZE;
+    b->prefetch[i].state = AUDIO_PREFETCH_FREE;
+  }
+}
+
+static void prefetch_deinit(audio_buffer_t *b) {
+  if (b->prefetch_dma) {
+    esp_async_memcpy_uninstall(b->prefetch_dma);
+    b->prefetch_dma = NULL;
+  }
+  mem_free(MEM_TAG_AUDIO, b->prefetch_area,
+           (size_t)CONFIG_AUDIO_PREFETCH_FRAMES * AUDIO_SLOT_SIZE);
+  b->prefetch_area = NULL;
+}
+
+#else
+
+static inline void prefetch_ahead(audio_buffer_t *b) {
+  (void)b;
+}
+
+static inline uint8_t *prefetch_claim(audio_buffer_t *b, uint32_t position,
+                                      uint16_t slot) {
+  (void)position;
+  return slot_ptr(b, slot);
+}
+
+static inline bool prefetch_return(audio_buffer_t *b, void *item) {
+  (void)b;
+  (void)item;
+  return false;
+}
+
+static inline bool prefetch_busy(audio_buffer_t *b) {
+  (void)b;
+  return false;
+}
+
+#endif
+
+/* ---------- size classes ---------- */
+
+/* Slots of one size across the pool and the himem blocks, within what the
+   16-bit slot indices can address */
+static int slab_slots(audio_buffer_t *b, size_t slot_size) {
+  size_t slots = b->pool_bytes / slot_size;
+#if CONFIG_AUDIO_HIMEM_POOL
+  slots += (size_t)bank_slots_for(b, slot_size);
+#endif
+  return slots < AUDIO_BUFFER_EMPTY_SLOT ? (int)slots
+                                         : AUDIO_BUFFER_EMPTY_SLOT - 1;
+}
+
+/* Slice the pool into slots of one class and start empty. Runs before the
+   tasks use the buffer, or on the consumer with the producer parked. */
+static void slab_format(audio_buffer_t *b, uint32_t samples,
+                        uint32_t channels) {
+  b->slot_samples = samples;
+  b->slot_channels = channels;
+  b->slot_size = slot_size_for(samples, channels);
+  b->capacity = slab_slots(b, b->slot_size);
+#if CONFIG_AUDIO_HIMEM_POOL
+  int direct = (int)(b->pool_bytes / b->slot_size);
+  b->direct_slots = direct < b->capacity ? direct : b->capacity;
+  b->bank_slots = b->capacity - b->direct_slots;
+  b->bank_slots_per_block = (int)(ESP_HIMEM_BLKSZ / b->slot_size);
+#endif
+
+  for (int i = 0; i < b->capacity; i++) {
+    atomic_store(&b->ring[i], AUDIO_BUFFER_EMPTY_SLOT);
+    b->free_queue[i] = (uint16_t)i;
+  }
+  atomic_store(&b->free_head, 0);
+  atomic_store(&b->free_tail, (uint32_t)b->capacity);
+  atomic_store(&b->count, 0);
+  uint32_t head = atomic_load(&b->head);
+  atomic_store(&b->tail, head);
+  atomic_store(&b->skip_to, head);
+  b->spare_slot = -1;
+  b->anchored = false;
+#if CONFIG_AUDIO_SRAM_PREFETCH
+  for (int i = 0; i < CONFIG_AUDIO_PREFETCH_FRAMES; i++) {
+    b->prefetch[i].state = AUDIO_PREFETCH_FREE;
+  }
+#endif
+}
+
+/* Consumer: carry out a size class request once the producer has parked
+   (dropping its spare) and every taken frame is back. Whatever is still
+   queued is dropped with the old slicing. */
+static void slab_apply(audio_buffer_t *b) {
+  uint32_t seq = atomic_load(&b->slab_seq);
+  if (seq == atomic_load_explicit(&b->slab_done, memory_order_relaxed) ||
+      atomic_load(&b->slab_parked) != seq || b->consumer_lent > 0 ||
+      prefetch_busy(b)) {
+    return;
+  }
+
+  slab_format(b, atomic_load(&b->slab_samples),
+              atomic_load(&b->slab_channels));
+  atomic_store_explicit(&b->slab_done, seq, memory_order_release);
+  RT_LOGI(TAG, "Pool re-sliced: %d slots × %zu bytes (%" PRIu32
+          " samples × %" PRIu32 " channels)", b->capacity, b->slot_size,
+          b->slot_samples, b->slot_channels);
+}
+
+static void slab_request(audio_buffer_t *b, uint32_t samples,
+                         uint32_t channels) {
+  atomic_store(&b->slab_samples, samples);
+  atomic_store(&b->slab_channels, channels);
+  if (!atomic_load(&b->consumer)) {
+    /* Nothing takes from the buffer yet, so nothing can race */
+    slab_format(b, samples, channels);
+    return;
+  }
+  atomic_fetch_add(&b->slab_seq, 1);
+  wake_consumer(b);
+}
+
+/* ---------- reserve / commit (producer) ---------- */
+
+/* Place a filled slot at its timestamp position. On failure the slot is
+   kept as the producer's spare. */
+static bool commit_slot(audio_buffer_t *buffer, audio_stats_t *stats,
+                        uint16_t slot, uint32_t timestamp, size_t samples,
+                        int channels) {
+  uint32_t epoch = atomic_load(&buffer->epoch);
+  if (epoch != buffer->producer_epoch) {
+    buffer->producer_epoch = epoch;
+    buffer->anchored = false;
+  }
+
+  if (audio_buffer_in_flush_range(buffer, timestamp)) {
+    release_spare(buffer, slot);
+    return false;
+  }
 
-  /* Build frame into pool slot */
-  uint8_t *dest = slot_ptr(buffer, slot);
-  audio_frame_header_t *hdr = (audio_frame_header_t *)dest;
+  audio_frame_header_t *hdr = slot_hdr(buffer, slot);
   hdr->rtp_timestamp = timestamp;
   hdr->samples_per_channel = (uint16_t)samples;
   hdr->channels = (uint8_t)channels;
-  hdr->reserved = 0;
+  hdr->reserved = (uint8_t)epoch;
+
+  uint32_t chunk = buffer->chunk_samples;
+  uint32_t head = atomic_load(&buffer->head);
+  uint32_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+  int32_t capacity = buffer->capacity;
+
+  /* Anchor a new epoch past everything already queued, so stale frames
+     the consumer has not purged yet never share a position with new ones.
+     Also re-anchor when nothing is queued (e.g. a late retransmit after
+     the consumer drained everything). */
+  int32_t delta = (int32_t)(timestamp - buffer->base_timestamp);
+  if (!buffer->anchored ||
+      (atomic_load(&buffer->count) == 0 &&
+       (int32_t)(buffer->base_position - head) + delta / (int32_t)chunk < 0)) {
+    buffer->base_timestamp = timestamp;
+    buffer->base_position = (int32_t)(tail - head) > 0 ? tail : head;
+    buffer->anchored = true;
+    delta = 0;
+  }
 
-  size_t pcm_bytes = samples * channels * sizeof(int16_t);
-  memcpy(dest + sizeof(audio_frame_header_t), pcm_data, pcm_bytes);
+  int32_t steps = (delta >= 0 ? delta + (int32_t)chunk / 2
+                              : delta - (int32_t)chunk / 2) /
+                  (int32_t)chunk;
+  uint32_t position = buffer->base_position + (uint32_t)steps;
+  int32_t offset = (int32_t)(position - head);
 
-  /* Binary search for insertion position */
-  int pos = sorted_insert_pos(buffer, timestamp);
+  if (offset < 0) {
+    /* The consumer is already past it */
+    release_spare(buffer, slot);
+    if (stats) {
+      stats->late_frames++;
+    }
+    return false;
+  }
+
+  if (offset >= 2 * capacity) {
+    /* Timestamp discontinuity: nothing queued is worth keeping. Start a new
+       epoch; the consumer discards the old frames as it meets them. */
+    buffer->producer_epoch = atomic_fetch_add(&buffer->epoch, 1) + 1;
+    hdr->reserved = (uint8_t)buffer->producer_epoch;
+    buffer->base_timestamp = timestamp;
+    buffer->base_position = (int32_t)(tail - head) > 0 ? tail : head;
+    position = buffer->base_position;
+    offset = (int32_t)(position - head);
+    atomic_store(&buffer->skip_to, position);
+  }
+
+  if (offset >= capacity) {
+    /* Overflow: ask the consumer to slide the window forward (dropping the
+       oldest frames) and drop this one, the window only moves from the
+       consumer side */
+    atomic_store(&buffer->skip_to, position - (uint32_t)capacity + 1);
+    wake_consumer(buffer);
+    release_spare(buffer, slot);
+    if (stats) {
+      stats->buffer_overruns++;
+    }
+    return false;
+  }
 
-  /* Shift indices to make room */
-  if (pos < buffer->count) {
-    memmove(&buffer->sorted[pos + 1], &buffer->sorted[pos],
-            (buffer->count - pos) * sizeof(uint16_t));
+  atomic_fetch_add(&buffer->count, 1);
+  uint32_t expected = AUDIO_BUFFER_EMPTY_SLOT;
+  if (!atomic_compare_exchange_strong(ring_entry(buffer, position), &expected,
+                                      slot)) {
+    /* Duplicate (retransmit of a frame we already hold) */
+    atomic_fetch_sub(&buffer->count, 1);
+    release_spare(buffer, slot);
+    return true;
   }
-  buffer->sorted[pos] = slot;
-  buffer->count++;
 
-  portEXIT_CRITICAL(&buffer->lock);
+  /* The consumer may have passed this position while we were inserting */
+  if ((int32_t)(atomic_load(&buffer->head) - position) > 0) {
+    expected = slot;
+    if (atomic_compare_exchange_strong(ring_entry(buffer, position), &expected,
+                                       AUDIO_BUFFER_EMPTY_SLOT)) {
+      atomic_fetch_sub(&buffer->count, 1);
+      release_spare(buffer, slot);
+      if (stats) {
+        stats->late_frames++;
+      }
+      return false;
+    }
+    /* else: the consumer claimed it after all */
+  }
 
-  /* Signal consumer */
-  xSemaphoreGive(buffer->data_ready);
+  if ((int32_t)(position + 1 - tail) > 0) {
+    atomic_store(&buffer->tail, position + 1);
+  }
+  wake_consumer(buffer);
 
   if (stats) {
     stats->packets_decoded++;
@@ -106,58 +741,136 @@ static bool audio_buffer_queue_chunk(audio_buffer_t *buffer,
   return true;
 }
 
+static bool audio_buffer_queue_chunk(audio_buffer_t *buffer,
+                                     audio_stats_t *stats, uint32_t timestamp,
+                                     const int16_t *pcm_data, size_t samples,
+                                     int channels) {
+  if (samples == 0) {
+    return false;
+  }
+
+  uint16_t slot;
+  if (!reserve_slot(buffer, &slot)) {
+    if (stats) {
+      stats->buffer_underruns++;
+    }
+    return false;
+  }
+  /* The class is only stable once a slot is held: a chunk size set for
+     the next class waits for the re-slice */
+  if (samples > buffer->slot_samples || channels > buffer->slot_channels) {
+    release_spare(buffer, slot);
+    return false;
+  }
+
+  /* PSRAM writes are slow; the slot is private until committed */
+  size_t pcm_bytes = samples * channels * sizeof(int16_t);
+  if (bank_slot(buffer, slot)) {
+    if (!bank_write(buffer, slot, pcm_data, pcm_bytes)) {
+      release_spare(buffer, slot);
+      return false;
+    }
+  } else {
+    memcpy(slot_ptr(buffer, slot) + sizeof(audio_frame_header_t), pcm_data,
+           pcm_bytes);
+  }
+
+  return commit_slot(buffer, stats, slot, timestamp, samples, channels);
+}
+
 /* ---------- init / deinit ---------- */
 
+static uint8_t *pool_alloc(size_t size) {
+#if CONFIG_AUDIO_SRAM_PREFETCH
+  uint8_t *pool = mem_aligned_alloc(MEM_TAG_AUDIO, AUDIO_PREFETCH_ALIGN, size,
+                                    MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!pool) {
+    pool = mem_aligned_alloc(MEM_TAG_AUDIO, AUDIO_PREFETCH_ALIGN, size,
+                             MALLOC_CAP_8BIT);
+  }
+  return pool;
+#else
+  return mem_alloc_prefer_psram(MEM_TAG_AUDIO, size);
+#endif
+}
+
+#if CONFIG_AUDIO_IRAM_HOT_PATH
+/* Just over the PSRAM malloc threshold; every packet is decoded into it */
+#define FRAME_BUFFER_CAPS (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+#else
+#define FRAME_BUFFER_CAPS MALLOC_CAP_8BIT
+#endif
+
+static size_t frame_buffer_size(void) {
+  return sizeof(audio_frame_header_t) +
+         (size_t)MAX_SAMPLES_PER_FRAME * AUDIO_MAX_CHANNELS * sizeof(int16_t);
+}
+
 esp_err_t audio_buffer_init(audio_buffer_t *buffer) {
+  // As many slots as the memory profile budgets
+  size_t budget = mem_budget_profile()->pcm_pool_bytes / AUDIO_SLOT_SIZE;
+  return audio_buffer_init_slots(
+      buffer, budget < MAX_RING_BUFFER_FRAMES ? (int)budget
+                                              : MAX_RING_BUFFER_FRAMES);
+}
+
+esp_err_t audio_buffer_init_slots(audio_buffer_t *buffer, int slots) {
   if (!buffer) {
     return ESP_ERR_INVALID_ARG;
   }
 
   memset(buffer, 0, sizeof(*buffer));
 
-  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
-  buffer->lock = lock;
-  buffer->capacity = MAX_RING_BUFFER_FRAMES;
-  buffer->slot_size = BYTES_PER_FRAME;
-  buffer->count = 0;
-
-  /* Pool in PSRAM */
-  buffer->pool =
-      (uint8_t *)heap_caps_malloc((size_t)buffer->capacity * buffer->slot_size,
-                                  MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-  if (!buffer->pool) {
-    ESP_LOGE(TAG, "Failed to allocate pool in PSRAM");
-    return ESP_ERR_NO_MEM;
+  // Within the compile-time maximum the indices are sized for
+  buffer->capacity = slots < MAX_RING_BUFFER_FRAMES ? slots
+                                                    : MAX_RING_BUFFER_FRAMES;
+  if (buffer->capacity < MIN_RING_BUFFER_FRAMES) {
+    buffer->capacity = MIN_RING_BUFFER_FRAMES;
   }
-
-  /* Sorted index array + free stack (internal RAM is fine, they're small) */
-  buffer->sorted = (uint16_t *)malloc(buffer->capacity * sizeof(uint16_t));
-  buffer->free_stack = (uint16_t *)malloc(buffer->capacity * sizeof(uint16_t));
-  if (!buffer->sorted || !buffer->free_stack) {
+  buffer->spare_slot = -1;
+  buffer->chunk_samples = AAC_FRAMES_PER_PACKET;
+  buffer->frame_samples = AAC_FRAMES_PER_PACKET;
+
+  /* Pool in PSRAM when there is any; halved until it fits otherwise, so a
+     tight board starts with a short buffer instead of not at all */
+  while (!(buffer->pool =
+               pool_alloc((size_t)buffer->capacity * AUDIO_SLOT_SIZE))) {
+    if (buffer->capacity / 2 < MIN_RING_BUFFER_FRAMES) {
+      ESP_LOGE(TAG, "Failed to allocate a %d slot pool", buffer->capacity);
+      return ESP_ERR_NO_MEM;
+    }
+    buffer->capacity /= 2;
+  }
+  buffer->pool_bytes = (size_t)buffer->capacity * AUDIO_SLOT_SIZE;
+#if CONFIG_AUDIO_HIMEM_POOL
+  bank_init(buffer, buffer->capacity);
+#endif
+
+  /* Timestamp ring + free queue (internal RAM is fine, they're small),
+     sized for the smallest class so re-slicing never allocates */
+  buffer->max_capacity = slab_slots(
+      buffer, slot_size_for(slot_classes[0], AUDIO_MIN_SLOT_CHANNELS));
+  buffer->ring = (_Atomic uint32_t *)mem_alloc(
+      MEM_TAG_AUDIO, buffer->max_capacity * sizeof(*buffer->ring),
+      MALLOC_CAP_8BIT);
+  buffer->free_queue =
+      (uint16_t *)mem_alloc(MEM_TAG_AUDIO,
+                            (buffer->max_capacity + 1) * sizeof(uint16_t),
+                            MALLOC_CAP_8BIT);
+  if (!buffer->ring || !buffer->free_queue) {
     ESP_LOGE(TAG, "Failed to allocate index arrays");
     audio_buffer_deinit(buffer);
     return ESP_ERR_NO_MEM;
   }
 
-  /* Initialise free stack: all slots available */
-  buffer->free_top = buffer->capacity;
-  for (int i = 0; i < buffer->capacity; i++) {
-    buffer->free_stack[i] = (uint16_t)i;
-  }
-
-  /* Counting semaphore: max = capacity, initial = 0 */
-  buffer->data_ready = xSemaphoreCreateCounting(buffer->capacity, 0);
-  if (!buffer->data_ready) {
-    ESP_LOGE(TAG, "Failed to create semaphore");
-    audio_buffer_deinit(buffer);
-    return ESP_ERR_NO_MEM;
-  }
+  /* Default class until a format asks for another: all slots free */
+  atomic_store(&buffer->slab_samples, AAC_FRAMES_PER_PACKET);
+  atomic_store(&buffer->slab_channels, AUDIO_MAX_CHANNELS);
+  slab_format(buffer, AAC_FRAMES_PER_PACKET, AUDIO_MAX_CHANNELS);
 
   /* Temp assembly / decode buffer (same as before) */
-  size_t max_pcm_bytes =
-      (size_t)MAX_SAMPLES_PER_FRAME * AUDIO_MAX_CHANNELS * sizeof(int16_t);
-  buffer->frame_buffer =
-      (uint8_t *)malloc(sizeof(audio_frame_header_t) + max_pcm_bytes);
+  buffer->frame_buffer = (uint8_t *)mem_alloc(
+      MEM_TAG_AUDIO, frame_buffer_size(), FRAME_BUFFER_CAPS);
   if (!buffer->frame_buffer) {
     ESP_LOGE(TAG, "Failed to allocate frame buffer");
     audio_buffer_deinit(buffer);
@@ -167,7 +880,11 @@ esp_err_t audio_buffer_init(audio_buffer_t *buffer) {
       (int16_t *)(buffer->frame_buffer + sizeof(audio_frame_header_t));
   buffer->decode_capacity_samples = MAX_SAMPLES_PER_FRAME;
 
-  ESP_LOGI(TAG, "Sorted buffer created: %d slots × %zu bytes = %zu bytes",
+#if CONFIG_AUDIO_SRAM_PREFETCH
+  prefetch_init(buffer);
+#endif
+
+  ESP_LOGI(TAG, "Jitter buffer created: %d slots × %zu bytes = %zu bytes",
            buffer->capacity, buffer->slot_size,
            (size_t)buffer->capacity * buffer->slot_size);
 
@@ -179,50 +896,97 @@ void audio_buffer_deinit(audio_buffer_t *buffer) {
     return;
   }
 
-  if (buffer->data_ready) {
-    vSemaphoreDelete(buffer->data_ready);
-    buffer->data_ready = NULL;
-  }
-  if (buffer->pool) {
-    heap_caps_free(buffer->pool);
-    buffer->pool = NULL;
-  }
-  free(buffer->sorted);
-  buffer->sorted = NULL;
-  free(buffer->free_stack);
-  buffer->free_stack = NULL;
+#if CONFIG_AUDIO_SRAM_PREFETCH
+  prefetch_deinit(buffer);
+#endif
+#if CONFIG_AUDIO_HIMEM_POOL
+  bank_deinit(buffer);
+#endif
+  mem_free(MEM_TAG_AUDIO, buffer->pool, buffer->pool_bytes);
+  buffer->pool = NULL;
+  mem_free(MEM_TAG_AUDIO, (void *)buffer->ring,
+           buffer->max_capacity * sizeof(*buffer->ring));
+  buffer->ring = NULL;
+  mem_free(MEM_TAG_AUDIO, buffer->free_queue,
+           (buffer->max_capacity + 1) * sizeof(uint16_t));
+  buffer->free_queue = NULL;
 
   if (buffer->frame_buffer) {
-    free(buffer->frame_buffer);
+    mem_free(MEM_TAG_AUDIO, buffer->frame_buffer, frame_buffer_size());
     buffer->frame_buffer = NULL;
     buffer->decode_buffer = NULL;
     buffer->decode_capacity_samples = 0;
   }
 
-  buffer->count = 0;
-  buffer->free_top = 0;
+  atomic_store(&buffer->count, 0);
 }
 
 /* ---------- flush ---------- */
 
+/* The range is written by the RTSP task only and read lock-free: the
+   sequence is odd while the pair is inconsistent */
+static void set_cut(audio_buffer_t *buffer, uint32_t from, uint32_t len) {
+  uint32_t seq = atomic_load(&buffer->cut_seq);
+  atomic_store(&buffer->cut_seq, seq + 1);
+  atomic_store(&buffer->cut_from, from);
+  atomic_store(&buffer->cut_len, len);
+  atomic_store(&buffer->cut_seq, seq + 2);
+}
+
 void audio_buffer_flush(audio_buffer_t *buffer) {
   if (!buffer || !buffer->pool) {
     return;
   }
 
-  portENTER_CRITICAL(&buffer->lock);
+  set_cut(buffer, 0, 0);
+
+  /* Only the consumer may move head, so a flush just starts a new epoch:
+     the producer re-anchors and the consumer drops every older frame */
+  uint32_t epoch = atomic_fetch_add(&buffer->epoch, 1) + 1;
 
-  /* Return all active slots to free stack */
-  for (int i = 0; i < buffer->count; i++) {
-    buffer->free_stack[buffer->free_top++] = buffer->sorted[i];
+  TaskHandle_t consumer = atomic_load(&buffer->consumer);
+  if (!consumer) {
+    return;
+  }
+  if (consumer == xTaskGetCurrentTaskHandle()) {
+    audio_buffer_service(buffer);
+    return;
   }
-  buffer->count = 0;
 
-  portEXIT_CRITICAL(&buffer->lock);
+  /* Callers expect an empty buffer on return; the playback task polls at
+     least once per DMA buffer, so this is normally a tick or two */
+  wake_consumer(buffer);
+  TickType_t waited = 0;
+  while ((int32_t)(atomic_load(&buffer->consumer_epoch) - epoch) < 0 &&
+         waited++ < pdMS_TO_TICKS(FLUSH_ACK_TIMEOUT_MS) + 1) {
+    vTaskDelay(1);
+  }
+}
 
-  /* Drain the semaphore */
-  while (xSemaphoreTake(buffer->data_ready, 0) == pdTRUE) {
+void audio_buffer_flush_range(audio_buffer_t *buffer, uint32_t from,
+                              uint32_t until) {
+  if (!buffer || !buffer->pool) {
+    return;
   }
+
+  set_cut(buffer, from, until - from);
+  wake_consumer(buffer);
+}
+
+/* Readers never wait for the writer: a frame checked while the range is
+   being replaced passes, and the consumer's purge or take catches it */
+bool audio_buffer_in_flush_range(audio_buffer_t *buffer, uint32_t timestamp) {
+  if (!buffer) {
+    return false;
+  }
+
+  uint32_t seq = atomic_load(&buffer->cut_seq);
+  uint32_t from = atomic_load(&buffer->cut_from);
+  uint32_t len = atomic_load(&buffer->cut_len);
+  if ((seq & 1) || atomic_load(&buffer->cut_seq) != seq) {
+    return false;
+  }
+  return timestamp - from < len;
 }
 
 /* ---------- frame count ---------- */
@@ -232,68 +996,216 @@ int audio_buffer_get_frame_count(audio_buffer_t *buffer) {
     return 0;
   }
 
-  int frames = 0;
-  portENTER_CRITICAL(&buffer->lock);
-  frames = buffer->count;
-  portEXIT_CRITICAL(&buffer->lock);
-  return frames;
+  int frames = atomic_load(&buffer->count);
+  return frames > 0 ? frames : 0;
 }
 
-/* ---------- take (consumer) ---------- */
+/* ---------- frame size ---------- */
 
-bool audio_buffer_take(audio_buffer_t *buffer, void **item, size_t *item_size,
-                       TickType_t ticks) {
-  if (!buffer || !buffer->pool || !item || !item_size) {
-    return false;
+void audio_buffer_set_frame_samples(audio_buffer_t *buffer,
+                                    uint32_t frame_samples) {
+  if (!buffer || !buffer->pool) {
+    return;
   }
 
-  /* Block until a frame is available */
-  if (xSemaphoreTake(buffer->data_ready, ticks) != pdTRUE) {
-    return false;
+  uint32_t chunk = chunk_samples_for(frame_samples);
+  buffer->frame_samples = frame_samples;
+  if (chunk == buffer->chunk_samples) {
+    return;
   }
 
-  portENTER_CRITICAL(&buffer->lock);
+  /* Queued positions were computed with the old chunk size; the new epoch
+     also makes the producer re-anchor with the new one */
+  buffer->chunk_samples = chunk;
+  uint32_t slot_samples = slot_class_for(chunk);
+  if (slot_samples != atomic_load(&buffer->slab_samples)) {
+    slab_request(buffer, slot_samples, atomic_load(&buffer->slab_channels));
+  }
+  audio_buffer_flush(buffer);
 
-  if (buffer->count == 0) {
-    /* Shouldn't happen if semaphore is in sync, but guard anyway */
-    portEXIT_CRITICAL(&buffer->lock);
-    return false;
+  ESP_LOGI(TAG,
+           "Ring position = %" PRIu32 " samples (packet %" PRIu32
+           "), %" PRIu32 "-sample slots",
+           chunk, frame_samples, slot_samples);
+}
+
+void audio_buffer_set_slot_channels(audio_buffer_t *buffer, int channels) {
+  if (!buffer || !buffer->pool || channels < AUDIO_MIN_SLOT_CHANNELS ||
+      channels > AUDIO_MAX_CHANNELS ||
+      (uint32_t)channels == atomic_load(&buffer->slab_channels)) {
+    return;
+  }
+
+  slab_request(buffer, atomic_load(&buffer->slab_samples), (uint32_t)channels);
+  audio_buffer_flush(buffer);
+  ESP_LOGI(TAG, "%d-channel slots", channels);
+}
+
+/* ---------- consumer ---------- */
+
+void audio_buffer_service(audio_buffer_t *buffer) {
+  if (!buffer || !buffer->pool) {
+    return;
   }
 
-  uint16_t slot = buffer->sorted[0];
+  atomic_store_explicit(&buffer->consumer, xTaskGetCurrentTaskHandle(),
+                        memory_order_relaxed);
+
+  uint32_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+
+  /* Flush: drop everything before the first frame of the new epoch */
+  uint32_t epoch = atomic_load(&buffer->epoch);
+  if (epoch != atomic_load_explicit(&buffer->consumer_epoch,
+                                    memory_order_relaxed)) {
+    while ((int32_t)(atomic_load(&buffer->tail) - head) > 0) {
+      uint32_t entry = atomic_load(ring_entry(buffer, head));
+      if (entry != AUDIO_BUFFER_EMPTY_SLOT &&
+          slot_epoch(buffer, (uint16_t)entry) == (uint8_t)epoch) {
+        break;
+      }
+      uint32_t slot = ring_pass(buffer, head++);
+      if (slot != AUDIO_BUFFER_EMPTY_SLOT) {
+        free_slot(buffer, (uint16_t)slot);
+      }
+    }
+    atomic_store(&buffer->consumer_epoch, epoch);
+  }
 
-  /* Shift remaining indices left */
-  if (buffer->count > 1) {
-    memmove(&buffer->sorted[0], &buffer->sorted[1],
-            (buffer->count - 1) * sizeof(uint16_t));
+  slab_apply(buffer);
+
+  /* Partial flush: take the frames in the range out of the window, the
+     ones around them keep their positions */
+  uint32_t cut_seq = atomic_load(&buffer->cut_seq);
+  if (cut_seq != buffer->consumer_cut_seq && !(cut_seq & 1)) {
+    buffer->consumer_cut_seq = cut_seq;
+    uint32_t tail = atomic_load(&buffer->tail);
+    for (uint32_t position = head; (int32_t)(tail - position) > 0;
+         position++) {
+      uint32_t entry = atomic_load(ring_entry(buffer, position));
+      if (entry == AUDIO_BUFFER_EMPTY_SLOT ||
+          !audio_buffer_in_flush_range(
+              buffer, slot_hdr(buffer, (uint16_t)entry)->rtp_timestamp)) {
+        continue;
+      }
+      if (atomic_compare_exchange_strong(ring_entry(buffer, position), &entry,
+                                         AUDIO_BUFFER_EMPTY_SLOT)) {
+        atomic_fetch_sub(&buffer->count, 1);
+        free_slot(buffer, (uint16_t)entry);
+      }
+    }
   }
-  buffer->count--;
 
-  portEXIT_CRITICAL(&buffer->lock);
+  /* Overflow or discontinuity: slide the window up to skip_to */
+  uint32_t target = atomic_load(&buffer->skip_to);
+  int32_t skip = (int32_t)(target - head);
+  if (skip > 0) {
+    for (int32_t i = 0; i < skip && i < buffer->capacity; i++) {
+      uint32_t slot = ring_pass(buffer, head + (uint32_t)i);
+      if (slot != AUDIO_BUFFER_EMPTY_SLOT) {
+        free_slot(buffer, (uint16_t)slot);
+      }
+    }
+    atomic_store(&buffer->head, target);
+  }
 
-  uint8_t *ptr = slot_ptr(buffer, slot);
-  audio_frame_header_t *hdr = (audio_frame_header_t *)ptr;
-  *item = ptr;
-  *item_size = sizeof(audio_frame_header_t) + (size_t)hdr->samples_per_channel *
-                                                  hdr->channels *
-                                                  sizeof(int16_t);
+  prefetch_ahead(buffer);
+}
 
-  return true;
+bool audio_buffer_wait(audio_buffer_t *buffer, TickType_t ticks) {
+  if (!buffer || !buffer->pool) {
+    return false;
+  }
+  if (atomic_load(&buffer->count) > 0) {
+    return true;
+  }
+  if (ticks == 0) {
+    return false;
+  }
+
+  /* Publish ourselves before re-checking, so the producer either sees the
+     waiter or we see its frame */
+  atomic_store(&buffer->waiter, xTaskGetCurrentTaskHandle());
+  if (atomic_load(&buffer->count) == 0) {
+    ulTaskNotifyTake(pdTRUE, ticks);
+  }
+  atomic_store(&buffer->waiter, NULL);
+
+  return atomic_load(&buffer->count) > 0;
 }
 
-/* ---------- return (consumer gives back slot) ---------- */
+void audio_buffer_notify(audio_buffer_t *buffer) {
+  if (buffer) {
+    wake_consumer(buffer);
+  }
+}
+
+bool audio_buffer_take(audio_buffer_t *buffer, void **item, size_t *item_size,
+                       TickType_t ticks) {
+  if (!buffer || !buffer->pool || !item || !item_size) {
+    return false;
+  }
+
+  audio_buffer_service(buffer);
+
+  uint32_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+  for (;;) {
+    if ((int32_t)(atomic_load(&buffer->tail) - head) <= 0) {
+      if (ticks == 0 || !audio_buffer_wait(buffer, ticks)) {
+        return false;
+      }
+      ticks = 0;
+      continue;
+    }
+
+    /* Empty positions were lost on the network; bounded by tail */
+    uint32_t position = head++;
+    uint32_t slot = ring_pass(buffer, position);
+    if (slot == AUDIO_BUFFER_EMPTY_SLOT) {
+      continue;
+    }
+    if (slot_epoch(buffer, (uint16_t)slot) !=
+        (uint8_t)atomic_load(&buffer->epoch)) {
+      /* Queued before a flush the producer raced with */
+      free_slot(buffer, (uint16_t)slot);
+      continue;
+    }
+    if (audio_buffer_in_flush_range(
+            buffer, slot_hdr(buffer, (uint16_t)slot)->rtp_timestamp)) {
+      /* Committed while a partial flush was being requested */
+      free_slot(buffer, (uint16_t)slot);
+      continue;
+    }
+
+    uint8_t *ptr = bank_slot(buffer, (uint16_t)slot)
+                       ? bank_claim(buffer, (uint16_t)slot)
+                       : prefetch_claim(buffer, position, (uint16_t)slot);
+    prefetch_ahead(buffer);
+    if (!ptr) {
+      continue;
+    }
+
+    audio_frame_header_t *hdr = (audio_frame_header_t *)ptr;
+    buffer->consumer_lent++;
+    *item = ptr;
+    *item_size = sizeof(audio_frame_header_t) +
+                 (size_t)hdr->samples_per_channel * hdr->channels *
+                     sizeof(int16_t);
+    return true;
+  }
+}
 
 void audio_buffer_return(audio_buffer_t *buffer, void *item) {
   if (!buffer || !buffer->pool || !item) {
     return;
   }
 
-  uint16_t slot =
-      (uint16_t)(((uint8_t *)item - buffer->pool) / buffer->slot_size);
-
-  portENTER_CRITICAL(&buffer->lock);
-  buffer->free_stack[buffer->free_top++] = slot;
-  portEXIT_CRITICAL(&buffer->lock);
+  if (buffer->consumer_lent > 0) {
+    buffer->consumer_lent--;
+  }
+  if (prefetch_return(buffer, item) || bank_return(buffer, item)) {
+    return;
+  }
+  free_slot(buffer, slot_of(buffer, item));
 }
 
 /* ---------- decode buffer accessor ---------- */
@@ -310,6 +1222,74 @@ int16_t *audio_buffer_get_decode_buffer(audio_buffer_t *buffer,
   return buffer->decode_buffer;
 }
 
+/* ---------- zero-copy enqueue ---------- */
+
+void *audio_buffer_reserve(audio_buffer_t *buffer, int16_t **pcm,
+                           size_t *capacity_samples) {
+  if (!buffer || !buffer->pool || !pcm || !capacity_samples) {
+    return NULL;
+  }
+
+  /* Only whole packets can be decoded in place; split packets go through
+     the decode buffer and audio_buffer_queue_decoded() */
+  if (buffer->frame_samples == 0 ||
+      buffer->frame_samples != buffer->chunk_samples) {
+    return NULL;
+  }
+
+  uint16_t slot;
+  if (!reserve_slot(buffer, &slot)) {
+    return NULL;
+  }
+  /* Decoders write every channel they decode; mono slots take the
+     channel-selected copy of the decode buffer */
+  if (buffer->chunk_samples > buffer->slot_samples ||
+      buffer->slot_channels < AUDIO_MAX_CHANNELS) {
+    release_spare(buffer, slot);
+    return NULL;
+  }
+
+  uint8_t *ptr = bank_stage(buffer, slot);
+  *pcm = (int16_t *)(ptr + sizeof(audio_frame_header_t));
+  *capacity_samples = buffer->slot_samples;
+  return ptr;
+}
+
+void audio_buffer_cancel(audio_buffer_t *buffer, void *item) {
+  if (!buffer || !buffer->pool || !item) {
+    return;
+  }
+
+  release_spare(buffer, item_slot(buffer, item));
+}
+
+bool audio_buffer_commit(audio_buffer_t *buffer, audio_stats_t *stats,
+                         void *item, uint32_t timestamp, size_t samples,
+                         int channels) {
+  if (!buffer || !buffer->pool || !item) {
+    return false;
+  }
+
+  if (channels <= 0) {
+    channels = 2;
+  }
+  if (samples == 0 || samples > buffer->slot_samples ||
+      channels > (int)buffer->slot_channels) {
+    audio_buffer_cancel(buffer, item);
+    return false;
+  }
+
+  uint16_t slot = item_slot(buffer, item);
+  if (bank_slot(buffer, slot) &&
+      !bank_write(buffer, slot,
+                  (uint8_t *)item + sizeof(audio_frame_header_t),
+                  samples * channels * sizeof(int16_t))) {
+    release_spare(buffer, slot);
+    return false;
+  }
+  return commit_slot(buffer, stats, slot, timestamp, samples, channels);
+}
+
 /* ---------- queue decoded (splits large frames into chunks) ---------- */
 
 bool audio_buffer_queue_decoded(audio_buffer_t *buffer, audio_stats_t *stats,
@@ -328,8 +1308,8 @@ bool audio_buffer_queue_decoded(audio_buffer_t *buffer, audio_stats_t *stats,
 
   while (offset < samples) {
     size_t chunk_samples = samples - offset;
-    if (chunk_samples > AAC_FRAMES_PER_PACKET) {
-      chunk_samples = AAC_FRAMES_PER_PACKET;
+    if (chunk_samples > buffer->chunk_samples) {
+      chunk_samples = buffer->chunk_samples;
     }
 
     if (!audio_buffer_queue_chunk(buffer, stats, chunk_timestamp,
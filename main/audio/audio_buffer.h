@@ -1,18 +1,30 @@
 #pragma once
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/portmacro.h"
-#include "freertos/semphr.h"
+#include "freertos/task.h"
+#if CONFIG_AUDIO_SRAM_PREFETCH
+#include "esp_async_memcpy.h"
+#endif
+#if CONFIG_AUDIO_HIMEM_POOL
+#include "esp32/himem.h"
+#endif
 
 #include "audio_receiver.h"
 
 #define AAC_FRAMES_PER_PACKET  352
 #define AUDIO_MAX_CHANNELS     2
+// Fewest channels a slot is sliced for
+#if CONFIG_AUDIO_CHANNEL_SELECT
+#define AUDIO_MIN_SLOT_CHANNELS 1
+#else
+#define AUDIO_MIN_SLOT_CHANNELS AUDIO_MAX_CHANNELS
+#endif
 #define AUDIO_BYTES_PER_SAMPLE 2
 #define MAX_SAMPLES_PER_FRAME  4096
 
@@ -26,47 +38,251 @@ typedef struct __attribute__((packed)) {
 // ESP32S3 can access 8M SPIRAM directly
 // Others require himem API to use. See
 // https://docs.espressif.com/projects/esp-idf/en/stable/esp32/api-reference/system/himem.html
-// Reduce buffers for non-s3 targets
+// Reduce buffers for non-s3 targets; with CONFIG_AUDIO_HIMEM_POOL the
+// bank-switched slots bring the ESP32 back to the S3 depth
+// With compressed buffering the PCM pool only has to cover realtime streams
+// and the decode-ahead window of buffered ones; the arena holds the rest.
+#if CONFIG_AUDIO_COMPRESSED_BUFFER
+#ifdef CONFIG_IDF_TARGET_ESP32S3
+#define MAX_RING_BUFFER_FRAMES 1500
+#else
+#define MAX_RING_BUFFER_FRAMES 750
+#endif
+#else
 #ifdef CONFIG_IDF_TARGET_ESP32S3
 #define MAX_RING_BUFFER_FRAMES 5000
 #else
 #define MAX_RING_BUFFER_FRAMES 2500
 #endif
+#endif
 #define BYTES_PER_FRAME                                          \
   ((size_t)sizeof(audio_frame_header_t) +                        \
    ((size_t)AAC_FRAMES_PER_PACKET * (size_t)AUDIO_MAX_CHANNELS * \
     (size_t)AUDIO_BYTES_PER_SAMPLE))
 #define AUDIO_BUFFER_SIZE (MAX_RING_BUFFER_FRAMES * BYTES_PER_FRAME)
+// Fewest slots the memory profile shrinks the pool to before giving up
+#define MIN_RING_BUFFER_FRAMES 64
 #ifdef CONFIG_IDF_TARGET_ESP32S3
 #define MAX_BUFFER_FRAMES 5000
 #else
 #define MAX_BUFFER_FRAMES 2500
 #endif
 
+#define AUDIO_BUFFER_EMPTY_SLOT 0xFFFF
+
+#if CONFIG_AUDIO_HIMEM_POOL
+// Directly mapped slots plus bank-switched ones
+#define MAX_HIMEM_RING_FRAMES (2 * MAX_RING_BUFFER_FRAMES)
+// Internal RAM copies take can have outstanding (pending + playing)
+#define AUDIO_BANK_LEND 2
+
+enum {
+  AUDIO_BANK_PRODUCER,
+  AUDIO_BANK_CONSUMER,
+  AUDIO_BANK_SIDES,
+};
+
 typedef struct {
-  uint8_t *pool;                // Pre-allocated frame data in PSRAM
-  uint16_t *sorted;             // Slot indices sorted by RTP timestamp
-  uint16_t *free_stack;         // Stack of free slot indices
-  int count;                    // Frames currently in buffer
-  int free_top;                 // Top of free stack (next free slot)
-  int capacity;                 // Max frames
-  size_t slot_size;             // BYTES_PER_FRAME
-  portMUX_TYPE lock;            // Spinlock for count/index manipulation
-  SemaphoreHandle_t data_ready; // Counting semaphore (blocks consumer)
-  uint8_t *frame_buffer;        // Temp assembly buffer
-  int16_t *decode_buffer;       // Decode buffer pointer
+  esp_himem_rangehandle_t range; // One ESP_HIMEM_BLKSZ of address space
+  uint8_t *ptr;                  // Where the mapped block appears, or NULL
+  int block;                     // Himem block mapped, or -1
+} audio_bank_window_t;
+#endif
+
+// Slots of the largest size class; smaller classes slice the same pool
+// into more slots (see audio_buffer_set_frame_samples)
+#if CONFIG_AUDIO_SRAM_PREFETCH
+// GDMA reads PSRAM behind the cache, so slots are whole cache lines
+#define AUDIO_PREFETCH_ALIGN 64
+#define AUDIO_SLOT_SIZE                                              \
+  ((BYTES_PER_FRAME + AUDIO_PREFETCH_ALIGN - 1) / AUDIO_PREFETCH_ALIGN * \
+   AUDIO_PREFETCH_ALIGN)
+
+enum {
+  AUDIO_PREFETCH_FREE,  // Unused
+  AUDIO_PREFETCH_BUSY,  // DMA in flight
+  AUDIO_PREFETCH_READY, // Copy complete
+  AUDIO_PREFETCH_LENT,  // Handed to the consumer by take
+};
+
+typedef struct {
+  uint8_t *data;          // Internal RAM copy of one slot
+  uint32_t position;      // Ring position the copy was made for
+  uint16_t slot;          // Pool slot it was copied from
+  volatile uint8_t state; // AUDIO_PREFETCH_*, set to READY from the DMA ISR
+} audio_prefetch_t;
+#else
+#define AUDIO_SLOT_SIZE BYTES_PER_FRAME
+#endif
+
+// Single-producer / single-consumer: the receiver task inserts frames, the
+// playback task takes them. Neither side takes a lock; each index below is
+// written by one side only. Positions are free-running counters, the ring
+// index is position % capacity.
+//
+// The pool is sliced into slots of one size class at a time, sized for the
+// ring position of the active format. A class change is requested by
+// set_frame_samples and carried out by the consumer once the producer has
+// parked and no taken frame is outstanding.
+typedef struct {
+  uint8_t *pool;                  // Pre-allocated frame data in PSRAM
+  size_t pool_bytes;              // Size of pool
+  _Atomic uint32_t *ring;         // Slot index per timestamp position, or EMPTY
+  uint16_t *free_queue;           // Free slot indices, consumer -> producer
+  int capacity;                   // Slots of the current class (ring length)
+  int max_capacity;               // Slots of the smallest class (array sizes)
+  size_t slot_size;               // Bytes per slot of the current class
+  uint32_t slot_samples;          // Samples per channel a slot holds
+  uint32_t slot_channels;         // Channels a slot holds
+  atomic_uint slab_seq;           // Bumped for each size class request
+  atomic_uint slab_samples;       // Requested slot_samples
+  atomic_uint slab_channels;      // Requested slot_channels
+  atomic_uint slab_parked;        // Producer: last request it stopped for
+  atomic_uint slab_done;          // Consumer: last request applied
+  int consumer_lent;              // Consumer: frames taken, not returned
+  atomic_int count;               // Frames currently in buffer
+  atomic_uint head;               // Consumer: position of the next frame
+  atomic_uint tail;               // Producer: one past the newest position
+  atomic_uint skip_to;            // Producer: consumer drops frames before this
+  atomic_uint free_head;          // Producer: next free_queue entry to pop
+  atomic_uint free_tail;          // Consumer: next free_queue entry to push
+  atomic_uint epoch;              // Bumped by flush, stamped into frame headers
+  atomic_uint consumer_epoch;     // Last epoch the consumer has purged
+  atomic_uint cut_seq;            // Odd while cut_from/cut_len are written
+  atomic_uint cut_from;           // Partial flush: RTP timestamps in
+  atomic_uint cut_len;            //   [cut_from, cut_from + cut_len) drop
+  uint32_t consumer_cut_seq;      // Consumer: last cut purged
+  _Atomic(TaskHandle_t) consumer; // Task that takes frames
+  _Atomic(TaskHandle_t) waiter;   // Consumer blocked in take, or NULL
+  uint32_t producer_epoch;        // Producer: epoch of the current anchor
+  uint32_t base_position;         // Producer: ring position of base_timestamp
+  uint32_t base_timestamp;        // Producer: RTP timestamp of the anchor
+  bool anchored;                  // Producer: base valid for this epoch
+  int spare_slot;                 // Producer: unused reserved slot, or -1
+  uint32_t chunk_samples;         // Samples per ring position
+  uint32_t frame_samples;         // Nominal samples per packet
+  uint8_t *frame_buffer;          // Temp assembly buffer
+  int16_t *decode_buffer;         // Decode buffer pointer
   size_t decode_capacity_samples;
+#if CONFIG_AUDIO_SRAM_PREFETCH
+  // Consumer: window of the next frames, copied to internal RAM by GDMA
+  audio_prefetch_t prefetch[CONFIG_AUDIO_PREFETCH_FRAMES];
+  uint8_t *prefetch_area;
+  async_memcpy_handle_t prefetch_dma;
+#endif
+#if CONFIG_AUDIO_HIMEM_POOL
+  // Slots from direct_slots up live in himem, a whole number per block.
+  // Their headers stay in mapped memory so flushes never switch banks.
+  int direct_slots;                  // Slots in pool
+  int bank_slots;
+  int bank_slots_per_block;
+  size_t bank_blocks;
+  esp_himem_handle_t bank_mem;
+  audio_frame_header_t *bank_hdr;    // Headers, sized for the smallest class
+  audio_bank_window_t bank_window[AUDIO_BANK_SIDES];
+  uint8_t *bank_staging;             // Producer: in-place decode target
+  uint16_t bank_staged_slot;         // Producer: slot the staging is for
+  uint8_t *bank_lend[AUDIO_BANK_LEND]; // Consumer: copies handed out by take
+  bool bank_lent[AUDIO_BANK_LEND];
+#endif
 } audio_buffer_t;
 
 esp_err_t audio_buffer_init(audio_buffer_t *buffer);
+
+/**
+ * Like audio_buffer_init() with a given number of slots of the largest
+ * class instead of the memory profile's, e.g. for a scratch buffer.
+ */
+esp_err_t audio_buffer_init_slots(audio_buffer_t *buffer, int slots);
 void audio_buffer_deinit(audio_buffer_t *buffer);
 void audio_buffer_flush(audio_buffer_t *buffer);
+
+/**
+ * Partial flush: drop the queued frames with RTP timestamps in
+ * [from, until) and any in that range queued later, keeping the others in
+ * place. Returns at once; the consumer purges on its next service. A full
+ * flush clears the range.
+ */
+void audio_buffer_flush_range(audio_buffer_t *buffer, uint32_t from,
+                              uint32_t until);
+
+/** Whether a frame with this timestamp falls in the partial flush range. */
+bool audio_buffer_in_flush_range(audio_buffer_t *buffer, uint32_t timestamp);
 int audio_buffer_get_frame_count(audio_buffer_t *buffer);
+
+/**
+ * Set the nominal samples per packet for the current stream.
+ * Packets are split into equal chunks of at most AAC_FRAMES_PER_PACKET
+ * samples, and each chunk maps to one timestamp-indexed ring position.
+ * Flushes the buffer if the chunk size changes, and re-slices the pool
+ * into the smallest slot size class that holds a chunk, so 1024-sample
+ * AAC or 480-sample ELD fit more frames in the same memory. Frames queued
+ * before the consumer has re-sliced are dropped.
+ */
+void audio_buffer_set_frame_samples(audio_buffer_t *buffer,
+                                    uint32_t frame_samples);
+
+/**
+ * Slice the pool for frames of this many channels (1 for channel-select,
+ * down to AUDIO_MIN_SLOT_CHANNELS), like a size class change: mono slots
+ * are half the size, so the pool holds twice the frames. Flushes if the
+ * slicing changes, and disables the zero-copy reserve below stereo.
+ */
+void audio_buffer_set_slot_channels(audio_buffer_t *buffer, int channels);
+
+/**
+ * Take the oldest frame (consumer side). With ticks > 0 the caller blocks
+ * on a task notification until the producer queues a frame.
+ */
 bool audio_buffer_take(audio_buffer_t *buffer, void **item, size_t *item_size,
                        TickType_t ticks);
+
+/** Hand a taken frame back to the pool (consumer side). */
 void audio_buffer_return(audio_buffer_t *buffer, void *item);
+
+/**
+ * Apply pending flushes and overflow skips (consumer side). Cheap when
+ * nothing is pending; call it regularly even while paused.
+ */
+void audio_buffer_service(audio_buffer_t *buffer);
+
+/**
+ * Block the consumer until a frame is queued or ticks expire.
+ * @return true if frames are available
+ */
+bool audio_buffer_wait(audio_buffer_t *buffer, TickType_t ticks);
+
+/**
+ * Wake a consumer blocked in audio_buffer_wait() without queueing a frame,
+ * e.g. when compressed packets arrived for it to decode.
+ */
+void audio_buffer_notify(audio_buffer_t *buffer);
 int16_t *audio_buffer_get_decode_buffer(audio_buffer_t *buffer,
                                         size_t *capacity_samples);
+
+/**
+ * Reserve a free pool slot so a packet can be decoded straight into it.
+ * Only available when a whole packet fits one ring position; returns NULL
+ * otherwise (or when the pool is exhausted) and the caller should fall back
+ * to the decode buffer and audio_buffer_queue_decoded().
+ * @param pcm Output: PCM area behind the slot's frame header
+ * @param capacity_samples Output: samples per channel the slot can hold
+ * @return Slot handle to pass to audio_buffer_commit() or audio_buffer_cancel()
+ */
+void *audio_buffer_reserve(audio_buffer_t *buffer, int16_t **pcm,
+                           size_t *capacity_samples);
+
+/** Give back a reserved slot that was not committed (producer side). */
+void audio_buffer_cancel(audio_buffer_t *buffer, void *item);
+
+/**
+ * Insert a reserved slot into the timestamp index.
+ * The slot is released on failure, so the handle must not be reused.
+ */
+bool audio_buffer_commit(audio_buffer_t *buffer, audio_stats_t *stats,
+                         void *item, uint32_t timestamp, size_t samples,
+                         int channels);
+
 bool audio_buffer_queue_decoded(audio_buffer_t *buffer, audio_stats_t *stats,
                                 uint32_t timestamp, const int16_t *pcm_data,
                                 size_t samples, int channels);
@@ -0,0 +1,91 @@
+#include "audio_channel.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "settings.h"
+
+static const char *TAG = "audio_channel";
+
+static const char *const mode_names[AUDIO_CHANNEL_MODE_COUNT] = {
+    "stereo", "left", "right", "mono"};
+
+static audio_channel_mode_t s_mode = AUDIO_CHANNEL_STEREO;
+static bool s_loaded;
+
+audio_channel_mode_t audio_channel_get_mode(void) {
+  if (!s_loaded) {
+    uint8_t saved;
+    if (settings_get_channel_mode(&saved) == ESP_OK &&
+        saved < AUDIO_CHANNEL_MODE_COUNT) {
+      s_mode = (audio_channel_mode_t)saved;
+      ESP_LOGI(TAG, "Channel mode: %s", mode_names[s_mode]);
+    }
+    s_loaded = true;
+  }
+  return s_mode;
+}
+
+esp_err_t audio_channel_set_mode(audio_channel_mode_t mode) {
+  if ((unsigned)mode >= AUDIO_CHANNEL_MODE_COUNT) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  esp_err_t err = settings_set_channel_mode((uint8_t)mode);
+  if (err == ESP_OK) {
+    s_mode = mode;
+    s_loaded = true;
+  }
+  return err;
+}
+
+const char *audio_channel_mode_name(audio_channel_mode_t mode) {
+  return (unsigned)mode < AUDIO_CHANNEL_MODE_COUNT ? mode_names[mode]
+                                                   : "unknown";
+}
+
+int audio_channel_mode_from_name(const char *name) {
+  if (!name) {
+    return -1;
+  }
+  for (int i = 0; i < AUDIO_CHANNEL_MODE_COUNT; i++) {
+    if (strcmp(name, mode_names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void audio_channel_select(audio_channel_mode_t mode, int16_t *pcm,
+                          size_t samples) {
+  if (!pcm) {
+    return;
+  }
+  // Sample i is written after samples 2i and 2i + 1 are read
+  switch (mode) {
+  case AUDIO_CHANNEL_LEFT:
+  case AUDIO_CHANNEL_RIGHT: {
+    const int16_t *in = pcm + (mode == AUDIO_CHANNEL_RIGHT);
+    for (size_t i = 0; i < samples; i++) {
+      pcm[i] = in[i * 2];
+    }
+    break;
+  }
+  case AUDIO_CHANNEL_MONO:
+    for (size_t i = 0; i < samples; i++) {
+      pcm[i] = (int16_t)(((int32_t)pcm[i * 2] + pcm[i * 2 + 1]) >> 1);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void audio_channel_expand(int16_t *out, const int16_t *mono, size_t samples) {
+  if (!out || !mono) {
+    return;
+  }
+  for (size_t i = 0; i < samples; i++) {
+    out[i * 2] = mono[i];
+    out[i * 2 + 1] = mono[i];
+  }
+}
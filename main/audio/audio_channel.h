@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * Channel-select mode for stereo pairs (CONFIG_AUDIO_CHANNEL_SELECT).
+ *
+ * A speaker that plays one side of a pair keeps only that channel, or the
+ * mono sum, from the decoder on. The jitter buffer is sliced into mono
+ * slots of half the size, so the same pool holds twice the audio and each
+ * frame moves half the bytes through PSRAM; playout widens the frame to
+ * both I2S slots in internal RAM.
+ */
+
+typedef enum {
+  AUDIO_CHANNEL_STEREO, // Both channels, as sent
+  AUDIO_CHANNEL_LEFT,
+  AUDIO_CHANNEL_RIGHT,
+  AUDIO_CHANNEL_MONO, // (L + R) / 2
+  AUDIO_CHANNEL_MODE_COUNT,
+} audio_channel_mode_t;
+
+/** Saved mode, AUDIO_CHANNEL_STEREO until one is set. */
+audio_channel_mode_t audio_channel_get_mode(void);
+
+/**
+ * Save the mode. Streams pick it up when their format is set, so a change
+ * applies from the next stream.
+ */
+esp_err_t audio_channel_set_mode(audio_channel_mode_t mode);
+
+const char *audio_channel_mode_name(audio_channel_mode_t mode);
+
+/** @return Mode for a name from audio_channel_mode_name(), -1 if none */
+int audio_channel_mode_from_name(const char *name);
+
+/**
+ * Reduce interleaved stereo to one channel in place; the mono samples take
+ * the first half of pcm.
+ * @param samples Samples per channel
+ */
+void audio_channel_select(audio_channel_mode_t mode, int16_t *pcm,
+                          size_t samples);
+
+/** Duplicate mono samples into both channels of out. */
+void audio_channel_expand(int16_t *out, const int16_t *mono, size_t samples);
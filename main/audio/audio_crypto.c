@@ -2,10 +2,43 @@
 
 #include "audio_crypto.h"
 
+#include "esp_log.h"
 #include "mbedtls/aes.h"
 #include "sodium.h"
 
-int audio_crypto_decrypt_rtp(const audio_encrypt_t *encrypt,
+static const char *TAG = "audio_crypto";
+
+void audio_crypto_prepare(audio_encrypt_t *encrypt) {
+  if (!encrypt) {
+    return;
+  }
+
+  encrypt->aes_ready = false;
+  if (encrypt->type != AUDIO_ENCRYPT_AES_CBC) {
+    return;
+  }
+
+  // With CONFIG_MBEDTLS_HARDWARE_AES this is the AES peripheral context and
+  // bulk CBC runs over DMA on chips that have it
+  mbedtls_aes_init(&encrypt->aes);
+  if (mbedtls_aes_setkey_dec(&encrypt->aes, encrypt->key, 128) != 0) {
+    ESP_LOGE(TAG, "Failed to set AES key");
+    mbedtls_aes_free(&encrypt->aes);
+    return;
+  }
+  encrypt->aes_ready = true;
+}
+
+void audio_crypto_release(audio_encrypt_t *encrypt) {
+  if (!encrypt || !encrypt->aes_ready) {
+    return;
+  }
+
+  mbedtls_aes_free(&encrypt->aes);
+  encrypt->aes_ready = false;
+}
+
+int audio_crypto_decrypt_rtp(audio_encrypt_t *encrypt,
                              const uint8_t *input, size_t input_len,
                              uint8_t *output, size_t output_capacity,
                              const uint8_t *full_packet,
@@ -18,7 +51,9 @@ int audio_crypto_decrypt_rtp(const audio_encrypt_t *encrypt,
     if (input_len > output_capacity) {
       return -1;
     }
-    memcpy(output, input, input_len);
+    if (output != input) {
+      memcpy(output, input, input_len);
+    }
     return (int)input_len;
   }
 
@@ -35,24 +70,21 @@ int audio_crypto_decrypt_rtp(const audio_encrypt_t *encrypt,
     size_t encrypted_len = num_blocks * 16;
 
     if (encrypted_len > 0) {
-      mbedtls_aes_context aes;
-      mbedtls_aes_init(&aes);
-
-      int ret = mbedtls_aes_setkey_dec(&aes, encrypt->key, 128);
-      if (ret != 0) {
-        mbedtls_aes_free(&aes);
-        return -1;
+      if (!encrypt->aes_ready) {
+        audio_crypto_prepare(encrypt);
+        if (!encrypt->aes_ready) {
+          return -1;
+        }
       }
 
-      ret = mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_DECRYPT, encrypted_len, iv,
-                                  input, output);
-      mbedtls_aes_free(&aes);
+      int ret = mbedtls_aes_crypt_cbc(&encrypt->aes, MBEDTLS_AES_DECRYPT,
+                                      encrypted_len, iv, input, output);
       if (ret != 0) {
         return -1;
       }
     }
 
-    if (remainder > 0) {
+    if (remainder > 0 && output != input) {
       memcpy(output + encrypted_len, input + encrypted_len, remainder);
     }
 
@@ -107,7 +139,9 @@ int audio_crypto_decrypt_buffered(const audio_encrypt_t *encrypt,
     if (payload_len > output_capacity) {
       return -1;
     }
-    memcpy(output, packet + 12, payload_len);
+    if (output != packet + 12) {
+      memcpy(output, packet + 12, payload_len);
+    }
     return (int)payload_len;
   }
 
@@ -5,12 +5,29 @@
 
 #include "audio_receiver.h"
 
-int audio_crypto_decrypt_rtp(const audio_encrypt_t *encrypt,
+/**
+ * Expand the AES-CBC decryption key of a freshly set encrypt config, so
+ * packets do not redo the key schedule. No-op for other types.
+ */
+void audio_crypto_prepare(audio_encrypt_t *encrypt);
+
+/** Free the cached key schedule (before the config is cleared or reused). */
+void audio_crypto_release(audio_encrypt_t *encrypt);
+
+/**
+ * Decrypt one RTP payload. AES-CBC uses the cached context and prepares it
+ * on first use if the caller has not. output may be input (in place).
+ */
+int audio_crypto_decrypt_rtp(audio_encrypt_t *encrypt,
                              const uint8_t *input, size_t input_len,
                              uint8_t *output, size_t output_capacity,
                              const uint8_t *full_packet,
                              size_t full_packet_len);
 
+/**
+ * Decrypt a buffered (TCP) packet. output may be the payload at packet + 12
+ * (in place); the nonce is read before the payload is overwritten.
+ */
 int audio_crypto_decrypt_buffered(const audio_encrypt_t *encrypt,
                                   const uint8_t *packet, size_t packet_len,
                                   uint8_t *output, size_t output_capacity);
@@ -1,4 +1,3 @@
-#include <netinet/in.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -10,9 +9,16 @@
 #include "decoder/impl/esp_aac_dec.h"
 #include "decoder/impl/esp_alac_dec.h"
 #include "esp_audio_dec.h"
+#if CONFIG_AUDIO_ALAC_INTREE
+#include "alac_decoder.h"
+#endif
 
 #define ADTS_HEADER_LEN       7
+#define ADTS_CRC_LEN          2
 #define MAX_FALLBACK_CHANNELS 2
+#define AOT_AAC_LC            2
+#define AOT_ESCAPE            31
+#define AOT_ER_AAC_ELD        39
 
 typedef enum {
   AUDIO_DECODER_NONE = 0,
@@ -24,11 +30,13 @@ typedef enum {
 struct audio_decoder {
   audio_decoder_kind_t kind;
   audio_format_t format;
+  audio_format_t requested; // As passed to create, before the ASC override
   void *alac_decoder;
+#if CONFIG_AUDIO_ALAC_INTREE
+  alac_decoder_t *alac_intree;
+#endif
   void *aac_decoder;
   uint8_t alac_magic_cookie[ALAC_MAGIC_COOKIE_SIZE];
-  uint8_t *aac_frame_buffer;
-  size_t aac_frame_buffer_size;
 };
 
 static const char *TAG = "audio_dec";
@@ -40,6 +48,14 @@ static bool codec_is_alac(const char *codec) {
   return strcmp(codec, "AppleLossless") == 0 || strcmp(codec, "ALAC") == 0;
 }
 
+// codec_is_aac() matches these names as well
+static bool codec_is_aac_eld(const char *codec) {
+  if (!codec) {
+    return false;
+  }
+  return strstr(codec, "ELD") != NULL || strstr(codec, "eld") != NULL;
+}
+
 static bool codec_is_aac(const char *codec) {
   if (!codec) {
     return false;
@@ -48,27 +64,119 @@ static bool codec_is_aac(const char *codec) {
          strstr(codec, "mpeg4-generic") != NULL;
 }
 
+// Every stage after the decoder carries int16 samples
+static bool format_is_16bit(const audio_format_t *format) {
+  int bits = format->sample_size
+                 ? format->sample_size
+                 : (format->bits_per_sample ? format->bits_per_sample : 16);
+  return bits == 16;
+}
+
 static bool aac_has_adts_header(const uint8_t *data, size_t len) {
   return len >= 2 && data[0] == 0xFF && (data[1] & 0xF0) == 0xF0;
 }
 
-static void build_adts_header(uint8_t *header, size_t frame_len,
-                              int sample_rate, int channels) {
-  (void)sample_rate;
-  (void)channels;
-
-  int profile = 2;
-  int freq_idx = 4;
-  int chan_cfg = 2;
-  int packet_len = (int)(frame_len + ADTS_HEADER_LEN);
-
-  header[0] = 0xFF;
-  header[1] = 0xF1;
-  header[2] = ((profile - 1) << 6) + (freq_idx << 2) + (chan_cfg >> 2);
-  header[3] = ((chan_cfg & 3) << 6) + (packet_len >> 11);
-  header[4] = (packet_len & 0x7FF) >> 3;
-  header[5] = ((packet_len & 7) << 5) + 0x1F;
-  header[6] = 0xFC;
+/**
+ * Big-endian L16 to host order, two samples per 32-bit word. out must be
+ * 4-byte aligned (pool slots and the decode buffer are); in is read a word
+ * at a time when it is aligned too, bytewise otherwise.
+ */
+static void swap_l16(const uint8_t *in, int16_t *out, size_t count) {
+  uint32_t *dst = (uint32_t *)out;
+  size_t words = count / 2;
+  size_t i = 0;
+
+  if (((uintptr_t)in & 3) == 0) {
+    const uint32_t *src = (const uint32_t *)in;
+    for (; i + 2 <= words; i += 2) {
+      uint32_t a = src[i];
+      uint32_t b = src[i + 1];
+      dst[i] = ((a & 0x00FF00FFu) << 8) | ((a >> 8) & 0x00FF00FFu);
+      dst[i + 1] = ((b & 0x00FF00FFu) << 8) | ((b >> 8) & 0x00FF00FFu);
+    }
+  }
+  for (; i < words; i++) {
+    const uint8_t *p = in + i * 4;
+    dst[i] = (uint32_t)p[1] | ((uint32_t)p[0] << 8) | ((uint32_t)p[3] << 16) |
+             ((uint32_t)p[2] << 24);
+  }
+  if (count & 1) {
+    const uint8_t *p = in + (count - 1) * 2;
+    out[count - 1] = (int16_t)(((uint16_t)p[0] << 8) | p[1]);
+  }
+}
+
+static uint32_t read_bits(const uint8_t *data, size_t len, size_t *pos,
+                          int count) {
+  uint32_t value = 0;
+  for (int i = 0; i < count; i++, (*pos)++) {
+    size_t byte = *pos >> 3;
+    int bit = byte < len ? (data[byte] >> (7 - (*pos & 7))) & 1 : 0;
+    value = (value << 1) | (uint32_t)bit;
+  }
+  return value;
+}
+
+/**
+ * Read object type, rate and channels from an AudioSpecificConfig
+ * (ISO 14496-3 1.6.2.1). Fields the config does not set are left alone.
+ */
+static bool parse_audio_specific_config(const uint8_t *asc, size_t len,
+                                        int *object_type, int *sample_rate,
+                                        int *channels) {
+  static const int rates[] = {96000, 88200, 64000, 48000, 44100,
+                              32000, 24000, 22050, 16000, 12000,
+                              11025, 8000,  7350};
+  if (len < 2) {
+    return false;
+  }
+
+  size_t pos = 0;
+  int aot = (int)read_bits(asc, len, &pos, 5);
+  if (aot == AOT_ESCAPE) {
+    aot = 32 + (int)read_bits(asc, len, &pos, 6);
+  }
+  uint32_t freq_idx = read_bits(asc, len, &pos, 4);
+  int rate = 0;
+  if (freq_idx == 0xF) {
+    rate = (int)read_bits(asc, len, &pos, 24);
+  } else if (freq_idx < sizeof(rates) / sizeof(rates[0])) {
+    rate = rates[freq_idx];
+  }
+  if (pos + 4 > len * 8) {
+    return false;
+  }
+  int chan_cfg = (int)read_bits(asc, len, &pos, 4);
+
+  *object_type = aot;
+  if (rate > 0) {
+    *sample_rate = rate;
+  }
+  if (chan_cfg > 0 && chan_cfg <= 2) {
+    *channels = chan_cfg;
+  }
+  return true;
+}
+
+// Raw access units only; the stream parameters are fixed at open
+static void *open_aac(audio_decoder_t *decoder) {
+  esp_aac_dec_cfg_t aac_cfg = ESP_AAC_DEC_CONFIG_DEFAULT();
+  aac_cfg.sample_rate = decoder->format.sample_rate;
+  aac_cfg.channel = decoder->format.channels;
+  aac_cfg.bits_per_sample =
+      decoder->format.bits_per_sample ? decoder->format.bits_per_sample : 16;
+  aac_cfg.no_adts_header = true;
+  aac_cfg.aac_plus_enable = false;
+
+  void *handle = NULL;
+  esp_audio_err_t err = esp_aac_dec_open(&aac_cfg, sizeof(aac_cfg), &handle);
+  if (err != ESP_AUDIO_ERR_OK) {
+    ESP_LOGE(TAG, "Failed to open AAC decoder: %d", err);
+    return NULL;
+  }
+  ESP_LOGI(TAG, "AAC decoder: %d Hz, %d ch", aac_cfg.sample_rate,
+           aac_cfg.channel);
+  return handle;
 }
 
 audio_decoder_t *audio_decoder_create(const audio_decoder_config_t *config) {
@@ -82,9 +190,22 @@ audio_decoder_t *audio_decoder_create(const audio_decoder_config_t *config) {
   }
 
   decoder->format = config->format;
+  decoder->requested = config->format;
 
-  if (codec_is_alac(config->format.codec)) {
+  if (codec_is_alac(config->format.codec) &&
+      !format_is_16bit(&config->format)) {
+    ESP_LOGE(TAG, "Unsupported ALAC bit depth: %d",
+             config->format.sample_size ? config->format.sample_size
+                                        : config->format.bits_per_sample);
+    decoder->kind = AUDIO_DECODER_NONE;
+  } else if (codec_is_alac(config->format.codec)) {
     decoder->kind = AUDIO_DECODER_ALAC;
+#if CONFIG_AUDIO_ALAC_INTREE
+    decoder->alac_intree = alac_decoder_create(&config->format);
+    if (!decoder->alac_intree) {
+      decoder->kind = AUDIO_DECODER_NONE;
+    }
+#else
     build_alac_magic_cookie(decoder->alac_magic_cookie, &config->format);
 
     esp_alac_dec_cfg_t alac_cfg = {.codec_spec_info =
@@ -98,23 +219,29 @@ audio_decoder_t *audio_decoder_create(const audio_decoder_config_t *config) {
       decoder->alac_decoder = NULL;
       decoder->kind = AUDIO_DECODER_NONE;
     }
+#endif
   } else if (codec_is_aac(config->format.codec)) {
-    decoder->kind = AUDIO_DECODER_AAC;
-
-    esp_aac_dec_cfg_t aac_cfg = ESP_AAC_DEC_CONFIG_DEFAULT();
-    aac_cfg.sample_rate = config->format.sample_rate;
-    aac_cfg.channel = config->format.channels;
-    aac_cfg.bits_per_sample =
-        config->format.bits_per_sample ? config->format.bits_per_sample : 16;
-    aac_cfg.no_adts_header = false;
-    aac_cfg.aac_plus_enable = false;
+    int object_type =
+        codec_is_aac_eld(config->format.codec) ? AOT_ER_AAC_ELD : AOT_AAC_LC;
+    if (config->format.aac_config_len > 0 &&
+        !parse_audio_specific_config(
+            config->format.aac_config, config->format.aac_config_len,
+            &object_type, &decoder->format.sample_rate,
+            &decoder->format.channels)) {
+      ESP_LOGW(TAG, "Ignoring malformed AudioSpecificConfig");
+    }
 
-    esp_audio_err_t err =
-        esp_aac_dec_open(&aac_cfg, sizeof(aac_cfg), &decoder->aac_decoder);
-    if (err != ESP_AUDIO_ERR_OK) {
-      ESP_LOGE(TAG, "Failed to open AAC decoder: %d", err);
-      decoder->aac_decoder = NULL;
+    if (object_type == AOT_ER_AAC_ELD) {
+      // The esp_audio_codec AAC decoder implements LC and HE-AAC only, and
+      // its config has no field for an AudioSpecificConfig
+      ESP_LOGE(TAG, "AAC-ELD is not supported by the AAC decoder");
       decoder->kind = AUDIO_DECODER_NONE;
+    } else {
+      decoder->kind = AUDIO_DECODER_AAC;
+      decoder->aac_decoder = open_aac(decoder);
+      if (!decoder->aac_decoder) {
+        decoder->kind = AUDIO_DECODER_NONE;
+      }
     }
   } else if (strcmp(config->format.codec, "L16") == 0 ||
              strcmp(config->format.codec, "PCM") == 0) {
@@ -135,19 +262,43 @@ void audio_decoder_destroy(audio_decoder_t *decoder) {
     esp_alac_dec_close(decoder->alac_decoder);
     decoder->alac_decoder = NULL;
   }
+#if CONFIG_AUDIO_ALAC_INTREE
+  alac_decoder_destroy(decoder->alac_intree);
+#endif
 
   if (decoder->aac_decoder) {
     esp_aac_dec_close(decoder->aac_decoder);
     decoder->aac_decoder = NULL;
   }
 
-  if (decoder->aac_frame_buffer) {
-    free(decoder->aac_frame_buffer);
-    decoder->aac_frame_buffer = NULL;
-    decoder->aac_frame_buffer_size = 0;
+  free(decoder);
+}
+
+bool audio_decoder_matches(const audio_decoder_t *decoder,
+                           const audio_format_t *format) {
+  if (!decoder || !format || decoder->kind == AUDIO_DECODER_NONE) {
+    return false;
   }
 
-  free(decoder);
+  // Field by field: SDP parsing does not clear the padding
+  const audio_format_t *a = &decoder->requested;
+  return strcmp(a->codec, format->codec) == 0 &&
+         a->sample_rate == format->sample_rate &&
+         a->channels == format->channels &&
+         a->bits_per_sample == format->bits_per_sample &&
+         a->frame_size == format->frame_size &&
+         a->max_samples_per_frame == format->max_samples_per_frame &&
+         a->sample_size == format->sample_size &&
+         a->rice_history_mult == format->rice_history_mult &&
+         a->rice_initial_history == format->rice_initial_history &&
+         a->rice_limit == format->rice_limit &&
+         a->num_channels == format->num_channels &&
+         a->max_run == format->max_run &&
+         a->max_coded_frame_size == format->max_coded_frame_size &&
+         a->avg_bit_rate == format->avg_bit_rate &&
+         a->sample_rate_config == format->sample_rate_config &&
+         a->aac_config_len == format->aac_config_len &&
+         memcmp(a->aac_config, format->aac_config, a->aac_config_len) == 0;
 }
 
 int audio_decoder_decode(audio_decoder_t *decoder, const uint8_t *input,
@@ -169,10 +320,7 @@ int audio_decoder_decode(audio_decoder_t *decoder, const uint8_t *input,
       decoded_samples = output_capacity_samples;
     }
 
-    const int16_t *src = (const int16_t *)input;
-    for (size_t i = 0; i < decoded_samples * channels; i++) {
-      output[i] = ntohs(src[i]);
-    }
+    swap_l16(input, output, decoded_samples * channels);
 
     if (info) {
       info->channels = channels;
@@ -181,6 +329,18 @@ int audio_decoder_decode(audio_decoder_t *decoder, const uint8_t *input,
   }
 
   if (decoder->kind == AUDIO_DECODER_ALAC) {
+#if CONFIG_AUDIO_ALAC_INTREE
+    int decoded_samples =
+        alac_decoder_decode(decoder->alac_intree, input, input_len, output,
+                            output_capacity_samples);
+    if (decoded_samples <= 0) {
+      return -1;
+    }
+    if (info) {
+      info->channels = alac_decoder_channels(decoder->alac_intree);
+    }
+    return decoded_samples;
+#else
     if (!decoder->alac_decoder) {
       return -1;
     }
@@ -216,6 +376,7 @@ int audio_decoder_decode(audio_decoder_t *decoder, const uint8_t *input,
       info->channels = dec_channels;
     }
     return (int)decoded_samples;
+#endif
   }
 
   if (decoder->kind == AUDIO_DECODER_AAC) {
@@ -226,23 +387,16 @@ int audio_decoder_decode(audio_decoder_t *decoder, const uint8_t *input,
     const uint8_t *decode_data = input;
     size_t decode_len = input_len;
 
-    if (!aac_has_adts_header(input, input_len)) {
-      size_t needed = input_len + ADTS_HEADER_LEN;
-      if (!decoder->aac_frame_buffer ||
-          decoder->aac_frame_buffer_size < needed) {
-        uint8_t *new_buf = realloc(decoder->aac_frame_buffer, needed);
-        if (!new_buf) {
-          return -1;
-        }
-        decoder->aac_frame_buffer = new_buf;
-        decoder->aac_frame_buffer_size = needed;
+    // The decoder runs raw; step over ADTS framing in place if a sender
+    // adds it anyway
+    if (aac_has_adts_header(input, input_len)) {
+      size_t header_len =
+          ADTS_HEADER_LEN + ((input[1] & 0x01) ? 0 : ADTS_CRC_LEN);
+      if (input_len <= header_len) {
+        return -1;
       }
-
-      build_adts_header(decoder->aac_frame_buffer, input_len,
-                        decoder->format.sample_rate, decoder->format.channels);
-      memcpy(decoder->aac_frame_buffer + ADTS_HEADER_LEN, input, input_len);
-      decode_data = decoder->aac_frame_buffer;
-      decode_len = needed;
+      decode_data += header_len;
+      decode_len -= header_len;
     }
 
     esp_audio_dec_in_raw_t raw = {.buffer = (uint8_t *)decode_data,
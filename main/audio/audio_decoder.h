@@ -18,6 +18,13 @@ typedef struct {
 
 audio_decoder_t *audio_decoder_create(const audio_decoder_config_t *config);
 void audio_decoder_destroy(audio_decoder_t *decoder);
+
+/**
+ * True if the decoder was created for an identical format, so a new stream
+ * in that format can keep using it.
+ */
+bool audio_decoder_matches(const audio_decoder_t *decoder,
+                           const audio_format_t *format);
 int audio_decoder_decode(audio_decoder_t *decoder, const uint8_t *input,
                          size_t input_len, int16_t *output,
                          size_t output_capacity_samples,
@@ -0,0 +1,318 @@
+#include "audio_eq.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "dsps_biquad.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "settings.h"
+
+static const char *TAG = "audio_eq";
+
+#define BLOCK_SAMPLES    512 // Work buffer length, longer blocks are split
+#define MIN_FREQ_HZ      10.0f
+#define MAX_FREQ_HZ      24000.0f
+#define MAX_GAIN_DB      24.0f
+#define MIN_Q            0.1f
+#define MAX_Q            20.0f
+#define MIN_PREAMP_DB    -24.0f
+#define MAX_PREAMP_DB    6.0f
+#define MAX_FREQ_RATIO   0.49f // Of the sample rate, keeps the poles stable
+#define CYCLES_AVG_SHIFT 4
+
+typedef struct {
+  float coef[5]; // b0, b1, b2, a1, a2, normalised by a0
+  float w[2][2]; // Filter memory per channel
+} biquad_t;
+
+static const char *const type_names[AUDIO_EQ_TYPE_COUNT] = {
+    [AUDIO_EQ_PEAK] = "peak",
+    [AUDIO_EQ_LOW_SHELF] = "lowshelf",
+    [AUDIO_EQ_HIGH_SHELF] = "highshelf",
+    [AUDIO_EQ_LOW_PASS] = "lowpass",
+    [AUDIO_EQ_HIGH_PASS] = "highpass",
+};
+
+// Written by the web server under config_lock, picked up by the playback
+// task when config_dirty is set
+static portMUX_TYPE config_lock = portMUX_INITIALIZER_UNLOCKED;
+static audio_eq_config_t pending;
+static atomic_bool config_dirty;
+
+// Playback task only
+static audio_eq_config_t active;
+static biquad_t filters[AUDIO_EQ_MAX_BANDS];
+static uint32_t filter_rate;
+static float input_scale;
+static float *work[2];
+
+// Written by the playback task, read by the web server
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static audio_eq_stats_t stats;
+
+const char *audio_eq_type_name(audio_eq_type_t type) {
+  if ((unsigned)type >= AUDIO_EQ_TYPE_COUNT) {
+    return NULL;
+  }
+  return type_names[type];
+}
+
+int audio_eq_type_from_name(const char *name) {
+  if (!name) {
+    return -1;
+  }
+  for (int i = 0; i < AUDIO_EQ_TYPE_COUNT; i++) {
+    if (strcmp(name, type_names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Robert Bristow-Johnson's Audio EQ Cookbook
+static void design(biquad_t *bq, const audio_eq_band_t *band,
+                   uint32_t sample_rate) {
+  float freq = band->freq_hz;
+  if (freq > sample_rate * MAX_FREQ_RATIO) {
+    freq = sample_rate * MAX_FREQ_RATIO;
+  }
+  float w0 = 2.0f * (float)M_PI * freq / (float)sample_rate;
+  float cw = cosf(w0);
+  float alpha = sinf(w0) / (2.0f * band->q);
+  float a = powf(10.0f, band->gain_db / 40.0f);
+  float b0, b1, b2, a0, a1, a2;
+
+  switch (band->type) {
+  case AUDIO_EQ_LOW_SHELF:
+  case AUDIO_EQ_HIGH_SHELF: {
+    float s = band->type == AUDIO_EQ_LOW_SHELF ? 1.0f : -1.0f;
+    float k = 2.0f * sqrtf(a) * alpha;
+    b0 = a * ((a + 1) - s * (a - 1) * cw + k);
+    b1 = s * 2 * a * ((a - 1) - s * (a + 1) * cw);
+    b2 = a * ((a + 1) - s * (a - 1) * cw - k);
+    a0 = (a + 1) + s * (a - 1) * cw + k;
+    a1 = -s * 2 * ((a - 1) + s * (a + 1) * cw);
+    a2 = (a + 1) + s * (a - 1) * cw - k;
+    break;
+  }
+  case AUDIO_EQ_LOW_PASS:
+    b0 = (1 - cw) / 2;
+    b1 = 1 - cw;
+    b2 = b0;
+    a0 = 1 + alpha;
+    a1 = -2 * cw;
+    a2 = 1 - alpha;
+    break;
+  case AUDIO_EQ_HIGH_PASS:
+    b0 = (1 + cw) / 2;
+    b1 = -(1 + cw);
+    b2 = b0;
+    a0 = 1 + alpha;
+    a1 = -2 * cw;
+    a2 = 1 - alpha;
+    break;
+  case AUDIO_EQ_PEAK:
+  default:
+    b0 = 1 + alpha * a;
+    b1 = -2 * cw;
+    b2 = 1 - alpha * a;
+    a0 = 1 + alpha / a;
+    a1 = -2 * cw;
+    a2 = 1 - alpha / a;
+    break;
+  }
+
+  bq->coef[0] = b0 / a0;
+  bq->coef[1] = b1 / a0;
+  bq->coef[2] = b2 / a0;
+  bq->coef[3] = a1 / a0;
+  bq->coef[4] = a2 / a0;
+}
+
+// Filter memories are kept, a rate change between tracks needs no reset
+static void rebuild(uint32_t sample_rate) {
+  for (int i = 0; i < active.band_count; i++) {
+    design(&filters[i], &active.bands[i], sample_rate);
+  }
+  input_scale = powf(10.0f, active.preamp_db / 20.0f) / 32768.0f;
+  filter_rate = sample_rate;
+  taskENTER_CRITICAL(&stats_lock);
+  stats.sample_rate = sample_rate;
+  taskEXIT_CRITICAL(&stats_lock);
+}
+
+static void clear_memories(void) {
+  for (int i = 0; i < AUDIO_EQ_MAX_BANDS; i++) {
+    memset(filters[i].w, 0, sizeof(filters[i].w));
+  }
+}
+
+// Same band types in the same order: retuned filters carry on from their
+// memories, zeroing them would click
+static bool same_layout(const audio_eq_config_t *a,
+                        const audio_eq_config_t *b) {
+  if (a->enabled != b->enabled || a->band_count != b->band_count) {
+    return false;
+  }
+  for (int i = 0; i < a->band_count; i++) {
+    if (a->bands[i].type != b->bands[i].type) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool band_valid(const audio_eq_band_t *band) {
+  return band->type < AUDIO_EQ_TYPE_COUNT && band->freq_hz >= MIN_FREQ_HZ &&
+         band->freq_hz <= MAX_FREQ_HZ && band->gain_db >= -MAX_GAIN_DB &&
+         band->gain_db <= MAX_GAIN_DB && band->q >= MIN_Q && band->q <= MAX_Q;
+}
+
+static esp_err_t validate(const audio_eq_config_t *config) {
+  if (!config || config->band_count > AUDIO_EQ_MAX_BANDS ||
+      !(config->preamp_db >= MIN_PREAMP_DB) ||
+      !(config->preamp_db <= MAX_PREAMP_DB)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  for (int i = 0; i < config->band_count; i++) {
+    if (!band_valid(&config->bands[i])) {
+      return ESP_ERR_INVALID_ARG;
+    }
+  }
+  return ESP_OK;
+}
+
+static void publish(const audio_eq_config_t *config) {
+  taskENTER_CRITICAL(&config_lock);
+  pending = *config;
+  taskEXIT_CRITICAL(&config_lock);
+  atomic_store(&config_dirty, true);
+}
+
+esp_err_t audio_eq_init(void) {
+  for (int ch = 0; ch < 2; ch++) {
+    work[ch] = heap_caps_malloc(BLOCK_SAMPLES * sizeof(float),
+                                MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!work[ch]) {
+      ESP_LOGE(TAG, "Failed to allocate work buffers");
+      return ESP_ERR_NO_MEM;
+    }
+  }
+
+  audio_eq_config_t config = {0};
+  if (settings_get_eq(&config) != ESP_OK || validate(&config) != ESP_OK) {
+    memset(&config, 0, sizeof(config));
+  } else {
+    ESP_LOGI(TAG, "Loaded %d band(s), %s", config.band_count,
+             config.enabled ? "enabled" : "bypassed");
+  }
+  publish(&config);
+  return ESP_OK;
+}
+
+esp_err_t audio_eq_set_config(const audio_eq_config_t *config) {
+  esp_err_t err = validate(config);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  publish(config);
+  return settings_set_eq(config);
+}
+
+void audio_eq_get_config(audio_eq_config_t *config) {
+  if (!config) {
+    return;
+  }
+
+  taskENTER_CRITICAL(&config_lock);
+  *config = pending;
+  taskEXIT_CRITICAL(&config_lock);
+}
+
+void audio_eq_reset(void) {
+  clear_memories();
+}
+
+static inline int16_t to_pcm(float v) {
+  v *= 32768.0f;
+  if (v >= 32767.0f) {
+    return INT16_MAX;
+  }
+  if (v <= -32768.0f) {
+    return INT16_MIN;
+  }
+  return (int16_t)(v + (v >= 0 ? 0.5f : -0.5f));
+}
+
+static void run_block(int16_t *pcm, size_t samples) {
+  for (size_t i = 0; i < samples; i++) {
+    work[0][i] = pcm[i * 2] * input_scale;
+    work[1][i] = pcm[i * 2 + 1] * input_scale;
+  }
+  for (int b = 0; b < active.band_count; b++) {
+    for (int ch = 0; ch < 2; ch++) {
+      dsps_biquad_f32(work[ch], work[ch], (int)samples, filters[b].coef,
+                      filters[b].w[ch]);
+    }
+  }
+  for (size_t i = 0; i < samples; i++) {
+    pcm[i * 2] = to_pcm(work[0][i]);
+    pcm[i * 2 + 1] = to_pcm(work[1][i]);
+  }
+}
+
+void audio_eq_process(int16_t *pcm, size_t samples, uint32_t sample_rate) {
+  if (!pcm || samples == 0 || !work[0]) {
+    return;
+  }
+
+  if (atomic_exchange(&config_dirty, false)) {
+    audio_eq_config_t previous = active;
+    taskENTER_CRITICAL(&config_lock);
+    active = pending;
+    taskEXIT_CRITICAL(&config_lock);
+    if (!same_layout(&previous, &active)) {
+      clear_memories();
+    }
+    filter_rate = 0;
+  }
+  if (!active.enabled) {
+    return;
+  }
+  if (sample_rate != filter_rate) {
+    rebuild(sample_rate);
+  }
+
+  uint32_t start = esp_cpu_get_cycle_count();
+  for (size_t done = 0; done < samples; done += BLOCK_SAMPLES) {
+    size_t n = samples - done;
+    if (n > BLOCK_SAMPLES) {
+      n = BLOCK_SAMPLES;
+    }
+    run_block(pcm + done * 2, n);
+  }
+  uint32_t cycles = esp_cpu_get_cycle_count() - start;
+
+  taskENTER_CRITICAL(&stats_lock);
+  stats.block_cycles += ((int32_t)cycles - (int32_t)stats.block_cycles) >>
+                        CYCLES_AVG_SHIFT;
+  if (cycles > stats.peak_cycles) {
+    stats.peak_cycles = cycles;
+  }
+  stats.block_samples = (uint32_t)samples;
+  taskEXIT_CRITICAL(&stats_lock);
+}
+
+void audio_eq_get_stats(audio_eq_stats_t *out) {
+  if (!out) {
+    return;
+  }
+  taskENTER_CRITICAL(&stats_lock);
+  *out = stats;
+  taskEXIT_CRITICAL(&stats_lock);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * Cascaded biquad chain (room EQ, crossover high-pass) for interleaved
+ * stereo 16-bit PCM.
+ *
+ * Bands are described by type, corner frequency, gain and Q; coefficients
+ * are derived for the current output rate (RBJ cookbook) and run with the
+ * esp-dsp biquad kernel, one channel at a time on a float copy of the
+ * block. The configuration is persisted through settings and can be
+ * replaced at any time; the playback task picks it up at the next block.
+ */
+
+#define AUDIO_EQ_MAX_BANDS CONFIG_AUDIO_EQ_MAX_BANDS
+
+typedef enum {
+  AUDIO_EQ_PEAK = 0,
+  AUDIO_EQ_LOW_SHELF,
+  AUDIO_EQ_HIGH_SHELF,
+  AUDIO_EQ_LOW_PASS,
+  AUDIO_EQ_HIGH_PASS,
+  AUDIO_EQ_TYPE_COUNT,
+} audio_eq_type_t;
+
+typedef struct {
+  uint8_t type;  // audio_eq_type_t
+  float freq_hz; // Centre or corner frequency
+  float gain_db; // Peak and shelf types only
+  float q;
+} audio_eq_band_t;
+
+typedef struct {
+  bool enabled;
+  uint8_t band_count;
+  float preamp_db; // Head-room for boosting bands
+  audio_eq_band_t bands[AUDIO_EQ_MAX_BANDS];
+} audio_eq_config_t;
+
+typedef struct {
+  uint32_t block_cycles;  // Smoothed CPU cycles per processed block
+  uint32_t peak_cycles;   // Most expensive block since boot
+  uint32_t block_samples; // Samples per channel in the last block
+  uint32_t sample_rate;   // Rate the coefficients were computed for
+} audio_eq_stats_t;
+
+/** Allocate the work buffers and load the saved configuration. */
+esp_err_t audio_eq_init(void);
+
+/**
+ * Validate and apply a configuration, and save it.
+ * @return ESP_ERR_INVALID_ARG if a band is out of range
+ */
+esp_err_t audio_eq_set_config(const audio_eq_config_t *config);
+
+void audio_eq_get_config(audio_eq_config_t *config);
+
+/** Short name of a band type ("peak", "lowshelf", ...), NULL if unknown. */
+const char *audio_eq_type_name(audio_eq_type_t type);
+
+/** Band type for a name from audio_eq_type_name(), or -1. */
+int audio_eq_type_from_name(const char *name);
+
+/**
+ * Filter one block in place (playback task).
+ * @param samples Samples per channel
+ * @param sample_rate Output rate, coefficients follow it
+ */
+void audio_eq_process(int16_t *pcm, size_t samples, uint32_t sample_rate);
+
+/** Clear the filter memories, e.g. after a flush. */
+void audio_eq_reset(void);
+
+void audio_eq_get_stats(audio_eq_stats_t *stats);
@@ -0,0 +1,125 @@
+#include "audio_fade.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "dsps_mul.h"
+
+#define FADE_SHIFT 15 // Envelopes are Q15
+
+// Interleaved so one multiply covers both channels: ramp_up rises from just
+// above 0 to just below unity, ramp_down is its mirror
+static int16_t ramp_up[AUDIO_FADE_SAMPLES * 2];
+static int16_t ramp_down[AUDIO_FADE_SAMPLES * 2];
+static bool ramps_ready;
+
+static void build_ramps(void) {
+  for (int i = 0; i < AUDIO_FADE_SAMPLES; i++) {
+    float phase = (float)M_PI * ((float)i + 0.5f) / AUDIO_FADE_SAMPLES;
+    int16_t g = (int16_t)lroundf(32767.0f * 0.5f * (1.0f - cosf(phase)));
+    ramp_up[i * 2] = g;
+    ramp_up[i * 2 + 1] = g;
+    ramp_down[(AUDIO_FADE_SAMPLES - 1 - i) * 2] = g;
+    ramp_down[(AUDIO_FADE_SAMPLES - 1 - i) * 2 + 1] = g;
+  }
+  ramps_ready = true;
+}
+
+void audio_fade_init(audio_fade_t *fade) {
+  if (!fade) {
+    return;
+  }
+  if (!ramps_ready) {
+    build_ramps();
+  }
+  fade->history_len = 0;
+  fade->fade_in_pos = 0;
+}
+
+static void remember(audio_fade_t *fade, const int16_t *pcm, size_t samples) {
+  if (samples >= AUDIO_FADE_SAMPLES) {
+    memcpy(fade->history, pcm + (samples - AUDIO_FADE_SAMPLES) * 2,
+           sizeof(fade->history));
+    fade->history_len = AUDIO_FADE_SAMPLES;
+    return;
+  }
+  // Short block: slide the older samples down to make room
+  size_t keep = fade->history_len;
+  if (keep + samples > AUDIO_FADE_SAMPLES) {
+    keep = AUDIO_FADE_SAMPLES - samples;
+  }
+  memmove(fade->history, fade->history + (fade->history_len - keep) * 2,
+          keep * 2 * sizeof(int16_t));
+  memcpy(fade->history + keep * 2, pcm, samples * 2 * sizeof(int16_t));
+  fade->history_len = keep + samples;
+}
+
+void audio_fade_process(audio_fade_t *fade, int16_t *pcm, size_t samples) {
+  if (!fade || !pcm || samples == 0) {
+    return;
+  }
+
+  if (fade->fade_in_pos < AUDIO_FADE_SAMPLES) {
+    size_t n = AUDIO_FADE_SAMPLES - fade->fade_in_pos;
+    if (n > samples) {
+      n = samples;
+    }
+    dsps_mul_s16(pcm, ramp_up + fade->fade_in_pos * 2, pcm, (int)(n * 2), 1,
+                 1, 1, FADE_SHIFT);
+    fade->fade_in_pos += n;
+  }
+  remember(fade, pcm, samples);
+}
+
+size_t audio_fade_out(audio_fade_t *fade, int16_t *out, size_t samples) {
+  if (!fade || !out) {
+    return 0;
+  }
+
+  // Play the tail backwards: it continues from the last sample at the same
+  // level and with the same spectrum, while the envelope takes it to zero
+  size_t n = fade->history_len < samples ? fade->history_len : samples;
+  for (size_t i = 0; i < n; i++) {
+    out[i * 2] = fade->history[(fade->history_len - 1 - i) * 2];
+    out[i * 2 + 1] = fade->history[(fade->history_len - 1 - i) * 2 + 1];
+  }
+  if (n == AUDIO_FADE_SAMPLES) {
+    dsps_mul_s16(out, ramp_down, out, (int)(n * 2), 1, 1, 1, FADE_SHIFT);
+  } else {
+    // Less history than a full fade (or room for less): stretch the ramp
+    for (size_t i = 0; i < n; i++) {
+      int32_t g = ramp_down[(i * AUDIO_FADE_SAMPLES / n) * 2];
+      out[i * 2] = (int16_t)((out[i * 2] * g) >> FADE_SHIFT);
+      out[i * 2 + 1] = (int16_t)((out[i * 2 + 1] * g) >> FADE_SHIFT);
+    }
+  }
+  if (samples > n) {
+    memset(out + n * 2, 0, (samples - n) * 2 * sizeof(int16_t));
+  }
+
+  fade->history_len = 0;
+  fade->fade_in_pos = 0;
+  return n;
+}
+
+void audio_fade_ramp_in(int16_t *pcm, size_t samples, int channels) {
+  if (!pcm || channels <= 0) {
+    return;
+  }
+  if (!ramps_ready) {
+    build_ramps();
+  }
+
+  size_t n = samples < AUDIO_FADE_SAMPLES ? samples : AUDIO_FADE_SAMPLES;
+  if (channels == 2) {
+    dsps_mul_s16(pcm, ramp_up, pcm, (int)(n * 2), 1, 1, 1, FADE_SHIFT);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) {
+    int32_t g = ramp_up[i * 2];
+    for (int c = 0; c < channels; c++) {
+      pcm[i * channels + c] =
+          (int16_t)((pcm[i * channels + c] * g) >> FADE_SHIFT);
+    }
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Click-free edges for interleaved stereo 16-bit PCM at the output.
+ *
+ * The output stops abruptly on flush, pause and underrun, and starts
+ * abruptly when audio comes back; on an amplifier each step is a click.
+ * The fade keeps the last AUDIO_FADE_SAMPLES played, so a stop can be
+ * finished with that tail mirrored and faded out, and ramps in whatever
+ * plays after the output went quiet. Both envelopes are raised-cosine
+ * tables applied with the DSP library's vector multiply; audio in between
+ * only costs the history copy.
+ */
+
+#define AUDIO_FADE_SAMPLES 128 // ~2.9 ms at 44.1 kHz
+
+typedef struct {
+  int16_t history[AUDIO_FADE_SAMPLES * 2]; // Last samples played, oldest first
+  size_t history_len;                      // Samples per channel held
+  size_t fade_in_pos; // Samples of fade-in done, AUDIO_FADE_SAMPLES when off
+} audio_fade_t;
+
+/** Start quiet: the first audio fades in. */
+void audio_fade_init(audio_fade_t *fade);
+
+/**
+ * Fade in if the output was quiet, then remember the block's end. Call on
+ * every block of audio played, before volume.
+ * @param samples Samples per channel
+ */
+void audio_fade_process(audio_fade_t *fade, int16_t *pcm, size_t samples);
+
+/**
+ * End the audio: write the faded tail into out, zero-filled up to samples,
+ * and fade in whatever plays next.
+ * @return Samples per channel of tail, 0 if nothing was playing
+ */
+size_t audio_fade_out(audio_fade_t *fade, int16_t *out, size_t samples);
+
+/**
+ * Ramp the start of a block in from silence, for audio that follows muted
+ * blocks further up the pipeline.
+ * @param samples Samples per channel
+ */
+void audio_fade_ramp_in(int16_t *pcm, size_t samples, int channels);
@@ -0,0 +1,242 @@
+#include <string.h>
+
+#include "audio_gain.h"
+#include "dsps_mulc.h"
+#include "sdkconfig.h"
+
+#define GAIN_FRAC_BITS 8
+#define DITHER_SEED    0x2545F491 // Any non-zero value
+#define DITHER_MASK    0x7FFF     // One output LSB in Q15
+#define ROUND_HALF     (1 << 14)
+
+void audio_gain_init(audio_gain_t *gain, int32_t gain_q15) {
+  if (!gain) {
+    return;
+  }
+
+  gain->current = gain_q15 << GAIN_FRAC_BITS;
+  gain->step = 0;
+  gain->target = gain_q15;
+  gain->remaining = 0;
+  gain->seed = DITHER_SEED;
+  gain->noise[0] = 0;
+  gain->noise[1] = 0;
+}
+
+static void start_ramp(audio_gain_t *gain, int32_t target_q15) {
+  int32_t delta = (target_q15 << GAIN_FRAC_BITS) - gain->current;
+  gain->target = target_q15;
+  gain->step = delta / AUDIO_GAIN_RAMP_SAMPLES;
+  gain->remaining = AUDIO_GAIN_RAMP_SAMPLES;
+  if (gain->step == 0) {
+    // Tiny change: unit steps, stopping on the target so the gain never
+    // overshoots unity (the wide path has no headroom above it)
+    gain->step = delta > 0 ? 1 : -1;
+    gain->remaining = (uint32_t)(delta > 0 ? delta : -delta);
+  }
+}
+
+static inline int16_t clamp16(int32_t v) {
+  if (v > INT16_MAX) {
+    return INT16_MAX;
+  }
+  if (v < INT16_MIN) {
+    return INT16_MIN;
+  }
+  return (int16_t)v;
+}
+
+#if CONFIG_AUDIO_GAIN_DITHER
+// xorshift32: three shifts per draw, one draw feeds both channels
+static inline uint32_t next_random(uint32_t *seed) {
+  uint32_t x = *seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *seed = x;
+  return x;
+}
+
+// TPDF dither for one stereo pair, rounding offset included. The dither is
+// the difference of two uniform draws of one LSB each, which makes it
+// triangular; taking the previous draw as the second one halves the
+// generator cost and tilts the noise towards high frequencies, where it is
+// least audible.
+static inline void next_dither(uint32_t *seed, int32_t prev[2],
+                               int32_t out[2]) {
+  uint32_t r = next_random(seed);
+  int32_t n0 = (int32_t)(r & DITHER_MASK);
+  int32_t n1 = (int32_t)((r >> 16) & DITHER_MASK);
+  out[0] = ROUND_HALF + n0 - prev[0];
+  out[1] = ROUND_HALF + n1 - prev[1];
+  prev[0] = n0;
+  prev[1] = n1;
+}
+
+// Requantise stereo pairs to 16 bits at a constant gain below unity. Below
+// unity the product plus dither still fits 16 bits after the shift, so the
+// loop needs no clamp.
+static void scale_dithered(audio_gain_t *gain, int16_t *pcm, size_t pairs,
+                           int32_t gain_q15) {
+  uint32_t seed = gain->seed;
+  int32_t prev[2] = {gain->noise[0], gain->noise[1]};
+
+  for (size_t i = 0; i < pairs; i++) {
+    int32_t d[2];
+    next_dither(&seed, prev, d);
+    pcm[i * 2] = (int16_t)((pcm[i * 2] * gain_q15 + d[0]) >> 15);
+    pcm[i * 2 + 1] = (int16_t)((pcm[i * 2 + 1] * gain_q15 + d[1]) >> 15);
+  }
+
+  gain->seed = seed;
+  gain->noise[0] = prev[0];
+  gain->noise[1] = prev[1];
+}
+
+// Ramp: one gain per stereo sample, both channels move together. The
+// whole ramped run is one loop with the generator and gain in registers.
+// The last steps may reach unity, so the result is clamped. Returns the
+// number of pairs consumed.
+static size_t ramp_dithered(audio_gain_t *gain, int16_t *pcm, size_t pairs) {
+  size_t n = pairs < gain->remaining ? pairs : gain->remaining;
+  uint32_t seed = gain->seed;
+  int32_t prev[2] = {gain->noise[0], gain->noise[1]};
+  int32_t current = gain->current;
+  int32_t step = gain->step;
+
+  for (size_t i = 0; i < n; i++) {
+    int32_t g = current >> GAIN_FRAC_BITS;
+    int32_t d[2];
+    next_dither(&seed, prev, d);
+    pcm[i * 2] = clamp16((pcm[i * 2] * g + d[0]) >> 15);
+    pcm[i * 2 + 1] = clamp16((pcm[i * 2 + 1] * g + d[1]) >> 15);
+    current += step;
+  }
+
+  gain->seed = seed;
+  gain->noise[0] = prev[0];
+  gain->noise[1] = prev[1];
+  gain->current = current;
+  gain->remaining -= (uint32_t)n;
+  if (gain->remaining == 0) {
+    gain->current = gain->target << GAIN_FRAC_BITS;
+  }
+  return n;
+}
+#else
+// Same ramp as the dithered one, truncating. Returns the number of pairs
+// consumed.
+static size_t ramp_truncated(audio_gain_t *gain, int16_t *pcm, size_t pairs) {
+  size_t n = pairs < gain->remaining ? pairs : gain->remaining;
+  int32_t current = gain->current;
+  int32_t step = gain->step;
+
+  for (size_t i = 0; i < n; i++) {
+    int32_t g = current >> GAIN_FRAC_BITS;
+    pcm[i * 2] = clamp16((pcm[i * 2] * g) >> 15);
+    pcm[i * 2 + 1] = clamp16((pcm[i * 2 + 1] * g) >> 15);
+    current += step;
+  }
+
+  gain->current = current;
+  gain->remaining -= (uint32_t)n;
+  if (gain->remaining == 0) {
+    gain->current = gain->target << GAIN_FRAC_BITS;
+  }
+  return n;
+}
+#endif
+
+static void scale_constant(audio_gain_t *gain, int16_t *pcm, size_t pairs,
+                           int32_t gain_q15) {
+  if (gain_q15 == AUDIO_GAIN_UNITY) {
+    return;
+  }
+  if (gain_q15 == 0) {
+    memset(pcm, 0, pairs * 2 * sizeof(int16_t));
+    return;
+  }
+#if CONFIG_AUDIO_GAIN_DITHER
+  scale_dithered(gain, pcm, pairs, gain_q15);
+#else
+  // (in * C) >> 15 in place, on the MAC16 unit of both targets; below unity
+  // the gain fits the int16 constant and the result needs no clamp
+  dsps_mulc_s16(pcm, pcm, (int)(pairs * 2), (int16_t)gain_q15, 1, 1);
+#endif
+}
+
+void audio_gain_apply(audio_gain_t *gain, int16_t *pcm, size_t samples,
+                      int32_t target_q15) {
+  if (!gain || !pcm || samples == 0) {
+    return;
+  }
+
+  if (target_q15 != gain->target) {
+    start_ramp(gain, target_q15);
+  }
+
+#if CONFIG_AUDIO_GAIN_DITHER
+  size_t i = ramp_dithered(gain, pcm, samples);
+#else
+  size_t i = ramp_truncated(gain, pcm, samples);
+#endif
+  if (i < samples) {
+    scale_constant(gain, pcm + i * 2, samples - i, gain->target);
+  }
+}
+
+// in * gain is at most 2^30 in magnitude, so doubling it fills the 32-bit
+// slot without overflow
+static void widen_constant(const int16_t *in, int32_t *out, size_t count,
+                           int32_t gain_q15) {
+  if (gain_q15 == 0) {
+    memset(out, 0, count * sizeof(int32_t));
+    return;
+  }
+  if (gain_q15 == AUDIO_GAIN_UNITY) {
+    for (size_t i = 0; i < count; i++) {
+      out[i] = (int32_t)in[i] * 65536;
+    }
+    return;
+  }
+
+  // Four at a time keeps the multiplier busy between loads on Xtensa
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    out[i] = in[i] * gain_q15 * 2;
+    out[i + 1] = in[i + 1] * gain_q15 * 2;
+    out[i + 2] = in[i + 2] * gain_q15 * 2;
+    out[i + 3] = in[i + 3] * gain_q15 * 2;
+  }
+  for (; i < count; i++) {
+    out[i] = in[i] * gain_q15 * 2;
+  }
+}
+
+void audio_gain_apply_wide(audio_gain_t *gain, const int16_t *in,
+                           int32_t *out, size_t samples, int32_t target_q15) {
+  if (!gain || !in || !out || samples == 0) {
+    return;
+  }
+
+  if (target_q15 != gain->target) {
+    start_ramp(gain, target_q15);
+  }
+
+  size_t i = 0;
+  while (gain->remaining > 0 && i < samples) {
+    int32_t g = gain->current >> GAIN_FRAC_BITS;
+    out[i * 2] = in[i * 2] * g * 2;
+    out[i * 2 + 1] = in[i * 2 + 1] * g * 2;
+    gain->current += gain->step;
+    gain->remaining--;
+    i++;
+  }
+  if (gain->remaining == 0) {
+    gain->current = gain->target << GAIN_FRAC_BITS;
+  }
+
+  if (i < samples) {
+    widen_constant(in + i * 2, out + i * 2, (samples - i) * 2, gain->target);
+  }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Volume stage for interleaved stereo 16-bit PCM.
+ *
+ * Gain changes are ramped linearly over AUDIO_GAIN_RAMP_SAMPLES instead of
+ * stepping at block boundaries, so volume moves do not zipper. Once the
+ * ramp is done the block is scaled by a constant, with shortcuts for unity
+ * and mute.
+ *
+ * The product is kept at 31 bits. For 32-bit output it is passed through
+ * whole. For 16-bit output it is truncated, or with CONFIG_AUDIO_GAIN_DITHER
+ * requantised with TPDF dither, so quiet passages at low volume turn into a
+ * little hiss instead of truncation distortion.
+ */
+
+#define AUDIO_GAIN_UNITY        32768 // Q15
+#define AUDIO_GAIN_RAMP_SAMPLES 512   // ~11.6 ms at 44.1 kHz
+
+typedef struct {
+  int32_t current;    // Q15 << 8 so slow ramps keep their precision
+  int32_t step;       // Per-sample change while ramping
+  int32_t target;     // Q15
+  uint32_t remaining; // Samples left in the ramp
+  uint32_t seed;      // Dither noise generator state (AUDIO_GAIN_DITHER)
+  int32_t noise[2];   // Previous dither draw per channel
+} audio_gain_t;
+
+/** Start at the given gain without a ramp. */
+void audio_gain_init(audio_gain_t *gain, int32_t gain_q15);
+
+/**
+ * Scale one block in place, ramping towards target_q15 if it changed.
+ * @param samples Samples per channel
+ */
+void audio_gain_apply(audio_gain_t *gain, int16_t *pcm, size_t samples,
+                      int32_t target_q15);
+
+/**
+ * Scale one block into left-justified 32-bit samples, without dither.
+ * @param out Interleaved stereo output, samples * 2 entries
+ * @param samples Samples per channel
+ */
+void audio_gain_apply_wide(audio_gain_t *gain, const int16_t *in,
+                           int32_t *out, size_t samples, int32_t target_q15);
@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include "audio_jitter.h"
+
+#define FLOOR_LEAK_US      1       // Floor rise per packet (~125 us/s)
+#define DECAY_PACKETS      2048    // Halve the histogram every ~16 s
+#define RESYNC_GAP_US      1000000 // Media/arrival mismatch that restarts
+#define REORDER_DECAY_MASK 0x3FF   // Forget one reorder step per 1024 packets
+
+void audio_jitter_init(audio_jitter_t *jitter) {
+  if (!jitter) {
+    return;
+  }
+
+  memset(jitter, 0, sizeof(*jitter));
+}
+
+static void decay(audio_jitter_t *jitter) {
+  jitter->total = 0;
+  for (int i = 0; i < AUDIO_JITTER_BINS; i++) {
+    jitter->hist[i] >>= 1;
+    jitter->total += jitter->hist[i];
+  }
+  jitter->packets_since_decay = 0;
+}
+
+void audio_jitter_note_arrival(audio_jitter_t *jitter, uint32_t rtp_timestamp,
+                               int sample_rate, int64_t now_us) {
+  if (!jitter || sample_rate <= 0) {
+    return;
+  }
+
+  if (!jitter->primed) {
+    jitter->primed = true;
+    jitter->last_timestamp = rtp_timestamp;
+    jitter->media_time_us = 0;
+    jitter->floor_transit_us = now_us;
+    return;
+  }
+
+  int32_t delta = (int32_t)(rtp_timestamp - jitter->last_timestamp);
+  if (delta <= 0) {
+    return; // Duplicate or late packet, not an arrival-time sample
+  }
+  jitter->last_timestamp = rtp_timestamp;
+  jitter->media_time_us += ((int64_t)delta * 1000000LL) / sample_rate;
+
+  int64_t transit_us = now_us - jitter->media_time_us;
+  int64_t excess_us = transit_us - jitter->floor_transit_us;
+  if (excess_us < 0) {
+    if (excess_us < -RESYNC_GAP_US) {
+      jitter->primed = false; // Sender jumped ahead (seek, new session)
+      return;
+    }
+    jitter->floor_transit_us = transit_us;
+    excess_us = 0;
+  } else if (excess_us > RESYNC_GAP_US) {
+    jitter->primed = false;
+    return;
+  } else {
+    jitter->floor_transit_us += FLOOR_LEAK_US;
+  }
+
+  uint32_t bin = (uint32_t)(excess_us / AUDIO_JITTER_BIN_US);
+  if (bin >= AUDIO_JITTER_BINS) {
+    bin = AUDIO_JITTER_BINS - 1;
+  }
+  jitter->hist[bin]++;
+  jitter->total++;
+
+  if (++jitter->packets_since_decay >= DECAY_PACKETS) {
+    decay(jitter);
+  }
+  if ((jitter->packets_since_decay & REORDER_DECAY_MASK) == 0 &&
+      jitter->reorder_depth > 0) {
+    jitter->reorder_depth--;
+  }
+}
+
+void audio_jitter_note_reorder(audio_jitter_t *jitter, uint32_t depth) {
+  if (!jitter) {
+    return;
+  }
+
+  if (depth > jitter->reorder_depth) {
+    jitter->reorder_depth = depth;
+  }
+}
+
+uint32_t audio_jitter_percentile_us(const audio_jitter_t *jitter,
+                                    uint32_t permille) {
+  if (!jitter || jitter->total == 0) {
+    return 0;
+  }
+
+  uint64_t needed = ((uint64_t)jitter->total * permille + 999) / 1000;
+  uint64_t seen = 0;
+  for (int i = 0; i < AUDIO_JITTER_BINS; i++) {
+    seen += jitter->hist[i];
+    if (seen >= needed) {
+      return (uint32_t)(i + 1) * AUDIO_JITTER_BIN_US;
+    }
+  }
+  return AUDIO_JITTER_BINS * AUDIO_JITTER_BIN_US;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Network jitter tracker for realtime (UDP) streams.
+ *
+ * Each packet's transit time (arrival minus RTP media time) is compared to a
+ * slowly rising floor; the excess delay goes into a decaying histogram from
+ * which percentiles are read. The floor leaks upwards so crystal drift
+ * between sender and receiver does not show up as jitter.
+ */
+
+#define AUDIO_JITTER_BINS   64
+#define AUDIO_JITTER_BIN_US 2000 // 2 ms per bin, up to 128 ms
+
+typedef struct {
+  bool primed;
+  uint32_t last_timestamp;  // RTP timestamp of the previous packet
+  int64_t media_time_us;    // Unwrapped media time of the previous packet
+  int64_t floor_transit_us; // Lowest recent transit time
+  uint32_t hist[AUDIO_JITTER_BINS];
+  uint32_t total;
+  uint32_t packets_since_decay;
+  uint32_t reorder_depth; // Deepest recent reordering, in packets
+} audio_jitter_t;
+
+void audio_jitter_init(audio_jitter_t *jitter);
+
+/**
+ * Account one in-order packet.
+ * @param now_us Local arrival time
+ */
+void audio_jitter_note_arrival(audio_jitter_t *jitter, uint32_t rtp_timestamp,
+                               int sample_rate, int64_t now_us);
+
+/** Account a packet that arrived depth packets behind the newest one. */
+void audio_jitter_note_reorder(audio_jitter_t *jitter, uint32_t depth);
+
+/**
+ * Excess delay below which the given share of packets arrived.
+ * @param permille 500 for the median, 990 for p99
+ */
+uint32_t audio_jitter_percentile_us(const audio_jitter_t *jitter,
+                                    uint32_t permille);
@@ -0,0 +1,162 @@
+#include <string.h>
+
+#include "audio_nack.h"
+
+#define NACK_MAX_TRIES 2     // First request plus one retry
+#define RTT_INITIAL_US 20000 // Until the first retransmit is measured
+#define RTO_MARGIN_US  5000
+#define RTO_MIN_US     10000
+#define WINDOW_MASK    (AUDIO_NACK_WINDOW - 1)
+
+#define BIT_WORD(seq) (((seq) & WINDOW_MASK) / 32)
+#define BIT_MASK(seq) (1u << ((seq) & 31))
+
+static inline bool is_missing(const audio_nack_t *nack, uint16_t seq) {
+  return (nack->missing[BIT_WORD(seq)] & BIT_MASK(seq)) != 0;
+}
+
+static inline void set_missing(audio_nack_t *nack, uint16_t seq) {
+  nack->missing[BIT_WORD(seq)] |= BIT_MASK(seq);
+  nack->tries[seq & WINDOW_MASK] = 0;
+}
+
+static inline void clear_missing(audio_nack_t *nack, uint16_t seq) {
+  nack->missing[BIT_WORD(seq)] &= ~BIT_MASK(seq);
+}
+
+void audio_nack_init(audio_nack_t *nack) {
+  if (!nack) {
+    return;
+  }
+
+  memset(nack, 0, sizeof(*nack));
+  nack->rtt_us = RTT_INITIAL_US;
+
+  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  nack->lock = lock;
+}
+
+void audio_nack_reset(audio_nack_t *nack) {
+  if (!nack) {
+    return;
+  }
+
+  taskENTER_CRITICAL(&nack->lock);
+  nack->primed = false;
+  memset(nack->missing, 0, sizeof(nack->missing));
+  taskEXIT_CRITICAL(&nack->lock);
+}
+
+void audio_nack_note_packet(audio_nack_t *nack, uint16_t seq) {
+  if (!nack) {
+    return;
+  }
+
+  taskENTER_CRITICAL(&nack->lock);
+  int16_t ahead = (int16_t)(uint16_t)(seq - nack->newest);
+  if (!nack->primed || ahead > AUDIO_NACK_WINDOW ||
+      ahead <= -AUDIO_NACK_WINDOW) {
+    // First packet, or a jump (new session, seek): nothing to recover
+    memset(nack->missing, 0, sizeof(nack->missing));
+    nack->newest = seq;
+    nack->primed = true;
+  } else if (ahead > 0) {
+    // Positions between the old and new newest are reused by the holes,
+    // which also retires whatever they held a window ago
+    for (uint16_t s = (uint16_t)(nack->newest + 1); s != seq; s++) {
+      set_missing(nack, s);
+    }
+    clear_missing(nack, seq);
+    nack->newest = seq;
+  } else {
+    clear_missing(nack, seq); // Late or reordered arrival fills its hole
+  }
+  taskEXIT_CRITICAL(&nack->lock);
+}
+
+bool audio_nack_note_retransmit(audio_nack_t *nack, uint16_t seq,
+                                int64_t now_us) {
+  if (!nack) {
+    return false;
+  }
+
+  bool wanted = false;
+  taskENTER_CRITICAL(&nack->lock);
+  int16_t behind = (int16_t)(uint16_t)(nack->newest - seq);
+  if (nack->primed && behind > 0 && behind < AUDIO_NACK_WINDOW &&
+      is_missing(nack, seq)) {
+    clear_missing(nack, seq);
+    wanted = true;
+    // Only unambiguous samples: after a retry it is unknown which request
+    // the packet answers
+    if (nack->tries[seq & WINDOW_MASK] == 1) {
+      int32_t sample =
+          (int32_t)((uint32_t)now_us - nack->sent_us[seq & WINDOW_MASK]);
+      if (sample > 0) {
+        nack->rtt_us += (sample - (int32_t)nack->rtt_us) / 8;
+      }
+    }
+  }
+  taskEXIT_CRITICAL(&nack->lock);
+  return wanted;
+}
+
+int audio_nack_poll(audio_nack_t *nack, int64_t now_us,
+                    int64_t newest_early_us, uint32_t packet_us,
+                    audio_nack_range_t *ranges) {
+  if (!nack || !ranges) {
+    return 0;
+  }
+
+  int count = 0;
+  taskENTER_CRITICAL(&nack->lock);
+  if (!nack->primed) {
+    taskEXIT_CRITICAL(&nack->lock);
+    return 0;
+  }
+
+  uint32_t rtt_us = nack->rtt_us;
+  uint32_t rto_us = rtt_us + rtt_us / 2 + RTO_MARGIN_US;
+  if (rto_us < RTO_MIN_US) {
+    rto_us = RTO_MIN_US;
+  }
+  uint32_t now = (uint32_t)now_us;
+
+  // Oldest first, so ranges come out in sequence order
+  uint16_t seq = (uint16_t)(nack->newest - AUDIO_NACK_WINDOW + 1);
+  for (uint32_t behind = AUDIO_NACK_WINDOW - 1; behind > 0; behind--, seq++) {
+    if (!is_missing(nack, seq)) {
+      continue;
+    }
+
+    uint8_t *tries = &nack->tries[seq & WINDOW_MASK];
+    uint32_t *sent = &nack->sent_us[seq & WINDOW_MASK];
+    bool waited = *tries > 0 && now - *sent >= rto_us;
+    bool too_late = newest_early_us != INT64_MAX &&
+                    newest_early_us - (int64_t)behind * packet_us <
+                        (int64_t)rtt_us;
+    if (too_late || (*tries >= NACK_MAX_TRIES && waited)) {
+      clear_missing(nack, seq);
+      nack->expired++;
+      continue;
+    }
+    if (*tries > 0 && !waited) {
+      continue; // Request in flight
+    }
+
+    audio_nack_range_t *last = count > 0 ? &ranges[count - 1] : NULL;
+    if (last && (uint16_t)(last->first + last->count) == seq) {
+      last->count++;
+    } else if (count < AUDIO_NACK_MAX_RANGES) {
+      ranges[count].first = seq;
+      ranges[count].count = 1;
+      count++;
+    } else {
+      continue; // Left due for the next poll
+    }
+    (*tries)++;
+    *sent = now;
+  }
+  taskEXIT_CRITICAL(&nack->lock);
+  return count;
+}
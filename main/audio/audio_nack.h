@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+/**
+ * Retransmit request scheduler for realtime (UDP) streams.
+ *
+ * Sequence numbers missing behind the newest packet are kept in a bitmap.
+ * Each poll coalesces the holes that are due into ranges, so one NACK covers
+ * a burst loss. A hole is requested once, retried once if nothing arrived
+ * within the RTO (derived from measured request-to-retransmit times), and
+ * dropped once it could no longer arrive before its playout deadline.
+ *
+ * The receiver task notes live packets and polls; the control task notes
+ * retransmits. The state is guarded by a spinlock.
+ */
+
+#define AUDIO_NACK_WINDOW     128 // Sequence numbers tracked behind the newest
+#define AUDIO_NACK_MAX_RANGES 8   // Ranges returned by one poll
+
+typedef struct {
+  uint16_t first;
+  uint16_t count;
+} audio_nack_range_t;
+
+typedef struct {
+  bool primed;
+  uint16_t newest; // Newest sequence number seen
+  uint32_t missing[AUDIO_NACK_WINDOW / 32];
+  uint8_t tries[AUDIO_NACK_WINDOW];    // Requests sent per hole
+  uint32_t sent_us[AUDIO_NACK_WINDOW]; // Time of the last request
+  uint32_t rtt_us;                     // Smoothed request-to-retransmit time
+  uint32_t expired;                    // Holes given up on
+  portMUX_TYPE lock;
+} audio_nack_t;
+
+void audio_nack_init(audio_nack_t *nack);
+
+/** Forget all holes, e.g. on flush (the RTT estimate is kept). */
+void audio_nack_reset(audio_nack_t *nack);
+
+/**
+ * Account a live packet: holes between the previous newest and seq are
+ * added, a late arrival fills its hole. Jumps beyond the window restart
+ * tracking.
+ */
+void audio_nack_note_packet(audio_nack_t *nack, uint16_t seq);
+
+/**
+ * Account a retransmitted packet.
+ * @return true if it fills a hole, false for duplicates and packets that
+ *         are no longer wanted
+ */
+bool audio_nack_note_retransmit(audio_nack_t *nack, uint16_t seq,
+                                int64_t now_us);
+
+/**
+ * Collect the holes due for a (re)request and mark them as sent.
+ * @param newest_early_us How long until the newest packet plays, or
+ *                        INT64_MAX when there is no playout deadline yet
+ * @param packet_us Duration of one packet
+ * @return Number of ranges written
+ */
+int audio_nack_poll(audio_nack_t *nack, int64_t now_us,
+                    int64_t newest_early_us, uint32_t packet_us,
+                    audio_nack_range_t *ranges);
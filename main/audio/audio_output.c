@@ -1,14 +1,37 @@
 #include "audio_output.h"
 
+#include "audio_bench.h"
+#if CONFIG_AUDIO_EQ
+#include "audio_eq.h"
+#endif
+#include "audio_fade.h"
+#include "audio_gain.h"
 #include "audio_receiver.h"
+#include "audio_resampler.h"
+#include "audio_trace.h"
+#include "audio_volume.h"
 #include "led.h"
+#include "mem_budget.h"
+#include "power_mgmt.h"
+#include "rt_log.h"
+#include "task_placement.h"
 #include "driver/i2s_std.h"
 #include "driver/gpio.h"
+#include "esp_attr.h"
 #include "esp_check.h"
+#include "esp_timer.h"
+#if CONFIG_AUDIO_DRIFT_APLL
+#include "clk_ctrl_os.h"
+#include "hal/clk_tree_ll.h"
+#endif
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "rtsp_server.h"
+#if CONFIG_AUDIO_IDLE_POWERDOWN && CONFIG_SQUEEZEAMP
+#include "dac_tas57xx.h"
+#endif
 
+#include <inttypes.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 
 #ifndef CONFIG_SQUEEZEAMP
@@ -21,70 +44,439 @@
 #define I2S_BCK_PIN   CONFIG_I2S_BCK_IO
 #define I2S_LRCK_PIN  CONFIG_I2S_WS_IO
 #define I2S_DOUT_PIN  CONFIG_I2S_DO_IO
-#define SAMPLE_RATE   44100
-#define FRAME_SAMPLES 352
+#define DEFAULT_SAMPLE_RATE 44100
+#define MIN_SAMPLE_RATE     8000
+#define MAX_SAMPLE_RATE     96000
+#define FRAME_SAMPLES       352
 
-#if CONFIG_FREERTOS_UNICORE
-#define PLAYBACK_CORE 0
+#if CONFIG_AUDIO_OUTPUT_32BIT
+#define OUTPUT_SLOT_WIDTH  I2S_DATA_BIT_WIDTH_32BIT
+#define OUTPUT_FRAME_BYTES 8
 #else
-#define PLAYBACK_CORE 1
+#define OUTPUT_SLOT_WIDTH  I2S_DATA_BIT_WIDTH_16BIT
+#define OUTPUT_FRAME_BYTES 4
 #endif
 
+// DMA ring: 8 x 256 frames (~46 ms at 44.1 kHz) by default. audio_timing
+// follows the measured queue, so the ring can be made shorter. Mid-stream
+// the task waits for late frames until only LOW_WATER_BYTES are left
+// queued, then plays silence.
+#define DMA_DESC_NUM    CONFIG_AUDIO_OUTPUT_DMA_BUFFERS
+#define DMA_FRAME_NUM   AUDIO_OUTPUT_DMA_BUF_FRAMES
+#define DMA_BUF_BYTES   (DMA_FRAME_NUM * OUTPUT_FRAME_BYTES)
+#define LOW_WATER_BYTES (2 * DMA_BUF_BYTES)
+#define OUTPUT_WAIT_MS  20
+#define IDLE_POLL_MS    20   // Paused with audio buffered: recheck this often
+#define IDLE_SLEEP_MS   1000 // Nothing buffered: producers wake us earlier
+#define PREFILL_WRITES  5  // Silence chunks queued on power-up (~40 ms)
+
 static i2s_chan_handle_t tx_handle;
 static volatile bool flush_requested = false;
+static TaskHandle_t playback_handle;
+static atomic_int queued_bytes; // Written to I2S, not yet sent by DMA
+static atomic_uint dma_underruns;
+static uint32_t output_gaps;
+static uint32_t output_rate = DEFAULT_SAMPLE_RATE;
+static int rejected_rate; // Rate the driver refused, not retried
+static bool powered_down;  // I2S channel stopped while idle
+static audio_gain_t gain;
+static audio_fade_t fade;
+#if CONFIG_AUDIO_DRIFT_RESAMPLE
+static audio_resampler_t resampler;
+#elif CONFIG_AUDIO_DRIFT_APLL
+#define MCLK_MULTIPLE 256
+static uint32_t apll_nominal_hz;
+static int32_t apll_ppm;
+#endif
+
+#if CONFIG_AUDIO_DRIFT_RESAMPLE
+// Stretch/squeeze by the drift loop's ppm. Returns the buffer to play: the
+// input itself while no correction has been applied yet (keeps zero-copy),
+// otherwise the resampled copy.
+static int16_t *resample_drift(int16_t *pcm, size_t *samples, int16_t *out) {
+  audio_resampler_set_ppm(&resampler, audio_receiver_get_drift_ppm());
+  if (resampler.ppm == 0 && resampler.phase == (1ULL << 32)) {
+    resampler.last[0] = pcm[(*samples - 1) * 2];
+    resampler.last[1] = pcm[(*samples - 1) * 2 + 1];
+    return pcm;
+  }
+  *samples = audio_resampler_process(
+      &resampler, pcm, *samples, out, audio_resampler_max_output(*samples));
+  return out;
+}
+#endif
 
-static void apply_volume(int16_t *buf, size_t n) {
-  int32_t vol = airplay_get_volume_q15();
-  for (size_t i = 0; i < n; i++) {
-    buf[i] = (int16_t)(((int32_t)buf[i] * vol) >> 15);
+#if CONFIG_AUDIO_DRIFT_APLL
+// The I2S driver runs the APLL at the smallest MCLK multiple above its
+// minimum; retune it directly with the same divider. Hz resolution at
+// ~11 MHz is well below 1 ppm.
+static void apll_init(uint32_t sample_rate) {
+  uint32_t mclk_hz = sample_rate * MCLK_MULTIPLE;
+  apll_nominal_hz = (CLK_LL_APLL_MIN_HZ / mclk_hz + 1) * mclk_hz;
+  apll_ppm = 0;
+}
+
+static void apll_track_drift(void) {
+  int32_t ppm = audio_receiver_get_drift_ppm();
+  if (ppm == apll_ppm || apll_nominal_hz == 0) {
+    return;
   }
+
+  // Positive ppm asks for slower playout
+  uint32_t expt_hz = (uint32_t)((int64_t)apll_nominal_hz -
+                                (int64_t)apll_nominal_hz * ppm / 1000000);
+  uint32_t real_hz = 0;
+  if (periph_rtc_apll_freq_set(expt_hz, &real_hz) == ESP_OK) {
+    apll_ppm = ppm;
+  } else {
+    RT_LOGW(TAG, "APLL retune to %" PRIu32 " Hz failed", expt_hz);
+    apll_nominal_hz = 0; // Shared with another peripheral, stop trying
+  }
+}
+#endif
+
+static i2s_std_clk_config_t clock_config(uint32_t sample_rate) {
+  i2s_std_clk_config_t clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(sample_rate);
+#if CONFIG_AUDIO_DRIFT_APLL
+  clk_cfg.clk_src = I2S_CLK_SRC_APLL;
+  clk_cfg.mclk_multiple = MCLK_MULTIPLE;
+#endif
+  return clk_cfg;
+}
+
+// Switch the I2S clock to the stream's rate. Called from the playback task
+// between writes, so the ring only holds silence or the tail of the old
+// stream; DMA restarts from cleared buffers.
+static void follow_sample_rate(void) {
+  int rate = audio_receiver_get_sample_rate();
+  if (rate == (int)output_rate || rate == rejected_rate ||
+      rate < MIN_SAMPLE_RATE || rate > MAX_SAMPLE_RATE) {
+    return;
+  }
+
+  i2s_std_clk_config_t clk_cfg = clock_config((uint32_t)rate);
+  if (!powered_down) {
+    i2s_channel_disable(tx_handle);
+  }
+  esp_err_t err = i2s_channel_reconfig_std_clock(tx_handle, &clk_cfg);
+  if (!powered_down) {
+    i2s_channel_enable(tx_handle);
+  }
+  atomic_store(&queued_bytes, 0);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "I2S clock change to %d Hz failed: %s", rate,
+             esp_err_to_name(err));
+    rejected_rate = rate; // The driver keeps the old clock
+    return;
+  }
+  ESP_LOGI(TAG, "Output clock %" PRIu32 " -> %d Hz", output_rate, rate);
+  output_rate = (uint32_t)rate;
+#if CONFIG_AUDIO_DRIFT_RESAMPLE
+  audio_resampler_reset(&resampler);
+#elif CONFIG_AUDIO_DRIFT_APLL
+  apll_init(output_rate);
+#endif
+}
+
+// DMA finished a buffer: account it and wake the playback task
+static bool IRAM_ATTR on_sent(i2s_chan_handle_t handle, i2s_event_data_t *event,
+                              void *ctx) {
+  int left = atomic_fetch_sub(&queued_bytes, (int)event->size) -
+             (int)event->size;
+  if (left < 0) {
+    atomic_store(&queued_bytes, 0);
+  }
+
+  BaseType_t woken = pdFALSE;
+  if (playback_handle) {
+    vTaskNotifyGiveFromISR(playback_handle, &woken);
+  }
+  return woken == pdTRUE;
+}
+
+// DMA reused a buffer nobody refilled: the DAC got stale (cleared) data
+static bool IRAM_ATTR on_send_q_ovf(i2s_chan_handle_t handle,
+                                    i2s_event_data_t *event, void *ctx) {
+  atomic_fetch_add(&dma_underruns, 1);
+  return false;
+}
+
+// How long until a sample written now is heard. on_sent only accounts a
+// buffer once DMA is done with it, so the one playing counts as half gone.
+// A powered-down output has nothing queued yet, but power_up() restarts the
+// ring with its prefill ahead of the frame that wakes it.
+static uint32_t queued_delay_us(void) {
+  int bytes = atomic_load(&queued_bytes) - DMA_BUF_BYTES / 2;
+  if (powered_down) {
+    bytes = PREFILL_WRITES * FRAME_SAMPLES * OUTPUT_FRAME_BYTES;
+  }
+  if (bytes <= 0) {
+    return 0;
+  }
+  return (uint32_t)((uint64_t)(bytes / OUTPUT_FRAME_BYTES) * 1000000 /
+                    output_rate);
+}
+
+static void write_pcm(const void *pcm, size_t bytes, TickType_t ticks) {
+  size_t written = 0;
+  i2s_channel_write(tx_handle, pcm, bytes, &written, ticks);
+  atomic_fetch_add(&queued_bytes, (int)written);
+}
+
+// Scale a fade tail like the audio before it and queue it
+static void write_tail(int16_t *tail, size_t samples, int32_t *wide) {
+#if CONFIG_AUDIO_OUTPUT_32BIT
+  audio_gain_apply_wide(&gain, tail, wide, samples,
+                        audio_volume_software_q15());
+  write_pcm(wide, samples * OUTPUT_FRAME_BYTES, portMAX_DELAY);
+#else
+  (void)wide;
+  audio_gain_apply(&gain, tail, samples, audio_volume_software_q15());
+  write_pcm(tail, samples * OUTPUT_FRAME_BYTES, portMAX_DELAY);
+#endif
 }
 
+#if CONFIG_AUDIO_IDLE_POWERDOWN
+static void power_down(void) {
+  i2s_channel_disable(tx_handle);
+  atomic_store(&queued_bytes, 0);
+#if CONFIG_SQUEEZEAMP
+  tas57xx_set_power_mode(TAS57XX_AMP_STANDBY);
+#endif
+  powered_down = true;
+  RT_LOGI(TAG, "Output idle, powered down");
+}
+
+// Restart the channel and queue silence first, so the frame that woke us
+// sees the same DMA latency as a running output
+static void power_up(const void *silence) {
+#if CONFIG_SQUEEZEAMP
+  tas57xx_set_power_mode(TAS57XX_AMP_ON);
+#endif
+  i2s_channel_enable(tx_handle);
+  powered_down = false;
+  for (int i = 0; i < PREFILL_WRITES; i++) {
+    write_pcm(silence, (size_t)FRAME_SAMPLES * OUTPUT_FRAME_BYTES, 0);
+  }
+  RT_LOGI(TAG, "Output powered up");
+}
+#endif
+
 static void playback_task(void *arg) {
-  int16_t *pcm = malloc((size_t)(FRAME_SAMPLES + 1) * 2 * sizeof(int16_t));
-  int16_t *silence = calloc((size_t)FRAME_SAMPLES * 2, sizeof(int16_t));
-  if (!pcm || !silence) {
+  // Sized for output slots, so it doubles as a 16-bit silent input frame
+  int16_t *silence = calloc((size_t)FRAME_SAMPLES + 1, OUTPUT_FRAME_BYTES);
+  int16_t *tail = malloc(((size_t)FRAME_SAMPLES + 1) * 2 * sizeof(int16_t));
+  bool allocated = silence && tail;
+#if CONFIG_AUDIO_DRIFT_RESAMPLE
+  size_t max_samples = audio_resampler_max_output(FRAME_SAMPLES + 1);
+  int16_t *resampled = malloc(max_samples * 2 * sizeof(int16_t));
+  allocated = allocated && resampled;
+  audio_resampler_init(&resampler);
+#else
+  size_t max_samples = FRAME_SAMPLES + 1;
+  int16_t *resampled = NULL;
+#endif
+#if CONFIG_AUDIO_OUTPUT_32BIT
+  int32_t *wide = malloc(max_samples * 2 * sizeof(int32_t));
+  allocated = allocated && wide;
+#else
+  int32_t *wide = NULL;
+  (void)max_samples;
+#endif
+  if (!allocated) {
     ESP_LOGE(TAG, "Failed to allocate buffers");
-    free(pcm);
     free(silence);
-    vTaskDelete(NULL);
+    free(tail);
+    free(resampled);
+    free(wide);
+    task_placement_exit(TASK_AUDIO_PLAY);
     return;
   }
 
-  size_t written;
+  audio_gain_init(&gain, audio_volume_software_q15());
+  audio_fade_init(&fade);
+
+  playback_handle = xTaskGetCurrentTaskHandle();
+  // Allocation-free from here on; the task never ends
+  mem_hot_path_enter();
+
+  // True while frames are being played; a gap is then bridged by waiting
+  // for the next frame, not by queueing silence in front of it
+  bool streaming = false;
+#if CONFIG_AUDIO_IDLE_POWERDOWN
+  int64_t idle_since_us = 0;
+#endif
   while (true) {
+    if (!streaming) {
+      follow_sample_rate();
+    }
     if (flush_requested) {
       flush_requested = false;
-      i2s_channel_disable(tx_handle);
-      i2s_channel_enable(tx_handle);
+      // Finish what is queued with a fade instead of cutting the ring off
+      // mid-waveform; the ring only holds the output latency anyway
+      size_t n = streaming ? audio_fade_out(&fade, tail, AUDIO_FADE_SAMPLES)
+                           : 0;
+      if (n > 0) {
+        write_tail(tail, n, wide);
+      } else {
+        if (!powered_down) {
+          i2s_channel_disable(tx_handle);
+          i2s_channel_enable(tx_handle);
+        }
+        atomic_store(&queued_bytes, 0);
+      }
+      streaming = false;
+#if CONFIG_AUDIO_DRIFT_RESAMPLE
+      audio_resampler_reset(&resampler);
+#endif
+#if CONFIG_AUDIO_EQ
+      audio_eq_reset();
+#endif
+    }
+    // PCM comes straight from the jitter buffer slot, which is only handed
+    // back once I2S has copied it into DMA memory
+    int16_t *pcm = NULL;
+    uint32_t work = power_mgmt_busy_start();
+    uint32_t bench = audio_bench_start();
+    audio_receiver_set_output_delay_us(queued_delay_us());
+    size_t samples = audio_receiver_borrow(&pcm, FRAME_SAMPLES + 1);
+    if (samples > 0) {
+      audio_bench_stop(AUDIO_BENCH_BORROW, bench);
     }
-    size_t samples = audio_receiver_read(pcm, FRAME_SAMPLES + 1);
     if (samples > 0) {
-      apply_volume(pcm, samples * 2);
+#if CONFIG_AUDIO_IDLE_POWERDOWN
+      if (powered_down) {
+        power_up(silence);
+      }
+      idle_since_us = 0;
+#endif
+      bool is_silence = !pcm;
+      bool held = is_silence;
+      if (held) {
+        // Early frame held back: play silence in its place, after fading
+        // out whatever played before it
+        pcm = silence;
+        if (audio_fade_out(&fade, tail, samples) > 0) {
+          pcm = tail;
+          is_silence = false;
+        }
+      }
+#if CONFIG_AUDIO_DRIFT_RESAMPLE
+      int16_t *out = resample_drift(pcm, &samples, resampled);
+      if (out != pcm) {
+        audio_receiver_release(); // Copied out, the slot can go back now
+        pcm = out;
+        is_silence = false; // The copy is ours to scale
+      }
+#elif CONFIG_AUDIO_DRIFT_APLL
+      apll_track_drift();
+#endif
+#if CONFIG_AUDIO_EQ
+      if (!is_silence) {
+        audio_eq_process(pcm, samples, output_rate);
+      }
+#endif
+      if (!held) {
+        audio_fade_process(&fade, pcm, samples);
+      }
+#if CONFIG_AUDIO_OUTPUT_32BIT
+      // Widening copies the frame out, so the slot goes back before the
+      // (blocking) write. The VU meter sees the level before volume.
+      led_audio_feed(pcm, samples);
+      bench = audio_bench_start();
+      audio_gain_apply_wide(&gain, pcm, wide, samples,
+                            audio_volume_software_q15());
+      audio_bench_stop(AUDIO_BENCH_GAIN, bench);
+      audio_receiver_release();
+      power_mgmt_busy_stop(work);
+      write_pcm(wide, samples * OUTPUT_FRAME_BYTES, portMAX_DELAY);
+#else
+      if (!is_silence) {
+        bench = audio_bench_start();
+        audio_gain_apply(&gain, pcm, samples, audio_volume_software_q15());
+        audio_bench_stop(AUDIO_BENCH_GAIN, bench);
+      }
       led_audio_feed(pcm, samples);
-      i2s_channel_write(tx_handle, pcm, samples * 4, &written, portMAX_DELAY);
-      taskYIELD();
-    } else {
-      led_audio_feed(silence, FRAME_SAMPLES);
-      i2s_channel_write(tx_handle, silence, (size_t)FRAME_SAMPLES * 4, &written,
-                        pdMS_TO_TICKS(10));
-      vTaskDelay(1);
+      power_mgmt_busy_stop(work);
+      write_pcm(pcm, samples * OUTPUT_FRAME_BYTES, portMAX_DELAY);
+      audio_receiver_release();
+#endif
+      audio_trace_written();
+      streaming = true;
+      continue;
+    }
+
+    if (streaming && atomic_load(&queued_bytes) >= LOW_WATER_BYTES) {
+      // Woken by the receiver as soon as a frame is queued, or by on_sent
+      // when DMA has played out another buffer
+      audio_receiver_wait_data(pdMS_TO_TICKS(OUTPUT_WAIT_MS));
+      continue;
+    }
+
+    if (streaming) {
+      if (!audio_receiver_wait_data(0)) {
+        // Caught before the DAC ran dry; counted, then bridged with silence
+        output_gaps++;
+      }
+      // Underrun or pause: fade out the last audio before the silence
+      size_t n = audio_fade_out(&fade, tail, AUDIO_FADE_SAMPLES);
+      if (n > 0) {
+        write_tail(tail, n, wide);
+      }
+    }
+    streaming = false;
+
+#if CONFIG_AUDIO_IDLE_POWERDOWN
+    if (powered_down) {
+      // Sleep until the receiver queues audio. Audio that is buffered but
+      // not playable (paused, pre-roll) is rechecked every IDLE_POLL_MS.
+      if (audio_receiver_has_data()) {
+        vTaskDelay(pdMS_TO_TICKS(IDLE_POLL_MS));
+      } else {
+        audio_receiver_wait_data(pdMS_TO_TICKS(IDLE_SLEEP_MS));
+      }
+      continue;
+    }
+    int64_t now_us = esp_timer_get_time();
+    if (idle_since_us == 0) {
+      idle_since_us = now_us;
+    } else if (now_us - idle_since_us >=
+               (int64_t)CONFIG_AUDIO_IDLE_TIMEOUT_S * 1000000) {
+      power_down();
+      continue;
     }
+#endif
+
+    // Idle, paused or pre-rolling: keep the DMA ring full of silence so the
+    // first frame sees the full output latency. The write blocks until DMA
+    // frees a buffer, which paces the loop.
+    led_audio_feed(silence, FRAME_SAMPLES);
+    write_pcm(silence, (size_t)FRAME_SAMPLES * OUTPUT_FRAME_BYTES,
+              pdMS_TO_TICKS(OUTPUT_WAIT_MS));
   }
 }
 
 esp_err_t audio_output_init(void) {
   i2s_chan_config_t chan_cfg =
       I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_0, I2S_ROLE_MASTER);
-  chan_cfg.dma_desc_num = 8;
-  chan_cfg.dma_frame_num = 256;
+  chan_cfg.dma_desc_num = DMA_DESC_NUM;
+  chan_cfg.dma_frame_num = DMA_FRAME_NUM;
+  chan_cfg.auto_clear_after_cb = true; // An underrun plays zeros, not echoes
 
   ESP_RETURN_ON_ERROR(i2s_new_channel(&chan_cfg, &tx_handle, NULL), TAG,
                       "channel create failed");
 
+  i2s_event_callbacks_t callbacks = {
+      .on_sent = on_sent,
+      .on_send_q_ovf = on_send_q_ovf,
+  };
+  ESP_RETURN_ON_ERROR(
+      i2s_channel_register_event_callback(tx_handle, &callbacks, NULL), TAG,
+      "callback register failed");
+
   i2s_std_config_t std_cfg = {
-      .clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(SAMPLE_RATE),
-      .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT,
+      .clk_cfg = clock_config(output_rate),
+      .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(OUTPUT_SLOT_WIDTH,
                                                       I2S_SLOT_MODE_STEREO),
       .gpio_cfg =
           {
@@ -110,15 +502,29 @@ esp_err_t audio_output_init(void) {
                       "std mode init failed");
   ESP_RETURN_ON_ERROR(i2s_channel_enable(tx_handle), TAG,
                       "channel enable failed");
+#if CONFIG_AUDIO_DRIFT_APLL
+  apll_init(output_rate);
+#endif
+#if CONFIG_AUDIO_EQ
+  ESP_RETURN_ON_ERROR(audio_eq_init(), TAG, "EQ init failed");
+#endif
 
   return ESP_OK;
 }
 
 void audio_output_start(void) {
-  xTaskCreatePinnedToCore(playback_task, "audio_play", 4096, NULL, 7, NULL,
-                          PLAYBACK_CORE);
+  task_placement_spawn(TASK_AUDIO_PLAY, playback_task, NULL, NULL);
 }
 
 void audio_output_flush(void) {
   flush_requested = true;
 }
+
+void audio_output_get_stats(audio_output_stats_t *stats) {
+  if (!stats) {
+    return;
+  }
+
+  stats->gaps = output_gaps;
+  stats->dma_underruns = atomic_load(&dma_underruns);
+}
@@ -1,6 +1,20 @@
 #pragma once
 
+#include <stdint.h>
+
 #include "esp_err.h"
+#include "sdkconfig.h"
+
+// I2S DMA ring: CONFIG_AUDIO_OUTPUT_DMA_BUFFERS buffers of 256 frames each.
+// audio_timing falls back to the full ring until a queue depth is reported.
+#define AUDIO_OUTPUT_DMA_BUF_FRAMES 256
+#define AUDIO_OUTPUT_DMA_FRAMES \
+  (CONFIG_AUDIO_OUTPUT_DMA_BUFFERS * AUDIO_OUTPUT_DMA_BUF_FRAMES)
+
+typedef struct {
+  uint32_t gaps;          // Stream ran out of frames, bridged with silence
+  uint32_t dma_underruns; // DMA replayed a buffer that was not refilled
+} audio_output_stats_t;
 
 /**
  * Initialize I2S audio output
@@ -16,3 +30,8 @@ void audio_output_start(void);
  * Flush I2S DMA buffers (clears stale audio on pause/seek)
  */
 void audio_output_flush(void);
+
+/**
+ * Output underrun counters.
+ */
+void audio_output_get_stats(audio_output_stats_t *stats);
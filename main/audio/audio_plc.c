@@ -0,0 +1,120 @@
+#include "audio_plc.h"
+
+#include <string.h>
+
+#define MATCH_SAMPLES 64 // Tail compared against earlier stretches
+#define MIN_LAG       32 // ~1.4 kHz at 44.1 kHz; shorter periods repeat twice
+#define GAIN_UNITY    32768
+
+void audio_plc_reset(audio_plc_t *plc) {
+  if (!plc) {
+    return;
+  }
+  plc->history_len = 0;
+  plc->lag = 0;
+  plc->position = 0;
+  plc->resume_q15 = GAIN_UNITY;
+}
+
+static inline int32_t mono(const int16_t *pcm, uint32_t i) {
+  return ((int32_t)pcm[2 * i] + pcm[2 * i + 1]) >> 1;
+}
+
+// Period whose repetition best continues the history: the lag at which the
+// stretch before the tail looks most like the tail itself
+static uint32_t find_lag(const audio_plc_t *plc) {
+  uint32_t len = plc->history_len;
+  if (len < MATCH_SAMPLES + MIN_LAG) {
+    return len;
+  }
+
+  const int16_t *h = plc->history;
+  uint32_t tail = len - MATCH_SAMPLES;
+  uint32_t best_lag = len - MATCH_SAMPLES;
+  float best_score = 0.0f;
+  for (uint32_t lag = MIN_LAG; lag <= len - MATCH_SAMPLES; lag++) {
+    int64_t corr = 0;
+    int64_t energy = 0;
+    for (uint32_t i = 0; i < MATCH_SAMPLES; i++) {
+      int32_t a = mono(h, tail + i);
+      int32_t b = mono(h, tail - lag + i);
+      corr += (int64_t)a * b;
+      energy += (int64_t)b * b;
+    }
+    if (corr <= 0 || energy == 0) {
+      continue;
+    }
+    float score = (float)corr * (float)corr / (float)energy;
+    if (score > best_score) {
+      best_score = score;
+      best_lag = lag;
+    }
+  }
+  return best_lag;
+}
+
+void audio_plc_feed(audio_plc_t *plc, int16_t *pcm, size_t samples) {
+  if (!plc || !pcm || samples == 0) {
+    return;
+  }
+
+  if (plc->lag > 0) {
+    // First real frame after a gap: ramp up from the concealment's level
+    int32_t from = plc->resume_q15;
+    size_t ramp = samples < AUDIO_PLC_RAMP_SAMPLES ? samples
+                                                   : AUDIO_PLC_RAMP_SAMPLES;
+    for (size_t i = 0; i < ramp; i++) {
+      int32_t g = from + (GAIN_UNITY - from) * (int32_t)i /
+                             AUDIO_PLC_RAMP_SAMPLES;
+      pcm[2 * i] = (int16_t)(((int32_t)pcm[2 * i] * g) >> 15);
+      pcm[2 * i + 1] = (int16_t)(((int32_t)pcm[2 * i + 1] * g) >> 15);
+    }
+    plc->lag = 0;
+    plc->position = 0;
+    plc->resume_q15 = GAIN_UNITY;
+  }
+
+  if (samples > AAC_FRAMES_PER_PACKET) {
+    pcm += (samples - AAC_FRAMES_PER_PACKET) * AUDIO_MAX_CHANNELS;
+    samples = AAC_FRAMES_PER_PACKET;
+  }
+  memcpy(plc->history, pcm, samples * AUDIO_MAX_CHANNELS * sizeof(int16_t));
+  plc->history_len = (uint32_t)samples;
+}
+
+size_t audio_plc_conceal(audio_plc_t *plc, int16_t **pcm_out,
+                         size_t samples) {
+  *pcm_out = NULL;
+  if (samples > AAC_FRAMES_PER_PACKET) {
+    samples = AAC_FRAMES_PER_PACKET;
+  }
+  if (!plc || plc->history_len == 0) {
+    return samples; // Nothing to repeat yet
+  }
+
+  if (plc->lag == 0) {
+    plc->lag = find_lag(plc);
+    plc->position = 0;
+  }
+  if (plc->position >= AUDIO_PLC_FADE_SAMPLES) {
+    plc->resume_q15 = 0;
+    return samples;
+  }
+
+  const int16_t *period =
+      plc->history + (plc->history_len - plc->lag) * AUDIO_MAX_CHANNELS;
+  for (size_t i = 0; i < samples; i++) {
+    uint32_t pos = plc->position + (uint32_t)i;
+    int32_t g = pos < AUDIO_PLC_FADE_SAMPLES
+                    ? GAIN_UNITY - (int32_t)((int64_t)GAIN_UNITY * pos /
+                                             AUDIO_PLC_FADE_SAMPLES)
+                    : 0;
+    const int16_t *src = period + (pos % plc->lag) * AUDIO_MAX_CHANNELS;
+    plc->out[2 * i] = (int16_t)(((int32_t)src[0] * g) >> 15);
+    plc->out[2 * i + 1] = (int16_t)(((int32_t)src[1] * g) >> 15);
+    plc->resume_q15 = g;
+  }
+  plc->position += (uint32_t)samples;
+  *pcm_out = plc->out;
+  return samples;
+}
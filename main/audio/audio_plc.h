@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "audio_buffer.h"
+
+/**
+ * Packet-loss concealment for interleaved stereo 16-bit PCM.
+ *
+ * The last frame played is kept. When a gap has to be filled, the period
+ * that best continues its tail is found by normalised cross-correlation,
+ * and the last period is repeated, fading out over AUDIO_PLC_FADE_SAMPLES.
+ * The first real samples after the gap fade back in from where the
+ * concealment left off, so neither end of the gap clicks.
+ */
+
+#define AUDIO_PLC_FADE_SAMPLES 704 // Two 352-sample frames to silence
+#define AUDIO_PLC_RAMP_SAMPLES 64  // Fade back in after the gap
+
+typedef struct {
+  int16_t history[AAC_FRAMES_PER_PACKET * AUDIO_MAX_CHANNELS];
+  uint32_t history_len; // Samples per channel, 0 before the first frame
+  uint32_t lag;         // Repeated period, 0 until a gap starts
+  uint32_t position;    // Samples concealed in the current gap
+  int32_t resume_q15;   // Gain the next real frame fades in from
+  int16_t out[AAC_FRAMES_PER_PACKET * AUDIO_MAX_CHANNELS];
+} audio_plc_t;
+
+/** Forget the history, e.g. after a flush. */
+void audio_plc_reset(audio_plc_t *plc);
+
+/**
+ * Keep a frame that is about to be played as the concealment source, and
+ * fade it in if it ends a concealed gap.
+ * @param pcm Frame PCM, changed in place by the fade-in
+ * @param samples Samples per channel
+ */
+void audio_plc_feed(audio_plc_t *plc, int16_t *pcm, size_t samples);
+
+/**
+ * Produce the next concealment samples of the current gap.
+ * @param pcm_out Output: concealment PCM, or NULL once it has faded out and
+ *                the samples should be played as silence
+ * @param samples Samples per channel wanted
+ * @return Samples produced, at most AAC_FRAMES_PER_PACKET
+ */
+size_t audio_plc_conceal(audio_plc_t *plc, int16_t **pcm_out, size_t samples);
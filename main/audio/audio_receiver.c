@@ -3,27 +3,59 @@
 
 #include "audio_receiver.h"
 
+#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
 
 #include "audio_buffer.h"
+#include "audio_crypto.h"
 #include "audio_decoder.h"
 #include "audio_receiver_internal.h"
 #include "audio_stream.h"
 #include "audio_timing.h"
+#include "mem_budget.h"
 #include "ptp_clock.h"
 
 #define DEFAULT_SAMPLE_RATE     44100
 #define DEFAULT_CHANNELS        2
 #define DEFAULT_BITS_PER_SAMPLE 16
 #define DEFAULT_FRAME_SIZE      352
-#define DECRYPT_BUFFER_SIZE     8192
+#define ARENA_AVG_PACKET_BYTES  256 // Sizes the arena index
 
 static const char *TAG = "audio_recv";
 
 static audio_receiver_state_t receiver = {0};
 
+// Kept across a TEARDOWN for CONFIG_AUDIO_WARM_GRACE_S so the next SETUP in
+// the same format skips decoder setup; warm_lock guards the hand-over
+static SemaphoreHandle_t warm_lock = NULL;
+static esp_timer_handle_t warm_timer = NULL;
+
+static void warm_release(void *arg) {
+  (void)arg;
+  xSemaphoreTake(warm_lock, portMAX_DELAY);
+  bool idle = !receiver.realtime_stream->running &&
+              !receiver.buffered_stream->running;
+#if CONFIG_MEM_STATIC_POOLS
+  // Static pools keep the pipeline for good; a new format replaces it
+  idle = false;
+#endif
+  if (idle && (receiver.decoder || receiver.buffered_recv_buffer)) {
+    ESP_LOGI(TAG, "Releasing the idle audio pipeline");
+    audio_decoder_destroy(receiver.decoder);
+    receiver.decoder = NULL;
+    mem_keep_put(&receiver.buffered_recv_keep, MEM_TAG_AUDIO,
+                 receiver.buffered_recv_buffer,
+                 mem_budget_profile()->buffered_recv_bytes);
+    receiver.buffered_recv_buffer = NULL;
+  }
+  xSemaphoreGive(warm_lock);
+}
+
 static void audio_receiver_reset_stats(void) {
   memset(&receiver.stats, 0, sizeof(receiver.stats));
+  receiver.decode_packets_dropped = 0;
 }
 
 static void audio_receiver_reset_blocks(void) {
@@ -38,7 +70,9 @@ static void audio_receiver_copy_stream_state(audio_stream_t *dst,
   }
 
   dst->format = src->format;
+  audio_crypto_release(&dst->encrypt);
   dst->encrypt = src->encrypt;
+  audio_crypto_prepare(&dst->encrypt);
 }
 
 esp_err_t audio_receiver_init(void) {
@@ -84,27 +118,57 @@ esp_err_t audio_receiver_init(void) {
     return err;
   }
 
-  receiver.decrypt_buffer_size = DECRYPT_BUFFER_SIZE;
-  receiver.decrypt_buffer = malloc(receiver.decrypt_buffer_size);
-  if (!receiver.decrypt_buffer) {
-    ESP_LOGE(TAG, "Failed to allocate decrypt buffer");
-    audio_buffer_deinit(&receiver.buffer);
-    audio_stream_destroy(receiver.realtime_stream);
-    audio_stream_destroy(receiver.buffered_stream);
-    receiver.realtime_stream = NULL;
-    receiver.buffered_stream = NULL;
-    return ESP_ERR_NO_MEM;
-  }
-
-  size_t pending_capacity =
-      sizeof(audio_frame_header_t) +
-      ((size_t)MAX_SAMPLES_PER_FRAME * AUDIO_MAX_CHANNELS * sizeof(int16_t));
-  audio_timing_init(&receiver.timing, pending_capacity);
+#if CONFIG_AUDIO_COMPRESSED_BUFFER
+  // Optional: without the arena, buffered streams fall back to PCM buffering
+  size_t arena_size = mem_budget_profile()->arena_bytes;
+  if (arena_size > 0) {
+    receiver.arena_packet =
+        mem_alloc(MEM_TAG_AUDIO, BUFFERED_AUDIO_PACKET_SIZE, MALLOC_CAP_8BIT);
+  }
+  if (!receiver.arena_packet ||
+      audio_arena_init(&receiver.arena, arena_size,
+                       (int)(arena_size / ARENA_AVG_PACKET_BYTES)) != ESP_OK) {
+    ESP_LOGW(TAG, "Compressed buffering disabled");
+    audio_arena_deinit(&receiver.arena);
+    mem_free(MEM_TAG_AUDIO, receiver.arena_packet, BUFFERED_AUDIO_PACKET_SIZE);
+    receiver.arena_packet = NULL;
+  }
+#endif
+
+#if CONFIG_MEM_STATIC_POOLS
+  // Everything a session needs on the audio path, while the heap is young
+  const mem_profile_t *profile = mem_budget_profile();
+  mem_keep_reserve(&receiver.packet_scratch_keep, MEM_TAG_AUDIO,
+                   MAX_RTP_PACKET_SIZE, MALLOC_CAP_8BIT);
+  mem_keep_reserve(&receiver.control_packet_keep, MEM_TAG_AUDIO,
+                   MAX_RTP_PACKET_SIZE, MALLOC_CAP_8BIT);
+  mem_keep_reserve(&receiver.packet_pool_keep, MEM_TAG_AUDIO,
+                   (size_t)profile->decode_queue_packets * MAX_RTP_PACKET_SIZE,
+                   MEM_PREFER_PSRAM);
+  mem_keep_reserve(&receiver.buffered_recv_keep, MEM_TAG_AUDIO,
+                   profile->buffered_recv_bytes, MEM_PREFER_PSRAM);
+#endif
+
+  audio_timing_init(&receiver.timing);
   audio_timing_set_format(&receiver.timing, &receiver.stream->format);
+  // Flush can come before the first realtime start; it needs a valid lock
+  audio_nack_init(&receiver.nack);
+  audio_buffer_set_frame_samples(&receiver.buffer,
+                                 receiver.timing.nominal_frame_samples);
 
   receiver.buffered_listen_socket = -1;
   receiver.buffered_client_socket = -1;
 
+  warm_lock = xSemaphoreCreateMutex();
+  const esp_timer_create_args_t timer_args = {
+      .callback = warm_release,
+      .name = "audio_warm",
+  };
+  if (!warm_lock || esp_timer_create(&timer_args, &warm_timer) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to create the pipeline grace timer");
+    return ESP_ERR_NO_MEM;
+  }
+
   audio_receiver_reset_blocks();
 
   return ESP_OK;
@@ -121,25 +185,47 @@ void audio_receiver_set_format(const audio_format_t *format) {
   receiver.realtime_stream->format = *format;
   receiver.buffered_stream->format = *format;
 
-  audio_decoder_destroy(receiver.decoder);
-  receiver.decoder = NULL;
+  xSemaphoreTake(warm_lock, portMAX_DELAY);
+  esp_timer_stop(warm_timer);
+  if (audio_decoder_matches(receiver.decoder, format)) {
+    ESP_LOGI(TAG, "Reusing the %s decoder of the last stream", format->codec);
+  } else {
+    audio_decoder_destroy(receiver.decoder);
+    receiver.decoder = NULL;
 
-  audio_decoder_config_t cfg = {.format = *format};
-  receiver.decoder = audio_decoder_create(&cfg);
-  if (!receiver.decoder) {
-    ESP_LOGW(TAG, "Decoder not initialized for codec: %s", format->codec);
+    audio_decoder_config_t cfg = {.format = *format};
+    receiver.decoder = audio_decoder_create(&cfg);
+    if (!receiver.decoder) {
+      ESP_LOGW(TAG, "Decoder not initialized for codec: %s", format->codec);
+    }
   }
+  xSemaphoreGive(warm_lock);
 
   audio_timing_set_format(&receiver.timing, format);
+#if CONFIG_AUDIO_CHANNEL_SELECT
+  // One channel per frame in the pool for pairs and for mono senders
+  receiver.channel_mode = audio_channel_get_mode();
+  audio_buffer_set_slot_channels(
+      &receiver.buffer,
+      receiver.channel_mode != AUDIO_CHANNEL_STEREO || format->channels == 1
+          ? 1
+          : AUDIO_MAX_CHANNELS);
+#endif
+  audio_buffer_set_frame_samples(&receiver.buffer,
+                                 receiver.timing.nominal_frame_samples);
 }
 
 void audio_receiver_set_encryption(const audio_encrypt_t *encrypt) {
   if (!receiver.realtime_stream || !receiver.buffered_stream) {
     return;
   }
+  audio_crypto_release(&receiver.realtime_stream->encrypt);
+  audio_crypto_release(&receiver.buffered_stream->encrypt);
   if (encrypt) {
     receiver.realtime_stream->encrypt = *encrypt;
     receiver.buffered_stream->encrypt = *encrypt;
+    audio_crypto_prepare(&receiver.realtime_stream->encrypt);
+    audio_crypto_prepare(&receiver.buffered_stream->encrypt);
   } else {
     memset(&receiver.realtime_stream->encrypt, 0,
            sizeof(receiver.realtime_stream->encrypt));
@@ -160,6 +246,11 @@ uint32_t audio_receiver_get_output_latency_us(void) {
   return audio_timing_get_output_latency(&receiver.timing);
 }
 
+void audio_receiver_set_output_delay_us(uint32_t delay_us) {
+  receiver.timing.output_delay_us = delay_us;
+  receiver.timing.output_delay_valid = true;
+}
+
 void audio_receiver_set_anchor_time(uint64_t clock_id, uint64_t network_time_ns,
                                     uint32_t rtp_time) {
   if (!receiver.stream) {
@@ -176,6 +267,19 @@ void audio_receiver_set_playing(bool playing) {
   }
 }
 
+void audio_receiver_set_rate_anchor(bool playing, uint64_t clock_id,
+                                    uint64_t network_time_ns,
+                                    uint32_t rtp_time) {
+  if (!receiver.stream) {
+    return;
+  }
+  audio_timing_set_rate_anchor(&receiver.timing, &receiver.stream->format,
+                               playing, clock_id, network_time_ns, rtp_time);
+  if (!playing) {
+    receiver.blocks_read_in_sequence = 0;
+  }
+}
+
 void audio_receiver_reset_timing(void) {
   audio_timing_reset(&receiver.timing);
 }
@@ -184,6 +288,11 @@ bool audio_receiver_is_playing(void) {
   return receiver.timing.playing;
 }
 
+bool audio_receiver_is_streaming(void) {
+  return (receiver.realtime_stream && receiver.realtime_stream->running) ||
+         (receiver.buffered_stream && receiver.buffered_stream->running);
+}
+
 void audio_receiver_set_stream_type(audio_stream_type_t type) {
   if (!receiver.realtime_stream || !receiver.buffered_stream) {
     return;
@@ -254,6 +363,9 @@ esp_err_t audio_receiver_start_buffered(uint16_t tcp_port) {
   // Starting a stream resets all timing state (including pause tracking)
   audio_receiver_reset_stats();
   audio_buffer_flush(&receiver.buffer);
+#if CONFIG_AUDIO_COMPRESSED_BUFFER
+  audio_arena_flush(&receiver.arena);
+#endif
   audio_timing_reset(&receiver.timing);
 
   receiver.timing.ptp_locked = ptp_clock_is_locked();
@@ -311,14 +423,25 @@ void audio_receiver_stop(void) {
     receiver.buffered_stream->ops->stop(receiver.buffered_stream);
   }
 
-  audio_decoder_destroy(receiver.decoder);
-  receiver.decoder = NULL;
+  // The decoder and receive buffer stay for a compatible next stream.
+  // Restarting the timer on every stop keeps one grace period from the last.
+  if (warm_timer) {
+    esp_timer_stop(warm_timer);
+    if (CONFIG_AUDIO_WARM_GRACE_S > 0) {
+      esp_timer_start_once(warm_timer,
+                           (uint64_t)CONFIG_AUDIO_WARM_GRACE_S * 1000000);
+    } else {
+      warm_release(NULL);
+    }
+  }
 
   if (receiver.realtime_stream) {
+    audio_crypto_release(&receiver.realtime_stream->encrypt);
     memset(&receiver.realtime_stream->encrypt, 0,
            sizeof(receiver.realtime_stream->encrypt));
   }
   if (receiver.buffered_stream) {
+    audio_crypto_release(&receiver.buffered_stream->encrypt);
     memset(&receiver.buffered_stream->encrypt, 0,
            sizeof(receiver.buffered_stream->encrypt));
   }
@@ -328,6 +451,7 @@ void audio_receiver_stop(void) {
          sizeof(receiver.client_control_addr));
 
   audio_receiver_flush();
+  mem_hot_path_report();
 }
 
 void audio_receiver_stop_buffered_only(void) {
@@ -342,6 +466,14 @@ void audio_receiver_get_stats(audio_stats_t *stats) {
     return;
   }
   memcpy(stats, &receiver.stats, sizeof(receiver.stats));
+  stats->packets_dropped += receiver.decode_packets_dropped;
+  if (receiver.ready_packets) {
+    stats->decode_queue_depth = uxQueueMessagesWaiting(receiver.ready_packets);
+  }
+  stats->decode_queue_peak = receiver.decode_queue_peak;
+  stats->decode_queue_drops = receiver.decode_queue_drops;
+  stats->pcm_depth_frames =
+      (uint32_t)audio_buffer_get_frame_count(&receiver.buffer);
 }
 
 size_t audio_receiver_read(int16_t *buffer, size_t samples) {
@@ -349,24 +481,93 @@ size_t audio_receiver_read(int16_t *buffer, size_t samples) {
     return 0;
   }
 
+#if CONFIG_AUDIO_COMPRESSED_BUFFER
+  if (receiver.stream == receiver.buffered_stream) {
+    audio_stream_buffered_decode_ahead(&receiver);
+  }
+#endif
+
   return audio_timing_read(&receiver.timing, &receiver.buffer, receiver.stream,
                            &receiver.stats, buffer, samples);
 }
 
+size_t audio_receiver_borrow(int16_t **pcm, size_t samples) {
+  if (!receiver.buffer.pool || !pcm || samples == 0) {
+    return 0;
+  }
+
+#if CONFIG_AUDIO_COMPRESSED_BUFFER
+  if (receiver.stream == receiver.buffered_stream) {
+    audio_stream_buffered_decode_ahead(&receiver);
+  }
+#endif
+
+  return audio_timing_borrow(&receiver.timing, &receiver.buffer,
+                             receiver.stream, &receiver.stats, pcm, samples);
+}
+
+void audio_receiver_release(void) {
+  audio_timing_release(&receiver.timing, &receiver.buffer);
+}
+
+int32_t audio_receiver_get_drift_ppm(void) {
+  return audio_timing_get_drift_ppm(&receiver.timing);
+}
+
+int audio_receiver_get_sample_rate(void) {
+  if (!receiver.stream) {
+    return DEFAULT_SAMPLE_RATE;
+  }
+  return receiver.stream->format.sample_rate;
+}
+
 bool audio_receiver_has_data(void) {
   int buffered_frames = audio_buffer_get_frame_count(&receiver.buffer);
+#if CONFIG_AUDIO_COMPRESSED_BUFFER
+  buffered_frames += audio_arena_get_packet_count(&receiver.arena);
+#endif
   return buffered_frames > 0 || receiver.timing.pending_valid;
 }
 
+bool audio_receiver_wait_data(TickType_t ticks) {
+  return audio_buffer_wait(&receiver.buffer, ticks);
+}
+
 void audio_receiver_flush(void) {
   // Flush is an explicit reset - clear all timing state including pause
   // tracking The sender will provide fresh anchor times after flush
   audio_buffer_flush(&receiver.buffer);
+#if CONFIG_AUDIO_COMPRESSED_BUFFER
+  audio_arena_flush(&receiver.arena);
+#endif
   audio_timing_reset(&receiver.timing);
+  // Without an anchor the holes would have no deadline to expire against
+  audio_nack_reset(&receiver.nack);
+  // Packets still queued for the decode task are discarded there
+  atomic_fetch_add(&receiver.flush_epoch, 1);
 
   receiver.blocks_read_in_sequence = 1;
 }
 
+void audio_receiver_flush_range(bool has_from, uint32_t from_ts,
+                                uint32_t until_ts) {
+  // Without a start the range is the half of the timestamp space before
+  // until_ts, which covers anything that can still be queued
+  if (!has_from) {
+    from_ts = until_ts - 0x80000000u;
+  }
+
+  // Set the PCM range first so nothing decoded from the arena meanwhile
+  // gets queued
+  audio_buffer_flush_range(&receiver.buffer, from_ts, until_ts);
+#if CONFIG_AUDIO_COMPRESSED_BUFFER
+  int discarded = audio_arena_discard(&receiver.arena, from_ts, until_ts);
+  ESP_LOGD(TAG, "Partial flush discarded %d compressed packets", discarded);
+#endif
+  // Retransmits would only refill the flushed range
+  audio_nack_reset(&receiver.nack);
+}
+
 uint16_t audio_receiver_get_buffered_port(void) {
   return receiver.buffered_port;
 }
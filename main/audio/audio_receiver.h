@@ -1,6 +1,8 @@
 #pragma once
 
 #include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "mbedtls/aes.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -29,6 +31,10 @@ typedef struct {
   uint32_t max_coded_frame_size;
   uint32_t avg_bit_rate;
   uint32_t sample_rate_config;
+
+  // AAC AudioSpecificConfig (fmtp "config="), empty if the sender sent none
+  uint8_t aac_config[8];
+  uint8_t aac_config_len;
 } audio_format_t;
 
 // Audio encryption types
@@ -44,6 +50,10 @@ typedef struct {
   uint8_t key[32]; // AES-128 uses 16, ChaCha20 uses 32
   uint8_t iv[16];  // AES-CBC IV
   size_t key_len;
+  // AES-CBC key schedule, expanded once by audio_crypto_prepare(). Callers
+  // only fill the fields above; a copied context is never used as is.
+  mbedtls_aes_context aes;
+  bool aes_ready;
 } audio_encrypt_t;
 
 // Audio buffer statistics
@@ -52,11 +62,27 @@ typedef struct {
   uint32_t packets_decoded;
   uint32_t packets_dropped;
   uint32_t decrypt_errors;
+  uint32_t retransmits_requested; // Packets asked for in NACKs
+  uint32_t retransmits_received;
   uint32_t buffer_underruns;
   uint32_t buffer_overruns;
   uint32_t late_frames;
+  uint32_t early_frames; // Held back with silence until their time
+  uint32_t concealed_gaps; // Lost frames bridged by concealment
   uint16_t last_seq;
   uint32_t last_timestamp;
+  int32_t drift_ppm; // Clock-drift correction currently applied
+  // Adaptive playout depth (realtime streams)
+  uint32_t target_depth_frames;
+  uint32_t jitter_p50_us; // Excess arrival delay percentiles
+  uint32_t jitter_p95_us;
+  uint32_t jitter_p99_us;
+  uint32_t reorder_depth; // Deepest recent reordering, in packets
+  // Pipeline stage depths (realtime streams)
+  uint32_t decode_queue_depth; // Packets received, waiting for the decoder
+  uint32_t decode_queue_peak;
+  uint32_t decode_queue_drops; // Dropped because the decoder fell behind
+  uint32_t pcm_depth_frames;   // Decoded frames waiting for playout
 } audio_stats_t;
 
 /**
@@ -103,21 +129,69 @@ void audio_receiver_get_stats(audio_stats_t *stats);
  */
 size_t audio_receiver_read(int16_t *buffer, size_t samples);
 
+/**
+ * Borrow decoded PCM straight from the jitter buffer (no copy)
+ * The samples may be modified in place and stay valid until
+ * audio_receiver_release().
+ * @param pcm Output: interleaved stereo samples, or NULL to play silence
+ * @param samples Maximum number of samples (per channel)
+ * @return Number of samples to play, 0 if nothing is ready
+ */
+size_t audio_receiver_borrow(int16_t **pcm, size_t samples);
+
+/**
+ * Release the frame returned by audio_receiver_borrow()
+ */
+void audio_receiver_release(void);
+
+/**
+ * Get the clock-drift correction (ppm) the output should apply
+ * Positive values mean stretch (the sender clock runs slower than ours).
+ */
+int32_t audio_receiver_get_drift_ppm(void);
+
+/**
+ * Sample rate of the current stream format, for the output clock.
+ */
+int audio_receiver_get_sample_rate(void);
+
 /**
  * Check if audio data is available
  */
 bool audio_receiver_has_data(void);
 
+/**
+ * Block the playback task until decoded audio is queued
+ * @param ticks Maximum time to wait
+ * @return true if decoded frames are available
+ */
+bool audio_receiver_wait_data(TickType_t ticks);
+
 /**
  * Flush audio buffer
  */
 void audio_receiver_flush(void);
 
+/**
+ * Partial flush (FLUSHBUFFERED with flushUntilTS): drop the queued audio
+ * with RTP timestamps in [from_ts, until_ts), or everything before until_ts
+ * when has_from is false, and keep the rest and the timing state.
+ */
+void audio_receiver_flush_range(bool has_from, uint32_t from_ts,
+                                uint32_t until_ts);
+
 /**
  * Set advertised/target output latency in microseconds.
  */
 void audio_receiver_set_output_latency_us(uint32_t latency_us);
 
+/**
+ * Report how long the output takes to play what it has queued, measured
+ * just before a read or borrow. Playout timing schedules the next frame
+ * behind it instead of behind a nominal DMA ring.
+ */
+void audio_receiver_set_output_delay_us(uint32_t delay_us);
+
 /**
  * Get current output latency in microseconds.
  */
@@ -137,11 +211,26 @@ void audio_receiver_set_anchor_time(uint64_t clock_id, uint64_t network_time_ns,
  */
 void audio_receiver_set_playing(bool playing);
 
+/**
+ * Pause or resume on a SETRATEANCHORTIME anchor without rebuffering.
+ * Pausing keeps the buffered audio; resuming plays the sample at rtp_time
+ * exactly at network_time_ns.
+ * @param playing Rate is non-zero
+ */
+void audio_receiver_set_rate_anchor(bool playing, uint64_t clock_id,
+                                    uint64_t network_time_ns,
+                                    uint32_t rtp_time);
+
 /**
  * Check if playback is currently active (not paused).
  */
 bool audio_receiver_is_playing(void);
 
+/**
+ * Check if a stream (realtime or buffered) is running, playing or not.
+ */
+bool audio_receiver_is_streaming(void);
+
 /**
  * Reset timing anchor (call when PTP clock changes, e.g., SETPEERS)
  */
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -7,15 +8,23 @@
 #include "lwip/sockets.h"
 
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "freertos/task.h"
 
+#include "audio_arena.h"
 #include "audio_buffer.h"
+#if CONFIG_AUDIO_CHANNEL_SELECT
+#include "audio_channel.h"
+#endif
 #include "audio_decoder.h"
+#include "audio_nack.h"
 #include "audio_receiver.h"
 #include "audio_stream.h"
 #include "audio_timing.h"
+#include "mem_budget.h"
 
-#define MAX_RTP_PACKET_SIZE 2048
+#define MAX_RTP_PACKET_SIZE        2048
+#define BUFFERED_AUDIO_PACKET_SIZE 8192 // Largest buffered record and pop copy
 
 typedef struct {
   audio_stream_t *stream;
@@ -32,6 +41,19 @@ typedef struct {
   int control_socket;
   TaskHandle_t task_handle;
   TaskHandle_t control_task_handle;
+
+  // Realtime pipeline: the network task receives into packet slots and
+  // queues them, the decode task decrypts and decodes on the other core
+  TaskHandle_t decode_task_handle;
+  uint8_t *packet_pool;        // Slots of MAX_RTP_PACKET_SIZE
+  QueueHandle_t free_slots;    // Slot indices, decode -> network
+  QueueHandle_t ready_packets; // Received packets, network -> decode
+  uint32_t decode_queue_peak;
+  uint32_t decode_queue_drops; // Received with every slot still queued
+  // Decode task's share of stats.packets_dropped, which only the network
+  // task writes; the two are summed when the stats are read
+  uint32_t decode_packets_dropped;
+  atomic_uint flush_epoch; // Bumped on flush, queued packets carry theirs
   uint16_t data_port;
   uint16_t control_port;
 
@@ -41,22 +63,45 @@ typedef struct {
   TaskHandle_t buffered_task_handle;
   uint8_t *buffered_recv_buffer;
 
-  uint8_t *decrypt_buffer;
-  size_t decrypt_buffer_size;
+  // Reserved at boot and held with CONFIG_MEM_STATIC_POOLS
+  mem_keep_t packet_scratch_keep; // Realtime receive task datagram
+  mem_keep_t control_packet_keep; // Control receive task datagram
+  mem_keep_t packet_pool_keep;    // packet_pool
+  mem_keep_t buffered_recv_keep;  // buffered_recv_buffer
+
+#if CONFIG_AUDIO_COMPRESSED_BUFFER
+  // Compressed packets of buffered streams, decoded at playout
+  audio_arena_t arena;
+  uint8_t *arena_packet; // Internal RAM copy of the packet being decoded
+#endif
 
   uint64_t blocks_read;
   uint64_t blocks_read_in_sequence;
 
+#if CONFIG_AUDIO_CHANNEL_SELECT
+  audio_channel_mode_t channel_mode; // Read when the stream's format is set
+#endif
+
   // NACK retransmission support
   struct sockaddr_in client_control_addr; // Client's control address for NACKs
   bool retransmit_enabled;                // True when client address is set
   int64_t last_resend_error_time_us;      // Backoff timer on sendto failure
+  audio_nack_t nack;                      // Holes and outstanding requests
 } audio_receiver_state_t;
 
 bool audio_stream_process_frame(audio_receiver_state_t *state,
                                 uint32_t timestamp, const uint8_t *audio_data,
                                 size_t audio_len);
 
+#if CONFIG_AUDIO_COMPRESSED_BUFFER
+/**
+ * Decode queued compressed packets into the PCM buffer until it holds the
+ * playout target plus a small decode-ahead margin. Called from the playback
+ * path right before audio_timing_read().
+ */
+void audio_stream_buffered_decode_ahead(audio_receiver_state_t *state);
+#endif
+
 static inline audio_receiver_state_t *
 audio_stream_state(audio_stream_t *stream) {
   return (audio_receiver_state_t *)stream->ctx;
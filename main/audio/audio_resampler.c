@@ -0,0 +1,82 @@
+#include <string.h>
+
+#include "audio_resampler.h"
+
+#define PHASE_ONE (1ULL << 32)
+
+void audio_resampler_init(audio_resampler_t *rs) {
+  if (!rs) {
+    return;
+  }
+
+  memset(rs, 0, sizeof(*rs));
+  rs->step = PHASE_ONE;
+  /* Start one sample behind so the first input lands on phase 0 */
+  rs->phase = PHASE_ONE;
+}
+
+void audio_resampler_reset(audio_resampler_t *rs) {
+  if (!rs) {
+    return;
+  }
+
+  rs->last[0] = 0;
+  rs->last[1] = 0;
+  rs->phase = PHASE_ONE;
+}
+
+void audio_resampler_set_ppm(audio_resampler_t *rs, int32_t ppm) {
+  if (!rs) {
+    return;
+  }
+
+  if (ppm > AUDIO_RESAMPLER_MAX_PPM) {
+    ppm = AUDIO_RESAMPLER_MAX_PPM;
+  } else if (ppm < -AUDIO_RESAMPLER_MAX_PPM) {
+    ppm = -AUDIO_RESAMPLER_MAX_PPM;
+  }
+  if (ppm == rs->ppm) {
+    return;
+  }
+
+  /* step = 1 / (1 + ppm / 1e6) */
+  rs->ppm = ppm;
+  rs->step = (PHASE_ONE * 1000000ULL) / (uint64_t)(1000000 + ppm);
+}
+
+size_t audio_resampler_process(audio_resampler_t *rs, const int16_t *in,
+                               size_t in_samples, int16_t *out,
+                               size_t out_capacity) {
+  if (!rs || !in || !out || in_samples == 0) {
+    return 0;
+  }
+
+  int32_t a0 = rs->last[0];
+  int32_t a1 = rs->last[1];
+  uint64_t phase = rs->phase;
+  size_t produced = 0;
+
+  /* Interpolate between a (previous input) and b (current input); phase is
+     the distance from a, in input samples */
+  for (size_t i = 0; i < in_samples; i++) {
+    int32_t b0 = in[i * 2];
+    int32_t b1 = in[i * 2 + 1];
+    phase -= PHASE_ONE;
+
+    while (phase < PHASE_ONE && produced < out_capacity) {
+      int32_t frac = (int32_t)(phase >> 17); /* Q15 */
+      out[produced * 2] = (int16_t)(a0 + (((b0 - a0) * frac) >> 15));
+      out[produced * 2 + 1] = (int16_t)(a1 + (((b1 - a1) * frac) >> 15));
+      produced++;
+      phase += rs->step;
+    }
+
+    a0 = b0;
+    a1 = b1;
+  }
+
+  rs->last[0] = (int16_t)a0;
+  rs->last[1] = (int16_t)a1;
+  rs->phase = phase;
+  return produced;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Fractional resampler for clock-drift correction.
+ *
+ * Linear interpolation on interleaved stereo 16-bit PCM with a Q32 phase,
+ * so the ratio can be trimmed by single ppm. Positive ppm stretches (more
+ * output than input samples), negative ppm squeezes. State carries over
+ * between calls, so frames join without discontinuities.
+ */
+
+#define AUDIO_RESAMPLER_MAX_PPM 1000
+
+typedef struct {
+  uint64_t step;    // Input samples per output sample, Q32
+  uint64_t phase;   // Position between last[] and the next input, Q32
+  int16_t last[2];  // Last input sample of the previous call
+  int32_t ppm;      // Current ratio correction
+} audio_resampler_t;
+
+void audio_resampler_init(audio_resampler_t *rs);
+
+/** Drop the carried-over sample and phase, e.g. after a flush. */
+void audio_resampler_reset(audio_resampler_t *rs);
+
+/** Set the ratio correction, clamped to +-AUDIO_RESAMPLER_MAX_PPM. */
+void audio_resampler_set_ppm(audio_resampler_t *rs, int32_t ppm);
+
+/**
+ * Output capacity (samples per channel) needed for in_samples of input.
+ */
+static inline size_t audio_resampler_max_output(size_t in_samples) {
+  return in_samples + in_samples * AUDIO_RESAMPLER_MAX_PPM / 1000000 + 2;
+}
+
+/**
+ * Resample one block.
+ * @param in Interleaved stereo input
+ * @param in_samples Input samples per channel
+ * @param out Interleaved stereo output, audio_resampler_max_output() big
+ * @return Output samples per channel
+ */
+size_t audio_resampler_process(audio_resampler_t *rs, const int16_t *in,
+                               size_t in_samples, int16_t *out,
+                               size_t out_capacity);
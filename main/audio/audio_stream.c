@@ -3,9 +3,15 @@
 
 #include "audio_stream.h"
 
+#include "audio_bench.h"
 #include "audio_buffer.h"
+#if CONFIG_AUDIO_CHANNEL_SELECT
+#include "audio_channel.h"
+#endif
 #include "audio_decoder.h"
+#include "audio_fade.h"
 #include "audio_receiver_internal.h"
+#include "audio_trace.h"
 
 extern const audio_stream_ops_t audio_stream_realtime_ops;
 extern const audio_stream_ops_t audio_stream_buffered_ops;
@@ -22,10 +28,45 @@ static bool apply_aac_transient_mute(audio_receiver_state_t *state,
     memset(buffer, 0, samples * channels * sizeof(int16_t));
     return true;
   }
+  if ((state->blocks_read_in_sequence == 3) &&
+      (state->blocks_read_in_sequence != state->blocks_read)) {
+    // First block after the muted ones: ramp in rather than step
+    audio_fade_ramp_in(buffer, samples, channels);
+  }
 
   return false;
 }
 
+static audio_bench_id_t decode_bench_id(const audio_decoder_t *decoder) {
+  if (audio_decoder_is_alac(decoder)) {
+    return AUDIO_BENCH_DECODE_ALAC;
+  }
+  return audio_decoder_is_aac(decoder) ? AUDIO_BENCH_DECODE_AAC
+                                       : AUDIO_BENCH_DECODE_PCM;
+}
+
+static int resolve_channels(audio_receiver_state_t *state,
+                            const audio_decode_info_t *info) {
+  int channels =
+      info->channels > 0 ? info->channels : state->stream->format.channels;
+  return channels > 0 ? channels : 2;
+}
+
+// Stereo pairs keep one channel from here on; returns the channels left
+static int select_channel(audio_receiver_state_t *state, int16_t *pcm,
+                          size_t samples, int channels) {
+#if CONFIG_AUDIO_CHANNEL_SELECT
+  if (channels == 2 && state->channel_mode != AUDIO_CHANNEL_STEREO) {
+    audio_channel_select(state->channel_mode, pcm, samples);
+    return 1;
+  }
+#endif
+  (void)state;
+  (void)pcm;
+  (void)samples;
+  return channels;
+}
+
 bool audio_stream_process_frame(audio_receiver_state_t *state,
                                 uint32_t timestamp, const uint8_t *audio_data,
                                 size_t audio_len) {
@@ -33,33 +74,70 @@ bool audio_stream_process_frame(audio_receiver_state_t *state,
     return false;
   }
 
+  audio_decode_info_t info = {0};
   size_t capacity_samples = 0;
+
+  // Zero-copy path: decode straight into a pool slot when a packet fits one
+  int16_t *slot_pcm = NULL;
+  void *slot =
+      audio_buffer_reserve(&state->buffer, &slot_pcm, &capacity_samples);
+  uint32_t bench = audio_bench_start();
+  if (slot) {
+    int decoded_samples =
+        audio_decoder_decode(state->decoder, audio_data, audio_len, slot_pcm,
+                             capacity_samples, &info);
+    audio_bench_stop(decode_bench_id(state->decoder), bench);
+    if (decoded_samples <= 0) {
+      audio_buffer_cancel(&state->buffer, slot);
+      return false;
+    }
+    audio_trace_mark(timestamp, AUDIO_TRACE_DECODED);
+
+    int channels = select_channel(state, slot_pcm, (size_t)decoded_samples,
+                                  resolve_channels(state, &info));
+    apply_aac_transient_mute(state, slot_pcm, (size_t)decoded_samples,
+                             channels);
+    bench = audio_bench_start();
+    bool queued = audio_buffer_commit(&state->buffer, &state->stats, slot,
+                                      timestamp, (size_t)decoded_samples,
+                                      channels);
+    audio_bench_stop(AUDIO_BENCH_QUEUE, bench);
+    if (queued) {
+      audio_trace_mark(timestamp, AUDIO_TRACE_QUEUED);
+    }
+    return queued;
+  }
+
   int16_t *decode_buffer =
       audio_buffer_get_decode_buffer(&state->buffer, &capacity_samples);
   if (!decode_buffer || capacity_samples == 0) {
     return false;
   }
 
-  audio_decode_info_t info = {0};
   int decoded_samples =
       audio_decoder_decode(state->decoder, audio_data, audio_len, decode_buffer,
                            capacity_samples, &info);
+  audio_bench_stop(decode_bench_id(state->decoder), bench);
   if (decoded_samples <= 0) {
     return false;
   }
+  audio_trace_mark(timestamp, AUDIO_TRACE_DECODED);
 
-  int channels =
-      info.channels > 0 ? info.channels : state->stream->format.channels;
-  if (channels <= 0) {
-    channels = 2;
-  }
+  int channels = select_channel(state, decode_buffer, (size_t)decoded_samples,
+                                resolve_channels(state, &info));
 
   apply_aac_transient_mute(state, decode_buffer, (size_t)decoded_samples,
                            channels);
 
-  return audio_buffer_queue_decoded(&state->buffer, &state->stats, timestamp,
-                                    decode_buffer, (size_t)decoded_samples,
-                                    channels);
+  bench = audio_bench_start();
+  bool queued = audio_buffer_queue_decoded(&state->buffer, &state->stats,
+                                           timestamp, decode_buffer,
+                                           (size_t)decoded_samples, channels);
+  audio_bench_stop(AUDIO_BENCH_QUEUE, bench);
+  if (queued) {
+    audio_trace_mark(timestamp, AUDIO_TRACE_QUEUED);
+  }
+  return queued;
 }
 
 audio_stream_t *audio_stream_create_realtime(void) {
@@ -12,50 +12,198 @@
 #include "esp_heap_caps.h"
 #include "esp_log.h"
 
+#include "audio_bench.h"
 #include "audio_crypto.h"
+#include "audio_trace.h"
+#include "mem_budget.h"
 #include "network/socket_utils.h"
+#include "power_mgmt.h"
+#include "rt_log.h"
+#include "task_placement.h"
 
-#define BUFFERED_AUDIO_PACKET_SIZE 8192
-#define AUDIO_BUFFERED_STACK_SIZE  4096
+// Compressed buffering: PCM frames to keep decoded beyond the playout target,
+// and how many packets one playback read may decode
+#define DECODE_AHEAD_FRAMES       8
+#define DECODE_PACKETS_STARTUP    8
+#define DECODE_PACKETS_STEADY     2
+#define ARENA_FULL_RETRY_MS       10
 
 static const char *TAG = "audio_buf";
 
-// Read exact number of bytes, but keep waiting on timeout if paused
+// Receive up to len bytes, whatever is available, but keep waiting on
+// timeout if paused
 // Returns: positive = bytes read, 0 = connection closed, -1 = error
-static ssize_t read_exact(audio_stream_t *stream, audio_receiver_state_t *state,
-                          int sock, uint8_t *buf, size_t len) {
-  size_t total = 0;
-  while (total < len && stream->running) {
-    ssize_t n = recv(sock, buf + total, len - total, 0);
+static ssize_t read_some(audio_stream_t *stream, audio_receiver_state_t *state,
+                         int sock, uint8_t *buf, size_t len) {
+  while (stream->running) {
+    ssize_t n = recv(sock, buf, len, 0);
     if (n > 0) {
-      total += (size_t)n;
-    } else if (n == 0) {
+      return n;
+    }
+    if (n == 0) {
       // Connection closed by peer
       ESP_LOGI(TAG, "Buffered audio connection closed by peer");
       return 0;
-    } else {
-      // n < 0: error or timeout
-      if (errno == EAGAIN || errno == EWOULDBLOCK) {
-        // Timeout - if we're paused, keep waiting for resume
-        if (!state->timing.playing) {
-          // Still paused, keep the connection alive
-          vTaskDelay(pdMS_TO_TICKS(100));
-          continue;
-        }
-        // Playing but timed out - connection may be dead
-        ESP_LOGW(TAG, "Buffered audio timeout while playing");
-        return -1;
+    }
+    // n < 0: error or timeout
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      // Timeout - if we're paused, keep waiting for resume
+      if (!state->timing.playing) {
+        // Still paused, keep the connection alive
+        vTaskDelay(pdMS_TO_TICKS(100));
+        continue;
       }
-      ESP_LOGE(TAG, "Buffered audio recv error: %d", errno);
+      // Playing but timed out - connection may be dead
+      RT_LOGW(TAG, "Buffered audio timeout while playing");
       return -1;
     }
+    RT_LOGE(TAG, "Buffered audio recv error: %d", errno);
+    return -1;
+  }
+  return -1;
+}
+
+#if CONFIG_AUDIO_COMPRESSED_BUFFER
+// Decrypt a packet straight into the compressed arena. Blocks while the
+// arena is full, which lets TCP flow control pace the sender.
+static void buffered_store_packet(audio_stream_t *stream,
+                                  audio_receiver_state_t *state,
+                                  const uint8_t *packet, size_t packet_len,
+                                  uint32_t timestamp) {
+  if (packet_len <= 12) {
+    state->stats.packets_dropped++;
+    return;
+  }
+
+  size_t capacity = packet_len - 12;
+  audio_arena_reservation_t res;
+  uint8_t *dst = NULL;
+  while (stream->running &&
+         !(dst = audio_arena_reserve(&state->arena, capacity, &res))) {
+    vTaskDelay(pdMS_TO_TICKS(ARENA_FULL_RETRY_MS));
+  }
+  if (!dst) {
+    return;
+  }
+
+  uint32_t bench = audio_bench_start();
+  int decrypted_len = audio_crypto_decrypt_buffered(
+      &stream->encrypt, packet, packet_len, dst, capacity);
+  audio_bench_stop(AUDIO_BENCH_DECRYPT, bench);
+  if (decrypted_len <= 0) {
+    state->stats.decrypt_errors++;
+    state->stats.packets_dropped++;
+    return;
+  }
+  audio_trace_mark(timestamp, AUDIO_TRACE_DECRYPTED);
+
+  if (!audio_arena_commit(&state->arena, &res, timestamp,
+                          (size_t)decrypted_len)) {
+    return; // Flushed while decrypting
+  }
+  // The playback task decodes ahead; wake it if it sleeps on an empty buffer
+  audio_buffer_notify(&state->buffer);
+}
+
+void audio_stream_buffered_decode_ahead(audio_receiver_state_t *state) {
+  // buffered_stop() clears running and waits before the decoder goes away
+  if (!state || !state->arena.data || !state->arena_packet ||
+      !state->decoder || !state->buffered_stream->running) {
+    return;
+  }
+
+  int target = (int)state->timing.target_buffer_frames + DECODE_AHEAD_FRAMES;
+  int frames = audio_buffer_get_frame_count(&state->buffer);
+  int budget =
+      frames < (int)state->timing.target_buffer_frames ? DECODE_PACKETS_STARTUP
+                                                       : DECODE_PACKETS_STEADY;
+
+  while (frames < target && budget-- > 0) {
+    size_t len = 0;
+    uint32_t timestamp = 0;
+    if (!audio_arena_pop(&state->arena, state->arena_packet,
+                         BUFFERED_AUDIO_PACKET_SIZE, &len, &timestamp)) {
+      return;
+    }
+
+    // Behind the head after a partial flush; not worth decoding
+    if (audio_buffer_in_flush_range(&state->buffer, timestamp)) {
+      budget++;
+      continue;
+    }
+
+    state->blocks_read++;
+    state->blocks_read_in_sequence++;
+
+    if (!audio_stream_process_frame(state, timestamp, state->arena_packet,
+                                    len)) {
+      state->stats.packets_dropped++;
+    }
+    frames = audio_buffer_get_frame_count(&state->buffer);
+  }
+}
+#endif
+
+// Handle one record of the stream; packet is RTP header plus encrypted
+// payload and is decrypted in place
+static void buffered_handle_packet(audio_stream_t *stream,
+                                   audio_receiver_state_t *state,
+                                   uint8_t *packet, size_t packet_len) {
+  state->stats.packets_received++;
+  if (packet_len < 12) {
+    state->stats.packets_dropped++;
+    return;
+  }
+
+  uint32_t seq_no = (packet[1] << 16) | (packet[2] << 8) | packet[3];
+  uint32_t timestamp =
+      (packet[4] << 24) | (packet[5] << 16) | (packet[6] << 8) | packet[7];
+
+  // Still in flight when a partial flush covered it
+  if (audio_buffer_in_flush_range(&state->buffer, timestamp)) {
+    return;
+  }
+  audio_trace_mark(timestamp, AUDIO_TRACE_RECV);
+
+#if CONFIG_AUDIO_COMPRESSED_BUFFER
+  if (state->arena.data) {
+    state->stats.last_seq = (uint16_t)(seq_no & 0xFFFF);
+    state->stats.last_timestamp = timestamp;
+    buffered_store_packet(stream, state, packet, packet_len, timestamp);
+    return;
+  }
+#endif
+
+  // Decrypt in place, over the payload in the receive buffer
+  uint8_t *decrypted = packet + 12;
+  size_t decrypt_capacity = packet_len - 12;
+
+  int decrypted_len = audio_crypto_decrypt_buffered(
+      &stream->encrypt, packet, packet_len, decrypted, decrypt_capacity);
+  if (decrypted_len < 0) {
+    state->stats.decrypt_errors++;
+    state->stats.packets_dropped++;
+    return;
+  }
+
+  audio_trace_mark(timestamp, AUDIO_TRACE_DECRYPTED);
+  state->stats.last_seq = (uint16_t)(seq_no & 0xFFFF);
+  state->stats.last_timestamp = timestamp;
+
+  state->blocks_read++;
+  state->blocks_read_in_sequence++;
+
+  if (!audio_stream_process_frame(state, timestamp, decrypted,
+                                  (size_t)decrypted_len)) {
+    state->stats.packets_dropped++;
   }
-  return stream->running ? (ssize_t)total : -1;
 }
 
 static void buffered_audio_task(void *pvParameters) {
   audio_stream_t *stream = (audio_stream_t *)pvParameters;
   audio_receiver_state_t *state = audio_stream_state(stream);
+  // Several records per recv(); never less than BUFFERED_AUDIO_PACKET_SIZE
+  size_t chunk_size = mem_budget_profile()->buffered_recv_bytes;
 
   while (stream->running) {
     struct sockaddr_in client_addr;
@@ -76,79 +224,67 @@ static void buffered_audio_task(void *pvParameters) {
     struct timeval tv = {.tv_sec = 30, .tv_usec = 0};
     setsockopt(client_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 
-    uint8_t *packet = state->buffered_recv_buffer;
-    if (!packet) {
-      packet = heap_caps_malloc(BUFFERED_AUDIO_PACKET_SIZE,
-                                MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-      if (!packet) {
-        packet = malloc(BUFFERED_AUDIO_PACKET_SIZE);
-      }
-      if (!packet) {
+    uint8_t *chunk = state->buffered_recv_buffer;
+    if (!chunk) {
+      chunk = mem_keep_get(&state->buffered_recv_keep, MEM_TAG_AUDIO,
+                           chunk_size, MEM_PREFER_PSRAM, NULL);
+      if (!chunk) {
         ESP_LOGE(TAG, "Failed to allocate buffered audio packet buffer");
         close(client_sock);
         state->buffered_client_socket = -1;
         continue;
       }
-      state->buffered_recv_buffer = packet;
+      state->buffered_recv_buffer = chunk;
     }
 
+    // Records are [len:u16][rtp][payload], len counting itself. Read in
+    // large chunks and handle every complete record of each one in place.
+    size_t fill = 0;
+    mem_hot_path_enter();
     while (stream->running) {
-      uint8_t len_buf[2];
-      if (read_exact(stream, state, client_sock, len_buf, 2) != 2) {
+      ssize_t n = read_some(stream, state, client_sock, chunk + fill,
+                            chunk_size - fill);
+      if (n <= 0) {
         break;
       }
-
-      uint16_t data_len = (uint16_t)((len_buf[0] << 8) | len_buf[1]);
-      if (data_len < 2 || data_len > BUFFERED_AUDIO_PACKET_SIZE) {
-        ESP_LOGW(TAG, "Invalid buffered audio packet length: %u", data_len);
-        break;
+      fill += (size_t)n;
+
+      size_t pos = 0;
+      bool valid = true;
+      while (fill - pos >= 2) {
+        uint16_t data_len = (uint16_t)((chunk[pos] << 8) | chunk[pos + 1]);
+        if (data_len < 2 || data_len > BUFFERED_AUDIO_PACKET_SIZE) {
+          RT_LOGW(TAG, "Invalid buffered audio packet length: %u", data_len);
+          valid = false;
+          break;
+        }
+        if (fill - pos < data_len) {
+          break; // Rest of the record is still in flight
+        }
+        uint32_t work = power_mgmt_busy_start();
+        buffered_handle_packet(stream, state, chunk + pos + 2,
+                               (size_t)data_len - 2);
+        power_mgmt_busy_stop(work);
+        pos += data_len;
       }
-
-      size_t packet_len = data_len - 2;
-      if (read_exact(stream, state, client_sock, packet, packet_len) !=
-          (ssize_t)packet_len) {
+      if (!valid) {
         break;
       }
 
-      state->stats.packets_received++;
-
-      uint32_t seq_no = (packet[1] << 16) | (packet[2] << 8) | packet[3];
-      uint32_t timestamp =
-          (packet[4] << 24) | (packet[5] << 16) | (packet[6] << 8) | packet[7];
-
-      uint8_t *decrypted = state->decrypt_buffer;
-      size_t decrypt_capacity = state->decrypt_buffer_size;
-      if (!decrypted) {
-        decrypted = packet + 12;
-        decrypt_capacity = packet_len > 12 ? packet_len - 12 : 0;
-      }
-
-      int decrypted_len = audio_crypto_decrypt_buffered(
-          &stream->encrypt, packet, packet_len, decrypted, decrypt_capacity);
-      if (decrypted_len < 0) {
-        state->stats.decrypt_errors++;
-        state->stats.packets_dropped++;
-        continue;
-      }
-
-      state->stats.last_seq = (uint16_t)(seq_no & 0xFFFF);
-      state->stats.last_timestamp = timestamp;
-
-      state->blocks_read++;
-      state->blocks_read_in_sequence++;
-
-      if (!audio_stream_process_frame(state, timestamp, decrypted,
-                                      (size_t)decrypted_len)) {
-        state->stats.packets_dropped++;
+      // Move the partial record (at most one packet) to the front
+      if (pos > 0) {
+        memmove(chunk, chunk + pos, fill - pos);
+        fill -= pos;
       }
     }
+    mem_hot_path_exit();
 
     close(client_sock);
     state->buffered_client_socket = -1;
   }
 
   state->buffered_task_handle = NULL;
-  vTaskDelete(NULL);
+  task_placement_exit(TASK_AUDIO_BUFFERED);
 }
 
 static esp_err_t buffered_start(audio_stream_t *stream, uint16_t port) {
@@ -167,10 +303,8 @@ static esp_err_t buffered_start(audio_stream_t *stream, uint16_t port) {
   state->buffered_port = bound_port;
 
   stream->running = true;
-  BaseType_t ret =
-      xTaskCreate(buffered_audio_task, "buff_audio", AUDIO_BUFFERED_STACK_SIZE,
-                  stream, 5, &state->buffered_task_handle);
-  if (ret != pdPASS) {
+  if (task_placement_spawn(TASK_AUDIO_BUFFERED, buffered_audio_task, stream,
+                           &state->buffered_task_handle) != ESP_OK) {
     ESP_LOGE(TAG, "Failed to create buffered audio task");
     close(state->buffered_listen_socket);
     state->buffered_listen_socket = -1;
@@ -204,10 +338,8 @@ static void buffered_stop(audio_stream_t *stream) {
     state->buffered_task_handle = NULL;
   }
 
-  if (state->buffered_recv_buffer) {
-    heap_caps_free(state->buffered_recv_buffer);
-    state->buffered_recv_buffer = NULL;
-  }
+  // The receive buffer is kept for the next stream and freed with the
+  // decoder once the pipeline has been idle for the grace period
 
   state->buffered_port = 0;
 }
@@ -9,24 +9,38 @@
 
 #include "audio_receiver_internal.h"
 
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 
+#include "audio_bench.h"
+#include "audio_trace.h"
 #include "audio_crypto.h"
+#include "mem_budget.h"
 #include "network/socket_utils.h"
+#include "power_mgmt.h"
+#include "rt_log.h"
+#include "task_placement.h"
 
 #define RTP_HEADER_SIZE         12
-#define AUDIO_RECV_STACK_SIZE   12288
-#define AUDIO_CTRL_STACK_SIZE   8192
 #define STACK_LOG_INTERVAL_US   5000000
 #define RESEND_ERROR_BACKOFF_US 100000 // 100ms backoff after sendto failure
-#define MAX_RESEND_GAP          100 // Don't request retransmit for gaps > 100
-
-#if CONFIG_FREERTOS_UNICORE
-#define AUDIO_TASK_CORE 0
-#else
-#define AUDIO_TASK_CORE 1
-#endif
+#define MAX_RESEND_GAP          100 // Larger jumps are a new position, not loss
+#define RECV_BATCH_MAX          16  // Datagrams drained per wake-up
+#define DECODE_POLL_MS          100 // Decode task rechecks running this often
+#define STOP_WAIT_MS            10
+#define STOP_WAIT_STEPS         50
+
+// Packet handed from the network to the decode stage. Sequence tracking,
+// NACKs and arrival timing are done; what is left is CPU work.
+typedef struct {
+  uint16_t slot;
+  uint16_t rtp_len;
+  uint16_t payload_offset; // From the start of the RTP header
+  uint16_t payload_len;
+  uint32_t timestamp;
+  uint32_t epoch; // flush_epoch when it was queued
+} rtp_packet_t;
 
 typedef struct __attribute__((packed)) {
   uint8_t flags;
@@ -48,7 +62,7 @@ static const uint8_t *parse_rtp(const uint8_t *packet, size_t len,
   const rtp_header_t *hdr = (const rtp_header_t *)packet;
   uint8_t version = (hdr->flags >> 6) & 0x03;
   if (version != 2) {
-    ESP_LOGW(TAG, "Invalid RTP version: %d", version);
+    RT_LOGW(TAG, "Invalid RTP version: %d", version);
     return NULL;
   }
 
@@ -78,19 +92,9 @@ static const uint8_t *parse_rtp(const uint8_t *packet, size_t len,
 /* Send an AirPlay NACK (retransmission request) for missing sequence numbers.
    Packet format: 0x80 0xD5 <seq_count_minus_1:u16> <first_seq:u16> <count:u16>
    Sent to the client's control port via our control socket. */
-static void send_resend_request(audio_receiver_state_t *state,
-                                uint16_t first_seq, uint16_t count) {
-  if (!state->retransmit_enabled || state->control_socket <= 0) {
-    return;
-  }
-
-  /* Backoff: skip if we recently had a sendto error */
-  int64_t now = esp_timer_get_time();
-  if (state->last_resend_error_time_us > 0 &&
-      (now - state->last_resend_error_time_us) < RESEND_ERROR_BACKOFF_US) {
-    return;
-  }
-
+static bool send_resend_request(audio_receiver_state_t *state,
+                                uint16_t first_seq, uint16_t count,
+                                int64_t now_us) {
   uint8_t nack[8];
   nack[0] = 0x80;
   nack[1] = 0xD5;
@@ -105,129 +109,355 @@ static void send_resend_request(audio_receiver_state_t *state,
                        (struct sockaddr *)&state->client_control_addr,
                        sizeof(state->client_control_addr));
   if (ret < 0) {
-    state->last_resend_error_time_us = now;
-    ESP_LOGD(TAG, "NACK sendto failed: %d", errno);
-  } else {
-    state->last_resend_error_time_us = 0;
-    ESP_LOGD(TAG, "NACK sent: seq=%u count=%u", first_seq, count);
+    state->last_resend_error_time_us = now_us;
+    RT_LOGD(TAG, "NACK sendto failed: %d", errno);
+    return false;
   }
+  state->last_resend_error_time_us = 0;
+  state->stats.retransmits_requested += count;
+  RT_LOGD(TAG, "NACK sent: seq=%u count=%u", first_seq, count);
+  return true;
 }
 
-static bool realtime_receive_packet(audio_stream_t *stream, uint8_t *packet,
-                                    struct sockaddr_in *src_addr,
-                                    socklen_t *addr_len) {
+// Request whatever the scheduler has due: new holes, and retries of ones
+// whose retransmit did not come back within the RTO. Holes that could not
+// arrive before their playout deadline any more are dropped by the poll.
+static void send_due_nacks(audio_stream_t *stream, int64_t now_us) {
   audio_receiver_state_t *state = audio_stream_state(stream);
+  if (!state->retransmit_enabled || state->control_socket <= 0) {
+    return;
+  }
+
+  /* Backoff: skip if we recently had a sendto error */
+  if (state->last_resend_error_time_us > 0 &&
+      (now_us - state->last_resend_error_time_us) < RESEND_ERROR_BACKOFF_US) {
+    return;
+  }
 
-  ssize_t len = recvfrom(state->data_socket, packet, MAX_RTP_PACKET_SIZE, 0,
-                         (struct sockaddr *)src_addr, addr_len);
+  int64_t early_us;
+  if (!audio_timing_get_early_us(&state->timing, &stream->format,
+                                 state->stats.last_timestamp, &early_us)) {
+    early_us = INT64_MAX;
+  }
+  uint32_t packet_us = 0;
+  if (stream->format.sample_rate > 0) {
+    uint32_t samples = stream->format.frame_size > 0
+                           ? (uint32_t)stream->format.frame_size
+                           : AAC_FRAMES_PER_PACKET;
+    packet_us = (uint32_t)((uint64_t)samples * 1000000ULL /
+                           (uint64_t)stream->format.sample_rate);
+  }
+
+  audio_nack_range_t ranges[AUDIO_NACK_MAX_RANGES];
+  int count =
+      audio_nack_poll(&state->nack, now_us, early_us, packet_us, ranges);
+  for (int i = 0; i < count; i++) {
+    if (!send_resend_request(state, ranges[i].first, ranges[i].count,
+                             now_us)) {
+      break;
+    }
+  }
+}
+
+static inline uint8_t *slot_data(audio_receiver_state_t *state,
+                                 uint16_t slot) {
+  return state->packet_pool + (size_t)slot * MAX_RTP_PACKET_SIZE;
+}
+
+typedef enum {
+  RECV_ERROR = -1, // Socket closed or failed
+  RECV_EMPTY = 0,  // Timeout, or nothing queued in a non-blocking read
+  RECV_OK = 1,
+} recv_result_t;
+
+// Receive one datagram. *slot is the packet slot to receive into, or -1 to
+// use the scratch buffer; it is set to -1 once the slot is queued for
+// decoding. *now_us is read when the first datagram of a batch arrives and
+// reused for the rest of it.
+static recv_result_t realtime_receive_packet(audio_stream_t *stream, int *slot,
+                                             uint8_t *scratch, int flags,
+                                             int64_t *now_us) {
+  audio_receiver_state_t *state = audio_stream_state(stream);
+  uint8_t *packet = *slot >= 0 ? slot_data(state, (uint16_t)*slot) : scratch;
+
+  ssize_t len = recvfrom(state->data_socket, packet, MAX_RTP_PACKET_SIZE,
+                         flags, NULL, NULL);
   if (len < 0) {
     if (errno == EAGAIN || errno == EWOULDBLOCK) {
-      return true;
+      return RECV_EMPTY;
     }
     if (stream->running) {
-      ESP_LOGE(TAG, "recvfrom error: %d", errno);
+      RT_LOGE(TAG, "recvfrom error: %d", errno);
     }
-    return false;
+    return RECV_ERROR;
   }
 
   if (len == 0) {
-    return true;
+    return RECV_OK;
+  }
+  if (*now_us == 0) {
+    *now_us = esp_timer_get_time();
   }
 
   state->stats.packets_received++;
 
-  const uint8_t *rtp_data = packet;
-  size_t rtp_len = (size_t)len;
-
-  /* Retransmit packets (type 0x56) have a 4-byte outer header before the
-     inner RTP packet. Strip it and parse the inner RTP normally. */
-  bool is_retransmit = (rtp_len >= 16 && rtp_data[1] == 0x56);
-  if (is_retransmit) {
-    rtp_data += 4;
-    rtp_len -= 4;
-  }
-
   uint16_t seq = 0;
   uint32_t timestamp = 0;
   size_t payload_len = 0;
   const uint8_t *payload =
-      parse_rtp(rtp_data, rtp_len, &seq, &timestamp, &payload_len);
+      parse_rtp(packet, (size_t)len, &seq, &timestamp, &payload_len);
 
   if (!payload || payload_len == 0) {
     state->stats.packets_dropped++;
-    return true;
-  }
-
-  /* Skip gap detection and sequence tracking for retransmits — their seq
-     is old and would corrupt last_seq, causing spurious NACKs. */
-  if (!is_retransmit) {
-    if (state->stats.packets_decoded > 0) {
-      uint16_t expected_seq = (state->stats.last_seq + 1) & 0xFFFF;
-      if (seq != expected_seq) {
-        int gap = (int)seq - (int)expected_seq;
-        if (gap < 0) {
-          gap += 65536;
-        }
-        if (gap > 0 && gap < MAX_RESEND_GAP) {
-          state->stats.packets_dropped += gap;
-          send_resend_request(state, expected_seq, (uint16_t)gap);
-        }
+    return RECV_OK;
+  }
+  audio_trace_mark(timestamp, AUDIO_TRACE_RECV);
+
+  audio_nack_note_packet(&state->nack, seq);
+
+  uint32_t reorder_depth = 0;
+  if (state->stats.packets_decoded > 0) {
+    uint16_t expected_seq = (state->stats.last_seq + 1) & 0xFFFF;
+    if (seq != expected_seq) {
+      int gap = (int)seq - (int)expected_seq;
+      if (gap < 0) {
+        gap += 65536;
+      }
+      if (gap > 0 && gap < MAX_RESEND_GAP) {
+        state->stats.packets_dropped += gap;
+      } else if (gap > 65536 - MAX_RESEND_GAP) {
+        /* Arrived behind newer packets: reordered, not a new gap */
+        reorder_depth = (uint32_t)(65536 - gap);
       }
     }
+  }
 
+  audio_timing_note_arrival(&state->timing, &stream->format, &state->stats,
+                            timestamp, reorder_depth, *now_us);
+  if (reorder_depth == 0) {
     state->stats.last_seq = seq;
     state->stats.last_timestamp = timestamp;
   }
 
+  if (*slot < 0) {
+    // Every slot is waiting for the decoder: drop rather than stall
+    state->decode_queue_drops++;
+    state->stats.packets_dropped++;
+    return RECV_OK;
+  }
+
+  rtp_packet_t queued = {
+      .slot = (uint16_t)*slot,
+      .rtp_len = (uint16_t)len,
+      .payload_offset = (uint16_t)(payload - packet),
+      .payload_len = (uint16_t)payload_len,
+      .timestamp = timestamp,
+      .epoch = atomic_load(&state->flush_epoch),
+  };
+  if (xQueueSend(state->ready_packets, &queued, 0) != pdTRUE) {
+    state->stats.packets_dropped++; // Cannot happen: one entry per slot
+    return RECV_OK;
+  }
+  *slot = -1;
+
+  uint32_t depth = uxQueueMessagesWaiting(state->ready_packets);
+  if (depth > state->decode_queue_peak) {
+    state->decode_queue_peak = depth;
+  }
+  return RECV_OK;
+}
+
+static void decode_packet(audio_stream_t *stream, const rtp_packet_t *queued) {
+  audio_receiver_state_t *state = audio_stream_state(stream);
+  uint8_t *rtp_data = slot_data(state, queued->slot);
+  uint8_t *payload = rtp_data + queued->payload_offset;
+
   state->blocks_read++;
   state->blocks_read_in_sequence++;
 
   const uint8_t *audio_data = payload;
-  size_t audio_len = payload_len;
+  size_t audio_len = queued->payload_len;
 
-  if (stream->encrypt.type != AUDIO_ENCRYPT_NONE && state->decrypt_buffer) {
+  if (stream->encrypt.type != AUDIO_ENCRYPT_NONE) {
+    // In place: the slot is ours until it goes back to the free list
+    uint32_t bench = audio_bench_start();
     int decrypted_len = audio_crypto_decrypt_rtp(
-        &stream->encrypt, payload, payload_len, state->decrypt_buffer,
-        MAX_RTP_PACKET_SIZE, rtp_data, rtp_len);
+        &stream->encrypt, payload, queued->payload_len, payload,
+        queued->payload_len, rtp_data, queued->rtp_len);
+    audio_bench_stop(AUDIO_BENCH_DECRYPT, bench);
     if (decrypted_len < 0) {
       state->stats.decrypt_errors++;
-      state->stats.packets_dropped++;
-      return true;
+      state->decode_packets_dropped++;
+      return;
     }
-    audio_data = state->decrypt_buffer;
     audio_len = (size_t)decrypted_len;
+    audio_trace_mark(queued->timestamp, AUDIO_TRACE_DECRYPTED);
   }
 
-  if (!audio_stream_process_frame(state, timestamp, audio_data, audio_len)) {
-    state->stats.packets_dropped++;
+  if (!audio_stream_process_frame(state, queued->timestamp, audio_data,
+                                  audio_len)) {
+    state->decode_packets_dropped++;
   }
-
-  return true;
 }
 
 static void receiver_task(void *pvParameters) {
   audio_stream_t *stream = (audio_stream_t *)pvParameters;
   audio_receiver_state_t *state = audio_stream_state(stream);
 
-  uint8_t *packet = (uint8_t *)malloc(MAX_RTP_PACKET_SIZE);
-  if (!packet) {
+  // Drains the socket while no slot is free, so lwIP never backs up
+  uint8_t *scratch =
+      (uint8_t *)mem_keep_get(&state->packet_scratch_keep, MEM_TAG_AUDIO,
+                              MAX_RTP_PACKET_SIZE, MALLOC_CAP_8BIT, NULL);
+  if (!scratch) {
     ESP_LOGE(TAG, "Failed to allocate packet buffer");
-    vTaskDelete(NULL);
+    state->task_handle = NULL;
+    task_placement_exit(TASK_AUDIO_RECV);
     return;
   }
 
-  struct sockaddr_in src_addr;
-  socklen_t addr_len = sizeof(src_addr);
+  int slot = -1;
+  recv_result_t result = RECV_OK;
+
+  mem_hot_path_enter();
+  while (stream->running && result != RECV_ERROR) {
+    // Block for the first datagram, then drain whatever queued up behind
+    // it (a burst after a Wi-Fi stall) before sleeping again
+    int flags = 0;
+    int64_t now_us = 0;
+    for (int n = 0; n < RECV_BATCH_MAX && stream->running; n++) {
+      if (slot < 0) {
+        uint16_t free_slot;
+        if (xQueueReceive(state->free_slots, &free_slot, 0) == pdTRUE) {
+          slot = free_slot;
+        }
+      }
+      result = realtime_receive_packet(stream, &slot, scratch, flags, &now_us);
+      if (result != RECV_OK) {
+        break;
+      }
+      flags = MSG_DONTWAIT;
+    }
+    if (now_us != 0) {
+      send_due_nacks(stream, now_us);
+    }
+  }
+  mem_hot_path_exit();
+
+  if (slot >= 0) {
+    uint16_t held = (uint16_t)slot;
+    xQueueSend(state->free_slots, &held, 0);
+  }
+  mem_keep_put(&state->packet_scratch_keep, MEM_TAG_AUDIO, scratch,
+               MAX_RTP_PACKET_SIZE);
+  state->task_handle = NULL;
+  task_placement_exit(TASK_AUDIO_RECV);
+}
 
+static void decode_task(void *pvParameters) {
+  audio_stream_t *stream = (audio_stream_t *)pvParameters;
+  audio_receiver_state_t *state = audio_stream_state(stream);
+
+  mem_hot_path_enter();
   while (stream->running) {
-    if (!realtime_receive_packet(stream, packet, &src_addr, &addr_len)) {
-      break;
+    rtp_packet_t queued;
+    if (xQueueReceive(state->ready_packets, &queued,
+                      pdMS_TO_TICKS(DECODE_POLL_MS)) != pdTRUE) {
+      continue;
+    }
+    // Queued before a flush: the audio it carries was flushed with it
+    if (queued.epoch == atomic_load(&state->flush_epoch)) {
+      uint32_t work = power_mgmt_busy_start();
+      decode_packet(stream, &queued);
+      power_mgmt_busy_stop(work);
     }
+    xQueueSend(state->free_slots, &queued.slot, 0);
   }
+  mem_hot_path_exit();
 
-  free(packet);
-  state->task_handle = NULL;
-  vTaskDelete(NULL);
+  state->decode_task_handle = NULL;
+  task_placement_exit(TASK_AUDIO_DECODE);
+}
+
+// CONFIG_AUDIO_DECODE_QUEUE_PACKETS, or fewer on a low-memory profile
+static size_t decode_pool_size(void) {
+  return (size_t)mem_budget_profile()->decode_queue_packets *
+         MAX_RTP_PACKET_SIZE;
+}
+
+static void pipeline_destroy(audio_receiver_state_t *state) {
+  if (state->ready_packets) {
+    vQueueDelete(state->ready_packets);
+    state->ready_packets = NULL;
+  }
+  if (state->free_slots) {
+    vQueueDelete(state->free_slots);
+    state->free_slots = NULL;
+  }
+  mem_keep_put(&state->packet_pool_keep, MEM_TAG_AUDIO, state->packet_pool,
+               decode_pool_size());
+  state->packet_pool = NULL;
+}
+
+static esp_err_t pipeline_create(audio_receiver_state_t *state) {
+  uint32_t packets = mem_budget_profile()->decode_queue_packets;
+  state->packet_pool =
+      mem_keep_get(&state->packet_pool_keep, MEM_TAG_AUDIO,
+                   decode_pool_size(), MEM_PREFER_PSRAM, NULL);
+  state->free_slots = xQueueCreate(packets, sizeof(uint16_t));
+  state->ready_packets = xQueueCreate(packets, sizeof(rtp_packet_t));
+  if (!state->packet_pool || !state->free_slots || !state->ready_packets) {
+    ESP_LOGE(TAG, "Failed to allocate decode queue");
+    pipeline_destroy(state);
+    return ESP_ERR_NO_MEM;
+  }
+
+  for (uint16_t i = 0; i < packets; i++) {
+    xQueueSend(state->free_slots, &i, 0);
+  }
+  state->decode_queue_peak = 0;
+  state->decode_queue_drops = 0;
+  return ESP_OK;
+}
+
+// Hand a retransmitted packet straight to the decode stage, which is the
+// only one touching the decoder. Sequence tracking and arrival timing are
+// skipped: its seq is old and would corrupt last_seq, causing spurious
+// NACKs.
+static void queue_retransmit(audio_receiver_state_t *state,
+                             const uint8_t *rtp_data, size_t rtp_len) {
+  if (rtp_len < RTP_HEADER_SIZE || rtp_len > MAX_RTP_PACKET_SIZE) {
+    return;
+  }
+  state->stats.retransmits_received++;
+
+  uint16_t seq = 0;
+  uint32_t timestamp = 0;
+  size_t payload_len = 0;
+  const uint8_t *payload =
+      parse_rtp(rtp_data, rtp_len, &seq, &timestamp, &payload_len);
+  if (!payload || payload_len == 0 ||
+      !audio_nack_note_retransmit(&state->nack, seq, esp_timer_get_time())) {
+    return; // Duplicate, or no longer wanted
+  }
+  audio_trace_mark(timestamp, AUDIO_TRACE_RECV);
+
+  uint16_t slot;
+  if (xQueueReceive(state->free_slots, &slot, 0) != pdTRUE) {
+    return; // Decoder is behind; the packet would only add to the backlog
+  }
+  memcpy(slot_data(state, slot), rtp_data, rtp_len);
+
+  rtp_packet_t queued = {
+      .slot = slot,
+      .rtp_len = (uint16_t)rtp_len,
+      .payload_offset = (uint16_t)(payload - rtp_data),
+      .payload_len = (uint16_t)payload_len,
+      .timestamp = timestamp,
+      .epoch = atomic_load(&state->flush_epoch),
+  };
+  if (xQueueSend(state->ready_packets, &queued, 0) != pdTRUE) {
+    xQueueSend(state->free_slots, &slot, 0);
+  }
 }
 
 static uint64_t nctoh64(const uint8_t *data) {
@@ -246,16 +476,19 @@ static void control_receiver_task(void *pvParameters) {
   audio_stream_t *stream = (audio_stream_t *)pvParameters;
   audio_receiver_state_t *state = audio_stream_state(stream);
 
-  uint8_t *packet = (uint8_t *)malloc(MAX_RTP_PACKET_SIZE);
+  uint8_t *packet =
+      (uint8_t *)mem_keep_get(&state->control_packet_keep, MEM_TAG_AUDIO,
+                              MAX_RTP_PACKET_SIZE, MALLOC_CAP_8BIT, NULL);
   if (!packet) {
     ESP_LOGE(TAG, "Failed to allocate control packet buffer");
     state->control_task_handle = NULL;
-    vTaskDelete(NULL);
+    task_placement_exit(TASK_AUDIO_CTRL);
     return;
   }
   struct sockaddr_in src_addr;
   socklen_t addr_len = sizeof(src_addr);
 
+  mem_hot_path_enter();
   while (stream->running) {
     ssize_t len = recvfrom(state->control_socket, packet, MAX_RTP_PACKET_SIZE,
                            0, (struct sockaddr *)&src_addr, &addr_len);
@@ -265,7 +498,7 @@ static void control_receiver_task(void *pvParameters) {
         continue;
       }
       if (stream->running) {
-        ESP_LOGE(TAG, "control recvfrom error: %d", errno);
+        RT_LOGE(TAG, "control recvfrom error: %d", errno);
       }
       break;
     }
@@ -302,36 +535,27 @@ static void control_receiver_task(void *pvParameters) {
       }
       break;
 
-    case 0xD6: { // Retransmit response — forward inner RTP to data socket
-      if (len < 8 || state->data_socket <= 0) {
-        break;
+    case 0xD6: // Retransmit response: 4-byte outer header, then RTP
+      if (len > 4) {
+        queue_retransmit(state, packet + 4, (size_t)len - 4);
       }
-      /* Re-wrap as a 0x56 retransmit and send to our own data socket so the
-         receiver task processes it in the same thread as normal packets.
-         This avoids concurrent access to the decoder and decrypt buffer. */
-      packet[1] = 0x56;
-      struct sockaddr_in self = {0};
-      self.sin_family = AF_INET;
-      self.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-      self.sin_port = htons(state->data_port);
-      sendto(state->data_socket, packet, (size_t)len, 0,
-             (struct sockaddr *)&self, sizeof(self));
       break;
-    }
 
     default:
       if (len >= 4) {
-        ESP_LOGD(TAG,
-                 "Control packet type 0x%02X, len=%d, data=%02x %02x %02x %02x",
-                 packet_type, len, packet[0], packet[1], packet[2], packet[3]);
+        RT_LOGD(TAG,
+                "Control packet type 0x%02X, len=%d, data=%02x %02x %02x %02x",
+                packet_type, len, packet[0], packet[1], packet[2], packet[3]);
       }
       break;
     }
   }
+  mem_hot_path_exit();
 
-  free(packet);
+  mem_keep_put(&state->control_packet_keep, MEM_TAG_AUDIO, packet,
+               MAX_RTP_PACKET_SIZE);
   state->control_task_handle = NULL;
-  vTaskDelete(NULL);
+  task_placement_exit(TASK_AUDIO_CTRL);
 }
 
 static esp_err_t realtime_start(audio_stream_t *stream, uint16_t port) {
@@ -342,9 +566,15 @@ static esp_err_t realtime_start(audio_stream_t *stream, uint16_t port) {
     return ESP_OK;
   }
 
+  if (pipeline_create(state) != ESP_OK) {
+    return ESP_ERR_NO_MEM;
+  }
+  audio_nack_init(&state->nack);
+
   uint16_t bound_port = port;
   state->data_socket = socket_utils_bind_udp(port, 1, 131072, &bound_port);
   if (state->data_socket < 0) {
+    pipeline_destroy(state);
     return ESP_FAIL;
   }
   state->data_port = bound_port;
@@ -356,17 +586,22 @@ static esp_err_t realtime_start(audio_stream_t *stream, uint16_t port) {
     if (state->control_socket < 0) {
       close(state->data_socket);
       state->data_socket = 0;
+      pipeline_destroy(state);
       return ESP_FAIL;
     }
+    socket_utils_set_realtime_dscp(state->control_socket); // NACKs
     state->control_port = ctrl_bound;
   }
 
   stream->running = true;
-  BaseType_t ret = xTaskCreatePinnedToCore(
-      receiver_task, "audio_recv", AUDIO_RECV_STACK_SIZE, stream, 8,
-      &state->task_handle, AUDIO_TASK_CORE);
-  if (ret != pdPASS) {
-    ESP_LOGE(TAG, "Failed to create receiver task");
+  esp_err_t ret = task_placement_spawn(TASK_AUDIO_DECODE, decode_task, stream,
+                                       &state->decode_task_handle);
+  if (ret == ESP_OK) {
+    ret = task_placement_spawn(TASK_AUDIO_RECV, receiver_task, stream,
+                               &state->task_handle);
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to create receiver tasks");
     if (state->control_socket > 0) {
       close(state->control_socket);
       state->control_socket = 0;
@@ -374,14 +609,20 @@ static esp_err_t realtime_start(audio_stream_t *stream, uint16_t port) {
     close(state->data_socket);
     state->data_socket = 0;
     stream->running = false;
+    // The decode task, if it started, leaves within DECODE_POLL_MS
+    for (int i = 0; i < STOP_WAIT_STEPS && state->decode_task_handle; i++) {
+      vTaskDelay(pdMS_TO_TICKS(STOP_WAIT_MS));
+    }
+    if (!state->decode_task_handle) {
+      pipeline_destroy(state);
+    }
     return ESP_FAIL;
   }
 
   if (state->control_socket > 0) {
-    ret = xTaskCreatePinnedToCore(control_receiver_task, "ctrl_recv",
-                                  AUDIO_CTRL_STACK_SIZE, stream, 7,
-                                  &state->control_task_handle, AUDIO_TASK_CORE);
-    if (ret != pdPASS) {
+    ret = task_placement_spawn(TASK_AUDIO_CTRL, control_receiver_task, stream,
+                               &state->control_task_handle);
+    if (ret != ESP_OK) {
       ESP_LOGW(TAG, "Failed to create control receiver task");
       close(state->control_socket);
       state->control_socket = 0;
@@ -416,6 +657,17 @@ static void realtime_stop(audio_stream_t *stream) {
     vTaskDelay(pdMS_TO_TICKS(100));
     state->control_task_handle = NULL;
   }
+
+  // Both stages use the packet slots; free them only once the decode task
+  // is gone (it notices within DECODE_POLL_MS)
+  for (int i = 0; i < STOP_WAIT_STEPS && state->decode_task_handle; i++) {
+    vTaskDelay(pdMS_TO_TICKS(STOP_WAIT_MS));
+  }
+  if (state->decode_task_handle) {
+    ESP_LOGW(TAG, "Decode task still running, keeping its queue");
+    return;
+  }
+  pipeline_destroy(state);
 }
 
 static uint16_t realtime_get_port(audio_stream_t *stream) {
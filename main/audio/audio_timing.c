@@ -1,21 +1,53 @@
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "audio_timing.h"
 
+#if CONFIG_AUDIO_CHANNEL_SELECT
+#include "audio_channel.h"
+#endif
+
+#include "audio_output.h"
+#include "audio_trace.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "ntp_clock.h"
 #include "ptp_clock.h"
+#include "rt_log.h"
 
-#define DEFAULT_BUFFER_LATENCY_US     1000000 // 500ms buffer for network jitter
-#define HARDWARE_OUTPUT_LATENCY_US    46000   // ~46ms I2S DMA latency
 #define MIN_STARTUP_FRAMES            4
 #define DRIFT_ADJUST_THRESHOLD_FRAMES 2
 #define TIMING_THRESHOLD_US           40000 // 40ms early/late threshold
 #define MAX_EARLY_US                  500000 // 500ms max early - play anyway if older
 #define MAX_CONSECUTIVE_EARLY \
   50 // Invalidate anchor after this many early frames
+#define EXACT_ANCHOR_MAX_EARLY_US 3000000 // Resume anchors may lie further out
+#define ANCHOR_WAIT_US            1000000 // Wait for an anchor before unsynced
+#define FAST_START_ANCHOR_WAIT_US 100000
+#define FAST_START_REFILL_PPM     1000 // ~1.7 cents slow, 1 ms per second
+
+// Drift loop: PI controller on the low-passed sync error of played frames.
+// 1 ms of error asks for 60 ppm; the integrator absorbs the steady crystal
+// offset between sender and receiver over a few tens of seconds.
+#define DRIFT_FILTER_SHIFT   6   // Error EMA over ~64 frames (~0.5 s)
+#define DRIFT_KP_PPM_PER_MS  60
+#define DRIFT_KI_SHIFT       16  // Integrator units: us x frames
+#define DRIFT_MAX_PPM        300
+
+// Adaptive depth: p99 excess delay + reordering + margin, re-evaluated every
+// DEPTH_EVAL_PACKETS arrivals. Grows at once, shrinks only after
+// DEPTH_SHRINK_EVALS evaluations in a row asked for DEPTH_HYSTERESIS_FRAMES
+// less.
+#define DEPTH_INITIAL_US        250000
+#define DEPTH_MARGIN_US         20000
+#define DEPTH_EVAL_PACKETS      64
+#define DEPTH_SHRINK_EVALS      8
+#define DEPTH_HYSTERESIS_FRAMES 4
+#define DEPTH_UNDERRUN_FRAMES   4
+
+// Longer gaps are a discontinuity, not loss; they are left to the anchor
+#define PLC_MAX_GAP_FRAMES 8
 
 static const char *TAG = "audio_time";
 static int consecutive_early_frames = 0;
@@ -30,25 +62,44 @@ static uint32_t frame_samples_from_format(const audio_format_t *format) {
   return AAC_FRAMES_PER_PACKET;
 }
 
+static uint32_t frames_for_us(const audio_timing_t *timing,
+                              const audio_format_t *format, uint64_t us) {
+  uint64_t samples = (us * (uint64_t)format->sample_rate) / 1000000ULL;
+  return (uint32_t)((samples + timing->nominal_frame_samples - 1) /
+                    timing->nominal_frame_samples);
+}
+
 static void update_timing_targets(audio_timing_t *timing,
                                   const audio_format_t *format) {
   timing->nominal_frame_samples = frame_samples_from_format(format);
 
   if (format->sample_rate <= 0 || timing->nominal_frame_samples == 0) {
     timing->target_buffer_frames = MIN_STARTUP_FRAMES;
+    timing->max_buffer_frames = MIN_STARTUP_FRAMES;
     return;
   }
 
-  uint64_t latency_samples =
-      ((uint64_t)timing->output_latency_us * (uint64_t)format->sample_rate) /
-      1000000ULL;
   uint32_t target_frames =
-      (uint32_t)((latency_samples + timing->nominal_frame_samples - 1) /
-                 timing->nominal_frame_samples);
+      frames_for_us(timing, format, timing->output_latency_us);
   if (target_frames < MIN_STARTUP_FRAMES) {
     target_frames = MIN_STARTUP_FRAMES;
   }
+  timing->max_buffer_frames = target_frames;
+
+#if CONFIG_AUDIO_ADAPTIVE_DEPTH
+  // Start shallow (or where the network left us) and let jitter grow it
+  uint32_t initial = frames_for_us(timing, format, DEPTH_INITIAL_US);
+  if (timing->jitter.total > 0) {
+    initial = timing->target_buffer_frames;
+  }
+  if (initial < MIN_STARTUP_FRAMES) {
+    initial = MIN_STARTUP_FRAMES;
+  }
+  timing->target_buffer_frames =
+      initial < target_frames ? initial : target_frames;
+#else
   timing->target_buffer_frames = target_frames;
+#endif
 }
 
 typedef enum {
@@ -89,8 +140,14 @@ static bool compute_early_us(const audio_timing_t *timing,
     break;
   }
 
-  // Subtract hardware latency to account for I2S DMA delay
-  target_ns -= (int64_t)HARDWARE_OUTPUT_LATENCY_US * 1000LL;
+  // Subtract what the output plays before this frame: the measured DMA
+  // queue, or the full ring (~46 ms at 44.1 kHz) until one is reported
+  if (timing->output_delay_valid) {
+    target_ns -= (int64_t)timing->output_delay_us * 1000LL;
+  } else {
+    target_ns -= (int64_t)AUDIO_OUTPUT_DMA_FRAMES * 1000000000LL /
+                 format->sample_rate;
+  }
 
   int64_t now_ns = (int64_t)esp_timer_get_time() * 1000LL;
 
@@ -104,28 +161,72 @@ static bool compute_early_us(const audio_timing_t *timing,
   // Debug: log when pause offset is significant
   static int log_count = 0;
   if (timing->total_pause_duration_ns > 0 && (log_count++ % 500 == 0)) {
-    ESP_LOGD(TAG, "Timing: pause_offset=%lld ms, early=%lld ms",
-             timing->total_pause_duration_ns / 1000000LL, *early_us / 1000LL);
+    RT_LOGD(TAG, "Timing: pause_offset=%lld ms, early=%lld ms",
+            timing->total_pause_duration_ns / 1000000LL, *early_us / 1000LL);
   }
 
   return true;
 }
 
-void audio_timing_init(audio_timing_t *timing, size_t pending_capacity) {
+// PTP (AirPlay 2), NTP (AirPlay 1), or local fallback
+static sync_mode_t current_sync_mode(void) {
+  if (ptp_clock_is_locked()) {
+    return SYNC_MODE_PTP;
+  }
+  if (ntp_clock_is_locked()) {
+    return SYNC_MODE_NTP;
+  }
+  return SYNC_MODE_NONE;
+}
+
+// Round a time offset to the nearest whole sample
+static int64_t us_to_samples(int64_t us, int sample_rate) {
+  int64_t scaled = us * sample_rate;
+  return (scaled + (scaled >= 0 ? 500000LL : -500000LL)) / 1000000LL;
+}
+
+// Track the sync error of an on-time frame and update the ppm correction
+// applied by the output resampler. Positive error means frames are due
+// later than we play them, so output is stretched.
+static void update_drift(audio_timing_t *timing, int64_t early_us) {
+  if (early_us > TIMING_THRESHOLD_US) {
+    early_us = TIMING_THRESHOLD_US;
+  } else if (early_us < -TIMING_THRESHOLD_US) {
+    early_us = -TIMING_THRESHOLD_US;
+  }
+
+  timing->drift_error_us +=
+      (early_us - timing->drift_error_us) >> DRIFT_FILTER_SHIFT;
+
+  int64_t max_integral = (int64_t)DRIFT_MAX_PPM << DRIFT_KI_SHIFT;
+  timing->drift_integral += timing->drift_error_us;
+  if (timing->drift_integral > max_integral) {
+    timing->drift_integral = max_integral;
+  } else if (timing->drift_integral < -max_integral) {
+    timing->drift_integral = -max_integral;
+  }
+
+  int64_t ppm = (timing->drift_error_us * DRIFT_KP_PPM_PER_MS) / 1000 +
+                (timing->drift_integral >> DRIFT_KI_SHIFT);
+  if (ppm > DRIFT_MAX_PPM) {
+    ppm = DRIFT_MAX_PPM;
+  } else if (ppm < -DRIFT_MAX_PPM) {
+    ppm = -DRIFT_MAX_PPM;
+  }
+  timing->drift_ppm = (int32_t)ppm;
+}
+
+void audio_timing_init(audio_timing_t *timing) {
   if (!timing) {
     return;
   }
 
   memset(timing, 0, sizeof(*timing));
-  timing->output_latency_us = DEFAULT_BUFFER_LATENCY_US;
+  timing->output_latency_us = AUDIO_TIMING_DEFAULT_LATENCY_US;
   timing->playing = true;
-
-  if (pending_capacity > 0) {
-    timing->pending_frame = (uint8_t *)malloc(pending_capacity);
-    if (timing->pending_frame) {
-      timing->pending_frame_capacity = pending_capacity;
-    }
-  }
+#if CONFIG_AUDIO_PLC
+  audio_plc_reset(&timing->plc);
+#endif
 }
 
 void audio_timing_reset(audio_timing_t *timing) {
@@ -134,12 +235,19 @@ void audio_timing_reset(audio_timing_t *timing) {
   }
 
   timing->playout_started = false;
+  timing->refilling = false;
   timing->anchor_valid = false;
+  timing->anchor_exact = false;
   timing->pending_valid = false;
   timing->pending_frame_len = 0;
   timing->ready_time_us = 0;
   timing->pause_start_time_ns = 0;
   timing->total_pause_duration_ns = 0;
+  timing->drift_error_us = 0;
+  // Keep drift_integral: the crystal offset survives a flush
+#if CONFIG_AUDIO_PLC
+  timing->next_rtp_valid = false;
+#endif
 }
 
 void audio_timing_set_format(audio_timing_t *timing,
@@ -170,6 +278,17 @@ uint32_t audio_timing_get_output_latency(const audio_timing_t *timing) {
   return timing->output_latency_us;
 }
 
+bool audio_timing_get_early_us(const audio_timing_t *timing,
+                               const audio_format_t *format,
+                               uint32_t rtp_timestamp, int64_t *early_us) {
+  if (!timing || !format || !early_us) {
+    return false;
+  }
+
+  return compute_early_us(timing, format, rtp_timestamp, current_sync_mode(),
+                          early_us);
+}
+
 void audio_timing_set_anchor(audio_timing_t *timing,
                              const audio_format_t *format, uint64_t clock_id,
                              uint64_t network_time_ns, uint32_t rtp_time) {
@@ -185,6 +304,7 @@ void audio_timing_set_anchor(audio_timing_t *timing,
   timing->anchor_network_time_ns = network_time_ns;
   timing->anchor_local_time_ns = now_ns;
   timing->ptp_locked = ptp_clock_is_locked();
+  timing->anchor_exact = false;
   timing->anchor_valid = true;
 
   // Reset pause tracking on new anchor - fresh timing baseline
@@ -192,6 +312,37 @@ void audio_timing_set_anchor(audio_timing_t *timing,
   timing->pause_start_time_ns = 0;
 }
 
+void audio_timing_set_rate_anchor(audio_timing_t *timing,
+                                  const audio_format_t *format, bool playing,
+                                  uint64_t clock_id, uint64_t network_time_ns,
+                                  uint32_t rtp_time) {
+  if (!timing || !format) {
+    return;
+  }
+
+  ESP_LOGI(TAG, "Rate anchor: %s at rtp %" PRIu32 ", %s",
+           playing ? "play" : "freeze", rtp_time,
+           timing->pending_valid ? "frame held" : "nothing held");
+
+  // The anchor is the whole timeline: no pause offset on top of it
+  audio_timing_set_anchor(timing, format, clock_id, network_time_ns,
+                          rtp_time);
+  timing->pause_start_time_ns = 0;
+  timing->total_pause_duration_ns = 0;
+
+  // Align the first frame again, but keep the held one: it is the next to
+  // play and must not go back to the pool
+  consecutive_early_frames = 0;
+  timing->drift_error_us = 0;
+  timing->refilling = false;
+#if CONFIG_AUDIO_PLC
+  timing->next_rtp_valid = false;
+#endif
+  timing->playout_started = false;
+  timing->anchor_exact = playing;
+  timing->playing = playing;
+}
+
 void audio_timing_set_playing(audio_timing_t *timing, bool playing) {
   if (!timing) {
     return;
@@ -228,16 +379,157 @@ void audio_timing_set_playing(audio_timing_t *timing, bool playing) {
   if (!playing) {
     // Keep anchor_valid and buffer intact - just stop consuming
     timing->pending_valid = false;
+#if CONFIG_AUDIO_PLC
+    timing->next_rtp_valid = false;
+#endif
     timing->pending_frame_len = 0;
   }
 }
 
-size_t audio_timing_read(audio_timing_t *timing, audio_buffer_t *buffer,
-                         const audio_stream_t *stream, audio_stats_t *stats,
-                         int16_t *out, size_t samples) {
-  if (!timing || !buffer || !stream || !out || samples == 0) {
+// Hand a held slot back to the pool. Runs on the playback task only, which
+// owns the consumer side of the buffer.
+static void release_pending(audio_timing_t *timing, audio_buffer_t *buffer) {
+  if (timing->pending_frame) {
+    audio_buffer_return(buffer, timing->pending_frame);
+    timing->pending_frame = NULL;
+  }
+  timing->pending_valid = false;
+  timing->pending_frame_len = 0;
+}
+
+void audio_timing_note_arrival(audio_timing_t *timing,
+                               const audio_format_t *format,
+                               audio_stats_t *stats, uint32_t rtp_timestamp,
+                               uint32_t reorder_depth, int64_t now_us) {
+  if (!timing || !format || format->sample_rate <= 0) {
+    return;
+  }
+
+  if (reorder_depth > 0) {
+    audio_jitter_note_reorder(&timing->jitter, reorder_depth);
+  } else {
+    audio_jitter_note_arrival(&timing->jitter, rtp_timestamp,
+                              format->sample_rate, now_us);
+  }
+
+  if (++timing->depth_updates < DEPTH_EVAL_PACKETS) {
+    return;
+  }
+  timing->depth_updates = 0;
+
+  uint32_t p99_us = audio_jitter_percentile_us(&timing->jitter, 990);
+  if (stats) {
+    stats->jitter_p50_us = audio_jitter_percentile_us(&timing->jitter, 500);
+    stats->jitter_p95_us = audio_jitter_percentile_us(&timing->jitter, 950);
+    stats->jitter_p99_us = p99_us;
+    stats->reorder_depth = timing->jitter.reorder_depth;
+  }
+
+#if CONFIG_AUDIO_ADAPTIVE_DEPTH
+  if (timing->nominal_frame_samples == 0) {
+    return;
+  }
+  uint32_t required =
+      frames_for_us(timing, format, (uint64_t)p99_us + DEPTH_MARGIN_US) +
+      timing->jitter.reorder_depth;
+  if (required < MIN_STARTUP_FRAMES) {
+    required = MIN_STARTUP_FRAMES;
+  }
+  if (required > timing->max_buffer_frames) {
+    required = timing->max_buffer_frames;
+  }
+
+  if (required > timing->target_buffer_frames) {
+    RT_LOGI(TAG, "Playout depth %" PRIu32 " -> %" PRIu32
+                 " frames (p99 jitter %" PRIu32 " us)",
+            timing->target_buffer_frames, required, p99_us);
+    timing->target_buffer_frames = required;
+    timing->shrink_streak = 0;
+  } else if (required + DEPTH_HYSTERESIS_FRAMES <=
+             timing->target_buffer_frames) {
+    if (++timing->shrink_streak >= DEPTH_SHRINK_EVALS) {
+      RT_LOGI(TAG, "Playout depth %" PRIu32 " -> %" PRIu32
+                   " frames (p99 jitter %" PRIu32 " us)",
+              timing->target_buffer_frames, required, p99_us);
+      timing->target_buffer_frames = required;
+      timing->shrink_streak = 0;
+    }
+  } else {
+    timing->shrink_streak = 0;
+  }
+#endif
+
+  if (stats) {
+    stats->target_depth_frames = timing->target_buffer_frames;
+  }
+}
+
+#if CONFIG_AUDIO_PLC
+// Samples missing between the last frame played and this one. Only short
+// gaps count, and none that the anchor already says are late.
+static uint32_t plc_gap(const audio_timing_t *timing,
+                        const audio_format_t *format, sync_mode_t sync_mode,
+                        uint32_t rtp_timestamp) {
+  if (!timing->next_rtp_valid || !timing->playout_started) {
+    return 0;
+  }
+  int32_t gap = (int32_t)(rtp_timestamp - timing->next_rtp);
+  if (gap <= 0 ||
+      (uint32_t)gap > PLC_MAX_GAP_FRAMES * timing->nominal_frame_samples) {
+    return 0;
+  }
+  int64_t early_us = 0;
+  if (timing->anchor_valid && format->sample_rate > 0 &&
+      compute_early_us(timing, format, rtp_timestamp, sync_mode,
+                       &early_us) &&
+      early_us < -TIMING_THRESHOLD_US) {
     return 0;
   }
+  return (uint32_t)gap;
+}
+#endif
+
+#if CONFIG_AUDIO_FAST_START
+// After a fast start, play slightly slow until the buffer reaches the target
+// depth. Only while unanchored: with an anchor the schedule is fixed and the
+// depth is the sender's lead.
+static void update_refill(audio_timing_t *timing, int buffered_frames) {
+  if (!timing->refilling) {
+    return;
+  }
+
+  if (timing->anchor_valid ||
+      buffered_frames >= (int)timing->target_buffer_frames) {
+    RT_LOGI(TAG, "Fast start refill done: %d frames buffered",
+            buffered_frames);
+    timing->refilling = false;
+    timing->drift_ppm = 0;
+    return;
+  }
+#if !CONFIG_AUDIO_DRIFT_NONE
+  timing->drift_ppm = FAST_START_REFILL_PPM;
+#endif
+}
+#endif
+
+size_t audio_timing_borrow(audio_timing_t *timing, audio_buffer_t *buffer,
+                           const audio_stream_t *stream, audio_stats_t *stats,
+                           int16_t **pcm_out, size_t samples) {
+  if (!timing || !buffer || !stream || !pcm_out || samples == 0) {
+    return 0;
+  }
+  *pcm_out = NULL;
+
+  // Apply flushes and overflow skips even while paused
+  audio_buffer_service(buffer);
+
+  // A frame still on loan means the caller skipped release
+  audio_timing_release(timing, buffer);
+
+  // reset()/set_playing() run on other tasks and only clear pending_valid
+  if (!timing->pending_valid && timing->pending_frame) {
+    release_pending(timing, buffer);
+  }
 
   if (!timing->playing) {
     return 0;
@@ -248,58 +540,78 @@ size_t audio_timing_read(audio_timing_t *timing, audio_buffer_t *buffer,
 
   // Wait for enough buffer before starting
   if (!timing->playout_started && !timing->pending_valid) {
-    if (buffered_frames < (int)timing->target_buffer_frames) {
+    uint32_t start_frames = timing->target_buffer_frames;
+    int64_t anchor_wait_us = ANCHOR_WAIT_US;
+#if CONFIG_AUDIO_FAST_START
+    // Start at the low watermark; with an anchor the early-frame path still
+    // holds the first frame until it is due
+    if (start_frames > CONFIG_AUDIO_FAST_START_FRAMES) {
+      start_frames = CONFIG_AUDIO_FAST_START_FRAMES;
+    }
+    anchor_wait_us = FAST_START_ANCHOR_WAIT_US;
+#endif
+    if (buffered_frames < (int)start_frames) {
       return 0;
     }
-    // Buffer is ready - wait up to 1 second for anchor to arrive
+    // Buffer is ready - wait a little for anchor to arrive
     if (!timing->anchor_valid) {
       int64_t now_us = esp_timer_get_time();
       if (timing->ready_time_us == 0) {
         timing->ready_time_us = now_us;
       }
-      if (now_us - timing->ready_time_us < 1000000) {
+      if (now_us - timing->ready_time_us < anchor_wait_us) {
         return 0; // Still waiting for anchor
       }
-      // Waited 1 second, no anchor - proceed without sync
+      // No anchor - proceed without sync
     }
+#if CONFIG_AUDIO_FAST_START
+    timing->refilling = buffered_frames < (int)timing->target_buffer_frames;
+#endif
   }
 
-  // Determine sync mode: PTP (AirPlay 2), NTP (AirPlay 1), or local fallback
-  sync_mode_t sync_mode = SYNC_MODE_NONE;
-  if (ptp_clock_is_locked()) {
-    sync_mode = SYNC_MODE_PTP;
-  } else if (ntp_clock_is_locked()) {
-    sync_mode = SYNC_MODE_NTP;
-  }
+#if CONFIG_AUDIO_FAST_START
+  update_refill(timing, buffered_frames);
+#endif
+
+  sync_mode_t sync_mode = current_sync_mode();
 
   for (int attempt = 0; attempt < 8; attempt++) {
     size_t item_size = 0;
     void *item = NULL;
-    bool from_pending = false;
+    bool from_pending = timing->pending_valid;
 
-    // Get frame from pending or buffer
-    if (timing->pending_valid) {
-      item_size = timing->pending_frame_len;
-      if (item_size < sizeof(audio_frame_header_t)) {
-        timing->pending_valid = false;
-        timing->pending_frame_len = 0;
-        continue;
-      }
+    // Get frame from pending (still held in its slot) or buffer
+    if (from_pending) {
       item = timing->pending_frame;
-      from_pending = true;
+      item_size = timing->pending_frame_len;
+      timing->pending_frame = NULL;
+      timing->pending_valid = false;
+      timing->pending_frame_len = 0;
     } else {
       if (!audio_buffer_take(buffer, &item, &item_size, 0)) {
         if (stats) {
           stats->buffer_underruns++;
         }
+#if CONFIG_AUDIO_ADAPTIVE_DEPTH
+        // Ran dry mid-stream: the next start needs more margin
+        if (timing->playout_started && !timing->ran_dry &&
+            timing->target_buffer_frames < timing->max_buffer_frames) {
+          timing->target_buffer_frames += DEPTH_UNDERRUN_FRAMES;
+          if (timing->target_buffer_frames > timing->max_buffer_frames) {
+            timing->target_buffer_frames = timing->max_buffer_frames;
+          }
+        }
+        timing->ran_dry = true;
+#endif
         return 0;
       }
+      timing->ran_dry = false;
       buffered_frames = audio_buffer_get_frame_count(buffer);
+    }
 
-      if (item_size < sizeof(audio_frame_header_t)) {
-        audio_buffer_return(buffer, item);
-        continue;
-      }
+    if (item_size < sizeof(audio_frame_header_t)) {
+      audio_buffer_return(buffer, item);
+      continue;
     }
 
     audio_frame_header_t *hdr = (audio_frame_header_t *)item;
@@ -309,103 +621,154 @@ size_t audio_timing_read(audio_timing_t *timing, audio_buffer_t *buffer,
 
     // Validate frame
     if (frame_samples == 0 || channels == 0) {
-      if (from_pending) {
-        timing->pending_valid = false;
-        timing->pending_frame_len = 0;
-      } else {
-        audio_buffer_return(buffer, item);
-      }
+      audio_buffer_return(buffer, item);
       continue;
     }
 
     size_t expected_bytes =
         sizeof(*hdr) + frame_samples * channels * sizeof(int16_t);
     if (item_size < expected_bytes) {
-      if (from_pending) {
-        timing->pending_valid = false;
-        timing->pending_frame_len = 0;
-      } else {
-        audio_buffer_return(buffer, item);
-      }
+      audio_buffer_return(buffer, item);
       continue;
     }
 
-    if (frame_samples > samples) {
-      frame_samples = samples;
+#if CONFIG_AUDIO_PLC
+    // A frame lost on the network leaves a gap before this one. Play
+    // concealment for exactly its length and hold this frame, instead of
+    // playing it early and shifting the stream.
+    uint32_t gap = plc_gap(timing, format, sync_mode, hdr->rtp_timestamp);
+    if (gap > 0) {
+      if (stats && !from_pending) {
+        stats->concealed_gaps++;
+      }
+      size_t concealed = audio_plc_conceal(&timing->plc, pcm_out,
+                                           gap < samples ? gap : samples);
+      timing->next_rtp += (uint32_t)concealed;
+      timing->pending_frame = item;
+      timing->pending_frame_len = item_size;
+      timing->pending_valid = true;
+      return concealed;
     }
+#endif
 
-    // Handle early/late frames based on anchor timing
+    // Handle early/late frames based on anchor timing. Corrections are made
+    // in samples, not whole frames: the first frame after (re)start lands
+    // exactly, later errors beyond the threshold are cut or padded exactly.
     if (timing->anchor_valid && format->sample_rate > 0) {
       int64_t early_us = 0;
       if (compute_early_us(timing, format, hdr->rtp_timestamp, sync_mode,
                            &early_us)) {
-        if (early_us > TIMING_THRESHOLD_US) {
+        bool align = !timing->playout_started;
+        int64_t early_samples = us_to_samples(early_us, format->sample_rate);
+
+        if (early_us > TIMING_THRESHOLD_US || (align && early_samples > 0)) {
           consecutive_early_frames++;
 
           // If frame is way too early or we've had too many early frames,
-          // the anchor is probably wrong - invalidate it and play normally
-          if (early_us > MAX_EARLY_US ||
-              consecutive_early_frames > MAX_CONSECUTIVE_EARLY) {
-            ESP_LOGW(TAG, "Invalidating anchor: early_us=%lld, consecutive=%d",
-                     early_us / 1000LL, consecutive_early_frames);
+          // the anchor is probably wrong - invalidate it and play normally.
+          // A rate anchor is waited out: resume lands where it says.
+          bool exact = timing->anchor_exact;
+          if (early_us > (exact ? EXACT_ANCHOR_MAX_EARLY_US : MAX_EARLY_US) ||
+              (!exact && consecutive_early_frames > MAX_CONSECUTIVE_EARLY)) {
+            RT_LOGW(TAG, "Invalidating anchor: early_us=%lld, consecutive=%d",
+                    early_us / 1000LL, consecutive_early_frames);
             timing->anchor_valid = false;
+            timing->anchor_exact = false;
             consecutive_early_frames = 0;
             // Fall through to play the frame normally
           } else {
-            // Frame is slightly early - output silence, keep frame for later
+            // Frame is early - output exactly the gap as silence (up to one
+            // read), hold the slot
             static int early_count = 0;
             early_count++;
-            if (early_count % 100 == 1) {
-              ESP_LOGW(TAG,
-                       "Frame too early #%d: %lld ms, buffered=%d, pending=%d",
-                       early_count, early_us / 1000LL, buffered_frames,
-                       timing->pending_valid ? 1 : 0);
+            if (stats && !from_pending) {
+              stats->early_frames++;
             }
-            if (!from_pending && timing->pending_frame &&
-                item_size <= timing->pending_frame_capacity) {
-              memcpy(timing->pending_frame, item, item_size);
-              timing->pending_frame_len = item_size;
-              timing->pending_valid = true;
-              audio_buffer_return(buffer, item);
+            if (early_count % 100 == 1) {
+              RT_LOGW(TAG,
+                      "Frame too early #%d: %lld ms, buffered=%d, pending=%d",
+                      early_count, early_us / 1000LL, buffered_frames,
+                      from_pending ? 1 : 0);
             }
-            memset(out, 0, samples * channels * sizeof(int16_t));
-            return samples;
+            timing->pending_frame = item;
+            timing->pending_frame_len = item_size;
+            timing->pending_valid = true;
+            return early_samples < (int64_t)samples ? (size_t)early_samples
+                                                    : samples;
           }
-        } else if (early_us < -TIMING_THRESHOLD_US) {
+        } else if (early_us < -TIMING_THRESHOLD_US ||
+                   (align && early_samples < 0)) {
           // Reset consecutive early counter on late/normal frames
           consecutive_early_frames = 0;
-          // Too late: drop frame
-          ESP_LOGW(TAG, "Dropping late frame: %lld ms", -early_us / 1000LL);
-          if (stats) {
-            stats->late_frames++;
-          }
-          if (from_pending) {
-            timing->pending_valid = false;
-            timing->pending_frame_len = 0;
-          } else {
+          size_t late_samples = (size_t)(-early_samples);
+          if (late_samples >= frame_samples) {
+            // Too late: drop frame
+            RT_LOGW(TAG, "Dropping late frame: %lld ms", -early_us / 1000LL);
+            if (stats) {
+              stats->late_frames++;
+            }
+#if CONFIG_AUDIO_PLC
+            // Dropped on purpose: no gap to conceal
+            timing->next_rtp = hdr->rtp_timestamp + hdr->samples_per_channel;
+#endif
             audio_buffer_return(buffer, item);
+            continue;
+          }
+          // Partly late: skip the samples whose time has passed
+          RT_LOGD(TAG, "Trimming %zu late samples", late_samples);
+          pcm += late_samples * channels;
+          frame_samples -= late_samples;
+        } else if (!align && sync_mode != SYNC_MODE_NONE) {
+          // Within the deadband: let the drift loop take care of it
+          update_drift(timing, early_us);
+#if !CONFIG_AUDIO_DRIFT_NONE
+          if (stats) {
+            stats->drift_ppm = timing->drift_ppm;
           }
-          continue;
+#endif
         }
       }
     }
 
+    if (frame_samples > samples) {
+      frame_samples = samples;
+    }
+
     // Frame is on time - reset early counter
     consecutive_early_frames = 0;
 
-    // Copy PCM data to output
-    memcpy(out, pcm, frame_samples * channels * sizeof(int16_t));
-
-    // Cleanup
-    if (from_pending) {
-      timing->pending_valid = false;
-      timing->pending_frame_len = 0;
-    } else {
-      audio_buffer_return(buffer, item);
+#if CONFIG_AUDIO_CHANNEL_SELECT
+    // Channel-select frames hold one channel; everything from here on
+    // works on both I2S slots
+    bool mono = channels == 1;
+    if (mono) {
+      if (frame_samples > AAC_FRAMES_PER_PACKET) {
+        frame_samples = AAC_FRAMES_PER_PACKET;
+      }
+      audio_channel_expand(timing->expanded, pcm, frame_samples);
+      pcm = timing->expanded;
+    }
+#endif
+
+#if CONFIG_AUDIO_PLC
+    audio_plc_feed(&timing->plc, pcm, frame_samples);
+    timing->next_rtp = hdr->rtp_timestamp + hdr->samples_per_channel;
+    timing->next_rtp_valid = true;
+#endif
+
+    // Lend the slot itself; it goes back to the pool on release
+    timing->borrowed_frame = item;
+    audio_trace_mark(hdr->rtp_timestamp, AUDIO_TRACE_DEQUEUED);
+    *pcm_out = pcm;
+#if CONFIG_AUDIO_CHANNEL_SELECT
+    if (mono) {
+      audio_timing_release(timing, buffer); // The widened copy is lent
     }
+#endif
 
     if (!timing->playout_started) {
       timing->playout_started = true;
+      timing->anchor_exact = false;
     }
 
     return frame_samples;
@@ -413,3 +776,44 @@ size_t audio_timing_read(audio_timing_t *timing, audio_buffer_t *buffer,
 
   return 0;
 }
+
+int32_t audio_timing_get_drift_ppm(const audio_timing_t *timing) {
+  if (!timing) {
+    return 0;
+  }
+
+  return timing->drift_ppm;
+}
+
+void audio_timing_release(audio_timing_t *timing, audio_buffer_t *buffer) {
+  if (!timing || !buffer || !timing->borrowed_frame) {
+    return;
+  }
+
+  audio_buffer_return(buffer, timing->borrowed_frame);
+  timing->borrowed_frame = NULL;
+}
+
+size_t audio_timing_read(audio_timing_t *timing, audio_buffer_t *buffer,
+                         const audio_stream_t *stream, audio_stats_t *stats,
+                         int16_t *out, size_t samples) {
+  if (!out) {
+    return 0;
+  }
+
+  int16_t *pcm = NULL;
+  size_t frame_samples =
+      audio_timing_borrow(timing, buffer, stream, stats, &pcm, samples);
+  if (frame_samples == 0) {
+    return 0;
+  }
+
+  size_t bytes = frame_samples * AUDIO_MAX_CHANNELS * sizeof(int16_t);
+  if (pcm) {
+    memcpy(out, pcm, bytes);
+  } else {
+    memset(out, 0, bytes);
+  }
+  audio_timing_release(timing, buffer);
+  return frame_samples;
+}
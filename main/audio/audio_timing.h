@@ -5,31 +5,66 @@
 #include <stdint.h>
 
 #include "audio_buffer.h"
+#include "audio_jitter.h"
+#if CONFIG_AUDIO_PLC
+#include "audio_plc.h"
+#endif
 #include "audio_receiver.h"
 #include "audio_stream.h"
 
+#define AUDIO_TIMING_DEFAULT_LATENCY_US 1000000 // Buffer for network jitter
+
 typedef struct {
   uint32_t output_latency_us;
+  // Audio queued at the output ahead of the next write, reported by the
+  // playback task before each take; nominal DMA ring until it does
+  uint32_t output_delay_us;
+  bool output_delay_valid;
   uint32_t target_buffer_frames;
+  uint32_t max_buffer_frames; // Upper bound from the output latency
+  // Adaptive playout depth, fed by the realtime receiver
+  audio_jitter_t jitter;
+  uint32_t depth_updates;  // Arrivals since the target was last evaluated
+  uint32_t shrink_streak;  // Evaluations in a row that asked for less
+  bool ran_dry;            // Underrun already counted towards depth
   uint32_t nominal_frame_samples;
   bool playout_started;
+  bool refilling; // Fast start: playing below target, stretching to catch up
   bool playing;
   bool anchor_valid;
+  bool anchor_exact; // From a rate anchor: trusted until the first frame lands
   uint64_t anchor_network_time_ns;
   uint32_t anchor_rtp_time;
   int64_t anchor_local_time_ns;
   int64_t ready_time_us; // When buffer became ready (0 = not ready yet)
   bool ptp_locked;
-  uint8_t *pending_frame;
+  // Early frame held back in its buffer slot (not copied); only the
+  // playback task returns it, other tasks just clear pending_valid
+  void *pending_frame;
   size_t pending_frame_len;
-  size_t pending_frame_capacity;
   bool pending_valid;
+  void *borrowed_frame; // Slot lent out by audio_timing_borrow()
   // Pause tracking - freeze timing during pause
   int64_t pause_start_time_ns;     // Local time when paused (0 = not paused)
   int64_t total_pause_duration_ns; // Accumulated pause time to offset timing
+  // Clock drift loop
+  int64_t drift_error_us; // Low-passed sync error of played frames
+  int64_t drift_integral; // Integrator of drift_error_us
+  int32_t drift_ppm;      // Ratio correction for the output resampler
+#if CONFIG_AUDIO_PLC
+  // Packet-loss concealment: gaps in the RTP timeline, found at dequeue.
+  // Other tasks only clear next_rtp_valid.
+  audio_plc_t plc;
+  uint32_t next_rtp; // Where the frame after the last one played starts
+  bool next_rtp_valid;
+#endif
+#if CONFIG_AUDIO_CHANNEL_SELECT
+  // Mono frames widened for playout; lent instead of their slot
+  int16_t expanded[AAC_FRAMES_PER_PACKET * AUDIO_MAX_CHANNELS];
+#endif
 } audio_timing_t;
 
-void audio_timing_init(audio_timing_t *timing, size_t pending_capacity);
+void audio_timing_init(audio_timing_t *timing);
 void audio_timing_reset(audio_timing_t *timing);
 void audio_timing_set_format(audio_timing_t *timing,
                              const audio_format_t *format);
@@ -37,10 +72,65 @@ void audio_timing_set_output_latency(audio_timing_t *timing,
                                      const audio_format_t *format,
                                      uint32_t latency_us);
 uint32_t audio_timing_get_output_latency(const audio_timing_t *timing);
+
+/**
+ * How long until the frame with this RTP timestamp is due at the output
+ * (negative once it is late).
+ * @return false while there is no anchor
+ */
+bool audio_timing_get_early_us(const audio_timing_t *timing,
+                               const audio_format_t *format,
+                               uint32_t rtp_timestamp, int64_t *early_us);
 void audio_timing_set_anchor(audio_timing_t *timing,
                              const audio_format_t *format, uint64_t clock_id,
                              uint64_t network_time_ns, uint32_t rtp_time);
 void audio_timing_set_playing(audio_timing_t *timing, bool playing);
+
+/**
+ * Re-anchor the timeline from SETRATEANCHORTIME. Rate 0 freezes playout with
+ * the buffered frames, and the one held back, left in place. A non-zero rate
+ * resumes with the sample at rtp_time playing exactly at network_time_ns:
+ * the first frame is padded or trimmed to land there, however long the
+ * pause was.
+ */
+void audio_timing_set_rate_anchor(audio_timing_t *timing,
+                                  const audio_format_t *format, bool playing,
+                                  uint64_t clock_id, uint64_t network_time_ns,
+                                  uint32_t rtp_time);
+
+/**
+ * Feed a realtime packet's arrival into the jitter tracker (receiver task).
+ * Adjusts target_buffer_frames with hysteresis and publishes the current
+ * depth and jitter percentiles in stats.
+ * @param reorder_depth Packets this one arrived behind the newest, 0 if
+ *                      in order
+ * @param now_us Arrival time; one reading may cover a batch of datagrams
+ */
+void audio_timing_note_arrival(audio_timing_t *timing,
+                               const audio_format_t *format,
+                               audio_stats_t *stats, uint32_t rtp_timestamp,
+                               uint32_t reorder_depth, int64_t now_us);
+
+/**
+ * Get the next frame to play without copying it out of the buffer slot.
+ * @param pcm_out Output: interleaved PCM inside the slot, or NULL when the
+ *                returned samples should be played as silence
+ * @return Samples per channel, 0 if there is nothing to play
+ */
+size_t audio_timing_borrow(audio_timing_t *timing, audio_buffer_t *buffer,
+                           const audio_stream_t *stream, audio_stats_t *stats,
+                           int16_t **pcm_out, size_t samples);
+
+/** Return the slot lent by audio_timing_borrow() to the pool. */
+void audio_timing_release(audio_timing_t *timing, audio_buffer_t *buffer);
+
+/**
+ * Ratio correction (ppm) the output should apply to track the sender clock.
+ * Positive values mean the output must stretch (play slower).
+ */
+int32_t audio_timing_get_drift_ppm(const audio_timing_t *timing);
+
+/** Copying variant of audio_timing_borrow() + audio_timing_release(). */
 size_t audio_timing_read(audio_timing_t *timing, audio_buffer_t *buffer,
                          const audio_stream_t *stream, audio_stats_t *stats,
                          int16_t *out, size_t samples);
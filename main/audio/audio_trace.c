@@ -0,0 +1,183 @@
+#include "audio_trace.h"
+
+#include <string.h>
+
+#include "esp_timer.h"
+
+#define TRACE_SLOTS 256 // Packets in flight that can be told apart
+#define BUCKETS     128 // Four per octave cover the 32-bit range
+
+typedef struct {
+  uint32_t rtp_timestamp;
+  uint32_t at_us[AUDIO_TRACE_POINTS]; // Low bits of esp_timer, 0 = unset
+} trace_slot_t;
+
+typedef struct {
+  uint32_t count;
+  uint32_t max;
+  uint64_t sum;
+  uint32_t hist[BUCKETS];
+} trace_stage_t;
+
+static const char *const stage_names[AUDIO_TRACE_STAGES] = {
+    "decrypt", "decode", "queue", "buffer", "output", "total",
+};
+
+static trace_slot_t slots[TRACE_SLOTS];
+static trace_stage_t stages[AUDIO_TRACE_STAGES];
+static audio_trace_frame_t recent[AUDIO_TRACE_RECENT];
+static uint32_t recent_count;
+
+// Frame the playback task dequeued and has not written yet
+static trace_slot_t *playing;
+static uint32_t playing_timestamp;
+
+static inline trace_slot_t *slot_of(uint32_t rtp_timestamp) {
+  // Timestamps advance by the frame size; a multiplicative hash spreads any
+  // step over the table
+  return &slots[(rtp_timestamp * 2654435761u) >> 24];
+}
+
+static inline uint32_t now_us(void) {
+  uint32_t now = (uint32_t)esp_timer_get_time();
+  return now ? now : 1;
+}
+
+static uint32_t bucket_of(uint32_t us) {
+  if (us < 4) {
+    return us;
+  }
+  uint32_t octave = 31 - (uint32_t)__builtin_clz(us);
+  return 4 * (octave - 1) + ((us >> (octave - 2)) & 3);
+}
+
+static uint32_t bucket_upper(uint32_t bucket) {
+  if (bucket < 4) {
+    return bucket;
+  }
+  uint32_t shift = bucket / 4 - 1;
+  uint64_t upper = ((uint64_t)(5 + bucket % 4) << shift) - 1;
+  return upper > UINT32_MAX ? UINT32_MAX : (uint32_t)upper;
+}
+
+void audio_trace_mark(uint32_t rtp_timestamp, audio_trace_point_t point) {
+  if (point >= AUDIO_TRACE_POINTS) {
+    return;
+  }
+
+  trace_slot_t *slot = slot_of(rtp_timestamp);
+  if (point == AUDIO_TRACE_RECV) {
+    memset(slot->at_us, 0, sizeof(slot->at_us));
+    slot->rtp_timestamp = rtp_timestamp;
+    slot->at_us[AUDIO_TRACE_RECV] = now_us();
+    return;
+  }
+  if (slot->rtp_timestamp != rtp_timestamp ||
+      !slot->at_us[AUDIO_TRACE_RECV]) {
+    return; // Overwritten by a later packet, or never received
+  }
+
+  slot->at_us[point] = now_us();
+  if (point == AUDIO_TRACE_DEQUEUED) {
+    playing = slot;
+    playing_timestamp = rtp_timestamp;
+  }
+}
+
+static void record(audio_trace_stage_t stage, uint32_t us) {
+  trace_stage_t *s = &stages[stage];
+  if (us > s->max) {
+    s->max = us;
+  }
+  s->count++;
+  s->sum += us;
+  s->hist[bucket_of(us)]++;
+}
+
+void audio_trace_written(void) {
+  trace_slot_t *slot = playing;
+  playing = NULL;
+  if (!slot || slot->rtp_timestamp != playing_timestamp ||
+      !slot->at_us[AUDIO_TRACE_RECV]) {
+    return;
+  }
+  slot->at_us[AUDIO_TRACE_WRITTEN] = now_us();
+
+  // A point that was skipped (clear stream) takes the time of the one
+  // before it, so its stage reads zero
+  audio_trace_frame_t *frame = &recent[recent_count % AUDIO_TRACE_RECENT];
+  frame->rtp_timestamp = playing_timestamp;
+  uint32_t prev = slot->at_us[AUDIO_TRACE_RECV];
+  for (int point = 1; point < AUDIO_TRACE_POINTS; point++) {
+    uint32_t at = slot->at_us[point] ? slot->at_us[point] : prev;
+    frame->stage_us[point - 1] = at - prev;
+    record((audio_trace_stage_t)(point - 1), at - prev);
+    prev = at;
+  }
+  frame->stage_us[AUDIO_TRACE_STAGE_TOTAL] =
+      prev - slot->at_us[AUDIO_TRACE_RECV];
+  record(AUDIO_TRACE_STAGE_TOTAL, frame->stage_us[AUDIO_TRACE_STAGE_TOTAL]);
+  recent_count++;
+
+  slot->at_us[AUDIO_TRACE_RECV] = 0; // Done; a late duplicate starts over
+}
+
+bool audio_trace_get(audio_trace_stage_t stage, audio_trace_stats_t *stats) {
+  if (stage >= AUDIO_TRACE_STAGES || !stats) {
+    return false;
+  }
+
+  const trace_stage_t *s = &stages[stage];
+  memset(stats, 0, sizeof(*stats));
+  if (s->count == 0) {
+    return false;
+  }
+
+  stats->count = s->count;
+  stats->max_us = s->max;
+  stats->avg_us = (uint32_t)(s->sum / s->count);
+
+  uint64_t p50 = ((uint64_t)s->count + 1) / 2;
+  uint64_t p99 = ((uint64_t)s->count * 99 + 99) / 100;
+  uint64_t seen = 0;
+  bool have_p50 = false;
+  for (uint32_t i = 0; i < BUCKETS; i++) {
+    seen += s->hist[i];
+    uint32_t upper = bucket_upper(i);
+    upper = upper < s->max ? upper : s->max;
+    if (!have_p50 && seen >= p50) {
+      stats->p50_us = upper;
+      have_p50 = true;
+    }
+    if (seen >= p99) {
+      stats->p99_us = upper;
+      break;
+    }
+  }
+  return true;
+}
+
+size_t audio_trace_get_recent(audio_trace_frame_t *frames, size_t max) {
+  if (!frames) {
+    return 0;
+  }
+
+  uint32_t total = recent_count;
+  size_t n = total < AUDIO_TRACE_RECENT ? total : AUDIO_TRACE_RECENT;
+  if (n > max) {
+    n = max;
+  }
+  for (size_t i = 0; i < n; i++) {
+    frames[i] = recent[(total - 1 - i) % AUDIO_TRACE_RECENT];
+  }
+  return n;
+}
+
+const char *audio_trace_stage_name(audio_trace_stage_t stage) {
+  return stage < AUDIO_TRACE_STAGES ? stage_names[stage] : "unknown";
+}
+
+void audio_trace_reset(void) {
+  memset(stages, 0, sizeof(stages));
+  recent_count = 0;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+/**
+ * End-to-end latency tracing of the frames of the live stream.
+ *
+ * Each packet is stamped with esp_timer_get_time() as it passes the points
+ * below, in a side table keyed by its RTP timestamp. When the playback task
+ * has written the frame to I2S, the time between consecutive points is
+ * folded into one log-scale histogram per stage (four buckets per octave of
+ * microseconds) and the whole trace goes into a ring of recent frames, both
+ * served as JSON on /api/trace.
+ *
+ * Only the first chunk of a packet carries its timestamp through the PCM
+ * buffer, so that is the one traced. With compressed buffering the time a
+ * packet waits in the arena counts towards "decode". Without
+ * CONFIG_AUDIO_TRACE the hooks compile to nothing.
+ */
+
+typedef enum {
+  AUDIO_TRACE_RECV = 0,  // Datagram or TCP record read
+  AUDIO_TRACE_DECRYPTED, // Payload decrypted (same as recv when clear)
+  AUDIO_TRACE_DECODED,   // PCM out of the decoder
+  AUDIO_TRACE_QUEUED,    // Placed in the jitter buffer
+  AUDIO_TRACE_DEQUEUED,  // Taken for playout
+  AUDIO_TRACE_WRITTEN,   // Handed to the I2S DMA
+  AUDIO_TRACE_POINTS,
+} audio_trace_point_t;
+
+/** Stage n spans point n to n + 1; the last one is recv to written. */
+typedef enum {
+  AUDIO_TRACE_STAGE_DECRYPT = 0,
+  AUDIO_TRACE_STAGE_DECODE,
+  AUDIO_TRACE_STAGE_QUEUE,
+  AUDIO_TRACE_STAGE_BUFFER,
+  AUDIO_TRACE_STAGE_OUTPUT,
+  AUDIO_TRACE_STAGE_TOTAL,
+  AUDIO_TRACE_STAGES,
+} audio_trace_stage_t;
+
+#define AUDIO_TRACE_RECENT 32 // Frames kept in the ring
+
+typedef struct {
+  uint32_t count;
+  uint32_t avg_us;
+  uint32_t p50_us; // Upper edge of the histogram bucket
+  uint32_t p99_us;
+  uint32_t max_us;
+} audio_trace_stats_t;
+
+typedef struct {
+  uint32_t rtp_timestamp;
+  uint32_t stage_us[AUDIO_TRACE_STAGES];
+} audio_trace_frame_t;
+
+#if CONFIG_AUDIO_TRACE
+
+/** Stamp a frame at a point (any task; stats only, no locking). */
+void audio_trace_mark(uint32_t rtp_timestamp, audio_trace_point_t point);
+
+/**
+ * Playback task, after each I2S write: completes the trace of the frame
+ * dequeued for it, if any.
+ */
+void audio_trace_written(void);
+
+/**
+ * Summary of a stage since the last reset.
+ * @return false if no frame has completed
+ */
+bool audio_trace_get(audio_trace_stage_t stage, audio_trace_stats_t *stats);
+
+/**
+ * Copy the most recent complete traces, newest first.
+ * @return Number of frames copied
+ */
+size_t audio_trace_get_recent(audio_trace_frame_t *frames, size_t max);
+
+/** Stable stage name used in the JSON ("decrypt", "buffer", ...). */
+const char *audio_trace_stage_name(audio_trace_stage_t stage);
+
+/** Restart the histograms and the ring. */
+void audio_trace_reset(void);
+
+#else
+
+static inline void audio_trace_mark(uint32_t rtp_timestamp,
+                                    audio_trace_point_t point) {
+  (void)rtp_timestamp;
+  (void)point;
+}
+
+static inline void audio_trace_written(void) {}
+
+#endif
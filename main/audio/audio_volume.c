@@ -0,0 +1,66 @@
+#include "audio_volume.h"
+
+#include "audio_gain.h"
+#include "esp_log.h"
+#include "rtsp_server.h"
+
+#define VOLUME_MUTE_DB -30.0f // AirPlay's floor; -144 means mute outright
+
+static const char *TAG = "audio_volume";
+
+static const audio_volume_backend_t *s_backend;
+static volatile bool s_hardware;
+static int32_t s_gain_q15 = -1; // Last requested, -1 before the first
+
+int32_t audio_volume_curve_q15(float volume_db) {
+  if (volume_db <= VOLUME_MUTE_DB) {
+    return 0;
+  }
+  if (volume_db >= 0.0f) {
+    return AUDIO_GAIN_UNITY;
+  }
+  // Map -30..0 to 0..1, then square for perceptual control
+  float normalized = (volume_db - VOLUME_MUTE_DB) / -VOLUME_MUTE_DB;
+  return (int32_t)(normalized * normalized * AUDIO_GAIN_UNITY);
+}
+
+static void apply(int32_t gain_q15) {
+  esp_err_t err = s_backend->set_gain_q15(gain_q15);
+  if (err != ESP_OK && s_hardware) {
+    ESP_LOGW(TAG, "%s volume failed (%s), using software gain",
+             s_backend->name, esp_err_to_name(err));
+  } else if (err == ESP_OK && !s_hardware) {
+    ESP_LOGI(TAG, "Volume applied by %s", s_backend->name);
+  }
+  s_hardware = err == ESP_OK;
+}
+
+void audio_volume_register(const audio_volume_backend_t *backend) {
+  s_backend = backend;
+  s_hardware = false;
+  if (!backend) {
+    ESP_LOGI(TAG, "Volume applied in software");
+    return;
+  }
+  // Assume the hardware works until a write says otherwise
+  s_hardware = true;
+  ESP_LOGI(TAG, "Volume applied by %s", backend->name);
+  if (s_gain_q15 >= 0) {
+    apply(s_gain_q15);
+  }
+}
+
+void audio_volume_set_q15(int32_t gain_q15) {
+  s_gain_q15 = gain_q15;
+  if (s_backend) {
+    apply(gain_q15);
+  }
+}
+
+bool audio_volume_is_hardware(void) {
+  return s_hardware;
+}
+
+int32_t audio_volume_software_q15(void) {
+  return s_hardware ? AUDIO_GAIN_UNITY : airplay_get_volume_q15();
+}
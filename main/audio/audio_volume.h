@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * Where the AirPlay volume is applied.
+ *
+ * By default the output task scales the PCM itself (audio_gain). A board
+ * whose DAC has a digital attenuator can register it as a backend instead:
+ * the volume is then sent to the chip, which works at a higher internal
+ * precision and ramps by itself, and the software gain stays at unity so
+ * low volumes keep the full 16 bits of the stream.
+ */
+
+typedef struct {
+  const char *name;
+  /**
+   * Apply a linear gain (Q15, 32768 = full scale, 0 = mute). Called from the
+   * RTSP task on every volume change; must not block for long.
+   */
+  esp_err_t (*set_gain_q15)(int32_t gain_q15);
+} audio_volume_backend_t;
+
+/**
+ * Hand the volume to a hardware backend (NULL returns it to software). The
+ * last requested volume, if any, is applied right away.
+ */
+void audio_volume_register(const audio_volume_backend_t *backend);
+
+/** Map AirPlay volume (-30..0 dB, -144 = mute) to the perceptual Q15 curve. */
+int32_t audio_volume_curve_q15(float volume_db);
+
+/**
+ * Route a new volume to the backend. Without one, or if the backend fails,
+ * the software gain takes over.
+ */
+void audio_volume_set_q15(int32_t gain_q15);
+
+/** True while a hardware backend applies the volume. */
+bool audio_volume_is_hardware(void);
+
+/** Gain the output task applies: unity when the hardware handles volume. */
+int32_t audio_volume_software_q15(void);
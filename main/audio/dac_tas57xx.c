@@ -11,12 +11,25 @@
 #include "driver/i2c_types.h"
 #include "esp_log.h"
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
 #define TAS575x (0x98 >> 1)
 #define TAS578x (0x90 >> 1)
 
 #define I2C_TIMEOUT    100
 #define I2C_LINE_SPEED 100000
 
+// Page 0 digital volume (R61 left, R62 right): 0x30 is 0 dB, each step down
+// another -0.5 dB to -103 dB at 0xFE, and 0xFF mutes
+#define TAS57XX_REG_VOLUME_LEFT 0x3d
+#define TAS57XX_REG_VOLUME_RAMP 0x3f
+#define TAS57XX_AUTO_INCREMENT  0x80 // Register address flag: consecutive regs
+#define TAS57XX_VOLUME_0DB      0x30
+#define TAS57XX_VOLUME_MIN      0xfe
+#define TAS57XX_VOLUME_MUTE     0xff
+
 static const char TAG[] = "TAS57xx DAC";
 
 struct tas57xx_cmd_s {
@@ -31,7 +44,8 @@ static const struct tas57xx_cmd_s tas57xx_init_seq[] = {
     {0x25, 0x08}, // ignore SCK halt
     {0x08, 0x10}, // Mute control enable (from TAS5780)
     {0x54, 0x02}, // Mute output control (from TAS5780)
-#if BYTES_PER_FRAME == 8
+    {TAS57XX_REG_VOLUME_RAMP, 0x77}, // Volume ramps 0.5 dB every 2 samples
+#if CONFIG_AUDIO_OUTPUT_32BIT
     {0x28, 0x03}, // I2S length 32 bits
 #else
     {0x28, 0x00}, // I2S length 16 bits
@@ -47,7 +61,6 @@ typedef enum {
   TAS57XX_DOWN,
   TAS57XX_ANALOGUE_OFF,
   TAS57XX_ANALOGUE_ON,
-  TAS57XX_VOLUME_ADJUST // For TAS5754m, R61/2 are used to set this
 } tas57xx_cmd_e;
 
 static const struct tas57xx_cmd_s tas57xx_cmd[] = {
@@ -61,8 +74,9 @@ static const struct tas57xx_cmd_s tas57xx_cmd[] = {
 static uint8_t tas57xx_addr;
 static i2c_master_bus_handle_t s_bus_handle = NULL;
 static i2c_master_dev_handle_t tas57xx_device_handle;
+static int tas57xx_volume = -1; // Register value last written, -1 unknown
 
-static esp_err_t write_cmd(tas57xx_cmd_e cmd, ...);
+static esp_err_t write_cmd(tas57xx_cmd_e cmd);
 static int tas57xx_detect(i2c_master_bus_handle_t s_bus_handle);
 
 // I2C functions
@@ -125,6 +139,7 @@ esp_err_t tas57xx_deinit(int i2c_port, int sda_io, int scl_io) {
     }
   }
 
+  tas57xx_volume = -1;
   err = i2c_deinit(i2c_port, sda_io, scl_io);
   return err;
 }
@@ -159,27 +174,43 @@ void tas57xx_enable_line_out(bool enable) {
   ESP_LOGW(TAG, "Not supported yet");
 }
 
-static esp_err_t write_cmd(tas57xx_cmd_e cmd, ...) {
-  va_list args;
-  esp_err_t err = ESP_OK;
-  va_start(args, cmd);
+esp_err_t tas57xx_set_volume_q15(int32_t gain_q15) {
+  uint8_t value = TAS57XX_VOLUME_MUTE;
+  if (gain_q15 >= 32768) {
+    value = TAS57XX_VOLUME_0DB;
+  } else if (gain_q15 > 0) {
+    float db = 20.0f * log10f((float)gain_q15 / 32768.0f);
+    long steps = lroundf(-2.0f * db);
+    value = (uint8_t)(steps < TAS57XX_VOLUME_MIN - TAS57XX_VOLUME_0DB
+                          ? TAS57XX_VOLUME_0DB + steps
+                          : TAS57XX_VOLUME_MIN);
+  }
+  if (value == tas57xx_volume) {
+    return ESP_OK;
+  }
 
-  switch (cmd) {
-  case TAS57XX_VOLUME_ADJUST:
-    ESP_LOGE(TAG, "Volume Change: WIP");
-    // TODO: look up command in datasheet, send values to chip
-    break;
-  default:
-    err =
-        i2c_bus_write(tas57xx_device_handle, tas57xx_addr, tas57xx_cmd[cmd].reg,
-                      &(tas57xx_cmd[cmd].value), sizeof(uint8_t));
+  // Both channels in one transaction; the chip ramps to the new value
+  uint8_t pair[2] = {value, value};
+  esp_err_t err = i2c_bus_write(
+      tas57xx_device_handle, tas57xx_addr,
+      TAS57XX_REG_VOLUME_LEFT | TAS57XX_AUTO_INCREMENT, pair, sizeof(pair));
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to set volume: %s", esp_err_to_name(err));
+    tas57xx_volume = -1;
+    return err;
   }
+  tas57xx_volume = value;
+  ESP_LOGD(TAG, "Volume register 0x%02x", value);
+  return ESP_OK;
+}
 
+static esp_err_t write_cmd(tas57xx_cmd_e cmd) {
+  esp_err_t err =
+      i2c_bus_write(tas57xx_device_handle, tas57xx_addr, tas57xx_cmd[cmd].reg,
+                    &(tas57xx_cmd[cmd].value), sizeof(uint8_t));
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "Failed i2c write to TAS57xx: %s", esp_err_to_name(err));
   }
-
-  va_end(args);
   return err;
 }
 
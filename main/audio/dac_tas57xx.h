@@ -32,6 +32,13 @@ void tas57xx_enable_speaker(bool enable);
  */
 void tas57xx_enable_line_out(bool enable);
 
+/**
+ * Set the digital volume of both channels from a linear Q15 gain
+ * (32768 = 0 dB, 0 = mute), in 0.5 dB steps down to -103 dB. The chip
+ * ramps to the new level; repeating the current level writes nothing.
+ */
+esp_err_t tas57xx_set_volume_q15(int32_t gain_q15);
+
 /**
  * Set the power mode for the amplifier
  */
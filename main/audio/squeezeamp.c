@@ -1,5 +1,6 @@
 #include "squeezeamp.h"
 
+#include "audio_volume.h"
 #include "dac_tas57xx.h"
 #include "driver/gpio.h"
 #include "esp_check.h"
@@ -12,8 +13,17 @@ static const char TAG[] = "SqueezeAMP";
 
 static esp_err_t init_gpio(void);
 
-static void on_rtsp_event(rtsp_event_t event, void *user_data) {
+#if CONFIG_SQUEEZEAMP_HW_VOLUME
+static const audio_volume_backend_t tas57xx_volume = {
+    .name = "TAS57xx",
+    .set_gain_q15 = tas57xx_set_volume_q15,
+};
+#endif
+
+static void on_rtsp_event(rtsp_event_t event, const rtsp_event_data_t *data,
+                          void *user_data) {
   (void)user_data;
+  (void)data;
   switch (event) {
   case RTSP_EVENT_CLIENT_CONNECTED:
   case RTSP_EVENT_PAUSED:
@@ -26,6 +36,8 @@ static void on_rtsp_event(rtsp_event_t event, void *user_data) {
     tas57xx_enable_speaker(true);
     tas57xx_set_power_mode(TAS57XX_AMP_OFF);
     break;
+  default:
+    break;
   }
 }
 
@@ -48,6 +60,11 @@ esp_err_t squeezeamp_init(void) {
   // Register for RTSP events to control DAC power
   rtsp_events_register(on_rtsp_event, NULL);
 
+#if CONFIG_SQUEEZEAMP_HW_VOLUME
+  // The DAC attenuates; the stream is passed through at full scale
+  audio_volume_register(&tas57xx_volume);
+#endif
+
   // Start in standby
   tas57xx_enable_speaker(true);
   tas57xx_set_power_mode(TAS57XX_AMP_OFF);
@@ -74,6 +91,9 @@ static esp_err_t init_gpio(void) {
 
 esp_err_t squeezeamp_deinit(void) {
   rtsp_events_unregister(on_rtsp_event);
+#if CONFIG_SQUEEZEAMP_HW_VOLUME
+  audio_volume_register(NULL);
+#endif
   tas57xx_enable_speaker(false);
   tas57xx_set_power_mode(TAS57XX_AMP_OFF);
   return ESP_OK;
@@ -3,6 +3,9 @@
 #include "hap.h"
 
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "mem_budget.h"
+#include "freertos/task.h"
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "sodium.h"
@@ -19,6 +22,79 @@ static uint8_t g_device_public_key[HAP_ED25519_PUBLIC_KEY_SIZE];
 static uint8_t g_device_secret_key[HAP_ED25519_SECRET_KEY_SIZE];
 static bool g_initialized = false;
 
+#define HAP_KEYGEN_STACK 4096
+#define HAP_KEYGEN_PRIO  1 // Below everything that streams
+
+// Pair-verify needs a fresh X25519 pair per connection, so the next one is
+// generated in the background and a reconnect only has to do the agreement
+static portMUX_TYPE spare_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool spare_valid;
+static uint8_t spare_public_key[HAP_X25519_KEY_SIZE];
+static uint8_t spare_secret_key[HAP_X25519_KEY_SIZE];
+static TaskHandle_t keygen_task;
+
+static void keygen_task_fn(void *arg) {
+  (void)arg;
+  uint8_t public_key[HAP_X25519_KEY_SIZE];
+  uint8_t secret_key[HAP_X25519_KEY_SIZE];
+
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    taskENTER_CRITICAL(&spare_lock);
+    bool needed = !spare_valid;
+    taskEXIT_CRITICAL(&spare_lock);
+    if (!needed) {
+      continue;
+    }
+
+    crypto_box_keypair(public_key, secret_key);
+
+    taskENTER_CRITICAL(&spare_lock);
+    if (!spare_valid) {
+      memcpy(spare_public_key, public_key, sizeof(public_key));
+      memcpy(spare_secret_key, secret_key, sizeof(secret_key));
+      spare_valid = true;
+    }
+    taskEXIT_CRITICAL(&spare_lock);
+    sodium_memzero(secret_key, sizeof(secret_key));
+  }
+}
+
+static void kick_keygen(void) {
+  if (!keygen_task) {
+    TaskHandle_t handle = NULL;
+    if (xTaskCreate(keygen_task_fn, "hap_keygen", HAP_KEYGEN_STACK, NULL,
+                    HAP_KEYGEN_PRIO, &handle) != pdPASS) {
+      return;
+    }
+    keygen_task = handle;
+  }
+  xTaskNotifyGive(keygen_task);
+}
+
+// Take the spare pair, or generate one inline if the task has not caught up
+static void take_session_keypair(hap_session_t *session) {
+  bool have_pair = false;
+  taskENTER_CRITICAL(&spare_lock);
+  if (spare_valid) {
+    memcpy(session->session_public_key, spare_public_key,
+           HAP_X25519_KEY_SIZE);
+    memcpy(session->session_secret_key, spare_secret_key,
+           HAP_X25519_KEY_SIZE);
+    sodium_memzero(spare_secret_key, sizeof(spare_secret_key));
+    spare_valid = false;
+    have_pair = true;
+  }
+  taskEXIT_CRITICAL(&spare_lock);
+
+  if (!have_pair) {
+    crypto_box_keypair(session->session_public_key,
+                       session->session_secret_key);
+  }
+  kick_keygen();
+}
+
 esp_err_t hap_init(void) {
   if (g_initialized) {
     return ESP_OK;
@@ -66,6 +142,10 @@ esp_err_t hap_init(void) {
 
   nvs_close(nvs);
 
+  // Transient pairing is what iOS uses; have its SRP state ready
+  srp_prepare("Pair-Setup", "3939");
+  kick_keygen();
+
   g_initialized = true;
   return ESP_OK;
 }
@@ -75,7 +155,7 @@ const uint8_t *hap_get_public_key(void) {
 }
 
 hap_session_t *hap_session_create(void) {
-  hap_session_t *session = calloc(1, sizeof(hap_session_t));
+  hap_session_t *session = mem_calloc(MEM_TAG_HAP, sizeof(hap_session_t));
   if (!session) {
     return NULL;
   }
@@ -85,7 +165,7 @@ hap_session_t *hap_session_create(void) {
   memcpy(session->device_secret_key, g_device_secret_key,
          HAP_ED25519_SECRET_KEY_SIZE);
 
-  crypto_box_keypair(session->session_public_key, session->session_secret_key);
+  take_session_keypair(session);
 
   session->pair_verify_state = 0;
   session->session_established = false;
@@ -113,5 +193,5 @@ void hap_session_free(hap_session_t *session) {
   sodium_memzero(session->shared_secret, sizeof(session->shared_secret));
   sodium_memzero(session->encrypt_key, sizeof(session->encrypt_key));
   sodium_memzero(session->decrypt_key, sizeof(session->decrypt_key));
-  free(session);
+  mem_free(MEM_TAG_HAP, session, sizeof(hap_session_t));
 }
@@ -11,6 +11,20 @@
 
 static const char *TAG = "hap_verify";
 
+#define DEVICE_ID_LEN 17 // "AA:BB:CC:DD:EE:FF"
+
+// The MAC does not change, so the identifier is formatted once
+static const char *get_device_id(void) {
+  static char device_id[DEVICE_ID_LEN + 1];
+  if (!device_id[0]) {
+    uint8_t mac[6];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(device_id, sizeof(device_id), "%02X:%02X:%02X:%02X:%02X:%02X",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  }
+  return device_id;
+}
+
 esp_err_t hap_pair_verify_m1(hap_session_t *session, const uint8_t *input,
                              size_t input_len, uint8_t *output,
                              size_t output_capacity, size_t *output_len) {
@@ -38,12 +52,8 @@ esp_err_t hap_pair_verify_m1(hap_session_t *session, const uint8_t *input,
     return ESP_FAIL;
   }
 
-  uint8_t mac[6];
-  esp_read_mac(mac, ESP_MAC_WIFI_STA);
-  char device_id[18];
-  snprintf(device_id, sizeof(device_id), "%02X:%02X:%02X:%02X:%02X:%02X",
-           mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-  size_t device_id_len = 17;
+  const char *device_id = get_device_id();
+  size_t device_id_len = DEVICE_ID_LEN;
 
   uint8_t accessory_info[128];
   size_t accessory_info_len = 0;
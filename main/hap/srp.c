@@ -1,7 +1,11 @@
+#include <stdlib.h>
 #include <string.h>
 #include "esp_log.h"
 #include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "mbedtls/bignum.h"
+#include "mem_budget.h"
 #include "sodium.h"
 
 #include "srp.h"
@@ -45,6 +49,37 @@ static const uint8_t srp_N[] = {
 
 #define SRP_GENERATOR 5
 
+// RFC 5054 asks for at least 256 random bits; a full-width b only makes
+// g^b (the slowest step of M2) twelve times longer
+#define SRP_SECRET_BYTES 32
+
+#define SRP_CACHE_ENTRIES  2 // Transient "3939" and the "0000" PIN
+#define SRP_REFILL_STACK   6144
+#define SRP_REFILL_PRIO    1 // Below everything that streams
+
+// Per-credential state that survives between pairings: the verifier is
+// derived from a salt chosen once, and a spare (b, B) pair is generated
+// in the background so M2 does not wait for a 3072-bit exponentiation.
+typedef struct {
+  bool valid;
+  uint8_t identity[64]; // H(I ":" P), identifies the credentials
+  uint8_t salt[SRP_SALT_BYTES];
+  uint8_t verifier[SRP_PRIME_BYTES]; // v = g^x mod N
+  bool spare_valid;
+  uint8_t spare_secret[SRP_SECRET_BYTES];
+  uint8_t spare_public[SRP_PRIME_BYTES];
+} srp_cache_entry_t;
+
+static portMUX_TYPE cache_lock = portMUX_INITIALIZER_UNLOCKED;
+static srp_cache_entry_t cache[SRP_CACHE_ENTRIES];
+static int cache_next; // Entry replaced when all are taken
+static TaskHandle_t refill_task;
+
+// Group constants, derived once
+static bool constants_ready;
+static uint8_t srp_k[64];    // k = H(N || pad(g)), already < N
+static uint8_t h_Ng_xor[64]; // H(N) ^ H(g), for M1
+
 // Helper: write MPI to buffer with minimum bytes (no leading zeros except for
 // value 0)
 static size_t mpi_to_bytes_min(const mbedtls_mpi *mpi, uint8_t *buf,
@@ -104,120 +139,307 @@ static void compute_m1(uint8_t *out, const uint8_t *h_Ng_xor,
   crypto_hash_sha512_final(&state, out);
 }
 
-srp_session_t *srp_session_create(void) {
-  srp_session_t *session = calloc(1, sizeof(srp_session_t));
-  return session;
-}
+static void compute_constants(void) {
+  uint8_t k_hash[64];
+  uint8_t h_N[64];
+  uint8_t h_g[64];
+  {
+    uint8_t hash_input[SRP_PRIME_BYTES * 2];
+    memcpy(hash_input, srp_N, SRP_PRIME_BYTES);
+    memset(hash_input + SRP_PRIME_BYTES, 0, SRP_PRIME_BYTES);
+    hash_input[SRP_PRIME_BYTES * 2 - 1] = SRP_GENERATOR;
+    crypto_hash_sha512(k_hash, hash_input, sizeof(hash_input));
+  }
+  crypto_hash_sha512(h_N, srp_N, sizeof(srp_N));
+  uint8_t g_byte = SRP_GENERATOR;
+  crypto_hash_sha512(h_g, &g_byte, 1);
 
-void srp_session_free(srp_session_t *session) {
-  if (session) {
-    memset(session, 0, sizeof(srp_session_t));
-    free(session);
+  taskENTER_CRITICAL(&cache_lock);
+  if (!constants_ready) {
+    // N starts with 0xFF, so a 512-bit hash is already reduced mod N
+    memcpy(srp_k, k_hash, sizeof(srp_k));
+    for (int i = 0; i < 64; i++) {
+      h_Ng_xor[i] = h_N[i] ^ h_g[i];
+    }
+    constants_ready = true;
   }
+  taskEXIT_CRITICAL(&cache_lock);
 }
 
-esp_err_t srp_start(srp_session_t *session, const char *username,
-                    const char *password) {
-  if (!session || !username || !password) {
-    return ESP_ERR_INVALID_ARG;
+static void identity_hash(const char *username, const char *password,
+                          uint8_t *out) {
+  crypto_hash_sha512_state state;
+  crypto_hash_sha512_init(&state);
+  crypto_hash_sha512_update(&state, (const uint8_t *)username,
+                            strlen(username));
+  crypto_hash_sha512_update(&state, (const uint8_t *)":", 1);
+  crypto_hash_sha512_update(&state, (const uint8_t *)password,
+                            strlen(password));
+  crypto_hash_sha512_final(&state, out);
+}
+
+// v = g^x mod N, x = H(s || H(I || ":" || P))
+static int compute_verifier(const uint8_t *identity, const uint8_t *salt,
+                            uint8_t *verifier) {
+  uint8_t x_hash[64];
+  crypto_hash_sha512_state state;
+  crypto_hash_sha512_init(&state);
+  crypto_hash_sha512_update(&state, salt, SRP_SALT_BYTES);
+  crypto_hash_sha512_update(&state, identity, 64);
+  crypto_hash_sha512_final(&state, x_hash);
+
+  mbedtls_mpi N, g, x, v;
+  mbedtls_mpi_init(&N);
+  mbedtls_mpi_init(&g);
+  mbedtls_mpi_init(&x);
+  mbedtls_mpi_init(&v);
+
+  int ret = mbedtls_mpi_read_binary(&N, srp_N, sizeof(srp_N));
+  if (ret == 0) {
+    ret = mbedtls_mpi_lset(&g, SRP_GENERATOR);
+  }
+  if (ret == 0) {
+    ret = mbedtls_mpi_read_binary(&x, x_hash, sizeof(x_hash));
+  }
+  if (ret == 0) {
+    ret = mbedtls_mpi_exp_mod(&v, &g, &x, &N, NULL);
+  }
+  if (ret == 0) {
+    ret = mpi_to_bytes_padded(&v, verifier, SRP_PRIME_BYTES);
   }
 
-  mbedtls_mpi N, g, k, v, b, B, x, tmp, tmp2;
+  mbedtls_mpi_free(&N);
+  mbedtls_mpi_free(&g);
+  mbedtls_mpi_free(&x);
+  mbedtls_mpi_free(&v);
+  sodium_memzero(x_hash, sizeof(x_hash));
+  return ret;
+}
+
+// Random b and B = (k*v + g^b) mod N
+static int compute_key_pair(const uint8_t *verifier, uint8_t *secret,
+                            uint8_t *public_key) {
+  esp_fill_random(secret, SRP_SECRET_BYTES);
+
+  mbedtls_mpi N, g, k, v, b, B, tmp;
   mbedtls_mpi_init(&N);
   mbedtls_mpi_init(&g);
   mbedtls_mpi_init(&k);
   mbedtls_mpi_init(&v);
   mbedtls_mpi_init(&b);
   mbedtls_mpi_init(&B);
-  mbedtls_mpi_init(&x);
   mbedtls_mpi_init(&tmp);
-  mbedtls_mpi_init(&tmp2);
 
-  int ret = -1;
+  int ret = mbedtls_mpi_read_binary(&N, srp_N, sizeof(srp_N));
+  if (ret == 0) {
+    ret = mbedtls_mpi_lset(&g, SRP_GENERATOR);
+  }
+  if (ret == 0) {
+    ret = mbedtls_mpi_read_binary(&k, srp_k, sizeof(srp_k));
+  }
+  if (ret == 0) {
+    ret = mbedtls_mpi_read_binary(&v, verifier, SRP_PRIME_BYTES);
+  }
+  if (ret == 0) {
+    ret = mbedtls_mpi_read_binary(&b, secret, SRP_SECRET_BYTES);
+  }
+  if (ret == 0) {
+    ret = mbedtls_mpi_exp_mod(&tmp, &g, &b, &N, NULL);
+  }
+  if (ret == 0) {
+    ret = mbedtls_mpi_mul_mpi(&B, &k, &v);
+  }
+  if (ret == 0) {
+    ret = mbedtls_mpi_add_mpi(&B, &B, &tmp);
+  }
+  if (ret == 0) {
+    ret = mbedtls_mpi_mod_mpi(&B, &B, &N);
+  }
+  if (ret == 0) {
+    ret = mpi_to_bytes_padded(&B, public_key, SRP_PRIME_BYTES);
+  }
 
-  // Generate random salt
-  esp_fill_random(session->salt, SRP_SALT_BYTES);
+  mbedtls_mpi_free(&N);
+  mbedtls_mpi_free(&g);
+  mbedtls_mpi_free(&k);
+  mbedtls_mpi_free(&v);
+  mbedtls_mpi_free(&b);
+  mbedtls_mpi_free(&B);
+  mbedtls_mpi_free(&tmp);
+  return ret;
+}
 
-  // Load N and g
-  mbedtls_mpi_read_binary(&N, srp_N, sizeof(srp_N));
-  mbedtls_mpi_lset(&g, SRP_GENERATOR);
+// Background task: keep one spare (b, B) pair per cached verifier
+static void refill_task_fn(void *arg) {
+  (void)arg;
+  uint8_t *verifier = malloc(SRP_PRIME_BYTES);
+  uint8_t *public_key = malloc(SRP_PRIME_BYTES);
+  uint8_t secret[SRP_SECRET_BYTES];
+  uint8_t identity[64];
+
+  while (verifier && public_key) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    for (int i = 0; i < SRP_CACHE_ENTRIES; i++) {
+      bool needed = false;
+      taskENTER_CRITICAL(&cache_lock);
+      if (cache[i].valid && !cache[i].spare_valid) {
+        memcpy(identity, cache[i].identity, sizeof(identity));
+        memcpy(verifier, cache[i].verifier, SRP_PRIME_BYTES);
+        needed = true;
+      }
+      taskEXIT_CRITICAL(&cache_lock);
+      if (!needed || compute_key_pair(verifier, secret, public_key) != 0) {
+        continue;
+      }
+
+      taskENTER_CRITICAL(&cache_lock);
+      if (cache[i].valid && !cache[i].spare_valid &&
+          memcmp(cache[i].identity, identity, sizeof(identity)) == 0) {
+        memcpy(cache[i].spare_secret, secret, SRP_SECRET_BYTES);
+        memcpy(cache[i].spare_public, public_key, SRP_PRIME_BYTES);
+        cache[i].spare_valid = true;
+      }
+      taskEXIT_CRITICAL(&cache_lock);
+      sodium_memzero(secret, sizeof(secret));
+    }
+  }
 
-  // k = H(N || pad(g))
-  {
-    uint8_t hash_input[SRP_PRIME_BYTES * 2];
-    memcpy(hash_input, srp_N, SRP_PRIME_BYTES);
-    memset(hash_input + SRP_PRIME_BYTES, 0, SRP_PRIME_BYTES);
-    hash_input[SRP_PRIME_BYTES * 2 - 1] = SRP_GENERATOR;
+  ESP_LOGE(TAG, "SRP refill task out of memory");
+  free(verifier);
+  free(public_key);
+  refill_task = NULL;
+  vTaskDelete(NULL);
+}
 
-    uint8_t k_hash[64];
-    crypto_hash_sha512(k_hash, hash_input, sizeof(hash_input));
-    mbedtls_mpi_read_binary(&k, k_hash, 64);
-    mbedtls_mpi_mod_mpi(&k, &k, &N);
+static void kick_refill(void) {
+  if (!refill_task) {
+    TaskHandle_t handle = NULL;
+    if (xTaskCreate(refill_task_fn, "srp_refill", SRP_REFILL_STACK, NULL,
+                    SRP_REFILL_PRIO, &handle) != pdPASS) {
+      return;
+    }
+    refill_task = handle;
   }
+  xTaskNotifyGive(refill_task);
+}
 
-  // x = H(s || H(I || ":" || P))
-  {
-    uint8_t inner_hash[64];
-    crypto_hash_sha512_state state;
-    crypto_hash_sha512_init(&state);
-    crypto_hash_sha512_update(&state, (const uint8_t *)username,
-                              strlen(username));
-    crypto_hash_sha512_update(&state, (const uint8_t *)":", 1);
-    crypto_hash_sha512_update(&state, (const uint8_t *)password,
-                              strlen(password));
-    crypto_hash_sha512_final(&state, inner_hash);
-
-    uint8_t x_hash[64];
-    crypto_hash_sha512_init(&state);
-    crypto_hash_sha512_update(&state, session->salt, SRP_SALT_BYTES);
-    crypto_hash_sha512_update(&state, inner_hash, 64);
-    crypto_hash_sha512_final(&state, x_hash);
+// Find or create the cache entry for these credentials; copies its salt
+// and verifier, and takes the spare key pair if there is one
+static esp_err_t load_credentials(const uint8_t *identity,
+                                  srp_session_t *session, bool *have_pair) {
+  *have_pair = false;
+  bool found = false;
+
+  taskENTER_CRITICAL(&cache_lock);
+  for (int i = 0; i < SRP_CACHE_ENTRIES; i++) {
+    srp_cache_entry_t *entry = &cache[i];
+    if (!entry->valid || memcmp(entry->identity, identity, 64) != 0) {
+      continue;
+    }
+    memcpy(session->salt, entry->salt, SRP_SALT_BYTES);
+    memcpy(session->verifier, entry->verifier, SRP_PRIME_BYTES);
+    if (entry->spare_valid) {
+      memset(session->server_secret, 0, SRP_PRIME_BYTES);
+      memcpy(session->server_secret + SRP_PRIME_BYTES - SRP_SECRET_BYTES,
+             entry->spare_secret, SRP_SECRET_BYTES);
+      memcpy(session->server_public_key, entry->spare_public,
+             SRP_PRIME_BYTES);
+      entry->spare_valid = false;
+      *have_pair = true;
+    }
+    found = true;
+    break;
+  }
+  taskEXIT_CRITICAL(&cache_lock);
+  if (found) {
+    return ESP_OK;
+  }
+
+  esp_fill_random(session->salt, SRP_SALT_BYTES);
+  if (compute_verifier(identity, session->salt, session->verifier) != 0) {
+    return ESP_FAIL;
+  }
+
+  taskENTER_CRITICAL(&cache_lock);
+  srp_cache_entry_t *entry = &cache[cache_next];
+  cache_next = (cache_next + 1) % SRP_CACHE_ENTRIES;
+  entry->valid = true;
+  entry->spare_valid = false;
+  memcpy(entry->identity, identity, 64);
+  memcpy(entry->salt, session->salt, SRP_SALT_BYTES);
+  memcpy(entry->verifier, session->verifier, SRP_PRIME_BYTES);
+  taskEXIT_CRITICAL(&cache_lock);
+  return ESP_OK;
+}
 
-    mbedtls_mpi_read_binary(&x, x_hash, 64);
+esp_err_t srp_prepare(const char *username, const char *password) {
+  if (!username || !password) {
+    return ESP_ERR_INVALID_ARG;
   }
 
-  // v = g^x mod N
-  if (mbedtls_mpi_exp_mod(&v, &g, &x, &N, NULL) != 0) {
-    goto cleanup;
+  srp_session_t *session = srp_session_create();
+  if (!session) {
+    return ESP_ERR_NO_MEM;
   }
 
-  // Generate random b (server secret)
-  {
-    uint8_t b_bytes[SRP_PRIME_BYTES];
-    esp_fill_random(b_bytes, sizeof(b_bytes));
-    mbedtls_mpi_read_binary(&b, b_bytes, sizeof(b_bytes));
-    mbedtls_mpi_mod_mpi(&b, &b, &N);
-    mpi_to_bytes_padded(&b, session->server_secret, SRP_PRIME_BYTES);
+  compute_constants();
+  uint8_t identity[64];
+  identity_hash(username, password, identity);
+  bool have_pair;
+  esp_err_t err = load_credentials(identity, session, &have_pair);
+  srp_session_free(session);
+  if (err == ESP_OK) {
+    kick_refill();
   }
+  return err;
+}
 
-  // B = (k*v + g^b) mod N
-  if (mbedtls_mpi_exp_mod(&tmp, &g, &b, &N, NULL) != 0) {
-    goto cleanup;
+srp_session_t *srp_session_create(void) {
+  srp_session_t *session = mem_calloc(MEM_TAG_HAP, sizeof(srp_session_t));
+  return session;
+}
+
+void srp_session_free(srp_session_t *session) {
+  if (session) {
+    memset(session, 0, sizeof(srp_session_t));
+    mem_free(MEM_TAG_HAP, session, sizeof(srp_session_t));
   }
-  if (mbedtls_mpi_mul_mpi(&tmp2, &k, &v) != 0) {
-    goto cleanup;
+}
+
+esp_err_t srp_start(srp_session_t *session, const char *username,
+                    const char *password) {
+  if (!session || !username || !password) {
+    return ESP_ERR_INVALID_ARG;
   }
-  if (mbedtls_mpi_add_mpi(&B, &tmp2, &tmp) != 0) {
-    goto cleanup;
+
+  compute_constants();
+
+  uint8_t identity[64];
+  identity_hash(username, password, identity);
+
+  bool have_pair = false;
+  if (load_credentials(identity, session, &have_pair) != ESP_OK) {
+    return ESP_FAIL;
   }
-  mbedtls_mpi_mod_mpi(&B, &B, &N);
 
-  mpi_to_bytes_padded(&B, session->server_public_key, SRP_PRIME_BYTES);
-  session->state = 1;
-  ret = 0;
+  if (!have_pair) {
+    uint8_t secret[SRP_SECRET_BYTES];
+    if (compute_key_pair(session->verifier, secret,
+                         session->server_public_key) != 0) {
+      return ESP_FAIL;
+    }
+    memset(session->server_secret, 0, SRP_PRIME_BYTES);
+    memcpy(session->server_secret + SRP_PRIME_BYTES - SRP_SECRET_BYTES,
+           secret, SRP_SECRET_BYTES);
+    sodium_memzero(secret, sizeof(secret));
+  }
 
-cleanup:
-  mbedtls_mpi_free(&N);
-  mbedtls_mpi_free(&g);
-  mbedtls_mpi_free(&k);
-  mbedtls_mpi_free(&v);
-  mbedtls_mpi_free(&b);
-  mbedtls_mpi_free(&B);
-  mbedtls_mpi_free(&x);
-  mbedtls_mpi_free(&tmp);
-  mbedtls_mpi_free(&tmp2);
+  // Have the next pairing's key pair ready
+  kick_refill();
 
-  return ret == 0 ? ESP_OK : ESP_FAIL;
+  session->state = 1;
+  return ESP_OK;
 }
 
 const uint8_t *srp_get_salt(srp_session_t *session) {
@@ -251,7 +473,7 @@ esp_err_t srp_verify_client(srp_session_t *session,
   memcpy(session->client_public_key + (SRP_PRIME_BYTES - client_pk_len),
          client_public_key, client_pk_len);
 
-  mbedtls_mpi N, g, A, B, b, u, S, k, v, x, tmp, tmp2;
+  mbedtls_mpi N, g, A, B, b, u, S, v, tmp, tmp2;
   mbedtls_mpi_init(&N);
   mbedtls_mpi_init(&g);
   mbedtls_mpi_init(&A);
@@ -259,9 +481,7 @@ esp_err_t srp_verify_client(srp_session_t *session,
   mbedtls_mpi_init(&b);
   mbedtls_mpi_init(&u);
   mbedtls_mpi_init(&S);
-  mbedtls_mpi_init(&k);
   mbedtls_mpi_init(&v);
-  mbedtls_mpi_init(&x);
   mbedtls_mpi_init(&tmp);
   mbedtls_mpi_init(&tmp2);
 
@@ -296,41 +516,8 @@ esp_err_t srp_verify_client(srp_session_t *session,
     mbedtls_mpi_read_binary(&u, u_hash, 64);
   }
 
-  // Recompute k = H(N || pad(g))
-  {
-    uint8_t hash_input[SRP_PRIME_BYTES * 2];
-    memcpy(hash_input, srp_N, SRP_PRIME_BYTES);
-    memset(hash_input + SRP_PRIME_BYTES, 0, SRP_PRIME_BYTES);
-    hash_input[SRP_PRIME_BYTES * 2 - 1] = SRP_GENERATOR;
-    uint8_t k_hash[64];
-    crypto_hash_sha512(k_hash, hash_input, sizeof(hash_input));
-    mbedtls_mpi_read_binary(&k, k_hash, 64);
-    mbedtls_mpi_mod_mpi(&k, &k, &N);
-  }
-
-  // Recompute x = H(s || H(I || ":" || P)) for "Pair-Setup:3939"
-  {
-    uint8_t inner_hash[64];
-    crypto_hash_sha512_state state;
-    crypto_hash_sha512_init(&state);
-    crypto_hash_sha512_update(&state, (const uint8_t *)"Pair-Setup", 10);
-    crypto_hash_sha512_update(&state, (const uint8_t *)":", 1);
-    crypto_hash_sha512_update(&state, (const uint8_t *)"3939", 4);
-    crypto_hash_sha512_final(&state, inner_hash);
-
-    uint8_t x_hash[64];
-    crypto_hash_sha512_init(&state);
-    crypto_hash_sha512_update(&state, session->salt, SRP_SALT_BYTES);
-    crypto_hash_sha512_update(&state, inner_hash, 64);
-    crypto_hash_sha512_final(&state, x_hash);
-
-    mbedtls_mpi_read_binary(&x, x_hash, 64);
-  }
-
-  // v = g^x mod N
-  if (mbedtls_mpi_exp_mod(&v, &g, &x, &N, NULL) != 0) {
-    goto cleanup;
-  }
+  // v was cached by srp_start()
+  mbedtls_mpi_read_binary(&v, session->verifier, SRP_PRIME_BYTES);
 
   // S = (A * v^u)^b mod N
   if (mbedtls_mpi_exp_mod(&tmp, &v, &u, &N, NULL) != 0) {
@@ -353,21 +540,6 @@ esp_err_t srp_verify_client(srp_session_t *session,
   // Compute expected M1 = H(H(N)^H(g) || H(I) || s || A || B || K)
   uint8_t expected_m1[64];
   {
-    // H(N)
-    uint8_t h_N[64];
-    crypto_hash_sha512(h_N, srp_N, sizeof(srp_N));
-
-    // H(g)
-    uint8_t g_byte = SRP_GENERATOR;
-    uint8_t h_g[64];
-    crypto_hash_sha512(h_g, &g_byte, 1);
-
-    // H(N) ^ H(g)
-    uint8_t h_Ng_xor[64];
-    for (int i = 0; i < 64; i++) {
-      h_Ng_xor[i] = h_N[i] ^ h_g[i];
-    }
-
     // H(I) where I = "Pair-Setup"
     uint8_t h_I[64];
     crypto_hash_sha512(h_I, (const uint8_t *)"Pair-Setup", 10);
@@ -418,9 +590,7 @@ cleanup:
   mbedtls_mpi_free(&b);
   mbedtls_mpi_free(&u);
   mbedtls_mpi_free(&S);
-  mbedtls_mpi_free(&k);
   mbedtls_mpi_free(&v);
-  mbedtls_mpi_free(&x);
   mbedtls_mpi_free(&tmp);
   mbedtls_mpi_free(&tmp2);
 
@@ -22,6 +22,7 @@ typedef struct srp_session {
   uint8_t salt[SRP_SALT_BYTES];
   uint8_t server_public_key[SRP_PRIME_BYTES]; // B
   uint8_t server_secret[SRP_PRIME_BYTES];     // b
+  uint8_t verifier[SRP_PRIME_BYTES];          // v, shared by all pairings
   uint8_t client_public_key[SRP_PRIME_BYTES]; // A
   uint8_t session_key[SRP_SESSION_KEY_BYTES]; // K
   size_t session_key_len;
@@ -41,8 +42,17 @@ srp_session_t *srp_session_create(void);
  */
 void srp_session_free(srp_session_t *session);
 
+/**
+ * Derive and cache the verifier for these credentials and generate a spare
+ * server key pair in a low-priority background task, so a later
+ * srp_start() with the same credentials only copies them.
+ */
+esp_err_t srp_prepare(const char *username, const char *password);
+
 /**
  * Start SRP session (generate salt and server public key B)
+ * Salt and verifier are cached per credentials; B comes from the spare
+ * pair made in the background when there is one.
  * For transient pairing, username="Pair-Setup" and password="3939"
  *
  * @param session SRP session
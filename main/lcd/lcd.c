@@ -15,6 +15,7 @@
 #include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "hd44780.h"
+#include "mem_budget.h"
 #include "rtsp_events.h"
 
 static const char *TAG = "lcd";
@@ -28,15 +29,19 @@ static const char *TAG = "lcd";
 #endif
 
 typedef struct {
-  char title[128];
-  int64_t progress_start;
-  int64_t progress_current;
-  int64_t progress_end;
+  int64_t start;
+  int64_t current;
+  int64_t end;
   int sample_rate;
   double rate;
-  int64_t progress_base_us;
-  bool has_title;
-  bool has_progress;
+  int64_t base_us; // When current was reported
+  bool valid;
+} lcd_progress_t;
+
+typedef struct {
+  char title[128];
+  uint32_t title_rev; // Bumped on every title change
+  lcd_progress_t progress;
 } lcd_now_playing_t;
 
 static SemaphoreHandle_t s_mutex;
@@ -49,6 +54,14 @@ static uint8_t s_i2c_addr;
 static hd44780_t s_lcd;
 static lcd_now_playing_t s_now_playing;
 
+#if CONFIG_LCD_MODE_I2C
+// Expander bytes of one update, sent as a single I2C transaction
+#define LCD_I2C_BATCH_MAX 128
+static uint8_t s_i2c_batch[LCD_I2C_BATCH_MAX];
+static size_t s_i2c_batch_len;
+static bool s_i2c_batching;
+#endif
+
 static const uint8_t s_char_music_note[8] = {
     0x02, 0x03, 0x02, 0x0E, 0x1E, 0x0C, 0x00, 0x00,
 };
@@ -115,9 +128,39 @@ static int lcd_i2c_scan(uint8_t *out_addrs, size_t out_capacity) {
   return found;
 }
 
+static esp_err_t lcd_i2c_flush(void) {
+  esp_err_t err = ESP_OK;
+  if (s_i2c_batch_len > 0) {
+    err = i2c_master_write_to_device(s_i2c_port, s_i2c_addr, s_i2c_batch,
+                                     s_i2c_batch_len, pdMS_TO_TICKS(100));
+    s_i2c_batch_len = 0;
+  }
+  return err;
+}
+
+// The expander latches every byte it acks, so the E strobes of several
+// characters can share one transaction; at 100 kHz each byte takes longer
+// than an HD44780 write cycle
 static esp_err_t write_lcd_data(const hd44780_t *lcd, uint8_t data) {
   (void)lcd;
-  return lcd_i2c_write(data);
+  if (!s_i2c_batching) {
+    return lcd_i2c_write(data);
+  }
+  esp_err_t err = ESP_OK;
+  if (s_i2c_batch_len == sizeof(s_i2c_batch)) {
+    err = lcd_i2c_flush();
+  }
+  s_i2c_batch[s_i2c_batch_len++] = data;
+  return err;
+}
+
+static void lcd_batch_begin(void) {
+  s_i2c_batching = true;
+}
+
+static void lcd_batch_end(void) {
+  lcd_i2c_flush();
+  s_i2c_batching = false;
 }
 
 static esp_err_t lcd_i2c_init(void) {
@@ -145,6 +188,12 @@ static esp_err_t lcd_i2c_init(void) {
   }
   return err;
 }
+#else
+static void lcd_batch_begin(void) {
+}
+
+static void lcd_batch_end(void) {
+}
 #endif
 
 static void lcd_format_title15(char out[16], const char *title, int scroll_off) {
@@ -192,48 +241,51 @@ static void clamp_m_ss(uint32_t in_sec, uint8_t *out_min, uint8_t *out_sec) {
   *out_sec = (uint8_t)(in_sec % 60);
 }
 
-static void lcd_format_progress_bar(char out[17], const lcd_now_playing_t *np,
-                                    int64_t now_us) {
+// Formats line 2 and sets *next_us to when it will next change on its own
+// (INT64_MAX while it is static)
+static void lcd_format_progress_bar(char out[17], const lcd_progress_t *p,
+                                    int64_t now_us, int64_t *next_us) {
   // Default placeholder
   memcpy(out, "0:00----|---0:00", 16);
   out[16] = '\0';
+  *next_us = INT64_MAX;
 
-  if (!np->has_progress || np->progress_end <= np->progress_start ||
-      np->sample_rate <= 0) {
+  if (!p->valid || p->end <= p->start || p->sample_rate <= 0) {
     return;
   }
 
-  int64_t cur = np->progress_current;
-  if (np->progress_base_us > 0 && audio_receiver_is_playing()) {
-    int64_t elapsed_us = now_us - np->progress_base_us;
+  double rate = p->rate > 0.01 ? p->rate : 1.0;
+  bool running = p->base_us > 0 && audio_receiver_is_playing();
+  int64_t cur = p->current;
+  if (running) {
+    int64_t elapsed_us = now_us - p->base_us;
     if (elapsed_us > 0) {
-      double rate = np->rate;
-      if (rate <= 0.01) {
-        rate = 1.0;
-      }
-      cur += (int64_t)((elapsed_us * (double)np->sample_rate * rate) /
+      cur += (int64_t)((elapsed_us * (double)p->sample_rate * rate) /
                        1000000.0);
     }
   }
 
-  if (cur < np->progress_start) {
-    cur = np->progress_start;
+  if (cur < p->start) {
+    cur = p->start;
   }
-  if (cur > np->progress_end) {
-    cur = np->progress_end;
+  if (cur > p->end) {
+    cur = p->end;
   }
 
-  int64_t pos_samples = cur - np->progress_start;
-  int64_t dur_samples = np->progress_end - np->progress_start;
-  if (pos_samples < 0) {
-    pos_samples = 0;
-  }
-  if (dur_samples <= 0) {
-    return;
+  int64_t pos_samples = cur - p->start;
+  int64_t dur_samples = p->end - p->start;
+
+  if (running && cur < p->end) {
+    // Wake just after the displayed second rolls over
+    int64_t to_next = p->sample_rate - pos_samples % p->sample_rate;
+    *next_us = now_us +
+               (int64_t)((double)to_next * 1000000.0 /
+                         ((double)p->sample_rate * rate)) +
+               1000;
   }
 
-  uint32_t pos_sec = (uint32_t)(pos_samples / np->sample_rate);
-  uint32_t dur_sec = (uint32_t)(dur_samples / np->sample_rate);
+  uint32_t pos_sec = (uint32_t)(pos_samples / p->sample_rate);
+  uint32_t dur_sec = (uint32_t)(dur_samples / p->sample_rate);
 
   uint8_t pos_m = 0, pos_s = 0, dur_m = 0, dur_s = 0;
   clamp_m_ss(pos_sec, &pos_m, &pos_s);
@@ -258,35 +310,114 @@ static void lcd_format_progress_bar(char out[17], const lcd_now_playing_t *np,
   memcpy(out + 12, right, 4);
 }
 
-static void on_rtsp_event(rtsp_event_t event, void *user_data) {
+static bool is_all_ascii_printable(const char *s) {
+  if (!s || !*s) {
+    return false;
+  }
+  for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+    if (*p < 0x20 || *p > 0x7e) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void show_now_playing(const rtsp_now_playing_t *np) {
+  // 1602 LCD can't reliably show UTF-8; prefer ASCII fields if available.
+  const char *best = NULL;
+  if (is_all_ascii_printable(np->title)) {
+    best = np->title;
+  } else if (is_all_ascii_printable(np->album)) {
+    best = np->album;
+  } else if (is_all_ascii_printable(np->artist)) {
+    best = np->artist;
+  } else if (np->title[0]) {
+    best = np->title;
+  } else if (np->album[0]) {
+    best = np->album;
+  } else if (np->artist[0]) {
+    best = np->artist;
+  }
+
+  if (best) {
+    lcd_now_playing_set_title(best);
+  }
+}
+
+static void lcd_notify(void);
+
+static void on_rtsp_event(rtsp_event_t event, const rtsp_event_data_t *data,
+                          void *user_data) {
   (void)user_data;
   if (event == RTSP_EVENT_DISCONNECTED) {
     lcd_now_playing_clear();
+  } else if (event == RTSP_EVENT_METADATA) {
+    show_now_playing(data->now_playing);
+  } else {
+    lcd_notify(); // Play state moves the progress clock
+  }
+}
+
+// Write the cells of one row that differ from what is shown, moving the
+// cursor only across unchanged cells
+static void lcd_update_row(char shown[16], const char frame[16], uint8_t row) {
+  int cursor = -1;
+  for (int col = 0; col < 16; col++) {
+    if (frame[col] == shown[col]) {
+      continue;
+    }
+    if (cursor != col) {
+      hd44780_gotoxy(&s_lcd, (uint8_t)col, row);
+    }
+    hd44780_putc(&s_lcd, frame[col]);
+    shown[col] = frame[col];
+    cursor = col + 1;
   }
 }
 
+static TickType_t ticks_until(int64_t deadline_us, int64_t now_us) {
+  if (deadline_us == INT64_MAX) {
+    return portMAX_DELAY;
+  }
+  int64_t wait_ms = (deadline_us - now_us + 999) / 1000;
+  if (wait_ms <= 0) {
+    return 0;
+  }
+  TickType_t ticks = pdMS_TO_TICKS(wait_ms);
+  return ticks > 0 ? ticks : 1;
+}
+
+// Renders on now-playing changes (task notifications), marquee steps and
+// progress second rollovers; nothing is polled
 static void lcd_task(void *pvParameters) {
   (void)pvParameters;
 
-  char last_title[128] = {0};
-  char title15_prev[16] = {0};
-  char line2_prev[17] = {0};
+  char title[128] = {0};
+  uint32_t title_rev = 0;
+  char shown[2][16];
+  memset(shown, 0xFF, sizeof(shown)); // Force a full first frame
 
   int scroll_offset = 0;
   int64_t next_scroll_us = 0;
   int64_t reset_wait_until_us = 0;
+  int64_t last_render_us = 0;
 
   while (1) {
-    lcd_now_playing_t np = {0};
+    lcd_progress_t progress = {0};
+    bool title_changed = false;
     if (s_mutex && xSemaphoreTake(s_mutex, pdMS_TO_TICKS(50)) == pdTRUE) {
-      np = s_now_playing;
+      progress = s_now_playing.progress;
+      if (s_now_playing.title_rev != title_rev) {
+        memcpy(title, s_now_playing.title, sizeof(title));
+        title_rev = s_now_playing.title_rev;
+        title_changed = true;
+      }
       xSemaphoreGive(s_mutex);
     }
 
     int64_t now_us = esp_timer_get_time();
 
-    if (strcmp(last_title, np.title) != 0) {
-      strlcpy(last_title, np.title, sizeof(last_title));
+    if (title_changed) {
       scroll_offset = 0;
       // Initial pause before starting marquee scroll
       reset_wait_until_us =
@@ -294,12 +425,11 @@ static void lcd_task(void *pvParameters) {
       next_scroll_us = 0;
     }
 
-    char line2[17];
-    const char *title = np.has_title ? np.title : "";
+    int64_t next_us = INT64_MAX;
     size_t title_len = strlen(title);
     if (title_len > 15) {
       const int pattern_len = (int)(title_len + 2);
-      if (pattern_len > 0 && reset_wait_until_us > 0) {
+      if (reset_wait_until_us > 0) {
         // Hold initial position during the reset-wait window.
         if (now_us >= reset_wait_until_us) {
           reset_wait_until_us = 0;
@@ -307,7 +437,7 @@ static void lcd_task(void *pvParameters) {
         } else {
           scroll_offset = 0;
         }
-      } else if (pattern_len > 0 && now_us >= next_scroll_us) {
+      } else if (now_us >= next_scroll_us) {
         scroll_offset = (scroll_offset + 1) % pattern_len;
         if (scroll_offset == 0) {
           reset_wait_until_us =
@@ -317,31 +447,38 @@ static void lcd_task(void *pvParameters) {
           next_scroll_us = now_us + (int64_t)CONFIG_I2C_LCD_SCROLL_MS * 1000;
         }
       }
+      next_us = reset_wait_until_us > 0 ? reset_wait_until_us : next_scroll_us;
     } else {
       scroll_offset = 0;
       reset_wait_until_us = 0;
       next_scroll_us = 0;
     }
 
-    char title15[16];
-    lcd_format_title15(title15, title, scroll_offset);
+    char frame[2][17];
+    frame[0][0] = 0; // custom char 0: music note
+    lcd_format_title15(&frame[0][1], title, scroll_offset);
 
-    if (memcmp(title15, title15_prev, sizeof(title15_prev)) != 0) {
-      hd44780_gotoxy(&s_lcd, 0, 0);
-      hd44780_putc(&s_lcd, 0); // custom char 0: music note
-      hd44780_puts(&s_lcd, title15);
-      memcpy(title15_prev, title15, sizeof(title15_prev));
+    int64_t progress_next_us;
+    lcd_format_progress_bar(frame[1], &progress, now_us, &progress_next_us);
+    if (progress_next_us < next_us) {
+      next_us = progress_next_us;
     }
 
-    lcd_format_progress_bar(line2, &np, now_us);
+    lcd_batch_begin();
+    lcd_update_row(shown[0], frame[0], 0);
+    lcd_update_row(shown[1], frame[1], 1);
+    lcd_batch_end();
+    last_render_us = now_us;
 
-    if (strcmp(line2, line2_prev) != 0) {
-      hd44780_gotoxy(&s_lcd, 0, 1);
-      hd44780_puts(&s_lcd, line2);
-      strlcpy(line2_prev, line2, sizeof(line2_prev));
-    }
+    ulTaskNotifyTake(pdTRUE, ticks_until(next_us, esp_timer_get_time()));
 
-    vTaskDelay(pdMS_TO_TICKS(CONFIG_I2C_LCD_UPDATE_MS));
+    // Coalesce bursts of updates (title, progress and rate usually arrive
+    // together)
+    int64_t since_us = esp_timer_get_time() - last_render_us;
+    int64_t min_us = (int64_t)CONFIG_I2C_LCD_UPDATE_MS * 1000;
+    if (since_us < min_us) {
+      vTaskDelay(ticks_until(min_us - since_us, 0));
+    }
   }
 }
 
@@ -355,11 +492,12 @@ esp_err_t lcd_init(void) {
     return ESP_ERR_NO_MEM;
   }
 
+  esp_err_t err;
 #if CONFIG_LCD_MODE_I2C
   s_i2c_port = (i2c_port_t)CONFIG_I2C_LCD_I2C_PORT;
   s_i2c_addr = (uint8_t)CONFIG_I2C_LCD_I2C_ADDR;
 
-  esp_err_t err = lcd_i2c_init();
+  err = lcd_i2c_init();
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "I2C init failed: %s", esp_err_to_name(err));
     return err;
@@ -433,7 +571,7 @@ esp_err_t lcd_init(void) {
   };
 #endif
 
-  esp_err_t err = hd44780_init(&s_lcd);
+  err = hd44780_init(&s_lcd);
   if (err != ESP_OK) {
 #if CONFIG_LCD_MODE_I2C
     ESP_LOGE(TAG, "LCD init failed (addr=0x%02x): %s", s_i2c_addr,
@@ -463,6 +601,7 @@ esp_err_t lcd_init(void) {
     s_task = NULL;
     return ESP_ERR_NO_MEM;
   }
+  mem_account(MEM_TAG_LCD, 4096);
 
 #if CONFIG_LCD_MODE_I2C
   ESP_LOGI(TAG, "I2C LCD initialized (SDA=%d SCL=%d addr=0x%02x)",
@@ -477,6 +616,12 @@ esp_err_t lcd_init(void) {
   return ESP_OK;
 }
 
+static void lcd_notify(void) {
+  if (s_task) {
+    xTaskNotifyGive(s_task);
+  }
+}
+
 void lcd_now_playing_set_title(const char *title) {
   if (!s_mutex) {
     return;
@@ -485,10 +630,18 @@ void lcd_now_playing_set_title(const char *title) {
     return;
   }
 
-  sanitize_ascii(s_now_playing.title, sizeof(s_now_playing.title), title);
-  s_now_playing.has_title = s_now_playing.title[0] != '\0';
+  char sanitized[sizeof(s_now_playing.title)];
+  sanitize_ascii(sanitized, sizeof(sanitized), title);
+  bool changed = strcmp(sanitized, s_now_playing.title) != 0;
+  if (changed) {
+    memcpy(s_now_playing.title, sanitized, sizeof(sanitized));
+    s_now_playing.title_rev++;
+  }
 
   xSemaphoreGive(s_mutex);
+  if (changed) {
+    lcd_notify();
+  }
 }
 
 void lcd_now_playing_set_progress(int64_t start, int64_t current, int64_t end,
@@ -500,14 +653,16 @@ void lcd_now_playing_set_progress(int64_t start, int64_t current, int64_t end,
     return;
   }
 
-  s_now_playing.progress_start = start;
-  s_now_playing.progress_current = current;
-  s_now_playing.progress_end = end;
-  s_now_playing.sample_rate = sample_rate > 0 ? sample_rate : 44100;
-  s_now_playing.progress_base_us = esp_timer_get_time();
-  s_now_playing.has_progress = (end > start);
+  lcd_progress_t *p = &s_now_playing.progress;
+  p->start = start;
+  p->current = current;
+  p->end = end;
+  p->sample_rate = sample_rate > 0 ? sample_rate : 44100;
+  p->base_us = esp_timer_get_time();
+  p->valid = (end > start);
 
   xSemaphoreGive(s_mutex);
+  lcd_notify();
 }
 
 void lcd_now_playing_set_rate(double rate) {
@@ -518,9 +673,10 @@ void lcd_now_playing_set_rate(double rate) {
     return;
   }
 
-  s_now_playing.rate = rate;
+  s_now_playing.progress.rate = rate;
 
   xSemaphoreGive(s_mutex);
+  lcd_notify();
 }
 
 void lcd_now_playing_clear(void) {
@@ -531,10 +687,13 @@ void lcd_now_playing_clear(void) {
     return;
   }
 
+  uint32_t title_rev = s_now_playing.title_rev;
   memset(&s_now_playing, 0, sizeof(s_now_playing));
-  s_now_playing.rate = 1.0;
+  s_now_playing.title_rev = title_rev + 1;
+  s_now_playing.progress.rate = 1.0;
 
   xSemaphoreGive(s_mutex);
+  lcd_notify();
 }
 
 #else
@@ -3,6 +3,7 @@
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "freertos/timers.h"
 #include "rtsp_events.h"
 
@@ -11,6 +12,8 @@
 #endif
 
 #include <math.h>
+#include <stdatomic.h>
+#include <string.h>
 
 static const char *TAG = "led";
 
@@ -449,8 +452,10 @@ static void apply_state(led_state_t state) {
   }
 }
 
-static void on_rtsp_event(rtsp_event_t event, void *user_data) {
+static void on_rtsp_event(rtsp_event_t event, const rtsp_event_data_t *data,
+                          void *user_data) {
   (void)user_data;
+  (void)data;
 
   switch (event) {
   case RTSP_EVENT_CLIENT_CONNECTED:
@@ -465,6 +470,8 @@ static void on_rtsp_event(rtsp_event_t event, void *user_data) {
   case RTSP_EVENT_DISCONNECTED:
     apply_state(STATE_STANDBY);
     break;
+  default:
+    break;
   }
 }
 
@@ -474,37 +481,91 @@ static void on_rtsp_event(rtsp_event_t event, void *user_data) {
 
 #define SILENCE_THRESH     200
 #define UPDATE_INTERVAL_US (1000000 / 30) // ~30 Hz
-
+#define VU_MAX_SAMPLES     512            // Stereo samples kept per snapshot
+#define VU_TASK_PRIORITY   2
+#define VU_TASK_STACK      3072
+#define VU_CORE            0 // Away from playback unless single-core
+
+// The playback task copies one block per update interval into the snapshot
+// and wakes the VU task, which does the math and drives the LEDs. While
+// s_vu_busy is set the snapshot belongs to the VU task and feeds are
+// skipped; a late meter is harmless, a late I2S write is not.
+static int16_t s_vu_pcm[VU_MAX_SAMPLES * 2];
+static size_t s_vu_samples;
+static atomic_bool s_vu_busy;
+static TaskHandle_t s_vu_task = NULL;
 static int64_t s_last_update_us = 0;
 
 void led_audio_feed(const int16_t *pcm, size_t stereo_samples) {
-  if (stereo_samples == 0 || s_current_state != STATE_PLAYING) {
+  if (stereo_samples == 0 || s_current_state != STATE_PLAYING || !s_vu_task) {
     return;
   }
 
   // Rate limit to ~30 Hz
   int64_t now = esp_timer_get_time();
-  if (now - s_last_update_us < UPDATE_INTERVAL_US) {
+  if (now - s_last_update_us < UPDATE_INTERVAL_US ||
+      atomic_load(&s_vu_busy)) {
     return;
   }
   s_last_update_us = now;
 
+  if (stereo_samples > VU_MAX_SAMPLES) {
+    stereo_samples = VU_MAX_SAMPLES;
+  }
+  memcpy(s_vu_pcm, pcm, stereo_samples * 2 * sizeof(int16_t));
+  s_vu_samples = stereo_samples;
+  atomic_store(&s_vu_busy, true);
+  xTaskNotifyGive(s_vu_task);
+}
+
+// Energy and left-channel slope in one pass, four samples per step with
+// independent accumulators so loads and multiplies overlap
+static void vu_measure(const int16_t *pcm, size_t stereo_samples,
+                       uint64_t *sum_sq, uint64_t *diff_sum) {
+  uint64_t sq0 = 0;
+  uint64_t sq1 = 0;
+  uint32_t diff0 = 0;
+  uint32_t diff1 = 0;
+  int32_t prev = pcm[0];
+  size_t i = 0;
+
+  for (; i + 2 <= stereo_samples; i += 2) {
+    int32_t l0 = pcm[i * 2];
+    int32_t r0 = pcm[i * 2 + 1];
+    int32_t l1 = pcm[i * 2 + 2];
+    int32_t r1 = pcm[i * 2 + 3];
+    sq0 += (uint32_t)(l0 * l0) + (uint32_t)(r0 * r0);
+    sq1 += (uint32_t)(l1 * l1) + (uint32_t)(r1 * r1);
+    int32_t d0 = l0 - prev;
+    int32_t d1 = l1 - l0;
+    diff0 += (uint32_t)(d0 < 0 ? -d0 : d0);
+    diff1 += (uint32_t)(d1 < 0 ? -d1 : d1);
+    prev = l1;
+  }
+  for (; i < stereo_samples; i++) {
+    int32_t l = pcm[i * 2];
+    int32_t r = pcm[i * 2 + 1];
+    sq0 += (uint32_t)(l * l) + (uint32_t)(r * r);
+    int32_t d = l - prev;
+    diff0 += (uint32_t)(d < 0 ? -d : d);
+    prev = l;
+  }
+
+  *sum_sq = sq0 + sq1;
+  *diff_sum = (uint64_t)diff0 + diff1;
+}
+
+static void vu_update(const int16_t *pcm, size_t stereo_samples) {
   size_t total = stereo_samples * 2;
 
+  uint64_t sum_sq;
+  uint64_t diff_sum;
+  vu_measure(pcm, stereo_samples, &sum_sq, &diff_sum);
+
   // Compute RMS energy
-  uint64_t sum_sq = 0;
-  for (size_t i = 0; i < total; i++) {
-    int32_t s = pcm[i];
-    sum_sq += (uint64_t)(s * s);
-  }
   float rms = sqrtf((float)sum_sq / (float)total);
 
   // Simple bass energy estimate
-  uint64_t diff_sum = 0;
-  for (size_t i = 2; i < total; i += 2) {
-    int32_t d = (int32_t)pcm[i] - (int32_t)pcm[i - 2];
-    diff_sum += (uint64_t)(d < 0 ? -d : d);
-  }
   float high_energy = (float)diff_sum / ((float)total / 2.0f);
 
   float bass_ratio = 0.0f;
@@ -530,6 +591,18 @@ void led_audio_feed(const int16_t *pcm, size_t stereo_samples) {
   rgb_led_set_vu(norm, bass_ratio);
 }
 
+static void vu_task(void *arg) {
+  (void)arg;
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (!atomic_load(&s_vu_busy)) {
+      continue;
+    }
+    vu_update(s_vu_pcm, s_vu_samples);
+    atomic_store(&s_vu_busy, false);
+  }
+}
+
 // ============================================================================
 // Public API
 // ============================================================================
@@ -541,6 +614,13 @@ void led_init(void) {
 
   rtsp_events_register(on_rtsp_event, NULL);
 
+  if (xTaskCreatePinnedToCore(vu_task, "led_vu", VU_TASK_STACK, NULL,
+                              VU_TASK_PRIORITY, &s_vu_task,
+                              VU_CORE) != pdPASS) {
+    ESP_LOGW(TAG, "VU task not started, meter disabled");
+    s_vu_task = NULL;
+  }
+
   // Start in standby
   apply_state(STATE_STANDBY);
 
@@ -4,16 +4,27 @@
 #include "led.h"
 #include "hap.h"
 #include "mdns_airplay.h"
+#include "mem_budget.h"
 #include "lcd.h"
 #include "nvs_flash.h"
+#include "power_mgmt.h"
 #include "ptp_clock.h"
+#include "rt_log.h"
+#include "rtsp_events.h"
 #include "rtsp_server.h"
 #include "settings.h"
+#include "task_placement.h"
+#if CONFIG_TASK_STATS
+#include "task_stats.h"
+#endif
 #include "web_server.h"
 #include "wifi.h"
 
+#include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
 #include "freertos/task.h"
 #include "driver/gpio.h"
 #ifdef CONFIG_SQUEEZEAMP
@@ -26,8 +37,76 @@ static const char *TAG = "main";
 #define AP_IP_ADDR 0x0104A8C0
 #define BOOT_BUTTON_GPIO GPIO_NUM_0
 
+// Boot sequencing: the peripherals come up in their own task, and the audio
+// services while Wi-Fi associates; only mDNS and RTSP wait for an address
+#define BOOT_PERIPHERALS_BIT BIT0 // LED, LCD and DAC initialized
+#define BOOT_GOT_IP_BIT      BIT1 // Station address (re)acquired
+#define BOOT_PERIPHERALS_WAIT_MS 10000
+
+static EventGroupHandle_t s_boot_events;
 static bool s_airplay_started = false;
 
+static void boot_peripherals_task(void *pvParameters) {
+  int64_t start_us = esp_timer_get_time();
+  led_init();
+  esp_err_t lcd_err = lcd_init();
+  if (lcd_err != ESP_OK) {
+    ESP_LOGW(TAG, "LCD init failed: %s", esp_err_to_name(lcd_err));
+  }
+
+#ifdef CONFIG_SQUEEZEAMP
+  esp_err_t err = squeezeamp_init();
+  if (ESP_OK != err) {
+    ESP_LOGE(TAG, "Failed to initialize SqueezeAMP: %s", esp_err_to_name(err));
+  };
+#endif
+
+  ESP_LOGI(TAG, "Peripherals ready in %lld ms",
+           (esp_timer_get_time() - start_us) / 1000);
+  xEventGroupSetBits(s_boot_events, BOOT_PERIPHERALS_BIT);
+  vTaskDelete(NULL);
+}
+
+// The DAC driver must be up before the output can power it and before a
+// session's events reach its listener
+static void wait_peripherals(void) {
+  EventBits_t bits = xEventGroupWaitBits(
+      s_boot_events, BOOT_PERIPHERALS_BIT, pdFALSE, pdFALSE,
+      pdMS_TO_TICKS(BOOT_PERIPHERALS_WAIT_MS));
+  if (!(bits & BOOT_PERIPHERALS_BIT)) {
+    ESP_LOGW(TAG, "Peripherals still initializing, continuing without them");
+  }
+}
+
+static void got_ip_handler(void *arg, esp_event_base_t event_base,
+                           int32_t event_id, void *event_data) {
+  xEventGroupSetBits(s_boot_events, BOOT_GOT_IP_BIT);
+}
+
+// Everything that does not need an address: runs once, while associating
+static void start_audio_services(void) {
+  int64_t start_us = esp_timer_get_time();
+
+  esp_err_t err = ptp_clock_init();
+  if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+    // Retried when the network comes up
+    ESP_LOGW(TAG, "Failed to init PTP clock: %s", esp_err_to_name(err));
+  }
+
+  // Sized from what Wi-Fi and the web server have left
+  mem_budget_init();
+  ESP_ERROR_CHECK(hap_init());
+  // Registered before the address arrives, so probing starts right on it
+  mdns_airplay_init();
+  ESP_ERROR_CHECK(audio_receiver_init());
+  wait_peripherals();
+  ESP_ERROR_CHECK(audio_output_init());
+  audio_output_start();
+
+  ESP_LOGI(TAG, "Audio services ready in %lld ms",
+           (esp_timer_get_time() - start_us) / 1000);
+}
+
 static void start_airplay_services(void) {
   if (s_airplay_started) {
     return;
@@ -43,14 +122,11 @@ static void start_airplay_services(void) {
     return;
   }
 
-  ESP_ERROR_CHECK(hap_init());
-  ESP_ERROR_CHECK(audio_receiver_init());
-  ESP_ERROR_CHECK(audio_output_init());
-  audio_output_start();
-  mdns_airplay_init();
   ESP_ERROR_CHECK(rtsp_server_start());
 
-  ESP_LOGI(TAG, "AirPlay ready");
+  ESP_LOGI(TAG, "AirPlay ready, advertised %lld ms after boot",
+           esp_timer_get_time() / 1000);
+  mem_budget_log();
 }
 
 static void boot_button_task(void *pvParameters) {
@@ -79,7 +155,7 @@ static void boot_button_task(void *pvParameters) {
 }
 
 static void wifi_monitor_task(void *pvParameters) {
-  bool was_connected = wifi_is_connected();
+  bool was_connected = false;
   bool ap_enabled = wifi_settings_ap_is_enabled();
   bool dns_running = false;
   if (ap_enabled) {
@@ -88,8 +164,6 @@ static void wifi_monitor_task(void *pvParameters) {
   }
 
   while (1) {
-    vTaskDelay(pdMS_TO_TICKS(2000));
-
     bool new_ap_enabled = wifi_settings_ap_is_enabled();
     if (new_ap_enabled != ap_enabled) {
       ap_enabled = new_ap_enabled;
@@ -103,18 +177,19 @@ static void wifi_monitor_task(void *pvParameters) {
     }
 
     bool connected = wifi_is_connected();
-    if (connected == was_connected) {
-      continue;
-    }
-
-    if (connected) {
-      ESP_LOGI(TAG, "WiFi connected");
-      start_airplay_services();
-    } else {
-      ESP_LOGW(TAG, "WiFi disconnected");
+    if (connected != was_connected) {
+      if (connected) {
+        ESP_LOGI(TAG, "WiFi connected");
+        start_airplay_services();
+      } else {
+        ESP_LOGW(TAG, "WiFi disconnected");
+      }
+      was_connected = connected;
     }
 
-    was_connected = connected;
+    // Woken by the IP event so services follow the address immediately
+    xEventGroupWaitBits(s_boot_events, BOOT_GOT_IP_BIT, pdTRUE, pdFALSE,
+                        pdMS_TO_TICKS(2000));
   }
 }
 
@@ -127,42 +202,41 @@ void app_main(void) {
     ret = nvs_flash_init();
   }
   ESP_ERROR_CHECK(ret);
+  if (rt_log_init() != ESP_OK) {
+    ESP_LOGW(TAG, "Audio path logs go straight to the console");
+  }
   ESP_ERROR_CHECK(settings_init());
-  led_init();
-  esp_err_t lcd_err = lcd_init();
-  if (lcd_err != ESP_OK) {
-    ESP_LOGW(TAG, "LCD init failed: %s", esp_err_to_name(lcd_err));
+  ESP_ERROR_CHECK(rtsp_events_init());
+  if (power_mgmt_init() != ESP_OK) {
+    ESP_LOGW(TAG, "CPU stays at its default clock");
+  }
+  task_placement_log();
+#if CONFIG_TASK_STATS
+  if (task_stats_init() != ESP_OK) {
+    ESP_LOGW(TAG, "Task stats unavailable");
   }
-
-#ifdef CONFIG_SQUEEZEAMP
-  esp_err_t err = ESP_OK;
-  err = squeezeamp_init();
-  if (ESP_OK != err) {
-    ESP_LOGE(TAG, "Failed to initialize SqueezeAMP: %s", esp_err_to_name(err));
-  };
 #endif
 
-  // Start WiFi (APSTA mode: AP for config, STA for connection)
-  wifi_init_apsta("O1", "OpenAirplay");
-
-  // Wait for initial connection if credentials exist
-  bool connected = false;
-  if (settings_has_wifi_credentials()) {
-    connected = wifi_wait_connected(30000);
-  }
+  s_boot_events = xEventGroupCreate();
+  configASSERT(s_boot_events);
+  xTaskCreate(boot_peripherals_task, "boot_periph", 4096, NULL, 5, NULL);
 
-  if (!connected) {
+  // Start WiFi (APSTA mode: AP for config, STA for connection); association
+  // proceeds in the background
+  wifi_init_apsta("O1", "OpenAirplay");
+  ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP,
+                                             &got_ip_handler, NULL));
+  if (!settings_has_wifi_credentials()) {
     ESP_LOGI(TAG, "Connect to 'O1' -> http://192.168.4.1");
   }
 
-  // Start services
   web_server_start(80);
+  start_audio_services();
+
+  // Starts mDNS and RTSP as soon as the station has an address
   xTaskCreate(wifi_monitor_task, "wifi_mon", 4096, NULL, 5, NULL);
   xTaskCreate(boot_button_task, "boot_btn", 2048, NULL, 5, NULL);
 
-  if (connected) {
-    start_airplay_services();
-  }
   while (1) {
     vTaskDelay(pdMS_TO_TICKS(10000));
   }
@@ -0,0 +1,391 @@
+#include "mem_budget.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_memory_utils.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#if CONFIG_MEM_HOT_PATH_GUARD
+#include <stdlib.h>
+
+#include "esp_attr.h"
+#endif
+
+static const char *TAG = "mem_budget";
+
+#define KB(n) ((size_t)(n) * 1024)
+
+#define PSRAM_PROFILE_MIN  KB(1024) // Less spare PSRAM is planned as none
+#define ARENA_MIN          KB(64)   // Smaller arenas are not worth the copy
+#define STREAM_BUFFER_MAX  KB(1024) // Offered when there is no arena
+#define LOW_DECODE_QUEUE   8
+#define LOW_RECV_BYTES     KB(8) // One record of the largest size
+#define FULL_RECV_BYTES    KB(32)
+#define LOW_REQUEST_MAX    KB(64)
+#define FULL_REQUEST_MAX   KB(1024)
+#define HOT_TASKS_MAX      8 // Receive, control, decode, buffered, playback
+
+static const char *const tag_names[MEM_TAG_COUNT] = {
+    "audio", "rtsp", "hap", "httpd", "lcd",
+};
+
+static portMUX_TYPE usage_lock = portMUX_INITIALIZER_UNLOCKED;
+static mem_usage_t usage[MEM_TAG_COUNT];
+
+static mem_profile_t profile;
+static bool profile_taken = false;
+
+static size_t min_size(size_t a, size_t b) {
+  return a < b ? a : b;
+}
+
+esp_err_t mem_budget_init(void) {
+  if (profile_taken) {
+    return ESP_OK;
+  }
+
+  size_t psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+  size_t internal =
+      heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  size_t psram_reserve = KB(CONFIG_MEM_PSRAM_RESERVE_KB);
+  size_t internal_reserve = KB(CONFIG_MEM_INTERNAL_RESERVE_KB);
+  size_t arena = 0;
+
+  profile.psram_free = psram;
+  profile.internal_free = internal;
+  if (psram >= psram_reserve + PSRAM_PROFILE_MIN) {
+    size_t spare = psram - psram_reserve;
+#if CONFIG_AUDIO_COMPRESSED_BUFFER
+    arena = min_size(KB(CONFIG_AUDIO_COMPRESSED_BUFFER_KB), spare / 2);
+#endif
+    profile.name = "psram";
+    profile.pcm_pool_bytes = spare - arena;
+    profile.decode_queue_packets = CONFIG_AUDIO_DECODE_QUEUE_PACKETS;
+    profile.buffered_recv_bytes = FULL_RECV_BYTES;
+    profile.rtsp_request_max = FULL_REQUEST_MAX;
+  } else {
+    // Everything comes out of internal RAM: half of what is spare after the
+    // reserve for PCM, a quarter for compressed packets (about twice the
+    // audio per byte), the rest for sessions and requests
+    size_t spare =
+        internal > internal_reserve ? internal - internal_reserve : 0;
+#if CONFIG_AUDIO_COMPRESSED_BUFFER
+    arena = spare / 4;
+#endif
+    profile.name = "internal";
+    profile.pcm_pool_bytes = spare / 2;
+    profile.decode_queue_packets =
+        CONFIG_AUDIO_DECODE_QUEUE_PACKETS < LOW_DECODE_QUEUE
+            ? CONFIG_AUDIO_DECODE_QUEUE_PACKETS
+            : LOW_DECODE_QUEUE;
+    profile.buffered_recv_bytes = LOW_RECV_BYTES;
+    profile.rtsp_request_max = LOW_REQUEST_MAX;
+  }
+  profile.arena_bytes = arena >= ARENA_MIN ? arena : 0;
+  profile.stream_buffer_bytes =
+      profile.arena_bytes ? profile.arena_bytes
+                          : min_size(profile.pcm_pool_bytes, STREAM_BUFFER_MAX);
+  profile_taken = true;
+
+  ESP_LOGI(TAG,
+           "Profile %s (PSRAM %zu KB, internal %zu KB free): PCM %zu KB, "
+           "arena %zu KB, decode queue %" PRIu32 ", RTSP body %zu KB",
+           profile.name, psram / 1024, internal / 1024,
+           profile.pcm_pool_bytes / 1024, profile.arena_bytes / 1024,
+           profile.decode_queue_packets, profile.rtsp_request_max / 1024);
+  return ESP_OK;
+}
+
+const mem_profile_t *mem_budget_profile(void) {
+  if (!profile_taken) {
+    mem_budget_init();
+  }
+  return &profile;
+}
+
+static void count(mem_tag_t tag, const void *ptr, size_t size, bool add) {
+  if (tag >= MEM_TAG_COUNT || !ptr) {
+    return;
+  }
+
+  bool psram = esp_ptr_external_ram(ptr);
+  portENTER_CRITICAL(&usage_lock);
+  mem_usage_t *u = &usage[tag];
+  size_t *bytes = psram ? &u->psram_bytes : &u->internal_bytes;
+  if (add) {
+    *bytes += size;
+    u->blocks++;
+    size_t total = u->internal_bytes + u->psram_bytes;
+    if (total > u->peak_bytes) {
+      u->peak_bytes = total;
+    }
+  } else {
+    *bytes -= size < *bytes ? size : *bytes;
+    u->blocks -= u->blocks ? 1 : 0;
+  }
+  portEXIT_CRITICAL(&usage_lock);
+}
+
+void *mem_alloc(mem_tag_t tag, size_t size, uint32_t caps) {
+  void *ptr = heap_caps_malloc(size, caps);
+  count(tag, ptr, size, true);
+  return ptr;
+}
+
+void *mem_alloc_prefer_psram(mem_tag_t tag, size_t size) {
+  void *ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!ptr) {
+    ptr = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+  }
+  count(tag, ptr, size, true);
+  return ptr;
+}
+
+void *mem_calloc(mem_tag_t tag, size_t size) {
+  void *ptr = heap_caps_calloc(1, size, MALLOC_CAP_8BIT);
+  count(tag, ptr, size, true);
+  return ptr;
+}
+
+void *mem_aligned_alloc(mem_tag_t tag, size_t alignment, size_t size,
+                        uint32_t caps) {
+  void *ptr = heap_caps_aligned_alloc(alignment, size, caps);
+  count(tag, ptr, size, true);
+  return ptr;
+}
+
+void mem_free(mem_tag_t tag, void *ptr, size_t size) {
+  if (!ptr) {
+    return;
+  }
+  count(tag, ptr, size, false);
+  heap_caps_free(ptr);
+}
+
+void mem_account(mem_tag_t tag, int32_t bytes) {
+  if (tag >= MEM_TAG_COUNT) {
+    return;
+  }
+
+  portENTER_CRITICAL(&usage_lock);
+  mem_usage_t *u = &usage[tag];
+  if (bytes < 0 && (size_t)-bytes > u->internal_bytes) {
+    u->internal_bytes = 0;
+  } else {
+    u->internal_bytes += bytes;
+  }
+  size_t total = u->internal_bytes + u->psram_bytes;
+  if (total > u->peak_bytes) {
+    u->peak_bytes = total;
+  }
+  portEXIT_CRITICAL(&usage_lock);
+}
+
+void mem_get_usage(mem_tag_t tag, mem_usage_t *out) {
+  if (!out) {
+    return;
+  }
+  if (tag >= MEM_TAG_COUNT) {
+    *out = (mem_usage_t){0};
+    return;
+  }
+
+  portENTER_CRITICAL(&usage_lock);
+  *out = usage[tag];
+  portEXIT_CRITICAL(&usage_lock);
+}
+
+const char *mem_tag_name(mem_tag_t tag) {
+  return tag < MEM_TAG_COUNT ? tag_names[tag] : "unknown";
+}
+
+#if CONFIG_AUDIO_IRAM_HOT_PATH
+#define HOT_PATH_PLACEMENT "in IRAM"
+#else
+#define HOT_PATH_PLACEMENT "in flash"
+#endif
+
+/* From the IDF linker script */
+extern int _iram_text_start;
+extern int _iram_text_end;
+
+size_t mem_iram_text_bytes(void) {
+  return (size_t)((uintptr_t)&_iram_text_end - (uintptr_t)&_iram_text_start);
+}
+
+void mem_budget_log(void) {
+  const mem_profile_t *p = mem_budget_profile();
+  ESP_LOGI(TAG, "Profile %s; free now: internal %zu KB, PSRAM %zu KB", p->name,
+           heap_caps_get_free_size(MALLOC_CAP_INTERNAL) / 1024,
+           heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / 1024);
+  ESP_LOGI(TAG, "IRAM text %zu KB (hot path %s), executable heap free %zu KB",
+           mem_iram_text_bytes() / 1024,
+           HOT_PATH_PLACEMENT,
+           heap_caps_get_free_size(MALLOC_CAP_EXEC) / 1024);
+  for (int i = 0; i < MEM_TAG_COUNT; i++) {
+    mem_usage_t u;
+    mem_get_usage((mem_tag_t)i, &u);
+    ESP_LOGI(TAG,
+             "  %-5s internal %6zu  psram %8zu  peak %8zu  blocks %" PRIu32,
+             tag_names[i], u.internal_bytes, u.psram_bytes, u.peak_bytes,
+             u.blocks);
+  }
+}
+
+static void *keep_alloc(mem_tag_t tag, size_t size, uint32_t caps) {
+  return caps == MEM_PREFER_PSRAM ? mem_alloc_prefer_psram(tag, size)
+                                  : mem_alloc(tag, size, caps);
+}
+
+esp_err_t mem_keep_reserve(mem_keep_t *keep, mem_tag_t tag, size_t size,
+                           uint32_t caps) {
+#if CONFIG_MEM_STATIC_POOLS
+  if (keep->ptr) {
+    return ESP_OK;
+  }
+  keep->ptr = keep_alloc(tag, size, caps);
+  if (!keep->ptr) {
+    ESP_LOGW(TAG, "No memory to reserve %zu bytes for %s", size,
+             mem_tag_name(tag));
+    return ESP_ERR_NO_MEM;
+  }
+  keep->size = size;
+#else
+  (void)keep;
+  (void)tag;
+  (void)size;
+  (void)caps;
+#endif
+  return ESP_OK;
+}
+
+void *mem_keep_get(mem_keep_t *keep, mem_tag_t tag, size_t size,
+                   uint32_t caps, size_t *got) {
+#if CONFIG_MEM_STATIC_POOLS
+  // Missed at boot: hold the first block instead
+  if (!keep->ptr) {
+    mem_keep_reserve(keep, tag, size, caps);
+  }
+  if (keep->ptr && size <= keep->size) {
+    if (got) {
+      *got = keep->size;
+    }
+    return keep->ptr;
+  }
+#else
+  (void)keep;
+#endif
+  void *ptr = keep_alloc(tag, size, caps);
+  if (got) {
+    *got = ptr ? size : 0;
+  }
+  return ptr;
+}
+
+void mem_keep_put(mem_keep_t *keep, mem_tag_t tag, void *ptr, size_t size) {
+#if CONFIG_MEM_STATIC_POOLS
+  if (ptr && ptr == keep->ptr) {
+    return;
+  }
+#else
+  (void)keep;
+#endif
+  mem_free(tag, ptr, size);
+}
+
+#if CONFIG_MEM_HOT_PATH_GUARD
+
+static TaskHandle_t hot_tasks[HOT_TASKS_MAX];
+static volatile uint32_t hot_allocs = 0;
+static volatile size_t hot_last_size = 0;
+static volatile uint32_t hot_last_caps = 0;
+static uint32_t hot_reported = 0;
+
+// Weak hook of the heap component (CONFIG_HEAP_USE_HOOKS), called after
+// every successful allocation, in any context: it must stay short and must
+// not allocate or log
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size,
+                                         uint32_t caps) {
+  (void)ptr;
+  if (xPortInIsrContext()) {
+    return;
+  }
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  for (int i = 0; i < HOT_TASKS_MAX; i++) {
+    if (hot_tasks[i] == self) {
+      hot_allocs++;
+      hot_last_size = size;
+      hot_last_caps = caps;
+#if CONFIG_MEM_HOT_PATH_ABORT
+      abort();
+#endif
+      return;
+    }
+  }
+}
+
+void mem_hot_path_enter(void) {
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  portENTER_CRITICAL(&usage_lock);
+  int slot = -1;
+  for (int i = 0; i < HOT_TASKS_MAX; i++) {
+    if (hot_tasks[i] == self) {
+      slot = -1;
+      break;
+    }
+    if (!hot_tasks[i] && slot < 0) {
+      slot = i;
+    }
+  }
+  if (slot >= 0) {
+    hot_tasks[slot] = self;
+  }
+  portEXIT_CRITICAL(&usage_lock);
+}
+
+void mem_hot_path_exit(void) {
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  portENTER_CRITICAL(&usage_lock);
+  for (int i = 0; i < HOT_TASKS_MAX; i++) {
+    if (hot_tasks[i] == self) {
+      hot_tasks[i] = NULL;
+    }
+  }
+  portEXIT_CRITICAL(&usage_lock);
+}
+
+uint32_t mem_hot_path_allocs(void) {
+  return hot_allocs;
+}
+
+void mem_hot_path_report(void) {
+  uint32_t allocs = hot_allocs;
+  if (allocs != hot_reported) {
+    ESP_LOGW(TAG,
+             "%" PRIu32 " heap allocations on the audio path (last %zu bytes, "
+             "caps 0x%" PRIx32 ")",
+             allocs - hot_reported, hot_last_size, hot_last_caps);
+    hot_reported = allocs;
+  }
+}
+
+#else
+
+void mem_hot_path_enter(void) {
+}
+
+void mem_hot_path_exit(void) {
+}
+
+uint32_t mem_hot_path_allocs(void) {
+  return 0;
+}
+
+void mem_hot_path_report(void) {
+}
+
+#endif
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * Memory accounting per subsystem and the boot-time memory profile.
+ *
+ * Long-lived allocations of the big consumers go through mem_alloc() and
+ * friends with a tag, so the bytes each subsystem holds (and its peak) can
+ * be reported next to the heap totals. The caller passes the size back on
+ * free; nothing is stored in front of the block.
+ *
+ * The profile sizes the jitter buffer, the compressed arena, the decode
+ * queue and the RTSP body limit from the heap that is free when AirPlay
+ * starts, so the same image runs on boards with 8 MB of PSRAM and on 4 MB
+ * boards without any.
+ */
+
+typedef enum {
+  MEM_TAG_AUDIO = 0,
+  MEM_TAG_RTSP,
+  MEM_TAG_HAP,
+  MEM_TAG_HTTPD,
+  MEM_TAG_LCD,
+  MEM_TAG_COUNT,
+} mem_tag_t;
+
+typedef struct {
+  size_t internal_bytes; // Held now, internal RAM
+  size_t psram_bytes;    // Held now, PSRAM
+  size_t peak_bytes;     // Highest total since boot
+  uint32_t blocks;       // Live allocations
+} mem_usage_t;
+
+typedef struct {
+  const char *name;     // "psram" or "internal"
+  size_t psram_free;    // Free when the profile was taken
+  size_t internal_free;
+  size_t pcm_pool_bytes;       // PCM jitter buffer slots
+  size_t arena_bytes;          // Compressed arena, 0 to go without
+  size_t stream_buffer_bytes;  // audioBufferSize offered to senders
+  uint32_t decode_queue_packets;
+  size_t buffered_recv_bytes;  // Socket read buffer of buffered streams
+  size_t rtsp_request_max;     // Largest RTSP request accepted
+} mem_profile_t;
+
+/**
+ * Take the memory profile from the heap free now. Call once before the
+ * AirPlay services allocate; later calls keep the first profile.
+ */
+esp_err_t mem_budget_init(void);
+
+/** The boot profile (taken on first use if mem_budget_init() was not). */
+const mem_profile_t *mem_budget_profile(void);
+
+/** heap_caps_malloc() counted against a subsystem. */
+void *mem_alloc(mem_tag_t tag, size_t size, uint32_t caps);
+
+/** PSRAM if there is any to spare, internal RAM otherwise. */
+void *mem_alloc_prefer_psram(mem_tag_t tag, size_t size);
+
+/** Zeroed allocation placed like calloc(), for session structs. */
+void *mem_calloc(mem_tag_t tag, size_t size);
+
+/** heap_caps_aligned_alloc() counted against a subsystem. */
+void *mem_aligned_alloc(mem_tag_t tag, size_t alignment, size_t size,
+                        uint32_t caps);
+
+/** Free a block from the calls above; size is what was asked for. */
+void mem_free(mem_tag_t tag, void *ptr, size_t size);
+
+/**
+ * Count internal memory a subsystem holds outside these calls, such as a
+ * task stack: positive when taken, negative when given back.
+ */
+void mem_account(mem_tag_t tag, int32_t bytes);
+
+void mem_get_usage(mem_tag_t tag, mem_usage_t *usage);
+
+/** Stable name used in logs and metrics ("audio", "rtsp", ...). */
+const char *mem_tag_name(mem_tag_t tag);
+
+/** Log the profile and what each subsystem holds. */
+void mem_budget_log(void);
+
+/**
+ * Code linked into IRAM (all of it, not just ours), to weigh
+ * CONFIG_AUDIO_IRAM_HOT_PATH against what the board has left.
+ */
+size_t mem_iram_text_bytes(void);
+
+/** caps for mem_keep_*: PSRAM if there is any, internal RAM otherwise */
+#define MEM_PREFER_PSRAM 0
+
+/**
+ * A buffer a hot-path user needs for every session, such as a task's packet
+ * buffer. With CONFIG_MEM_STATIC_POOLS, mem_keep_reserve() takes it at boot
+ * and get/put hand out the same block for good; a request larger than the
+ * reservation is served by a plain allocation. Without it, get and put are
+ * mem_alloc()/mem_free() and reserve does nothing. One user at a time.
+ */
+typedef struct {
+  void *ptr;
+  size_t size;
+} mem_keep_t;
+
+esp_err_t mem_keep_reserve(mem_keep_t *keep, mem_tag_t tag, size_t size,
+                           uint32_t caps);
+
+/** At least size bytes; *got (optional) is the usable size. */
+void *mem_keep_get(mem_keep_t *keep, mem_tag_t tag, size_t size,
+                   uint32_t caps, size_t *got);
+
+/** Give back a block from mem_keep_get() with the size it was asked for. */
+void mem_keep_put(mem_keep_t *keep, mem_tag_t tag, void *ptr, size_t size);
+
+/**
+ * Mark the calling task's steady state: with CONFIG_MEM_HOT_PATH_GUARD every
+ * heap allocation it makes until mem_hot_path_exit() is counted (and aborts
+ * with CONFIG_MEM_HOT_PATH_ABORT). No-ops otherwise.
+ */
+void mem_hot_path_enter(void);
+void mem_hot_path_exit(void);
+
+/** Allocations counted on the hot path since boot. */
+uint32_t mem_hot_path_allocs(void);
+
+/** Warn if the hot path allocated since the last call, e.g. per session. */
+void mem_hot_path_report(void);
@@ -1,11 +1,16 @@
+#include "esp_event.h"
 #include "esp_log.h"
 #include "esp_mac.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
 #include "mdns.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "hap.h"
 #include "mdns_airplay.h"
+#include "rtsp_events.h"
 #include "wifi.h"
 #include "settings.h"
 
@@ -23,21 +28,145 @@ static const char *TAG = "mdns_airplay";
 #define AIRPLAY_PROTOCOL_VERSION "2"
 #define AIRPLAY_SOURCE_VERSION   "377.40.00"
 
-// Flags: 0x4 = audio receiver
-#define AIRPLAY_FLAGS "0x4"
+// Status flags: 0x4 = audio receiver, 0x800 = a session is active
+#define AIRPLAY_FLAGS        0x4
+#define AIRPLAY_FLAG_SESSION 0x800
 
 // Model identifier - AudioAccessory for speaker appearance
 // AppleTV3,2 = Apple TV, AudioAccessory5,1 = HomePod mini (speaker)
 #define AIRPLAY_MODEL "AudioAccessory5,1"
 
+// Extra unsolicited announcements after an address is acquired, on top of
+// the one the mDNS task sends when probing ends (~1 s): a sender that lost
+// a multicast packet, or only just woke its picker, sees us at once. Each
+// restarts the component's announce sequence; the first waits for probing
+// to end, since an announcement during probing starts it over. Gaps
+// between sends, the first counted from the address.
+static const uint16_t announce_delays_ms[] = {1200, 1000, 2000};
+
+static bool s_started;
+static uint32_t s_status_flags = AIRPLAY_FLAGS;
+static esp_timer_handle_t s_announce_timer;
+static int s_announce_next;
+static char s_raop_name[80];
+
+static void announce_now(void) {
+  esp_netif_t *sta = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+  if (sta) {
+    mdns_netif_action(sta, MDNS_EVENT_ANNOUNCE_IP4);
+  }
+}
+
+static void announce_timer_cb(void *arg) {
+  (void)arg;
+  announce_now();
+  if (++s_announce_next < (int)(sizeof(announce_delays_ms) /
+                                sizeof(announce_delays_ms[0]))) {
+    esp_timer_start_once(s_announce_timer,
+                         announce_delays_ms[s_announce_next] * 1000ULL);
+  }
+}
+
+void mdns_airplay_announce(void) {
+  if (!s_started || !s_announce_timer) {
+    return;
+  }
+  esp_timer_stop(s_announce_timer);
+  s_announce_next = 0;
+  esp_timer_start_once(s_announce_timer, announce_delays_ms[0] * 1000ULL);
+}
+
+// New address (first connect or a reconnect): our records are valid again
+static void got_ip_handler(void *arg, esp_event_base_t event_base,
+                           int32_t event_id, void *event_data) {
+  ESP_LOGD(TAG, "Address acquired, announcing");
+  mdns_airplay_announce();
+}
+
+static void format_flags(char *buf, size_t len, uint32_t flags) {
+  snprintf(buf, len, "0x%" PRIX32, flags);
+}
+
+void mdns_airplay_set_status_flags(uint32_t flags) {
+  if (flags == s_status_flags) {
+    return;
+  }
+  s_status_flags = flags;
+  if (!s_started) {
+    return;
+  }
+  // In place: the component re-announces just the changed TXT records
+  char flags_str[12];
+  format_flags(flags_str, sizeof(flags_str), flags);
+  mdns_service_txt_item_set("_airplay", "_tcp", "flags", flags_str);
+  mdns_service_txt_item_set("_raop", "_tcp", "sf", flags_str);
+  ESP_LOGI(TAG, "Status flags %s", flags_str);
+}
+
+uint32_t mdns_airplay_get_status_flags(void) {
+  return s_status_flags;
+}
+
+static void on_rtsp_event(rtsp_event_t event, const rtsp_event_data_t *data,
+                          void *user_data) {
+  (void)data;
+  (void)user_data;
+  switch (event) {
+  case RTSP_EVENT_CLIENT_CONNECTED:
+    mdns_airplay_set_status_flags(s_status_flags | AIRPLAY_FLAG_SESSION);
+    break;
+  case RTSP_EVENT_DISCONNECTED:
+    mdns_airplay_set_status_flags(s_status_flags & ~AIRPLAY_FLAG_SESSION);
+    break;
+  default:
+    break;
+  }
+}
+
+static void format_raop_name(char *buf, size_t len, const char *name) {
+  // RAOP instance: <MAC>@<DeviceName>
+  uint8_t mac[6];
+  esp_read_mac(mac, ESP_MAC_WIFI_STA);
+  snprintf(buf, len, "%02X%02X%02X%02X%02X%02X@%s", mac[0], mac[1], mac[2],
+           mac[3], mac[4], mac[5], name);
+}
+
+esp_err_t mdns_airplay_set_name(const char *name) {
+  if (!name || !name[0]) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (!s_started) {
+    return ESP_OK; // Picked up from the settings at init
+  }
+
+  format_raop_name(s_raop_name, sizeof(s_raop_name), name);
+  esp_err_t err = mdns_hostname_set(name);
+  if (err == ESP_OK) {
+    err = mdns_service_instance_name_set("_airplay", "_tcp", name);
+  }
+  if (err == ESP_OK) {
+    err = mdns_service_instance_name_set("_raop", "_tcp", s_raop_name);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Renaming services failed: %s", esp_err_to_name(err));
+    return err;
+  }
+  ESP_LOGI(TAG, "Advertised as \"%s\"", name);
+  return ESP_OK;
+}
+
 void mdns_airplay_init(void) {
   char mac_str[18];
   char device_id[18];
   char features_str[32];
-  char service_name[80];
+  char flags_str[12];
   char pk_str[65]; // 32 bytes = 64 hex chars + null
   char device_name[65];
 
+  if (s_started) {
+    return;
+  }
+
   // Get device name from settings
   settings_get_device_name(device_name, sizeof(device_name));
 
@@ -55,11 +184,8 @@ void mdns_airplay_init(void) {
   snprintf(features_str, sizeof(features_str), "0x%X,0x%X", AIRPLAY_FEATURES_LO,
            AIRPLAY_FEATURES_HI);
 
-  // Create service name for RAOP: <mac>@<name>
-  uint8_t mac[6];
-  esp_read_mac(mac, ESP_MAC_WIFI_STA);
-  snprintf(service_name, sizeof(service_name), "%02X%02X%02X%02X%02X%02X@%s",
-           mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], device_name);
+  format_flags(flags_str, sizeof(flags_str), s_status_flags);
+  format_raop_name(s_raop_name, sizeof(s_raop_name), device_name);
 
   // Initialize mDNS
   ESP_ERROR_CHECK(mdns_init());
@@ -73,7 +199,7 @@ void mdns_airplay_init(void) {
   mdns_txt_item_t airplay_txt[] = {
       {"deviceid", device_id},
       {"features", features_str},
-      {"flags", AIRPLAY_FLAGS},
+      {"flags", flags_str},
       {"model", AIRPLAY_MODEL},
       {"pk", pk_str},
       {"pi", "00000000-0000-0000-0000-000000000000"}, // Pairing identity UUID
@@ -97,22 +223,40 @@ void mdns_airplay_init(void) {
   // ========================================
   mdns_txt_item_t raop_txt[] = {
       {"am", AIRPLAY_MODEL},
-      {"cn", "0,1,2,3"},     // Audio codecs: PCM, ALAC, AAC, AAC-ELD
+      {"cn", "0,1,2"},       // Audio codecs: PCM, ALAC, AAC
       {"da", "true"},        // Digest auth
       {"et", "0,3,5"},       // Encryption types
       {"ft", features_str},  // Features (same as airplay)
       {"md", "0,1,2"},       // Metadata types
       {"pk", pk_str},        // Public key
-      {"sf", AIRPLAY_FLAGS}, // Status flags
+      {"sf", flags_str},     // Status flags
       {"tp", "UDP"},         // Transport protocol
       {"vn", "65537"},       // Version number
       {"vs", AIRPLAY_SOURCE_VERSION},
       {"vv", AIRPLAY_PROTOCOL_VERSION},
   };
 
-  err = mdns_service_add(service_name, "_raop", "_tcp", 7000, raop_txt,
+  err = mdns_service_add(s_raop_name, "_raop", "_tcp", 7000, raop_txt,
                          sizeof(raop_txt) / sizeof(raop_txt[0]));
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "Failed to add _raop._tcp service: %s", esp_err_to_name(err));
   }
+
+  const esp_timer_create_args_t timer_args = {
+      .callback = announce_timer_cb,
+      .name = "mdns_announce",
+  };
+  if (esp_timer_create(&timer_args, &s_announce_timer) != ESP_OK) {
+    ESP_LOGW(TAG, "No announcement burst, relying on the mDNS task");
+  }
+  esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &got_ip_handler,
+                             NULL);
+  rtsp_events_register(on_rtsp_event, NULL);
+  s_started = true;
+
+  // Already on the network (services added after the address): the
+  // component announces them, the burst follows up
+  if (wifi_is_connected()) {
+    mdns_airplay_announce();
+  }
 }
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <stdint.h>
+
+#include "esp_err.h"
+
 /**
  * Initialize mDNS and advertise AirPlay 2 services
  *
@@ -7,6 +11,29 @@
  * - _airplay._tcp service (AirPlay 2)
  * - _raop._tcp service (Remote Audio Output Protocol)
  *
- * With all required TXT records for iOS to recognize the device
+ * With all required TXT records for iOS to recognize the device. Safe to
+ * call before the station has an address: the services are then probed
+ * and announced the moment it gets one.
  */
 void mdns_airplay_init(void);
+
+/**
+ * Send a short burst of unsolicited announcements. Runs by itself whenever
+ * the station gets an address (boot and every reconnect).
+ */
+void mdns_airplay_announce(void);
+
+/**
+ * Rename the advertised services in place: hostname, _airplay instance and
+ * the <MAC>@<name> _raop instance, without re-registering them.
+ */
+esp_err_t mdns_airplay_set_name(const char *name);
+
+/**
+ * Update the status flags TXT records ("flags", "sf") in place. The
+ * session-active bit follows RTSP connections by itself.
+ */
+void mdns_airplay_set_status_flags(uint32_t flags);
+
+/** Status flags as advertised, also reported by GET /info. */
+uint32_t mdns_airplay_get_status_flags(void);
@@ -10,6 +10,8 @@
 #include "freertos/task.h"
 
 #include "ntp_clock.h"
+#include "socket_utils.h"
+#include "task_placement.h"
 
 static const char *TAG = "ntp_clock";
 
@@ -29,9 +31,28 @@ typedef struct __attribute__((packed)) {
 } timing_packet_t;
 
 // Number of measurements to keep for stability
-#define TIMING_HISTORY_SIZE 8
+#define TIMING_HISTORY_SIZE 16
 #define MIN_MEASUREMENTS    3
-#define TIMING_INTERVAL_MS  3000 // Send request every 3 seconds
+
+// Request cadence: a quick burst right after start, then the interval backs
+// off (doubling) to the slow steady-state rate
+#define BURST_REQUESTS      8
+#define BURST_INTERVAL_MS   40
+#define BACKOFF_START_MS    250
+#define TIMING_INTERVAL_MS  3000 // Steady state: one request every 3 seconds
+#define PENDING_REQUESTS    8    // Requests in flight, matched by origin
+#define RECV_POLL_MS        100  // Upper bound on one wait for a response
+
+// Offset selection and drift tracking
+#define DELAY_FLOOR_NS        100000LL // Keeps 1/delay^2 weights finite
+#define DRIFT_MIN_INTERVAL_NS 1000000000LL // Burst samples are too close
+#define DRIFT_GAIN_SHIFT      3 // Frequency follows 1/8 of the residual rate
+#define DRIFT_MAX_PPB         500000
+
+typedef struct {
+  uint64_t origin; // Timestamp as sent, echoed back by the sender
+  bool in_flight;
+} pending_request_t;
 
 // Timing state
 static struct {
@@ -40,13 +61,25 @@ static struct {
   int socket;
   struct sockaddr_in remote_addr;
 
+  // Outstanding requests
+  pending_request_t pending[PENDING_REQUESTS];
+  int pending_index;
+  uint16_t seqno;
+  int requests_sent;
+
   // Clock offset tracking
   bool locked;
-  int64_t offset_ns; // Current best offset
-  int64_t measurements[TIMING_HISTORY_SIZE];
-  int64_t dispersions[TIMING_HISTORY_SIZE];
+  int64_t measurements[TIMING_HISTORY_SIZE]; // Offset samples
+  int64_t dispersions[TIMING_HISTORY_SIZE];  // Half network delay of each
+  int64_t times[TIMING_HISTORY_SIZE];        // Local arrival time of each
   int measurement_count;
   int measurement_index;
+
+  // Model, remote_time = local_time + offset_ns + drift * (t - anchor)
+  portMUX_TYPE model_lock;
+  int64_t offset_ns; // Best offset at anchor_local_ns
+  int64_t anchor_local_ns;
+  int32_t drift_ppb;
 } ntp = {0};
 
 // Convert local time (microseconds) to NTP timestamp format (for packet)
@@ -65,6 +98,54 @@ static int64_t ntp_to_ns(uint32_t secs, uint32_t frac) {
   return ns;
 }
 
+// Offset predicted by the model for local time t
+static int64_t model_offset_at(int64_t local_ns) {
+  return ntp.offset_ns +
+         (int64_t)ntp.drift_ppb * (local_ns - ntp.anchor_local_ns) /
+             1000000000LL;
+}
+
+// Re-estimate the offset at now_ns from the history and trim the drift
+static void update_model(int64_t now_ns, int64_t reference_ns) {
+  // Weighted mean of the samples projected to now; a sample's weight falls
+  // with the square of its network delay, so the quick round trips dominate
+  float weight_sum = 0.0f;
+  float delta_sum = 0.0f;
+  for (int i = 0; i < ntp.measurement_count; i++) {
+    int64_t projected =
+        ntp.measurements[i] +
+        (int64_t)ntp.drift_ppb * (now_ns - ntp.times[i]) / 1000000000LL;
+    float delay = (float)(ntp.dispersions[i] + DELAY_FLOOR_NS);
+    float weight = 1.0f / (delay * delay);
+    weight_sum += weight;
+    delta_sum += weight * (float)(projected - reference_ns);
+  }
+  int64_t estimate = reference_ns + (int64_t)(delta_sum / weight_sum);
+
+  int32_t drift = ntp.drift_ppb;
+  int64_t interval_ns = now_ns - ntp.anchor_local_ns;
+  if (ntp.locked && interval_ns >= DRIFT_MIN_INTERVAL_NS) {
+    int64_t residual = estimate - model_offset_at(now_ns);
+    int64_t step =
+        residual * 1000000000LL / interval_ns / (1 << DRIFT_GAIN_SHIFT);
+    int64_t next = drift + step;
+    if (next > DRIFT_MAX_PPB) {
+      next = DRIFT_MAX_PPB;
+    } else if (next < -DRIFT_MAX_PPB) {
+      next = -DRIFT_MAX_PPB;
+    }
+    drift = (int32_t)next;
+  } else if (ntp.locked) {
+    return; // Keep the anchor so the drift sees a long enough baseline
+  }
+
+  portENTER_CRITICAL(&ntp.model_lock);
+  ntp.offset_ns = estimate;
+  ntp.anchor_local_ns = now_ns;
+  ntp.drift_ppb = drift;
+  portEXIT_CRITICAL(&ntp.model_lock);
+}
+
 // Process timing response and calculate offset
 static void process_timing_response(const uint8_t *packet, size_t len,
                                     int64_t arrival_ns) {
@@ -89,6 +170,21 @@ static void process_timing_response(const uint8_t *packet, size_t len,
   uint32_t transmit_secs = ntohl(*(uint32_t *)(packet + 24));
   uint32_t transmit_frac = ntohl(*(uint32_t *)(packet + 28));
 
+  // Only accept answers to requests still in flight; duplicates and
+  // answers to requests from a previous session are dropped here
+  uint64_t origin = ((uint64_t)origin_secs << 32) | origin_frac;
+  int slot = -1;
+  for (int i = 0; i < PENDING_REQUESTS; i++) {
+    if (ntp.pending[i].in_flight && ntp.pending[i].origin == origin) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) {
+    return;
+  }
+  ntp.pending[slot].in_flight = false;
+
   int64_t departure_ns = ntp_to_ns(origin_secs, origin_frac);
   int64_t remote_receive_ns = ntp_to_ns(receive_secs, receive_frac);
   int64_t remote_transmit_ns = ntp_to_ns(transmit_secs, transmit_frac);
@@ -119,30 +215,21 @@ static void process_timing_response(const uint8_t *packet, size_t len,
   // Store measurement
   int idx = ntp.measurement_index;
   ntp.measurements[idx] = offset_ns;
-  ntp.dispersions[idx] = dispersion_ns;
+  ntp.dispersions[idx] = dispersion_ns > 0 ? dispersion_ns : 0;
+  ntp.times[idx] = arrival_ns;
   ntp.measurement_index = (idx + 1) % TIMING_HISTORY_SIZE;
   if (ntp.measurement_count < TIMING_HISTORY_SIZE) {
     ntp.measurement_count++;
   }
 
-  // Find best measurement (lowest dispersion)
-  int64_t best_offset = offset_ns;
-  int64_t best_dispersion = dispersion_ns;
-  for (int i = 0; i < ntp.measurement_count; i++) {
-    if (ntp.dispersions[i] < best_dispersion) {
-      best_dispersion = ntp.dispersions[i];
-      best_offset = ntp.measurements[i];
-    }
-  }
-
-  ntp.offset_ns = best_offset;
+  update_model(arrival_ns, offset_ns);
 
   // Consider locked after enough measurements
   if (!ntp.locked && ntp.measurement_count >= MIN_MEASUREMENTS) {
     ntp.locked = true;
     ESP_LOGI(TAG, "NTP timing locked: offset=%lld ms, dispersion=%lld us",
              (long long)(ntp.offset_ns / 1000000),
-             (long long)(best_dispersion / 1000));
+             (long long)(dispersion_ns / 1000));
   }
 
   ESP_LOGD(TAG, "Timing: RTT=%lld us, offset=%lld ms",
@@ -156,7 +243,7 @@ static void send_timing_request(void) {
 
   req.leader = 0x80;
   req.type = TIMING_REQUEST;
-  req.seqno = htons(7); // Fixed sequence number (like shairport-sync)
+  req.seqno = htons(ntp.seqno++);
 
   // Set origin to our current time (will be echoed back in response)
   int64_t now_us = esp_timer_get_time();
@@ -169,10 +256,33 @@ static void send_timing_request(void) {
   memcpy(origin_bytes, &secs, 4);
   memcpy(origin_bytes + 4, &frac, 4);
 
+  // Remember it so the response can be matched; the oldest slot is reused
+  // when a request was never answered
+  pending_request_t *pending = &ntp.pending[ntp.pending_index];
+  pending->origin = ntp_time;
+  pending->in_flight = true;
+  ntp.pending_index = (ntp.pending_index + 1) % PENDING_REQUESTS;
+  ntp.requests_sent++;
+
   sendto(ntp.socket, &req, sizeof(req), 0, (struct sockaddr *)&ntp.remote_addr,
          sizeof(ntp.remote_addr));
 }
 
+// Delay before the next request: burst, then back off to the slow rate
+static uint32_t next_interval_ms(void) {
+  if (ntp.requests_sent < BURST_REQUESTS) {
+    return BURST_INTERVAL_MS;
+  }
+  uint32_t interval = BACKOFF_START_MS;
+  for (int i = BURST_REQUESTS; i < ntp.requests_sent; i++) {
+    interval *= 2;
+    if (interval >= TIMING_INTERVAL_MS) {
+      return TIMING_INTERVAL_MS;
+    }
+  }
+  return interval;
+}
+
 // Timing task: sends requests and processes responses
 static void ntp_task(void *pvParameters) {
   uint8_t packet[64];
@@ -183,19 +293,36 @@ static void ntp_task(void *pvParameters) {
   vTaskDelay(pdMS_TO_TICKS(300));
 
   TickType_t last_request = 0;
+  TickType_t interval = 0;
 
   while (ntp.running) {
-    // Send timing request periodically
+    // Send timing request on the burst / back-off schedule
     TickType_t now = xTaskGetTickCount();
-    if (now - last_request >= pdMS_TO_TICKS(TIMING_INTERVAL_MS)) {
+    if (now - last_request >= interval) {
       send_timing_request();
       last_request = now;
+      interval = pdMS_TO_TICKS(next_interval_ms());
+    }
+
+    // Wait for a response until the next request is due
+    TickType_t wait = interval - (xTaskGetTickCount() - last_request);
+    if (wait > pdMS_TO_TICKS(RECV_POLL_MS)) {
+      wait = pdMS_TO_TICKS(RECV_POLL_MS);
+    }
+    fd_set read_fds;
+    FD_ZERO(&read_fds);
+    FD_SET(ntp.socket, &read_fds);
+    struct timeval tv = {.tv_sec = 0,
+                         .tv_usec = (long)(wait * portTICK_PERIOD_MS) * 1000};
+    int ready = select(ntp.socket + 1, &read_fds, NULL, NULL, &tv);
+    if (ready == 0) {
+      continue;
     }
 
-    // Check for response (with short timeout)
     addr_len = sizeof(src_addr);
-    int len = recvfrom(ntp.socket, packet, sizeof(packet), 0,
-                       (struct sockaddr *)&src_addr, &addr_len);
+    int len = ready < 0 ? -1
+                        : recvfrom(ntp.socket, packet, sizeof(packet), 0,
+                                   (struct sockaddr *)&src_addr, &addr_len);
 
     if (len < 0) {
       if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -218,7 +345,7 @@ static void ntp_task(void *pvParameters) {
   }
 
   ntp.task_handle = NULL;
-  vTaskDelete(NULL);
+  task_placement_exit(TASK_NTP);
 }
 
 esp_err_t ntp_clock_start_client(uint32_t remote_ip, uint16_t remote_port) {
@@ -237,10 +364,7 @@ esp_err_t ntp_clock_start_client(uint32_t remote_ip, uint16_t remote_port) {
     ESP_LOGE(TAG, "Failed to create socket: %d", errno);
     return ESP_FAIL;
   }
-
-  // Set receive timeout (100ms for responsive checking)
-  struct timeval tv = {.tv_sec = 0, .tv_usec = 100000};
-  setsockopt(ntp.socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  socket_utils_set_realtime_dscp(ntp.socket);
 
   // Setup remote address
   memset(&ntp.remote_addr, 0, sizeof(ntp.remote_addr));
@@ -248,18 +372,24 @@ esp_err_t ntp_clock_start_client(uint32_t remote_ip, uint16_t remote_port) {
   ntp.remote_addr.sin_addr.s_addr = remote_ip;
   ntp.remote_addr.sin_port = htons(remote_port);
 
-  // Reset state
+  // Reset state; the drift describes our crystal and is kept
+  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  ntp.model_lock = lock;
   ntp.locked = false;
   ntp.offset_ns = 0;
+  ntp.anchor_local_ns = 0;
   ntp.measurement_count = 0;
   ntp.measurement_index = 0;
   memset(ntp.measurements, 0, sizeof(ntp.measurements));
   memset(ntp.dispersions, 0, sizeof(ntp.dispersions));
+  memset(ntp.times, 0, sizeof(ntp.times));
+  memset(ntp.pending, 0, sizeof(ntp.pending));
+  ntp.pending_index = 0;
+  ntp.requests_sent = 0;
   ntp.running = true;
 
-  BaseType_t ret =
-      xTaskCreate(ntp_task, "ntp_clock", 3072, NULL, 5, &ntp.task_handle);
-  if (ret != pdPASS) {
+  if (task_placement_spawn(TASK_NTP, ntp_task, NULL, &ntp.task_handle) !=
+      ESP_OK) {
     ESP_LOGE(TAG, "Failed to create NTP task");
     close(ntp.socket);
     ntp.socket = -1;
@@ -302,5 +432,9 @@ bool ntp_clock_is_locked(void) {
 }
 
 int64_t ntp_clock_get_offset_ns(void) {
-  return ntp.offset_ns;
+  int64_t now_ns = esp_timer_get_time() * 1000LL;
+  portENTER_CRITICAL(&ntp.model_lock);
+  int64_t offset = model_offset_at(now_ns);
+  portEXIT_CRITICAL(&ntp.model_lock);
+  return offset;
 }
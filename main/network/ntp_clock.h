@@ -13,7 +13,8 @@
 
 /**
  * Start NTP timing client.
- * Sends periodic timing requests to the remote client and calculates offset.
+ * Sends a quick burst of timing requests to the remote client, then backs
+ * off to a slow cadence, and tracks offset and drift from the responses.
  * @param remote_ip Remote IP address (network byte order)
  * @param remote_port Remote timing port
  * @return ESP_OK on success
@@ -33,6 +34,6 @@ bool ntp_clock_is_locked(void);
 
 /**
  * Get current offset from local clock to remote time in nanoseconds.
- * remote_time = local_time + offset
+ * remote_time = local_time + offset, extrapolated with the drift estimate.
  */
 int64_t ntp_clock_get_offset_ns(void);
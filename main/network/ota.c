@@ -1,48 +1,283 @@
 #include "ota.h"
 
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "audio_receiver.h"
+#include "esp_flash_encrypt.h"
 #include "esp_log.h"
 #include "esp_ota_ops.h"
-#include <sys/param.h>
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "rtsp_server.h"
+
+// Flash erases and writes stall both cores' cache. Under playback they are
+// done in small steps: each 4 KB sector is erased a few sectors ahead of the
+// data, preferably while the jitter buffer is full so the output rides out
+// the stall, and writes go in chunks with a pause between them.
+#define SECTOR_SIZE         4096
+#define ERASE_AHEAD_SECTORS 4
+#define BUFFER_SIZE         4096 // Largest chunk, and the full-speed write
+#define HEADROOM_POLL_MS    10
+#define HEADROOM_WAIT_MS    250 // Then the operation goes ahead regardless
+#define MIN_DEPTH_FRAMES    32  // Without an adaptive target: ~250 ms
+#define DEFER_POLL_MS       500
+#define PROGRESS_STEP_PCT   10
+
+#if CONFIG_OTA_PLAYBACK_SAFE
+#define CHUNK_BYTES       (CONFIG_OTA_CHUNK_BYTES & ~15) // Encryption blocks
+#define CHUNK_INTERVAL_MS CONFIG_OTA_CHUNK_INTERVAL_MS
+#else
+#define CHUNK_BYTES       BUFFER_SIZE
+#define CHUNK_INTERVAL_MS 0
+#endif
 
 static const char *TAG = "ota";
 
-esp_err_t ota_start_from_http(httpd_req_t *req) {
+typedef struct {
+  const esp_partition_t *partition;
+  esp_ota_handle_t handle;
+  size_t erased; // Bytes from the partition start
+  ota_report_t *report;
+} ota_job_t;
+
+const char *ota_mode_name(ota_mode_t mode) {
+  switch (mode) {
+  case OTA_MODE_THROTTLED:
+    return "throttled";
+  case OTA_MODE_DEFERRED:
+    return "deferred";
+  default:
+    return "full";
+  }
+}
+
+// The buffer covers a flash stall once it holds its adaptive target (or a
+// fixed depth for streams without one)
+static bool has_headroom(void) {
+  if (!audio_receiver_is_playing()) {
+    return true;
+  }
+  audio_stats_t stats;
+  audio_receiver_get_stats(&stats);
+  uint32_t want = stats.target_depth_frames > 0 ? stats.target_depth_frames
+                                                : MIN_DEPTH_FRAMES;
+  return stats.pcm_depth_frames >= want;
+}
+
+static void wait_headroom(ota_job_t *job) {
+  if (has_headroom()) {
+    return;
+  }
+  job->report->headroom_waits++;
+  for (int waited = 0; waited < HEADROOM_WAIT_MS && !has_headroom();
+       waited += HEADROOM_POLL_MS) {
+    vTaskDelay(pdMS_TO_TICKS(HEADROOM_POLL_MS));
+  }
+}
+
+static void account_stall(ota_job_t *job, int64_t start_us,
+                          uint32_t *max_us) {
+  uint32_t us = (uint32_t)(esp_timer_get_time() - start_us);
+  if (us > *max_us) {
+    *max_us = us;
+  }
+  job->report->stall_total_us += us;
+}
+
+static esp_err_t erase_sector(ota_job_t *job, bool throttled) {
+  if (job->erased >= job->partition->size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (throttled) {
+    wait_headroom(job);
+  }
+  int64_t start = esp_timer_get_time();
+  esp_err_t err =
+      esp_partition_erase_range(job->partition, job->erased, SECTOR_SIZE);
+  account_stall(job, start, &job->report->erase_stall_max_us);
+  if (err == ESP_OK) {
+    job->erased += SECTOR_SIZE;
+    job->report->erases++;
+  }
+  return err;
+}
+
+static esp_err_t write_chunk(ota_job_t *job, const uint8_t *data, size_t len,
+                             bool throttled) {
+  ota_report_t *report = job->report;
+  size_t end = report->written_bytes + len;
+  while (job->erased < end) {
+    esp_err_t err = erase_sector(job, throttled);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  // Stay ahead while the buffer allows it, so the next chunks need not wait
+  size_t image_end =
+      MIN((size_t)job->partition->size,
+          (report->image_bytes + SECTOR_SIZE - 1) & ~(size_t)(SECTOR_SIZE - 1));
+  while (throttled &&
+         job->erased < MIN(end + ERASE_AHEAD_SECTORS * SECTOR_SIZE,
+                           image_end) &&
+         has_headroom()) {
+    esp_err_t err = erase_sector(job, false);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+
+  if (throttled) {
+    wait_headroom(job);
+  }
+  int64_t start = esp_timer_get_time();
+  esp_err_t err = esp_ota_write_with_offset(job->handle, data, len,
+                                            report->written_bytes);
+  account_stall(job, start, &report->write_stall_max_us);
+  if (err != ESP_OK) {
+    return err;
+  }
+  report->written_bytes = end;
+  report->writes++;
+  if (throttled && CHUNK_INTERVAL_MS > 0) {
+    vTaskDelay(pdMS_TO_TICKS(CHUNK_INTERVAL_MS));
+  }
+  return ESP_OK;
+}
+
+// Fill the buffer with want bytes (fewer only at the end of the body)
+static int receive(httpd_req_t *req, uint8_t *buf, size_t want,
+                   size_t *remaining) {
+  size_t got = 0;
+  while (got < want && *remaining > 0) {
+    int len = httpd_req_recv(req, (char *)buf + got,
+                             MIN(*remaining, want - got));
+    if (len == HTTPD_SOCK_ERR_TIMEOUT) {
+      continue;
+    } else if (len <= 0) {
+      ESP_LOGE(TAG, "Receive error: %d", len);
+      return -1;
+    }
+    got += len;
+    *remaining -= len;
+  }
+  return (int)got;
+}
+
+static void wait_for_pause(ota_report_t *report) {
+  int64_t start = esp_timer_get_time();
+  int64_t limit_us = (int64_t)CONFIG_OTA_DEFER_MAX_S * 1000000;
+  if (audio_receiver_is_playing()) {
+    ESP_LOGI(TAG, "Update deferred until playback pauses");
+  }
+  while (audio_receiver_is_playing() &&
+         esp_timer_get_time() - start < limit_us) {
+    vTaskDelay(pdMS_TO_TICKS(DEFER_POLL_MS));
+  }
+  report->deferred_ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+}
+
+esp_err_t ota_start_from_http(httpd_req_t *req, bool defer,
+                              ota_report_t *report) {
+  ota_report_t local;
+  if (!report) {
+    report = &local;
+  }
+  memset(report, 0, sizeof(*report));
+  report->image_bytes = req->content_len;
+
   const esp_partition_t *ota_partition =
       esp_ota_get_next_update_partition(NULL);
   if (!ota_partition) {
     ESP_LOGE(TAG, "No OTA partition found");
     return ESP_ERR_NOT_FOUND;
   }
+  if (req->content_len > ota_partition->size) {
+    ESP_LOGE(TAG, "Image of %zu bytes exceeds the partition",
+             req->content_len);
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  if (defer) {
+    wait_for_pause(report);
+    report->mode = OTA_MODE_DEFERRED;
+  }
+  bool throttled = false;
+#if CONFIG_OTA_PLAYBACK_SAFE
+  throttled = audio_receiver_is_playing();
+#endif
+  if (throttled) {
+    report->mode = OTA_MODE_THROTTLED;
+  } else {
+    // Stop AirPlay to free resources during OTA
+    ESP_LOGI(TAG, "Stopping AirPlay for OTA update");
+    rtsp_server_stop();
+  }
 
+  // Sequential mode leaves the partition unerased; sectors are erased here
+  // just ahead of the data
   esp_ota_handle_t ota_handle;
-  esp_err_t err = esp_ota_begin(ota_partition, OTA_SIZE_UNKNOWN, &ota_handle);
+  esp_err_t err =
+      esp_ota_begin(ota_partition, OTA_WITH_SEQUENTIAL_WRITES, &ota_handle);
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(err));
     return err;
   }
 
-  char buf[1024];
+  uint8_t *buf = malloc(BUFFER_SIZE);
+  if (!buf) {
+    esp_ota_abort(ota_handle);
+    return ESP_ERR_NO_MEM;
+  }
+
+  ota_job_t job = {
+      .partition = ota_partition, .handle = ota_handle, .report = report};
+  size_t chunk = throttled ? CHUNK_BYTES : BUFFER_SIZE;
   size_t remaining = req->content_len;
-  ESP_LOGI(TAG, "Receiving firmware (%zu bytes)...", remaining);
+  int64_t start = esp_timer_get_time();
+  int next_pct = PROGRESS_STEP_PCT;
+  ESP_LOGI(TAG, "Receiving firmware (%zu bytes, %s)...", remaining,
+           ota_mode_name(report->mode));
 
   while (remaining > 0) {
-    int recv_len = httpd_req_recv(req, buf, MIN(remaining, sizeof(buf)));
-
-    if (recv_len == HTTPD_SOCK_ERR_TIMEOUT) {
-      continue;
-    } else if (recv_len <= 0) {
-      ESP_LOGE(TAG, "Receive error: %d", recv_len);
-      esp_ota_abort(ota_handle);
-      return ESP_FAIL;
+    int len = receive(req, buf, chunk, &remaining);
+    if (len <= 0) {
+      err = ESP_FAIL;
+      break;
+    }
+    // Encrypted flash takes whole 16-byte blocks; pad the tail
+    if (esp_flash_encryption_enabled() && (len & 15)) {
+      size_t padded = ((size_t)len + 15) & ~(size_t)15;
+      memset(buf + len, 0xFF, padded - len);
+      len = (int)padded;
+    }
+    err = write_chunk(&job, buf, (size_t)len, throttled);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Flash write failed: %s", esp_err_to_name(err));
+      break;
     }
 
-    if (esp_ota_write(ota_handle, buf, recv_len) != ESP_OK) {
-      ESP_LOGE(TAG, "Flash write failed");
-      esp_ota_abort(ota_handle);
-      return ESP_FAIL;
+    int pct = (int)((uint64_t)report->written_bytes * 100 /
+                    MAX(report->image_bytes, 1));
+    if (pct >= next_pct) {
+      ESP_LOGI(TAG,
+               "%d%% (%zu bytes), longest stall erase %" PRIu32
+               " us, write %" PRIu32 " us",
+               pct, report->written_bytes, report->erase_stall_max_us,
+               report->write_stall_max_us);
+      next_pct = pct - pct % PROGRESS_STEP_PCT + PROGRESS_STEP_PCT;
     }
+  }
+  free(buf);
+  report->duration_ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
 
-    remaining -= recv_len;
+  if (err != ESP_OK) {
+    esp_ota_abort(ota_handle);
+    return err;
   }
 
   if (esp_ota_end(ota_handle) != ESP_OK) {
@@ -55,6 +290,11 @@ esp_err_t ota_start_from_http(httpd_req_t *req) {
     return ESP_FAIL;
   }
 
-  ESP_LOGI(TAG, "OTA update successful");
+  ESP_LOGI(TAG,
+           "OTA update successful: %zu bytes in %" PRIu32 " ms (%s), %" PRIu32
+           " erases, %" PRIu32 " writes, %" PRIu64 " us in flash operations",
+           report->written_bytes, report->duration_ms,
+           ota_mode_name(report->mode), report->erases, report->writes,
+           report->stall_total_us);
   return ESP_OK;
 }
@@ -1,13 +1,48 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include "esp_err.h"
 #include "esp_http_server.h"
 
+typedef enum {
+  OTA_MODE_FULL = 0,   // Nothing playing: erase and write at full speed
+  OTA_MODE_THROTTLED,  // Playing: small writes, erases while the buffer is full
+  OTA_MODE_DEFERRED,   // Waited for playback to pause, then full speed
+} ota_mode_t;
+
+typedef struct {
+  ota_mode_t mode;
+  size_t image_bytes;
+  size_t written_bytes;
+  uint32_t erases;           // 4 KB sectors
+  uint32_t writes;
+  uint32_t erase_stall_max_us; // Longest single flash operation of each kind
+  uint32_t write_stall_max_us;
+  uint64_t stall_total_us;     // Time spent inside erases and writes
+  uint32_t headroom_waits;     // Flash operations held for the buffer to fill
+  uint32_t deferred_ms;        // Waited for a pause before starting
+  uint32_t duration_ms;
+} ota_report_t;
+
 /**
  * Perform OTA update from HTTP POST request containing raw firmware binary.
  * Does not restart - caller should send response then call esp_restart().
  *
+ * Stops AirPlay first to free resources, unless a stream is playing and
+ * CONFIG_OTA_PLAYBACK_SAFE is set: then the image goes in small chunks paced
+ * by the jitter buffer. With defer the upload is not read until playback
+ * pauses or stops (up to CONFIG_OTA_DEFER_MAX_S), then AirPlay is stopped.
+ *
  * @param req HTTP request with firmware in body
+ * @param defer Wait for playback to pause instead of writing under it
+ * @param report Optional: mode, progress and measured flash stalls
  * @return ESP_OK on success
  */
-esp_err_t ota_start_from_http(httpd_req_t *req);
+esp_err_t ota_start_from_http(httpd_req_t *req, bool defer,
+                              ota_report_t *report);
+
+/** Human-readable mode name ("full", "throttled", "deferred"). */
+const char *ota_mode_name(ota_mode_t mode);
@@ -1,17 +1,18 @@
-#include <arpa/inet.h>
-#include <errno.h>
-#include <netinet/in.h>
+#include <inttypes.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <sys/time.h>
-#include <unistd.h>
 
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "freertos/task.h"
+#include "lwip/igmp.h"
+#include "lwip/pbuf.h"
+#include "lwip/priv/tcpip_priv.h"
+#include "lwip/udp.h"
 
 #include "ptp_clock.h"
+#include "task_placement.h"
 
 static const char *TAG = "ptp_clock";
 
@@ -31,32 +32,91 @@ static const char *TAG = "ptp_clock";
 #define PTP_HEADER_SIZE      34
 #define PTP_TIMESTAMP_OFFSET 34
 #define PTP_TIMESTAMP_SIZE   10
+#define PTP_RX_COPY_SIZE     64 // Header, timestamp and a little of the TLVs
+#define PTP_RX_QUEUE_DEPTH   16
+#define PTP_PORT_ID_OFFSET   20 // sourcePortIdentity in the header
+#define PTP_PORT_ID_SIZE     10 // clockIdentity + portNumber
+#define PTP_ANNOUNCE_SIZE    64 // Header plus the Announce body
+#define PTP_CLOCK_ID_SIZE    8
+
+// Best master selection
+#define PTP_MAX_PEERS       16
+#define PTP_MAX_FOREIGN     4    // Announcing masters tracked at once
+#define ANNOUNCE_TIMEOUT_MS 4000 // Master forgotten after this silence
 
 // Synchronization parameters
-#define LOCK_THRESHOLD_NS    40000000LL // 40ms - tight threshold for lock
+#define LOCK_RESIDUAL_NS     500000LL   // 500us - servo residual for lock
+#define LOCK_SPREAD_NS       40000000LL // 40ms - sample spread for lock
 #define MIN_SAMPLES_FOR_LOCK 8
 #define LOCK_STABLE_TIME_MS  1000 // 1s of stable readings to declare lock
 #define LOCK_TIMEOUT_MS      5000
-#define SAMPLE_BUFFER_SIZE   16         // Ring buffer for median filtering
+#define SAMPLE_BUFFER_SIZE   64         // Median window, ~8s of SYNCs
 #define OUTLIER_THRESHOLD_NS 50000000LL // 50ms - reject samples beyond this
+#define OUTLIER_RESET_COUNT  16 // Consecutive outliers that restart the servo
+
+// Servo gains: offset follows 1/16 of the median residual per sample, the
+// frequency 1/1024 of the residual rate (critically damped for Kp^2/4)
+#define SERVO_KP_SHIFT     4
+#define SERVO_KI_SHIFT     10
+#define SERVO_MAX_SKEW_PPB 500000 // +-500 ppm
+
+// Message handed from the lwIP receive callback to the PTP task
+typedef struct {
+  int64_t local_ns; // Receive time, stamped in the tcpip thread
+  uint16_t len;     // Bytes copied to data
+  bool is_event_port;
+  uint32_t src_ip; // IPv4 sender, network byte order
+  uint8_t data[PTP_RX_COPY_SIZE];
+} ptp_rx_t;
+
+// Announce dataset of a foreign master, compared in IEEE 1588 BMCA order
+typedef struct {
+  bool valid;
+  uint32_t ip;
+  uint32_t last_ms;
+  uint8_t port_id[PTP_PORT_ID_SIZE];
+  uint8_t priority1;
+  uint8_t clock_class;
+  uint8_t accuracy;
+  uint16_t variance;
+  uint8_t priority2;
+  uint8_t gm_id[PTP_CLOCK_ID_SIZE];
+  uint16_t steps_removed;
+} ptp_foreign_t;
 
 // PTP state
 static struct {
   bool running;
   TaskHandle_t task_handle;
-  int event_socket;
-  int general_socket;
+  struct udp_pcb *event_pcb;
+  struct udp_pcb *general_pcb;
+  QueueHandle_t rx_queue;
 
   // Synchronization state
   bool locked;
   uint32_t lock_start_ms;
   uint32_t lock_candidate_start_ms;
   uint32_t last_sync_ms;
-  int64_t filtered_offset_ns; // PTP_time = local_time + offset
   uint32_t sample_count;
-
-  // Sample ring buffer for median filtering
+  uint32_t outlier_run;
+  int64_t last_offset_ns;
+  int64_t residual_ns;
+
+  // Servo model, PTP_time = local_time + offset(local_time):
+  // offset(t) = servo_offset_ns + anchor_trend_ns + skew * (t - anchor)
+  // The trend integrates the frequency estimate; samples are stored with it
+  // removed, so the median window only sees the remaining phase error.
+  portMUX_TYPE model_lock;
+  bool servo_valid;
+  int64_t servo_offset_ns;
+  int64_t anchor_local_ns;
+  int64_t anchor_trend_ns;
+  int32_t skew_ppb;
+
+  // Ring buffer of detrended samples in arrival order, and the same window
+  // kept sorted for the median and spread
   int64_t samples[SAMPLE_BUFFER_SIZE];
+  int64_t sorted[SAMPLE_BUFFER_SIZE];
   int sample_index;
   int sample_fill;
 
@@ -65,11 +125,29 @@ static struct {
   int64_t last_sync_local_ns;
   bool awaiting_followup;
 
+  // Group members from SETPEERS (set by the RTSP task); empty accepts any
+  // sender
+  portMUX_TYPE peers_lock;
+  uint32_t peers[PTP_MAX_PEERS];
+  size_t peer_count;
+
+  // Announcing masters and the one Sync/Follow_Up is taken from
+  ptp_foreign_t foreign[PTP_MAX_FOREIGN];
+  bool has_master;
+  uint8_t master_port_id[PTP_PORT_ID_SIZE];
+  uint8_t gm_id[PTP_CLOCK_ID_SIZE];
+  bool rebase_pending; // Grandmaster changed: re-derive the offset
+
   // Statistics
   uint32_t sync_count;
   uint32_t followup_count;
+  uint32_t gm_changes;
 } ptp = {0};
 
+// Deferred ptp_clock_clear() after a session ends; outside ptp so that
+// ptp_clock_init() does not lose it
+static esp_timer_handle_t clear_timer = NULL;
+
 // Parse 48-bit seconds + 32-bit nanoseconds from PTP timestamp
 static uint64_t parse_ptp_timestamp_ns(const uint8_t *data) {
   // Seconds: 6 bytes big-endian
@@ -90,99 +168,205 @@ static inline int64_t get_local_time_ns(void) {
   return (int64_t)esp_timer_get_time() * 1000LL;
 }
 
-// Compare function for qsort
-static int compare_int64(const void *a, const void *b) {
-  int64_t va = *(const int64_t *)a;
-  int64_t vb = *(const int64_t *)b;
-  if (va < vb) {
-    return -1;
+// First index in the sorted window whose value is >= value
+static int sorted_lower_bound(int64_t value) {
+  int lo = 0;
+  int hi = ptp.sample_fill;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (ptp.sorted[mid] < value) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
   }
-  if (va > vb) {
-    return 1;
+  return lo;
+}
+
+// Add a sample to the window, evicting the oldest once it is full
+static void window_push(int64_t value) {
+  if (ptp.sample_fill == SAMPLE_BUFFER_SIZE) {
+    int old = sorted_lower_bound(ptp.samples[ptp.sample_index]);
+    memmove(&ptp.sorted[old], &ptp.sorted[old + 1],
+            (size_t)(ptp.sample_fill - old - 1) * sizeof(int64_t));
+    ptp.sample_fill--;
   }
-  return 0;
+
+  int pos = sorted_lower_bound(value);
+  memmove(&ptp.sorted[pos + 1], &ptp.sorted[pos],
+          (size_t)(ptp.sample_fill - pos) * sizeof(int64_t));
+  ptp.sorted[pos] = value;
+  ptp.sample_fill++;
+
+  ptp.samples[ptp.sample_index] = value;
+  ptp.sample_index = (ptp.sample_index + 1) % SAMPLE_BUFFER_SIZE;
+}
+
+static void window_reset(void) {
+  ptp.sample_index = 0;
+  ptp.sample_fill = 0;
+}
+
+static int64_t window_median(void) {
+  return ptp.sample_fill > 0 ? ptp.sorted[ptp.sample_fill / 2] : 0;
 }
 
-// Compute median of samples
-static int64_t compute_median(void) {
+// Max deviation of any sample from the median
+static int64_t window_spread(void) {
   if (ptp.sample_fill == 0) {
     return 0;
   }
+  int64_t median = window_median();
+  int64_t low = median - ptp.sorted[0];
+  int64_t high = ptp.sorted[ptp.sample_fill - 1] - median;
+  return low > high ? low : high;
+}
 
-  int64_t sorted[SAMPLE_BUFFER_SIZE];
-  memcpy(sorted, ptp.samples, ptp.sample_fill * sizeof(int64_t));
-  qsort(sorted, ptp.sample_fill, sizeof(int64_t), compare_int64);
+// Frequency trend accumulated up to local time t
+static int64_t trend_at(int64_t local_ns) {
+  return ptp.anchor_trend_ns +
+         (int64_t)ptp.skew_ppb * (local_ns - ptp.anchor_local_ns) /
+             1000000000LL;
+}
 
-  return sorted[ptp.sample_fill / 2];
+// Offset predicted by the servo for local time t
+static int64_t model_offset_at(int64_t local_ns) {
+  portENTER_CRITICAL(&ptp.model_lock);
+  int64_t offset =
+      ptp.servo_valid ? ptp.servo_offset_ns + trend_at(local_ns) : 0;
+  portEXIT_CRITICAL(&ptp.model_lock);
+  return offset;
 }
 
-// Update offset with new sample using median filtering
-static void update_offset(int64_t new_offset_ns) {
-  uint32_t now_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
-  ptp.last_sync_ms = now_ms;
-  ptp.sample_count++;
+// (Re)start the servo from a single measurement, keeping the frequency
+static void servo_start(int64_t local_ns, int64_t offset_ns) {
+  portENTER_CRITICAL(&ptp.model_lock);
+  ptp.servo_offset_ns = offset_ns;
+  ptp.anchor_local_ns = local_ns;
+  ptp.anchor_trend_ns = 0;
+  ptp.servo_valid = true;
+  portEXIT_CRITICAL(&ptp.model_lock);
+
+  window_reset();
+  window_push(offset_ns);
+  ptp.outlier_run = 0;
+  ptp.residual_ns = 0;
+  ptp.locked = false;
+  ptp.lock_start_ms = 0;
+  ptp.lock_candidate_start_ms = 0;
+}
 
-  // Reject obvious outliers (more than 50ms from current estimate)
-  if (ptp.sample_fill > 0) {
-    int64_t diff = new_offset_ns - ptp.filtered_offset_ns;
-    if (diff < 0) {
-      diff = -diff;
-    }
-    if (diff > OUTLIER_THRESHOLD_NS) {
-      return;
-    }
-  }
+// Restart from a measurement on a new grandmaster's timeline. Lock is kept,
+// so playout carries on against the same anchor instead of dropping to the
+// unsynchronized path while the window refills.
+static void servo_rebase(int64_t local_ns, int64_t offset_ns) {
+  bool locked = ptp.locked;
+  uint32_t lock_start_ms = ptp.lock_start_ms;
+  servo_start(local_ns, offset_ns);
+  ptp.locked = locked;
+  ptp.lock_start_ms = lock_start_ms;
+}
 
-  // Add to ring buffer
-  ptp.samples[ptp.sample_index] = new_offset_ns;
-  ptp.sample_index = (ptp.sample_index + 1) % SAMPLE_BUFFER_SIZE;
-  if (ptp.sample_fill < SAMPLE_BUFFER_SIZE) {
-    ptp.sample_fill++;
-  }
+static int64_t abs64(int64_t v) {
+  return v < 0 ? -v : v;
+}
 
-  // Use median for filtered offset (robust to outliers)
-  ptp.filtered_offset_ns = compute_median();
+// Track lock on the servo residual and the spread of the sample window
+static void update_lock(uint32_t now_ms, int64_t residual) {
+  if (ptp.sample_fill < MIN_SAMPLES_FOR_LOCK) {
+    return;
+  }
 
-  // Check lock status based on sample variance
-  if (ptp.sample_fill >= MIN_SAMPLES_FOR_LOCK) {
-    // Compute max deviation from median
-    int64_t max_dev = 0;
-    for (int i = 0; i < ptp.sample_fill; i++) {
-      int64_t dev = ptp.samples[i] - ptp.filtered_offset_ns;
-      if (dev < 0) {
-        dev = -dev;
+  int64_t spread = window_spread();
+  residual = abs64(residual);
+  if (residual < LOCK_RESIDUAL_NS && spread < LOCK_SPREAD_NS) {
+    if (!ptp.locked) {
+      if (ptp.lock_candidate_start_ms == 0) {
+        ptp.lock_candidate_start_ms = now_ms;
       }
-      if (dev > max_dev) {
-        max_dev = dev;
+      if ((now_ms - ptp.lock_candidate_start_ms) >= LOCK_STABLE_TIME_MS) {
+        ptp.locked = true;
+        ptp.lock_start_ms = now_ms;
+        ptp.lock_candidate_start_ms = 0;
       }
     }
+  } else {
+    ptp.lock_candidate_start_ms = 0;
+    if (ptp.locked && (residual > LOCK_RESIDUAL_NS * 4 ||
+                       spread > LOCK_SPREAD_NS * 4)) {
+      ptp.locked = false;
+      ptp.lock_start_ms = 0;
+    }
+  }
+}
 
-    if (max_dev < LOCK_THRESHOLD_NS) {
-      if (!ptp.locked) {
-        if (ptp.lock_candidate_start_ms == 0) {
-          ptp.lock_candidate_start_ms = now_ms;
-        }
-        if ((now_ms - ptp.lock_candidate_start_ms) >= LOCK_STABLE_TIME_MS) {
-          ptp.locked = true;
-          ptp.lock_start_ms = now_ms;
-          ptp.lock_candidate_start_ms = 0;
-        }
-      }
-    } else {
-      ptp.lock_candidate_start_ms = 0;
-      if (ptp.locked && max_dev > LOCK_THRESHOLD_NS * 4) {
-        ptp.locked = false;
-        ptp.lock_start_ms = 0;
-      }
+// Feed one offset measurement (taken at local time local_ns) to the servo
+static void update_offset(int64_t local_ns, int64_t new_offset_ns) {
+  uint32_t now_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+  ptp.last_sync_ms = now_ms;
+  ptp.sample_count++;
+  ptp.last_offset_ns = new_offset_ns;
+
+  if (!ptp.servo_valid) {
+    servo_start(local_ns, new_offset_ns);
+    ptp.rebase_pending = false;
+    return;
+  }
+  if (ptp.rebase_pending) {
+    ESP_LOGI(TAG, "Re-deriving offset on new grandmaster: %" PRId64 " ns",
+             new_offset_ns - model_offset_at(local_ns));
+    servo_rebase(local_ns, new_offset_ns);
+    ptp.rebase_pending = false;
+    return;
+  }
+
+  // Reject outliers against the prediction; a run of them means the master
+  // stepped its clock (or changed), so start over from the new timeline
+  int64_t trend = trend_at(local_ns);
+  int64_t detrended = new_offset_ns - trend;
+  if (abs64(detrended - ptp.servo_offset_ns) > OUTLIER_THRESHOLD_NS) {
+    if (++ptp.outlier_run >= OUTLIER_RESET_COUNT) {
+      ESP_LOGW(TAG, "PTP timeline jumped, restarting servo");
+      servo_start(local_ns, new_offset_ns);
     }
+    return;
+  }
+  ptp.outlier_run = 0;
+
+  window_push(detrended);
+
+  // PI step on the median residual (robust to outliers): the proportional
+  // part pulls the offset, the integral part trims the frequency
+  int64_t median = window_median();
+  int64_t residual = median - ptp.servo_offset_ns;
+  int64_t interval_ns = local_ns - ptp.anchor_local_ns;
+  int64_t skew = ptp.skew_ppb;
+  if (interval_ns > 0) {
+    skew += residual * 1000000000LL / interval_ns / (1 << SERVO_KI_SHIFT);
   }
+  if (skew > SERVO_MAX_SKEW_PPB) {
+    skew = SERVO_MAX_SKEW_PPB;
+  } else if (skew < -SERVO_MAX_SKEW_PPB) {
+    skew = -SERVO_MAX_SKEW_PPB;
+  }
+
+  portENTER_CRITICAL(&ptp.model_lock);
+  ptp.servo_offset_ns += residual / (1 << SERVO_KP_SHIFT);
+  ptp.anchor_trend_ns = trend;
+  ptp.anchor_local_ns = local_ns;
+  ptp.skew_ppb = (int32_t)skew;
+  portEXIT_CRITICAL(&ptp.model_lock);
+
+  ptp.residual_ns = residual;
+  update_lock(now_ms, residual);
 }
 
 // Process SYNC message (records receive time)
-static void process_sync(const uint8_t *data, size_t len, uint16_t seq) {
+static void process_sync(const uint8_t *data, size_t len, uint16_t seq,
+                         int64_t local_ns) {
   ptp.sync_count++;
   ptp.last_sync_seq = seq;
-  ptp.last_sync_local_ns = get_local_time_ns();
+  ptp.last_sync_local_ns = local_ns;
   ptp.awaiting_followup = true;
 
   // Check if this is a one-step sync (timestamp in SYNC itself)
@@ -194,7 +378,7 @@ static void process_sync(const uint8_t *data, size_t len, uint16_t seq) {
     // One-step sync - timestamp is in the SYNC message
     uint64_t ptp_time_ns = parse_ptp_timestamp_ns(data + PTP_TIMESTAMP_OFFSET);
     int64_t offset = (int64_t)ptp_time_ns - ptp.last_sync_local_ns;
-    update_offset(offset);
+    update_offset(ptp.last_sync_local_ns, offset);
     ptp.awaiting_followup = false;
   }
 }
@@ -218,35 +402,173 @@ static void process_followup(const uint8_t *data, size_t len, uint16_t seq) {
 
     // offset = PTP_time - local_time_at_sync_receipt
     int64_t offset = (int64_t)ptp_time_ns - ptp.last_sync_local_ns;
-    update_offset(offset);
+    update_offset(ptp.last_sync_local_ns, offset);
+  }
+}
+
+static uint32_t tick_ms(void) {
+  return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+static uint64_t clock_id_u64(const uint8_t *id) {
+  uint64_t value = 0;
+  for (int i = 0; i < PTP_CLOCK_ID_SIZE; i++) {
+    value = (value << 8) | id[i];
+  }
+  return value;
+}
+
+static bool peer_allowed(uint32_t ip) {
+  bool allowed;
+  portENTER_CRITICAL(&ptp.peers_lock);
+  allowed = ptp.peer_count == 0;
+  for (size_t i = 0; i < ptp.peer_count && !allowed; i++) {
+    allowed = ptp.peers[i] == ip;
+  }
+  portEXIT_CRITICAL(&ptp.peers_lock);
+  return allowed;
+}
+
+// IEEE 1588 dataset comparison: negative if a is the better master
+static int compare_foreign(const ptp_foreign_t *a, const ptp_foreign_t *b) {
+  int gm = memcmp(a->gm_id, b->gm_id, PTP_CLOCK_ID_SIZE);
+  if (gm == 0) {
+    // Same grandmaster: prefer the shorter path, then the lower port
+    if (a->steps_removed != b->steps_removed) {
+      return a->steps_removed < b->steps_removed ? -1 : 1;
+    }
+    return memcmp(a->port_id, b->port_id, PTP_PORT_ID_SIZE);
+  }
+  if (a->priority1 != b->priority1) {
+    return a->priority1 - b->priority1;
+  }
+  if (a->clock_class != b->clock_class) {
+    return a->clock_class - b->clock_class;
+  }
+  if (a->accuracy != b->accuracy) {
+    return a->accuracy - b->accuracy;
+  }
+  if (a->variance != b->variance) {
+    return a->variance < b->variance ? -1 : 1;
+  }
+  if (a->priority2 != b->priority2) {
+    return a->priority2 - b->priority2;
+  }
+  return gm;
+}
+
+// Pick the best live master; a new grandmaster re-derives the offset
+static void select_master(uint32_t now) {
+  const ptp_foreign_t *best = NULL;
+  for (int i = 0; i < PTP_MAX_FOREIGN; i++) {
+    ptp_foreign_t *f = &ptp.foreign[i];
+    if (f->valid && (now - f->last_ms > ANNOUNCE_TIMEOUT_MS ||
+                     !peer_allowed(f->ip))) {
+      f->valid = false;
+    }
+    if (f->valid && (!best || compare_foreign(f, best) < 0)) {
+      best = f;
+    }
+  }
+
+  if (!best) {
+    if (ptp.has_master) {
+      ESP_LOGW(TAG, "PTP master lost");
+      ptp.has_master = false;
+    }
+    return;
+  }
+  if (ptp.has_master &&
+      memcmp(best->port_id, ptp.master_port_id, PTP_PORT_ID_SIZE) == 0) {
+    return;
+  }
+
+  bool gm_changed = !ptp.has_master ||
+                    memcmp(best->gm_id, ptp.gm_id, PTP_CLOCK_ID_SIZE) != 0;
+  ESP_LOGI(TAG, "PTP master %016" PRIx64 " (grandmaster %016" PRIx64 ")",
+           clock_id_u64(best->port_id), clock_id_u64(best->gm_id));
+  if (gm_changed && ptp.servo_valid) {
+    ptp.rebase_pending = true;
+    ptp.gm_changes++;
+  }
+  memcpy(ptp.master_port_id, best->port_id, PTP_PORT_ID_SIZE);
+  memcpy(ptp.gm_id, best->gm_id, PTP_CLOCK_ID_SIZE);
+  ptp.has_master = true;
+  ptp.awaiting_followup = false; // A pending SYNC came from the old master
+}
+
+// Record an Announce in the foreign master table
+static void process_announce(const uint8_t *data, size_t len, uint32_t ip,
+                             uint32_t now) {
+  if (len < PTP_ANNOUNCE_SIZE) {
+    return;
+  }
+
+  const uint8_t *port_id = data + PTP_PORT_ID_OFFSET;
+  ptp_foreign_t *slot = NULL;
+  for (int i = 0; i < PTP_MAX_FOREIGN && !slot; i++) {
+    if (ptp.foreign[i].valid &&
+        memcmp(ptp.foreign[i].port_id, port_id, PTP_PORT_ID_SIZE) == 0) {
+      slot = &ptp.foreign[i];
+    }
+  }
+  for (int i = 0; i < PTP_MAX_FOREIGN && !slot; i++) {
+    if (!ptp.foreign[i].valid) {
+      slot = &ptp.foreign[i];
+    }
+  }
+  if (!slot) {
+    return; // Table full of live masters
   }
+
+  slot->valid = true;
+  slot->ip = ip;
+  slot->last_ms = now;
+  memcpy(slot->port_id, port_id, PTP_PORT_ID_SIZE);
+  slot->priority1 = data[47];
+  slot->clock_class = data[48];
+  slot->accuracy = data[49];
+  slot->variance = ((uint16_t)data[50] << 8) | data[51];
+  slot->priority2 = data[52];
+  memcpy(slot->gm_id, data + 53, PTP_CLOCK_ID_SIZE);
+  slot->steps_removed = ((uint16_t)data[61] << 8) | data[62];
 }
 
 // Process received PTP message
-static void process_ptp_message(const uint8_t *data, size_t len,
-                                bool is_event_port) {
-  if (len < PTP_HEADER_SIZE) {
+static void process_ptp_message(const ptp_rx_t *rx) {
+  const uint8_t *data = rx->data;
+  size_t len = rx->len;
+  if (len < PTP_HEADER_SIZE || !peer_allowed(rx->src_ip)) {
     return;
   }
 
   uint8_t msg_type = data[0] & 0x0F;
   uint16_t seq = ((uint16_t)data[30] << 8) | data[31];
 
+  // Once a master is selected, timing only comes from it
+  bool from_master =
+      !ptp.has_master || memcmp(data + PTP_PORT_ID_OFFSET, ptp.master_port_id,
+                                PTP_PORT_ID_SIZE) == 0;
+
   switch (msg_type) {
   case PTP_MSG_SYNC:
-    if (is_event_port) {
-      process_sync(data, len, seq);
+    if (rx->is_event_port && from_master) {
+      process_sync(data, len, seq, rx->local_ns);
     }
     break;
 
   case PTP_MSG_FOLLOW_UP:
-    if (!is_event_port) {
+    if (!rx->is_event_port && from_master) {
       process_followup(data, len, seq);
     }
     break;
 
   case PTP_MSG_ANNOUNCE:
-    // Could track master identity here if needed
+    if (!rx->is_event_port) {
+      uint32_t now = tick_ms();
+      process_announce(data, len, rx->src_ip, now);
+      select_master(now);
+    }
     break;
 
   default:
@@ -254,120 +576,106 @@ static void process_ptp_message(const uint8_t *data, size_t len,
   }
 }
 
-// Create and bind multicast socket
-static int create_ptp_socket(uint16_t port) {
-  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-  if (sock < 0) {
-    ESP_LOGE(TAG, "Failed to create socket: %d", errno);
-    return -1;
-  }
+// Runs in the tcpip thread straight from UDP input: the SYNC receive time is
+// taken here, before socket mailboxes and task scheduling add their jitter
+static void ptp_recv_cb(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+                        const ip_addr_t *addr, u16_t port) {
+  ptp_rx_t rx;
+  rx.local_ns = get_local_time_ns();
+  rx.is_event_port = arg != NULL;
+  rx.src_ip = ip4_addr_get_u32(ip_2_ip4(addr));
+  rx.len = pbuf_copy_partial(p, rx.data, sizeof(rx.data), 0);
+  pbuf_free(p);
+
+  // Never block the stack; a SYNC lost to a full queue is just skipped
+  xQueueSend(ptp.rx_queue, &rx, 0);
+}
 
-  // Allow address reuse
-  int opt = 1;
-  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+typedef struct {
+  struct tcpip_api_call_data call;
+  uint16_t port;
+  struct udp_pcb *pcb;
+} ptp_pcb_msg_t;
 
-  // Bind to port
-  struct sockaddr_in addr = {0};
-  addr.sin_family = AF_INET;
-  addr.sin_addr.s_addr = htonl(INADDR_ANY);
-  addr.sin_port = htons(port);
+static err_t open_pcb_cb(struct tcpip_api_call_data *call) {
+  ptp_pcb_msg_t *msg = (ptp_pcb_msg_t *)call;
 
-  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-    ESP_LOGE(TAG, "Failed to bind to port %d: %d", port, errno);
-    close(sock);
-    return -1;
+  struct udp_pcb *pcb = udp_new_ip_type(IPADDR_TYPE_V4);
+  if (!pcb) {
+    return ERR_MEM;
   }
+  ip_set_option(pcb, SOF_REUSEADDR);
 
-  // Join multicast group
-  struct ip_mreq mreq = {0};
-  mreq.imr_multiaddr.s_addr = inet_addr(PTP_MULTICAST_ADDR);
-  mreq.imr_interface.s_addr = htonl(INADDR_ANY);
-
-  if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) <
-      0) {
-    ESP_LOGE(TAG, "Failed to join multicast group: %d", errno);
-    close(sock);
-    return -1;
+  err_t err = udp_bind(pcb, IP4_ADDR_ANY, msg->port);
+  if (err == ERR_OK) {
+    ip4_addr_t group;
+    ip4addr_aton(PTP_MULTICAST_ADDR, &group);
+    err = igmp_joingroup(IP4_ADDR_ANY4, &group);
+  }
+  if (err != ERR_OK) {
+    udp_remove(pcb);
+    return err;
   }
 
-  // Set receive timeout
-  struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
-  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-
-  return sock;
+  udp_recv(pcb, ptp_recv_cb,
+           msg->port == PTP_EVENT_PORT ? (void *)pcb : NULL);
+  msg->pcb = pcb;
+  return ERR_OK;
 }
 
-// PTP task - listens for messages on both ports
-static void ptp_task(void *pvParameters) {
-  uint8_t buffer[256];
+static err_t close_pcb_cb(struct tcpip_api_call_data *call) {
+  ptp_pcb_msg_t *msg = (ptp_pcb_msg_t *)call;
 
-  while (ptp.running) {
-    fd_set read_fds;
-    FD_ZERO(&read_fds);
-
-    int max_fd = -1;
-    if (ptp.event_socket >= 0) {
-      FD_SET(ptp.event_socket, &read_fds);
-      if (ptp.event_socket > max_fd) {
-        max_fd = ptp.event_socket;
-      }
-    }
-    if (ptp.general_socket >= 0) {
-      FD_SET(ptp.general_socket, &read_fds);
-      if (ptp.general_socket > max_fd) {
-        max_fd = ptp.general_socket;
-      }
-    }
+  ip4_addr_t group;
+  ip4addr_aton(PTP_MULTICAST_ADDR, &group);
+  igmp_leavegroup(IP4_ADDR_ANY4, &group);
+  udp_remove(msg->pcb);
+  return ERR_OK;
+}
 
-    if (max_fd < 0) {
-      vTaskDelay(pdMS_TO_TICKS(100));
-      continue;
-    }
+// Bind a raw UDP PCB to the port and join the PTP multicast group
+static struct udp_pcb *open_ptp_pcb(uint16_t port) {
+  ptp_pcb_msg_t msg = {.port = port};
+  err_t err = tcpip_api_call(open_pcb_cb, &msg.call);
+  if (err != ERR_OK) {
+    ESP_LOGE(TAG, "Failed to open PTP port %d: %d", port, err);
+    return NULL;
+  }
+  return msg.pcb;
+}
 
-    struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
-    int ret = select(max_fd + 1, &read_fds, NULL, NULL, &tv);
+static void close_ptp_pcb(struct udp_pcb **pcb) {
+  if (*pcb) {
+    ptp_pcb_msg_t msg = {.pcb = *pcb};
+    tcpip_api_call(close_pcb_cb, &msg.call);
+    *pcb = NULL;
+  }
+}
 
-    if (ret < 0) {
-      if (errno != EINTR) {
-        ESP_LOGE(TAG, "select error: %d", errno);
-      }
-      continue;
-    }
+// PTP task - processes messages queued by the receive callback
+static void ptp_task(void *pvParameters) {
+  ptp_rx_t rx;
 
-    if (ret == 0) {
-      // Timeout - check if we lost lock due to no messages
+  while (ptp.running) {
+    if (xQueueReceive(ptp.rx_queue, &rx, pdMS_TO_TICKS(1000)) != pdTRUE) {
+      select_master(tick_ms()); // Expire a master that went silent
       continue;
     }
-
-    // Check event port (SYNC messages)
-    if (ptp.event_socket >= 0 && FD_ISSET(ptp.event_socket, &read_fds)) {
-      ssize_t len = recv(ptp.event_socket, buffer, sizeof(buffer), 0);
-      if (len > 0) {
-        process_ptp_message(buffer, (size_t)len, true);
-      }
-    }
-
-    // Check general port (FOLLOW_UP messages)
-    if (ptp.general_socket >= 0 && FD_ISSET(ptp.general_socket, &read_fds)) {
-      ssize_t len = recv(ptp.general_socket, buffer, sizeof(buffer), 0);
-      if (len > 0) {
-        process_ptp_message(buffer, (size_t)len, false);
-      }
-    }
+    process_ptp_message(&rx);
   }
 
   // Cleanup
-  if (ptp.event_socket >= 0) {
-    close(ptp.event_socket);
-    ptp.event_socket = -1;
-  }
-  if (ptp.general_socket >= 0) {
-    close(ptp.general_socket);
-    ptp.general_socket = -1;
-  }
+  close_ptp_pcb(&ptp.event_pcb);
+  close_ptp_pcb(&ptp.general_pcb);
 
   ptp.task_handle = NULL;
-  vTaskDelete(NULL);
+  task_placement_exit(TASK_PTP);
+}
+
+static void clear_timer_cb(void *arg) {
+  (void)arg;
+  ESP_LOGI(TAG, "No new session, clearing PTP state");
+  ptp_clock_clear();
 }
 
 esp_err_t ptp_clock_init(void) {
@@ -375,33 +683,47 @@ esp_err_t ptp_clock_init(void) {
     return ESP_ERR_INVALID_STATE;
   }
 
+  if (ptp.rx_queue) {
+    vQueueDelete(ptp.rx_queue);
+  }
   memset(&ptp, 0, sizeof(ptp));
-  ptp.event_socket = -1;
-  ptp.general_socket = -1;
+  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  ptp.model_lock = lock;
+  ptp.peers_lock = lock;
 
-  // Create sockets
-  ptp.event_socket = create_ptp_socket(PTP_EVENT_PORT);
-  if (ptp.event_socket < 0) {
+  ptp.rx_queue = xQueueCreate(PTP_RX_QUEUE_DEPTH, sizeof(ptp_rx_t));
+  if (!ptp.rx_queue) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Open ports
+  ptp.event_pcb = open_ptp_pcb(PTP_EVENT_PORT);
+  if (!ptp.event_pcb) {
     return ESP_FAIL;
   }
 
-  ptp.general_socket = create_ptp_socket(PTP_GENERAL_PORT);
-  if (ptp.general_socket < 0) {
-    close(ptp.event_socket);
-    ptp.event_socket = -1;
+  ptp.general_pcb = open_ptp_pcb(PTP_GENERAL_PORT);
+  if (!ptp.general_pcb) {
+    close_ptp_pcb(&ptp.event_pcb);
     return ESP_FAIL;
   }
 
-  // Start task
+  if (!clear_timer) {
+    const esp_timer_create_args_t timer_args = {
+        .callback = clear_timer_cb,
+        .name = "ptp_clear",
+    };
+    esp_timer_create(&timer_args, &clear_timer);
+  }
+
+  // Start task. Timestamps are taken in the receive callback, so it no
+  // longer needs to preempt the RTSP and audio receive tasks.
   ptp.running = true;
-  BaseType_t ret =
-      xTaskCreate(ptp_task, "ptp_clock", 4096, NULL, 6, &ptp.task_handle);
-  if (ret != pdPASS) {
+  if (task_placement_spawn(TASK_PTP, ptp_task, NULL, &ptp.task_handle) !=
+      ESP_OK) {
     ESP_LOGE(TAG, "Failed to create PTP task");
-    close(ptp.event_socket);
-    close(ptp.general_socket);
-    ptp.event_socket = -1;
-    ptp.general_socket = -1;
+    close_ptp_pcb(&ptp.event_pcb);
+    close_ptp_pcb(&ptp.general_pcb);
     ptp.running = false;
     return ESP_FAIL;
   }
@@ -416,15 +738,11 @@ void ptp_clock_stop(void) {
 
   ptp.running = false;
 
-  // Close sockets to unblock select
-  if (ptp.event_socket >= 0) {
-    close(ptp.event_socket);
-    ptp.event_socket = -1;
-  }
-  if (ptp.general_socket >= 0) {
-    close(ptp.general_socket);
-    ptp.general_socket = -1;
-  }
+  // Close ports so no more messages arrive, then wake the task
+  close_ptp_pcb(&ptp.event_pcb);
+  close_ptp_pcb(&ptp.general_pcb);
+  ptp_rx_t wake = {0};
+  xQueueSend(ptp.rx_queue, &wake, 0);
 
   // Wait for task to exit
   if (ptp.task_handle) {
@@ -437,17 +755,63 @@ void ptp_clock_clear(void) {
   ptp.lock_start_ms = 0;
   ptp.lock_candidate_start_ms = 0;
   ptp.last_sync_ms = 0;
-  ptp.filtered_offset_ns = 0;
   ptp.sample_count = 0;
-  ptp.sample_index = 0;
-  ptp.sample_fill = 0;
+  window_reset();
+  ptp.outlier_run = 0;
+  ptp.last_offset_ns = 0;
+  ptp.residual_ns = 0;
+
+  // The frequency estimate describes our crystal, so it survives sessions
+  portENTER_CRITICAL(&ptp.model_lock);
+  ptp.servo_valid = false;
+  ptp.servo_offset_ns = 0;
+  ptp.anchor_trend_ns = 0;
+  portEXIT_CRITICAL(&ptp.model_lock);
 
   ptp.last_sync_seq = 0;
   ptp.last_sync_local_ns = 0;
   ptp.awaiting_followup = false;
 
+  // The next session announces its own group
+  portENTER_CRITICAL(&ptp.peers_lock);
+  ptp.peer_count = 0;
+  portEXIT_CRITICAL(&ptp.peers_lock);
+  memset(ptp.foreign, 0, sizeof(ptp.foreign));
+  ptp.has_master = false;
+  ptp.rebase_pending = false;
+
   ptp.sync_count = 0;
   ptp.followup_count = 0;
+  ptp.gm_changes = 0;
+}
+
+void ptp_clock_clear_later(uint32_t delay_ms) {
+  if (delay_ms == 0 || !clear_timer) {
+    ptp_clock_clear();
+    return;
+  }
+  esp_timer_stop(clear_timer);
+  esp_timer_start_once(clear_timer, (uint64_t)delay_ms * 1000);
+}
+
+void ptp_clock_set_peers(const uint32_t *addrs, size_t count) {
+  // A new session: whatever lock the last one left behind is reused
+  if (clear_timer) {
+    esp_timer_stop(clear_timer);
+  }
+
+  if (count > PTP_MAX_PEERS) {
+    ESP_LOGW(TAG, "%zu PTP peers, keeping the first %d", count,
+             PTP_MAX_PEERS);
+    count = PTP_MAX_PEERS;
+  }
+
+  portENTER_CRITICAL(&ptp.peers_lock);
+  if (addrs) {
+    memcpy(ptp.peers, addrs, count * sizeof(uint32_t));
+  }
+  ptp.peer_count = addrs ? count : 0;
+  portEXIT_CRITICAL(&ptp.peers_lock);
 }
 
 bool ptp_clock_is_locked(void) {
@@ -465,22 +829,22 @@ bool ptp_clock_is_locked(void) {
 
 uint64_t ptp_clock_get_time_ns(void) {
   int64_t local_ns = get_local_time_ns();
-  return (uint64_t)(local_ns + ptp.filtered_offset_ns);
+  return (uint64_t)(local_ns + model_offset_at(local_ns));
 }
 
 int64_t ptp_clock_get_offset_ns(void) {
-  return ptp.filtered_offset_ns;
+  return model_offset_at(get_local_time_ns());
 }
 
 void ptp_clock_get_stats(ptp_stats_t *stats) {
   stats->sync_count = ptp.sync_count;
   stats->followup_count = ptp.followup_count;
-  stats->last_offset_ns =
-      ptp.sample_fill > 0
-          ? ptp.samples[(ptp.sample_index + SAMPLE_BUFFER_SIZE - 1) %
-                        SAMPLE_BUFFER_SIZE]
-          : 0;
-  stats->filtered_offset_ns = ptp.filtered_offset_ns;
+  stats->last_offset_ns = ptp.last_offset_ns;
+  stats->filtered_offset_ns = model_offset_at(get_local_time_ns());
+  stats->freq_ppb = ptp.skew_ppb;
+  stats->residual_ns = ptp.residual_ns;
+  stats->gm_identity = ptp.has_master ? clock_id_u64(ptp.gm_id) : 0;
+  stats->gm_changes = ptp.gm_changes;
 
   if (ptp.locked && ptp.lock_start_ms > 0) {
     uint32_t now_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
@@ -1,12 +1,19 @@
 #pragma once
 
-#include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "esp_err.h"
 
 /**
  * Simple PTP (IEEE 1588) slave for AirPlay time synchronization.
  * Listens for SYNC/FOLLOW_UP messages and tracks offset to PTP master.
+ * A PI servo estimates both the offset and the frequency skew, so the
+ * offset keeps extrapolating between SYNC messages.
+ *
+ * In a multi-room group every member announces itself; a best master
+ * selection over the Announce messages of the SETPEERS group picks the
+ * master the SYNCs are taken from.
  */
 
 /**
@@ -27,6 +34,23 @@ void ptp_clock_stop(void);
  */
 void ptp_clock_clear(void);
 
+/**
+ * Clear the synchronization state after delay_ms unless a new session sets
+ * its peers first, so a sender that reconnects finds the clock still
+ * locked. A new grandmaster is handled by the usual rebase.
+ * @param delay_ms Grace period, 0 clears at once
+ */
+void ptp_clock_clear_later(uint32_t delay_ms);
+
+/**
+ * Restrict PTP to the members of the current group.
+ * Messages from other hosts are ignored; an empty list accepts any sender.
+ * A change of grandmaster re-derives the offset, keeping the lock.
+ * @param addrs IPv4 addresses in network byte order
+ * @param count Number of addresses
+ */
+void ptp_clock_set_peers(const uint32_t *addrs, size_t count);
+
 /**
  * Check if PTP is locked to a master clock.
  * @return true if synchronized with acceptable accuracy
@@ -35,14 +59,14 @@ bool ptp_clock_is_locked(void);
 
 /**
  * Get current PTP time in nanoseconds.
- * Returns local time adjusted by PTP offset.
+ * Returns local time adjusted by the PTP offset extrapolated to now.
  * @return PTP time in nanoseconds since epoch
  */
 uint64_t ptp_clock_get_time_ns(void);
 
 /**
  * Get current offset from local clock to PTP time in nanoseconds.
- * PTP_time = local_time + offset
+ * PTP_time = local_time + offset, extrapolated with the frequency estimate.
  */
 int64_t ptp_clock_get_offset_ns(void);
 
@@ -53,8 +77,12 @@ typedef struct {
   uint32_t sync_count;        // Number of SYNC messages received
   uint32_t followup_count;    // Number of FOLLOW_UP messages received
   int64_t last_offset_ns;     // Last measured offset
-  int64_t filtered_offset_ns; // Filtered/averaged offset
+  int64_t filtered_offset_ns; // Servo offset, extrapolated to now
+  int32_t freq_ppb;           // Master rate relative to ours, minus one
+  int64_t residual_ns;        // Last median residual seen by the servo
   uint32_t lock_time_ms;      // Time since lock achieved (0 if not locked)
+  uint64_t gm_identity;       // Selected grandmaster (0 before an Announce)
+  uint32_t gm_changes;        // Grandmaster changes that re-derived the offset
 } ptp_stats_t;
 
 void ptp_clock_get_stats(ptp_stats_t *stats);
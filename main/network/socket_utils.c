@@ -89,3 +89,14 @@ int socket_utils_bind_tcp_listener(uint16_t port, int backlog, bool nonblocking,
 
   return sock;
 }
+
+void socket_utils_set_realtime_dscp(int sock) {
+#if CONFIG_NET_REALTIME_DSCP > 0
+  int tos = CONFIG_NET_REALTIME_DSCP << 2; // DSCP is the upper six TOS bits
+  if (setsockopt(sock, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) < 0) {
+    ESP_LOGW(TAG, "Failed to set IP_TOS on socket %d: %d", sock, errno);
+  }
+#else
+  (void)sock;
+#endif
+}
@@ -7,3 +7,9 @@ int socket_utils_bind_udp(uint16_t port, int recv_timeout_sec, int recvbuf_size,
                           uint16_t *bound_port);
 int socket_utils_bind_tcp_listener(uint16_t port, int backlog, bool nonblocking,
                                    uint16_t *bound_port);
+
+/**
+ * Mark outgoing packets with CONFIG_NET_REALTIME_DSCP, from which the Wi-Fi
+ * driver picks the WMM access category. No-op when the option is 0.
+ */
+void socket_utils_set_realtime_dscp(int sock);
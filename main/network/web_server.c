@@ -5,15 +5,50 @@
 #include "esp_app_desc.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
 #include "cJSON.h"
 #include <sys/types.h>
+#include <inttypes.h>
+#include <stdarg.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
+#include "mdns_airplay.h"
 #include "settings.h"
 #include "wifi.h"
+#if CONFIG_AUDIO_EQ
+#include "audio_eq.h"
+#endif
+#if CONFIG_AUDIO_CHANNEL_SELECT
+#include "audio_channel.h"
+#endif
+#if CONFIG_AUDIO_TRACE
+#include "audio_trace.h"
+#endif
+#if CONFIG_AUDIO_BENCH
+#include "audio_bench.h"
+#endif
+#if CONFIG_TASK_STATS
+#include "task_stats.h"
+#endif
+#if CONFIG_POWER_DFS
+#include "power_mgmt.h"
+#endif
+#if CONFIG_AUDIO_BENCH_SUITE
+#include "audio_bench_suite.h"
+#include "esp_chip_info.h"
+#include "esp_flash.h"
+#endif
+#include "audio_output.h"
+#include "audio_receiver.h"
+#include "mem_budget.h"
+#include "ntp_clock.h"
+#include "ptp_clock.h"
 #include "ota.h"
+#include "rtsp_events.h"
 #include "rtsp_server.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -22,31 +57,63 @@
 static const char *TAG = "web_server";
 static httpd_handle_t s_server = NULL;
 
-// HTML control panel (embedded from network/main.html)
-// Note: ESP-IDF's EMBED_TXTFILES generates symbols based on the file basename
-// ("main.html" -> _binary_main_html_start/end).
-extern const char control_panel_html_start[] asm("_binary_main_html_start");
-extern const char control_panel_html_end[] asm("_binary_main_html_end");
+#define HTTPD_STACK_SIZE 8192
 
-static const char *HTML_CONTROL_PANEL = control_panel_html_start;
+// HTML control panel, gzipped from network/main.html at build time
+// (target_add_binary_data: "main.html.gz" -> _binary_main_html_gz_start/end)
+extern const uint8_t
+    control_panel_gz_start[] asm("_binary_main_html_gz_start");
+extern const uint8_t control_panel_gz_end[] asm("_binary_main_html_gz_end");
 
-static size_t html_control_panel_len(void) {
-  ptrdiff_t len = control_panel_html_end - control_panel_html_start;
+static size_t control_panel_gz_len(void) {
+  ptrdiff_t len = control_panel_gz_end - control_panel_gz_start;
   if (len <= 0) {
     return 0;
   }
   return (size_t)len;
 }
 
+// Quoted hash of the compressed page, so browsers revalidate with
+// If-None-Match and only a new firmware's page is sent again
+static const char *control_panel_etag(void) {
+  static char etag[12];
+  if (etag[0] == '\0') {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (const uint8_t *p = control_panel_gz_start; p < control_panel_gz_end;
+         p++) {
+      hash = (hash ^ *p) * 16777619u;
+    }
+    snprintf(etag, sizeof(etag), "\"%08" PRIx32 "\"", hash);
+  }
+  return etag;
+}
+
 // API handlers
 static esp_err_t root_handler(httpd_req_t *req) {
-  httpd_resp_set_type(req, "text/html");
-  size_t len = html_control_panel_len();
+  size_t len = control_panel_gz_len();
   if (len == 0) {
     httpd_resp_send_500(req);
     return ESP_FAIL;
   }
-  httpd_resp_send(req, HTML_CONTROL_PANEL, (ssize_t)len);
+
+  const char *etag = control_panel_etag();
+  httpd_resp_set_hdr(req, "ETag", etag);
+  // Cached, but checked against the ETag on every load
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+  char if_none_match[16];
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match,
+                                  sizeof(if_none_match)) == ESP_OK &&
+      strcmp(if_none_match, etag) == 0) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_send(req, NULL, 0);
+    return ESP_OK;
+  }
+
+  // Only the compressed copy is embedded; every browser accepts gzip
+  httpd_resp_set_type(req, "text/html");
+  httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+  httpd_resp_send(req, (const char *)control_panel_gz_start, (ssize_t)len);
   return ESP_OK;
 }
 
@@ -77,14 +144,25 @@ static esp_err_t captive_windows_handler(httpd_req_t *req) {
   return captive_portal_redirect(req);
 }
 
+// Serves the last background scan; the page polls while "scanning" is set
 static esp_err_t wifi_scan_handler(httpd_req_t *req) {
   wifi_ap_record_t *ap_list = NULL;
   uint16_t ap_count = 0;
+  wifi_scan_info_t info;
+  bool refresh = false;
+
+  char query[32];
+  char value[8];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "refresh", value, sizeof(value)) ==
+          ESP_OK) {
+    refresh = strcmp(value, "1") == 0;
+  }
 
   cJSON *json = cJSON_CreateObject();
-  esp_err_t err = wifi_scan(&ap_list, &ap_count);
+  esp_err_t err = wifi_scan_get_cached(refresh, &ap_list, &ap_count, &info);
 
-  if (err == ESP_OK && ap_list) {
+  if (err == ESP_OK) {
     cJSON *networks = cJSON_CreateArray();
     for (uint16_t i = 0; i < ap_count; i++) {
       cJSON *net = cJSON_CreateObject();
@@ -95,6 +173,9 @@ static esp_err_t wifi_scan_handler(httpd_req_t *req) {
       cJSON_AddItemToArray(networks, net);
     }
     cJSON_AddItemToObject(json, "networks", networks);
+    cJSON_AddNumberToObject(json, "age_ms", (double)info.age_ms);
+    cJSON_AddBoolToObject(json, "scanning", info.scanning);
+    cJSON_AddBoolToObject(json, "streaming", info.streaming);
     cJSON_AddBoolToObject(json, "success", true);
     free(ap_list);
   } else {
@@ -269,6 +350,7 @@ static esp_err_t device_name_handler(httpd_req_t *req) {
     const char *name = cJSON_GetStringValue(name_json);
     esp_err_t err = settings_set_device_name(name);
     if (err == ESP_OK) {
+      mdns_airplay_set_name(name);
       cJSON_AddBoolToObject(response, "success", true);
     } else {
       cJSON_AddBoolToObject(response, "success", false);
@@ -295,11 +377,16 @@ static esp_err_t ota_update_handler(httpd_req_t *req) {
     return ESP_FAIL;
   }
 
-  // Stop AirPlay to free resources during OTA
-  ESP_LOGI(TAG, "Stopping AirPlay for OTA update");
-  rtsp_server_stop();
+  // ?defer=1 holds the upload until playback pauses
+  char query[32];
+  char value[4];
+  bool defer =
+      httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "defer", value, sizeof(value)) == ESP_OK &&
+      strcmp(value, "1") == 0;
 
-  esp_err_t err = ota_start_from_http(req);
+  ota_report_t report;
+  esp_err_t err = ota_start_from_http(req, defer, &report);
 
   if (err != ESP_OK) {
     httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
@@ -308,8 +395,16 @@ static esp_err_t ota_update_handler(httpd_req_t *req) {
   }
 
   // Send response before restarting
+  char msg[192];
+  snprintf(msg, sizeof(msg),
+           "Firmware update complete, rebooting now!\n"
+           "%zu bytes in %" PRIu32 " ms (%s), longest stall: erase %" PRIu32
+           " us, write %" PRIu32 " us\n",
+           report.written_bytes, report.duration_ms,
+           ota_mode_name(report.mode), report.erase_stall_max_us,
+           report.write_stall_max_us);
   httpd_resp_set_type(req, "text/plain");
-  httpd_resp_sendstr(req, "Firmware update complete, rebooting now!\n");
+  httpd_resp_sendstr(req, msg);
   vTaskDelay(pdMS_TO_TICKS(500));
   esp_restart();
 
@@ -352,6 +447,23 @@ static esp_err_t system_info_handler(httpd_req_t *req) {
     }
   }
 
+  rtsp_now_playing_t np;
+  if (rtsp_events_get_now_playing(&np)) {
+    cJSON *now_playing = cJSON_CreateObject();
+    char persistent_id[17];
+    snprintf(persistent_id, sizeof(persistent_id), "%016" PRIx64,
+             np.persistent_id);
+    cJSON_AddStringToObject(now_playing, "title", np.title);
+    cJSON_AddStringToObject(now_playing, "album", np.album);
+    cJSON_AddStringToObject(now_playing, "artist", np.artist);
+    cJSON_AddStringToObject(now_playing, "genre", np.genre);
+    cJSON_AddNumberToObject(now_playing, "track_number", np.track_number);
+    cJSON_AddNumberToObject(now_playing, "track_count", np.track_count);
+    cJSON_AddNumberToObject(now_playing, "duration_ms", np.duration_ms);
+    cJSON_AddStringToObject(now_playing, "persistent_id", persistent_id);
+    cJSON_AddItemToObject(info, "now_playing", now_playing);
+  }
+
   cJSON_AddItemToObject(json, "info", info);
   cJSON_AddBoolToObject(json, "success", true);
 
@@ -381,6 +493,725 @@ static esp_err_t system_restart_handler(httpd_req_t *req) {
   return ESP_OK;
 }
 
+// Prometheus text exposition, built in one buffer and sent in one go
+#define METRICS_BUFFER_SIZE 8192
+
+typedef struct {
+  char *buf;
+  size_t len;
+} metrics_t;
+
+static void metrics_printf(metrics_t *m, const char *fmt, ...) {
+  if (m->len >= METRICS_BUFFER_SIZE - 1) {
+    return;
+  }
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(m->buf + m->len, METRICS_BUFFER_SIZE - m->len, fmt, args);
+  va_end(args);
+  if (n > 0) {
+    m->len += (size_t)n;
+    if (m->len > METRICS_BUFFER_SIZE - 1) {
+      m->len = METRICS_BUFFER_SIZE - 1; // Truncated; keep what fit
+    }
+  }
+}
+
+static void metrics_header(metrics_t *m, const char *name, const char *type,
+                           const char *help) {
+  metrics_printf(m, "# HELP airplay_%s %s\n# TYPE airplay_%s %s\n", name,
+                 help, name, type);
+}
+
+static void metric(metrics_t *m, const char *name, const char *type,
+                   const char *help, double value) {
+  metrics_header(m, name, type, help);
+  metrics_printf(m, "airplay_%s %.10g\n", name, value);
+}
+
+static esp_err_t metrics_handler(httpd_req_t *req) {
+  metrics_t m = {
+      .buf = mem_alloc(MEM_TAG_HTTPD, METRICS_BUFFER_SIZE, MALLOC_CAP_8BIT)};
+  if (!m.buf) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    return ESP_FAIL;
+  }
+
+  audio_stats_t stats;
+  audio_receiver_get_stats(&stats);
+  metric(&m, "packets_received_total", "counter", "RTP packets received",
+         stats.packets_received);
+  metric(&m, "packets_decoded_total", "counter", "Packets decoded",
+         stats.packets_decoded);
+  metric(&m, "packets_dropped_total", "counter",
+         "Packets lost, undecodable or dropped", stats.packets_dropped);
+  metric(&m, "decrypt_errors_total", "counter", "Packets failing decryption",
+         stats.decrypt_errors);
+  metric(&m, "nack_requested_total", "counter",
+         "Packets asked for in retransmit requests",
+         stats.retransmits_requested);
+  metric(&m, "nack_recovered_total", "counter", "Retransmitted packets received",
+         stats.retransmits_received);
+  metric(&m, "buffer_underruns_total", "counter",
+         "Playout found the jitter buffer empty", stats.buffer_underruns);
+  metric(&m, "buffer_overruns_total", "counter",
+         "Frames dropped because the jitter buffer was full",
+         stats.buffer_overruns);
+  metric(&m, "late_frames_total", "counter", "Frames dropped as too late",
+         stats.late_frames);
+  metric(&m, "early_frames_total", "counter",
+         "Frames held back with silence until due", stats.early_frames);
+  metric(&m, "concealed_gaps_total", "counter",
+         "Timeline gaps filled by packet-loss concealment",
+         stats.concealed_gaps);
+  metric(&m, "buffer_depth_frames", "gauge", "Decoded frames waiting for playout",
+         stats.pcm_depth_frames);
+  metric(&m, "buffer_target_frames", "gauge", "Adaptive playout depth",
+         stats.target_depth_frames);
+  metric(&m, "decode_queue_depth", "gauge", "Packets waiting for the decoder",
+         stats.decode_queue_depth);
+  metric(&m, "decode_queue_drops_total", "counter",
+         "Packets dropped because the decoder fell behind",
+         stats.decode_queue_drops);
+  metrics_header(&m, "jitter_us", "gauge", "Excess arrival delay percentile");
+  metrics_printf(&m,
+                 "airplay_jitter_us{quantile=\"0.5\"} %" PRIu32 "\n"
+                 "airplay_jitter_us{quantile=\"0.95\"} %" PRIu32 "\n"
+                 "airplay_jitter_us{quantile=\"0.99\"} %" PRIu32 "\n",
+                 stats.jitter_p50_us, stats.jitter_p95_us, stats.jitter_p99_us);
+  metric(&m, "reorder_depth_packets", "gauge", "Deepest recent reordering",
+         stats.reorder_depth);
+  metric(&m, "drift_ppm", "gauge", "Clock drift correction applied",
+         stats.drift_ppm);
+
+  audio_output_stats_t output;
+  audio_output_get_stats(&output);
+  metric(&m, "output_gaps_total", "counter",
+         "Playout ran out of frames and bridged with silence", output.gaps);
+  metric(&m, "dma_underruns_total", "counter",
+         "I2S DMA replayed a buffer that was not refilled",
+         output.dma_underruns);
+
+  ptp_stats_t ptp;
+  ptp_clock_get_stats(&ptp);
+  metric(&m, "ptp_locked", "gauge", "PTP synchronized to a master",
+         ptp_clock_is_locked());
+  metric(&m, "ptp_offset_ns", "gauge", "Servo offset from local to PTP time",
+         (double)ptp.filtered_offset_ns);
+  metric(&m, "ptp_residual_ns", "gauge", "Median residual seen by the servo",
+         (double)ptp.residual_ns);
+  metric(&m, "ptp_freq_ppb", "gauge", "Master rate relative to ours",
+         ptp.freq_ppb);
+  metric(&m, "ptp_gm_changes_total", "counter", "Grandmaster changes",
+         ptp.gm_changes);
+  metric(&m, "ntp_locked", "gauge", "NTP timing synchronized",
+         ntp_clock_is_locked());
+  metric(&m, "ntp_offset_ns", "gauge", "Offset from local to sender time",
+         (double)ntp_clock_get_offset_ns());
+
+#if CONFIG_AUDIO_BENCH
+  metrics_header(&m, "stage_cycles", "summary",
+                 "CPU cycles per frame in the current bench window");
+  for (int i = 0; i < AUDIO_BENCH_COUNT; i++) {
+    audio_bench_result_t r;
+    if (!audio_bench_get((audio_bench_id_t)i, &r)) {
+      continue;
+    }
+    const char *name = audio_bench_name((audio_bench_id_t)i);
+    metrics_printf(&m,
+                   "airplay_stage_cycles{stage=\"%s\",quantile=\"0.99\"} "
+                   "%" PRIu32 "\n"
+                   "airplay_stage_cycles{stage=\"%s\",quantile=\"1\"} "
+                   "%" PRIu32 "\n"
+                   "airplay_stage_cycles_sum{stage=\"%s\"} %" PRIu64 "\n"
+                   "airplay_stage_cycles_count{stage=\"%s\"} %" PRIu32 "\n",
+                   name, r.p99, name, r.max, name, (uint64_t)r.avg * r.count,
+                   name, r.count);
+  }
+#endif
+#if CONFIG_AUDIO_TRACE
+  metrics_header(&m, "latency_us", "summary",
+                 "Per-frame pipeline latency since the last trace reset");
+  for (int i = 0; i < AUDIO_TRACE_STAGES; i++) {
+    audio_trace_stats_t t;
+    if (!audio_trace_get((audio_trace_stage_t)i, &t)) {
+      continue;
+    }
+    const char *name = audio_trace_stage_name((audio_trace_stage_t)i);
+    metrics_printf(&m,
+                   "airplay_latency_us{stage=\"%s\",quantile=\"0.5\"} "
+                   "%" PRIu32 "\n"
+                   "airplay_latency_us{stage=\"%s\",quantile=\"0.99\"} "
+                   "%" PRIu32 "\n"
+                   "airplay_latency_us{stage=\"%s\",quantile=\"1\"} "
+                   "%" PRIu32 "\n"
+                   "airplay_latency_us_sum{stage=\"%s\"} %" PRIu64 "\n"
+                   "airplay_latency_us_count{stage=\"%s\"} %" PRIu32 "\n",
+                   name, t.p50_us, name, t.p99_us, name, t.max_us, name,
+                   (uint64_t)t.avg_us * t.count, name, t.count);
+  }
+#endif
+
+  metrics_header(&m, "heap_free_bytes", "gauge", "Free heap by region");
+  metrics_printf(&m,
+                 "airplay_heap_free_bytes{region=\"internal\"} %u\n"
+                 "airplay_heap_free_bytes{region=\"psram\"} %u\n",
+                 (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+                 (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+  metrics_header(&m, "heap_min_free_bytes", "gauge",
+                 "Lowest free heap since boot by region");
+  metrics_printf(
+      &m,
+      "airplay_heap_min_free_bytes{region=\"internal\"} %u\n"
+      "airplay_heap_min_free_bytes{region=\"psram\"} %u\n",
+      (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+      (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
+  metric(&m, "heap_largest_free_block_bytes", "gauge",
+         "Largest allocatable internal block",
+         heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+  metrics_header(&m, "mem_bytes", "gauge",
+                 "Memory held by subsystem and region");
+  for (int i = 0; i < MEM_TAG_COUNT; i++) {
+    mem_usage_t u;
+    mem_get_usage((mem_tag_t)i, &u);
+    const char *name = mem_tag_name((mem_tag_t)i);
+    metrics_printf(&m,
+                   "airplay_mem_bytes{subsystem=\"%s\",region=\"internal\"} "
+                   "%zu\n"
+                   "airplay_mem_bytes{subsystem=\"%s\",region=\"psram\"} "
+                   "%zu\n",
+                   name, u.internal_bytes, name, u.psram_bytes);
+  }
+  metrics_header(&m, "mem_peak_bytes", "gauge",
+                 "Most memory held by subsystem since boot");
+  for (int i = 0; i < MEM_TAG_COUNT; i++) {
+    mem_usage_t u;
+    mem_get_usage((mem_tag_t)i, &u);
+    metrics_printf(&m, "airplay_mem_peak_bytes{subsystem=\"%s\"} %zu\n",
+                   mem_tag_name((mem_tag_t)i), u.peak_bytes);
+  }
+  metric(&m, "iram_text_bytes", "gauge", "Code linked into IRAM",
+         mem_iram_text_bytes());
+#if CONFIG_MEM_HOT_PATH_GUARD
+  metric(&m, "hot_path_allocs_total", "counter",
+         "Heap allocations made by the streaming tasks",
+         mem_hot_path_allocs());
+#endif
+
+#if CONFIG_POWER_DFS
+  power_stats_t power;
+  power_mgmt_get_stats(&power);
+  metric(&m, "cpu_full_clock_seconds_total", "counter",
+         "Time the pipeline held the CPU at full clock",
+         (double)power.boost_us / 1e6);
+  metric(&m, "cpu_pairing_seconds_total", "counter",
+         "Time pairing held the CPU at full clock",
+         (double)power.pairing_us / 1e6);
+  metric(&m, "cpu_full_clock", "gauge", "Pipeline holds full clock now",
+         power.boosted);
+  metric(&m, "cpu_full_clock_pinned", "gauge",
+         "Full clock held for the session after a gap", power.pinned);
+  metric(&m, "cpu_pipeline_load_ratio", "gauge",
+         "Pipeline work over the last window vs one core at the low clock",
+         power.load_permille / 1000.0);
+  metric(&m, "cpu_pipeline_peak_ratio", "gauge",
+         "Costliest frame of the last window vs a frame period at the low "
+         "clock",
+         power.peak_permille / 1000.0);
+  metric(&m, "cpu_min_mhz", "gauge", "Lowest DFS clock", power.min_mhz);
+#endif
+
+  wifi_stats_t wifi;
+  wifi_get_stats(&wifi);
+  metric(&m, "wifi_connects_total", "counter", "Station connections",
+         wifi.connects);
+  metric(&m, "wifi_disconnects_total", "counter",
+         "Station disconnects and failed joins", wifi.disconnects);
+  metric(&m, "wifi_retry_streak", "gauge",
+         "Failed attempts since the last connection", wifi.retry_streak);
+  metric(&m, "wifi_last_disconnect_reason", "gauge",
+         "Reason code of the last disconnect", wifi.last_reason);
+#if CONFIG_WIFI_ROAMING
+  metric(&m, "wifi_roams_total", "counter",
+         "Moves to a stronger AP without a disconnect", wifi.roams);
+  metric(&m, "wifi_roam_failures_total", "counter",
+         "Roams that fell back to the old AP", wifi.roam_failures);
+#endif
+  wifi_ap_record_t ap = {0};
+  if (wifi_is_connected() && esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+    metric(&m, "wifi_rssi_dbm", "gauge", "Signal of the joined AP", ap.rssi);
+  }
+
+  httpd_resp_set_type(req, "text/plain; version=0.0.4");
+  httpd_resp_send(req, m.buf, (ssize_t)m.len);
+  mem_free(MEM_TAG_HTTPD, m.buf, METRICS_BUFFER_SIZE);
+  return ESP_OK;
+}
+
+#if CONFIG_TASK_STATS
+static esp_err_t tasks_handler(httpd_req_t *req) {
+  static task_stats_entry_t entries[TASK_STATS_MAX_TASKS];
+  uint32_t window_ms = 0;
+  size_t count = task_stats_get(entries, TASK_STATS_MAX_TASKS, &window_ms);
+
+  cJSON *json = cJSON_CreateObject();
+  cJSON_AddNumberToObject(json, "window_ms", window_ms);
+  cJSON *tasks = cJSON_AddArrayToObject(json, "tasks");
+  for (size_t i = 0; i < count; i++) {
+    const task_stats_entry_t *e = &entries[i];
+    cJSON *item = cJSON_CreateObject();
+    cJSON_AddStringToObject(item, "name", e->name);
+    cJSON_AddNumberToObject(item, "core", e->core);
+    cJSON_AddNumberToObject(item, "priority", e->priority);
+    cJSON_AddNumberToObject(item, "cpu_percent", e->cpu_permille / 10.0);
+    cJSON_AddNumberToObject(item, "stack_free", e->stack_free_bytes);
+    cJSON_AddItemToArray(tasks, item);
+  }
+  cJSON_AddBoolToObject(json, "success", true);
+
+  char *json_str = cJSON_PrintUnformatted(json);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_send(req, json_str, HTTPD_RESP_USE_STRLEN);
+  free(json_str);
+  cJSON_Delete(json);
+  return ESP_OK;
+}
+#endif
+
+#if CONFIG_AUDIO_BENCH_SUITE
+// Runs the micro-benchmarks and reports them with what identifies the
+// board and build, so results from different units can be compared
+static esp_err_t bench_handler(httpd_req_t *req) {
+  static audio_bench_suite_result_t result;
+  esp_err_t err = audio_bench_suite_run(&result);
+
+  cJSON *json = cJSON_CreateObject();
+  if (err != ESP_OK) {
+    if (err == ESP_ERR_INVALID_STATE) {
+      httpd_resp_set_status(req, "409 Conflict");
+    }
+    cJSON_AddBoolToObject(json, "success", false);
+    cJSON_AddStringToObject(json, "error", err == ESP_ERR_INVALID_STATE
+                                               ? "Stream active"
+                                               : esp_err_to_name(err));
+  } else {
+    cJSON_AddNumberToObject(json, "version", 1);
+
+    esp_chip_info_t chip_info;
+    esp_chip_info(&chip_info);
+    uint32_t flash_size = 0;
+    esp_flash_get_size(NULL, &flash_size);
+    cJSON *chip = cJSON_AddObjectToObject(json, "chip");
+    cJSON_AddStringToObject(chip, "model", CONFIG_IDF_TARGET);
+    cJSON_AddNumberToObject(chip, "revision", chip_info.revision);
+    cJSON_AddNumberToObject(chip, "cores", chip_info.cores);
+    cJSON_AddNumberToObject(chip, "cpu_mhz", result.cpu_mhz);
+    cJSON_AddNumberToObject(chip, "flash_bytes", flash_size);
+    cJSON_AddNumberToObject(chip, "psram_bytes",
+                            heap_caps_get_total_size(MALLOC_CAP_SPIRAM));
+    cJSON_AddNumberToObject(chip, "internal_bytes",
+                            heap_caps_get_total_size(MALLOC_CAP_INTERNAL));
+
+    const esp_app_desc_t *app_desc = esp_app_get_description();
+#if CONFIG_SQUEEZEAMP
+    cJSON_AddStringToObject(json, "board", "squeezeamp");
+#else
+    cJSON_AddStringToObject(json, "board", "generic");
+#endif
+    cJSON_AddStringToObject(json, "firmware_version", app_desc->version);
+    cJSON_AddStringToObject(json, "idf_version", app_desc->idf_ver);
+    cJSON_AddStringToObject(json, "memory_profile",
+                            mem_budget_profile()->name);
+
+    cJSON *stages = cJSON_AddObjectToObject(json, "stages");
+    for (int i = 0; i < AUDIO_BENCH_SUITE_COUNT; i++) {
+      const audio_bench_result_t *r = &result.stages[i];
+      if (r->count == 0) {
+        continue;
+      }
+      cJSON *stage = cJSON_AddObjectToObject(
+          stages, audio_bench_suite_name((audio_bench_suite_id_t)i));
+      cJSON_AddNumberToObject(stage, "count", r->count);
+      cJSON_AddNumberToObject(stage, "min", r->min);
+      cJSON_AddNumberToObject(stage, "avg", r->avg);
+      cJSON_AddNumberToObject(stage, "p99", r->p99);
+      cJSON_AddNumberToObject(stage, "max", r->max);
+    }
+    cJSON_AddNumberToObject(json, "memcpy_internal_mbps",
+                            result.memcpy_internal_mbps);
+    cJSON_AddNumberToObject(json, "memcpy_psram_mbps",
+                            result.memcpy_psram_mbps);
+    cJSON_AddBoolToObject(json, "alac_bitexact", result.alac_bitexact);
+    cJSON_AddNumberToObject(json, "duration_ms", result.duration_ms);
+    cJSON_AddBoolToObject(json, "success", true);
+  }
+
+  char *json_str = cJSON_PrintUnformatted(json);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_send(req, json_str, HTTPD_RESP_USE_STRLEN);
+  free(json_str);
+  cJSON_Delete(json);
+  return ESP_OK;
+}
+#endif
+
+#if CONFIG_AUDIO_TRACE
+// Per-stage latency since the last reset plus the latest frames; ?reset=1
+// restarts the counters after reporting them
+static esp_err_t trace_handler(httpd_req_t *req) {
+  cJSON *json = cJSON_CreateObject();
+  cJSON *stages = cJSON_AddObjectToObject(json, "stages");
+  for (int i = 0; i < AUDIO_TRACE_STAGES; i++) {
+    audio_trace_stats_t stats;
+    if (!audio_trace_get((audio_trace_stage_t)i, &stats)) {
+      continue;
+    }
+    cJSON *stage = cJSON_AddObjectToObject(
+        stages, audio_trace_stage_name((audio_trace_stage_t)i));
+    cJSON_AddNumberToObject(stage, "count", stats.count);
+    cJSON_AddNumberToObject(stage, "avg_us", stats.avg_us);
+    cJSON_AddNumberToObject(stage, "p50_us", stats.p50_us);
+    cJSON_AddNumberToObject(stage, "p99_us", stats.p99_us);
+    cJSON_AddNumberToObject(stage, "max_us", stats.max_us);
+  }
+
+  static audio_trace_frame_t frames[AUDIO_TRACE_RECENT];
+  size_t count = audio_trace_get_recent(frames, AUDIO_TRACE_RECENT);
+  cJSON *recent = cJSON_AddArrayToObject(json, "recent");
+  for (size_t f = 0; f < count; f++) {
+    cJSON *item = cJSON_CreateObject();
+    cJSON_AddNumberToObject(item, "rtp", frames[f].rtp_timestamp);
+    for (int i = 0; i < AUDIO_TRACE_STAGES; i++) {
+      cJSON_AddNumberToObject(item,
+                              audio_trace_stage_name((audio_trace_stage_t)i),
+                              frames[f].stage_us[i]);
+    }
+    cJSON_AddItemToArray(recent, item);
+  }
+
+  char query[32];
+  char value[4];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "reset", value, sizeof(value)) == ESP_OK &&
+      strcmp(value, "1") == 0) {
+    audio_trace_reset();
+  }
+  cJSON_AddBoolToObject(json, "success", true);
+
+  char *json_str = cJSON_PrintUnformatted(json);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_send(req, json_str, HTTPD_RESP_USE_STRLEN);
+  free(json_str);
+  cJSON_Delete(json);
+  return ESP_OK;
+}
+#endif
+
+#if CONFIG_WEB_STATS_WS
+// Live stats for the control panel: every interval one compact JSON text
+// frame, written in place into a static buffer, goes to each open /ws/stats
+// socket. The push runs as httpd work so it never races a handler.
+#define WS_STATS_FRAME_SIZE 384
+
+static esp_timer_handle_t s_ws_timer = NULL;
+static volatile bool s_ws_queued = false;
+static char s_ws_frame[WS_STATS_FRAME_SIZE];
+
+static size_t ws_stats_snapshot(char *buf, size_t size) {
+  audio_stats_t stats;
+  audio_receiver_get_stats(&stats);
+  audio_output_stats_t output;
+  audio_output_get_stats(&output);
+  ptp_stats_t ptp;
+  ptp_clock_get_stats(&ptp);
+
+  int len = snprintf(
+      buf, size,
+      "{\"t\":%" PRId64 ",\"playing\":%d,\"rx\":%" PRIu32 ",\"decoded\":%" PRIu32
+      ",\"dropped\":%" PRIu32 ",\"nack\":%" PRIu32 ",\"recovered\":%" PRIu32
+      ",\"underruns\":%" PRIu32 ",\"late\":%" PRIu32 ",\"depth\":%" PRIu32
+      ",\"target\":%" PRIu32 ",\"jitter_p99_us\":%" PRIu32
+      ",\"drift_ppm\":%" PRId32 ",\"gaps\":%" PRIu32 ",\"ptp_locked\":%d"
+      ",\"ptp_offset_ns\":%" PRId64 ",\"ntp_locked\":%d"
+      ",\"heap_free\":%u}",
+      esp_timer_get_time() / 1000, audio_receiver_is_playing(),
+      stats.packets_received, stats.packets_decoded, stats.packets_dropped,
+      stats.retransmits_requested, stats.retransmits_received,
+      stats.buffer_underruns, stats.late_frames, stats.pcm_depth_frames,
+      stats.target_depth_frames, stats.jitter_p99_us, stats.drift_ppm,
+      output.gaps, ptp_clock_is_locked(), (int64_t)ptp.filtered_offset_ns,
+      ntp_clock_is_locked(), (unsigned)esp_get_free_heap_size());
+  if (len < 0 || (size_t)len >= size) {
+    return 0;
+  }
+  return (size_t)len;
+}
+
+static void ws_stats_push(void *arg) {
+  (void)arg;
+  s_ws_queued = false;
+  if (!s_server) {
+    return;
+  }
+
+  int fds[CONFIG_LWIP_MAX_SOCKETS];
+  size_t count = sizeof(fds) / sizeof(fds[0]);
+  if (httpd_get_client_list(s_server, &count, fds) != ESP_OK) {
+    return;
+  }
+
+  httpd_ws_frame_t frame = {
+      .final = true,
+      .type = HTTPD_WS_TYPE_TEXT,
+      .payload = (uint8_t *)s_ws_frame,
+      .len = 0,
+  };
+  size_t listeners = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (httpd_ws_get_fd_info(s_server, fds[i]) != HTTPD_WS_CLIENT_WEBSOCKET) {
+      continue;
+    }
+    if (listeners++ == 0) {
+      frame.len = ws_stats_snapshot(s_ws_frame, sizeof(s_ws_frame));
+      if (frame.len == 0) {
+        return;
+      }
+    }
+    httpd_ws_send_frame_async(s_server, fds[i], &frame);
+  }
+
+  if (listeners == 0) {
+    esp_timer_stop(s_ws_timer); // Restarted by the next handshake
+  }
+}
+
+static void ws_stats_tick(void *arg) {
+  (void)arg;
+  // Skip a frame rather than pile up work while httpd is busy (e.g. OTA)
+  if (!s_server || s_ws_queued) {
+    return;
+  }
+  s_ws_queued = true;
+  if (httpd_queue_work(s_server, ws_stats_push, NULL) != ESP_OK) {
+    s_ws_queued = false;
+  }
+}
+
+static esp_err_t ws_stats_handler(httpd_req_t *req) {
+  if (req->method == HTTP_GET) {
+    ESP_LOGI(TAG, "Stats socket %d opened", httpd_req_to_sockfd(req));
+    if (!s_ws_timer) {
+      const esp_timer_create_args_t timer_args = {
+          .callback = ws_stats_tick,
+          .name = "ws_stats",
+      };
+      if (esp_timer_create(&timer_args, &s_ws_timer) != ESP_OK) {
+        return ESP_FAIL;
+      }
+    }
+    if (!esp_timer_is_active(s_ws_timer)) {
+      esp_timer_start_periodic(
+          s_ws_timer, (uint64_t)CONFIG_WEB_STATS_WS_INTERVAL_MS * 1000);
+    }
+    return ESP_OK;
+  }
+
+  // The panel never sends data; drain and ignore anything small, close on
+  // anything else. Pings and closes are answered by httpd itself.
+  uint8_t discard[64];
+  httpd_ws_frame_t frame = {.payload = discard};
+  return httpd_ws_recv_frame(req, &frame, sizeof(discard));
+}
+#endif
+
+#if CONFIG_AUDIO_EQ
+static esp_err_t eq_get_handler(httpd_req_t *req) {
+  audio_eq_config_t config;
+  audio_eq_stats_t stats;
+  audio_eq_get_config(&config);
+  audio_eq_get_stats(&stats);
+
+  cJSON *json = cJSON_CreateObject();
+  cJSON *eq = cJSON_CreateObject();
+  cJSON_AddBoolToObject(eq, "enabled", config.enabled);
+  cJSON_AddNumberToObject(eq, "preamp_db", config.preamp_db);
+  cJSON *bands = cJSON_AddArrayToObject(eq, "bands");
+  for (int i = 0; i < config.band_count; i++) {
+    const audio_eq_band_t *band = &config.bands[i];
+    cJSON *item = cJSON_CreateObject();
+    cJSON_AddStringToObject(item, "type", audio_eq_type_name(band->type));
+    cJSON_AddNumberToObject(item, "freq", band->freq_hz);
+    cJSON_AddNumberToObject(item, "gain", band->gain_db);
+    cJSON_AddNumberToObject(item, "q", band->q);
+    cJSON_AddItemToArray(bands, item);
+  }
+  cJSON_AddItemToObject(json, "eq", eq);
+  cJSON_AddNumberToObject(json, "max_bands", AUDIO_EQ_MAX_BANDS);
+
+  // Budget: CPU cycles that pass while one block plays out
+  cJSON *load = cJSON_CreateObject();
+  cJSON_AddNumberToObject(load, "block_cycles", stats.block_cycles);
+  cJSON_AddNumberToObject(load, "peak_cycles", stats.peak_cycles);
+  cJSON_AddNumberToObject(load, "block_samples", stats.block_samples);
+  if (stats.sample_rate > 0) {
+    double budget = (double)CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1e6 *
+                    stats.block_samples / stats.sample_rate;
+    cJSON_AddNumberToObject(load, "budget_cycles", budget);
+  }
+  cJSON_AddItemToObject(json, "stats", load);
+  cJSON_AddBoolToObject(json, "success", true);
+
+  char *json_str = cJSON_Print(json);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_send(req, json_str, HTTPD_RESP_USE_STRLEN);
+  free(json_str);
+  cJSON_Delete(json);
+  return ESP_OK;
+}
+
+static bool parse_eq_band(const cJSON *item, audio_eq_band_t *band) {
+  const cJSON *type = cJSON_GetObjectItem(item, "type");
+  const cJSON *freq = cJSON_GetObjectItem(item, "freq");
+  const cJSON *gain = cJSON_GetObjectItem(item, "gain");
+  const cJSON *q = cJSON_GetObjectItem(item, "q");
+  int type_id = audio_eq_type_from_name(cJSON_GetStringValue(type));
+  if (type_id < 0 || !cJSON_IsNumber(freq) || !cJSON_IsNumber(q)) {
+    return false;
+  }
+  band->type = (uint8_t)type_id;
+  band->freq_hz = (float)freq->valuedouble;
+  band->gain_db = cJSON_IsNumber(gain) ? (float)gain->valuedouble : 0.0f;
+  band->q = (float)q->valuedouble;
+  return true;
+}
+
+static esp_err_t eq_set_handler(httpd_req_t *req) {
+  // Several bands can span more than one TCP segment
+  char content[1024];
+  if (req->content_len >= sizeof(content)) {
+    // Parsing a truncated body could apply half a configuration
+    httpd_resp_set_status(req, "413 Content Too Large");
+    httpd_resp_sendstr(req, "EQ configuration too large");
+    return ESP_FAIL;
+  }
+  int len = 0;
+  while (len < (int)req->content_len && len < (int)sizeof(content) - 1) {
+    int ret = httpd_req_recv(req, content + len, sizeof(content) - 1 - len);
+    if (ret <= 0) {
+      httpd_resp_send_500(req);
+      return ESP_FAIL;
+    }
+    len += ret;
+  }
+  content[len] = '\0';
+
+  cJSON *json = cJSON_Parse(content);
+  if (!json) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+    return ESP_FAIL;
+  }
+
+  audio_eq_config_t config = {0};
+  audio_eq_get_config(&config);
+  const cJSON *enabled = cJSON_GetObjectItem(json, "enabled");
+  const cJSON *preamp = cJSON_GetObjectItem(json, "preamp_db");
+  const cJSON *bands = cJSON_GetObjectItem(json, "bands");
+  bool valid = true;
+  if (cJSON_IsBool(enabled)) {
+    config.enabled = cJSON_IsTrue(enabled);
+  }
+  if (cJSON_IsNumber(preamp)) {
+    config.preamp_db = (float)preamp->valuedouble;
+  }
+  if (cJSON_IsArray(bands)) {
+    int count = cJSON_GetArraySize(bands);
+    valid = count <= AUDIO_EQ_MAX_BANDS;
+    for (int i = 0; valid && i < count; i++) {
+      valid = parse_eq_band(cJSON_GetArrayItem(bands, i), &config.bands[i]);
+    }
+    config.band_count = valid ? (uint8_t)count : 0;
+  }
+
+  cJSON *response = cJSON_CreateObject();
+  esp_err_t err = valid ? audio_eq_set_config(&config) : ESP_ERR_INVALID_ARG;
+  if (err == ESP_OK) {
+    cJSON_AddBoolToObject(response, "success", true);
+  } else {
+    cJSON_AddBoolToObject(response, "success", false);
+    cJSON_AddStringToObject(response, "error", esp_err_to_name(err));
+  }
+
+  char *json_str = cJSON_Print(response);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_send(req, json_str, HTTPD_RESP_USE_STRLEN);
+  free(json_str);
+  cJSON_Delete(json);
+  cJSON_Delete(response);
+
+  return ESP_OK;
+}
+#endif
+
+#if CONFIG_AUDIO_CHANNEL_SELECT
+static esp_err_t channel_get_handler(httpd_req_t *req) {
+  cJSON *root = cJSON_CreateObject();
+  cJSON_AddStringToObject(root, "mode",
+                          audio_channel_mode_name(audio_channel_get_mode()));
+
+  char *json_str = cJSON_Print(root);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_send(req, json_str, HTTPD_RESP_USE_STRLEN);
+  free(json_str);
+  cJSON_Delete(root);
+
+  return ESP_OK;
+}
+
+static esp_err_t channel_set_handler(httpd_req_t *req) {
+  char content[64];
+  int ret = httpd_req_recv(req, content, sizeof(content) - 1);
+  if (ret <= 0) {
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+  content[ret] = '\0';
+
+  cJSON *json = cJSON_Parse(content);
+  if (!json) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+    return ESP_FAIL;
+  }
+
+  const cJSON *mode = cJSON_GetObjectItem(json, "mode");
+  int value = cJSON_IsString(mode)
+                  ? audio_channel_mode_from_name(mode->valuestring)
+                  : -1;
+  esp_err_t err = value >= 0
+                      ? audio_channel_set_mode((audio_channel_mode_t)value)
+                      : ESP_ERR_INVALID_ARG;
+
+  cJSON *response = cJSON_CreateObject();
+  if (err == ESP_OK) {
+    cJSON_AddBoolToObject(response, "success", true);
+    // The pool is laid out per stream
+    cJSON_AddStringToObject(response, "message",
+                            "Applies from the next stream");
+  } else {
+    cJSON_AddBoolToObject(response, "success", false);
+    cJSON_AddStringToObject(response, "error", esp_err_to_name(err));
+  }
+
+  char *json_str = cJSON_Print(response);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_send(req, json_str, HTTPD_RESP_USE_STRLEN);
+  free(json_str);
+  cJSON_Delete(json);
+  cJSON_Delete(response);
+
+  return ESP_OK;
+}
+#endif
+
 esp_err_t web_server_start(uint16_t port) {
   if (s_server) {
     ESP_LOGW(TAG, "Web server already running");
@@ -389,15 +1220,16 @@ esp_err_t web_server_start(uint16_t port) {
 
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
   config.server_port = port;
-  config.max_uri_handlers = 16; // Increased for captive portal handlers
+  config.max_uri_handlers = 26; // Captive portal and diagnostics handlers
   config.max_resp_headers = 8;
-  config.stack_size = 8192;
+  config.stack_size = HTTPD_STACK_SIZE;
 
   esp_err_t err = httpd_start(&s_server, &config);
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "Failed to start web server: %s", esp_err_to_name(err));
     return err;
   }
+  mem_account(MEM_TAG_HTTPD, (int32_t)config.stack_size);
 
   // Register handlers
   httpd_uri_t root_uri = {
@@ -454,6 +1286,58 @@ esp_err_t web_server_start(uint16_t port) {
                                     .handler = system_restart_handler};
   httpd_register_uri_handler(s_server, &system_restart_uri);
 
+  httpd_uri_t metrics_uri = {
+      .uri = "/metrics", .method = HTTP_GET, .handler = metrics_handler};
+  httpd_register_uri_handler(s_server, &metrics_uri);
+
+#if CONFIG_TASK_STATS
+  httpd_uri_t tasks_uri = {
+      .uri = "/api/tasks", .method = HTTP_GET, .handler = tasks_handler};
+  httpd_register_uri_handler(s_server, &tasks_uri);
+#endif
+
+#if CONFIG_AUDIO_BENCH_SUITE
+  httpd_uri_t bench_uri = {
+      .uri = "/api/bench", .method = HTTP_POST, .handler = bench_handler};
+  httpd_register_uri_handler(s_server, &bench_uri);
+#endif
+
+#if CONFIG_AUDIO_TRACE
+  httpd_uri_t trace_uri = {
+      .uri = "/api/trace", .method = HTTP_GET, .handler = trace_handler};
+  httpd_register_uri_handler(s_server, &trace_uri);
+#endif
+
+#if CONFIG_WEB_STATS_WS
+  httpd_uri_t ws_stats_uri = {.uri = "/ws/stats",
+                              .method = HTTP_GET,
+                              .handler = ws_stats_handler,
+                              .is_websocket = true};
+  httpd_register_uri_handler(s_server, &ws_stats_uri);
+#endif
+
+#if CONFIG_AUDIO_EQ
+  httpd_uri_t eq_get_uri = {
+      .uri = "/api/eq", .method = HTTP_GET, .handler = eq_get_handler};
+  httpd_register_uri_handler(s_server, &eq_get_uri);
+
+  httpd_uri_t eq_set_uri = {
+      .uri = "/api/eq", .method = HTTP_POST, .handler = eq_set_handler};
+  httpd_register_uri_handler(s_server, &eq_set_uri);
+#endif
+
+#if CONFIG_AUDIO_CHANNEL_SELECT
+  httpd_uri_t channel_get_uri = {.uri = "/api/channel",
+                                 .method = HTTP_GET,
+                                 .handler = channel_get_handler};
+  httpd_register_uri_handler(s_server, &channel_get_uri);
+
+  httpd_uri_t channel_set_uri = {.uri = "/api/channel",
+                                 .method = HTTP_POST,
+                                 .handler = channel_set_handler};
+  httpd_register_uri_handler(s_server, &channel_set_uri);
+#endif
+
   // Captive portal detection endpoints
   // Apple iOS/macOS
   httpd_uri_t apple_captive1 = {.uri = "/hotspot-detect.html",
@@ -485,7 +1369,13 @@ esp_err_t web_server_start(uint16_t port) {
 
 void web_server_stop(void) {
   if (s_server) {
+#if CONFIG_WEB_STATS_WS
+    if (s_ws_timer) {
+      esp_timer_stop(s_ws_timer);
+    }
+#endif
     httpd_stop(s_server);
+    mem_account(MEM_TAG_HTTPD, -(int32_t)HTTPD_STACK_SIZE);
     s_server = NULL;
     ESP_LOGI(TAG, "Web server stopped");
   }
@@ -1,8 +1,10 @@
+#include <inttypes.h>
 #include <string.h>
 #include <stdlib.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
@@ -13,6 +15,12 @@
 
 #include "wifi.h"
 #include "settings.h"
+#include "rtsp_events.h"
+#if CONFIG_WIFI_ROAMING
+#include "audio_receiver.h"
+#include "esp_rrm.h"
+#include "esp_wnm.h"
+#endif
 
 static const char *TAG = "wifi";
 
@@ -20,11 +28,15 @@ static const char *TAG = "wifi";
 static EventGroupHandle_t s_wifi_event_group;
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT      BIT1
+#define ROAM_RSSI_LOW_BIT  BIT2
+#define ROAM_NEIGHBORS_BIT BIT3
+#define ROAM_DONE_BIT      BIT4
 
 // Re-enable AP after this many consecutive failures
 #define AP_REENABLE_THRESHOLD 5
 
 static int s_retry_num = 0;
+static wifi_stats_t s_stats = {0};
 static esp_netif_t *s_sta_netif = NULL;
 static esp_netif_t *s_ap_netif = NULL;
 static bool s_wifi_initialized = false;
@@ -32,11 +44,86 @@ static bool s_sta_connected = false;
 static bool s_bssid_set = false;
 static esp_timer_handle_t s_retry_timer = NULL;
 static bool s_settings_ap_enabled = true;
+static bool s_streaming = false;
 
 // Saved AP config from init, used to re-enable AP without duplication
 static wifi_config_t s_ap_config;
 
+// Last scan results, shared by /api/wifi/scan and the best-AP choice. Scans
+// run in the driver while the caller carries on; WIFI_EVENT_SCAN_DONE fills
+// the cache.
+#define SCAN_MAX_APS 32
+static SemaphoreHandle_t s_scan_mutex = NULL;
+static wifi_ap_record_t *s_scan_records = NULL;
+static uint16_t s_scan_count = 0;
+static int64_t s_scan_time_us = 0; // 0 until the first scan completes
+static bool s_scan_running = false;
+// SCAN_DONE events of blocking scans, whose records are already collected
+static int s_scan_done_ignore = 0;
+
+static const wifi_scan_config_t s_scan_config = {
+    .show_hidden = true,
+    .scan_type = WIFI_SCAN_TYPE_ACTIVE,
+    .scan_time = {.active = {.min = 100, .max = 300}},
+};
+
 static void wifi_select_best_ap(const char *ssid);
+static void scan_store(void);
+static bool scan_claim(void);
+static void scan_release(void);
+
+#if CONFIG_WIFI_ROAMING
+// Background roaming. The driver reports a weak link through its RSSI
+// threshold; candidates come from an 802.11k neighbor report, or from every
+// channel without one. Channels are visited one at a time, each only with
+// the jitter buffer at its target depth, so a stream sees a jitter blip
+// rather than a dropout. The move is a BSS transition query (11v) where the
+// AP takes them, otherwise a reassociation to the chosen BSSID, with FT
+// (11r) if the network offers it. Leaving the old AP is not treated as a
+// lost link, so sockets and sessions carry on.
+#define ROAM_MAX_NEIGHBORS  8
+#define ROAM_DWELL_MS       40   // Per channel visit
+#define ROAM_HOME_MS        200  // Back on the AP's channel between visits
+#define ROAM_BUFFER_WAIT_MS 5000
+#define ROAM_REPORT_MS      1000 // For the neighbor report
+#define ROAM_CONNECT_MS     3000
+#define ROAM_RETRY_S        30   // While the link stays weak, doubling
+#define ROAM_RETRY_MAX_S    300  // when no better AP turns up
+
+typedef struct {
+  uint8_t bssid[6];
+  uint32_t bssid_info;
+  uint8_t op_class;
+  uint8_t channel;
+  uint8_t phy_type;
+} roam_neighbor_t;
+
+static TaskHandle_t s_roam_task = NULL;
+static volatile bool s_roaming = false; // Leaving the AP on purpose
+static volatile bool s_roam_ok = false;
+static uint8_t s_roam_from[6];
+static roam_neighbor_t s_neighbors[ROAM_MAX_NEIGHBORS];
+static int s_neighbor_count = 0;
+#endif
+
+#if CONFIG_WIFI_IDLE_POWER_SAVE
+#define WIFI_IDLE_PS WIFI_PS_MIN_MODEM
+#else
+#define WIFI_IDLE_PS WIFI_PS_NONE
+#endif
+
+// Playback turns streaming on and it stays on through pauses, until the
+// client goes away
+static void on_rtsp_event(rtsp_event_t event, const rtsp_event_data_t *data,
+                          void *user_data) {
+  (void)user_data;
+  (void)data;
+  if (event == RTSP_EVENT_PLAYING) {
+    wifi_set_streaming(true);
+  } else if (event == RTSP_EVENT_DISCONNECTED) {
+    wifi_set_streaming(false);
+  }
+}
 
 static void retry_timer_callback(void *arg) {
   if (!s_sta_connected) {
@@ -75,6 +162,70 @@ static void enable_ap_mode(void) {
   }
 }
 
+#if CONFIG_WIFI_ROAMING
+// Neighbor Report elements (802.11k): BSSID, BSSID info, operating class,
+// channel and PHY type, then optional subelements. The report starts with
+// the action code and dialog token.
+static void roam_store_neighbors(const wifi_event_neighbor_report_t *event) {
+  int count = 0;
+  if (event && event->report_len > 2) {
+    const uint8_t *pos = event->report + 2;
+    size_t left = event->report_len - 2;
+    while (left >= 2 && count < ROAM_MAX_NEIGHBORS) {
+      uint8_t id = pos[0];
+      uint8_t len = pos[1];
+      if (left < 2u + len) {
+        break;
+      }
+      if (id == 52 && len >= 13) {
+        roam_neighbor_t *n = &s_neighbors[count++];
+        memcpy(n->bssid, pos + 2, 6);
+        n->bssid_info = (uint32_t)pos[8] | (uint32_t)pos[9] << 8 |
+                        (uint32_t)pos[10] << 16 | (uint32_t)pos[11] << 24;
+        n->op_class = pos[12];
+        n->channel = pos[13];
+        n->phy_type = pos[14];
+      }
+      pos += 2 + len;
+      left -= 2u + len;
+    }
+  }
+  s_neighbor_count = count;
+}
+
+// Lock the station config to bssid (on channel, 0 for any)
+static void roam_set_bssid(const uint8_t *bssid, uint8_t channel) {
+  wifi_config_t cfg;
+  if (esp_wifi_get_config(WIFI_IF_STA, &cfg) != ESP_OK) {
+    return;
+  }
+  memcpy(cfg.sta.bssid, bssid, 6);
+  cfg.sta.bssid_set = true;
+  cfg.sta.channel = channel;
+  esp_wifi_set_config(WIFI_IF_STA, &cfg);
+  s_bssid_set = true;
+}
+
+// True for the departure from the old AP while roaming, which is not a lost
+// link. Any other disconnect ends the roam and points the retries back at the
+// old AP.
+static bool roam_disconnected(uint8_t reason) {
+  if (!s_roaming) {
+    return false;
+  }
+  if (reason == WIFI_REASON_ASSOC_LEAVE) {
+    return true;
+  }
+  ESP_LOGW(TAG, "Roam failed, reason: %d", reason);
+  s_stats.roam_failures++;
+  s_roaming = false;
+  s_roam_ok = false;
+  roam_set_bssid(s_roam_from, 0);
+  xEventGroupSetBits(s_wifi_event_group, ROAM_DONE_BIT);
+  return false;
+}
+#endif
+
 static void event_handler(void *arg, esp_event_base_t event_base,
                           int32_t event_id, void *event_data) {
   if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
@@ -87,14 +238,23 @@ static void event_handler(void *arg, esp_event_base_t event_base,
     esp_wifi_connect();
   } else if (event_base == WIFI_EVENT &&
              event_id == WIFI_EVENT_STA_DISCONNECTED) {
-    s_sta_connected = false;
     wifi_event_sta_disconnected_t *disconnected =
         (wifi_event_sta_disconnected_t *)event_data;
+#if CONFIG_WIFI_ROAMING
+    if (roam_disconnected(disconnected->reason)) {
+      return;
+    }
+#endif
+    s_sta_connected = false;
     ESP_LOGI(TAG, "Disconnected from AP, reason: %d", disconnected->reason);
 
     s_retry_num++;
+    s_stats.disconnects++;
+    s_stats.last_reason = disconnected->reason;
 
-    if (s_retry_num < AP_REENABLE_THRESHOLD) {
+    if (s_scan_running) {
+      // Reconnecting would abort the scan; its completion reconnects
+    } else if (s_retry_num < AP_REENABLE_THRESHOLD) {
       // Fast retries — reconnect immediately
       ESP_LOGI(TAG, "Retrying connection (%d/%d)...", s_retry_num,
                AP_REENABLE_THRESHOLD);
@@ -115,8 +275,12 @@ static void event_handler(void *arg, esp_event_base_t event_base,
     ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
     ESP_LOGI(TAG, "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
     s_retry_num = 0;
+    s_stats.connects++;
     s_sta_connected = true;
     xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+#if CONFIG_WIFI_ROAMING
+    esp_wifi_set_rssi_threshold(CONFIG_WIFI_ROAM_RSSI);
+#endif
 
     // Keep AP enabled by default, but honor explicit user "close settings".
     wifi_mode_t mode;
@@ -125,13 +289,151 @@ static void event_handler(void *arg, esp_event_base_t event_base,
       ESP_LOGI(TAG, "Settings AP disabled by user, switching to STA-only mode");
       esp_wifi_set_mode(WIFI_MODE_STA);
     }
+  } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE) {
+    if (s_scan_done_ignore > 0) {
+      s_scan_done_ignore--;
+    } else if (s_scan_running) {
+      scan_store();
+      if (!s_sta_connected) {
+        esp_wifi_connect();
+      }
+    }
   } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_START) {
     ESP_LOGI(TAG, "AP started");
+#if CONFIG_WIFI_ROAMING
+  } else if (event_base == WIFI_EVENT &&
+             event_id == WIFI_EVENT_STA_CONNECTED) {
+    if (s_roaming) {
+      wifi_event_sta_connected_t *connected =
+          (wifi_event_sta_connected_t *)event_data;
+      ESP_LOGI(TAG, "Roamed to " MACSTR " (ch=%d)", MAC2STR(connected->bssid),
+               connected->channel);
+      s_stats.roams++;
+      s_roam_ok = true;
+      s_roaming = false;
+      xEventGroupSetBits(s_wifi_event_group, ROAM_DONE_BIT);
+    }
+  } else if (event_base == WIFI_EVENT &&
+             event_id == WIFI_EVENT_STA_BSS_RSSI_LOW) {
+    xEventGroupSetBits(s_wifi_event_group, ROAM_RSSI_LOW_BIT);
+  } else if (event_base == WIFI_EVENT &&
+             event_id == WIFI_EVENT_STA_NEIGHBOR_REP) {
+    roam_store_neighbors((wifi_event_neighbor_report_t *)event_data);
+    xEventGroupSetBits(s_wifi_event_group, ROAM_NEIGHBORS_BIT);
+#endif
   }
 }
 
-// Scan for the best AP matching our SSID and set its BSSID in the STA config
-static void wifi_select_best_ap(const char *ssid) {
+// Take the scanner; false if a scan is already running
+static bool scan_claim(void) {
+  xSemaphoreTake(s_scan_mutex, portMAX_DELAY);
+  bool claimed = !s_scan_running;
+  s_scan_running = true;
+  xSemaphoreGive(s_scan_mutex);
+  return claimed;
+}
+
+static void scan_release(void) {
+  xSemaphoreTake(s_scan_mutex, portMAX_DELAY);
+  s_scan_running = false;
+  xSemaphoreGive(s_scan_mutex);
+}
+
+static bool scan_is_fresh(void) {
+  return s_scan_time_us > 0 &&
+         esp_timer_get_time() - s_scan_time_us <
+             (int64_t)CONFIG_WIFI_SCAN_MAX_AGE_S * 1000000;
+}
+
+// Move the driver's records into the cache and release the scanner
+static void scan_store(void) {
+  uint16_t number = 0;
+  esp_wifi_scan_get_ap_num(&number);
+  if (number > SCAN_MAX_APS) {
+    number = SCAN_MAX_APS;
+  }
+  wifi_ap_record_t *records =
+      number > 0 ? malloc(sizeof(wifi_ap_record_t) * number) : NULL;
+  if (number > 0 && !records) {
+    // Keep the previous results
+    esp_wifi_scan_get_ap_records(&number, NULL);
+    scan_release();
+    return;
+  }
+  esp_wifi_scan_get_ap_records(&number, records);
+
+  xSemaphoreTake(s_scan_mutex, portMAX_DELAY);
+  wifi_ap_record_t *old = s_scan_records;
+  s_scan_records = records;
+  s_scan_count = number;
+  s_scan_time_us = esp_timer_get_time();
+  s_scan_running = false;
+  xSemaphoreGive(s_scan_mutex);
+  free(old);
+  ESP_LOGI(TAG, "Scan found %u networks", number);
+}
+
+// Start a scan in the background; returns at once
+static esp_err_t scan_start_background(void) {
+  if (s_streaming) {
+    // Each channel visit leaves the AP's channel for up to 300 ms
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!scan_claim()) {
+    return ESP_OK;
+  }
+
+  if (!s_sta_connected) {
+    // A station that is still joining cannot scan; hold it until done
+    esp_timer_stop(s_retry_timer);
+    esp_wifi_disconnect();
+    vTaskDelay(pdMS_TO_TICKS(100));
+
+    // Clear BSSID lock so next connect can use a fresh scan result
+    if (s_bssid_set) {
+      wifi_config_t sta_cfg;
+      if (esp_wifi_get_config(WIFI_IF_STA, &sta_cfg) == ESP_OK) {
+        memset(sta_cfg.sta.bssid, 0, sizeof(sta_cfg.sta.bssid));
+        sta_cfg.sta.bssid_set = false;
+        esp_wifi_set_config(WIFI_IF_STA, &sta_cfg);
+      }
+      s_bssid_set = false;
+    }
+  }
+
+  esp_err_t err = esp_wifi_scan_start(&s_scan_config, false);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "WiFi scan failed: %s", esp_err_to_name(err));
+    scan_release();
+    if (!s_sta_connected) {
+      esp_wifi_connect();
+    }
+  }
+  return err;
+}
+
+// Strongest AP named ssid among the cached results, if they are fresh
+static int scan_cache_best(const char *ssid, wifi_ap_record_t *best) {
+  int matches = 0;
+  xSemaphoreTake(s_scan_mutex, portMAX_DELAY);
+  if (scan_is_fresh()) {
+    for (int i = 0; i < s_scan_count; i++) {
+      if (strcmp((char *)s_scan_records[i].ssid, ssid) != 0) {
+        continue;
+      }
+      if (matches == 0 || s_scan_records[i].rssi > best->rssi) {
+        *best = s_scan_records[i];
+      }
+      matches++;
+    }
+  }
+  xSemaphoreGive(s_scan_mutex);
+  return matches;
+}
+
+// Hidden networks only answer probes that name them, so they need a scan of
+// their own
+static int scan_named_best(const char *ssid, wifi_ap_record_t *best) {
   wifi_scan_config_t scan_config = {
       .ssid = (uint8_t *)ssid,
       .bssid = NULL,
@@ -144,61 +446,283 @@ static void wifi_select_best_ap(const char *ssid) {
   esp_err_t err = esp_wifi_scan_start(&scan_config, true);
   if (err != ESP_OK) {
     ESP_LOGW(TAG, "Best-AP scan failed: %s", esp_err_to_name(err));
-    return;
+    return 0;
   }
+  s_scan_done_ignore++;
 
   uint16_t ap_count = 0;
   esp_wifi_scan_get_ap_num(&ap_count);
   if (ap_count == 0) {
-    ESP_LOGW(TAG, "Best-AP scan: no APs found for SSID %s", ssid);
     esp_wifi_scan_get_ap_records(&ap_count, NULL);
-    return;
+    return 0;
   }
 
   wifi_ap_record_t *ap_list = malloc(sizeof(wifi_ap_record_t) * ap_count);
   if (!ap_list) {
     esp_wifi_scan_get_ap_records(&ap_count, NULL);
-    return;
+    return 0;
   }
 
   esp_wifi_scan_get_ap_records(&ap_count, ap_list);
-
-  // Find AP with strongest signal
-  int best_idx = 0;
+  *best = ap_list[0];
   for (int i = 1; i < ap_count; i++) {
-    if (ap_list[i].rssi > ap_list[best_idx].rssi) {
-      best_idx = i;
+    if (ap_list[i].rssi > best->rssi) {
+      *best = ap_list[i];
     }
   }
+  free(ap_list);
+  return ap_count;
+}
 
-  ESP_LOGI(TAG, "Found %d APs for SSID '%s', best: " MACSTR " (rssi=%d, ch=%d)",
-           ap_count, ssid, MAC2STR(ap_list[best_idx].bssid),
-           ap_list[best_idx].rssi, ap_list[best_idx].primary);
-
-  for (int i = 0; i < ap_count; i++) {
-    if (i != best_idx) {
-      ESP_LOGI(TAG, "  Other AP: " MACSTR " (rssi=%d, ch=%d)",
-               MAC2STR(ap_list[i].bssid), ap_list[i].rssi, ap_list[i].primary);
+// Pick the best AP matching our SSID and set its BSSID in the STA config.
+// Fresh scan results are used as they are; otherwise a full scan refills the
+// cache, which also answers the next /api/wifi/scan.
+static void wifi_select_best_ap(const char *ssid) {
+  wifi_ap_record_t best;
+  const char *source = "cached scan";
+  int ap_count = scan_cache_best(ssid, &best);
+  if (ap_count == 0 && scan_claim()) {
+    source = "scan";
+    esp_err_t err = esp_wifi_scan_start(&s_scan_config, true);
+    if (err == ESP_OK) {
+      s_scan_done_ignore++;
+      scan_store();
+      ap_count = scan_cache_best(ssid, &best);
+    } else {
+      scan_release();
     }
   }
+  if (ap_count == 0) {
+    source = "named scan";
+    ap_count = scan_named_best(ssid, &best);
+  }
+  if (ap_count == 0) {
+    ESP_LOGW(TAG, "Best-AP scan: no APs found for SSID %s", ssid);
+    return;
+  }
+
+  ESP_LOGI(TAG,
+           "Found %d APs for SSID '%s' (%s), best: " MACSTR
+           " (rssi=%d, ch=%d)",
+           ap_count, ssid, source, MAC2STR(best.bssid), best.rssi,
+           best.primary);
 
   // Set BSSID in the STA config to lock to the best AP
   wifi_config_t sta_cfg;
   esp_wifi_get_config(WIFI_IF_STA, &sta_cfg);
-  memcpy(sta_cfg.sta.bssid, ap_list[best_idx].bssid, 6);
+  memcpy(sta_cfg.sta.bssid, best.bssid, 6);
   sta_cfg.sta.bssid_set = true;
   esp_wifi_set_config(WIFI_IF_STA, &sta_cfg);
   s_bssid_set = true;
+}
 
-  free(ap_list);
+#if CONFIG_WIFI_ROAMING
+// Off-channel time is only safe with the jitter buffer at its target depth;
+// buffered streams keep seconds in hand and do not set one
+static bool roam_wait_buffer_full(void) {
+  int64_t deadline = esp_timer_get_time() + ROAM_BUFFER_WAIT_MS * 1000;
+  while (audio_receiver_is_streaming()) {
+    audio_stats_t stats;
+    audio_receiver_get_stats(&stats);
+    if (stats.pcm_depth_frames >= stats.target_depth_frames) {
+      return true;
+    }
+    if (esp_timer_get_time() > deadline) {
+      return false;
+    }
+    vTaskDelay(pdMS_TO_TICKS(20));
+  }
+  return true;
 }
 
+// Strongest AP named ssid on one channel, other than the current one
+static void roam_scan_channel(const char *ssid, uint8_t channel,
+                              const uint8_t *current, wifi_ap_record_t *best,
+                              bool *found) {
+  if (!scan_claim()) {
+    return;
+  }
+  wifi_scan_config_t config = {
+      .ssid = (uint8_t *)ssid,
+      .channel = channel,
+      .scan_type = WIFI_SCAN_TYPE_ACTIVE,
+      .scan_time = {.active = {.min = 0, .max = ROAM_DWELL_MS}},
+  };
+  esp_err_t err = esp_wifi_scan_start(&config, true);
+  if (err != ESP_OK) {
+    scan_release();
+    return;
+  }
+  s_scan_done_ignore++;
+
+  wifi_ap_record_t records[4];
+  uint16_t number = sizeof(records) / sizeof(records[0]);
+  if (esp_wifi_scan_get_ap_records(&number, records) != ESP_OK) {
+    number = 0;
+  }
+  scan_release();
+  for (int i = 0; i < number; i++) {
+    if (memcmp(records[i].bssid, current, 6) == 0) {
+      continue;
+    }
+    if (!*found || records[i].rssi > best->rssi) {
+      *best = records[i];
+      *found = true;
+    }
+  }
+}
+
+static const roam_neighbor_t *roam_find_neighbor(const uint8_t *bssid) {
+  for (int i = 0; i < s_neighbor_count; i++) {
+    if (memcmp(s_neighbors[i].bssid, bssid, 6) == 0) {
+      return &s_neighbors[i];
+    }
+  }
+  return NULL;
+}
+
+static bool roam_wait_done(void) {
+  EventBits_t bits =
+      xEventGroupWaitBits(s_wifi_event_group, ROAM_DONE_BIT, pdTRUE, pdFALSE,
+                          pdMS_TO_TICKS(ROAM_CONNECT_MS));
+  return (bits & ROAM_DONE_BIT) && s_roam_ok;
+}
+
+// Ask the AP to steer us to target (11v); false if it does not
+static bool roam_via_btm(const roam_neighbor_t *target) {
+  char candidate[64];
+  snprintf(candidate, sizeof(candidate),
+           "neighbor=" MACSTR ",0x%04" PRIx32 ",%u,%u,%u",
+           MAC2STR(target->bssid), target->bssid_info, target->op_class,
+           target->channel, target->phy_type);
+  xEventGroupClearBits(s_wifi_event_group, ROAM_DONE_BIT);
+  s_roam_ok = false;
+  s_roaming = true;
+  if (esp_wnm_send_bss_transition_mgmt_query(REASON_RSSI, candidate, 1) == 0 &&
+      roam_wait_done()) {
+    return true;
+  }
+  s_roaming = false;
+  return false;
+}
+
+// Reassociate to target ourselves; FT makes it a single exchange
+static bool roam_reassociate(const wifi_ap_record_t *target) {
+  xEventGroupClearBits(s_wifi_event_group, ROAM_DONE_BIT);
+  s_roam_ok = false;
+  s_roaming = true;
+  roam_set_bssid(target->bssid, target->primary);
+  if (esp_wifi_connect() == ESP_OK && roam_wait_done()) {
+    return true;
+  }
+  if (s_roaming) {
+    // Neither joined nor failed in time; go back to the old AP
+    ESP_LOGW(TAG, "Roam timed out");
+    s_stats.roam_failures++;
+    s_roaming = false;
+    roam_set_bssid(s_roam_from, 0);
+    esp_wifi_connect();
+  }
+  return false;
+}
+
+// One attempt: find a clearly stronger AP of the same network and move to it
+static bool roam_attempt(const wifi_ap_record_t *current) {
+  s_neighbor_count = 0;
+  if (esp_rrm_is_rrm_supported_connection()) {
+    xEventGroupClearBits(s_wifi_event_group, ROAM_NEIGHBORS_BIT);
+    if (esp_rrm_send_neighbor_report_request() == 0) {
+      xEventGroupWaitBits(s_wifi_event_group, ROAM_NEIGHBORS_BIT, pdTRUE,
+                          pdFALSE, pdMS_TO_TICKS(ROAM_REPORT_MS));
+    }
+  }
+
+  uint8_t channels[14];
+  int channel_count = 0;
+  if (s_neighbor_count > 0) {
+    for (int i = 0; i < s_neighbor_count && channel_count < 14; i++) {
+      uint8_t ch = s_neighbors[i].channel;
+      if (ch == 0 || ch > 14 || memchr(channels, ch, channel_count)) {
+        continue;
+      }
+      channels[channel_count++] = ch;
+    }
+  } else {
+    wifi_country_t country = {.schan = 1, .nchan = 11};
+    esp_wifi_get_country(&country);
+    for (int ch = country.schan;
+         ch < country.schan + country.nchan && channel_count < 14; ch++) {
+      channels[channel_count++] = (uint8_t)ch;
+    }
+  }
+
+  wifi_ap_record_t best;
+  bool found = false;
+  for (int i = 0; i < channel_count; i++) {
+    if (!roam_wait_buffer_full()) {
+      ESP_LOGW(TAG, "Jitter buffer not full, roam scan postponed");
+      return false;
+    }
+    roam_scan_channel((const char *)current->ssid, channels[i],
+                      current->bssid, &best, &found);
+    vTaskDelay(pdMS_TO_TICKS(ROAM_HOME_MS));
+  }
+  if (!found || best.rssi < current->rssi + CONFIG_WIFI_ROAM_HYSTERESIS_DB) {
+    ESP_LOGI(TAG, "No stronger AP than " MACSTR " (rssi=%d, %d channels)",
+             MAC2STR(current->bssid), current->rssi, channel_count);
+    return false;
+  }
+
+  ESP_LOGI(TAG, "Roaming " MACSTR " (rssi=%d) -> " MACSTR " (rssi=%d, ch=%d)",
+           MAC2STR(current->bssid), current->rssi, MAC2STR(best.bssid),
+           best.rssi, best.primary);
+  memcpy(s_roam_from, current->bssid, 6);
+  if (!roam_wait_buffer_full()) {
+    return false;
+  }
+  const roam_neighbor_t *neighbor = roam_find_neighbor(best.bssid);
+  if (neighbor && esp_wnm_is_btm_supported_connection() &&
+      roam_via_btm(neighbor)) {
+    return true;
+  }
+  return roam_reassociate(&best);
+}
+
+static void roam_task(void *arg) {
+  (void)arg;
+  int retry_s = ROAM_RETRY_S;
+  while (1) {
+    xEventGroupWaitBits(s_wifi_event_group, ROAM_RSSI_LOW_BIT, pdTRUE,
+                        pdFALSE, pdMS_TO_TICKS(retry_s * 1000));
+    wifi_ap_record_t current;
+    if (!s_sta_connected || s_scan_running ||
+        esp_wifi_sta_get_ap_info(&current) != ESP_OK) {
+      continue;
+    }
+    if (current.rssi >= CONFIG_WIFI_ROAM_RSSI) {
+      retry_s = ROAM_RETRY_S;
+      continue;
+    }
+    if (roam_attempt(&current)) {
+      retry_s = ROAM_RETRY_S;
+    } else if (retry_s < ROAM_RETRY_MAX_S) {
+      retry_s *= 2;
+    }
+    // The threshold event fires once per crossing
+    esp_wifi_set_rssi_threshold(CONFIG_WIFI_ROAM_RSSI);
+  }
+}
+#endif
+
 static void wifi_init_base(void) {
   if (s_wifi_initialized) {
     return;
   }
 
   s_wifi_event_group = xEventGroupCreate();
+  if (!s_scan_mutex) {
+    s_scan_mutex = xSemaphoreCreateMutex();
+  }
 
   esp_err_t ret = esp_netif_init();
   if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
@@ -220,7 +744,8 @@ static void wifi_init_base(void) {
 
   wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
   ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-  ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE));
+  ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_IDLE_PS));
+  rtsp_events_register(on_rtsp_event, NULL);
 
   // Create one-shot retry timer (no background task needed)
   const esp_timer_create_args_t timer_args = {
@@ -228,6 +753,11 @@ static void wifi_init_base(void) {
       .name = "wifi_retry",
   };
   ESP_ERROR_CHECK(esp_timer_create(&timer_args, &s_retry_timer));
+#if CONFIG_WIFI_ROAMING
+  if (!s_roam_task) {
+    xTaskCreate(roam_task, "wifi_roam", 4096, NULL, 3, &s_roam_task);
+  }
+#endif
 
   s_wifi_initialized = true;
 }
@@ -259,6 +789,14 @@ void wifi_init_apsta(const char *ap_ssid, const char *ap_password) {
   strncpy((char *)sta_config.sta.password, password,
           sizeof(sta_config.sta.password) - 1);
   sta_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
+#if CONFIG_WIFI_ROAMING
+  // Neighbor reports (11k) and BSS transitions (11v) where the AP has them
+  sta_config.sta.rm_enabled = 1;
+  sta_config.sta.btm_enabled = 1;
+#if CONFIG_ESP_WIFI_11R_SUPPORT
+  sta_config.sta.ft_enabled = 1;
+#endif
+#endif
 
   // Configure AP and save for later re-enable
   const char *default_ssid = ap_ssid ? ap_ssid : "O1";
@@ -353,10 +891,31 @@ void wifi_get_mac_str(char *mac_str, size_t len) {
            mac[2], mac[3], mac[4], mac[5]);
 }
 
+void wifi_set_streaming(bool streaming) {
+  if (!s_wifi_initialized || streaming == s_streaming) {
+    return;
+  }
+
+  // Modem sleep batches inbound frames to the DTIM interval, which shows up
+  // as 100+ ms arrival bursts in the jitter statistics
+  esp_err_t err = esp_wifi_set_ps(streaming ? WIFI_PS_NONE : WIFI_IDLE_PS);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to set power save: %s", esp_err_to_name(err));
+    return;
+  }
+  s_streaming = streaming;
+  ESP_LOGI(TAG, "Streaming profile %s", streaming ? "on" : "off");
+}
+
 bool wifi_is_connected(void) {
   return s_sta_connected;
 }
 
+void wifi_get_stats(wifi_stats_t *stats) {
+  *stats = s_stats;
+  stats->retry_streak = (uint32_t)s_retry_num;
+}
+
 esp_err_t wifi_get_ip_str(char *ip_str, size_t len) {
   if (!s_sta_netif || !ip_str || len == 0) {
     return ESP_ERR_INVALID_ARG;
@@ -370,68 +929,41 @@ esp_err_t wifi_get_ip_str(char *ip_str, size_t len) {
   return err;
 }
 
-esp_err_t wifi_scan(wifi_ap_record_t **ap_list, uint16_t *ap_count) {
-  if (!ap_list || !ap_count) {
+esp_err_t wifi_scan_get_cached(bool refresh, wifi_ap_record_t **ap_list,
+                               uint16_t *ap_count, wifi_scan_info_t *info) {
+  if (!ap_list || !ap_count || !info) {
     return ESP_ERR_INVALID_ARG;
   }
-
-  // Stop any pending retry and disconnect cleanly
-  esp_timer_stop(s_retry_timer);
-  esp_wifi_disconnect();
-  vTaskDelay(pdMS_TO_TICKS(100));
-
-  // Clear BSSID lock so next connect can use a fresh scan result
-  if (s_bssid_set) {
-    wifi_config_t sta_cfg;
-    if (esp_wifi_get_config(WIFI_IF_STA, &sta_cfg) == ESP_OK) {
-      memset(sta_cfg.sta.bssid, 0, sizeof(sta_cfg.sta.bssid));
-      sta_cfg.sta.bssid_set = false;
-      esp_wifi_set_config(WIFI_IF_STA, &sta_cfg);
-    }
-    s_bssid_set = false;
-  }
-
-  wifi_scan_config_t scan_config = {
-      .ssid = NULL,
-      .bssid = NULL,
-      .channel = 0,
-      .show_hidden = true,
-  };
-
-  esp_err_t err = esp_wifi_scan_start(&scan_config, true);
-  if (err != ESP_OK) {
-    ESP_LOGE(TAG, "WiFi scan failed: %s", esp_err_to_name(err));
-    return err;
+  if (!s_wifi_initialized) {
+    return ESP_ERR_INVALID_STATE;
   }
 
-  uint16_t number = 0;
-  err = esp_wifi_scan_get_ap_num(&number);
-  if (err != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to get AP count: %s", esp_err_to_name(err));
-    return err;
-  }
-
-  if (number == 0) {
-    *ap_list = NULL;
-    *ap_count = 0;
-    return ESP_OK;
-  }
-
-  wifi_ap_record_t *aps = malloc(sizeof(wifi_ap_record_t) * number);
-  if (!aps) {
-    return ESP_ERR_NO_MEM;
+  esp_err_t err = ESP_OK;
+  xSemaphoreTake(s_scan_mutex, portMAX_DELAY);
+  *ap_list = NULL;
+  *ap_count = 0;
+  if (s_scan_count > 0) {
+    *ap_list = malloc(sizeof(wifi_ap_record_t) * s_scan_count);
+    if (*ap_list) {
+      memcpy(*ap_list, s_scan_records,
+             sizeof(wifi_ap_record_t) * s_scan_count);
+      *ap_count = s_scan_count;
+    } else {
+      err = ESP_ERR_NO_MEM;
+    }
   }
+  info->age_ms = s_scan_time_us > 0
+                     ? (esp_timer_get_time() - s_scan_time_us) / 1000
+                     : -1;
+  bool fresh = scan_is_fresh();
+  xSemaphoreGive(s_scan_mutex);
 
-  err = esp_wifi_scan_get_ap_records(&number, aps);
-  if (err != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to get AP records: %s", esp_err_to_name(err));
-    free(aps);
-    return err;
+  if (refresh || !fresh) {
+    scan_start_background();
   }
-
-  *ap_list = aps;
-  *ap_count = number;
-  return ESP_OK;
+  info->scanning = s_scan_running;
+  info->streaming = s_streaming;
+  return err;
 }
 
 void wifi_stop(void) {
@@ -442,6 +974,11 @@ void wifi_stop(void) {
     s_wifi_initialized = false;
     s_sta_connected = false;
     s_retry_num = 0;
+    scan_release();
+    s_scan_done_ignore = 0;
+#if CONFIG_WIFI_ROAMING
+    s_roaming = false;
+#endif
     if (s_wifi_event_group) {
       xEventGroupClearBits(s_wifi_event_group,
                            WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
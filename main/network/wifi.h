@@ -23,11 +23,32 @@ bool wifi_wait_connected(uint32_t timeout_ms);
  */
 void wifi_get_mac_str(char *mac_str, size_t len);
 
+/**
+ * Switch the low-latency streaming profile (no modem power save) on or off.
+ * Driven by RTSP playback events; while idle the radio uses the power save
+ * mode chosen by CONFIG_WIFI_IDLE_POWER_SAVE.
+ */
+void wifi_set_streaming(bool streaming);
+
 /**
  * Check if WiFi STA is connected
  */
 bool wifi_is_connected(void);
 
+typedef struct {
+  uint32_t connects;      // Got an IP, since boot
+  uint32_t disconnects;   // Lost the AP or failed to join, since boot
+  uint32_t retry_streak;  // Failed attempts since the last connect
+  uint8_t last_reason;    // wifi_err_reason_t of the last disconnect
+  uint32_t roams;         // Moved to another AP without a disconnect
+  uint32_t roam_failures; // Roams that fell back to the old AP
+} wifi_stats_t;
+
+/**
+ * Station connection counters.
+ */
+void wifi_get_stats(wifi_stats_t *stats);
+
 /**
  * Get current IP address as string
  * @param ip_str Output buffer
@@ -36,13 +57,24 @@ bool wifi_is_connected(void);
  */
 esp_err_t wifi_get_ip_str(char *ip_str, size_t len);
 
+typedef struct {
+  int64_t age_ms;  // Of the results, -1 until the first scan completes
+  bool scanning;   // A new scan is in progress
+  bool streaming;  // No new scans until the stream ends
+} wifi_scan_info_t;
+
 /**
- * Scan for available WiFi networks
- * @param ap_list Output array of AP info (caller must free)
- * @param ap_count Output: number of APs found
+ * Get the last WiFi scan results without waiting for a scan. Results older
+ * than CONFIG_WIFI_SCAN_MAX_AGE_S start a new scan in the background, unless
+ * a stream is active; poll again for them.
+ * @param refresh Start a new scan even if the results are fresh
+ * @param ap_list Output copy of the AP info (caller must free), NULL if none
+ * @param ap_count Output: number of APs
+ * @param info Output: age of the results and scan state
  * @return ESP_OK on success
  */
-esp_err_t wifi_scan(wifi_ap_record_t **ap_list, uint16_t *ap_count);
+esp_err_t wifi_scan_get_cached(bool refresh, wifi_ap_record_t **ap_list,
+                               uint16_t *ap_count, wifi_scan_info_t *info);
 
 /**
  * Disconnect and stop WiFi
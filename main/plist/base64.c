@@ -2,28 +2,60 @@
 
 #include "base64.h"
 
+#define XX 0xFF // Not base64
+#define WS 0x80 // Whitespace, skipped
+#define PD 0x81 // Padding, ends the data
+#define SPECIAL 0x80 // Set in all three, clear for the 64 digits
+
 static const char b64_table[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
 static const uint8_t b64_decode_table[256] = {
-    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
-    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
-    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 62,  255,
-    255, 255, 63,  52,  53,  54,  55,  56,  57,  58,  59,  60,  61,  255, 255,
-    255, 0,   255, 255, 255, 0,   1,   2,   3,   4,   5,   6,   7,   8,   9,
-    10,  11,  12,  13,  14,  15,  16,  17,  18,  19,  20,  21,  22,  23,  24,
-    25,  255, 255, 255, 255, 255, 255, 26,  27,  28,  29,  30,  31,  32,  33,
-    34,  35,  36,  37,  38,  39,  40,  41,  42,  43,  44,  45,  46,  47,  48,
-    49,  50,  51,  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
-    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
-    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
-    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
-    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
-    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
-    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
-    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
-    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
-    255};
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, WS, WS, XX, XX, WS, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, WS, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, 62, XX, XX, XX, 63, 52, 53, 54, 55, 56, 57, 58, 59, 60,
+    61, XX, XX, XX, PD, XX, XX, XX, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12,
+    13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, XX, XX, XX, XX, XX, XX,
+    26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44,
+    45, 46, 47, 48, 49, 50, 51, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX};
+
+/* ---------- encode ---------- */
+
+// The four characters of a group, in memory order for a single 32-bit store
+// (all ESP32 targets are little-endian)
+static inline uint32_t encode_group(uint32_t triple) {
+  return (uint32_t)(uint8_t)b64_table[triple >> 18] |
+         ((uint32_t)(uint8_t)b64_table[(triple >> 12) & 0x3F] << 8) |
+         ((uint32_t)(uint8_t)b64_table[(triple >> 6) & 0x3F] << 16) |
+         ((uint32_t)(uint8_t)b64_table[triple & 0x3F] << 24);
+}
+
+static size_t encode_groups(const uint8_t *in, size_t groups, char *out) {
+  for (size_t i = 0; i < groups; i++, in += 3, out += 4) {
+    uint32_t word = encode_group(((uint32_t)in[0] << 16) |
+                                 ((uint32_t)in[1] << 8) | in[2]);
+    memcpy(out, &word, sizeof(word));
+  }
+  return groups * 4;
+}
+
+// The last one or two bytes, padded to a group
+static void encode_tail(const uint8_t *in, size_t len, char *out) {
+  uint32_t triple = ((uint32_t)in[0] << 16) | (len > 1 ? in[1] << 8 : 0);
+  uint32_t word = encode_group(triple);
+  memcpy(out, &word, sizeof(word));
+  out[3] = '=';
+  if (len == 1) {
+    out[2] = '=';
+  }
+}
 
 size_t base64_encoded_length(size_t input_len) {
   return ((input_len + 2) / 3) * 4;
@@ -40,75 +72,148 @@ int base64_encode(const uint8_t *input, size_t input_len, char *output,
     return -1;
   }
 
-  size_t pos = 0;
-  for (size_t i = 0; i < input_len; i += 3) {
-    uint32_t octet_a = i < input_len ? input[i] : 0;
-    uint32_t octet_b = i + 1 < input_len ? input[i + 1] : 0;
-    uint32_t octet_c = i + 2 < input_len ? input[i + 2] : 0;
+  size_t groups = input_len / 3;
+  size_t pos = encode_groups(input, groups, output);
+  if (input_len % 3) {
+    encode_tail(input + groups * 3, input_len % 3, output + pos);
+  }
+  return (int)out_len;
+}
 
-    uint32_t triple = (octet_a << 16) | (octet_b << 8) | octet_c;
+void base64_encoder_init(base64_encoder_t *enc) {
+  if (enc) {
+    enc->pending_len = 0;
+  }
+}
 
-    output[pos++] = b64_table[(triple >> 18) & 0x3F];
-    output[pos++] = b64_table[(triple >> 12) & 0x3F];
-    output[pos++] =
-        (char)((i + 1 < input_len) ? b64_table[(triple >> 6) & 0x3F] : '=');
-    output[pos++] =
-        (char)((i + 2 < input_len) ? b64_table[triple & 0x3F] : '=');
+int base64_encoder_update(base64_encoder_t *enc, const uint8_t *input,
+                          size_t input_len, char *output,
+                          size_t output_capacity) {
+  if (!enc || (!input && input_len > 0) || !output) {
+    return -1;
+  }
+  size_t total = enc->pending_len + input_len;
+  if (total / 3 * 4 > output_capacity) {
+    return -1;
   }
 
-  return (int)out_len;
+  size_t pos = 0;
+  if (enc->pending_len > 0 && total >= 3) {
+    // Complete the group carried over from the last chunk
+    uint8_t group[3];
+    size_t take = 3 - enc->pending_len;
+    memcpy(group, enc->pending, enc->pending_len);
+    memcpy(group + enc->pending_len, input, take);
+    pos = encode_groups(group, 1, output);
+    input += take;
+    input_len -= take;
+    enc->pending_len = 0;
+  }
+  size_t groups = input_len / 3;
+  pos += encode_groups(input, groups, output + pos);
+  input_len -= groups * 3;
+  memcpy(enc->pending + enc->pending_len, input + groups * 3, input_len);
+  enc->pending_len += input_len;
+  return (int)pos;
 }
 
-int base64_decode(const char *input, size_t input_len, uint8_t *output,
-                  size_t output_capacity) {
-  if (!input || !output || output_capacity == 0) {
+int base64_encoder_finish(base64_encoder_t *enc, char *output,
+                          size_t output_capacity) {
+  if (!enc || !output) {
     return -1;
   }
+  if (enc->pending_len == 0) {
+    return 0;
+  }
+  if (output_capacity < 4) {
+    return -1;
+  }
+  encode_tail(enc->pending, enc->pending_len, output);
+  enc->pending_len = 0;
+  return 4;
+}
 
-  size_t actual_len = 0;
-  for (size_t i = 0; i < input_len; i++) {
-    char c = input[i];
-    if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
-      actual_len++;
-    }
+/* ---------- decode ---------- */
+
+void base64_decoder_init(base64_decoder_t *dec) {
+  if (dec) {
+    dec->accum = 0;
+    dec->bits = 0;
+    dec->done = false;
   }
+}
 
-  size_t output_len = (actual_len * 3) / 4;
-  if (output_len > output_capacity) {
+int base64_decoder_update(base64_decoder_t *dec, const char *input,
+                          size_t input_len, uint8_t *output,
+                          size_t output_capacity) {
+  if (!dec || (!input && input_len > 0) || !output) {
     return -1;
   }
 
+  const uint8_t *in = (const uint8_t *)input;
+  size_t i = 0;
   size_t j = 0;
-  uint32_t accum = 0;
-  int bits = 0;
-
-  for (size_t i = 0; i < input_len; i++) {
-    char c = input[i];
+  while (i < input_len && !dec->done) {
+    // On a group boundary: four digits at a time while there is no
+    // whitespace or padding among them. All four are read before the three
+    // bytes are written, which keeps in-place decoding safe.
+    if (dec->bits == 0) {
+      while (i + 4 <= input_len) {
+        uint32_t a = b64_decode_table[in[i]];
+        uint32_t b = b64_decode_table[in[i + 1]];
+        uint32_t c = b64_decode_table[in[i + 2]];
+        uint32_t d = b64_decode_table[in[i + 3]];
+        if ((a | b | c | d) & SPECIAL) {
+          break;
+        }
+        if (j + 3 > output_capacity) {
+          return -1;
+        }
+        uint32_t word = (a << 18) | (b << 12) | (c << 6) | d;
+        output[j] = (uint8_t)(word >> 16);
+        output[j + 1] = (uint8_t)(word >> 8);
+        output[j + 2] = (uint8_t)word;
+        i += 4;
+        j += 3;
+      }
+      if (i >= input_len) {
+        break;
+      }
+    }
 
-    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+    // One character at a time around whitespace, padding and chunk edges
+    uint8_t val = b64_decode_table[in[i++]];
+    if (val == WS) {
       continue;
     }
-
-    if (c == '=') {
+    if (val == PD) {
+      dec->done = true;
       break;
     }
-
-    uint8_t val = b64_decode_table[(uint8_t)c];
-    if (val == 255) {
+    if (val == XX) {
       return -1;
     }
-
-    accum = (accum << 6) | val;
-    bits += 6;
-
-    if (bits >= 8) {
-      bits -= 8;
+    dec->accum = (dec->accum << 6) | val;
+    dec->bits += 6;
+    if (dec->bits >= 8) {
+      dec->bits -= 8;
       if (j >= output_capacity) {
         return -1;
       }
-      output[j++] = (accum >> bits) & 0xFF;
+      output[j++] = (uint8_t)(dec->accum >> dec->bits);
     }
   }
-
   return (int)j;
 }
+
+int base64_decode(const char *input, size_t input_len, uint8_t *output,
+                  size_t output_capacity) {
+  if (!input || !output || output_capacity == 0) {
+    return -1;
+  }
+
+  base64_decoder_t dec;
+  base64_decoder_init(&dec);
+  return base64_decoder_update(&dec, input, input_len, output,
+                               output_capacity);
+}
@@ -1,10 +1,60 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 size_t base64_encoded_length(size_t input_len);
 int base64_encode(const uint8_t *input, size_t input_len, char *output,
                   size_t output_capacity);
+
+/**
+ * Decode, skipping whitespace and stopping at the first '='. output may be
+ * the input buffer itself: each byte is written only after the characters
+ * it came from have been read.
+ * @return Bytes written, -1 on an invalid character or a full output
+ */
 int base64_decode(const char *input, size_t input_len, uint8_t *output,
                   size_t output_capacity);
+
+/**
+ * Streaming encode for payloads that arrive or leave in pieces. Chunks of
+ * any size can be fed; up to two bytes carry over to the next one.
+ */
+typedef struct {
+  uint8_t pending[2];
+  size_t pending_len;
+} base64_encoder_t;
+
+void base64_encoder_init(base64_encoder_t *enc);
+
+/**
+ * Encode the complete groups of what has been fed so far.
+ * @return Characters written (a multiple of 4), -1 if they do not fit, in
+ *         which case nothing is consumed
+ */
+int base64_encoder_update(base64_encoder_t *enc, const uint8_t *input,
+                          size_t input_len, char *output,
+                          size_t output_capacity);
+
+/** Write the padded last group, if any. @return 0 or 4, -1 if no room */
+int base64_encoder_finish(base64_encoder_t *enc, char *output,
+                          size_t output_capacity);
+
+/** Streaming decode; the partial group carries over between chunks. */
+typedef struct {
+  uint32_t accum;
+  int bits;
+  bool done; // Padding seen, the rest is ignored
+} base64_decoder_t;
+
+void base64_decoder_init(base64_decoder_t *dec);
+
+/**
+ * Decode one chunk, in place if wanted as with base64_decode().
+ * @return Bytes written, -1 on an invalid character or a full output (the
+ *         stream is then unusable)
+ */
+int base64_decoder_update(base64_decoder_t *dec, const char *input,
+                          size_t input_len, uint8_t *output,
+                          size_t output_capacity);
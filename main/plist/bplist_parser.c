@@ -1,11 +1,9 @@
-#include <inttypes.h>
 #include <string.h>
 
 #include "plist.h"
 
 // Binary plist object types (high nibble of marker byte)
-#define BPLIST_NULL    0x00
-#define BPLIST_BOOL    0x00
+#define BPLIST_SIMPLE  0x00 // null, false, true
 #define BPLIST_INT     0x10
 #define BPLIST_REAL    0x20
 #define BPLIST_DATE    0x30
@@ -17,6 +15,19 @@
 #define BPLIST_SET     0xC0
 #define BPLIST_DICT    0xD0
 
+#define BPLIST_FALSE 0x08
+#define BPLIST_TRUE  0x09
+
+typedef struct {
+  const uint8_t *data;
+  size_t len;
+  uint8_t offset_size;
+  uint8_t ref_size;
+  uint64_t num_objects;
+  uint64_t top_object;
+  uint64_t offset_table_offset;
+} bplist_trailer_t;
+
 static uint64_t read_be_int(const uint8_t *data, size_t bytes) {
   uint64_t val = 0;
   for (size_t i = 0; i < bytes; i++) {
@@ -25,1382 +36,324 @@ static uint64_t read_be_int(const uint8_t *data, size_t bytes) {
   return val;
 }
 
-static bool bplist_parse_trailer(const uint8_t *plist, size_t plist_len,
-                                 uint8_t *offset_size, uint8_t *ref_size,
-                                 uint64_t *num_objects, uint64_t *top_object,
-                                 uint64_t *offset_table_offset) {
-  if (plist_len < 32) {
+static bool parse_trailer(const uint8_t *plist, size_t plist_len,
+                          bplist_trailer_t *t) {
+  if (!plist || plist_len < 40 || memcmp(plist, "bplist00", 8) != 0) {
     return false;
   }
 
   const uint8_t *trailer = plist + plist_len - 32;
-
-  *offset_size = trailer[6];
-  *ref_size = trailer[7];
-  *num_objects = read_be_int(trailer + 8, 8);
-  *top_object = read_be_int(trailer + 16, 8);
-  *offset_table_offset = read_be_int(trailer + 24, 8);
-
-  return (*offset_size > 0 && *offset_size <= 8 && *ref_size > 0 &&
-          *ref_size <= 8 && *offset_table_offset < plist_len);
+  t->data = plist;
+  t->len = plist_len;
+  t->offset_size = trailer[6];
+  t->ref_size = trailer[7];
+  t->num_objects = read_be_int(trailer + 8, 8);
+  t->top_object = read_be_int(trailer + 16, 8);
+  t->offset_table_offset = read_be_int(trailer + 24, 8);
+
+  return t->offset_size > 0 && t->offset_size <= 8 && t->ref_size > 0 &&
+         t->ref_size <= 8 && t->offset_table_offset < plist_len &&
+         t->num_objects <=
+             (plist_len - t->offset_table_offset) / t->offset_size &&
+         t->top_object < t->num_objects;
 }
 
-static uint64_t bplist_get_offset(const uint8_t *plist,
-                                  uint64_t offset_table_offset,
-                                  uint8_t offset_size, uint64_t obj_idx) {
-  const uint8_t *entry = plist + offset_table_offset + obj_idx * offset_size;
-  return read_be_int(entry, offset_size);
-}
-
-static bool bplist_read_string(const uint8_t *plist, size_t plist_len,
-                               uint64_t offset, char *out,
-                               size_t out_capacity) {
-  if (offset >= plist_len) {
-    return false;
-  }
-
-  uint8_t marker = plist[offset];
-  uint8_t type = marker & 0xF0;
-  size_t len = marker & 0x0F;
-  size_t pos = offset + 1;
-
-  if (len == 0x0F) {
-    if (pos >= plist_len) {
-      return false;
-    }
-    uint8_t len_marker = plist[pos++];
-    if ((len_marker & 0xF0) != BPLIST_INT) {
-      return false;
-    }
-    size_t len_bytes = 1 << (len_marker & 0x0F);
-    if (pos + len_bytes > plist_len) {
-      return false;
-    }
-    len = (size_t)read_be_int(plist + pos, len_bytes);
-    pos += len_bytes;
-  }
-
-  if (type == BPLIST_STRING) {
-    if (pos + len > plist_len || len >= out_capacity) {
-      return false;
-    }
-    memcpy(out, plist + pos, len);
-    out[len] = '\0';
-    return true;
-  }
-
-  if (type == BPLIST_UNICODE) {
-    size_t bytes = len * 2;
-    if (pos + bytes > plist_len || len >= out_capacity) {
-      return false;
-    }
-    for (size_t i = 0; i < len; i++) {
-      uint16_t code =
-          (uint16_t)(plist[pos + i * 2] << 8) | plist[pos + i * 2 + 1];
-      out[i] = (code <= 0x7F) ? (char)code : '?';
-    }
-    out[len] = '\0';
-    return true;
+// Byte offset of an object, or len if the reference is out of range
+static size_t object_offset(const bplist_trailer_t *t, uint64_t idx) {
+  if (idx >= t->num_objects) {
+    return t->len;
   }
-
-  return false;
+  uint64_t offset = read_be_int(
+      t->data + t->offset_table_offset + idx * t->offset_size, t->offset_size);
+  return offset < t->offset_table_offset ? (size_t)offset : t->len;
 }
 
-static bool bplist_read_data(const uint8_t *plist, size_t plist_len,
-                             uint64_t offset, uint8_t *out, size_t out_capacity,
-                             size_t *out_len) {
-  if (offset >= plist_len) {
-    return false;
-  }
-
-  uint8_t marker = plist[offset];
-  uint8_t type = marker & 0xF0;
-  size_t len = marker & 0x0F;
-  size_t pos = offset + 1;
-
-  if (len == 0x0F) {
-    if (pos >= plist_len) {
-      return false;
-    }
-    uint8_t len_marker = plist[pos++];
-    if ((len_marker & 0xF0) != BPLIST_INT) {
-      return false;
-    }
-    size_t len_bytes = 1 << (len_marker & 0x0F);
-    if (pos + len_bytes > plist_len) {
-      return false;
-    }
-    len = (size_t)read_be_int(plist + pos, len_bytes);
-    pos += len_bytes;
-  }
-
-  if (type == BPLIST_DATA) {
-    if (pos + len > plist_len || len > out_capacity) {
-      return false;
-    }
-    memcpy(out, plist + pos, len);
-    *out_len = len;
+// Object length from the marker nibble or the int that follows it; pos is
+// advanced to the payload. No count can exceed the document length, so a
+// larger one is rejected before it is narrowed to size_t
+static bool read_count(const bplist_trailer_t *t, size_t *pos, uint8_t marker,
+                       size_t *count) {
+  size_t info = marker & 0x0F;
+  if (info != 0x0F) {
+    *count = info;
     return true;
   }
 
-  return false;
-}
-
-static bool bplist_read_data_len(const uint8_t *plist, size_t plist_len,
-                                 uint64_t offset, size_t *out_len) {
-  if (offset >= plist_len) {
+  if (*pos >= t->len || (t->data[*pos] & 0xF0) != BPLIST_INT) {
     return false;
   }
-
-  uint8_t marker = plist[offset];
-  uint8_t type = marker & 0xF0;
-  size_t len = marker & 0x0F;
-  size_t pos = offset + 1;
-
-  if (len == 0x0F) {
-    if (pos >= plist_len) {
-      return false;
-    }
-    uint8_t len_marker = plist[pos++];
-    if ((len_marker & 0xF0) != BPLIST_INT) {
-      return false;
-    }
-    size_t len_bytes = 1 << (len_marker & 0x0F);
-    if (pos + len_bytes > plist_len) {
-      return false;
-    }
-    len = (size_t)read_be_int(plist + pos, len_bytes);
-    pos += len_bytes;
+  size_t len_bytes = (size_t)1 << (t->data[*pos] & 0x0F);
+  if (len_bytes > 8 || *pos + 1 + len_bytes > t->len) {
+    return false;
   }
-
-  if (type == BPLIST_DATA) {
-    if (pos + len > plist_len) {
-      return false;
-    }
-    *out_len = len;
-    return true;
+  uint64_t value = read_be_int(t->data + *pos + 1, len_bytes);
+  if (value > t->len) {
+    return false;
   }
-
-  return false;
+  *count = (size_t)value;
+  *pos += 1 + len_bytes;
+  return true;
 }
 
-static bool bplist_read_string_len(const uint8_t *plist, size_t plist_len,
-                                   uint64_t offset, size_t *out_len) {
-  if (offset >= plist_len) {
+// Decode one object into a node; containers keep the byte position of their
+// reference list in first_child until they are expanded
+static bool decode_object(const bplist_trailer_t *t, uint64_t idx,
+                          bplist_node_t *node) {
+  size_t offset = object_offset(t, idx);
+  if (offset >= t->len) {
     return false;
   }
 
-  uint8_t marker = plist[offset];
-  uint8_t type = marker & 0xF0;
-  size_t len = marker & 0x0F;
+  uint8_t marker = t->data[offset];
   size_t pos = offset + 1;
+  size_t count = 0;
+  size_t bytes = 0;
 
-  if (len == 0x0F) {
-    if (pos >= plist_len) {
-      return false;
-    }
-    uint8_t len_marker = plist[pos++];
-    if ((len_marker & 0xF0) != BPLIST_INT) {
-      return false;
-    }
-    size_t len_bytes = 1 << (len_marker & 0x0F);
-    if (pos + len_bytes > plist_len) {
-      return false;
-    }
-    len = (size_t)read_be_int(plist + pos, len_bytes);
-    pos += len_bytes;
-  }
+  node->type = BPLIST_VALUE_UNKNOWN;
+  node->utf16 = false;
+  node->len = 0;
+  node->int_value = 0;
 
-  if (type == BPLIST_STRING) {
-    if (pos + len > plist_len) {
-      return false;
-    }
-    *out_len = len;
-    return true;
-  }
-  if (type == BPLIST_UNICODE) {
-    size_t bytes = len * 2;
-    if (pos + bytes > plist_len) {
-      return false;
+  switch (marker & 0xF0) {
+  case BPLIST_SIMPLE:
+    if (marker == BPLIST_FALSE || marker == BPLIST_TRUE) {
+      node->type = BPLIST_VALUE_BOOL;
+      node->int_value = marker == BPLIST_TRUE;
     }
-    *out_len = len;
     return true;
-  }
-
-  return false;
-}
-
-static bool bplist_read_int(const uint8_t *plist, size_t plist_len,
-                            uint64_t offset, int64_t *out) {
-  if (offset >= plist_len) {
-    return false;
-  }
-
-  uint8_t marker = plist[offset];
-  uint8_t type = marker & 0xF0;
 
-  if (type == BPLIST_INT) {
-    size_t len = 1 << (marker & 0x0F);
-    if (offset + 1 + len > plist_len) {
+  case BPLIST_INT:
+  case BPLIST_UID:
+    // Ints are 2^n bytes, UIDs n+1; the low 64 bits of a 128-bit int
+    bytes = (marker & 0xF0) == BPLIST_INT ? (size_t)1 << (marker & 0x0F)
+                                          : (size_t)(marker & 0x0F) + 1;
+    if (bytes > 16 || pos + bytes > t->len) {
       return false;
     }
-    *out = (int64_t)read_be_int(plist + offset + 1, len);
+    node->type = (marker & 0xF0) == BPLIST_INT ? BPLIST_VALUE_INT
+                                               : BPLIST_VALUE_UID;
+    node->int_value =
+        (int64_t)read_be_int(t->data + pos + (bytes > 8 ? bytes - 8 : 0),
+                             bytes > 8 ? 8 : bytes);
     return true;
-  }
-
-  return false;
-}
-
-static bool bplist_read_real(const uint8_t *plist, size_t plist_len,
-                             uint64_t offset, double *out) {
-  if (offset >= plist_len) {
-    return false;
-  }
-
-  uint8_t marker = plist[offset];
-  uint8_t type = marker & 0xF0;
 
-  if (type == BPLIST_REAL) {
-    size_t len = 1 << (marker & 0x0F);
-    if (offset + 1 + len > plist_len) {
+  case BPLIST_REAL:
+    bytes = (size_t)1 << (marker & 0x0F);
+    if (pos + bytes > t->len) {
       return false;
     }
-
-    if (len == 4) {
-      uint32_t bits = (uint32_t)read_be_int(plist + offset + 1, 4);
+    if (bytes == 4) {
+      uint32_t bits = (uint32_t)read_be_int(t->data + pos, 4);
       float f;
       memcpy(&f, &bits, sizeof(f));
-      *out = (double)f;
-      return true;
-    } else if (len == 8) {
-      uint64_t bits = read_be_int(plist + offset + 1, 8);
-      memcpy(out, &bits, sizeof(*out));
-      return true;
-    }
-  }
-
-  return false;
-}
-
-static bool bplist_parse_count(const uint8_t *plist, size_t plist_len,
-                               uint64_t offset, size_t *count,
-                               size_t *header_len) {
-  if (offset >= plist_len) {
-    return false;
-  }
-
-  uint8_t marker = plist[offset];
-  size_t info = marker & 0x0F;
-  size_t pos = offset + 1;
-
-  if (info == 0x0F) {
-    if (pos >= plist_len) {
-      return false;
-    }
-    uint8_t len_marker = plist[pos++];
-    size_t len_bytes = 1 << (len_marker & 0x0F);
-    if (pos + len_bytes > plist_len) {
+      node->real_value = (double)f;
+    } else if (bytes == 8) {
+      uint64_t bits = read_be_int(t->data + pos, 8);
+      memcpy(&node->real_value, &bits, sizeof(node->real_value));
+    } else {
       return false;
     }
-    *count = (size_t)read_be_int(plist + pos, len_bytes);
-    pos += len_bytes;
-  } else {
-    *count = info;
-  }
-
-  *header_len = pos - offset;
-  return true;
-}
-
-static bool bplist_find_data_in_dict(const uint8_t *plist, size_t plist_len,
-                                     uint64_t dict_offset,
-                                     uint64_t offset_table_offset,
-                                     uint8_t offset_size, uint8_t ref_size,
-                                     const char *key, uint8_t *out_data,
-                                     size_t out_capacity, size_t *out_len) {
-  if (dict_offset >= plist_len) {
-    return false;
-  }
-
-  uint8_t marker = plist[dict_offset];
-  if ((marker & 0xF0) != BPLIST_DICT) {
-    return false;
-  }
-
-  size_t dict_size = 0;
-  size_t header_len = 0;
-  if (!bplist_parse_count(plist, plist_len, dict_offset, &dict_size,
-                          &header_len)) {
-    return false;
-  }
-
-  size_t pos = dict_offset + header_len;
-  if (pos + dict_size * 2 * ref_size > plist_len) {
-    return false;
-  }
-
-  const uint8_t *key_refs = plist + pos;
-  const uint8_t *val_refs = plist + pos + dict_size * ref_size;
-
-  for (size_t i = 0; i < dict_size; i++) {
-    uint64_t key_idx = read_be_int(key_refs + i * ref_size, ref_size);
-    uint64_t key_offset =
-        bplist_get_offset(plist, offset_table_offset, offset_size, key_idx);
-
-    char found_key[64];
-    if (bplist_read_string(plist, plist_len, key_offset, found_key,
-                           sizeof(found_key))) {
-      if (strcmp(found_key, key) == 0) {
-        uint64_t val_idx = read_be_int(val_refs + i * ref_size, ref_size);
-        uint64_t val_offset =
-            bplist_get_offset(plist, offset_table_offset, offset_size, val_idx);
-        return bplist_read_data(plist, plist_len, val_offset, out_data,
-                                out_capacity, out_len);
-      }
-    }
-  }
-
-  return false;
-}
-
-static bool bplist_find_data_recursive(const uint8_t *plist, size_t plist_len,
-                                       uint64_t obj_idx,
-                                       uint64_t offset_table_offset,
-                                       uint8_t offset_size, uint8_t ref_size,
-                                       const char *key, uint8_t *out_data,
-                                       size_t out_capacity, size_t *out_len,
-                                       int depth) {
-  if (depth > 10) {
-    return false;
-  }
-
-  uint64_t offset =
-      bplist_get_offset(plist, offset_table_offset, offset_size, obj_idx);
-  if (offset >= plist_len) {
-    return false;
-  }
-
-  uint8_t marker = plist[offset];
-  uint8_t type = marker & 0xF0;
+    node->type = BPLIST_VALUE_REAL;
+    return true;
 
-  if (type == BPLIST_DICT) {
-    size_t dict_size = 0;
-    size_t header_len = 0;
-    if (!bplist_parse_count(plist, plist_len, offset, &dict_size,
-                            &header_len)) {
+  case BPLIST_DATA:
+  case BPLIST_STRING:
+  case BPLIST_UNICODE:
+    if (!read_count(t, &pos, marker, &count)) {
       return false;
     }
-
-    size_t pos = offset + header_len;
-    if (pos + dict_size * 2 * ref_size > plist_len) {
+    // count is at most len, so doubling it cannot wrap
+    bytes = (marker & 0xF0) == BPLIST_UNICODE ? count * 2 : count;
+    if (pos > t->len || bytes > t->len - pos) {
       return false;
     }
+    node->type = (marker & 0xF0) == BPLIST_DATA ? BPLIST_VALUE_DATA
+                                                : BPLIST_VALUE_STRING;
+    node->utf16 = (marker & 0xF0) == BPLIST_UNICODE;
+    node->len = (uint32_t)count;
+    node->bytes = t->data + pos;
+    return true;
 
-    const uint8_t *key_refs = plist + pos;
-    const uint8_t *val_refs = plist + pos + dict_size * ref_size;
-
-    for (size_t i = 0; i < dict_size; i++) {
-      uint64_t key_idx = read_be_int(key_refs + i * ref_size, ref_size);
-      uint64_t key_offset =
-          bplist_get_offset(plist, offset_table_offset, offset_size, key_idx);
-
-      char found_key[64];
-      if (bplist_read_string(plist, plist_len, key_offset, found_key,
-                             sizeof(found_key))) {
-        if (strcmp(found_key, key) == 0) {
-          uint64_t val_idx = read_be_int(val_refs + i * ref_size, ref_size);
-          uint64_t val_offset = bplist_get_offset(plist, offset_table_offset,
-                                                  offset_size, val_idx);
-          return bplist_read_data(plist, plist_len, val_offset, out_data,
-                                  out_capacity, out_len);
-        }
-      }
-    }
-
-    for (size_t i = 0; i < dict_size; i++) {
-      uint64_t val_idx = read_be_int(val_refs + i * ref_size, ref_size);
-      if (bplist_find_data_recursive(
-              plist, plist_len, val_idx, offset_table_offset, offset_size,
-              ref_size, key, out_data, out_capacity, out_len, depth + 1)) {
-        return true;
-      }
-    }
-  } else if (type == BPLIST_ARRAY || type == BPLIST_SET) {
-    size_t count = 0;
-    size_t header_len = 0;
-    if (!bplist_parse_count(plist, plist_len, offset, &count, &header_len)) {
+  case BPLIST_ARRAY:
+  case BPLIST_SET:
+  case BPLIST_DICT:
+    if (!read_count(t, &pos, marker, &count)) {
       return false;
     }
-
-    size_t pos = offset + header_len;
-    if (pos + count * ref_size > plist_len) {
+    bytes = ((marker & 0xF0) == BPLIST_DICT ? 2 : 1) * (size_t)t->ref_size;
+    if (count > t->num_objects * 2 || pos > t->len ||
+        count > (t->len - pos) / bytes) {
       return false;
     }
+    node->type = (marker & 0xF0) == BPLIST_DICT ? BPLIST_VALUE_DICT
+                                                : BPLIST_VALUE_ARRAY;
+    node->len = (uint32_t)count;
+    node->first_child = (uint32_t)pos;
+    return true;
 
-    for (size_t i = 0; i < count; i++) {
-      uint64_t idx = read_be_int(plist + pos + i * ref_size, ref_size);
-      if (bplist_find_data_recursive(plist, plist_len, idx, offset_table_offset,
-                                     offset_size, ref_size, key, out_data,
-                                     out_capacity, out_len, depth + 1)) {
-        return true;
-      }
-    }
+  default:
+    return true; // Dates and reserved types are kept as UNKNOWN
   }
-
-  return false;
 }
 
-static bool bplist_find_string_in_dict(const uint8_t *plist, size_t plist_len,
-                                       uint64_t dict_offset,
-                                       uint64_t offset_table_offset,
-                                       uint8_t offset_size, uint8_t ref_size,
-                                       const char *key, char *out,
-                                       size_t out_capacity) {
-  if (dict_offset >= plist_len || !out || out_capacity == 0) {
-    return false;
-  }
-
-  uint8_t marker = plist[dict_offset];
-  if ((marker & 0xF0) != BPLIST_DICT) {
-    return false;
-  }
-
-  size_t dict_size = 0;
-  size_t header_len = 0;
-  if (!bplist_parse_count(plist, plist_len, dict_offset, &dict_size,
-                          &header_len)) {
-    return false;
-  }
-
-  size_t pos = dict_offset + header_len;
-  if (pos + dict_size * 2 * ref_size > plist_len) {
+bool bplist_parse(bplist_doc_t *doc, const uint8_t *plist, size_t plist_len,
+                  bplist_node_t *nodes, size_t capacity) {
+  if (!doc) {
     return false;
   }
+  doc->nodes = nodes;
+  doc->count = 0;
 
-  const uint8_t *key_refs = plist + pos;
-  const uint8_t *val_refs = plist + pos + dict_size * ref_size;
-
-  for (size_t i = 0; i < dict_size; i++) {
-    uint64_t key_idx = read_be_int(key_refs + i * ref_size, ref_size);
-    uint64_t key_offset =
-        bplist_get_offset(plist, offset_table_offset, offset_size, key_idx);
-
-    char found_key[64];
-    if (bplist_read_string(plist, plist_len, key_offset, found_key,
-                           sizeof(found_key))) {
-      if (strcmp(found_key, key) == 0) {
-        uint64_t val_idx = read_be_int(val_refs + i * ref_size, ref_size);
-        uint64_t val_offset =
-            bplist_get_offset(plist, offset_table_offset, offset_size, val_idx);
-        return bplist_read_string(plist, plist_len, val_offset, out,
-                                  out_capacity);
-      }
-    }
-  }
-
-  return false;
-}
-
-static bool bplist_find_string_recursive(
-    const uint8_t *plist, size_t plist_len, uint64_t obj_idx,
-    uint64_t offset_table_offset, uint8_t offset_size, uint8_t ref_size,
-    const char *key, char *out, size_t out_capacity, int depth) {
-  if (depth > 10) {
+  bplist_trailer_t t;
+  if (!nodes || capacity == 0 || !parse_trailer(plist, plist_len, &t)) {
     return false;
   }
 
-  uint64_t offset =
-      bplist_get_offset(plist, offset_table_offset, offset_size, obj_idx);
-  if (offset >= plist_len) {
+  memset(&nodes[0], 0, sizeof(nodes[0]));
+  if (!decode_object(&t, t.top_object, &nodes[0])) {
     return false;
   }
+  size_t count = 1;
 
-  uint8_t marker = plist[offset];
-  uint8_t type = marker & 0xF0;
-
-  if (type == BPLIST_DICT) {
-    if (bplist_find_string_in_dict(plist, plist_len, offset, offset_table_offset,
-                                   offset_size, ref_size, key, out,
-                                   out_capacity)) {
-      return true;
-    }
-
-    size_t dict_size = 0;
-    size_t header_len = 0;
-    if (!bplist_parse_count(plist, plist_len, offset, &dict_size,
-                            &header_len)) {
-      return false;
+  // Breadth first: each container's children are appended as one run, so
+  // the node array is the work queue and no recursion is needed. Shared or
+  // cyclic references just use up the arena.
+  for (size_t i = 0; i < count; i++) {
+    bplist_node_t *node = &nodes[i];
+    if (node->type != BPLIST_VALUE_ARRAY && node->type != BPLIST_VALUE_DICT) {
+      continue;
     }
 
-    size_t pos = offset + header_len;
-    if (pos + dict_size * 2 * ref_size > plist_len) {
+    size_t children = node->len;
+    if (children > capacity - count) {
       return false;
     }
+    const uint8_t *refs = t.data + node->first_child;
+    const uint8_t *value_refs =
+        node->type == BPLIST_VALUE_DICT ? refs + children * t.ref_size : refs;
+    node->first_child = (uint32_t)count;
 
-    const uint8_t *val_refs = plist + pos + dict_size * ref_size;
-    for (size_t i = 0; i < dict_size; i++) {
-      uint64_t val_idx = read_be_int(val_refs + i * ref_size, ref_size);
-      if (bplist_find_string_recursive(
-              plist, plist_len, val_idx, offset_table_offset, offset_size,
-              ref_size, key, out, out_capacity, depth + 1)) {
-        return true;
+    for (size_t c = 0; c < children; c++) {
+      bplist_node_t *child = &nodes[count++];
+      memset(child, 0, sizeof(*child));
+      uint64_t idx = read_be_int(value_refs + c * t.ref_size, t.ref_size);
+      if (!decode_object(&t, idx, child)) {
+        return false;
       }
-    }
-  } else if (type == BPLIST_ARRAY || type == BPLIST_SET) {
-    size_t count = 0;
-    size_t header_len = 0;
-    if (!bplist_parse_count(plist, plist_len, offset, &count, &header_len)) {
-      return false;
-    }
-
-    size_t pos = offset + header_len;
-    if (pos + count * ref_size > plist_len) {
-      return false;
-    }
 
-    for (size_t i = 0; i < count; i++) {
-      uint64_t idx = read_be_int(plist + pos + i * ref_size, ref_size);
-      if (bplist_find_string_recursive(plist, plist_len, idx, offset_table_offset,
-                                       offset_size, ref_size, key, out,
-                                       out_capacity, depth + 1)) {
-        return true;
+      if (node->type == BPLIST_VALUE_DICT) {
+        // Keys are ASCII strings; anything else leaves the member unnamed
+        bplist_node_t key;
+        uint64_t key_idx = read_be_int(refs + c * t.ref_size, t.ref_size);
+        if (decode_object(&t, key_idx, &key) &&
+            key.type == BPLIST_VALUE_STRING && !key.utf16 &&
+            key.len <= UINT16_MAX) {
+          child->key = key.bytes;
+          child->key_len = (uint16_t)key.len;
+        }
       }
     }
   }
 
-  return false;
-}
-
-bool bplist_find_data(const uint8_t *plist, size_t plist_len, const char *key,
-                      uint8_t *out_data, size_t out_capacity, size_t *out_len) {
-  if (plist_len < 40 || memcmp(plist, "bplist00", 8) != 0) {
-    return false;
-  }
-
-  uint8_t offset_size = 0;
-  uint8_t ref_size = 0;
-  uint64_t num_objects = 0;
-  uint64_t top_object = 0;
-  uint64_t offset_table_offset = 0;
-  if (!bplist_parse_trailer(plist, plist_len, &offset_size, &ref_size,
-                            &num_objects, &top_object, &offset_table_offset)) {
-    return false;
-  }
-
-  uint64_t top_offset =
-      bplist_get_offset(plist, offset_table_offset, offset_size, top_object);
-  if (top_offset >= plist_len) {
-    return false;
-  }
-
-  return bplist_find_data_in_dict(plist, plist_len, top_offset,
-                                  offset_table_offset, offset_size, ref_size,
-                                  key, out_data, out_capacity, out_len);
-}
-
-bool bplist_find_data_deep(const uint8_t *plist, size_t plist_len,
-                           const char *key, uint8_t *out_data,
-                           size_t out_capacity, size_t *out_len) {
-  if (plist_len < 40 || memcmp(plist, "bplist00", 8) != 0) {
-    return false;
-  }
-
-  uint8_t offset_size = 0;
-  uint8_t ref_size = 0;
-  uint64_t num_objects = 0;
-  uint64_t top_object = 0;
-  uint64_t offset_table_offset = 0;
-  if (!bplist_parse_trailer(plist, plist_len, &offset_size, &ref_size,
-                            &num_objects, &top_object, &offset_table_offset)) {
-    return false;
-  }
-
-  (void)num_objects;
-  return bplist_find_data_recursive(plist, plist_len, top_object,
-                                    offset_table_offset, offset_size, ref_size,
-                                    key, out_data, out_capacity, out_len, 0);
-}
-
-bool bplist_find_string(const uint8_t *plist, size_t plist_len, const char *key,
-                        char *out, size_t out_capacity) {
-  if (!out || out_capacity == 0) {
-    return false;
-  }
-  out[0] = '\0';
-
-  if (plist_len < 40 || memcmp(plist, "bplist00", 8) != 0) {
-    return false;
-  }
-
-  uint8_t offset_size = 0;
-  uint8_t ref_size = 0;
-  uint64_t num_objects = 0;
-  uint64_t top_object = 0;
-  uint64_t offset_table_offset = 0;
-  if (!bplist_parse_trailer(plist, plist_len, &offset_size, &ref_size,
-                            &num_objects, &top_object, &offset_table_offset)) {
-    return false;
-  }
-
-  uint64_t top_offset =
-      bplist_get_offset(plist, offset_table_offset, offset_size, top_object);
-  if (top_offset >= plist_len) {
-    return false;
-  }
-
-  return bplist_find_string_in_dict(plist, plist_len, top_offset,
-                                    offset_table_offset, offset_size, ref_size,
-                                    key, out, out_capacity);
+  doc->count = count;
+  return true;
 }
 
-bool bplist_find_string_deep(const uint8_t *plist, size_t plist_len,
-                             const char *key, char *out,
-                             size_t out_capacity) {
-  if (!out || out_capacity == 0) {
-    return false;
-  }
-  out[0] = '\0';
-
-  if (plist_len < 40 || memcmp(plist, "bplist00", 8) != 0) {
-    return false;
-  }
-
-  uint8_t offset_size = 0;
-  uint8_t ref_size = 0;
-  uint64_t num_objects = 0;
-  uint64_t top_object = 0;
-  uint64_t offset_table_offset = 0;
-  if (!bplist_parse_trailer(plist, plist_len, &offset_size, &ref_size,
-                            &num_objects, &top_object, &offset_table_offset)) {
-    return false;
-  }
-
-  (void)num_objects;
-  return bplist_find_string_recursive(plist, plist_len, top_object,
-                                      offset_table_offset, offset_size,
-                                      ref_size, key, out, out_capacity, 0);
+static bool key_equals(const bplist_node_t *node, const char *key) {
+  size_t len = strlen(key);
+  return node->key && node->key_len == len && memcmp(node->key, key, len) == 0;
 }
 
-bool bplist_find_int(const uint8_t *plist, size_t plist_len, const char *key,
-                     int64_t *out_value) {
-  if (plist_len < 40 || memcmp(plist, "bplist00", 8) != 0) {
-    return false;
-  }
-
-  uint8_t offset_size = 0;
-  uint8_t ref_size = 0;
-  uint64_t num_objects = 0;
-  uint64_t top_object = 0;
-  uint64_t offset_table_offset = 0;
-  if (!bplist_parse_trailer(plist, plist_len, &offset_size, &ref_size,
-                            &num_objects, &top_object, &offset_table_offset)) {
-    return false;
+const bplist_node_t *bplist_get(const bplist_doc_t *doc,
+                                const bplist_node_t *dict, const char *key) {
+  if (!doc || doc->count == 0 || !key) {
+    return NULL;
   }
-
-  uint64_t top_offset =
-      bplist_get_offset(plist, offset_table_offset, offset_size, top_object);
-  if (top_offset >= plist_len) {
-    return false;
+  if (!dict) {
+    dict = &doc->nodes[0];
   }
-
-  uint8_t marker = plist[top_offset];
-  if ((marker & 0xF0) != BPLIST_DICT) {
-    return false;
+  if (dict->type != BPLIST_VALUE_DICT) {
+    return NULL;
   }
 
-  size_t dict_size = marker & 0x0F;
-  size_t pos = top_offset + 1;
-
-  if (dict_size == 0x0F) {
-    if (pos >= plist_len) {
-      return false;
-    }
-    uint8_t len_marker = plist[pos++];
-    size_t len_bytes = 1 << (len_marker & 0x0F);
-    if (pos + len_bytes > plist_len) {
-      return false;
+  for (uint32_t i = 0; i < dict->len; i++) {
+    const bplist_node_t *member = &doc->nodes[dict->first_child + i];
+    if (key_equals(member, key)) {
+      return member;
     }
-    dict_size = (size_t)read_be_int(plist + pos, len_bytes);
-    pos += len_bytes;
-  }
-
-  if (pos + dict_size * 2 * ref_size > plist_len) {
-    return false;
   }
-
-  const uint8_t *key_refs = plist + pos;
-  const uint8_t *val_refs = plist + pos + dict_size * ref_size;
-
-  for (size_t i = 0; i < dict_size; i++) {
-    uint64_t key_idx = read_be_int(key_refs + i * ref_size, ref_size);
-    uint64_t key_offset =
-        bplist_get_offset(plist, offset_table_offset, offset_size, key_idx);
-
-    char found_key[64];
-    if (bplist_read_string(plist, plist_len, key_offset, found_key,
-                           sizeof(found_key))) {
-      if (strcmp(found_key, key) == 0) {
-        uint64_t val_idx = read_be_int(val_refs + i * ref_size, ref_size);
-        uint64_t val_offset =
-            bplist_get_offset(plist, offset_table_offset, offset_size, val_idx);
-        return bplist_read_int(plist, plist_len, val_offset, out_value);
-      }
-    }
-  }
-
-  return false;
+  return NULL;
 }
 
-bool bplist_find_real(const uint8_t *plist, size_t plist_len, const char *key,
-                      double *out_value) {
-  if (plist_len < 40 || memcmp(plist, "bplist00", 8) != 0) {
-    return false;
-  }
-
-  uint8_t offset_size = 0;
-  uint8_t ref_size = 0;
-  uint64_t num_objects = 0;
-  uint64_t top_object = 0;
-  uint64_t offset_table_offset = 0;
-  if (!bplist_parse_trailer(plist, plist_len, &offset_size, &ref_size,
-                            &num_objects, &top_object, &offset_table_offset)) {
-    return false;
-  }
-
-  uint64_t top_offset =
-      bplist_get_offset(plist, offset_table_offset, offset_size, top_object);
-  if (top_offset >= plist_len) {
-    return false;
-  }
-
-  uint8_t marker = plist[top_offset];
-  if ((marker & 0xF0) != BPLIST_DICT) {
-    return false;
-  }
-
-  size_t dict_size = marker & 0x0F;
-  size_t pos = top_offset + 1;
-
-  if (dict_size == 0x0F) {
-    if (pos >= plist_len) {
-      return false;
-    }
-    uint8_t len_marker = plist[pos++];
-    size_t len_bytes = 1 << (len_marker & 0x0F);
-    if (pos + len_bytes > plist_len) {
-      return false;
-    }
-    dict_size = (size_t)read_be_int(plist + pos, len_bytes);
-    pos += len_bytes;
-  }
-
-  if (pos + dict_size * 2 * ref_size > plist_len) {
-    return false;
-  }
-
-  const uint8_t *key_refs = plist + pos;
-  const uint8_t *val_refs = plist + pos + dict_size * ref_size;
-
-  for (size_t i = 0; i < dict_size; i++) {
-    uint64_t key_idx = read_be_int(key_refs + i * ref_size, ref_size);
-    uint64_t key_offset =
-        bplist_get_offset(plist, offset_table_offset, offset_size, key_idx);
-
-    char found_key[64];
-    if (bplist_read_string(plist, plist_len, key_offset, found_key,
-                           sizeof(found_key))) {
-      if (strcmp(found_key, key) == 0) {
-        uint64_t val_idx = read_be_int(val_refs + i * ref_size, ref_size);
-        uint64_t val_offset =
-            bplist_get_offset(plist, offset_table_offset, offset_size, val_idx);
-        if (bplist_read_real(plist, plist_len, val_offset, out_value)) {
-          return true;
-        }
-        int64_t int_val = 0;
-        if (bplist_read_int(plist, plist_len, val_offset, &int_val)) {
-          *out_value = (double)int_val;
-          return true;
-        }
-        return false;
-      }
-    }
+const bplist_node_t *bplist_item(const bplist_doc_t *doc,
+                                 const bplist_node_t *array, size_t index) {
+  if (!doc || !array || array->type != BPLIST_VALUE_ARRAY ||
+      index >= array->len) {
+    return NULL;
   }
-
-  return false;
+  return &doc->nodes[array->first_child + index];
 }
 
-bool bplist_get_streams_count(const uint8_t *plist, size_t plist_len,
-                              size_t *count) {
-  if (!count) {
-    return false;
-  }
-
-  *count = 0;
-
-  if (plist_len < 40 || memcmp(plist, "bplist00", 8) != 0) {
-    return false;
-  }
-
-  uint8_t offset_size = 0;
-  uint8_t ref_size = 0;
-  uint64_t num_objects = 0;
-  uint64_t top_object = 0;
-  uint64_t offset_table_offset = 0;
-  if (!bplist_parse_trailer(plist, plist_len, &offset_size, &ref_size,
-                            &num_objects, &top_object, &offset_table_offset)) {
-    return false;
-  }
-
-  uint64_t top_offset =
-      bplist_get_offset(plist, offset_table_offset, offset_size, top_object);
-  if (top_offset >= plist_len) {
-    return false;
-  }
-
-  size_t streams_key_len = 0;
-  uint64_t streams_key_offset = 0;
-  for (uint64_t i = 0; i < num_objects; i++) {
-    uint64_t offset =
-        bplist_get_offset(plist, offset_table_offset, offset_size, i);
-    if (offset >= plist_len) {
-      continue;
-    }
-    char key[16];
-    if (bplist_read_string(plist, plist_len, offset, key, sizeof(key))) {
-      if (strcmp(key, "streams") == 0) {
-        streams_key_offset = offset;
-        if (!bplist_read_string_len(plist, plist_len, offset,
-                                    &streams_key_len)) {
-          return false;
-        }
-        break;
-      }
-    }
-  }
-
-  if (streams_key_len == 0) {
-    return false;
-  }
-
-  uint64_t top_dict_offset = top_offset;
-  uint8_t marker = plist[top_dict_offset];
-  if ((marker & 0xF0) != BPLIST_DICT) {
-    return false;
-  }
-
-  size_t dict_size = marker & 0x0F;
-  size_t pos = top_dict_offset + 1;
-  if (dict_size == 0x0F) {
-    if (pos >= plist_len) {
-      return false;
-    }
-    uint8_t len_marker = plist[pos++];
-    size_t len_bytes = 1 << (len_marker & 0x0F);
-    if (pos + len_bytes > plist_len) {
-      return false;
-    }
-    dict_size = (size_t)read_be_int(plist + pos, len_bytes);
-    pos += len_bytes;
-  }
-
-  if (pos + dict_size * 2 * ref_size > plist_len) {
-    return false;
+const bplist_node_t *bplist_find(const bplist_doc_t *doc, const char *key) {
+  if (!doc || !key) {
+    return NULL;
   }
-
-  const uint8_t *key_refs = plist + pos;
-  const uint8_t *val_refs = plist + pos + dict_size * ref_size;
-
-  for (size_t i = 0; i < dict_size; i++) {
-    uint64_t key_idx = read_be_int(key_refs + i * ref_size, ref_size);
-    uint64_t key_offset =
-        bplist_get_offset(plist, offset_table_offset, offset_size, key_idx);
-
-    if (key_offset == streams_key_offset) {
-      uint64_t val_idx = read_be_int(val_refs + i * ref_size, ref_size);
-      uint64_t val_offset =
-          bplist_get_offset(plist, offset_table_offset, offset_size, val_idx);
-
-      uint8_t val_marker = plist[val_offset];
-      if ((val_marker & 0xF0) != BPLIST_ARRAY) {
-        return false;
-      }
-
-      size_t array_count = 0;
-      size_t header_len = 0;
-      if (!bplist_parse_count(plist, plist_len, val_offset, &array_count,
-                              &header_len)) {
-        return false;
-      }
-
-      *count = array_count;
-      return true;
+  for (size_t i = 0; i < doc->count; i++) {
+    if (key_equals(&doc->nodes[i], key)) {
+      return &doc->nodes[i];
     }
   }
-
-  return false;
+  return NULL;
 }
 
-bool bplist_get_stream_info(const uint8_t *plist, size_t plist_len,
-                            size_t index, int64_t *type, size_t *ekey_len,
-                            size_t *eiv_len, size_t *shk_len) {
-  if (!type) {
-    return false;
-  }
-
-  *type = -1;
-  if (ekey_len) {
-    *ekey_len = 0;
-  }
-  if (eiv_len) {
-    *eiv_len = 0;
-  }
-  if (shk_len) {
-    *shk_len = 0;
-  }
-
-  if (plist_len < 40 || memcmp(plist, "bplist00", 8) != 0) {
-    return false;
-  }
-
-  uint8_t offset_size = 0;
-  uint8_t ref_size = 0;
-  uint64_t num_objects = 0;
-  uint64_t top_object = 0;
-  uint64_t offset_table_offset = 0;
-  if (!bplist_parse_trailer(plist, plist_len, &offset_size, &ref_size,
-                            &num_objects, &top_object, &offset_table_offset)) {
-    return false;
-  }
-
-  uint64_t top_offset =
-      bplist_get_offset(plist, offset_table_offset, offset_size, top_object);
-  if (top_offset >= plist_len) {
-    return false;
-  }
-
-  size_t streams_key_len = 0;
-  uint64_t streams_key_offset = 0;
-  for (uint64_t i = 0; i < num_objects; i++) {
-    uint64_t offset =
-        bplist_get_offset(plist, offset_table_offset, offset_size, i);
-    if (offset >= plist_len) {
-      continue;
-    }
-    char key[16];
-    if (bplist_read_string(plist, plist_len, offset, key, sizeof(key))) {
-      if (strcmp(key, "streams") == 0) {
-        streams_key_offset = offset;
-        if (!bplist_read_string_len(plist, plist_len, offset,
-                                    &streams_key_len)) {
-          return false;
-        }
-        break;
-      }
-    }
-  }
-
-  if (streams_key_len == 0) {
-    return false;
-  }
-
-  uint64_t top_dict_offset = top_offset;
-  uint8_t marker = plist[top_dict_offset];
-  if ((marker & 0xF0) != BPLIST_DICT) {
+bool bplist_node_int(const bplist_node_t *node, int64_t *out) {
+  if (!node || (node->type != BPLIST_VALUE_INT &&
+                node->type != BPLIST_VALUE_UID &&
+                node->type != BPLIST_VALUE_BOOL)) {
     return false;
   }
+  *out = node->int_value;
+  return true;
+}
 
-  size_t dict_size = marker & 0x0F;
-  size_t pos = top_dict_offset + 1;
-  if (dict_size == 0x0F) {
-    if (pos >= plist_len) {
-      return false;
-    }
-    uint8_t len_marker = plist[pos++];
-    size_t len_bytes = 1 << (len_marker & 0x0F);
-    if (pos + len_bytes > plist_len) {
-      return false;
-    }
-    dict_size = (size_t)read_be_int(plist + pos, len_bytes);
-    pos += len_bytes;
-  }
-
-  if (pos + dict_size * 2 * ref_size > plist_len) {
-    return false;
+bool bplist_node_real(const bplist_node_t *node, double *out) {
+  if (node && node->type == BPLIST_VALUE_REAL) {
+    *out = node->real_value;
+    return true;
   }
-
-  const uint8_t *key_refs = plist + pos;
-  const uint8_t *val_refs = plist + pos + dict_size * ref_size;
-
-  for (size_t i = 0; i < dict_size; i++) {
-    uint64_t key_idx = read_be_int(key_refs + i * ref_size, ref_size);
-    uint64_t key_offset =
-        bplist_get_offset(plist, offset_table_offset, offset_size, key_idx);
-
-    if (key_offset == streams_key_offset) {
-      uint64_t val_idx = read_be_int(val_refs + i * ref_size, ref_size);
-      uint64_t val_offset =
-          bplist_get_offset(plist, offset_table_offset, offset_size, val_idx);
-
-      uint8_t val_marker = plist[val_offset];
-      if ((val_marker & 0xF0) != BPLIST_ARRAY) {
-        return false;
-      }
-
-      size_t array_count = 0;
-      size_t header_len = 0;
-      if (!bplist_parse_count(plist, plist_len, val_offset, &array_count,
-                              &header_len)) {
-        return false;
-      }
-
-      if (index >= array_count) {
-        return false;
-      }
-
-      size_t array_pos = val_offset + header_len;
-      if (array_pos + array_count * ref_size > plist_len) {
-        return false;
-      }
-
-      uint64_t stream_idx =
-          read_be_int(plist + array_pos + index * ref_size, ref_size);
-      uint64_t stream_offset = bplist_get_offset(plist, offset_table_offset,
-                                                 offset_size, stream_idx);
-
-      uint8_t stream_marker = plist[stream_offset];
-      if ((stream_marker & 0xF0) != BPLIST_DICT) {
-        return false;
-      }
-
-      size_t stream_dict_size = 0;
-      size_t stream_header_len = 0;
-      if (!bplist_parse_count(plist, plist_len, stream_offset,
-                              &stream_dict_size, &stream_header_len)) {
-        return false;
-      }
-
-      size_t stream_pos = stream_offset + stream_header_len;
-      if (stream_pos + stream_dict_size * 2 * ref_size > plist_len) {
-        return false;
-      }
-
-      const uint8_t *stream_key_refs = plist + stream_pos;
-      const uint8_t *stream_val_refs =
-          plist + stream_pos + stream_dict_size * ref_size;
-
-      for (size_t j = 0; j < stream_dict_size; j++) {
-        uint64_t stream_key_idx =
-            read_be_int(stream_key_refs + j * ref_size, ref_size);
-        uint64_t stream_key_offset = bplist_get_offset(
-            plist, offset_table_offset, offset_size, stream_key_idx);
-
-        char stream_key[32];
-        if (!bplist_read_string(plist, plist_len, stream_key_offset, stream_key,
-                                sizeof(stream_key))) {
-          continue;
-        }
-
-        uint64_t stream_val_idx =
-            read_be_int(stream_val_refs + j * ref_size, ref_size);
-        uint64_t stream_val_offset = bplist_get_offset(
-            plist, offset_table_offset, offset_size, stream_val_idx);
-
-        if (strcmp(stream_key, "type") == 0) {
-          int64_t type_val = 0;
-          if (bplist_read_int(plist, plist_len, stream_val_offset, &type_val)) {
-            *type = type_val;
-          }
-        } else if (strcmp(stream_key, "ekey") == 0 && ekey_len) {
-          bplist_read_data_len(plist, plist_len, stream_val_offset, ekey_len);
-        } else if (strcmp(stream_key, "eiv") == 0 && eiv_len) {
-          bplist_read_data_len(plist, plist_len, stream_val_offset, eiv_len);
-        } else if (strcmp(stream_key, "shk") == 0 && shk_len) {
-          bplist_read_data_len(plist, plist_len, stream_val_offset, shk_len);
-        }
-      }
-
-      return (*type != -1);
-    }
+  if (node && node->type == BPLIST_VALUE_INT) {
+    *out = (double)node->int_value;
+    return true;
   }
-
   return false;
 }
 
-bool bplist_get_stream_kv_info(const uint8_t *plist, size_t plist_len,
-                               size_t index, bplist_kv_info_t *out,
-                               size_t out_capacity, size_t *out_count) {
-  if (!out || out_capacity == 0 || !out_count) {
-    return false;
-  }
-
-  *out_count = 0;
-
-  if (plist_len < 40 || memcmp(plist, "bplist00", 8) != 0) {
-    return false;
-  }
-
-  uint8_t offset_size = 0;
-  uint8_t ref_size = 0;
-  uint64_t num_objects = 0;
-  uint64_t top_object = 0;
-  uint64_t offset_table_offset = 0;
-  if (!bplist_parse_trailer(plist, plist_len, &offset_size, &ref_size,
-                            &num_objects, &top_object, &offset_table_offset)) {
-    return false;
-  }
-
-  uint64_t top_offset =
-      bplist_get_offset(plist, offset_table_offset, offset_size, top_object);
-  if (top_offset >= plist_len) {
-    return false;
-  }
-
-  size_t streams_key_len = 0;
-  uint64_t streams_key_offset = 0;
-  for (uint64_t i = 0; i < num_objects; i++) {
-    uint64_t offset =
-        bplist_get_offset(plist, offset_table_offset, offset_size, i);
-    if (offset >= plist_len) {
-      continue;
-    }
-    char key[16];
-    if (bplist_read_string(plist, plist_len, offset, key, sizeof(key))) {
-      if (strcmp(key, "streams") == 0) {
-        streams_key_offset = offset;
-        if (!bplist_read_string_len(plist, plist_len, offset,
-                                    &streams_key_len)) {
-          return false;
-        }
-        break;
-      }
-    }
-  }
-
-  if (streams_key_len == 0) {
-    return false;
-  }
-
-  uint64_t top_dict_offset = top_offset;
-  uint8_t marker = plist[top_dict_offset];
-  if ((marker & 0xF0) != BPLIST_DICT) {
-    return false;
-  }
-
-  size_t dict_size = marker & 0x0F;
-  size_t pos = top_dict_offset + 1;
-  if (dict_size == 0x0F) {
-    if (pos >= plist_len) {
-      return false;
-    }
-    uint8_t len_marker = plist[pos++];
-    size_t len_bytes = 1 << (len_marker & 0x0F);
-    if (pos + len_bytes > plist_len) {
-      return false;
-    }
-    dict_size = (size_t)read_be_int(plist + pos, len_bytes);
-    pos += len_bytes;
-  }
-
-  if (pos + dict_size * 2 * ref_size > plist_len) {
+bool bplist_node_string(const bplist_node_t *node, char *out,
+                        size_t out_capacity) {
+  if (!node || node->type != BPLIST_VALUE_STRING || !out ||
+      node->len >= out_capacity) {
     return false;
   }
 
-  const uint8_t *key_refs = plist + pos;
-  const uint8_t *val_refs = plist + pos + dict_size * ref_size;
-
-  for (size_t i = 0; i < dict_size; i++) {
-    uint64_t key_idx = read_be_int(key_refs + i * ref_size, ref_size);
-    uint64_t key_offset =
-        bplist_get_offset(plist, offset_table_offset, offset_size, key_idx);
-
-    if (key_offset == streams_key_offset) {
-      uint64_t val_idx = read_be_int(val_refs + i * ref_size, ref_size);
-      uint64_t val_offset =
-          bplist_get_offset(plist, offset_table_offset, offset_size, val_idx);
-
-      uint8_t val_marker = plist[val_offset];
-      if ((val_marker & 0xF0) != BPLIST_ARRAY) {
-        return false;
-      }
-
-      size_t array_count = 0;
-      size_t header_len = 0;
-      if (!bplist_parse_count(plist, plist_len, val_offset, &array_count,
-                              &header_len)) {
-        return false;
-      }
-
-      if (index >= array_count) {
-        return false;
-      }
-
-      size_t array_pos = val_offset + header_len;
-      if (array_pos + array_count * ref_size > plist_len) {
-        return false;
-      }
-
-      uint64_t stream_idx =
-          read_be_int(plist + array_pos + index * ref_size, ref_size);
-      uint64_t stream_offset = bplist_get_offset(plist, offset_table_offset,
-                                                 offset_size, stream_idx);
-
-      uint8_t stream_marker = plist[stream_offset];
-      if ((stream_marker & 0xF0) != BPLIST_DICT) {
-        return false;
-      }
-
-      size_t stream_dict_size = 0;
-      size_t stream_header_len = 0;
-      if (!bplist_parse_count(plist, plist_len, stream_offset,
-                              &stream_dict_size, &stream_header_len)) {
-        return false;
-      }
-
-      size_t stream_pos = stream_offset + stream_header_len;
-      if (stream_pos + stream_dict_size * 2 * ref_size > plist_len) {
-        return false;
-      }
-
-      const uint8_t *stream_key_refs = plist + stream_pos;
-      const uint8_t *stream_val_refs =
-          plist + stream_pos + stream_dict_size * ref_size;
-
-      for (size_t j = 0; j < stream_dict_size && *out_count < out_capacity;
-           j++) {
-        uint64_t stream_key_idx =
-            read_be_int(stream_key_refs + j * ref_size, ref_size);
-        uint64_t stream_key_offset = bplist_get_offset(
-            plist, offset_table_offset, offset_size, stream_key_idx);
-
-        char stream_key[64];
-        if (!bplist_read_string(plist, plist_len, stream_key_offset, stream_key,
-                                sizeof(stream_key))) {
-          continue;
-        }
-
-        uint64_t stream_val_idx =
-            read_be_int(stream_val_refs + j * ref_size, ref_size);
-        uint64_t stream_val_offset = bplist_get_offset(
-            plist, offset_table_offset, offset_size, stream_val_idx);
-
-        bplist_kv_info_t *info = &out[*out_count];
-        memset(info, 0, sizeof(*info));
-        strncpy(info->key, stream_key, sizeof(info->key) - 1);
-
-        uint8_t stream_val_marker = plist[stream_val_offset];
-        uint8_t stream_val_type = stream_val_marker & 0xF0;
-
-        if (stream_val_type == BPLIST_INT) {
-          info->value_type = BPLIST_VALUE_INT;
-          int64_t int_val = 0;
-          if (bplist_read_int(plist, plist_len, stream_val_offset, &int_val)) {
-            info->int_value = int_val;
-          }
-        } else if (stream_val_type == BPLIST_DATA) {
-          info->value_type = BPLIST_VALUE_DATA;
-          size_t len = 0;
-          if (bplist_read_data_len(plist, plist_len, stream_val_offset, &len)) {
-            info->value_len = len;
-          }
-        } else if (stream_val_type == BPLIST_STRING ||
-                   stream_val_type == BPLIST_UNICODE) {
-          info->value_type = BPLIST_VALUE_STRING;
-          size_t len = 0;
-          if (bplist_read_string_len(plist, plist_len, stream_val_offset,
-                                     &len)) {
-            info->value_len = len;
-          }
-        } else if (stream_val_type == BPLIST_UID) {
-          info->value_type = BPLIST_VALUE_UID;
-        } else if (stream_val_type == BPLIST_ARRAY) {
-          info->value_type = BPLIST_VALUE_ARRAY;
-        } else if (stream_val_type == BPLIST_DICT) {
-          info->value_type = BPLIST_VALUE_DICT;
-        }
-
-        (*out_count)++;
-      }
-
-      return (*out_count > 0);
+  if (!node->utf16) {
+    memcpy(out, node->bytes, node->len);
+  } else {
+    for (uint32_t i = 0; i < node->len; i++) {
+      uint16_t code =
+          (uint16_t)(node->bytes[i * 2] << 8) | node->bytes[i * 2 + 1];
+      out[i] = (code <= 0x7F) ? (char)code : '?';
     }
   }
-
-  return false;
+  out[node->len] = '\0';
+  return true;
 }
 
-bool bplist_find_stream_crypto(const uint8_t *plist, size_t plist_len,
-                               int64_t stream_type, uint8_t *ekey,
-                               size_t ekey_capacity, size_t *ekey_len,
-                               uint8_t *eiv, size_t eiv_capacity,
-                               size_t *eiv_len, uint8_t *shk,
-                               size_t shk_capacity, size_t *shk_len) {
-  bool found = false;
-
-  if (ekey_len) {
-    *ekey_len = 0;
-  }
-  if (eiv_len) {
-    *eiv_len = 0;
-  }
-  if (shk_len) {
-    *shk_len = 0;
-  }
-
-  size_t stream_count = 0;
-  if (!bplist_get_streams_count(plist, plist_len, &stream_count)) {
+bool bplist_node_data(const bplist_node_t *node, const uint8_t **data,
+                      size_t *len) {
+  if (!node || node->type != BPLIST_VALUE_DATA) {
     return false;
   }
-
-  for (size_t i = 0; i < stream_count; i++) {
-    int64_t type = -1;
-    size_t local_ekey_len = 0;
-    size_t local_eiv_len = 0;
-    size_t local_shk_len = 0;
-
-    if (!bplist_get_stream_info(plist, plist_len, i, &type, &local_ekey_len,
-                                &local_eiv_len, &local_shk_len)) {
-      continue;
-    }
-
-    if (type != stream_type) {
-      continue;
-    }
-
-    uint8_t temp_buf[512];
-    size_t temp_len = 0;
-
-    if (ekey && local_ekey_len > 0 && ekey_len) {
-      if (bplist_find_data(plist, plist_len, "ekey", temp_buf, sizeof(temp_buf),
-                           &temp_len)) {
-        size_t copy_len = temp_len < ekey_capacity ? temp_len : ekey_capacity;
-        memcpy(ekey, temp_buf, copy_len);
-        *ekey_len = copy_len;
-        found = true;
-      }
-    }
-
-    if (eiv && local_eiv_len > 0 && eiv_len) {
-      if (bplist_find_data(plist, plist_len, "eiv", temp_buf, sizeof(temp_buf),
-                           &temp_len)) {
-        size_t copy_len = temp_len < eiv_capacity ? temp_len : eiv_capacity;
-        memcpy(eiv, temp_buf, copy_len);
-        *eiv_len = copy_len;
-        found = true;
-      }
-    }
-
-    if (shk && local_shk_len > 0 && shk_len) {
-      if (bplist_find_data(plist, plist_len, "shk", temp_buf, sizeof(temp_buf),
-                           &temp_len)) {
-        size_t copy_len = temp_len < shk_capacity ? temp_len : shk_capacity;
-        memcpy(shk, temp_buf, copy_len);
-        *shk_len = copy_len;
-        found = true;
-      }
-    }
-
-    break;
-  }
-
-  return found;
+  *data = node->bytes;
+  *len = node->len;
+  return true;
 }
@@ -99,159 +99,99 @@ size_t plist_end(plist_t *p);
 // Binary plist parser (for AirPlay 2 SETUP)
 // ========================================
 
-/**
- * Find a data value by key in a binary plist
- * @param plist Binary plist data
- * @param plist_len Length of plist
- * @param key Key to search for (e.g., "ekey", "eiv")
- * @param out_data Output buffer for data value
- * @param out_capacity Capacity of output buffer
- * @param out_len Actual length of data found
- * @return true if found, false otherwise
- */
-bool bplist_find_data(const uint8_t *plist, size_t plist_len, const char *key,
-                      uint8_t *out_data, size_t out_capacity, size_t *out_len);
+#define BPLIST_VALUE_UNKNOWN 0
+#define BPLIST_VALUE_INT     1
+#define BPLIST_VALUE_DATA    2
+#define BPLIST_VALUE_STRING  3
+#define BPLIST_VALUE_UID     4
+#define BPLIST_VALUE_ARRAY   5 // Arrays and sets
+#define BPLIST_VALUE_DICT    6
+#define BPLIST_VALUE_REAL    7
+#define BPLIST_VALUE_BOOL    8
 
 /**
- * Find a data value by key anywhere in a binary plist
- * @param plist Binary plist data
- * @param plist_len Length of plist
- * @param key Key to search for (e.g., "ekey", "eiv")
- * @param out_data Output buffer for data value
- * @param out_capacity Capacity of output buffer
- * @param out_len Actual length of data found
- * @return true if found, false otherwise
+ * One decoded object. Strings and data point into the plist, which must
+ * outlive the document. Children of a container are stored contiguously
+ * from first_child; dict members carry their key.
  */
-bool bplist_find_data_deep(const uint8_t *plist, size_t plist_len,
-                           const char *key, uint8_t *out_data,
-                           size_t out_capacity, size_t *out_len);
+typedef struct {
+  const uint8_t *key; // Dict member key (not terminated), or NULL
+  uint16_t key_len;
+  uint8_t type; // See BPLIST_VALUE_*
+  bool utf16;   // STRING holds UTF-16BE code units
+  uint32_t len; // Bytes, code units or number of children
+  union {
+    int64_t int_value; // INT, UID, BOOL
+    double real_value;
+    const uint8_t *bytes; // DATA, STRING
+    uint32_t first_child; // ARRAY, DICT
+  };
+} bplist_node_t;
+
+typedef struct {
+  bplist_node_t *nodes; // nodes[0] is the top object
+  size_t count;
+} bplist_doc_t;
 
 /**
- * Find a string value by key in a binary plist
- * Supports both ASCII and UTF-8 string objects. For UTF-16 (UNICODE) strings,
- * only ASCII code points are supported by the parser.
+ * Decode a binary plist into a caller-provided node arena in one pass, so
+ * any number of lookups can follow without re-walking the offset table.
+ * @param doc Output document
  * @param plist Binary plist data
  * @param plist_len Length of plist
- * @param key Key to search for
- * @param out Output buffer for string (NULL-terminated)
- * @param out_capacity Capacity of output buffer
- * @return true if found, false otherwise
+ * @param nodes Node arena
+ * @param capacity Nodes in the arena
+ * @return false if the plist is malformed or has more objects than fit
  */
-bool bplist_find_string(const uint8_t *plist, size_t plist_len, const char *key,
-                        char *out, size_t out_capacity);
+bool bplist_parse(bplist_doc_t *doc, const uint8_t *plist, size_t plist_len,
+                  bplist_node_t *nodes, size_t capacity);
 
 /**
- * Find a string value by key anywhere in a binary plist
- * @param plist Binary plist data
- * @param plist_len Length of plist
- * @param key Key to search for
- * @param out Output buffer for string (NULL-terminated)
- * @param out_capacity Capacity of output buffer
- * @return true if found, false otherwise
+ * Member of a dict by key
+ * @param dict Dict node, or NULL for the top object
+ * @return Member node, or NULL if absent or dict is not a dict
  */
-bool bplist_find_string_deep(const uint8_t *plist, size_t plist_len,
-                             const char *key, char *out, size_t out_capacity);
+const bplist_node_t *bplist_get(const bplist_doc_t *doc,
+                                const bplist_node_t *dict, const char *key);
 
 /**
- * Get number of stream entries in a binary plist "streams" array
- * @param plist Binary plist data
- * @param plist_len Length of plist
- * @param count Output stream count
- * @return true if streams array found and count read
+ * Element of an array by index
+ * @return Element node, or NULL if out of range or not an array
  */
-bool bplist_get_streams_count(const uint8_t *plist, size_t plist_len,
-                              size_t *count);
+const bplist_node_t *bplist_item(const bplist_doc_t *doc,
+                                 const bplist_node_t *array, size_t index);
 
 /**
- * Get stream details by index from a binary plist "streams" array
- * @param plist Binary plist data
- * @param plist_len Length of plist
- * @param index Stream index
- * @param type Stream type (e.g., 96)
- * @param ekey_len Length of ekey data if present
- * @param eiv_len Length of eiv data if present
- * @param shk_len Length of shk data if present
- * @return true if stream entry parsed
+ * First dict member with this key at any depth, shallowest first
  */
-bool bplist_get_stream_info(const uint8_t *plist, size_t plist_len,
-                            size_t index, int64_t *type, size_t *ekey_len,
-                            size_t *eiv_len, size_t *shk_len);
-
-// Stream key debug info
-typedef struct {
-  char key[64];
-  uint8_t value_type; // See BPLIST_VALUE_*
-  size_t value_len;
-  int64_t int_value;
-} bplist_kv_info_t;
-
-#define BPLIST_VALUE_UNKNOWN 0
-#define BPLIST_VALUE_INT     1
-#define BPLIST_VALUE_DATA    2
-#define BPLIST_VALUE_STRING  3
-#define BPLIST_VALUE_UID     4
-#define BPLIST_VALUE_ARRAY   5
-#define BPLIST_VALUE_DICT    6
+const bplist_node_t *bplist_find(const bplist_doc_t *doc, const char *key);
 
 /**
- * Get key/value info for a stream dict (debug helper)
- * @param plist Binary plist data
- * @param plist_len Length of plist
- * @param index Stream index
- * @param out Output array for key/value info
- * @param out_capacity Capacity of output array
- * @param out_count Number of items written
- * @return true if stream entry parsed
+ * Read an integer (INT, UID or BOOL) node
+ * @return false if node is NULL or of another type
  */
-bool bplist_get_stream_kv_info(const uint8_t *plist, size_t plist_len,
-                               size_t index, bplist_kv_info_t *out,
-                               size_t out_capacity, size_t *out_count);
+bool bplist_node_int(const bplist_node_t *node, int64_t *out);
 
 /**
- * Find stream-specific crypto fields in a binary plist
- * @param plist Binary plist data
- * @param plist_len Length of plist
- * @param stream_type Stream "type" to match (e.g., 96 for audio)
- * @param ekey Output buffer for encrypted key (optional)
- * @param ekey_capacity Capacity of ekey buffer
- * @param ekey_len Length of ekey found
- * @param eiv Output buffer for IV (optional)
- * @param eiv_capacity Capacity of eiv buffer
- * @param eiv_len Length of eiv found
- * @param shk Output buffer for shared key (optional)
- * @param shk_capacity Capacity of shk buffer
- * @param shk_len Length of shk found
- * @return true if any crypto field was found for the stream, false otherwise
+ * Read a REAL node, converting INT nodes to double
+ * @return false if node is NULL or of another type
  */
-bool bplist_find_stream_crypto(const uint8_t *plist, size_t plist_len,
-                               int64_t stream_type, uint8_t *ekey,
-                               size_t ekey_capacity, size_t *ekey_len,
-                               uint8_t *eiv, size_t eiv_capacity,
-                               size_t *eiv_len, uint8_t *shk,
-                               size_t shk_capacity, size_t *shk_len);
+bool bplist_node_real(const bplist_node_t *node, double *out);
 
 /**
- * Find an integer value by key in a binary plist
- * @param plist Binary plist data
- * @param plist_len Length of plist
- * @param key Key to search for
- * @param out_value Output for integer value
- * @return true if found, false otherwise
+ * Copy a STRING node as a NUL-terminated string. UTF-16 strings keep ASCII
+ * code points and replace the rest with '?'.
+ * @return false if node is NULL, not a string or does not fit
  */
-bool bplist_find_int(const uint8_t *plist, size_t plist_len, const char *key,
-                     int64_t *out_value);
+bool bplist_node_string(const bplist_node_t *node, char *out,
+                        size_t out_capacity);
 
 /**
- * Find a real/float value by key in a binary plist
- * Handles both real and integer values (converting int to double)
- * @param plist Binary plist data
- * @param plist_len Length of plist
- * @param key Key to search for
- * @param out_value Output for double value
- * @return true if found, false otherwise
+ * View of a DATA node's bytes (inside the plist, not copied)
+ * @return false if node is NULL or not data
  */
-bool bplist_find_real(const uint8_t *plist, size_t plist_len, const char *key,
-                      double *out_value);
+bool bplist_node_data(const bplist_node_t *node, const uint8_t **data,
+                      size_t *len);
 
 // ========================================
 // Binary plist builders (for AirPlay SETUP responses)
@@ -0,0 +1,249 @@
+#include "power_mgmt.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+
+#include "audio_output.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "rtsp_events.h"
+
+#define WINDOW_US       500000 // Load is judged over this
+#define QUIET_WINDOWS   4      // Below the low mark this long before slowing
+#define FRAME_US        7982   // 352 samples at 44.1 kHz, the tightest deadline
+#define MAX_CALL_CYCLES (CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 100000u) // 100 ms
+#define HIGH_PERMILLE   (CONFIG_POWER_DFS_HIGH_PERCENT * 10)
+#define LOW_PERMILLE    (HIGH_PERMILLE * 2 / 3) // Hysteresis
+
+static const char *TAG = "power";
+
+static esp_pm_lock_handle_t s_audio_lock;
+static esp_pm_lock_handle_t s_pairing_lock;
+static esp_timer_handle_t s_timer;
+static SemaphoreHandle_t s_mutex; // Policy state: timer and RTSP events
+
+// Fed by the audio tasks of both cores, summed against one core's clock
+static _Atomic uint32_t s_busy_cycles;
+static _Atomic uint32_t s_peak_cycles;
+static _Atomic uint64_t s_pairing_us;
+
+static bool s_session;
+static bool s_paused; // Pausing ends the audio with a gap of its own
+static bool s_boosted;
+static bool s_pinned;
+static int s_quiet;
+static uint32_t s_last_gaps;
+static int64_t s_last_us;
+static int64_t s_session_start_us;
+static uint64_t s_session_boost_us;
+static uint64_t s_boost_us;
+static uint16_t s_load_permille;
+static uint16_t s_peak_permille;
+
+static void set_boost(bool boost) {
+  if (boost == s_boosted) {
+    return;
+  }
+  esp_err_t err = boost ? esp_pm_lock_acquire(s_audio_lock)
+                        : esp_pm_lock_release(s_audio_lock);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Lock %s failed: %s", boost ? "acquire" : "release",
+             esp_err_to_name(err));
+    return;
+  }
+  s_boosted = boost;
+  ESP_LOGI(TAG, "Pipeline at %s clock (load %u.%u%%, peak %u.%u%% at %d MHz)",
+           boost ? "full" : "low", s_load_permille / 10, s_load_permille % 10,
+           s_peak_permille / 10, s_peak_permille % 10,
+           CONFIG_POWER_DFS_MIN_MHZ);
+}
+
+// Called with s_mutex held
+static void account(int64_t now) {
+  uint64_t elapsed = (uint64_t)(now - s_last_us);
+  s_last_us = now;
+  if (s_boosted) {
+    s_boost_us += elapsed;
+    s_session_boost_us += elapsed;
+  }
+}
+
+static void evaluate(void *arg) {
+  (void)arg;
+  xSemaphoreTake(s_mutex, portMAX_DELAY);
+  int64_t now = esp_timer_get_time();
+  uint64_t window = (uint64_t)(now - s_last_us);
+  account(now);
+
+  uint64_t busy = atomic_exchange(&s_busy_cycles, 0);
+  uint64_t peak = atomic_exchange(&s_peak_cycles, 0);
+  uint64_t budget = (uint64_t)CONFIG_POWER_DFS_MIN_MHZ * (window ? window : 1);
+  uint64_t load = busy * 1000 / budget;
+  uint64_t peak_load =
+      peak * 1000 / ((uint64_t)CONFIG_POWER_DFS_MIN_MHZ * FRAME_US);
+  s_load_permille = (uint16_t)(load > UINT16_MAX ? UINT16_MAX : load);
+  s_peak_permille = (uint16_t)(peak_load > UINT16_MAX ? UINT16_MAX : peak_load);
+
+  audio_output_stats_t output;
+  audio_output_get_stats(&output);
+  bool gap = output.gaps != s_last_gaps;
+  s_last_gaps = output.gaps;
+
+  bool boost = s_boosted;
+  if (!s_session) {
+    boost = false;
+  } else if (gap && !s_boosted && !s_paused && !s_pinned) {
+    ESP_LOGW(TAG, "Playout gap at low clock, staying at full speed");
+    s_pinned = true;
+  }
+  if (s_pinned) {
+    boost = true;
+  } else if (s_session) {
+    if (load > HIGH_PERMILLE || peak_load > HIGH_PERMILLE) {
+      boost = true;
+      s_quiet = 0;
+    } else if (load < LOW_PERMILLE && peak_load < LOW_PERMILLE) {
+      if (++s_quiet >= QUIET_WINDOWS) {
+        boost = false;
+      }
+    } else {
+      s_quiet = 0;
+    }
+  }
+  set_boost(boost);
+  xSemaphoreGive(s_mutex);
+}
+
+static void on_rtsp_event(rtsp_event_t event, const rtsp_event_data_t *data,
+                          void *user_data) {
+  (void)data;
+  (void)user_data;
+  if (event != RTSP_EVENT_PLAYING && event != RTSP_EVENT_PAUSED &&
+      event != RTSP_EVENT_DISCONNECTED) {
+    return;
+  }
+
+  xSemaphoreTake(s_mutex, portMAX_DELAY);
+  int64_t now = esp_timer_get_time();
+  account(now);
+  s_paused = event == RTSP_EVENT_PAUSED;
+  if (event == RTSP_EVENT_PAUSED) {
+    // Nothing to do; the quiet windows bring the clock down
+  } else if (event == RTSP_EVENT_PLAYING) {
+    // Start and resume at full speed; the windows that follow decide
+    if (!s_session) {
+      s_session = true;
+      s_session_start_us = now;
+      s_session_boost_us = 0;
+    }
+    s_quiet = 0;
+    set_boost(true);
+  } else if (s_session) {
+    uint64_t length = (uint64_t)(now - s_session_start_us);
+    ESP_LOGI(TAG, "Session of %" PRIu64 " s: %" PRIu64 "%% at full clock",
+             length / 1000000,
+             length ? s_session_boost_us * 100 / length : 0);
+    s_session = false;
+    s_pinned = false;
+    s_quiet = 0;
+    set_boost(false);
+  }
+  xSemaphoreGive(s_mutex);
+}
+
+esp_err_t power_mgmt_init(void) {
+  esp_pm_config_t config = {
+      .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+      .min_freq_mhz = CONFIG_POWER_DFS_MIN_MHZ,
+      .light_sleep_enable = false, // Would add wake-up latency to every RTP
+  };
+  esp_err_t err = esp_pm_configure(&config);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "DFS unavailable: %s", esp_err_to_name(err));
+    return err;
+  }
+
+  s_mutex = xSemaphoreCreateMutex();
+  if (!s_mutex) {
+    return ESP_ERR_NO_MEM;
+  }
+  err = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "audio", &s_audio_lock);
+  if (err == ESP_OK) {
+    err = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "pairing",
+                             &s_pairing_lock);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to create PM locks: %s", esp_err_to_name(err));
+    return err;
+  }
+
+  s_last_us = esp_timer_get_time();
+  const esp_timer_create_args_t args = {.callback = evaluate,
+                                        .name = "power_dfs"};
+  err = esp_timer_create(&args, &s_timer);
+  if (err == ESP_OK) {
+    err = esp_timer_start_periodic(s_timer, WINDOW_US);
+  }
+  if (err != ESP_OK) {
+    return err;
+  }
+  if (rtsp_events_register(on_rtsp_event, NULL) != 0) {
+    ESP_LOGW(TAG, "No RTSP listener slot, streams run at low clock");
+  }
+
+  ESP_LOGI(TAG, "DFS %d-%d MHz, full speed above %d%% load at %d MHz",
+           CONFIG_POWER_DFS_MIN_MHZ, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+           CONFIG_POWER_DFS_HIGH_PERCENT, CONFIG_POWER_DFS_MIN_MHZ);
+  return ESP_OK;
+}
+
+void power_mgmt_busy_stop(uint32_t start) {
+  uint32_t cycles = esp_cpu_get_cycle_count() - start;
+  if (cycles > MAX_CALL_CYCLES) {
+    return; // Preempted for long or moved cores between the reads
+  }
+  atomic_fetch_add(&s_busy_cycles, cycles);
+  // Racy max, good enough for a statistic
+  if (cycles > atomic_load(&s_peak_cycles)) {
+    atomic_store(&s_peak_cycles, cycles);
+  }
+}
+
+int64_t power_mgmt_pairing_begin(void) {
+  if (!s_pairing_lock || esp_pm_lock_acquire(s_pairing_lock) != ESP_OK) {
+    return 0;
+  }
+  return esp_timer_get_time();
+}
+
+void power_mgmt_pairing_end(int64_t token) {
+  if (token == 0) {
+    return;
+  }
+  atomic_fetch_add(&s_pairing_us, (uint64_t)(esp_timer_get_time() - token));
+  esp_pm_lock_release(s_pairing_lock);
+}
+
+void power_mgmt_get_stats(power_stats_t *stats) {
+  if (!stats) {
+    return;
+  }
+  *stats = (power_stats_t){.min_mhz = CONFIG_POWER_DFS_MIN_MHZ,
+                           .max_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+                           .pairing_us = atomic_load(&s_pairing_us),
+                           .uptime_us = (uint64_t)esp_timer_get_time()};
+  if (!s_mutex) {
+    return;
+  }
+  xSemaphoreTake(s_mutex, portMAX_DELAY);
+  account(esp_timer_get_time());
+  stats->boosted = s_boosted;
+  stats->pinned = s_pinned;
+  stats->load_permille = s_load_permille;
+  stats->peak_permille = s_peak_permille;
+  stats->boost_us = s_boost_us;
+  xSemaphoreGive(s_mutex);
+}
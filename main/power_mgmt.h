@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+#if CONFIG_POWER_DFS
+#include "esp_cpu.h"
+#endif
+
+/**
+ * CPU clock scaled with the audio pipeline's load (CONFIG_POWER_DFS).
+ *
+ * Dynamic frequency scaling runs the CPU at CONFIG_POWER_DFS_MIN_MHZ unless
+ * something holds a full-speed lock. Pairing holds one for its SRP and
+ * curve maths. A stream holds one from PLAYING until the measurements say
+ * it can do without: the decode and output tasks time each frame with the
+ * cycle counter, and twice a second the cycles are compared with what the
+ * lowest clock would offer. Cycle counts barely depend on the frequency,
+ * so the projection holds while running fast. A playout gap while slow
+ * keeps full speed for the rest of the session.
+ *
+ * Without CONFIG_POWER_DFS the hooks compile to nothing.
+ */
+
+typedef struct {
+  bool boosted;            // The pipeline holds full speed now
+  bool pinned;             // Held for the session after a gap at low clock
+  uint32_t min_mhz;
+  uint32_t max_mhz;
+  uint16_t load_permille;  // Last window's pipeline cycles vs min_mhz
+  uint16_t peak_permille;  // Costliest frame of the window vs one 352-sample
+                           // frame period at min_mhz
+  uint64_t boost_us;       // Pipeline lock held, since boot
+  uint64_t pairing_us;     // Pairing lock held, since boot
+  uint64_t uptime_us;
+} power_stats_t;
+
+#if CONFIG_POWER_DFS
+
+/**
+ * Configure DFS and start judging the load. Until then, and if it fails,
+ * the CPU stays at its default clock.
+ */
+esp_err_t power_mgmt_init(void);
+
+/** Start timing a frame's work (decrypt, decode, DSP). */
+static inline uint32_t power_mgmt_busy_start(void) {
+  return esp_cpu_get_cycle_count();
+}
+
+/** Account the work since power_mgmt_busy_start(); any task. */
+void power_mgmt_busy_stop(uint32_t start);
+
+/** Hold full speed for a pairing step. @return Token for the end call */
+int64_t power_mgmt_pairing_begin(void);
+void power_mgmt_pairing_end(int64_t token);
+
+void power_mgmt_get_stats(power_stats_t *stats);
+
+#else
+
+static inline esp_err_t power_mgmt_init(void) {
+  return ESP_OK;
+}
+static inline uint32_t power_mgmt_busy_start(void) {
+  return 0;
+}
+static inline void power_mgmt_busy_stop(uint32_t start) {
+  (void)start;
+}
+static inline int64_t power_mgmt_pairing_begin(void) {
+  return 0;
+}
+static inline void power_mgmt_pairing_end(int64_t token) {
+  (void)token;
+}
+
+#endif
@@ -0,0 +1,172 @@
+#include "rt_log.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "rt_log";
+
+#define RING_DEPTH      CONFIG_RT_LOG_DEPTH
+#define TEXT_MAX        112 // Longer lines are cut
+#define DRAIN_PERIOD_MS 50
+#define DRAIN_STACK     3072
+#define DRAIN_PRIORITY  (tskIDLE_PRIORITY + 1)
+
+_Static_assert((RING_DEPTH & (RING_DEPTH - 1)) == 0,
+               "CONFIG_RT_LOG_DEPTH must be a power of two");
+
+typedef struct {
+  // pos while free for the producer at pos, pos + 1 once written
+  _Atomic uint32_t seq;
+  esp_log_level_t level;
+  const char *tag;
+  uint32_t stamp_ms;
+  uint32_t suppressed;
+  char text[TEXT_MAX];
+} rt_log_entry_t;
+
+// Bounded MPMC queue (Vyukov) used with a single consumer, the drain task
+static rt_log_entry_t ring[RING_DEPTH];
+static _Atomic uint32_t enqueue_pos;
+static uint32_t dequeue_pos;
+static _Atomic uint32_t dropped;
+static _Atomic bool ready;
+
+static uint32_t now_ms(void) {
+  return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void emit(const rt_log_entry_t *e) {
+  static const char letters[] = "NEWIDV";
+  char letter = e->level < sizeof(letters) - 1 ? letters[e->level] : '?';
+  if (e->suppressed) {
+    esp_log_write(e->level, e->tag,
+                  "%c (%" PRIu32 ") %s: %s (+%" PRIu32 " suppressed)\n",
+                  letter, e->stamp_ms, e->tag, e->text, e->suppressed);
+  } else {
+    esp_log_write(e->level, e->tag, "%c (%" PRIu32 ") %s: %s\n", letter,
+                  e->stamp_ms, e->tag, e->text);
+  }
+}
+
+/* ---------- producers (any task) ---------- */
+
+// Lock-free: a producer only loses the race to another producer, which has
+// then made progress
+static rt_log_entry_t *ring_claim(uint32_t *pos_out) {
+  uint32_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+  for (;;) {
+    rt_log_entry_t *e = &ring[pos & (RING_DEPTH - 1)];
+    uint32_t seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+    int32_t lag = (int32_t)(seq - pos);
+    if (lag == 0) {
+      if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        *pos_out = pos;
+        return e;
+      }
+    } else if (lag < 0) {
+      return NULL; // Full: the drain task has not reached this entry yet
+    } else {
+      pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    }
+  }
+}
+
+// One caller per interval gets the site; the others only count
+static bool site_pass(rt_log_site_t *site, uint32_t now) {
+  uint32_t next = atomic_load_explicit(&site->next_ms, memory_order_relaxed);
+  if (next != 0 && (int32_t)(now - next) < 0) {
+    return false;
+  }
+  uint32_t after = (now + CONFIG_RT_LOG_INTERVAL_MS) | 1; // Never 0
+  return CONFIG_RT_LOG_INTERVAL_MS == 0 ||
+         atomic_compare_exchange_strong(&site->next_ms, &next, after);
+}
+
+void rt_log_write(rt_log_site_t *site, esp_log_level_t level, const char *tag,
+                  const char *format, ...) {
+  uint32_t now = now_ms();
+  if (!site_pass(site, now)) {
+    atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+    return;
+  }
+
+  static rt_log_entry_t early; // Only used while there is one task
+  uint32_t pos = 0;
+  bool queued = atomic_load_explicit(&ready, memory_order_acquire);
+  rt_log_entry_t *e = queued ? ring_claim(&pos) : &early;
+  if (!e) {
+    atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+    return;
+  }
+
+  e->level = level;
+  e->tag = tag;
+  e->stamp_ms = now;
+  e->suppressed =
+      atomic_exchange_explicit(&site->suppressed, 0, memory_order_relaxed);
+  va_list args;
+  va_start(args, format);
+  vsnprintf(e->text, sizeof(e->text), format, args);
+  va_end(args);
+
+  if (queued) {
+    atomic_store_explicit(&e->seq, pos + 1, memory_order_release);
+  } else {
+    emit(e); // Before rt_log_init(): nothing real-time runs yet
+  }
+}
+
+/* ---------- drain task ---------- */
+
+static void drain(void) {
+  for (;;) {
+    rt_log_entry_t *e = &ring[dequeue_pos & (RING_DEPTH - 1)];
+    if (atomic_load_explicit(&e->seq, memory_order_acquire) !=
+        dequeue_pos + 1) {
+      break;
+    }
+    emit(e);
+    atomic_store_explicit(&e->seq, dequeue_pos + RING_DEPTH,
+                          memory_order_release);
+    dequeue_pos++;
+  }
+
+  uint32_t lost = atomic_exchange(&dropped, 0);
+  if (lost) {
+    ESP_LOGW(TAG, "%" PRIu32 " lines dropped, ring full", lost);
+  }
+}
+
+static void drain_task(void *arg) {
+  (void)arg;
+  for (;;) {
+    drain();
+    vTaskDelay(pdMS_TO_TICKS(DRAIN_PERIOD_MS));
+  }
+}
+
+esp_err_t rt_log_init(void) {
+  if (atomic_load(&ready)) {
+    return ESP_OK;
+  }
+
+  for (uint32_t i = 0; i < RING_DEPTH; i++) {
+    atomic_store_explicit(&ring[i].seq, i, memory_order_relaxed);
+  }
+  if (xTaskCreate(drain_task, "rt_log", DRAIN_STACK, NULL, DRAIN_PRIORITY,
+                  NULL) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to create drain task");
+    return ESP_ERR_NO_MEM;
+  }
+  atomic_store_explicit(&ready, true, memory_order_release);
+  return ESP_OK;
+}
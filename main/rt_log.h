@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+/**
+ * Logging for the real-time paths (receive, decode, playout).
+ *
+ * ESP_LOGx formats and writes to the console UART in the calling task, so
+ * one warning about a late frame can hold the playback task for a few ms
+ * and make the next frames late as well. RT_LOGx formats into a lock-free
+ * ring instead and a low-priority task writes the lines out. Each call site
+ * passes at most one line per CONFIG_RT_LOG_INTERVAL_MS; the next line that
+ * does go out carries the count of those held back. A full ring drops the
+ * line and the drop is reported later.
+ *
+ * Without CONFIG_RT_LOG the macros are plain ESP_LOGx.
+ */
+
+#if CONFIG_RT_LOG
+
+typedef struct {
+  _Atomic uint32_t next_ms;    // Earliest a line may go out, 0 for now
+  _Atomic uint32_t suppressed; // Lines held back since the last one
+} rt_log_site_t;
+
+/** Start the drain task. Lines logged before are written directly. */
+esp_err_t rt_log_init(void);
+
+/** Queue one line from a call site; use the RT_LOGx macros. */
+void rt_log_write(rt_log_site_t *site, esp_log_level_t level, const char *tag,
+                  const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+#define RT_LOG_LEVEL(level, tag, format, ...)                                  \
+  do {                                                                         \
+    if (LOG_LOCAL_LEVEL >= (level)) {                                          \
+      static rt_log_site_t rt_log_site;                                        \
+      rt_log_write(&rt_log_site, (level), (tag), format, ##__VA_ARGS__);      \
+    }                                                                          \
+  } while (0)
+
+#define RT_LOGE(tag, format, ...)                                              \
+  RT_LOG_LEVEL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define RT_LOGW(tag, format, ...)                                              \
+  RT_LOG_LEVEL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define RT_LOGI(tag, format, ...)                                              \
+  RT_LOG_LEVEL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define RT_LOGD(tag, format, ...)                                              \
+  RT_LOG_LEVEL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+
+#else
+
+static inline esp_err_t rt_log_init(void) {
+  return ESP_OK;
+}
+
+#define RT_LOGE(tag, format, ...) ESP_LOGE(tag, format, ##__VA_ARGS__)
+#define RT_LOGW(tag, format, ...) ESP_LOGW(tag, format, ##__VA_ARGS__)
+#define RT_LOGI(tag, format, ...) ESP_LOGI(tag, format, ##__VA_ARGS__)
+#define RT_LOGD(tag, format, ...) ESP_LOGD(tag, format, ##__VA_ARGS__)
+
+#endif
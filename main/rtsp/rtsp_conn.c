@@ -5,11 +5,13 @@
 #include <unistd.h>
 
 #include "audio_receiver.h"
+#include "audio_volume.h"
+#include "mem_budget.h"
 #include "ptp_clock.h"
 #include "settings.h"
 
 rtsp_conn_t *rtsp_conn_create(void) {
-  rtsp_conn_t *conn = calloc(1, sizeof(rtsp_conn_t));
+  rtsp_conn_t *conn = mem_calloc(MEM_TAG_RTSP, sizeof(rtsp_conn_t));
   if (!conn) {
     return NULL;
   }
@@ -18,19 +20,11 @@ rtsp_conn_t *rtsp_conn_create(void) {
   float saved_volume;
   if (settings_get_volume(&saved_volume) == ESP_OK) {
     conn->volume_db = saved_volume;
-    // Apply volume curve
-    if (saved_volume <= -30.0f) {
-      conn->volume_q15 = 0;
-    } else if (saved_volume >= 0.0f) {
-      conn->volume_q15 = 32768;
-    } else {
-      float normalized = (saved_volume + 30.0f) / 30.0f;
-      conn->volume_q15 = (int32_t)(normalized * normalized * 32768.0f);
-    }
   } else {
-    conn->volume_q15 = 32768; // Full volume
-    conn->volume_db = 0.0f;
+    conn->volume_db = 0.0f; // Full volume
   }
+  conn->volume_q15 = audio_volume_curve_q15(conn->volume_db);
+  audio_volume_set_q15(conn->volume_q15);
 
   conn->data_socket = -1;
   conn->control_socket = -1;
@@ -53,7 +47,7 @@ void rtsp_conn_free(rtsp_conn_t *conn) {
     conn->hap_session = NULL;
   }
 
-  free(conn);
+  mem_free(MEM_TAG_RTSP, conn, sizeof(rtsp_conn_t));
 }
 
 void rtsp_conn_reset_stream(rtsp_conn_t *conn) {
@@ -74,17 +68,22 @@ void rtsp_conn_cleanup(rtsp_conn_t *conn) {
     return;
   }
 
-  if (conn->crypto_rx.encrypted) {
-    free(conn->crypto_rx.encrypted);
-    conn->crypto_rx.encrypted = NULL;
-  }
   conn->crypto_rx.len_received = 0;
   conn->crypto_rx.block_len = 0;
   conn->crypto_rx.encrypted_len = 0;
   conn->crypto_rx.encrypted_received = 0;
 
+#if CONFIG_RTSP_FAST_TAKEOVER
+  // A session that never went live leaves the pipeline to the one playing
+  bool live = !conn->standby;
+#else
+  bool live = true;
+#endif
+
   // Stop audio receiver
-  audio_receiver_stop();
+  if (live) {
+    audio_receiver_stop();
+  }
 
   // Close sockets
   if (conn->data_socket >= 0) {
@@ -109,8 +108,11 @@ void rtsp_conn_cleanup(rtsp_conn_t *conn) {
   conn->event_port = 0;
   conn->buffered_port = 0;
 
-  // Clear PTP clock for fresh sync on next connection
-  ptp_clock_clear();
+  // Keep the PTP lock for a reconnect from the same sender, clear it for
+  // a fresh sync once the grace period passes without a new session
+  if (live) {
+    ptp_clock_clear_later((uint32_t)CONFIG_AUDIO_WARM_GRACE_S * 1000);
+  }
 
   // Reset encryption state
   conn->encrypted_mode = false;
@@ -124,17 +126,8 @@ void rtsp_conn_set_volume(rtsp_conn_t *conn, float volume_db) {
   conn->volume_db = volume_db;
 
   // AirPlay volume: 0 dB = max, -30 dB = mute
-  // Use squared curve for better perceptual control
-  if (volume_db <= -30.0f) {
-    conn->volume_q15 = 0;
-  } else if (volume_db >= 0.0f) {
-    conn->volume_q15 = 32768;
-  } else {
-    // Map -30..0 to 0..1, then square for perceptual curve
-    float normalized = (volume_db + 30.0f) / 30.0f;
-    float curved = normalized * normalized;
-    conn->volume_q15 = (int32_t)(curved * 32768.0f);
-  }
+  conn->volume_q15 = audio_volume_curve_q15(volume_db);
+  audio_volume_set_q15(conn->volume_q15);
 
   // Persist to NVS
   settings_set_volume(volume_db);
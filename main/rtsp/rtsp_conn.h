@@ -5,6 +5,11 @@
 #include <stdint.h>
 
 #include "hap.h"
+#include "plist.h"
+#include "sdkconfig.h"
+#if CONFIG_RTSP_FAST_TAKEOVER
+#include "audio_receiver.h"
+#endif
 
 /**
  * RTSP Connection State Management
@@ -14,6 +19,16 @@
 // Forward declaration
 typedef struct rtsp_conn rtsp_conn_t;
 
+// Maximum plaintext size of an encrypted RTSP block, and its Poly1305 tag
+#define RTSP_ENCRYPTED_BLOCK_MAX 0x400
+#define RTSP_CRYPTO_TAG_LEN      16
+
+// Decoded objects per bplist request body (a SETUP body has about 60)
+#define RTSP_PLIST_NODES 192
+
+// IPv4 addresses kept from a SETPEERS list
+#define RTSP_PEERS_MAX 16
+
 /**
  * Connection state struct - consolidates all session state
  */
@@ -27,11 +42,14 @@ struct rtsp_conn {
     uint8_t len_buf[2];
     uint8_t len_received;
     uint16_t block_len;
-    uint8_t *encrypted;
     size_t encrypted_len;
     size_t encrypted_received;
+    uint8_t encrypted[RTSP_ENCRYPTED_BLOCK_MAX + RTSP_CRYPTO_TAG_LEN];
   } crypto_rx;
 
+  // Encrypted RTSP send frame: length, block encrypted in place, tag
+  uint8_t crypto_tx[2 + RTSP_ENCRYPTED_BLOCK_MAX + RTSP_CRYPTO_TAG_LEN];
+
   // Volume control: Q15 fixed-point (0-32768)
   // 32768 = 0 dB (unity), 0 = mute
   volatile int32_t volume_q15;
@@ -60,6 +78,26 @@ struct rtsp_conn {
   int sample_rate;
   int channels;
   int bits_per_sample;
+
+  // Index of the current request's bplist body, see bplist_parse()
+  bplist_doc_t plist;
+  bplist_node_t plist_nodes[RTSP_PLIST_NODES];
+
+#if CONFIG_RTSP_FAST_TAKEOVER
+  // A second sender's session while another one plays: it pairs and sets
+  // up in parallel, and what would reach the audio pipeline is kept here
+  // until rtsp_conn_go_live()
+  bool standby;
+  struct {
+    bool has_format;
+    bool has_encrypt;
+    bool has_peers;
+    audio_format_t format;
+    audio_encrypt_t encrypt;
+    uint32_t peers[RTSP_PEERS_MAX];
+    size_t peer_count;
+  } staged;
+#endif
 };
 
 /**
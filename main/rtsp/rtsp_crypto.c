@@ -1,7 +1,6 @@
 #include "rtsp_crypto.h"
 
 #include <errno.h>
-#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 
@@ -23,6 +22,13 @@ static int send_all(int socket, const uint8_t *data, size_t len) {
   return 0;
 }
 
+static void reset_rx(rtsp_conn_t *conn) {
+  conn->crypto_rx.len_received = 0;
+  conn->crypto_rx.block_len = 0;
+  conn->crypto_rx.encrypted_len = 0;
+  conn->crypto_rx.encrypted_received = 0;
+}
+
 int rtsp_crypto_read_block(int socket, rtsp_conn_t *conn, uint8_t *buffer,
                            size_t buffer_size) {
   if (!conn || !conn->hap_session || !conn->encrypted_mode) {
@@ -48,32 +54,22 @@ int rtsp_crypto_read_block(int socket, rtsp_conn_t *conn, uint8_t *buffer,
     conn->crypto_rx.len_received += (uint8_t)r;
   }
 
-  // Allocate encrypted buffer once we have a full length header
-  if (!conn->crypto_rx.encrypted) {
+  // Start a block once we have a full length header
+  if (conn->crypto_rx.encrypted_len == 0) {
     uint16_t block_len = (uint16_t)conn->crypto_rx.len_buf[0] |
                          ((uint16_t)conn->crypto_rx.len_buf[1] << 8);
 
     if (block_len == 0 || block_len > RTSP_ENCRYPTED_BLOCK_MAX ||
         block_len > buffer_size) {
       ESP_LOGE(TAG, "Invalid encrypted block length: %d", block_len);
-      conn->crypto_rx.len_received = 0;
-      conn->crypto_rx.block_len = 0;
+      reset_rx(conn);
       errno = EBADMSG;
       return -1;
     }
 
     conn->crypto_rx.block_len = block_len;
-    conn->crypto_rx.encrypted_len = (size_t)block_len + 16; // +16 tag
+    conn->crypto_rx.encrypted_len = (size_t)block_len + RTSP_CRYPTO_TAG_LEN;
     conn->crypto_rx.encrypted_received = 0;
-    conn->crypto_rx.encrypted = malloc(conn->crypto_rx.encrypted_len);
-    if (!conn->crypto_rx.encrypted) {
-      ESP_LOGE(TAG, "Failed to allocate encrypted buffer");
-      conn->crypto_rx.len_received = 0;
-      conn->crypto_rx.block_len = 0;
-      conn->crypto_rx.encrypted_len = 0;
-      errno = ENOMEM;
-      return -1;
-    }
   }
 
   // Read encrypted payload (+ tag), keeping partial state across timeouts.
@@ -86,53 +82,32 @@ int rtsp_crypto_read_block(int socket, rtsp_conn_t *conn, uint8_t *buffer,
       if (errno == EAGAIN || errno == EWOULDBLOCK) {
         return 0;
       }
-      free(conn->crypto_rx.encrypted);
-      conn->crypto_rx.encrypted = NULL;
-      conn->crypto_rx.len_received = 0;
-      conn->crypto_rx.block_len = 0;
-      conn->crypto_rx.encrypted_len = 0;
-      conn->crypto_rx.encrypted_received = 0;
+      reset_rx(conn);
       return -1;
     }
     if (r == 0) {
-      free(conn->crypto_rx.encrypted);
-      conn->crypto_rx.encrypted = NULL;
-      conn->crypto_rx.len_received = 0;
-      conn->crypto_rx.block_len = 0;
-      conn->crypto_rx.encrypted_len = 0;
-      conn->crypto_rx.encrypted_received = 0;
+      reset_rx(conn);
       errno = ECONNRESET;
       return -1;
     }
     conn->crypto_rx.encrypted_received += (size_t)r;
   }
 
-  // Decrypt using session keys
+  // Decrypt using session keys, straight into the caller's buffer
   uint8_t nonce[12] = {0};
   memcpy(nonce + 4, &conn->hap_session->decrypt_nonce, 8);
 
   unsigned long long plaintext_len;
-  if (crypto_aead_chacha20poly1305_ietf_decrypt(
-          buffer, &plaintext_len, NULL, conn->crypto_rx.encrypted,
-          conn->crypto_rx.encrypted_len, conn->crypto_rx.len_buf,
-          sizeof(conn->crypto_rx.len_buf), nonce,
-          conn->hap_session->decrypt_key) != 0) {
-    free(conn->crypto_rx.encrypted);
-    conn->crypto_rx.encrypted = NULL;
-    conn->crypto_rx.len_received = 0;
-    conn->crypto_rx.block_len = 0;
-    conn->crypto_rx.encrypted_len = 0;
-    conn->crypto_rx.encrypted_received = 0;
+  int ret = crypto_aead_chacha20poly1305_ietf_decrypt(
+      buffer, &plaintext_len, NULL, conn->crypto_rx.encrypted,
+      conn->crypto_rx.encrypted_len, conn->crypto_rx.len_buf,
+      sizeof(conn->crypto_rx.len_buf), nonce, conn->hap_session->decrypt_key);
+  reset_rx(conn);
+  if (ret != 0) {
     ESP_LOGE(TAG, "Failed to decrypt frame");
     errno = EBADMSG;
     return -1;
   }
-  free(conn->crypto_rx.encrypted);
-  conn->crypto_rx.encrypted = NULL;
-  conn->crypto_rx.len_received = 0;
-  conn->crypto_rx.block_len = 0;
-  conn->crypto_rx.encrypted_len = 0;
-  conn->crypto_rx.encrypted_received = 0;
 
   conn->hap_session->decrypt_nonce++;
 
@@ -145,55 +120,64 @@ int rtsp_crypto_read_block(int socket, rtsp_conn_t *conn, uint8_t *buffer,
   return (int)plaintext_len;
 }
 
-int rtsp_crypto_write_frame(int socket, rtsp_conn_t *conn, const uint8_t *data,
-                            size_t data_len) {
+int rtsp_crypto_write_parts(int socket, rtsp_conn_t *conn,
+                            const uint8_t *head, size_t head_len,
+                            const uint8_t *body, size_t body_len) {
   if (!conn || !conn->hap_session || !conn->encrypted_mode) {
     // Expected during session teardown - not an error
     return -1;
   }
 
+  uint8_t *frame = conn->crypto_tx;
+  uint8_t *block = frame + 2;
+  size_t total = head_len + body_len;
   size_t offset = 0;
-  while (offset < data_len) {
-    uint16_t block_len = (data_len - offset) > RTSP_ENCRYPTED_BLOCK_MAX
+  while (offset < total) {
+    uint16_t block_len = (total - offset) > RTSP_ENCRYPTED_BLOCK_MAX
                              ? RTSP_ENCRYPTED_BLOCK_MAX
-                             : (uint16_t)(data_len - offset);
+                             : (uint16_t)(total - offset);
+
+    // Gather the plaintext for this block from head and body
+    for (size_t filled = 0; filled < block_len;) {
+      size_t pos = offset + filled;
+      const uint8_t *src =
+          pos < head_len ? head + pos : body + (pos - head_len);
+      size_t avail = pos < head_len ? head_len - pos : total - pos;
+      size_t n = avail < block_len - filled ? avail : block_len - filled;
+      memcpy(block + filled, src, n);
+      filled += n;
+    }
 
-    uint8_t len_buf[2];
-    len_buf[0] = block_len & 0xFF;
-    len_buf[1] = (block_len >> 8) & 0xFF;
+    frame[0] = block_len & 0xFF;
+    frame[1] = (block_len >> 8) & 0xFF;
 
     uint8_t nonce[12] = {0};
     memcpy(nonce + 4, &conn->hap_session->encrypt_nonce, 8);
 
-    size_t encrypted_len = block_len + 16; // +16 for Poly1305 tag
-    uint8_t *encrypted = malloc(encrypted_len);
-    if (!encrypted) {
-      ESP_LOGE(TAG, "Failed to allocate encrypted buffer");
-      return -1;
-    }
-
+    // In place; the tag lands right after the ciphertext
     unsigned long long ct_len;
-    crypto_aead_chacha20poly1305_ietf_encrypt(
-        encrypted, &ct_len, data + offset, block_len, len_buf, sizeof(len_buf),
-        NULL, nonce, conn->hap_session->encrypt_key);
+    crypto_aead_chacha20poly1305_ietf_encrypt(block, &ct_len, block, block_len,
+                                              frame, 2, NULL, nonce,
+                                              conn->hap_session->encrypt_key);
 
-    if (ct_len != encrypted_len) {
+    if (ct_len != (size_t)block_len + RTSP_CRYPTO_TAG_LEN) {
       ESP_LOGE(TAG, "Unexpected encrypted length: %llu", ct_len);
-      free(encrypted);
       return -1;
     }
 
-    if (send_all(socket, len_buf, sizeof(len_buf)) != 0 ||
-        send_all(socket, encrypted, encrypted_len) != 0) {
+    if (send_all(socket, frame, 2 + (size_t)ct_len) != 0) {
       ESP_LOGE(TAG, "Failed to send encrypted block");
-      free(encrypted);
       return -1;
     }
 
-    free(encrypted);
     conn->hap_session->encrypt_nonce++;
     offset += block_len;
   }
 
   return 0;
 }
+
+int rtsp_crypto_write_frame(int socket, rtsp_conn_t *conn, const uint8_t *data,
+                            size_t data_len) {
+  return rtsp_crypto_write_parts(socket, conn, data, data_len, NULL, 0);
+}
@@ -10,12 +10,10 @@
  * Handles ChaCha20-Poly1305 encrypted frame read/write
  */
 
-// Maximum size of an encrypted block
-#define RTSP_ENCRYPTED_BLOCK_MAX 0x400
-
 /**
  * Read and decrypt a block from socket
  * Format: [2-byte length (little-endian)][encrypted data + 16-byte tag]
+ * The block is received into the connection's fixed frame buffer.
  *
  * @param socket Client socket
  * @param conn Connection state (must have hap_session and encrypted_mode)
@@ -39,3 +37,14 @@ int rtsp_crypto_read_block(int socket, rtsp_conn_t *conn, uint8_t *buffer,
  */
 int rtsp_crypto_write_frame(int socket, rtsp_conn_t *conn, const uint8_t *data,
                             size_t data_len);
+
+/**
+ * Encrypt and write head followed by body as one stream, without joining
+ * them first. Blocks are assembled and encrypted in place in the
+ * connection's send frame, so nothing is allocated.
+ *
+ * @return 0 on success, -1 on error
+ */
+int rtsp_crypto_write_parts(int socket, rtsp_conn_t *conn,
+                            const uint8_t *head, size_t head_len,
+                            const uint8_t *body, size_t body_len);
@@ -1,36 +1,150 @@
 #include "rtsp_events.h"
 
 #include <stddef.h>
+#include <string.h>
 
-#define MAX_LISTENERS 4
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define MAX_LISTENERS     6
+#define EVENT_QUEUE_LEN   16
+#define DISPATCH_STACK    3072
+#define DISPATCH_PRIORITY 2
 
 typedef struct {
   rtsp_event_callback_t callback;
   void *user_data;
 } listener_t;
 
+static const char *TAG = "rtsp_events";
+
 static listener_t listeners[MAX_LISTENERS];
 static int listener_count = 0;
 
+static rtsp_now_playing_t now_playing;
+static bool now_playing_valid;
+
+// Pending events, oldest first. Payload events sit in the queue at most
+// once and carry their latest value in the slots below.
+static rtsp_event_t queue[EVENT_QUEUE_LEN];
+static uint32_t queue_head;
+static uint32_t queue_count;
+static uint32_t queued_payloads; // Bit per event type
+static float pending_volume_db;
+static uint32_t dropped;
+static TaskHandle_t dispatch_task;
+
+// Guards all of the above; held only for a few instructions or a copy
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void deliver(rtsp_event_t event, const rtsp_event_data_t *data) {
+  listener_t snapshot[MAX_LISTENERS];
+  taskENTER_CRITICAL(&lock);
+  int count = listener_count;
+  memcpy(snapshot, listeners, sizeof(snapshot));
+  taskEXIT_CRITICAL(&lock);
+
+  for (int i = 0; i < count; i++) {
+    snapshot[i].callback(event, data, snapshot[i].user_data);
+  }
+}
+
+// Take the next event and its payload; false when the queue is empty
+static bool dequeue(rtsp_event_t *event, rtsp_event_data_t *data,
+                    rtsp_now_playing_t *np) {
+  bool ok = false;
+  taskENTER_CRITICAL(&lock);
+  while (queue_count > 0 && !ok) {
+    *event = queue[queue_head];
+    queue_head = (queue_head + 1) % EVENT_QUEUE_LEN;
+    queue_count--;
+    queued_payloads &= ~(1u << *event);
+    ok = true;
+
+    if (*event == RTSP_EVENT_METADATA) {
+      // Cleared by a disconnect while queued: nothing left to show
+      ok = now_playing_valid;
+      if (ok) {
+        *np = now_playing;
+        data->now_playing = np;
+      }
+    } else if (*event == RTSP_EVENT_VOLUME) {
+      data->volume_db = pending_volume_db;
+    }
+  }
+  taskEXIT_CRITICAL(&lock);
+  return ok;
+}
+
+static void dispatch_task_fn(void *arg) {
+  (void)arg;
+  static rtsp_now_playing_t np; // Passed to listeners by pointer
+  uint32_t dropped_seen = 0;
+
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    while (1) {
+      rtsp_event_t event;
+      rtsp_event_data_t data = {0};
+      if (!dequeue(&event, &data, &np)) {
+        break;
+      }
+      deliver(event, &data);
+    }
+
+    uint32_t dropped_now = dropped;
+    if (dropped_now != dropped_seen) {
+      ESP_LOGW(TAG, "Event queue full, %lu events dropped",
+               (unsigned long)(dropped_now - dropped_seen));
+      dropped_seen = dropped_now;
+    }
+  }
+}
+
+esp_err_t rtsp_events_init(void) {
+  if (dispatch_task) {
+    return ESP_OK;
+  }
+  if (xTaskCreate(dispatch_task_fn, "rtsp_events", DISPATCH_STACK, NULL,
+                  DISPATCH_PRIORITY, &dispatch_task) != pdPASS) {
+    dispatch_task = NULL;
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
 int rtsp_events_register(rtsp_event_callback_t callback, void *user_data) {
-  if (callback == NULL || listener_count >= MAX_LISTENERS) {
+  if (callback == NULL) {
     return -1;
   }
 
+  int ret = 0;
+  taskENTER_CRITICAL(&lock);
+  bool found = false;
   // Check if already registered
   for (int i = 0; i < listener_count; i++) {
     if (listeners[i].callback == callback) {
-      return 0;
+      found = true;
+      break;
     }
   }
-
-  listeners[listener_count].callback = callback;
-  listeners[listener_count].user_data = user_data;
-  listener_count++;
-  return 0;
+  if (!found) {
+    if (listener_count >= MAX_LISTENERS) {
+      ret = -1;
+    } else {
+      listeners[listener_count].callback = callback;
+      listeners[listener_count].user_data = user_data;
+      listener_count++;
+    }
+  }
+  taskEXIT_CRITICAL(&lock);
+  return ret;
 }
 
 void rtsp_events_unregister(rtsp_event_callback_t callback) {
+  taskENTER_CRITICAL(&lock);
   for (int i = 0; i < listener_count; i++) {
     if (listeners[i].callback == callback) {
       // Shift remaining listeners
@@ -38,13 +152,95 @@ void rtsp_events_unregister(rtsp_event_callback_t callback) {
         listeners[j] = listeners[j + 1];
       }
       listener_count--;
-      return;
+      break;
     }
   }
+  taskEXIT_CRITICAL(&lock);
+}
+
+// Caller holds the lock. State events repeating the newest queued one add
+// nothing; a queued payload event just picks up the newer value.
+static void enqueue_locked(rtsp_event_t event, bool payload) {
+  if (payload && (queued_payloads & (1u << event))) {
+    return;
+  }
+  if (!payload && queue_count > 0 &&
+      queue[(queue_head + queue_count - 1) % EVENT_QUEUE_LEN] == event) {
+    return;
+  }
+  if (queue_count == EVENT_QUEUE_LEN) {
+    dropped++;
+    return;
+  }
+  queue[(queue_head + queue_count) % EVENT_QUEUE_LEN] = event;
+  queue_count++;
+  if (payload) {
+    queued_payloads |= 1u << event;
+  }
+}
+
+static void post(rtsp_event_t event, bool payload) {
+  if (!dispatch_task) {
+    // Not started yet (early boot): deliver in place
+    rtsp_event_data_t data = {0};
+    rtsp_now_playing_t np;
+    if (event == RTSP_EVENT_METADATA) {
+      if (!rtsp_events_get_now_playing(&np)) {
+        return;
+      }
+      data.now_playing = &np;
+    } else if (event == RTSP_EVENT_VOLUME) {
+      data.volume_db = pending_volume_db;
+    }
+    deliver(event, &data);
+    return;
+  }
+
+  taskENTER_CRITICAL(&lock);
+  enqueue_locked(event, payload);
+  taskEXIT_CRITICAL(&lock);
+  xTaskNotifyGive(dispatch_task);
 }
 
 void rtsp_events_emit(rtsp_event_t event) {
-  for (int i = 0; i < listener_count; i++) {
-    listeners[i].callback(event, listeners[i].user_data);
+  if (event == RTSP_EVENT_DISCONNECTED) {
+    taskENTER_CRITICAL(&lock);
+    now_playing_valid = false;
+    taskEXIT_CRITICAL(&lock);
+  }
+  post(event, false);
+}
+
+void rtsp_events_emit_volume(float volume_db) {
+  taskENTER_CRITICAL(&lock);
+  pending_volume_db = volume_db;
+  taskEXIT_CRITICAL(&lock);
+  post(RTSP_EVENT_VOLUME, true);
+}
+
+void rtsp_events_publish_now_playing(const rtsp_now_playing_t *np) {
+  if (!np) {
+    return;
+  }
+  taskENTER_CRITICAL(&lock);
+  now_playing = *np;
+  now_playing_valid = true;
+  taskEXIT_CRITICAL(&lock);
+  post(RTSP_EVENT_METADATA, true);
+}
+
+bool rtsp_events_get_now_playing(rtsp_now_playing_t *out) {
+  if (!out) {
+    return false;
+  }
+  taskENTER_CRITICAL(&lock);
+  bool valid = now_playing_valid;
+  if (valid) {
+    *out = now_playing;
+  }
+  taskEXIT_CRITICAL(&lock);
+  if (!valid) {
+    memset(out, 0, sizeof(*out));
   }
+  return valid;
 }
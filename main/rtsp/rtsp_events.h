@@ -1,8 +1,18 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
 /**
  * RTSP event system - Observer pattern for playback state changes.
  * Allows multiple listeners to react to RTSP events without coupling.
+ *
+ * Emitting only queues the event; a low-priority dispatcher task calls the
+ * listeners, so slow consumers (LCD, LEDs, amp control) never hold up an
+ * RTSP reply. Repeated state events and superseded payload events are
+ * coalesced while queued.
  */
 
 typedef enum {
@@ -10,9 +20,44 @@ typedef enum {
   RTSP_EVENT_PLAYING,
   RTSP_EVENT_PAUSED,
   RTSP_EVENT_DISCONNECTED,
+  RTSP_EVENT_METADATA, // Now-playing record changed
+  RTSP_EVENT_VOLUME,   // Sender volume changed
 } rtsp_event_t;
 
-typedef void (*rtsp_event_callback_t)(rtsp_event_t event, void *user_data);
+/**
+ * Track metadata of the current session, parsed once from the sender's
+ * DMAP (or bplist) metadata. Strings are UTF-8 as sent, empty if absent;
+ * numbers are 0 if absent.
+ */
+typedef struct {
+  char title[128];
+  char album[128];
+  char artist[128];
+  char genre[64];
+  uint16_t track_number;
+  uint16_t track_count;
+  uint32_t duration_ms;
+  uint64_t persistent_id;
+} rtsp_now_playing_t;
+
+/**
+ * Event payload; only the member of the delivered event type is set, and
+ * it is valid for the duration of the callback.
+ */
+typedef union {
+  const rtsp_now_playing_t *now_playing; // RTSP_EVENT_METADATA
+  float volume_db;                       // RTSP_EVENT_VOLUME (-30..0, -144)
+} rtsp_event_data_t;
+
+typedef void (*rtsp_event_callback_t)(rtsp_event_t event,
+                                      const rtsp_event_data_t *data,
+                                      void *user_data);
+
+/**
+ * Start the dispatcher task. Until it runs, events are delivered
+ * synchronously on the emitting task.
+ */
+esp_err_t rtsp_events_init(void);
 
 /**
  * Register a listener for RTSP events.
@@ -29,8 +74,29 @@ int rtsp_events_register(rtsp_event_callback_t callback, void *user_data);
 void rtsp_events_unregister(rtsp_event_callback_t callback);
 
 /**
- * Emit an event to all registered listeners.
- * Called internally by RTSP handlers.
+ * Queue a payload-less event for all registered listeners.
+ * Called internally by RTSP handlers; never blocks.
  * @param event The event to emit
  */
 void rtsp_events_emit(rtsp_event_t event);
+
+/**
+ * Queue RTSP_EVENT_VOLUME; only the latest volume is delivered if several
+ * are pending.
+ * @param volume_db AirPlay volume in dB
+ */
+void rtsp_events_emit_volume(float volume_db);
+
+/**
+ * Store the now-playing record and emit RTSP_EVENT_METADATA.
+ * The record is cleared on RTSP_EVENT_DISCONNECTED.
+ * @param np Record to publish (copied)
+ */
+void rtsp_events_publish_now_playing(const rtsp_now_playing_t *np);
+
+/**
+ * Copy the current now-playing record (any task).
+ * @param out Output record
+ * @return false if nothing has been published this session
+ */
+bool rtsp_events_get_now_playing(rtsp_now_playing_t *out);
@@ -1,6 +1,7 @@
 #include "rtsp_handlers.h"
 
 #include <arpa/inet.h>
+#include <ctype.h>
 #include <errno.h>
 #include <inttypes.h>
 #include <netinet/in.h>
@@ -19,13 +20,19 @@
 #include "audio_output.h"
 #include "audio_receiver.h"
 #include "audio_stream.h"
+#include "audio_volume.h"
 #include "hap.h"
 #include "lcd.h"
+#include "mdns_airplay.h"
+#include "mem_budget.h"
 #include "ntp_clock.h"
 #include "plist.h"
+#include "power_mgmt.h"
+#include "ptp_clock.h"
 #include "rtsp_fairplay.h"
 #include "settings.h"
 #include "socket_utils.h"
+#include "task_placement.h"
 #include "tlv8.h"
 
 #include "rtsp_events.h"
@@ -68,83 +75,72 @@ static uint32_t read_be_u32(const uint8_t *p) {
          (uint32_t)p[3];
 }
 
-static bool dmap_find_tag_recursive(const uint8_t *data, size_t len,
-                                    const char tag[4], const uint8_t **out,
-                                    uint32_t *out_len, int depth) {
-  if (!data || len < 8 || !out || !out_len) {
-    return false;
-  }
-  if (depth > 8) {
-    return false;
-  }
-
-  size_t pos = 0;
-  while (pos + 8 <= len) {
-    const uint8_t *cur = data + pos;
-    uint32_t value_len = read_be_u32(cur + 4);
-    pos += 8;
-    if (pos + value_len > len) {
+static bool dmap_is_tag(const uint8_t *p) {
+  for (int i = 0; i < 4; i++) {
+    if (!((p[i] >= 'A' && p[i] <= 'Z') || (p[i] >= 'a' && p[i] <= 'z'))) {
       return false;
     }
-
-    if (memcmp(cur, tag, 4) == 0) {
-      *out = data + pos;
-      *out_len = value_len;
-      return true;
-    }
-
-    if (value_len >= 8) {
-      const uint8_t *val = data + pos;
-      if (((val[0] >= 'A' && val[0] <= 'Z') || (val[0] >= 'a' && val[0] <= 'z')) &&
-          ((val[1] >= 'A' && val[1] <= 'Z') || (val[1] >= 'a' && val[1] <= 'z')) &&
-          ((val[2] >= 'A' && val[2] <= 'Z') || (val[2] >= 'a' && val[2] <= 'z')) &&
-          ((val[3] >= 'A' && val[3] <= 'Z') || (val[3] >= 'a' && val[3] <= 'z'))) {
-        if (dmap_find_tag_recursive(val, value_len, tag, out, out_len,
-                                    depth + 1)) {
-          return true;
-        }
-      }
-    }
-
-    pos += value_len;
   }
-
-  return false;
+  return true;
 }
 
-static bool dmap_find_string(const uint8_t *data, size_t len, const char tag[4],
-                             char *out, size_t out_capacity) {
-  if (!out || out_capacity == 0) {
-    return false;
-  }
-  out[0] = '\0';
-
-  const uint8_t *val = NULL;
-  uint32_t val_len = 0;
-  if (!dmap_find_tag_recursive(data, len, tag, &val, &val_len, 0) || !val ||
-      val_len == 0) {
-    return false;
-  }
-
-  size_t copy_len = val_len;
-  if (copy_len >= out_capacity) {
-    copy_len = out_capacity - 1;
+static void dmap_copy_string(char *out, size_t out_capacity,
+                             const uint8_t *val, uint32_t val_len) {
+  if (out[0] != '\0' || val_len == 0) {
+    return; // First occurrence wins
   }
+  size_t copy_len = val_len < out_capacity ? val_len : out_capacity - 1;
   memcpy(out, val, copy_len);
   out[copy_len] = '\0';
-  return true;
 }
 
-static bool is_all_ascii_printable(const char *s) {
-  if (!s || !*s) {
-    return false;
+static uint64_t dmap_read_uint(const uint8_t *val, uint32_t val_len) {
+  uint64_t v = 0;
+  for (uint32_t i = 0; i < val_len && i < 8; i++) {
+    v = (v << 8) | val[i];
   }
-  for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
-    if (*p < 0x20 || *p > 0x7e) {
-      return false;
+  return v;
+}
+
+// One walk over a DMAP listing (mlit and its containers) that fills every
+// now-playing field; values that look like nested items are descended into
+static void dmap_parse_now_playing(const uint8_t *data, size_t len,
+                                   rtsp_now_playing_t *np, int depth) {
+  if (depth > 8) {
+    return;
+  }
+
+  size_t pos = 0;
+  while (pos + 8 <= len) {
+    const uint8_t *tag = data + pos;
+    uint32_t val_len = read_be_u32(tag + 4);
+    const uint8_t *val = tag + 8;
+    pos += 8;
+    if (val_len > len - pos) {
+      return;
+    }
+    pos += val_len;
+
+    if (memcmp(tag, "minm", 4) == 0) {
+      dmap_copy_string(np->title, sizeof(np->title), val, val_len);
+    } else if (memcmp(tag, "asal", 4) == 0) {
+      dmap_copy_string(np->album, sizeof(np->album), val, val_len);
+    } else if (memcmp(tag, "asar", 4) == 0) {
+      dmap_copy_string(np->artist, sizeof(np->artist), val, val_len);
+    } else if (memcmp(tag, "asgn", 4) == 0) {
+      dmap_copy_string(np->genre, sizeof(np->genre), val, val_len);
+    } else if (memcmp(tag, "astn", 4) == 0) {
+      np->track_number = (uint16_t)dmap_read_uint(val, val_len);
+    } else if (memcmp(tag, "astc", 4) == 0) {
+      np->track_count = (uint16_t)dmap_read_uint(val, val_len);
+    } else if (memcmp(tag, "astm", 4) == 0) {
+      np->duration_ms = (uint32_t)dmap_read_uint(val, val_len);
+    } else if (memcmp(tag, "mper", 4) == 0) {
+      np->persistent_id = dmap_read_uint(val, val_len);
+    } else if (val_len >= 8 && dmap_is_tag(val)) {
+      dmap_parse_now_playing(val, val_len, np, depth + 1);
     }
   }
-  return true;
 }
 
 // ============================================================================
@@ -167,13 +163,20 @@ static void configure_codec(audio_format_t *fmt, const char *name, int64_t sr,
 
 // Codec registry - add new codecs here
 // ct values: 2=ALAC, 4=AAC, 8=AAC-ELD, 64=OPUS (based on AirPlay 2 protocol)
-static const rtsp_codec_t codec_registry[] = {
-    {"ALAC", 2}, {"AAC", 4}, {"AAC-ELD", 8}, {"OPUS", 64}, {NULL, 0}};
+// AAC-ELD is the low-delay profile: 480 samples per frame (512 is also valid)
+static const rtsp_codec_t codec_registry[] = {{"ALAC", 2, 352},
+                                              {"AAC", 4, 1024},
+                                              {"AAC-ELD", 8, 480},
+                                              {"OPUS", 64, 480},
+                                              {NULL, 0, 0}};
 
 bool rtsp_codec_configure(int64_t type_id, audio_format_t *fmt,
                           int64_t sample_rate, int64_t samples_per_frame) {
   for (const rtsp_codec_t *codec = codec_registry; codec->name; codec++) {
     if (codec->type_id == type_id) {
+      if (samples_per_frame <= 0) {
+        samples_per_frame = codec->default_spf;
+      }
       configure_codec(fmt, codec->name, sample_rate, samples_per_frame);
       ESP_LOGI(TAG, "Configured codec: %s (ct=%lld, sr=%lld, spf=%lld)",
                codec->name, (long long)type_id, (long long)sample_rate,
@@ -184,7 +187,8 @@ bool rtsp_codec_configure(int64_t type_id, audio_format_t *fmt,
   // Default to ALAC if unknown codec type
   ESP_LOGW(TAG, "Unknown codec type %lld, defaulting to ALAC",
            (long long)type_id);
-  configure_codec(fmt, "ALAC", sample_rate, samples_per_frame);
+  configure_codec(fmt, "ALAC", sample_rate,
+                  samples_per_frame > 0 ? samples_per_frame : 352);
   return false;
 }
 
@@ -250,6 +254,40 @@ static void ensure_stream_ports(rtsp_conn_t *conn, bool buffered) {
   }
 }
 
+// Whether this connection drives the audio pipeline; a standby one keeps
+// what it sets up for rtsp_conn_go_live()
+static bool conn_is_live(const rtsp_conn_t *conn) {
+#if CONFIG_RTSP_FAST_TAKEOVER
+  return !conn->standby;
+#else
+  (void)conn;
+  return true;
+#endif
+}
+
+static void conn_set_format(rtsp_conn_t *conn, const audio_format_t *format) {
+#if CONFIG_RTSP_FAST_TAKEOVER
+  if (conn->standby) {
+    conn->staged.format = *format;
+    conn->staged.has_format = true;
+    return;
+  }
+#endif
+  audio_receiver_set_format(format);
+}
+
+static void conn_set_encryption(rtsp_conn_t *conn,
+                                const audio_encrypt_t *encrypt) {
+#if CONFIG_RTSP_FAST_TAKEOVER
+  if (conn->standby) {
+    conn->staged.encrypt = *encrypt;
+    conn->staged.has_encrypt = true;
+    return;
+  }
+#endif
+  audio_receiver_set_encryption(encrypt);
+}
+
 // Event port task - handles AirPlay 2 session persistence
 static void event_port_task(void *pvParameters) {
   int listen_socket = (int)(intptr_t)pvParameters;
@@ -299,6 +337,7 @@ static void event_port_task(void *pvParameters) {
         close(event_client_socket);
       }
       event_client_socket = client;
+      socket_utils_set_realtime_dscp(client);
       ESP_LOGI(TAG, "Event client connected");
       rtsp_events_emit(RTSP_EVENT_CLIENT_CONNECTED);
 
@@ -336,7 +375,7 @@ static void event_port_task(void *pvParameters) {
   }
   event_listen_socket = -1;
   event_task_handle = NULL;
-  vTaskDelete(NULL);
+  task_placement_exit(TASK_EVENT_PORT);
 }
 
 void rtsp_start_event_port_task(int listen_socket) {
@@ -345,8 +384,8 @@ void rtsp_start_event_port_task(int listen_socket) {
   }
   event_task_should_stop = false;
   event_listen_socket = -1;
-  xTaskCreate(event_port_task, "event_port", 3072,
-              (void *)(intptr_t)listen_socket, 5, &event_task_handle);
+  task_placement_spawn(TASK_EVENT_PORT, event_port_task,
+                       (void *)(intptr_t)listen_socket, &event_task_handle);
 }
 
 void rtsp_stop_event_port_task(void) {
@@ -374,6 +413,114 @@ void rtsp_stop_event_port_task(void) {
 }
 
 // Forward declarations of handlers
+// GET /info reply, rebuilt only when an input changes: the device name
+// (tracked by its settings revision), the status flags or the output
+// latency. The features and key are fixed for the lifetime of the firmware.
+static struct {
+  bool valid;
+  uint32_t name_revision;
+  uint32_t status_flags;
+  uint32_t latency_us;
+  size_t len;
+  char body[4096];
+} info_cache;
+
+static const char *get_info_response(size_t *len) {
+  uint32_t name_revision = settings_get_device_name_revision();
+  uint32_t status_flags = mdns_airplay_get_status_flags();
+  uint32_t latency_us = audio_receiver_get_output_latency_us();
+  if (info_cache.valid && info_cache.name_revision == name_revision &&
+      info_cache.status_flags == status_flags &&
+      info_cache.latency_us == latency_us) {
+    *len = info_cache.len;
+    return info_cache.body;
+  }
+
+  char device_id[18];
+  char device_name[65];
+  plist_t p;
+
+  rtsp_get_device_id(device_id, sizeof(device_id));
+  settings_get_device_name(device_name, sizeof(device_name));
+  const uint8_t *pk = hap_get_public_key();
+  uint64_t features =
+      ((uint64_t)AIRPLAY_FEATURES_HI << 32) | AIRPLAY_FEATURES_LO;
+
+  plist_init(&p, info_cache.body, sizeof(info_cache.body));
+  plist_begin(&p);
+  plist_dict_begin(&p);
+
+  plist_dict_string(&p, "deviceid", device_id);
+  plist_dict_uint(&p, "features", features);
+  plist_dict_string(&p, "model", "AudioAccessory5,1");
+  plist_dict_string(&p, "protovers", "1.1");
+  plist_dict_string(&p, "srcvers", "377.40.00");
+  plist_dict_int(&p, "vv", 2);
+  plist_dict_int(&p, "statusFlags", status_flags);
+  plist_dict_data(&p, "pk", pk, 32);
+  plist_dict_string(&p, "pi", "00000000-0000-0000-0000-000000000000");
+  plist_dict_string(&p, "name", device_name);
+
+  // Audio formats array
+  plist_dict_array_begin(&p, "audioFormats");
+  plist_dict_begin(&p);
+  plist_dict_int(&p, "type", 96);
+  plist_dict_int(&p, "audioInputFormats", 0x01000000);
+  plist_dict_int(&p, "audioOutputFormats", 0x01000000);
+  plist_dict_end(&p);
+  plist_array_end(&p);
+
+  // Audio latencies array
+  plist_dict_array_begin(&p, "audioLatencies");
+  plist_dict_begin(&p);
+  plist_dict_int(&p, "type", 96);
+  plist_dict_int(&p, "audioType", 0x64);
+  plist_dict_int(&p, "inputLatencyMicros", 0);
+  plist_dict_int(&p, "outputLatencyMicros", latency_us);
+  plist_dict_end(&p);
+  plist_array_end(&p);
+
+  plist_dict_end(&p);
+  info_cache.len = plist_end(&p);
+
+  info_cache.name_revision = name_revision;
+  info_cache.status_flags = status_flags;
+  info_cache.latency_us = latency_us;
+  info_cache.valid = info_cache.len > 0;
+  *len = info_cache.len;
+  return info_cache.body;
+}
+
+// /feedback reply for buffered streams; it never changes, so it is built on
+// first use
+static const uint8_t *get_feedback_response(size_t *len) {
+  static uint8_t response[128];
+  static size_t response_len;
+  if (response_len == 0) {
+    response_len = bplist_build_feedback_response(response, sizeof(response),
+                                                  103, 44100.0);
+  }
+  *len = response_len;
+  return response;
+}
+
+// Decode a bplist request body once into the connection's node arena; all
+// lookups of the handler then run on the index
+static const bplist_doc_t *parse_body_plist(rtsp_conn_t *conn,
+                                            const rtsp_request_t *req) {
+  if (!req->body || req->body_len < 8 ||
+      memcmp(req->body, "bplist00", 8) != 0) {
+    return NULL;
+  }
+  if (!bplist_parse(&conn->plist, req->body, req->body_len,
+                    conn->plist_nodes, RTSP_PLIST_NODES)) {
+    ESP_LOGW(TAG, "%s: bplist body malformed or over %d objects",
+             req->method, RTSP_PLIST_NODES);
+    return NULL;
+  }
+  return &conn->plist;
+}
+
 static void handle_options(int socket, rtsp_conn_t *conn,
                            const rtsp_request_t *req, const uint8_t *raw,
                            size_t raw_len);
@@ -432,23 +579,18 @@ static const rtsp_method_handler_t method_handlers[] = {
     {"SETPEERSX", handle_setpeers},
     {NULL, NULL}};
 
-int rtsp_dispatch(int socket, rtsp_conn_t *conn, const uint8_t *raw_request,
-                  size_t raw_len) {
-  rtsp_request_t req;
-  if (rtsp_request_parse(raw_request, raw_len, &req) < 0) {
-    ESP_LOGW(TAG, "Failed to parse RTSP request");
-    return -1;
-  }
+int rtsp_dispatch(int socket, rtsp_conn_t *conn, const rtsp_request_t *req) {
+  size_t raw_len = req->header_len + req->body_len;
 
   // Find handler in dispatch table
   for (const rtsp_method_handler_t *h = method_handlers; h->method; h++) {
-    if (strcasecmp(req.method, h->method) == 0) {
-      h->handler(socket, conn, &req, raw_request, raw_len);
+    if (strcasecmp(req->method, h->method) == 0) {
+      h->handler(socket, conn, req, req->raw, raw_len);
       return 0;
     }
   }
 
-  ESP_LOGW(TAG, "Unknown method: %s", req.method);
+  ESP_LOGW(TAG, "Unknown method: %s", req->method);
   rtsp_send_http_response(socket, conn, 501, "Not Implemented", "text/plain",
                           "Not Implemented", 15);
   return 0;
@@ -479,56 +621,8 @@ static void handle_get(int socket, rtsp_conn_t *conn, const rtsp_request_t *req,
   (void)raw_len;
 
   if (strcmp(req->path, "/info") == 0) {
-    // Build info response
-    char device_id[18];
-    char device_name[65];
-    static char body[4096];
-    plist_t p;
-
-    rtsp_get_device_id(device_id, sizeof(device_id));
-    settings_get_device_name(device_name, sizeof(device_name));
-    const uint8_t *pk = hap_get_public_key();
-    uint64_t features =
-        ((uint64_t)AIRPLAY_FEATURES_HI << 32) | AIRPLAY_FEATURES_LO;
-
-    plist_init(&p, body, sizeof(body));
-    plist_begin(&p);
-    plist_dict_begin(&p);
-
-    plist_dict_string(&p, "deviceid", device_id);
-    plist_dict_uint(&p, "features", features);
-    plist_dict_string(&p, "model", "AudioAccessory5,1");
-    plist_dict_string(&p, "protovers", "1.1");
-    plist_dict_string(&p, "srcvers", "377.40.00");
-    plist_dict_int(&p, "vv", 2);
-    plist_dict_int(&p, "statusFlags", 4);
-    plist_dict_data(&p, "pk", pk, 32);
-    plist_dict_string(&p, "pi", "00000000-0000-0000-0000-000000000000");
-    plist_dict_string(&p, "name", device_name);
-
-    // Audio formats array
-    plist_dict_array_begin(&p, "audioFormats");
-    plist_dict_begin(&p);
-    plist_dict_int(&p, "type", 96);
-    plist_dict_int(&p, "audioInputFormats", 0x01000000);
-    plist_dict_int(&p, "audioOutputFormats", 0x01000000);
-    plist_dict_end(&p);
-    plist_array_end(&p);
-
-    // Audio latencies array
-    plist_dict_array_begin(&p, "audioLatencies");
-    plist_dict_begin(&p);
-    plist_dict_int(&p, "type", 96);
-    plist_dict_int(&p, "audioType", 0x64);
-    plist_dict_int(&p, "inputLatencyMicros", 0);
-    plist_dict_int(&p, "outputLatencyMicros",
-                   audio_receiver_get_output_latency_us());
-    plist_dict_end(&p);
-    plist_array_end(&p);
-
-    plist_dict_end(&p);
-    size_t body_len = plist_end(&p);
-
+    size_t body_len = 0;
+    const char *body = get_info_response(&body_len);
     rtsp_send_http_response(socket, conn, 200, "OK", "text/x-apple-plist+xml",
                             body, body_len);
   } else {
@@ -569,6 +663,7 @@ static void handle_post(int socket, rtsp_conn_t *conn,
     size_t response_len = 0;
     esp_err_t err = ESP_FAIL;
 
+    int64_t boost = power_mgmt_pairing_begin(); // SRP and curve maths
     if (body && body_len > 0) {
       size_t state_len;
       const uint8_t *state =
@@ -593,6 +688,7 @@ static void handle_post(int socket, rtsp_conn_t *conn,
         }
       }
     }
+    power_mgmt_pairing_end(boost);
 
     if (err == ESP_OK && response_len > 0) {
       rtsp_send_response(socket, conn, 200, "OK", req->cseq,
@@ -634,6 +730,7 @@ static void handle_post(int socket, rtsp_conn_t *conn,
     size_t response_len = 0;
     esp_err_t err = ESP_FAIL;
 
+    int64_t boost = power_mgmt_pairing_begin(); // X25519 and Ed25519
     if (body && body_len > 0) {
       size_t state_len;
       const uint8_t *state =
@@ -668,6 +765,7 @@ static void handle_post(int socket, rtsp_conn_t *conn,
         }
       }
     }
+    power_mgmt_pairing_end(boost);
 
     if (err == ESP_OK && response_len > 0) {
       rtsp_send_response(socket, conn, 200, "OK", req->cseq,
@@ -701,29 +799,27 @@ static void handle_post(int socket, rtsp_conn_t *conn,
                        "Content-Type: application/octet-stream\r\n", "\x00", 1);
 
   } else if (strstr(req->path, "/command")) {
-    if (body && body_len >= 8 && memcmp(body, "bplist00", 8) == 0) {
-      int64_t cmd_type = 0;
-      if (bplist_find_int(body, body_len, "type", &cmd_type)) {
-        ESP_LOGI(TAG, "/command type=%lld", (long long)cmd_type);
-      }
+    const bplist_doc_t *plist = parse_body_plist(conn, req);
+    int64_t cmd_type = 0;
+    if (plist && bplist_node_int(bplist_get(plist, NULL, "type"), &cmd_type)) {
+      ESP_LOGI(TAG, "/command type=%lld", (long long)cmd_type);
     }
     rtsp_send_ok(socket, conn, req->cseq);
 
   } else if (strstr(req->path, "/feedback")) {
-    if (body && body_len >= 8 && memcmp(body, "bplist00", 8) == 0) {
-      int64_t value;
-      if (bplist_find_int(body, body_len, "networkTimeSecs", &value)) {
-        ESP_LOGI(TAG, "/feedback has networkTimeSecs=%lld", (long long)value);
-      }
+    const bplist_doc_t *plist = parse_body_plist(conn, req);
+    int64_t value;
+    if (plist &&
+        bplist_node_int(bplist_get(plist, NULL, "networkTimeSecs"), &value)) {
+      ESP_LOGI(TAG, "/feedback has networkTimeSecs=%lld", (long long)value);
     }
 
     // For buffered audio streams (type 103), send a proper feedback response
     // with stream status. This acts as a keepalive to prevent iPhone from
     // sending TEARDOWN during extended pause.
     if (conn->stream_type == 103) {
-      uint8_t response[128];
-      size_t response_len = bplist_build_feedback_response(
-          response, sizeof(response), conn->stream_type, 44100.0);
+      size_t response_len = 0;
+      const uint8_t *response = get_feedback_response(&response_len);
 
       if (response_len > 0) {
         ESP_LOGD(
@@ -812,10 +908,33 @@ static void parse_sdp(rtsp_conn_t *conn, const char *sdp, size_t len) {
     }
   }
 
-  if ((strstr(format.codec, "AAC") || strstr(format.codec, "aac") ||
-       strstr(format.codec, "mpeg4-generic") ||
-       strstr(format.codec, "MPEG4-GENERIC")) &&
-      format.max_samples_per_frame == 0) {
+  bool is_aac = strstr(format.codec, "AAC") || strstr(format.codec, "aac") ||
+                strstr(format.codec, "mpeg4-generic") ||
+                strstr(format.codec, "MPEG4-GENERIC");
+  const char *asc = fmtp ? strstr(fmtp, "config=") : NULL;
+  if (is_aac && asc) {
+    // AudioSpecificConfig as hex; the decoder is opened from it once
+    asc += strlen("config=");
+    unsigned int byte;
+    while (format.aac_config_len < sizeof(format.aac_config) &&
+           isxdigit((unsigned char)asc[0]) &&
+           isxdigit((unsigned char)asc[1]) && sscanf(asc, "%2x", &byte) == 1) {
+      format.aac_config[format.aac_config_len++] = (uint8_t)byte;
+      asc += 2;
+    }
+  }
+  if (is_aac && fmtp &&
+      (strstr(fmtp, "mode=AAC-eld") || strstr(fmtp, "mode=AAC-ELD"))) {
+    // Low-delay AAC: "constantDuration" gives the 480/512 frame length
+    unsigned int duration = 480;
+    const char *cd = strstr(fmtp, "constantDuration=");
+    if (cd) {
+      sscanf(cd, "constantDuration=%u", &duration);
+    }
+    strcpy(format.codec, "AAC-ELD");
+    format.frame_size = (int)duration;
+    format.max_samples_per_frame = duration;
+  } else if (is_aac && format.max_samples_per_frame == 0) {
     format.frame_size = 1024;
     format.max_samples_per_frame = 1024;
   }
@@ -826,10 +945,10 @@ static void parse_sdp(rtsp_conn_t *conn, const char *sdp, size_t len) {
   conn->channels = format.channels;
   conn->bits_per_sample = format.bits_per_sample;
 
-  audio_receiver_set_format(&format);
+  conn_set_format(conn, &format);
 
   if (encrypt.type != AUDIO_ENCRYPT_NONE) {
-    audio_receiver_set_encryption(&encrypt);
+    conn_set_encryption(conn, &encrypt);
   }
 }
 
@@ -852,86 +971,79 @@ static void handle_setup(int socket, rtsp_conn_t *conn,
   (void)raw;
   (void)raw_len;
 
-  const uint8_t *body = req->body;
-  size_t body_len = req->body_len;
-
   bool is_bplist =
       strstr(req->content_type, "application/x-apple-binary-plist") != NULL;
+  const bplist_doc_t *plist = parse_body_plist(conn, req);
 
   // Check for streams array
-  bool request_has_streams = false;
-  size_t stream_count = 0;
-  if (body && body_len >= 8 && memcmp(body, "bplist00", 8) == 0) {
-    if (bplist_get_streams_count(body, body_len, &stream_count)) {
-      request_has_streams = true;
-    }
-  }
+  const bplist_node_t *streams = bplist_get(plist, NULL, "streams");
+  bool request_has_streams = streams && streams->type == BPLIST_VALUE_ARRAY;
+  size_t stream_count = request_has_streams ? streams->len : 0;
 
   ESP_LOGI(TAG, "SETUP: has_streams=%d, stream_count=%zu", request_has_streams,
            stream_count);
 
-  if (body && body_len > 0 && is_bplist && request_has_streams) {
+  // Stream dict whose "type" matches, for its per-stream crypto fields
+  const bplist_node_t *crypto_stream = NULL;
+  int64_t crypto_stream_type = conn->stream_type > 0 ? conn->stream_type : 96;
+
+  if (is_bplist && request_has_streams) {
     for (size_t i = 0; i < stream_count; i++) {
+      const bplist_node_t *stream = bplist_item(plist, streams, i);
       int64_t stream_type = -1;
-      size_t ekey_len = 0, eiv_len = 0, shk_len = 0;
-      if (bplist_get_stream_info(body, body_len, i, &stream_type, &ekey_len,
-                                 &eiv_len, &shk_len)) {
-        if (i == 0) {
-          conn->stream_type = stream_type;
+      if (!stream || stream->type != BPLIST_VALUE_DICT) {
+        continue;
+      }
+      bplist_node_int(bplist_get(plist, stream, "type"), &stream_type);
+      if (i == 0) {
+        conn->stream_type = stream_type;
+        if (conn_is_live(conn)) {
           audio_receiver_set_stream_type((audio_stream_type_t)stream_type);
         }
+        crypto_stream_type = stream_type > 0 ? stream_type : 96;
+      }
+      if (!crypto_stream && stream_type == crypto_stream_type) {
+        crypto_stream = stream;
+      }
 
-        bplist_kv_info_t kv[16];
-        size_t kv_count = 0;
-        int64_t codec_type = -1;
-        int64_t sample_rate = 44100;
-        int64_t samples_per_frame = 352;
-
-        if (bplist_get_stream_kv_info(body, body_len, i, kv, 16, &kv_count)) {
-          for (size_t k = 0; k < kv_count; k++) {
-            if (kv[k].value_type == BPLIST_VALUE_INT) {
-              if (strcmp(kv[k].key, "ct") == 0) {
-                codec_type = kv[k].int_value;
-              } else if (strcmp(kv[k].key, "sr") == 0) {
-                sample_rate = kv[k].int_value;
-              } else if (strcmp(kv[k].key, "spf") == 0) {
-                samples_per_frame = kv[k].int_value;
-              } else if (strcmp(kv[k].key, "controlPort") == 0) {
-                conn->client_control_port = (uint16_t)kv[k].int_value;
-              }
-            }
-          }
-
-          // Use codec registry to configure audio format
-          audio_format_t format = {0};
-          rtsp_codec_configure(codec_type, &format, sample_rate,
-                               samples_per_frame);
-          audio_receiver_set_format(&format);
-        }
+      int64_t codec_type = -1;
+      int64_t sample_rate = 44100;
+      int64_t samples_per_frame = 0; // Codec default unless "spf" is sent
+      int64_t control_port;
+      bplist_node_int(bplist_get(plist, stream, "ct"), &codec_type);
+      bplist_node_int(bplist_get(plist, stream, "sr"), &sample_rate);
+      bplist_node_int(bplist_get(plist, stream, "spf"), &samples_per_frame);
+      if (bplist_node_int(bplist_get(plist, stream, "controlPort"),
+                          &control_port)) {
+        conn->client_control_port = (uint16_t)control_port;
       }
+
+      // Use codec registry to configure audio format
+      audio_format_t format = {0};
+      rtsp_codec_configure(codec_type, &format, sample_rate,
+                           samples_per_frame);
+      conn_set_format(conn, &format);
     }
   }
 
   // Process encryption keys
-  if (body && body_len > 0) {
-    uint8_t ekey_encrypted[64];
+  if (req->body && req->body_len > 0) {
+    const uint8_t *ekey_encrypted = NULL;
     size_t ekey_len = 0;
-    uint8_t eiv[16];
+    const uint8_t *eiv = NULL;
     size_t eiv_len = 0;
-    uint8_t shk[32];
+    const uint8_t *shk = NULL;
     size_t shk_len = 0;
 
-    int64_t crypto_stream_type = conn->stream_type > 0 ? conn->stream_type : 96;
-    bool has_stream_crypto = bplist_find_stream_crypto(
-        body, body_len, crypto_stream_type, ekey_encrypted,
-        sizeof(ekey_encrypted), &ekey_len, eiv, sizeof(eiv), &eiv_len, shk,
-        sizeof(shk), &shk_len);
-
-    if (!has_stream_crypto || (ekey_len == 0 && shk_len == 0)) {
-      bplist_find_data_deep(body, body_len, "ekey", ekey_encrypted,
-                            sizeof(ekey_encrypted), &ekey_len);
-      bplist_find_data_deep(body, body_len, "eiv", eiv, sizeof(eiv), &eiv_len);
-      bplist_find_data_deep(body, body_len, "shk", shk, sizeof(shk), &shk_len);
+    bplist_node_data(bplist_get(plist, crypto_stream, "ekey"), &ekey_encrypted,
+                     &ekey_len);
+    bplist_node_data(bplist_get(plist, crypto_stream, "eiv"), &eiv, &eiv_len);
+    bplist_node_data(bplist_get(plist, crypto_stream, "shk"), &shk, &shk_len);
+
+    if (!crypto_stream || (ekey_len == 0 && shk_len == 0)) {
+      bplist_node_data(bplist_find(plist, "ekey"), &ekey_encrypted, &ekey_len);
+      bplist_node_data(bplist_find(plist, "eiv"), &eiv, &eiv_len);
+      bplist_node_data(bplist_find(plist, "shk"), &shk, &shk_len);
     }
 
     audio_encrypt_t audio_encrypt = {0};
@@ -944,9 +1056,11 @@ static void handle_setup(int socket, rtsp_conn_t *conn,
       if (eiv_len >= 16) {
         memcpy(audio_encrypt.iv, eiv, 16);
       }
-      audio_receiver_set_encryption(&audio_encrypt);
+      conn_set_encryption(conn, &audio_encrypt);
       encryption_set = true;
-    } else if (ekey_len > 16 && conn->hap_session &&
+    } else if (ekey_len > 16 &&
+               ekey_len <= 32 + crypto_aead_chacha20poly1305_ietf_ABYTES &&
+               conn->hap_session &&
                conn->hap_session->session_established) {
       uint8_t nonce[12] = {0};
       uint8_t decrypted_key[32];
@@ -963,7 +1077,7 @@ static void handle_setup(int socket, rtsp_conn_t *conn,
         if (eiv_len >= 16) {
           memcpy(audio_encrypt.iv, eiv, 16);
         }
-        audio_receiver_set_encryption(&audio_encrypt);
+        conn_set_encryption(conn, &audio_encrypt);
         encryption_set = true;
       }
     }
@@ -977,7 +1091,7 @@ static void handle_setup(int socket, rtsp_conn_t *conn,
         if (eiv_len >= 16) {
           memcpy(audio_encrypt.iv, eiv, 16);
         }
-        audio_receiver_set_encryption(&audio_encrypt);
+        conn_set_encryption(conn, &audio_encrypt);
       }
     }
   }
@@ -985,7 +1099,7 @@ static void handle_setup(int socket, rtsp_conn_t *conn,
   // Create event port if needed
   if (conn->event_port == 0) {
     conn->event_socket = rtsp_create_event_socket(&conn->event_port);
-    if (conn->event_socket >= 0) {
+    if (conn->event_socket >= 0 && conn_is_live(conn)) {
       rtsp_start_event_port_task(conn->event_socket);
       ESP_LOGI(TAG, "SETUP: Created event port %u", conn->event_port);
     }
@@ -1042,7 +1156,7 @@ static void handle_setup(int socket, rtsp_conn_t *conn,
     uint8_t plist_body[256];
     size_t plist_len = bplist_build_stream_setup(
         plist_body, sizeof(plist_body), stream_type, response_data_port,
-        conn->control_port, AP2_AUDIO_BUFFER_SIZE);
+        conn->control_port, mem_budget_profile()->stream_buffer_bytes);
     if (plist_len == 0) {
       rtsp_send_response(socket, conn, 500, "Internal Error", req->cseq, NULL,
                          NULL, 0);
@@ -1055,13 +1169,14 @@ static void handle_setup(int socket, rtsp_conn_t *conn,
                        (const char *)plist_body, plist_len);
   } else {
     // AirPlay 1: Parse client's ports from Transport header
-    rtsp_parse_transport((const char *)raw, &conn->client_control_port,
+    rtsp_parse_transport(req, &conn->client_control_port,
                          &conn->client_timing_port);
     ESP_LOGI(TAG, "Client ports: control=%u timing=%u",
              conn->client_control_port, conn->client_timing_port);
 
     // Start NTP timing client if client has a timing port
-    if (conn->client_timing_port > 0 && conn->client_ip != 0) {
+    if (conn->client_timing_port > 0 && conn->client_ip != 0 &&
+        conn_is_live(conn)) {
       ntp_clock_start_client(conn->client_ip, conn->client_timing_port);
     }
 
@@ -1075,6 +1190,13 @@ static void handle_setup(int socket, rtsp_conn_t *conn,
                        NULL, 0);
   }
 
+  if (!conn_is_live(conn)) {
+    // Started by RECORD, which takes over first
+    conn->stream_paused = false;
+    conn->stream_active = true;
+    return;
+  }
+
   // Start audio receiver
   audio_receiver_set_stream_type((audio_stream_type_t)stream_type);
   audio_receiver_start_stream(conn->data_port, conn->control_port,
@@ -1152,6 +1274,7 @@ static void handle_set_parameter(int socket, rtsp_conn_t *conn,
       if (vol) {
         float volume = (float)atof(vol + 7);
         rtsp_conn_set_volume(conn, volume);
+        rtsp_events_emit_volume(volume);
       }
 
       const char *prog = strstr(params, "progress:");
@@ -1175,67 +1298,48 @@ static void handle_set_parameter(int socket, rtsp_conn_t *conn,
 #if CONFIG_RTSP_METADATA_DEBUG
       log_body_snippet("dmap", body, body_len);
 #endif
-      char title[128] = {0};
-      char album[128] = {0};
-      char artist[128] = {0};
-
-      dmap_find_string(body, body_len, "minm", title, sizeof(title));
-      dmap_find_string(body, body_len, "asal", album, sizeof(album));
-      dmap_find_string(body, body_len, "asar", artist, sizeof(artist));
-
-      // 1602 LCD can't reliably show UTF-8; prefer ASCII fields if available.
-      const char *best = NULL;
-      if (is_all_ascii_printable(title)) {
-        best = title;
-      } else if (is_all_ascii_printable(album)) {
-        best = album;
-      } else if (is_all_ascii_printable(artist)) {
-        best = artist;
-      } else if (title[0]) {
-        best = title;
-      } else if (album[0]) {
-        best = album;
-      } else if (artist[0]) {
-        best = artist;
-      }
-
-      if (best) {
+      rtsp_now_playing_t np = {0};
+      dmap_parse_now_playing(body, body_len, &np, 0);
 #if CONFIG_RTSP_METADATA_DEBUG
-        ESP_LOGI(TAG, "dmap best(title)='%s' (minm='%s' asal='%s' asar='%s')",
-                 best, title, album, artist);
+      ESP_LOGI(TAG,
+               "dmap title='%s' album='%s' artist='%s' genre='%s' track=%u/%u "
+               "duration=%" PRIu32 " ms",
+               np.title, np.album, np.artist, np.genre, np.track_number,
+               np.track_count, np.duration_ms);
 #endif
-        lcd_now_playing_set_title(best);
-      }
+      rtsp_events_publish_now_playing(&np);
     }
   } else if (strstr(req->content_type, "application/x-apple-binary-plist")) {
     if (body && body_len >= 8 && memcmp(body, "bplist00", 8) == 0) {
 #if CONFIG_RTSP_METADATA_DEBUG
       log_body_snippet("bplist", body, body_len);
 #endif
+      const bplist_doc_t *plist = parse_body_plist(conn, req);
       int64_t value;
-      if (bplist_find_int(body, body_len, "networkTimeSecs", &value)) {
+      if (bplist_node_int(bplist_get(plist, NULL, "networkTimeSecs"),
+                          &value)) {
         ESP_LOGI(TAG, "SET_PARAMETER has networkTimeSecs=%lld",
                  (long long)value);
       }
       double rate;
-      if (bplist_find_real(body, body_len, "rate", &rate)) {
+      if (bplist_node_real(bplist_get(plist, NULL, "rate"), &rate)) {
         ESP_LOGI(TAG, "SET_PARAMETER has rate=%.2f", rate);
         lcd_now_playing_set_rate(rate);
       }
 
-      char title[128];
-      if (bplist_find_string_deep(body, body_len, "title", title,
-                                  sizeof(title)) ||
-          bplist_find_string_deep(body, body_len, "trackName", title,
-                                  sizeof(title)) ||
-          bplist_find_string_deep(body, body_len, "itemName", title,
-                                  sizeof(title)) ||
-          bplist_find_string_deep(body, body_len, "name", title,
-                                  sizeof(title))) {
+      rtsp_now_playing_t np = {0};
+      if (bplist_node_string(bplist_find(plist, "title"), np.title,
+                             sizeof(np.title)) ||
+          bplist_node_string(bplist_find(plist, "trackName"), np.title,
+                             sizeof(np.title)) ||
+          bplist_node_string(bplist_find(plist, "itemName"), np.title,
+                             sizeof(np.title)) ||
+          bplist_node_string(bplist_find(plist, "name"), np.title,
+                             sizeof(np.title))) {
 #if CONFIG_RTSP_METADATA_DEBUG
-        ESP_LOGI(TAG, "bplist title='%s'", title);
+        ESP_LOGI(TAG, "bplist title='%s'", np.title);
 #endif
-        lcd_now_playing_set_title(title);
+        rtsp_events_publish_now_playing(&np);
       }
     }
   } else {
@@ -1292,6 +1396,33 @@ static void handle_flush(int socket, rtsp_conn_t *conn,
   (void)raw;
   (void)raw_len;
 
+  // FLUSHBUFFERED with flushUntilTS (seek, skip) drops one span of the
+  // buffered stream and keeps what surrounds it queued
+  const bplist_doc_t *plist = parse_body_plist(conn, req);
+  int64_t until_ts;
+  if (bplist_node_int(bplist_get(plist, NULL, "flushUntilTS"), &until_ts)) {
+    int64_t from_ts = 0;
+    int64_t from_seq = -1;
+    int64_t until_seq = -1;
+    bool has_from =
+        bplist_node_int(bplist_get(plist, NULL, "flushFromTS"), &from_ts);
+    bplist_node_int(bplist_get(plist, NULL, "flushFromSeq"), &from_seq);
+    bplist_node_int(bplist_get(plist, NULL, "flushUntilSeq"), &until_seq);
+    ESP_LOGI(TAG, "Partial flush: ts %s%" PRIu32 " to %" PRIu32
+                  " (seq %" PRId64 " to %" PRId64 ")",
+             has_from ? "" : "<", (uint32_t)from_ts, (uint32_t)until_ts,
+             from_seq, until_seq);
+
+    audio_receiver_flush_range(has_from, (uint32_t)from_ts,
+                               (uint32_t)until_ts);
+    // Only a flush from the head makes what is in the DMA stale
+    if (!has_from) {
+      audio_output_flush();
+    }
+    rtsp_send_ok(socket, conn, req->cseq);
+    return;
+  }
+
   audio_receiver_flush();
   audio_output_flush();
   rtsp_send_ok(socket, conn, req->cseq);
@@ -1303,15 +1434,15 @@ static void handle_teardown(int socket, rtsp_conn_t *conn,
   (void)raw;
   (void)raw_len;
 
-  const uint8_t *body = req->body;
-  size_t body_len = req->body_len;
-  bool has_streams = false;
-  size_t stream_count = 0;
+  const bplist_doc_t *plist = parse_body_plist(conn, req);
+  const bplist_node_t *streams = bplist_get(plist, NULL, "streams");
+  bool has_streams = streams && streams->type == BPLIST_VALUE_ARRAY;
 
-  if (body && body_len >= 8 && memcmp(body, "bplist00", 8) == 0) {
-    if (bplist_get_streams_count(body, body_len, &stream_count)) {
-      has_streams = true;
-    }
+  if (!conn_is_live(conn)) {
+    // The sender gave up before going live; nothing reached the pipeline
+    conn->stream_active = false;
+    rtsp_send_ok(socket, conn, req->cseq);
+    return;
   }
 
   // TEARDOWN with streams = stream teardown (may be followed by new SETUP)
@@ -1338,35 +1469,31 @@ static void handle_setrateanchortime(int socket, rtsp_conn_t *conn,
   (void)raw;
   (void)raw_len;
 
-  const uint8_t *body = req->body;
-  size_t body_len = req->body_len;
+  const bplist_doc_t *plist = parse_body_plist(conn, req);
 
   double rate = 1.0;
+  bool anchored = false;
+  uint64_t network_time_ns = 0;
   uint64_t clock_id = 0;
   uint64_t network_time_secs = 0;
   uint64_t network_time_frac = 0;
   uint64_t rtp_time = 0;
 
-  if (body && body_len > 0 && body_len >= 8 &&
-      memcmp(body, "bplist00", 8) == 0) {
-    if (!bplist_find_real(body, body_len, "rate", &rate)) {
-      int64_t rate_int;
-      if (bplist_find_int(body, body_len, "rate", &rate_int)) {
-        rate = (double)rate_int;
-      }
-    }
+  if (plist) {
+    bplist_node_real(bplist_get(plist, NULL, "rate"), &rate);
 
     int64_t value;
-    if (bplist_find_int(body, body_len, "networkTimeTimelineID", &value)) {
+    if (bplist_node_int(bplist_get(plist, NULL, "networkTimeTimelineID"),
+                        &value)) {
       clock_id = (uint64_t)value;
     }
-    if (bplist_find_int(body, body_len, "networkTimeSecs", &value)) {
+    if (bplist_node_int(bplist_get(plist, NULL, "networkTimeSecs"), &value)) {
       network_time_secs = (uint64_t)value;
     }
-    if (bplist_find_int(body, body_len, "networkTimeFrac", &value)) {
+    if (bplist_node_int(bplist_get(plist, NULL, "networkTimeFrac"), &value)) {
       network_time_frac = (uint64_t)value;
     }
-    if (bplist_find_int(body, body_len, "rtpTime", &value)) {
+    if (bplist_node_int(bplist_get(plist, NULL, "rtpTime"), &value)) {
       rtp_time = (uint64_t)value;
     }
 
@@ -1377,48 +1504,172 @@ static void handle_setrateanchortime(int socket, rtsp_conn_t *conn,
     if (network_time_secs != 0 && rtp_time != 0) {
       uint64_t frac = network_time_frac >> 32;
       frac = (frac * 1000000000ULL) >> 32;
-      uint64_t network_time_ns = network_time_secs * 1000000000ULL + frac;
-      audio_receiver_set_anchor_time(clock_id, network_time_ns,
-                                     (uint32_t)rtp_time);
+      network_time_ns = network_time_secs * 1000000000ULL + frac;
+      anchored = true;
     }
   }
 
+  // With an anchor the rate change is an exact re-anchor of the timeline:
+  // the buffer stays frozen in place over a pause and resumes on the
+  // sample the sender names. Without one, fall back to pause offsets.
   if (rate == 0.0) {
     ESP_LOGI(TAG, "SETRATEANCHORTIME: rate=0 -> PAUSING");
     conn->stream_paused = true;
-    audio_receiver_flush();
-    audio_receiver_set_playing(false);
+    if (anchored) {
+      audio_receiver_set_rate_anchor(false, clock_id, network_time_ns,
+                                     (uint32_t)rtp_time);
+    } else {
+      audio_receiver_flush();
+      audio_receiver_set_playing(false);
+    }
     audio_output_flush();
     rtsp_events_emit(RTSP_EVENT_PAUSED);
   } else {
     ESP_LOGI(TAG, "SETRATEANCHORTIME: rate=%.1f -> RESUMING (was_paused=%d)",
              rate, conn->stream_paused);
     conn->stream_paused = false;
-    audio_receiver_set_playing(true);
+    if (anchored) {
+      audio_receiver_set_rate_anchor(true, clock_id, network_time_ns,
+                                     (uint32_t)rtp_time);
+    } else {
+      audio_receiver_set_playing(true);
+    }
     rtsp_events_emit(RTSP_EVENT_PLAYING);
   }
 
   rtsp_send_ok(socket, conn, req->cseq);
 }
 
+typedef struct {
+  uint32_t addrs[RTSP_PEERS_MAX];
+  size_t count;
+} peer_list_t;
+
+static void add_peer_address(peer_list_t *peers, const bplist_node_t *node) {
+  char value[64];
+  struct in_addr addr;
+  if (!bplist_node_string(node, value, sizeof(value))) {
+    return;
+  }
+  // Only dotted quads; PTP runs on IPv4 here, IPv6 peers are skipped
+  if (strchr(value, ':') || !strchr(value, '.') ||
+      inet_aton(value, &addr) == 0) {
+    return;
+  }
+  for (size_t i = 0; i < peers->count; i++) {
+    if (peers->addrs[i] == addr.s_addr) {
+      return;
+    }
+  }
+  if (peers->count < sizeof(peers->addrs) / sizeof(peers->addrs[0])) {
+    peers->addrs[peers->count++] = addr.s_addr;
+  }
+}
+
 static void handle_setpeers(int socket, rtsp_conn_t *conn,
                             const rtsp_request_t *req, const uint8_t *raw,
                             size_t raw_len) {
   (void)raw;
   (void)raw_len;
 
-  const uint8_t *body = req->body;
-  size_t body_len = req->body_len;
-
-  ESP_LOGI(TAG, "%s: body_len=%zu", req->method, body_len);
-  if (body && body_len >= 8 && memcmp(body, "bplist00", 8) == 0) {
-    ESP_LOGI(TAG, "SETPEERS: got bplist");
+  // SETPEERS carries an array of address strings, SETPEERSX an array of
+  // peer dicts with an "Addresses" array each
+  const bplist_doc_t *plist = parse_body_plist(conn, req);
+  const bplist_node_t *list = plist ? &plist->nodes[0] : NULL;
+  peer_list_t peers = {0};
+  for (size_t i = 0; list && i < list->len; i++) {
+    const bplist_node_t *item = bplist_item(plist, list, i);
+    if (!item) {
+      break;
+    }
+    if (item->type == BPLIST_VALUE_STRING) {
+      add_peer_address(&peers, item);
+      continue;
+    }
+    const bplist_node_t *addresses = bplist_get(plist, item, "Addresses");
+    for (size_t a = 0; addresses && a < addresses->len; a++) {
+      add_peer_address(&peers, bplist_item(plist, addresses, a));
+    }
   }
+  ESP_LOGI(TAG, "%s: %zu IPv4 peers", req->method, peers.count);
+
+#if CONFIG_RTSP_FAST_TAKEOVER
+  if (conn->standby) {
+    // The clock follows the playing group until this session goes live
+    memcpy(conn->staged.peers, peers.addrs, sizeof(conn->staged.peers));
+    conn->staged.peer_count = peers.count;
+    conn->staged.has_peers = true;
+    rtsp_send_ok(socket, conn, req->cseq);
+    return;
+  }
+#endif
 
-  // Reset audio timing anchor when PTP peers change
-  // The PTP clock master may change, invalidating the current anchor
-  ESP_LOGI(TAG, "SETPEERS: Resetting timing anchor (PTP peers changed)");
-  audio_receiver_reset_timing();
+  // The anchor stays valid: if the group's grandmaster changes, the PTP
+  // clock re-derives its offset on the new timeline
+  ptp_clock_set_peers(peers.addrs, peers.count);
 
   rtsp_send_ok(socket, conn, req->cseq);
 }
+
+#if CONFIG_RTSP_FAST_TAKEOVER
+bool rtsp_request_takes_over(rtsp_conn_t *conn, const rtsp_request_t *req) {
+  static const char *const live_methods[] = {
+      "RECORD", "SET_PARAMETER", "PAUSE", "FLUSH", "FLUSHBUFFERED",
+      "SETRATEANCHORTIME"};
+  if (!conn || !conn->standby) {
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(live_methods) / sizeof(live_methods[0]);
+       i++) {
+    if (strcasecmp(req->method, live_methods[i]) == 0) {
+      return true;
+    }
+  }
+  if (strcasecmp(req->method, "SETUP") != 0) {
+    return false;
+  }
+
+  // A buffered stream's TCP port has to listen as soon as the reply names
+  // it, so that SETUP cannot wait for RECORD
+  const bplist_doc_t *plist = parse_body_plist(conn, req);
+  const bplist_node_t *stream =
+      bplist_item(plist, bplist_get(plist, NULL, "streams"), 0);
+  int64_t stream_type = conn->stream_type > 0 ? conn->stream_type : 96;
+  bplist_node_int(bplist_get(plist, stream, "type"), &stream_type);
+  return stream && audio_stream_uses_buffer((audio_stream_type_t)stream_type);
+}
+
+void rtsp_conn_go_live(rtsp_conn_t *conn) {
+  if (!conn || !conn->standby) {
+    return;
+  }
+  conn->standby = false;
+
+  // The decoder and buffers are still warm from the stream that just
+  // stopped; a compatible format reuses them
+  if (conn->stream_type > 0) {
+    audio_receiver_set_stream_type((audio_stream_type_t)conn->stream_type);
+  }
+  if (conn->staged.has_format) {
+    audio_receiver_set_format(&conn->staged.format);
+  }
+  if (conn->staged.has_encrypt) {
+    audio_receiver_set_encryption(&conn->staged.encrypt);
+  }
+  if (conn->staged.has_peers) {
+    ptp_clock_set_peers(conn->staged.peers, conn->staged.peer_count);
+  }
+  if (conn->client_control_port > 0 && conn->client_ip != 0) {
+    audio_receiver_set_client_control(conn->client_ip,
+                                      conn->client_control_port);
+  }
+  if (conn->client_timing_port > 0 && conn->client_ip != 0) {
+    ntp_clock_start_client(conn->client_ip, conn->client_timing_port);
+  }
+  if (conn->event_socket >= 0) {
+    rtsp_start_event_port_task(conn->event_socket);
+  }
+  audio_volume_set_q15(conn->volume_q15);
+  memset(&conn->staged, 0, sizeof(conn->staged));
+}
+#endif
@@ -18,9 +18,6 @@
 #define AIRPLAY_FEATURES_HI 0x1C340
 #define AIRPLAY_FEATURES_LO 0x405C4A00
 
-// Audio buffer size for buffered streams (type 103)
-#define AP2_AUDIO_BUFFER_SIZE (1 * 1024 * 1024)
-
 // Include for audio_format_t
 #include "audio_receiver.h"
 
@@ -30,6 +27,7 @@
 typedef struct {
   const char *name; // Codec name: "ALAC", "AAC", "OPUS"
   int64_t type_id;  // bplist "ct" value (2=ALAC, 4=AAC, 8=AAC-ELD)
+  int64_t default_spf; // Samples per frame when SETUP carries no "spf"
 } rtsp_codec_t;
 
 /**
@@ -38,7 +36,7 @@ typedef struct {
  * @param type_id Codec type from bplist "ct" field
  * @param fmt Audio format struct to configure
  * @param sample_rate Sample rate from bplist
- * @param samples_per_frame Samples per frame from bplist
+ * @param samples_per_frame Samples per frame from bplist, or 0 if absent
  * @return true if codec found and configured, false otherwise
  */
 bool rtsp_codec_configure(int64_t type_id, audio_format_t *fmt,
@@ -63,12 +61,10 @@ typedef struct {
  * Dispatch RTSP request to appropriate handler
  * @param socket Client socket
  * @param conn Connection state
- * @param raw_request Raw request data
- * @param raw_len Length of raw request
+ * @param req Complete request from rtsp_request_parse()
  * @return 0 on success, -1 on error
  */
-int rtsp_dispatch(int socket, rtsp_conn_t *conn, const uint8_t *raw_request,
-                  size_t raw_len);
+int rtsp_dispatch(int socket, rtsp_conn_t *conn, const rtsp_request_t *req);
 
 /**
  * Get device ID string (MAC address format)
@@ -80,3 +76,19 @@ void rtsp_get_device_id(char *device_id, size_t len);
 // Event port task management
 void rtsp_start_event_port_task(int listen_socket);
 void rtsp_stop_event_port_task(void);
+
+#if CONFIG_RTSP_FAST_TAKEOVER
+/**
+ * Whether a standby session has to take over the pipeline before req is
+ * handled: at RECORD, or earlier for requests that act on the stream
+ * (volume and metadata, flushes, rate changes, a buffered stream's SETUP).
+ */
+bool rtsp_request_takes_over(rtsp_conn_t *conn, const rtsp_request_t *req);
+
+/**
+ * Hand the pipeline to a standby session once the live one has stopped:
+ * apply the format, keys and PTP peers its ANNOUNCE, SETUP and SETPEERS
+ * left, and start its event and timing channels.
+ */
+void rtsp_conn_go_live(rtsp_conn_t *conn);
+#endif
@@ -1,9 +1,10 @@
 #include "rtsp_message.h"
 
 #include <ctype.h>
-#include <stdio.h>
-#include <stdlib.h>
+#include <limits.h>
+#include <stdbool.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/socket.h>
 
 #include "esp_log.h"
@@ -11,208 +12,290 @@
 
 static const char *TAG = "rtsp_message";
 
-static const char *find_header_ci(const char *headers, const char *key) {
-  if (!headers || !key) {
-    return NULL;
-  }
-
-  size_t key_len = strlen(key);
-  if (key_len == 0) {
-    return NULL;
-  }
+static bool name_equals(const uint8_t *data, const rtsp_header_t *h,
+                        const char *name) {
+  size_t name_len = strlen(name);
+  return h->name_len == name_len &&
+         strncasecmp((const char *)data + h->name_off, name, name_len) == 0;
+}
 
-  const char *p = headers;
-  while (*p) {
-    const char *line_end = strstr(p, "\r\n");
-    if (!line_end) {
-      line_end = p + strlen(p);
+// Decimal prefix of a header value; saturates instead of wrapping
+static size_t parse_decimal(const uint8_t *p, size_t len) {
+  size_t value = 0;
+  for (size_t i = 0; i < len && isdigit(p[i]); i++) {
+    if (value > (SIZE_MAX - 9) / 10) {
+      return SIZE_MAX;
     }
+    value = value * 10 + (size_t)(p[i] - '0');
+  }
+  return value;
+}
 
-    if ((size_t)(line_end - p) >= key_len &&
-        strncasecmp(p, key, key_len) == 0) {
-      const char *v = p + key_len;
-      while (*v == ' ' || *v == '\t') {
-        v++;
-      }
-      return v;
-    }
+static void copy_token(char *dst, size_t dst_cap, const uint8_t *src,
+                       size_t len) {
+  if (len >= dst_cap) {
+    len = dst_cap - 1;
+  }
+  memcpy(dst, src, len);
+  dst[len] = '\0';
+}
 
-    if (*line_end == '\0') {
-      break;
-    }
-    p = line_end + 2;
+// METHOD PATH PROTOCOL
+static bool parse_request_line(const uint8_t *line, size_t len,
+                               rtsp_request_t *req) {
+  size_t method_len = 0;
+  while (method_len < len && line[method_len] != ' ') {
+    method_len++;
+  }
+  if (method_len == 0 || method_len >= sizeof(req->method)) {
+    return false;
   }
+  copy_token(req->method, sizeof(req->method), line, method_len);
 
-  return NULL;
+  size_t path_start = method_len;
+  while (path_start < len && line[path_start] == ' ') {
+    path_start++;
+  }
+  size_t path_end = path_start;
+  while (path_end < len && line[path_end] != ' ') {
+    path_end++;
+  }
+  copy_token(req->path, sizeof(req->path), line + path_start,
+             path_end - path_start);
+  return true;
 }
 
-static void copy_header_value_token(char *dst, size_t dst_cap, const char *src) {
-  if (!dst || dst_cap == 0) {
-    return;
-  }
-  dst[0] = '\0';
-  if (!src) {
+// Index one "Name: value" line and pick up the fields every request needs
+static void parse_header_line(const uint8_t *data, size_t start, size_t end,
+                              rtsp_request_t *req) {
+  const uint8_t *colon = memchr(data + start, ':', end - start);
+  if (!colon || req->header_count >= RTSP_MAX_HEADERS) {
     return;
   }
 
-  size_t w = 0;
-  while (src[w] && src[w] != '\r' && src[w] != '\n' &&
-         (w + 1) < dst_cap) {
-    dst[w] = src[w];
-    w++;
+  size_t name_end = (size_t)(colon - data);
+  size_t value_start = name_end + 1;
+  while (name_end > start && (data[name_end - 1] == ' ' ||
+                              data[name_end - 1] == '\t')) {
+    name_end--;
+  }
+  while (value_start < end &&
+         (data[value_start] == ' ' || data[value_start] == '\t')) {
+    value_start++;
+  }
+  while (end > value_start && (data[end - 1] == ' ' || data[end - 1] == '\t')) {
+    end--;
   }
-  dst[w] = '\0';
 
-  // Trim trailing spaces
-  while (w > 0 && (dst[w - 1] == ' ' || dst[w - 1] == '\t')) {
-    dst[w - 1] = '\0';
-    w--;
+  rtsp_header_t *h = &req->headers[req->header_count++];
+  h->name_off = (uint16_t)start;
+  h->name_len = (uint16_t)(name_end - start);
+  h->value_off = (uint16_t)value_start;
+  h->value_len = (uint16_t)(end - value_start);
+
+  const uint8_t *value = data + value_start;
+  if (name_equals(data, h, "CSeq")) {
+    req->cseq = (int)parse_decimal(value, h->value_len);
+  } else if (name_equals(data, h, "Content-Length")) {
+    req->content_length = parse_decimal(value, h->value_len);
+  } else if (name_equals(data, h, "Content-Type")) {
+    copy_token(req->content_type, sizeof(req->content_type), value,
+               h->value_len);
   }
 }
 
-const uint8_t *rtsp_find_header_end(const uint8_t *data, size_t len) {
-  for (size_t i = 0; i + 3 < len; i++) {
-    if (data[i] == '\r' && data[i + 1] == '\n' && data[i + 2] == '\r' &&
-        data[i + 3] == '\n') {
-      return data + i;
+int rtsp_request_parse(const uint8_t *data, size_t len, rtsp_request_t *req) {
+  if (!data || !req) {
+    return -1;
+  }
+
+  memset(req, 0, sizeof(*req));
+  req->cseq = 1;
+  req->raw = data;
+
+  // Header offsets are 16-bit; longer heads are not sent by any client
+  size_t scan_len = len < UINT16_MAX ? len : UINT16_MAX;
+  size_t pos = 0;
+  bool first = true;
+  while (true) {
+    const uint8_t *nl = memchr(data + pos, '\n', scan_len - pos);
+    if (!nl) {
+      return len < UINT16_MAX ? 0 : -1;
+    }
+    size_t next = (size_t)(nl - data) + 1;
+    size_t end = next - 1;
+    if (end > pos && data[end - 1] == '\r') {
+      end--;
+    }
+
+    if (first) {
+      if (!parse_request_line(data + pos, end - pos, req)) {
+        return -1;
+      }
+      first = false;
+    } else if (end == pos) {
+      req->header_len = next;
+      break;
+    } else {
+      parse_header_line(data, pos, end, req);
     }
+    pos = next;
   }
-  return NULL;
-}
 
-int rtsp_parse_cseq(const char *request) {
-  const char *cseq = strstr(request, "CSeq:");
-  if (cseq) {
-    return atoi(cseq + 5);
+  if (req->content_length > (size_t)INT_MAX - req->header_len) {
+    return -1;
   }
-  return 1;
+  size_t total = req->header_len + req->content_length;
+  if (len >= total) {
+    req->body = data + req->header_len;
+    req->body_len = req->content_length;
+  }
+  return (int)total;
 }
 
-int rtsp_parse_content_length(const char *request) {
-  const char *cl = strstr(request, "Content-Length:");
-  if (!cl) {
-    cl = strstr(request, "content-length:");
+const char *rtsp_request_header(const rtsp_request_t *req, const char *name,
+                                size_t *value_len) {
+  for (size_t i = 0; req && name && i < req->header_count; i++) {
+    const rtsp_header_t *h = &req->headers[i];
+    if (name_equals(req->raw, h, name)) {
+      if (value_len) {
+        *value_len = h->value_len;
+      }
+      return (const char *)req->raw + h->value_off;
+    }
   }
-  if (cl) {
-    return atoi(cl + 15);
+  if (value_len) {
+    *value_len = 0;
   }
-  return 0;
+  return NULL;
 }
 
-const uint8_t *rtsp_get_body(const char *request, size_t request_len,
-                             size_t *body_len) {
-  const char *body = strstr(request, "\r\n\r\n");
-  if (body) {
-    body += 4;
-    *body_len = request_len - (body - request);
-    return (const uint8_t *)body;
+// Value of a "key=" parameter within a header value, or 0
+static uint16_t find_port_param(const char *value, size_t len,
+                                const char *key) {
+  size_t key_len = strlen(key);
+  for (size_t i = 0; i + key_len <= len; i++) {
+    if ((i == 0 || value[i - 1] == ';') &&
+        memcmp(value + i, key, key_len) == 0) {
+      return (uint16_t)parse_decimal((const uint8_t *)value + i + key_len,
+                                     len - i - key_len);
+    }
   }
-  *body_len = 0;
-  return NULL;
+  return 0;
 }
 
 // Parse Transport header for client ports (AirPlay 1)
 // Format: Transport:
 // RTP/AVP/UDP;unicast;mode=record;control_port=6001;timing_port=6002
-void rtsp_parse_transport(const char *request, uint16_t *control_port,
+void rtsp_parse_transport(const rtsp_request_t *req, uint16_t *control_port,
                           uint16_t *timing_port) {
+  size_t len = 0;
+  const char *transport = rtsp_request_header(req, "Transport", &len);
   if (control_port) {
-    *control_port = 0;
+    *control_port =
+        transport ? find_port_param(transport, len, "control_port=") : 0;
   }
   if (timing_port) {
-    *timing_port = 0;
+    *timing_port =
+        transport ? find_port_param(transport, len, "timing_port=") : 0;
   }
+}
 
-  const char *transport = strstr(request, "Transport:");
-  if (!transport) {
-    return;
-  }
+// Constant parts of every response head
+#define RTSP_STATUS_OK  "RTSP/1.0 200 OK\r\n"
+#define SERVER_HEADER   "Server: AirTunes/377.40.00\r\n"
+#define CSEQ_HEADER     "CSeq: "
+#define LENGTH_HEADER   "Content-Length: "
+#define TYPE_HEADER     "Content-Type: "
+#define CRLF            "\r\n"
+#define PUT_CONST(h, s) head_put((h), (s), sizeof(s) - 1)
+
+// Response head assembled on the stack; overflow truncates and is reported
+typedef struct {
+  char buf[1024];
+  size_t len;
+  bool overflow;
+} head_t;
+
+static void head_put(head_t *h, const char *s, size_t n) {
+  if (n > sizeof(h->buf) - h->len) {
+    h->overflow = true;
+    n = sizeof(h->buf) - h->len;
+  }
+  memcpy(h->buf + h->len, s, n);
+  h->len += n;
+}
 
-  // Find end of Transport header line
-  const char *line_end = strstr(transport, "\r\n");
-  if (!line_end) {
-    line_end = transport + strlen(transport);
-  }
+static void head_uint(head_t *h, size_t value) {
+  char digits[20];
+  size_t n = 0;
+  do {
+    digits[sizeof(digits) - 1 - n++] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value > 0);
+  head_put(h, digits + sizeof(digits) - n, n);
+}
 
-  // Parse control_port
-  const char *cp = strstr(transport, "control_port=");
-  if (cp && cp < line_end && control_port) {
-    *control_port = (uint16_t)atoi(cp + 13);
+static void head_status(head_t *h, const char *protocol, int status_code,
+                        const char *status_text) {
+  if (status_code == 200 && strcmp(protocol, "RTSP/1.0") == 0 &&
+      strcmp(status_text, "OK") == 0) {
+    PUT_CONST(h, RTSP_STATUS_OK);
+    return;
   }
+  head_put(h, protocol, strlen(protocol));
+  head_put(h, " ", 1);
+  head_uint(h, (size_t)(status_code < 0 ? 0 : status_code));
+  head_put(h, " ", 1);
+  head_put(h, status_text, strlen(status_text));
+  PUT_CONST(h, CRLF);
+}
 
-  // Parse timing_port
-  const char *tp = strstr(transport, "timing_port=");
-  if (tp && tp < line_end && timing_port) {
-    *timing_port = (uint16_t)atoi(tp + 12);
+// Internal: send the iovecs in order, handling partial sends
+static int send_iov(int socket, struct iovec *iov, int iovcnt) {
+  struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iovcnt};
+  while (msg.msg_iovlen > 0) {
+    ssize_t r = sendmsg(socket, &msg, 0);
+    if (r <= 0) {
+      return -1;
+    }
+    while (r > 0) {
+      if ((size_t)r >= msg.msg_iov->iov_len) {
+        r -= (ssize_t)msg.msg_iov->iov_len;
+        msg.msg_iov++;
+        msg.msg_iovlen--;
+      } else {
+        msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + r;
+        msg.msg_iov->iov_len -= (size_t)r;
+        r = 0;
+      }
+    }
   }
+  return 0;
 }
 
-int rtsp_request_parse(const uint8_t *data, size_t len, rtsp_request_t *req) {
-  if (!data || !req || len == 0) {
+// Internal: send head and body back to back without joining them, as one
+// scatter-gather send or, encrypted, as frames built in the connection's
+// tx buffer
+static int send_parts(int socket, rtsp_conn_t *conn, const head_t *head,
+                      const uint8_t *body, size_t body_len) {
+  if (head->overflow) {
+    ESP_LOGE(TAG, "Response head too long");
     return -1;
   }
-
-  memset(req, 0, sizeof(*req));
-
-  // Find header end
-  const uint8_t *header_end = rtsp_find_header_end(data, len);
-  if (!header_end) {
-    return -1;
+  if (conn && conn->encrypted_mode) {
+    return rtsp_crypto_write_parts(socket, conn, (const uint8_t *)head->buf,
+                                   head->len, body, body_len);
   }
 
-  // Parse first line: METHOD PATH PROTOCOL
-  if (sscanf((const char *)data, "%31s %255s", req->method, req->path) < 1) {
+  struct iovec iov[2] = {
+      {.iov_base = (void *)head->buf, .iov_len = head->len},
+      {.iov_base = (void *)body, .iov_len = body_len},
+  };
+  if (send_iov(socket, iov, body_len > 0 ? 2 : 1) < 0) {
+    ESP_LOGE(TAG, "Failed to send response");
     return -1;
   }
-
-  // Parse headers in a case-insensitive way (some clients vary header casing)
-  const size_t header_bytes = (size_t)(header_end - data);
-  char header_str[1024];
-  size_t copy_len = header_bytes;
-  if (copy_len >= sizeof(header_str)) {
-    copy_len = sizeof(header_str) - 1;
-  }
-  memcpy(header_str, data, copy_len);
-  header_str[copy_len] = '\0';
-
-  // Parse CSeq
-  const char *cseq = find_header_ci(header_str, "CSeq:");
-  if (cseq) {
-    req->cseq = atoi(cseq);
-  } else {
-    req->cseq = 1;
-  }
-
-  // Parse Content-Length
-  const char *cl = find_header_ci(header_str, "Content-Length:");
-  if (cl) {
-    req->content_length = (size_t)atoi(cl);
-  } else {
-    req->content_length = 0;
-  }
-
-  // Parse Content-Type (store whole value line, incl. optional params)
-  const char *ct = find_header_ci(header_str, "Content-Type:");
-  if (ct) {
-    copy_header_value_token(req->content_type, sizeof(req->content_type), ct);
-  }
-
-  // Get body
-  req->body = rtsp_get_body((const char *)data, len, &req->body_len);
-
-  return 0;
-}
-
-// Internal: send all data, handling partial sends
-static int send_all(int socket, const uint8_t *data, size_t len) {
-  size_t sent = 0;
-  while (sent < len) {
-    ssize_t r = send(socket, data + sent, len - sent, 0);
-    if (r <= 0) {
-      return -1;
-    }
-    sent += (size_t)r;
-  }
   return 0;
 }
 
@@ -220,70 +303,28 @@ int rtsp_send_response(int socket, rtsp_conn_t *conn, int status_code,
                        const char *status_text, int cseq,
                        const char *extra_headers, const char *body,
                        size_t body_len) {
-  char header[1024];
-  int header_len;
-
-  if (extra_headers && body && body_len > 0) {
-    header_len =
-        snprintf(header, sizeof(header),
-                 "RTSP/1.0 %d %s\r\n"
-                 "CSeq: %d\r\n"
-                 "Server: AirTunes/377.40.00\r\n"
-                 "%s"
-                 "Content-Length: %zu\r\n"
-                 "\r\n",
-                 status_code, status_text, cseq, extra_headers, body_len);
-  } else if (extra_headers) {
-    header_len = snprintf(header, sizeof(header),
-                          "RTSP/1.0 %d %s\r\n"
-                          "CSeq: %d\r\n"
-                          "Server: AirTunes/377.40.00\r\n"
-                          "%s"
-                          "\r\n",
-                          status_code, status_text, cseq, extra_headers);
-  } else if (body && body_len > 0) {
-    header_len = snprintf(header, sizeof(header),
-                          "RTSP/1.0 %d %s\r\n"
-                          "CSeq: %d\r\n"
-                          "Server: AirTunes/377.40.00\r\n"
-                          "Content-Length: %zu\r\n"
-                          "\r\n",
-                          status_code, status_text, cseq, body_len);
-  } else {
-    header_len = snprintf(header, sizeof(header),
-                          "RTSP/1.0 %d %s\r\n"
-                          "CSeq: %d\r\n"
-                          "Server: AirTunes/377.40.00\r\n"
-                          "\r\n",
-                          status_code, status_text, cseq);
+  if (!body) {
+    body_len = 0;
   }
 
-  // Build complete response
-  size_t total_len = (size_t)header_len + body_len;
-  uint8_t *response = malloc(total_len);
-  if (!response) {
-    ESP_LOGE(TAG, "Failed to allocate response buffer");
-    return -1;
+  head_t head;
+  head.len = 0;
+  head.overflow = false;
+  head_status(&head, "RTSP/1.0", status_code, status_text);
+  PUT_CONST(&head, CSEQ_HEADER);
+  head_uint(&head, (size_t)(cseq < 0 ? 0 : cseq));
+  PUT_CONST(&head, CRLF SERVER_HEADER);
+  if (extra_headers) {
+    head_put(&head, extra_headers, strlen(extra_headers));
   }
-
-  memcpy(response, header, (size_t)header_len);
-  if (body && body_len > 0) {
-    memcpy(response + header_len, body, body_len);
-  }
-
-  // Send encrypted or plain depending on mode
-  int result;
-  if (conn && conn->encrypted_mode) {
-    result = rtsp_crypto_write_frame(socket, conn, response, total_len);
-  } else {
-    result = (send_all(socket, response, total_len) < 0) ? -1 : 0;
-    if (result < 0) {
-      ESP_LOGE(TAG, "Failed to send RTSP response");
-    }
+  if (body_len > 0) {
+    PUT_CONST(&head, LENGTH_HEADER);
+    head_uint(&head, body_len);
+    PUT_CONST(&head, CRLF);
   }
+  PUT_CONST(&head, CRLF);
 
-  free(response);
-  return result;
+  return send_parts(socket, conn, &head, (const uint8_t *)body, body_len);
 }
 
 int rtsp_send_ok(int socket, rtsp_conn_t *conn, int cseq) {
@@ -293,40 +334,19 @@ int rtsp_send_ok(int socket, rtsp_conn_t *conn, int cseq) {
 int rtsp_send_http_response(int socket, rtsp_conn_t *conn, int status_code,
                             const char *status_text, const char *content_type,
                             const char *body, size_t body_len) {
-  char header[512];
-  int header_len = snprintf(header, sizeof(header),
-                            "HTTP/1.1 %d %s\r\n"
-                            "Content-Type: %s\r\n"
-                            "Content-Length: %zu\r\n"
-                            "Server: AirTunes/377.40.00\r\n"
-                            "CSeq: 1\r\n"
-                            "\r\n",
-                            status_code, status_text, content_type, body_len);
-
-  // Build complete response
-  size_t total_len = (size_t)header_len + body_len;
-  uint8_t *response = malloc(total_len);
-  if (!response) {
-    ESP_LOGE(TAG, "Failed to allocate response buffer");
-    return -1;
+  if (!body) {
+    body_len = 0;
   }
 
-  memcpy(response, header, (size_t)header_len);
-  if (body && body_len > 0) {
-    memcpy(response + header_len, body, body_len);
-  }
-
-  // Send encrypted or plain depending on mode
-  int result;
-  if (conn && conn->encrypted_mode) {
-    result = rtsp_crypto_write_frame(socket, conn, response, total_len);
-  } else {
-    result = (send_all(socket, response, total_len) < 0) ? -1 : 0;
-    if (result < 0) {
-      ESP_LOGE(TAG, "Failed to send HTTP response");
-    }
-  }
+  head_t head;
+  head.len = 0;
+  head.overflow = false;
+  head_status(&head, "HTTP/1.1", status_code, status_text);
+  PUT_CONST(&head, TYPE_HEADER);
+  head_put(&head, content_type, strlen(content_type));
+  PUT_CONST(&head, CRLF LENGTH_HEADER);
+  head_uint(&head, body_len);
+  PUT_CONST(&head, CRLF SERVER_HEADER CSEQ_HEADER "1" CRLF CRLF);
 
-  free(response);
-  return result;
+  return send_parts(socket, conn, &head, (const uint8_t *)body, body_len);
 }
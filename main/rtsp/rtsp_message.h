@@ -9,8 +9,22 @@
  * RTSP Message Parsing and Response Building
  */
 
+#define RTSP_MAX_HEADERS 24
+
+/**
+ * One header line of a request, as offsets into the receive buffer
+ */
+typedef struct {
+  uint16_t name_off;
+  uint16_t name_len;
+  uint16_t value_off; // Leading and trailing blanks trimmed
+  uint16_t value_len;
+} rtsp_header_t;
+
 /**
  * Parsed RTSP request structure
+ * The header index and body are views into the receive buffer, which must
+ * stay untouched while the request is handled.
  */
 typedef struct {
   char method[32];
@@ -18,50 +32,33 @@ typedef struct {
   int cseq;
   char content_type[64];
   size_t content_length;
+  const uint8_t *raw;
+  size_t header_len; // Request line and headers, including the blank line
   const uint8_t *body;
   size_t body_len;
+  size_t header_count;
+  rtsp_header_t headers[RTSP_MAX_HEADERS]; // Lines beyond these are ignored
 } rtsp_request_t;
 
 /**
- * Parse RTSP request from buffer
- * @param data Raw request data
+ * Parse the request line and headers at the start of a buffer in one pass
+ * @param data Received data
  * @param len Length of data
- * @param req Output: parsed request (body pointer references original data)
- * @return 0 on success, -1 on parse error
+ * @param req Output: parsed request; body is only set once len covers it
+ * @return Length of the whole request (head plus body) once the head is
+ *         complete, 0 if more data is needed, -1 on a malformed head
  */
 int rtsp_request_parse(const uint8_t *data, size_t len, rtsp_request_t *req);
 
 /**
- * Find end of HTTP/RTSP headers (\r\n\r\n)
- * @param data Request data
- * @param len Length of data
- * @return Pointer to first \r\n of header end, or NULL if not found
- */
-const uint8_t *rtsp_find_header_end(const uint8_t *data, size_t len);
-
-/**
- * Parse CSeq header from request
- * @param request Request string
- * @return CSeq value, or 1 if not found
- */
-int rtsp_parse_cseq(const char *request);
-
-/**
- * Parse Content-Length header from request
- * @param request Request string
- * @return Content length, or 0 if not found
- */
-int rtsp_parse_content_length(const char *request);
-
-/**
- * Get body pointer from request
- * @param request Request string
- * @param request_len Total request length
- * @param body_len Output: body length
- * @return Pointer to body, or NULL if none
+ * Look up a header value by name (case-insensitive)
+ * @param req Parsed request
+ * @param name Header name without the colon, e.g. "Transport"
+ * @param value_len Output: length of the value (not NUL-terminated)
+ * @return Pointer to the value in the receive buffer, or NULL if absent
  */
-const uint8_t *rtsp_get_body(const char *request, size_t request_len,
-                             size_t *body_len);
+const char *rtsp_request_header(const rtsp_request_t *req, const char *name,
+                                size_t *value_len);
 
 /**
  * Send RTSP response (handles encryption automatically)
@@ -102,9 +99,9 @@ int rtsp_send_http_response(int socket, rtsp_conn_t *conn, int status_code,
 
 /**
  * Parse Transport header for client ports (AirPlay 1)
- * @param request Request string
+ * @param req Parsed request
  * @param control_port Output: client's control port (or 0)
  * @param timing_port Output: client's timing port (or 0)
  */
-void rtsp_parse_transport(const char *request, uint16_t *control_port,
+void rtsp_parse_transport(const rtsp_request_t *req, uint16_t *control_port,
                           uint16_t *timing_port);
@@ -1,6 +1,7 @@
 #include "rtsp_server.h"
 
 #include <errno.h>
+#include <inttypes.h>
 #include <netinet/in.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,8 +11,10 @@
 #include "audio_receiver.h"
 #include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "mem_budget.h"
 
 #include "rtsp_conn.h"
 #include "rtsp_crypto.h"
@@ -23,8 +26,9 @@
 static const char *TAG = "rtsp_server";
 
 #define RTSP_PORT           7000
-#define RTSP_BUFFER_INITIAL 4096
-#define RTSP_BUFFER_LARGE   ((size_t)256 * 1024)
+#define RTSP_BUFFER_INITIAL  4096
+#define RTSP_BUFFER_HEAD_MAX 16384 // Longest request head accepted
+#define RTSP_RX_SLACK        RTSP_ENCRYPTED_BLOCK_MAX // One decrypted block
 
 static int server_socket = -1;
 static TaskHandle_t server_task_handle = NULL;
@@ -37,10 +41,14 @@ typedef struct {
   int socket;
   volatile bool should_stop;
   volatile bool is_old; // Marked as old client being killed
+  bool standby;         // Starts next to a live session, see rtsp_conn_t
 } client_slot_t;
 
-static client_slot_t clients[2] = {0}; // Current and old
-static int current_slot = 0;
+static client_slot_t clients[2] = {0}; // Current and old (or standby)
+static volatile int current_slot = 0;
+
+// Receive buffer of each slot, held for good with CONFIG_MEM_STATIC_POOLS
+static mem_keep_t rx_keeps[sizeof(clients) / sizeof(clients[0])];
 
 // Public API for volume control
 void airplay_set_volume(float volume_db) {
@@ -58,65 +66,219 @@ int32_t airplay_get_volume_q15(void) {
   return 16384; // 50% volume for new clients
 }
 
-// Helper to grow buffer
-static uint8_t *grow_buffer(uint8_t *old_buf, size_t old_size, size_t new_size,
-                            size_t data_len) {
-  (void)old_size;
-  uint8_t *new_buf =
-      heap_caps_malloc(new_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-  if (!new_buf) {
-    new_buf = malloc(new_size);
+// Receive state of one connection. Heads and small requests collect in
+// buffer; a request that does not fit is moved to a right-sized PSRAM
+// allocation and the rest of its body is received straight into it.
+typedef struct {
+  mem_keep_t *keep; // Where buffer comes from
+  uint8_t *buffer;
+  size_t capacity;
+  size_t start; // First byte not yet handled
+  size_t len;
+
+  uint8_t *large; // Whole request, plus RTSP_RX_SLACK for what follows it
+  size_t large_size;
+  size_t large_len;
+
+  size_t discard; // Body bytes of a refused request still to skip
+  int discard_cseq;
+  int discard_status;
+} rtsp_rx_t;
+
+static uint8_t *alloc_psram(size_t size) {
+  return mem_alloc_prefer_psram(MEM_TAG_RTSP, size);
+}
+
+// Make room for RTSP_RX_SLACK more bytes behind len. Handled requests are
+// only compacted away here, when the tail runs short; the buffer only grows
+// for an unusually long head.
+static bool rx_reserve(rtsp_rx_t *rx) {
+  if (rx->start == rx->len) {
+    rx->start = 0;
+    rx->len = 0;
+  }
+  if (rx->len + RTSP_RX_SLACK <= rx->capacity) {
+    return true;
   }
+  if (rx->start > 0) {
+    memmove(rx->buffer, rx->buffer + rx->start, rx->len - rx->start);
+    rx->len -= rx->start;
+    rx->start = 0;
+    if (rx->len + RTSP_RX_SLACK <= rx->capacity) {
+      return true;
+    }
+  }
+
+  if (rx->capacity >= RTSP_BUFFER_HEAD_MAX) {
+    ESP_LOGW(TAG, "RTSP head exceeds %d bytes", RTSP_BUFFER_HEAD_MAX);
+    return false;
+  }
+  uint8_t *new_buf = alloc_psram(RTSP_BUFFER_HEAD_MAX);
   if (!new_buf) {
-    return NULL;
+    return false;
   }
-  if (old_buf && data_len > 0) {
-    memcpy(new_buf, old_buf, data_len);
+  memcpy(new_buf, rx->buffer, rx->len);
+  mem_keep_put(rx->keep, MEM_TAG_RTSP, rx->buffer, rx->capacity);
+  rx->buffer = new_buf;
+  rx->capacity = RTSP_BUFFER_HEAD_MAX;
+  return true;
+}
+
+// Where the next receive goes
+static uint8_t *rx_tail(rtsp_rx_t *rx, size_t *space) {
+  if (rx->large) {
+    *space = rx->large_size + RTSP_RX_SLACK - rx->large_len;
+    return rx->large + rx->large_len;
   }
-  free(old_buf);
-  return new_buf;
+  *space = rx->capacity - rx->len;
+  return rx->buffer + rx->len;
 }
 
-// Process buffered RTSP requests
-static void process_rtsp_buffer(client_slot_t *slot, uint8_t *buffer,
-                                size_t *buf_len) {
-  while (*buf_len > 0 && !slot->should_stop) {
-    const uint8_t *header_end = rtsp_find_header_end(buffer, *buf_len);
-    if (!header_end) {
-      break;
+// Refuse a request without dropping the connection: its body is skipped
+// as it arrives and the error is answered once it has been
+static void rx_refuse(rtsp_rx_t *rx, const rtsp_request_t *req,
+                      size_t remaining, int status) {
+  rx->discard = remaining;
+  rx->discard_cseq = req->cseq;
+  rx->discard_status = status;
+  rx->start = rx->len;
+}
+
+// Signal old client to stop (non-blocking)
+static void signal_old_client_stop(int old_slot) {
+  client_slot_t *old = &clients[old_slot];
+  if (old->task == NULL) {
+    return;
+  }
+
+  ESP_LOGI(TAG, "Signaling old client to stop");
+  old->is_old = true;
+  old->should_stop = true;
+
+  // Shutdown socket to unblock recv
+  if (old->socket >= 0) {
+    shutdown(old->socket, SHUT_RDWR);
+  }
+  // Task will clean itself up
+}
+
+#if CONFIG_RTSP_FAST_TAKEOVER
+// Stop the live session and give its pipeline to the standby one in
+// slot_idx. The old task's teardown has to be over before the new session
+// starts its stream, or its audio_receiver_stop() would land on it.
+static void take_over(int slot_idx) {
+  int old_slot = 1 - slot_idx;
+  int64_t start = esp_timer_get_time();
+  if (clients[old_slot].task != NULL) {
+    ESP_LOGI(TAG, "Slot %d takes over from slot %d", slot_idx, old_slot);
+    signal_old_client_stop(old_slot);
+    // The event task's stop can take up to a second of its own
+    int timeout = 40;
+    while (clients[old_slot].task != NULL && timeout > 0) {
+      vTaskDelay(pdMS_TO_TICKS(50));
+      timeout--;
     }
+    if (clients[old_slot].task != NULL) {
+      ESP_LOGW(TAG, "Slot %d still stopping, taking over anyway", old_slot);
+    }
+  }
+  current_slot = slot_idx;
+  rtsp_conn_go_live(clients[slot_idx].conn);
+  ESP_LOGI(TAG, "Slot %d live after %" PRId64 " ms", slot_idx,
+           (esp_timer_get_time() - start) / 1000);
+}
+#endif
+
+static void dispatch(client_slot_t *slot, const rtsp_request_t *req) {
+#if CONFIG_RTSP_FAST_TAKEOVER
+  if (rtsp_request_takes_over(slot->conn, req)) {
+    take_over((int)(slot - clients));
+  }
+#endif
+  rtsp_dispatch(slot->socket, slot->conn, req);
+}
 
-    size_t header_len = (size_t)(header_end - buffer) + 4;
-    char *header_str = malloc(header_len + 1);
-    if (!header_str) {
-      *buf_len = 0;
+// Handle the complete requests between start and len, advancing start past
+// each one; a partial request is left for the next receive
+static void process_rtsp_buffer(client_slot_t *slot, rtsp_rx_t *rx) {
+  while (rx->start < rx->len && !slot->should_stop) {
+    rtsp_request_t req;
+    size_t avail = rx->len - rx->start;
+    int total = rtsp_request_parse(rx->buffer + rx->start, avail, &req);
+    if (total == 0) {
       break;
     }
-    memcpy(header_str, buffer, header_len);
-    header_str[header_len] = '\0';
-
-    int content_len = rtsp_parse_content_length(header_str);
-    if (content_len < 0) {
-      content_len = 0;
+    if (total < 0) {
+      ESP_LOGW(TAG, "Dropping malformed RTSP request");
+      rx->start = rx->len;
+      break;
+    }
+    if (avail >= (size_t)total) {
+      dispatch(slot, &req);
+      rx->start += (size_t)total;
+      continue;
+    }
+    if ((size_t)total + RTSP_RX_SLACK <= rx->capacity) {
+      break; // Fits once the rest arrives
     }
 
-    size_t total_len = header_len + (size_t)content_len;
-    if (total_len > RTSP_BUFFER_LARGE || *buf_len < total_len) {
-      free(header_str);
-      if (total_len > RTSP_BUFFER_LARGE) {
-        *buf_len = 0;
-      }
+    // 1 MB, or less on the low-memory profile
+    if ((size_t)total > mem_budget_profile()->rtsp_request_max) {
+      ESP_LOGW(TAG, "%s body of %zu bytes refused", req.method,
+               req.content_length);
+      rx_refuse(rx, &req, (size_t)total - avail, 413);
+      break;
+    }
+    rx->large = alloc_psram((size_t)total + RTSP_RX_SLACK);
+    if (!rx->large) {
+      ESP_LOGE(TAG, "No memory for a %d byte %s request", total, req.method);
+      rx_refuse(rx, &req, (size_t)total - avail, 503);
       break;
     }
+    memcpy(rx->large, rx->buffer + rx->start, avail);
+    rx->large_size = (size_t)total;
+    rx->large_len = avail;
+    rx->start = rx->len;
+    break;
+  }
+}
 
-    rtsp_dispatch(slot->socket, slot->conn, buffer, total_len);
-    free(header_str);
+// Account n bytes just received at rx_tail()
+static void rx_received(client_slot_t *slot, rtsp_rx_t *rx, size_t n) {
+  if (rx->large) {
+    rx->large_len += n;
+    if (rx->large_len < rx->large_size) {
+      return;
+    }
 
-    if (*buf_len > total_len) {
-      memmove(buffer, buffer + total_len, *buf_len - total_len);
+    rtsp_request_t req;
+    rtsp_request_parse(rx->large, rx->large_size, &req);
+    dispatch(slot, &req);
+
+    // Whatever followed the request continues in the small buffer, which
+    // was emptied when the request moved out
+    size_t leftover = rx->large_len - rx->large_size;
+    memcpy(rx->buffer, rx->large + rx->large_size, leftover);
+    rx->start = 0;
+    rx->len = leftover;
+    mem_free(MEM_TAG_RTSP, rx->large, rx->large_size + RTSP_RX_SLACK);
+    rx->large = NULL;
+  } else if (rx->discard > 0) {
+    size_t skip = n < rx->discard ? n : rx->discard;
+    memmove(rx->buffer + rx->len, rx->buffer + rx->len + skip, n - skip);
+    rx->discard -= skip;
+    rx->len += n - skip;
+    if (rx->discard == 0) {
+      rtsp_send_response(slot->socket, slot->conn, rx->discard_status,
+                         rx->discard_status == 413
+                             ? "Request Entity Too Large"
+                             : "Service Unavailable",
+                         rx->discard_cseq, NULL, NULL, 0);
     }
-    *buf_len -= total_len;
+  } else {
+    rx->len += n;
   }
+  process_rtsp_buffer(slot, rx);
 }
 
 // Client task
@@ -134,6 +296,9 @@ static void client_task(void *pvParameters) {
     vTaskDelete(NULL);
     return;
   }
+#if CONFIG_RTSP_FAST_TAKEOVER
+  conn->standby = slot->standby;
+#endif
   slot->conn = conn;
 
   // Get client IP address for timing requests
@@ -147,10 +312,11 @@ static void client_task(void *pvParameters) {
              (conn->client_ip >> 24) & 0xFF);
   }
 
-  // Allocate buffer
-  size_t buf_capacity = RTSP_BUFFER_INITIAL;
-  uint8_t *buffer = malloc(buf_capacity);
-  if (!buffer) {
+  // Allocate buffer (the reserved one already has room for any head)
+  rtsp_rx_t rx = {.keep = &rx_keeps[slot_idx]};
+  rx.buffer = mem_keep_get(rx.keep, MEM_TAG_RTSP, RTSP_BUFFER_INITIAL,
+                           MALLOC_CAP_8BIT, &rx.capacity);
+  if (!rx.buffer) {
     ESP_LOGE(TAG, "Failed to allocate buffer");
     rtsp_conn_free(conn);
     slot->conn = NULL;
@@ -161,88 +327,64 @@ static void client_task(void *pvParameters) {
     return;
   }
 
-  size_t buf_len = 0;
-
   // Socket timeout for stop signal responsiveness
   struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
   setsockopt(slot->socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 
   while (server_running && !slot->should_stop) {
-    if (conn->encrypted_mode) {
-      // Encrypted mode
-      while (server_running && conn->encrypted_mode && !slot->should_stop) {
-        if (buf_len >= buf_capacity - 1024) {
-          size_t new_cap = buf_capacity < RTSP_BUFFER_LARGE ? RTSP_BUFFER_LARGE
-                                                            : buf_capacity * 2;
-          if (new_cap > RTSP_BUFFER_LARGE) {
-            goto cleanup;
-          }
-          uint8_t *new_buf =
-              grow_buffer(buffer, buf_capacity, new_cap, buf_len);
-          if (!new_buf) {
-            goto cleanup;
-          }
-          buffer = new_buf;
-          buf_capacity = new_cap;
-        }
+    if (!rx.large && !rx_reserve(&rx)) {
+      break;
+    }
+    size_t space = 0;
+    uint8_t *tail = rx_tail(&rx, &space);
 
-        int block_len = rtsp_crypto_read_block(
-            slot->socket, conn, buffer + buf_len, buf_capacity - buf_len);
-        if (block_len <= 0) {
-          if (slot->should_stop || (errno != EAGAIN && errno != EWOULDBLOCK)) {
-            goto cleanup;
-          }
-          continue;
+    if (conn->encrypted_mode) {
+      int block_len = rtsp_crypto_read_block(slot->socket, conn, tail, space);
+      if (block_len <= 0) {
+        if (slot->should_stop || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+          break;
         }
-
-        buf_len += (size_t)block_len;
-        process_rtsp_buffer(slot, buffer, &buf_len);
+        continue;
       }
-      goto cleanup;
+      rx_received(slot, &rx, (size_t)block_len);
+      continue;
     }
 
     // Plain-text mode
-    if (buf_len >= buf_capacity - 1024) {
-      size_t new_cap = buf_capacity < RTSP_BUFFER_LARGE ? RTSP_BUFFER_LARGE
-                                                        : buf_capacity * 2;
-      if (new_cap > RTSP_BUFFER_LARGE) {
-        break;
-      }
-      uint8_t *new_buf = grow_buffer(buffer, buf_capacity, new_cap, buf_len);
-      if (!new_buf) {
-        break;
-      }
-      buffer = new_buf;
-      buf_capacity = new_cap;
-    }
-
-    ssize_t recv_len =
-        recv(slot->socket, buffer + buf_len, buf_capacity - buf_len, 0);
+    ssize_t recv_len = recv(slot->socket, tail, space, 0);
     if (recv_len <= 0) {
       if (recv_len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
         continue;
       }
       break;
     }
-    buf_len += (size_t)recv_len;
-    process_rtsp_buffer(slot, buffer, &buf_len);
+    rx_received(slot, &rx, (size_t)recv_len);
   }
 
-cleanup:
   ESP_LOGI(TAG, "Client slot %d disconnected", slot_idx);
-  free(buffer);
+  mem_free(MEM_TAG_RTSP, rx.large, rx.large_size + RTSP_RX_SLACK);
+  mem_keep_put(rx.keep, MEM_TAG_RTSP, rx.buffer, rx.capacity);
   close(slot->socket);
-  rtsp_events_emit(RTSP_EVENT_DISCONNECTED);
 
-  // Always stop event task before closing its socket
-  rtsp_stop_event_port_task();
+#if CONFIG_RTSP_FAST_TAKEOVER
+  // A standby session that never went live leaves everything shared to the
+  // one playing, including the event task
+  bool live = !conn->standby;
+#else
+  bool live = true;
+#endif
+  if (live) {
+    rtsp_events_emit(RTSP_EVENT_DISCONNECTED);
+    // Always stop event task before closing its socket
+    rtsp_stop_event_port_task();
+  }
   if (conn->event_socket >= 0) {
     close(conn->event_socket);
     conn->event_socket = -1;
   }
 
   // Full audio cleanup if old client being killed or server stopping
-  if (slot->is_old || !server_running) {
+  if (live && (slot->is_old || !server_running)) {
     audio_receiver_stop();
   }
 
@@ -254,28 +396,11 @@ cleanup:
   slot->task = NULL;
   slot->should_stop = false;
   slot->is_old = false;
+  slot->standby = false;
 
   vTaskDelete(NULL);
 }
 
-// Signal old client to stop (non-blocking)
-static void signal_old_client_stop(int old_slot) {
-  client_slot_t *old = &clients[old_slot];
-  if (old->task == NULL) {
-    return;
-  }
-
-  ESP_LOGI(TAG, "Signaling old client to stop");
-  old->is_old = true;
-  old->should_stop = true;
-
-  // Shutdown socket to unblock recv
-  if (old->socket >= 0) {
-    shutdown(old->socket, SHUT_RDWR);
-  }
-  // Task will clean itself up
-}
-
 static void server_task(void *pvParameters) {
   (void)pvParameters;
 
@@ -289,6 +414,7 @@ static void server_task(void *pvParameters) {
     clients[i].task = NULL;
     clients[i].should_stop = false;
     clients[i].is_old = false;
+    clients[i].standby = false;
   }
 
   server_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -341,6 +467,19 @@ static void server_task(void *pvParameters) {
     // Find slot for new client (alternate between 0 and 1)
     int new_slot = 1 - current_slot;
 
+#if CONFIG_RTSP_FAST_TAKEOVER
+    if (clients[current_slot].task == NULL && clients[new_slot].task != NULL) {
+      // The live session left before its standby went live
+      current_slot = new_slot;
+      new_slot = 1 - new_slot;
+    }
+    // Next to a session the newcomer stands by: it pairs and sets up while
+    // the other plays on, until its RECORD. One it replaces never went
+    // live, so stopping it leaves the pipeline alone.
+    bool standby = clients[current_slot].task != NULL;
+    signal_old_client_stop(new_slot);
+#endif
+
     // If new slot still has a running task, wait for it briefly
     if (clients[new_slot].task != NULL) {
       int timeout = 10;
@@ -350,13 +489,17 @@ static void server_task(void *pvParameters) {
       }
     }
 
+#if !CONFIG_RTSP_FAST_TAKEOVER
     // Signal old client to stop (in background)
     signal_old_client_stop(current_slot);
+    bool standby = false;
+#endif
 
     // Setup new slot
     clients[new_slot].socket = new_socket;
     clients[new_slot].should_stop = false;
     clients[new_slot].is_old = false;
+    clients[new_slot].standby = standby;
 
     // Start new client task immediately
     BaseType_t ret =
@@ -366,7 +509,7 @@ static void server_task(void *pvParameters) {
       ESP_LOGE(TAG, "Failed to create client task");
       close(new_socket);
       clients[new_slot].socket = -1;
-    } else {
+    } else if (!standby) {
       current_slot = new_slot;
     }
   }
@@ -396,11 +539,17 @@ esp_err_t rtsp_server_start(void) {
     return ESP_ERR_INVALID_STATE;
   }
 
+  for (size_t i = 0; i < sizeof(rx_keeps) / sizeof(rx_keeps[0]); i++) {
+    mem_keep_reserve(&rx_keeps[i], MEM_TAG_RTSP, RTSP_BUFFER_HEAD_MAX,
+                     MEM_PREFER_PSRAM);
+  }
+
   BaseType_t ret = xTaskCreate(server_task, "rtsp_server", 4096, NULL, 5,
                                &server_task_handle);
   if (ret != pdPASS) {
     return ESP_FAIL;
   }
+  mem_account(MEM_TAG_RTSP, 4096);
 
   return ESP_OK;
 }
@@ -417,5 +566,6 @@ void rtsp_server_stop(void) {
   if (server_task_handle != NULL) {
     vTaskDelay(pdMS_TO_TICKS(100));
     server_task_handle = NULL;
+    mem_account(MEM_TAG_RTSP, -4096);
   }
 }
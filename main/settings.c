@@ -1,6 +1,10 @@
 #include "settings.h"
 
 #include "esp_log.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "nvs.h"
 #include <string.h>
 
@@ -11,14 +15,118 @@ static const char *TAG = "settings";
 #define NVS_KEY_WIFI_SSID     "wifi_ssid"
 #define NVS_KEY_WIFI_PASSWORD "wifi_pass"
 #define NVS_KEY_DEVICE_NAME   "device_name"
+#define NVS_KEY_EQ            "eq"
+#define NVS_KEY_CHANNEL_MODE  "channel_mode"
 
 #define MAX_WIFI_SSID_LEN     32
 #define MAX_WIFI_PASSWORD_LEN 64
 #define MAX_DEVICE_NAME_LEN   64
 
+// Volume and EQ follow sliders, so they are written behind: a change marks
+// the cached value dirty and the writer commits whatever is dirty once the
+// changes have settled, at most once per delay
+#define COMMIT_DELAY_MS   3000
+#define WRITER_STACK      3072
+#define WRITER_PRIORITY   2 // Below everything in the audio and network paths
+#define DIRTY_VOLUME      (1u << 0)
+#define DIRTY_EQ          (1u << 1)
+
 // Cached values
 static float g_volume_db = 0.0f;
 static bool g_volume_loaded = false;
+static uint32_t g_device_name_revision = 0;
+#if CONFIG_AUDIO_EQ
+static audio_eq_config_t g_eq;
+#endif
+
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED; // Cache, dirty
+static uint32_t g_dirty;
+static SemaphoreHandle_t g_flush_lock;
+static TaskHandle_t g_writer;
+
+static void mark_dirty(uint32_t bits) {
+  taskENTER_CRITICAL(&g_lock);
+  g_dirty |= bits;
+  taskEXIT_CRITICAL(&g_lock);
+  if (g_writer) {
+    xTaskNotifyGive(g_writer);
+  }
+}
+
+static void writer_task(void *arg) {
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    // Changes made while waiting join this commit
+    vTaskDelay(pdMS_TO_TICKS(COMMIT_DELAY_MS));
+    settings_flush();
+  }
+}
+
+static void flush_on_shutdown(void) {
+  settings_flush();
+}
+
+void settings_flush(void) {
+  if (g_flush_lock) {
+    xSemaphoreTake(g_flush_lock, portMAX_DELAY);
+  }
+
+  taskENTER_CRITICAL(&g_lock);
+  uint32_t dirty = g_dirty;
+  g_dirty = 0;
+  float volume_db = g_volume_db;
+#if CONFIG_AUDIO_EQ
+  audio_eq_config_t eq = g_eq;
+#endif
+  taskEXIT_CRITICAL(&g_lock);
+
+  if (dirty == 0) {
+    if (g_flush_lock) {
+      xSemaphoreGive(g_flush_lock);
+    }
+    return;
+  }
+
+  nvs_handle_t nvs;
+  esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+  if (err == ESP_OK) {
+    if (dirty & DIRTY_VOLUME) {
+      // Store as fixed-point (x100) for 2 decimal precision
+      int32_t vol_fixed = (int32_t)(volume_db * 100.0f);
+      err = nvs_set_i32(nvs, NVS_KEY_VOLUME, vol_fixed);
+    }
+#if CONFIG_AUDIO_EQ
+    if (err == ESP_OK && (dirty & DIRTY_EQ)) {
+      err = nvs_set_blob(nvs, NVS_KEY_EQ, &eq, sizeof(eq));
+    }
+#endif
+    if (err == ESP_OK) {
+      err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+  }
+
+  if (err == ESP_OK) {
+    if (dirty & DIRTY_VOLUME) {
+      ESP_LOGI(TAG, "Saved volume: %.2f dB", volume_db);
+    }
+#if CONFIG_AUDIO_EQ
+    if (dirty & DIRTY_EQ) {
+      ESP_LOGI(TAG, "Saved EQ: %d band(s)", eq.band_count);
+    }
+#endif
+  } else {
+    // Keep the values dirty for the next change or shutdown to retry
+    ESP_LOGE(TAG, "Failed to save settings: %s", esp_err_to_name(err));
+    taskENTER_CRITICAL(&g_lock);
+    g_dirty |= dirty;
+    taskEXIT_CRITICAL(&g_lock);
+  }
+
+  if (g_flush_lock) {
+    xSemaphoreGive(g_flush_lock);
+  }
+}
 
 esp_err_t settings_init(void) {
   // Load volume on init
@@ -35,6 +143,16 @@ esp_err_t settings_init(void) {
     nvs_close(nvs);
   }
 
+  g_flush_lock = xSemaphoreCreateMutex();
+  if (!g_flush_lock || xTaskCreate(writer_task, "settings_wr", WRITER_STACK,
+                                   NULL, WRITER_PRIORITY,
+                                   &g_writer) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to start settings writer");
+    return ESP_ERR_NO_MEM;
+  }
+  // esp_restart() runs this, so a pending change survives a reboot
+  esp_register_shutdown_handler(flush_on_shutdown);
+
   return ESP_OK;
 }
 
@@ -53,35 +171,16 @@ esp_err_t settings_get_volume(float *volume_db) {
 
 esp_err_t settings_set_volume(float volume_db) {
   // Skip if unchanged
-  if (g_volume_loaded && volume_db == g_volume_db) {
-    return ESP_OK;
-  }
-
-  nvs_handle_t nvs;
-  esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
-  if (err != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
-    return err;
+  taskENTER_CRITICAL(&g_lock);
+  bool unchanged = g_volume_loaded && volume_db == g_volume_db;
+  g_volume_db = volume_db;
+  g_volume_loaded = true;
+  taskEXIT_CRITICAL(&g_lock);
+
+  if (!unchanged) {
+    mark_dirty(DIRTY_VOLUME);
   }
-
-  // Store as fixed-point (x100) for 2 decimal precision
-  int32_t vol_fixed = (int32_t)(volume_db * 100.0f);
-  err = nvs_set_i32(nvs, NVS_KEY_VOLUME, vol_fixed);
-  if (err == ESP_OK) {
-    err = nvs_commit(nvs);
-  }
-
-  nvs_close(nvs);
-
-  if (err == ESP_OK) {
-    g_volume_db = volume_db;
-    g_volume_loaded = true;
-    ESP_LOGI(TAG, "Saved volume: %.2f dB", volume_db);
-  } else {
-    ESP_LOGE(TAG, "Failed to save volume: %s", esp_err_to_name(err));
-  }
-
-  return err;
+  return ESP_OK;
 }
 
 esp_err_t settings_get_wifi_ssid(char *ssid, size_t len) {
@@ -246,6 +345,7 @@ esp_err_t settings_set_device_name(const char *name) {
   nvs_close(nvs);
 
   if (err == ESP_OK) {
+    g_device_name_revision++;
     ESP_LOGI(TAG, "Saved device name: %s", name);
   } else {
     ESP_LOGE(TAG, "Failed to save device name: %s", esp_err_to_name(err));
@@ -253,3 +353,93 @@ esp_err_t settings_set_device_name(const char *name) {
 
   return err;
 }
+
+uint32_t settings_get_device_name_revision(void) {
+  return g_device_name_revision;
+}
+
+#if CONFIG_AUDIO_EQ
+esp_err_t settings_get_eq(audio_eq_config_t *config) {
+  if (!config) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  // Not committed yet: the cache is newer than NVS
+  taskENTER_CRITICAL(&g_lock);
+  bool pending = g_dirty & DIRTY_EQ;
+  if (pending) {
+    *config = g_eq;
+  }
+  taskEXIT_CRITICAL(&g_lock);
+  if (pending) {
+    return ESP_OK;
+  }
+
+  nvs_handle_t nvs;
+  esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+  if (err != ESP_OK) {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  // Stored as the raw struct; a size mismatch means another band limit
+  size_t required_size = sizeof(*config);
+  err = nvs_get_blob(nvs, NVS_KEY_EQ, config, &required_size);
+  nvs_close(nvs);
+
+  if (err != ESP_OK || required_size != sizeof(*config)) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  return ESP_OK;
+}
+
+esp_err_t settings_set_eq(const audio_eq_config_t *config) {
+  if (!config) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  taskENTER_CRITICAL(&g_lock);
+  g_eq = *config;
+  taskEXIT_CRITICAL(&g_lock);
+  mark_dirty(DIRTY_EQ);
+  return ESP_OK;
+}
+#endif
+
+#if CONFIG_AUDIO_CHANNEL_SELECT
+esp_err_t settings_get_channel_mode(uint8_t *mode) {
+  if (!mode) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  nvs_handle_t nvs;
+  esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+  if (err != ESP_OK) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  err = nvs_get_u8(nvs, NVS_KEY_CHANNEL_MODE, mode);
+  nvs_close(nvs);
+  return err == ESP_OK ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t settings_set_channel_mode(uint8_t mode) {
+  nvs_handle_t nvs;
+  esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
+    return err;
+  }
+
+  err = nvs_set_u8(nvs, NVS_KEY_CHANNEL_MODE, mode);
+  if (err == ESP_OK) {
+    err = nvs_commit(nvs);
+  }
+  nvs_close(nvs);
+
+  if (err == ESP_OK) {
+    ESP_LOGI(TAG, "Saved channel mode: %u", mode);
+  } else {
+    ESP_LOGE(TAG, "Failed to save channel mode: %s", esp_err_to_name(err));
+  }
+  return err;
+}
+#endif
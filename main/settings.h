@@ -1,7 +1,12 @@
 #pragma once
 
 #include "esp_err.h"
+#include "sdkconfig.h"
 #include <stdbool.h>
+#include <stdint.h>
+#if CONFIG_AUDIO_EQ
+#include "audio_eq.h"
+#endif
 
 /**
  * Persistent settings storage (NVS)
@@ -23,7 +28,13 @@ esp_err_t settings_init(void);
 esp_err_t settings_get_volume(float *volume_db);
 
 /**
- * Save volume to persistent storage
+ * Flush pending changes to NVS now. Volume and EQ changes are otherwise
+ * committed a few seconds after they settle, and on esp_restart().
+ */
+void settings_flush(void);
+
+/**
+ * Save volume to persistent storage (written behind, see settings_flush())
  * @param volume_db Volume in dB (0 = max, -30 = mute)
  */
 esp_err_t settings_set_volume(float volume_db);
@@ -75,3 +86,38 @@ esp_err_t settings_get_device_name(char *name, size_t len);
  * @param name Device name
  */
 esp_err_t settings_set_device_name(const char *name);
+
+/**
+ * Counter bumped by every successful settings_set_device_name(), so copies
+ * derived from the name can be checked without reading NVS
+ */
+uint32_t settings_get_device_name_revision(void);
+
+#if CONFIG_AUDIO_EQ
+/**
+ * Get the saved equalizer configuration
+ * @param config Output: band list and preamp
+ * @return ESP_OK if found, ESP_ERR_NOT_FOUND if none (or saved by a build
+ *         with a different band limit)
+ */
+esp_err_t settings_get_eq(audio_eq_config_t *config);
+
+/**
+ * Save the equalizer configuration to persistent storage (written behind)
+ * @param config Band list and preamp
+ */
+esp_err_t settings_set_eq(const audio_eq_config_t *config);
+#endif
+
+#if CONFIG_AUDIO_CHANNEL_SELECT
+/**
+ * Get the saved channel-select mode (an audio_channel_mode_t)
+ * @return ESP_OK if found, ESP_ERR_NOT_FOUND if none saved
+ */
+esp_err_t settings_get_channel_mode(uint8_t *mode);
+
+/**
+ * Save the channel-select mode to persistent storage
+ */
+esp_err_t settings_set_channel_mode(uint8_t mode);
+#endif
@@ -0,0 +1,129 @@
+#include "task_placement.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/idf_additions.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "task_place";
+
+#if CONFIG_FREERTOS_UNICORE
+#define CORE(n) 0
+#else
+#define CORE(n) ((n) < 0 ? tskNO_AFFINITY : (BaseType_t)(n))
+#endif
+
+#define ENTRY(task_name, prefix)                         \
+  {                                                      \
+      .name = task_name,                                 \
+      .stack = CONFIG_TASK_##prefix##_STACK,             \
+      .priority = CONFIG_TASK_##prefix##_PRIORITY,       \
+      .core = CORE(CONFIG_TASK_##prefix##_CORE),         \
+      .psram_stack = CONFIG_TASK_##prefix##_PSRAM_STACK, \
+  }
+
+// Bool options that are off (or need PSRAM the build lacks) are undefined
+#ifndef CONFIG_TASK_AUDIO_RECV_PSRAM_STACK
+#define CONFIG_TASK_AUDIO_RECV_PSRAM_STACK 0
+#endif
+#ifndef CONFIG_TASK_AUDIO_CTRL_PSRAM_STACK
+#define CONFIG_TASK_AUDIO_CTRL_PSRAM_STACK 0
+#endif
+#ifndef CONFIG_TASK_AUDIO_DECODE_PSRAM_STACK
+#define CONFIG_TASK_AUDIO_DECODE_PSRAM_STACK 0
+#endif
+#ifndef CONFIG_TASK_AUDIO_PLAY_PSRAM_STACK
+#define CONFIG_TASK_AUDIO_PLAY_PSRAM_STACK 0
+#endif
+#ifndef CONFIG_TASK_AUDIO_BUFFERED_PSRAM_STACK
+#define CONFIG_TASK_AUDIO_BUFFERED_PSRAM_STACK 0
+#endif
+#ifndef CONFIG_TASK_EVENT_PORT_PSRAM_STACK
+#define CONFIG_TASK_EVENT_PORT_PSRAM_STACK 0
+#endif
+#ifndef CONFIG_TASK_PTP_PSRAM_STACK
+#define CONFIG_TASK_PTP_PSRAM_STACK 0
+#endif
+#ifndef CONFIG_TASK_NTP_PSRAM_STACK
+#define CONFIG_TASK_NTP_PSRAM_STACK 0
+#endif
+
+static const task_placement_t placements[TASK_PLACEMENT_COUNT] = {
+    [TASK_AUDIO_RECV] = ENTRY("audio_recv", AUDIO_RECV),
+    [TASK_AUDIO_CTRL] = ENTRY("ctrl_recv", AUDIO_CTRL),
+    [TASK_AUDIO_DECODE] = ENTRY("audio_dec", AUDIO_DECODE),
+    [TASK_AUDIO_PLAY] = ENTRY("audio_play", AUDIO_PLAY),
+    [TASK_AUDIO_BUFFERED] = ENTRY("buff_audio", AUDIO_BUFFERED),
+    [TASK_EVENT_PORT] = ENTRY("event_port", EVENT_PORT),
+    [TASK_PTP] = ENTRY("ptp_clock", PTP),
+    [TASK_NTP] = ENTRY("ntp_clock", NTP),
+};
+
+const task_placement_t *task_placement_get(task_placement_id_t id) {
+  return &placements[id < TASK_PLACEMENT_COUNT ? id : 0];
+}
+
+esp_err_t task_placement_spawn(task_placement_id_t id, TaskFunction_t fn,
+                               void *arg, TaskHandle_t *handle) {
+  const task_placement_t *p = task_placement_get(id);
+  BaseType_t ret;
+  if (p->psram_stack) {
+    ret = xTaskCreatePinnedToCoreWithCaps(fn, p->name, p->stack, arg,
+                                          p->priority, handle, p->core,
+                                          MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  } else {
+    ret = xTaskCreatePinnedToCore(fn, p->name, p->stack, arg, p->priority,
+                                  handle, p->core);
+  }
+  if (ret != pdPASS) {
+    ESP_LOGE(TAG, "Failed to create %s (%" PRIu32 " byte stack in %s)",
+             p->name, p->stack, p->psram_stack ? "PSRAM" : "internal RAM");
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+void task_placement_exit(task_placement_id_t id) {
+  if (task_placement_get(id)->psram_stack) {
+    vTaskDeleteWithCaps(NULL);
+  } else {
+    vTaskDelete(NULL);
+  }
+}
+
+void task_placement_log(void) {
+#if CONFIG_ESP_WIFI_TASK_PINNED_TO_CORE_1
+  int wifi_core = 1;
+#else
+  int wifi_core = 0;
+#endif
+#if CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU0
+  const char *tcpip = "0";
+#elif CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU1
+  const char *tcpip = "1";
+#else
+  const char *tcpip = "any";
+#endif
+  ESP_LOGI(TAG, "Task layout (%s): wifi core %d, tcpip core %s",
+#if CONFIG_TASK_LAYOUT_CUSTOM
+           "custom",
+#else
+           "recommended",
+#endif
+           wifi_core, tcpip);
+  for (int i = 0; i < TASK_PLACEMENT_COUNT; i++) {
+    const task_placement_t *p = &placements[i];
+    char core[4];
+    if (p->core == tskNO_AFFINITY) {
+      snprintf(core, sizeof(core), "any");
+    } else {
+      snprintf(core, sizeof(core), "%d", (int)p->core);
+    }
+    ESP_LOGI(TAG, "  %-10s core %-3s prio %2u stack %5" PRIu32 " %s", p->name,
+             core, (unsigned)p->priority, p->stack,
+             p->psram_stack ? "psram" : "internal");
+  }
+}
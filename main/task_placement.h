@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/**
+ * Core, priority and stack of the real-time tasks, in one table.
+ *
+ * The recommended layout keeps the network side (RTP receive, retransmits,
+ * the event port, PTP and NTP) on core 0 with the Wi-Fi driver and the
+ * lwIP task, and the CPU-heavy side (decoding, DSP and playout) on core 1.
+ * With CONFIG_TASK_LAYOUT_CUSTOM every entry comes from menuconfig so
+ * scheduling interference can be tuned per board. Single-core targets run
+ * everything on core 0.
+ */
+
+typedef enum {
+  TASK_AUDIO_RECV = 0, // RTP data receiver
+  TASK_AUDIO_CTRL,     // RTP control: retransmits and sync packets
+  TASK_AUDIO_DECODE,   // Realtime decode
+  TASK_AUDIO_PLAY,     // Playout, DSP and I2S
+  TASK_AUDIO_BUFFERED, // Buffered (TCP) stream receive and decode
+  TASK_EVENT_PORT,     // AirPlay 2 event channel
+  TASK_PTP,
+  TASK_NTP,
+  TASK_PLACEMENT_COUNT,
+} task_placement_id_t;
+
+typedef struct {
+  const char *name;    // Task name
+  uint32_t stack;      // Bytes
+  UBaseType_t priority;
+  BaseType_t core;     // 0, 1 or tskNO_AFFINITY
+  bool psram_stack;    // Stack in PSRAM instead of internal RAM
+} task_placement_t;
+
+/** The placement the given task is created with. */
+const task_placement_t *task_placement_get(task_placement_id_t id);
+
+/**
+ * Create a task with its table entry.
+ * Tasks created here end with task_placement_exit(), not vTaskDelete().
+ * @return ESP_ERR_NO_MEM if the task could not be created
+ */
+esp_err_t task_placement_spawn(task_placement_id_t id, TaskFunction_t fn,
+                               void *arg, TaskHandle_t *handle);
+
+/** Delete the calling task, created by task_placement_spawn(). */
+void task_placement_exit(task_placement_id_t id);
+
+/** Log the table and where the Wi-Fi and lwIP tasks run. */
+void task_placement_log(void);
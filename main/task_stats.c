@@ -0,0 +1,157 @@
+#include "task_stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+
+static const char *TAG = "task_stats";
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS &&                                 \
+    CONFIG_FREERTOS_USE_TRACE_FACILITY
+
+// Sampler state: only the esp_timer task touches these
+static TaskStatus_t status[TASK_STATS_MAX_TASKS];
+static TaskHandle_t prev_handle[TASK_STATS_MAX_TASKS];
+static configRUN_TIME_COUNTER_TYPE prev_runtime[TASK_STATS_MAX_TASKS];
+static UBaseType_t prev_count;
+static configRUN_TIME_COUNTER_TYPE prev_total;
+static task_stats_entry_t working[TASK_STATS_MAX_TASKS];
+
+// Last complete window, read by the web server
+static portMUX_TYPE result_lock = portMUX_INITIALIZER_UNLOCKED;
+static task_stats_entry_t result[TASK_STATS_MAX_TASKS];
+static size_t result_count;
+static uint32_t result_window_ms;
+
+static esp_timer_handle_t sample_timer = NULL;
+
+// Counter at the start of the window; 0 for a task created during it, which
+// then ran for all of its counter
+static configRUN_TIME_COUNTER_TYPE previous_runtime(TaskHandle_t handle) {
+  for (UBaseType_t i = 0; i < prev_count; i++) {
+    if (prev_handle[i] == handle) {
+      return prev_runtime[i];
+    }
+  }
+  return 0;
+}
+
+static int by_cpu_desc(const void *a, const void *b) {
+  const task_stats_entry_t *x = a;
+  const task_stats_entry_t *y = b;
+  return (int)y->cpu_permille - (int)x->cpu_permille;
+}
+
+static void sample(void *arg) {
+  (void)arg;
+  configRUN_TIME_COUNTER_TYPE total = 0;
+  UBaseType_t count =
+      uxTaskGetSystemState(status, TASK_STATS_MAX_TASKS, &total);
+  if (count == 0) {
+    ESP_LOGW(TAG, "More than %d tasks, not sampled", TASK_STATS_MAX_TASKS);
+    return;
+  }
+
+  // The run-time clock is esp_timer microseconds, shared by both cores
+  configRUN_TIME_COUNTER_TYPE window = total - prev_total;
+  bool first = prev_total == 0;
+  size_t n = 0;
+  for (UBaseType_t i = 0; i < count; i++) {
+    const TaskStatus_t *t = &status[i];
+    configRUN_TIME_COUNTER_TYPE ran =
+        t->ulRunTimeCounter - previous_runtime(t->xHandle);
+
+    task_stats_entry_t *e = &working[n++];
+    snprintf(e->name, sizeof(e->name), "%s", t->pcTaskName);
+    BaseType_t core = xTaskGetCoreID(t->xHandle);
+    e->core = core == tskNO_AFFINITY ? -1 : (int)core;
+    e->priority = (uint32_t)t->uxCurrentPriority;
+    e->stack_free_bytes = (uint32_t)t->usStackHighWaterMark;
+    uint64_t permille = window ? (uint64_t)ran * 1000 / window : 0;
+    e->cpu_permille = (uint16_t)(permille > 1000 ? 1000 : permille);
+  }
+
+  for (UBaseType_t i = 0; i < count; i++) {
+    prev_handle[i] = status[i].xHandle;
+    prev_runtime[i] = status[i].ulRunTimeCounter;
+  }
+  prev_count = count;
+  prev_total = total;
+  if (first) {
+    return; // Counters since boot, not a window
+  }
+
+  qsort(working, n, sizeof(working[0]), by_cpu_desc);
+
+#if CONFIG_TASK_STATS_LOG
+  for (size_t i = 0; i < n; i++) {
+    const task_stats_entry_t *e = &working[i];
+    ESP_LOGI(TAG, "task v1 %s core=%d prio=%u cpu=%u.%u stack_free=%u",
+             e->name, e->core, (unsigned)e->priority, e->cpu_permille / 10,
+             e->cpu_permille % 10, (unsigned)e->stack_free_bytes);
+  }
+#endif
+
+  portENTER_CRITICAL(&result_lock);
+  memcpy(result, working, n * sizeof(working[0]));
+  result_count = n;
+  result_window_ms = (uint32_t)(window / 1000);
+  portEXIT_CRITICAL(&result_lock);
+}
+
+esp_err_t task_stats_init(void) {
+  if (sample_timer) {
+    return ESP_OK;
+  }
+
+  const esp_timer_create_args_t timer_args = {
+      .callback = sample,
+      .name = "task_stats",
+  };
+  esp_err_t err = esp_timer_create(&timer_args, &sample_timer);
+  if (err != ESP_OK) {
+    return err;
+  }
+  sample(NULL); // Baseline for the first window
+  return esp_timer_start_periodic(
+      sample_timer, (uint64_t)CONFIG_TASK_STATS_PERIOD_S * 1000000);
+}
+
+size_t task_stats_get(task_stats_entry_t *entries, size_t max,
+                      uint32_t *window_ms) {
+  if (!entries) {
+    return 0;
+  }
+
+  portENTER_CRITICAL(&result_lock);
+  size_t n = result_count < max ? result_count : max;
+  memcpy(entries, result, n * sizeof(result[0]));
+  if (window_ms) {
+    *window_ms = result_window_ms;
+  }
+  portEXIT_CRITICAL(&result_lock);
+  return n;
+}
+
+#else
+
+esp_err_t task_stats_init(void) {
+  ESP_LOGW(TAG, "FreeRTOS run-time stats are disabled, no task report");
+  return ESP_OK;
+}
+
+size_t task_stats_get(task_stats_entry_t *entries, size_t max,
+                      uint32_t *window_ms) {
+  (void)entries;
+  (void)max;
+  if (window_ms) {
+    *window_ms = 0;
+  }
+  return 0;
+}
+
+#endif
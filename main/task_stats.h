@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+/**
+ * Per-task CPU load and stack headroom.
+ *
+ * Every CONFIG_TASK_STATS_PERIOD_S seconds the FreeRTOS run-time counters
+ * are sampled and each task's share of the window is worked out. A share
+ * is per core, so a task pinned to a saturated core reads 100. Optionally
+ * one line per task is logged in a fixed format, e.g.
+ *
+ *   task v1 audio_play core=1 prio=7 cpu=23.4 stack_free=1184
+ *
+ * and the last window is served on /api/tasks.
+ */
+
+#define TASK_STATS_MAX_TASKS 40
+
+typedef struct {
+  char name[configMAX_TASK_NAME_LEN];
+  int core;                  // -1 when not pinned
+  uint32_t priority;         // Current (possibly inherited) priority
+  uint32_t stack_free_bytes; // Lowest free stack since the task started
+  uint16_t cpu_permille;     // Share of one core over the last window
+} task_stats_entry_t;
+
+/** Start sampling. A no-op without run-time stats in the FreeRTOS config. */
+esp_err_t task_stats_init(void);
+
+/**
+ * Copy the last window's tasks, by descending CPU share.
+ * @param window_ms Output: length of that window (0 before the first one)
+ * @return Number of entries copied
+ */
+size_t task_stats_get(task_stats_entry_t *entries, size_t max,
+                      uint32_t *window_ms);
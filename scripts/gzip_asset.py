@@ -0,0 +1,19 @@
+#!/usr/bin/env python3
+"""Gzip a web asset for embedding, reproducibly (no name or timestamp)."""
+import gzip
+import sys
+
+
+def main() -> int:
+    if len(sys.argv) != 3:
+        print(f"usage: {sys.argv[0]} <input> <output.gz>", file=sys.stderr)
+        return 1
+    with open(sys.argv[1], "rb") as f:
+        data = f.read()
+    with open(sys.argv[2], "wb") as f:
+        f.write(gzip.compress(data, compresslevel=9, mtime=0))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())